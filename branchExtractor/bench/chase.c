@@ -0,0 +1,50 @@
+/* Pointer chasing for bench_overhead.sh: a linked list shuffled over
+   more memory than the caches hold, walked with a branch on each
+   node's value, so the program is bound by its loads.
+   ./chase [steps] */
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NODES (1 << 20)
+
+typedef struct node
+{
+  struct node *next;
+  unsigned value;
+} node_t;
+
+int main(int argc, char **argv)
+{
+  long steps = argc > 1 ? atol(argv[1]) : 5000000;
+  node_t *nodes = malloc(NODES * sizeof(node_t));
+  unsigned *order = malloc(NODES * sizeof(unsigned));
+  unsigned seed = 1;
+  for (unsigned i = 0; i < NODES; i++)
+    order[i] = i;
+  for (unsigned i = NODES - 1; i > 0; i--)
+  {
+    seed = seed * 1103515245 + 12345;
+    unsigned j = (seed >> 8) % (i + 1), t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+  for (unsigned i = 0; i < NODES; i++)
+  {
+    nodes[order[i]].next = &nodes[order[(i + 1) % NODES]];
+    nodes[order[i]].value = order[i] * 2654435761u;
+  }
+  node_t *p = &nodes[order[0]];
+  unsigned long sum = 0;
+  for (long s = 0; s < steps; s++)
+  {
+    if (p->value & 0x100)
+      sum += p->value;
+    else
+      sum -= p->value >> 3;
+    p = p->next;
+  }
+  printf("%lu\n", sum);
+  free(order);
+  free(nodes);
+  return 0;
+}
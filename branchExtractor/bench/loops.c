@@ -0,0 +1,65 @@
+/* Loop kernels for bench_overhead.sh: a branchy filter over random
+   data, a bubble pass, a small matrix product and a sieve, each with
+   the loop and data dependent branches of such code.
+   ./loops [rounds] */
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N 4096
+
+static unsigned data[N];
+static double a[64][64], b[64][64], c[64][64];
+static char composite[1 << 16];
+
+int main(int argc, char **argv)
+{
+  int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+  unsigned seed = 1, sum = 0;
+  for (int r = 0; r < rounds; r++)
+  {
+    for (int i = 0; i < N; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      data[i] = seed >> 16;
+    }
+    for (int i = 0; i < N; i++)
+    {
+      if (data[i] & 1)
+        sum += data[i];
+      else if (data[i] % 3 == 0)
+        sum ^= data[i];
+    }
+    for (int i = 0; i + 1 < N; i++)
+    {
+      if (data[i] > data[i + 1])
+      {
+        unsigned t = data[i];
+        data[i] = data[i + 1];
+        data[i + 1] = t;
+      }
+    }
+    for (int i = 0; i < 64; i++)
+      for (int j = 0; j < 64; j++)
+      {
+        a[i][j] = i + j + r;
+        b[i][j] = i - j;
+      }
+    for (int i = 0; i < 64; i++)
+      for (int j = 0; j < 64; j++)
+      {
+        double s = 0;
+        for (int k = 0; k < 64; k++)
+          s += a[i][k] * b[k][j];
+        c[i][j] = s;
+      }
+    for (int i = 2; i < (1 << 16); i++)
+      composite[i] = 0;
+    for (int i = 2; i * i < (1 << 16); i++)
+      if (!composite[i])
+        for (int j = i * i; j < (1 << 16); j += i)
+          composite[j] = 1;
+    sum += composite[r % (1 << 16)] + (unsigned)c[r % 64][r % 64];
+  }
+  printf("%u\n", sum);
+  return 0;
+}
@@ -0,0 +1,137 @@
+#!/bin/bash
+#
+# Extractor overhead benchmark: every program below runs natively,
+# then under branchExt.so in every mode, best of $RUNS each. It reports
+# the slowdown over the native run, the branches logged per second
+# and the bytes of output per branch logged.
+#
+#   loops   bench/loops.c: a branchy filter, a bubble pass, a matrix
+#           product and a sieve
+#   chase   bench/chase.c: a shuffled linked list walked with a branch
+#           on each node, bound by its loads
+#   cc1     the C++ compiler proper on ../src/calibrate.cpp at -O2,
+#           preprocessed first
+#
+#   text     -format text into a file
+#   bin      -format bin into a file, through the per-thread buffers
+#   bzip2    -format text through ../src/bpzip, as gen_trace.sh does
+#   zstd     -format bin through ../src/tobin --codec=zstd
+#   profile  -profile_only 1, the counts of <prefix>.prof
+#   sample   -sample_period windows of -sample_length branches
+#
+# The whole program is traced from its first instruction (-f 0, no
+# branch limit), without the instruction counts (-icount 0). The
+# branches logged are the records of the trace, as bpstat counts them,
+# or the executions in the profile. Each row is printed and written as
+# one JSON object to $OUT.
+#
+#   bench_overhead.sh
+#
+# RUNS (default 3), PROGRAMS and MODES (default all of the above),
+# SAMPLE_PERIOD (instructions, default 1000000), SAMPLE_LENGTH
+# (branches, default 10000) and OUT (default bench_overhead.json) come
+# from the environment. The programs and outputs are kept in $WORK.
+
+ROOT=$(dirname $(realpath -s $0))
+SRC=$ROOT/../src
+RUNS=${RUNS:-3}
+PROGRAMS=${PROGRAMS:-"loops chase cc1"}
+MODES=${MODES:-"text bin bzip2 zstd profile sample"}
+SAMPLE_PERIOD=${SAMPLE_PERIOD:-1000000}
+SAMPLE_LENGTH=${SAMPLE_LENGTH:-10000}
+OUT=${OUT:-bench_overhead.json}
+WORK=${WORK:-${TMPDIR:-/tmp}/bench_overhead}
+PIN="$ROOT/pin_tool/pin -t $ROOT/obj-intel64/branchExt.so"
+TOOL="-f 0 -l 18446744073709551615 -icount 0 -progress 0"
+
+mkdir -p $WORK || exit 2
+gcc -O2 -o $WORK/loops $ROOT/bench/loops.c || exit 2
+gcc -O2 -o $WORK/chase $ROOT/bench/chase.c || exit 2
+g++ -E -o $WORK/calibrate.ii $SRC/calibrate.cpp || exit 2
+CC1PLUS=$(g++ -print-prog-name=cc1plus)
+
+command_of() {
+  case $1 in
+    loops) echo $WORK/loops ;;
+    chase) echo $WORK/chase ;;
+    cc1)   echo $CC1PLUS -quiet -O2 $WORK/calibrate.ii -o /dev/null ;;
+  esac
+}
+
+# best <command...>: the fastest of $RUNS runs in microseconds, run in
+# $WORK/out with its outputs of the last run left there
+best() {
+  local fastest=
+  for r in $(seq $RUNS); do
+    rm -rf $WORK/out && mkdir $WORK/out
+    local start=$(date +%s%N)
+    (cd $WORK/out && eval "$@" > /dev/null 2>&1) || return 1
+    local t=$(( ($(date +%s%N) - start) / 1000 ))
+    [ -z "$fastest" ] || [ $t -lt $fastest ] && fastest=$t
+  done
+  echo $fastest
+}
+
+# run <mode> <program...>: the microseconds of the program under the
+# tool in that mode
+run() {
+  local mode=$1
+  shift
+  case $mode in
+    text)    best $PIN $TOOL -format text -- "$@" ;;
+    bin)     best $PIN $TOOL -format bin -- "$@" ;;
+    bzip2)   best "mkfifo branches_0.out && { $SRC/bpzip branches_0.out trace.bz2 & }" \
+                  "&& $PIN $TOOL -format text -- $* && wait && rm branches_0.out" ;;
+    zstd)    best "mkfifo branches_0.out && { $SRC/tobin --codec=zstd branches_0.out trace.bpz & }" \
+                  "&& $PIN $TOOL -format bin -- $* && wait && rm branches_0.out" ;;
+    profile) best $PIN $TOOL -profile_only 1 -- "$@" ;;
+    sample)  best $PIN $TOOL -format bin -sample_period $SAMPLE_PERIOD -sample_length $SAMPLE_LENGTH \
+                  -b 1000000 -- "$@" ;;
+  esac
+}
+
+# logged: the branches the last run logged and the bytes it wrote,
+# the trace or the profile
+logged() {
+  local branches=0 bytes=0
+  for f in $WORK/out/branches_*.out $WORK/out/trace.*; do
+    [ -e $f ] || continue
+    branches=$((branches + $($SRC/bpstat $f 2>/dev/null | awk '/^Records:/ { print $2 }')))
+    bytes=$((bytes + $(stat -c %s $f)))
+  done
+  for f in $WORK/out/*.prof; do
+    [ -e $f ] || continue
+    branches=$((branches + $(awk '!/^#/ { n += $2 } END { print n + 0 }' $f)))
+    bytes=$((bytes + $(stat -c %s $f)))
+  done
+  echo $branches $bytes
+}
+
+make -C $ROOT > /dev/null || exit 2
+make -C $SRC bpstat bpzip tobin > /dev/null || exit 2
+
+echo "[" > $OUT
+first=1
+printf "%-7s %-8s %10s %9s %14s %12s\n" program mode seconds slowdown "branches/s" "bytes/branch"
+for program in $PROGRAMS; do
+  cmd=$(command_of $program)
+  native=$(best $cmd) || { echo "$program failed natively" >&2; exit 1; }
+  native_seconds=$(awk -v n=$native 'BEGIN { printf "%.3f", n / 1e6 }')
+  printf "%-7s %-8s %10s\n" $program native $native_seconds
+  for mode in $MODES; do
+    t=$(run $mode $cmd) || { echo "$program failed under $mode" >&2; exit 1; }
+    read branches bytes <<< "$(logged)"
+    row=$(awk -v t=$t -v n=$native -v b=$branches -v s=$bytes 'BEGIN {
+      printf "%.3f %.2f %.0f %.3f", t / 1e6, t / n, b / (t / 1e6), b ? s / b : 0 }')
+    read seconds slowdown rate per <<< "$row"
+    printf "%-7s %-8s %10s %9sx %14s %12s\n" $program $mode $seconds $slowdown $rate $per
+    [ $first = 1 ] || echo "," >> $OUT
+    first=0
+    printf '  {"program": "%s", "mode": "%s", "native_seconds": %s, "seconds": %s, "slowdown": %s, ' \
+           $program $mode $native_seconds $seconds $slowdown >> $OUT
+    printf '"branches": %s, "branches_per_second": %s, "bytes": %s, "bytes_per_branch": %s}' \
+           $branches $rate $bytes $per >> $OUT
+  done
+done
+echo >> $OUT
+echo "]" >> $OUT
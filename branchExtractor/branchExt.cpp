@@ -44,7 +44,7 @@ END_LEGAL */
 */
 
 // T = 1, C = 1      ,  Call = 0      ,  Ret = 0   ,  Direct = 1
-// (T-N), (Con-Uncon), (Call-NotCall), (Ret-NotRet), (Direct-NotDirect), (first_inst_count_after_offset)
+// (T-N), (Con-Uncon), (Call-NotCall), (Ret-NotRet), (Direct-NotDirect)
 
 #include <stdlib.h>
 #include <cstdio>
@@ -55,38 +55,327 @@ END_LEGAL */
 #include <fstream>
 #include <cstdlib>
 #include <map>
+#include <new>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "pin.H"
 #include "instlib.H"
+#include "control_manager.H"
+// The simulator's predictors, for -predict. Pin's C library defines
+// STATIC, which predictor.h takes for the static predictor
+#undef STATIC
+#include "predictor.h"
+#include "shmring.h"
 
 using namespace std;
+using namespace CONTROLLER;
 
 #define axuliryFileName "generalInfo"
 std::map<ADDRINT, std::string> disAssemblyMap;
 
-static ADDRINT dl_debug_state_Addr = 0;
-static ADDRINT dl_debug_state_AddrEnd = 0;
-static BOOL justFoundDlDebugState = FALSE;
-
-ofstream OutFile;
-ofstream axuFile;
-// The running count of instructions is kept here
-// make it static to help the compiler optimize docount
-static UINT64 icount = 0;
-static UINT64 cbcount = 0;
-static UINT64 ubcount = 0;
-static UINT64 callcount = 0;
-static UINT64 retcount = 0;
+// Code filters, decided when an image loads. Each map holds address
+// ranges [low, high) by low: the images logged when a filter asks for
+// some only, the routines logged likewise, and the images and
+// routines excluded. Instructions outside them get no branch calls
+typedef std::map<ADDRINT, ADDRINT> RANGES;
+static RANGES keptImages;
+static RANGES keptRoutines;
+static RANGES skipped;
+static BOOL filterImages = FALSE;
+static BOOL filterRoutines = FALSE;
+
 static int64_t howManyBranch = 0;
 static UINT64 howManySet = 0;
-static UINT64 fileCounter = 0;
 static UINT64 offset_inst = 0;
-static UINT64 first_inst_count_after_offset = 0;
-static bool first_record = true;
-static bool record = false;
-static ostringstream filePrefix;
 
-static UINT64 CBCOUNT_LIMIT = 10000000;
-static UINT64 prev_cbcount = -1;
+// Fast-forward control. Until the controller's start event nothing but
+// its own triggers is instrumented; -f then counts from the start
+static CONTROL_MANAGER control;
+static BOOL roiActive = FALSE;
+
+// Pin attached to a running process (pin -pid): the trace ends when
+// any thread's does, since the first thread reported may sit idle,
+// and the process is always detached, never ended or kept under Pin
+static BOOL attached = FALSE;
+static BOOL detaching = FALSE; // a thread of the attached process ended the trace
+
+static UINT64 CBCOUNT_LIMIT = 10000000; // -l
+
+// Periodic sampling (-sample_period). Set k of a thread is a window
+// starting at instruction offset + k * samplePeriod and lasting
+// -sample_length conditional branches, or up to the next window. The
+// branches are instrumented only while some thread is in a window;
+// in between only the blocks are counted
+static UINT64 samplePeriod = 0;
+static INT32 windowsOpen = 0;
+
+// Tracing gates (-marker_begin, -marker_end, -toggle_signal). Every
+// trace is compiled in two versions: VERSION_TRACED, instrumented as
+// without them, and VERSION_GATED, which only counts the blocks. The
+// head of each trace switches to the version gateReg selects, so a
+// thread moves between them at its next trace without the code cache
+// being flushed. A marker call sets its own thread's gateReg; the
+// signal toggles every thread's, each taking it up at its next block.
+// Tracing starts gated
+#define VERSION_TRACED 0
+#define VERSION_GATED 1
+static bool gating = false;
+static BOOL gateClosed = FALSE; // of the process: threads start with it
+static REG gateReg;
+
+// Basic block vectors (-bbv), for SimPoint: every block gets an id
+// when first instrumented, and an inlined add counts the instructions
+// each thread runs in it. Every bbvInterval instructions the thread's
+// counts are written out as one line of its .bb file and cleared.
+// With -bbv the program runs on to its end under Pin once the trace
+// is done, counting blocks only
+#define BBV_MAX_BLOCKS (1 << 20)
+static UINT64 bbvInterval = 0;
+static std::map<ADDRINT, UINT32> bblIds;
+static UINT32 numBlocks = 0; // bblIds.size(), read by the threads
+static BOOL branchesDone = FALSE; // the first thread's trace is over
+
+// A branch in the trace buffer. The BRANCH_* bits of its instruction
+// are known when it is instrumented, only the direction is not
+#define BRANCH_CONDITIONAL 1
+#define BRANCH_CALL 2
+#define BRANCH_RET 4
+#define BRANCH_DIRECT 8
+#define BRANCH_RECORDED 16
+#define BRANCH_ID_SHIFT 8 // static id of the branch in the bits above
+#define BRANCH_ID_MAX (1u << (32 - BRANCH_ID_SHIFT))
+#define BRANCH_TEXT_MAX 36 // longest line of a record: two 10 character addresses, 5 flags, 7 separators
+
+struct BRANCH_RECORD
+{
+    ADDRINT pc;
+    ADDRINT target;
+    UINT32 taken;
+    UINT32 kind;
+    UINT64 icount; // instruction count of the thread through the branch's block, with -icount
+};
+
+// Everything about one application thread: its counts, its position
+// in the -f/-m/-b schedule, its buffer and its own output files, so
+// threads are traced independently and take no lock on the hot path.
+// Inlined code reaches it through a tool register; thread number 0,
+// the first to start, writes the files a single threaded program
+// always had, thread n writes <prefix>_t<n>_<set>.out
+struct THREAD_STATE
+{
+    // The running count of instructions is kept here, with the
+    // counts of the branches in the current set. Only the conditional
+    // ones are counted inline, for the limit; the writer counts the
+    // rest as it writes them
+    UINT64 icount;
+    UINT64 nextEvent;
+    UINT64 cbcount;
+    UINT64 ubcount;
+    UINT64 callcount;
+    UINT64 retcount;
+
+    UINT32 number;
+    UINT64 fileCounter;
+    UINT64 outSet;  // set of the open files, moved on by the writer
+    bool recording; // past the -f offset, and inside a window when sampling
+    bool inWindow;  // counted in windowsOpen
+    UINT64 windowStart; // instruction count the current window started at
+    bool gated;     // runs the VERSION_GATED code, or is about to
+    bool done;      // past its last set; its files are closed
+    BRANCH_RECORD *written; // buffer position written up to
+    ofstream OutFile;
+    char *segMap;       // -crash_safe: the trace file, mapped in place of OutFile
+    UINT64 segLen;      // bytes mapped, the file's size until it is closed
+    UINT64 segUsed;     // bytes written
+    int segFd;
+    ofstream axuFile;
+    ofstream icntFile;  // -icount: the records' instruction deltas
+    UINT64 icountLast;  // instruction count of the record before, or the set's start
+    UINT64 binRecords; // records in the current file
+    std::vector<bool> defined; // -format ids: static ids defined in the current file
+    UINT32 *bbv;        // -bbv: instructions by block id in the current interval
+    UINT64 bbvEnd;      // instruction count ending the interval
+    ofstream bbvFile;
+    std::vector<predictor_t *> predictors; // -predict: the thread's own, one per predictConfigs
+    std::vector<UINT64> mispredictions;      // of the current set, by predictor
+    std::vector<UINT64> totalMispredictions; // of the sets before it
+    UINT64 predicted;      // conditional branches of the current set
+    UINT64 totalPredicted;
+    UINT64 totalInstructions; // of the sets before it
+} __attribute__((aligned(64)));
+
+static REG stateReg;
+
+// -icount keeps a second running instruction count in a tool register,
+// added to by one inlined call per block along with icount, so that
+// the inlined fill of each record can store it. The writer turns the
+// counts into the delta from the record before, or from the start of
+// the set for its first record, and writes them as LEB128 varints
+// after the ICNT_MAGIC header of <trace>.icnt, one per record in the
+// order of the trace (see src/icount.h)
+#define ICNT_MAGIC "BPICNT1"
+static REG icountReg;
+static bool icountRecords = false;
+static TLS_KEY stateKey;
+static PIN_LOCK threadLock;
+static std::vector<THREAD_STATE *> threadStates;
+
+// -profile_only counts the executions and taken runs of each static
+// branch with one inlined add into a slot of its own, allocated when
+// the branch is first instrumented, as SimpleExamples/edgcnt.cpp
+// does. Nothing else is instrumented, not even the block counts, and
+// no trace is written: at exit <prefix>.prof lists every branch that
+// ran. The slots are shared by the threads and not locked, so counts
+// of a branch several threads run at once may lose an add
+#define PROFILE_CHUNK 4096 // slots allocated at once, never moved
+
+struct PROFILE_SLOT
+{
+    UINT64 execs;
+    UINT64 taken;
+};
+
+static bool profileOnly = false;
+static std::map<ADDRINT, PROFILE_SLOT *> profileSlots; // by PC
+static std::map<ADDRINT, UINT32> profileKinds;        // BRANCH_* bits by PC
+static PROFILE_SLOT *profileChunk = NULL;
+static UINT32 profileChunkUsed = PROFILE_CHUNK;
+
+// -format bin writes the packed binary trace that the simulator reads
+// natively (BPTRACE1 in src/trace.h): a header, then per branch the PC,
+// the target and one byte of the flags below, all little endian. The
+// header's record count is filled in as each file is closed, or after
+// each block with -crash_safe
+#define BIN_MAGIC "BPTRACE1"
+#define BIN_F_TAKEN 1
+#define BIN_F_CONDITION 2
+#define BIN_F_CALL 4
+#define BIN_F_RET 8
+#define BIN_F_DIRECT 16
+#define BIN_RECORD_SIZE 9
+
+struct BIN_HEADER
+{
+    char magic[8];
+    UINT32 version;
+    UINT32 recordSize;
+    UINT64 numRecords;
+} __attribute__((packed));
+
+// -format ids writes version 3 of the same format, which keeps the
+// static part of each branch out of its records: a record is the
+// 32 bit word (id << ID_SHIFT) | IDS_TAKEN, plus the target of an
+// indirect branch as an INT32 distance from the PC, or IDS_FAR and
+// the 64 bit target. The first record of an id in each file is
+// preceded by its definition, the word (id << ID_SHIFT) | IDS_DEFINE
+// and the 64 bit PC, the 64 bit direct target (or 0) and the flags
+// but TAKEN, so every file stands on its own and addresses are not
+// truncated as in the other formats. A run of the same record within a buffer is the
+// first one and the word (n << ID_SHIFT) | IDS_REPEAT for the n after
+// it. The whole table, with the disassembly, is also written to
+// <prefix>.tbl at the end
+#define BIN_VERSION_IDS 3
+#define IDS_TAKEN 1
+#define IDS_DEFINE 2
+#define IDS_REPEAT 3
+#define IDS_ID_SHIFT 2
+#define IDS_FAR ((INT32)0x80000000)
+#define IDS_RECORD_MAX 41 // a run, a definition and a far indirect record
+
+static bool binFormat = false; // bin or ids
+static bool idsFormat = false;
+
+// -crash_safe writes bin and ids trace files into a shared mapping of
+// the file, grown SEGMENT_BYTES at a time, in place of a stream. What
+// the writer copies there is in the page cache at once, and the
+// header's record count is stored after each block's bytes, so when
+// the program is killed and Fini never runs the file still reads as
+// the trace of every block written until then; readers ignore the
+// unused tail. src/bprecover trims it and writes the missing info
+// file. The .icnt file is flushed before each count
+#define SEGMENT_BYTES (64 << 20)
+static bool crashSafe = false;
+
+// Static ids by PC, assigned when a branch is first instrumented, and
+// the disassembly of each for the table
+static std::map<ADDRINT, UINT32> branchIds;
+
+static BUFFER_ID bufId;
+static PIN_LOCK outLock;
+static std::vector<char> textBuf;
+static std::vector<char> icntBuf;
+
+// Full blocks of the buffers are handed to an internal thread, which
+// formats and writes them, so the application threads do no output
+// and only wait when WRITE_QUEUE blocks are already queued. The queue
+// is a ring of writeCount blocks from writeHead; a block stays queued
+// while it is written, so an empty queue means everything is written.
+// The end of a set is queued as well, right after its last records:
+// the writer then writes the info file and moves to the next set's
+// files, so the thread goes on without waiting for the files
+#define WRITE_QUEUE 8
+
+// What the thread knows of a set as it ends; the writer has the rest
+struct SET_END
+{
+    UINT64 windowStart;
+    UINT64 instructions;
+    UINT64 cbcount;
+    UINT64 nextBase; // instruction count the next set's -icount deltas start from
+};
+
+struct WRITE_BLOCK
+{
+    THREAD_STATE *ts;
+    std::vector<BRANCH_RECORD> records;
+    bool rotate;  // no records, the set ends here
+    SET_END set;
+};
+
+static WRITE_BLOCK *writeQueue[WRITE_QUEUE];
+static int writeHead = 0;
+static int writeCount = 0;
+static bool writeStop = false; // the writer is stopping or gone
+static PIN_LOCK writeLock;
+static PIN_SEMAPHORE writeReady; // set while blocks are queued
+static PIN_SEMAPHORE writeDone;  // set by the writer after each block
+static PIN_THREAD_UID writerUid;
+static UINT64 recordsWritten = 0; // by FormatRecords, under outLock
+
+// Progress is printed to stderr by an internal thread every -progress
+// seconds, from counts kept anyway, read relaxed while they change
+static PIN_SEMAPHORE progressStop;
+static PIN_THREAD_UID progressUid;
+static BOOL progressRunning = FALSE;
+
+// -predict runs predictors on the records in place of the trace files:
+// the writer packs each block as -format bin would, which is the
+// batch layout of predictor_predict_batch, and runs it through every
+// predictor of the block's thread. Nothing is written but the info
+// files, with the mispredictions of each set, and the totals on
+// stderr at the end
+static std::vector<string> predictNames;
+static std::vector<predictor_config_t> predictConfigs;
+static_assert(sizeof(predictor_branch_t) == BIN_RECORD_SIZE, "a bin record is a predictor batch entry");
+
+// -shm publishes the first thread's records, packed as -format bin,
+// into the ring /dev/shm/<name> for predictor --shm=<name> to replay
+// live; the writer fills each slot in place and waits for the slowest
+// reader to release it, holding up the program once the queue is full
+static bool shmStream = false;
+static shm_ring_t *shmRing = NULL; // until the first thread finishes
+static_assert(SHM_RING_RECORD_SIZE == BIN_RECORD_SIZE, "a ring slot holds bin records");
+
+// -follow_child gives every process of the program its own files,
+// named <prefix>_<program>_<pid>_..., so a child does not write over
+// its parent's. A forked child is traced from the fork as a new
+// process would be, by the thread that forked; an exec'd program gets
+// a fresh copy of the tool when Pin follows it (pin -follow_execv),
+// after the process that exec'd has written its files out
+static string processTag; // "_<program>_<pid>" with -follow_child
 
 KNOB<string> KnobOutputFile(KNOB_MODE_WRITEONCE, "pintool", "o", "branches", "specifies the output file name prefix.");
 
@@ -95,432 +384,1565 @@ KNOB<string> KnobHowManySet(KNOB_MODE_WRITEONCE, "pintool", "b", "1", "Specifies
 KNOB<string> KnobHowManyBranch(KNOB_MODE_WRITEONCE, "pintool", "m", "-1", "Specifies how many instructions should be probed. -1 for probing whole program.");
 
 KNOB<string> KnobOffset(KNOB_MODE_WRITEONCE, "pintool", "f", "20000000", "Starts saving instructions after seeing the first `f` instruction.");
+
+KNOB<string> KnobFormat(KNOB_MODE_WRITEONCE, "pintool", "format", "text", "Output format: text, bin for the simulator's binary trace, or ids for it with a static branch table.");
+
+KNOB<UINT64> KnobBranchLimit(KNOB_MODE_WRITEONCE, "pintool", "l", "10000000", "Ends a thread's trace after this many conditional branches.");
+
+KNOB<BOOL> KnobDetach(KNOB_MODE_WRITEONCE, "pintool", "detach", "1", "Once the first thread's trace ends, detach and let the program run on natively; 0 ends the program instead, unless Pin attached to it.");
+
+KNOB<UINT64> KnobSamplePeriod(KNOB_MODE_WRITEONCE, "pintool", "sample_period", "0", "Records a window every this many instructions from -f, one set each, in place of -m; 0 records one stretch.");
+
+KNOB<UINT64> KnobSampleLength(KNOB_MODE_WRITEONCE, "pintool", "sample_length", "1000000", "Conditional branches of each -sample_period window, in place of -l.");
+
+KNOB<UINT64> KnobBbv(KNOB_MODE_WRITEONCE, "pintool", "bbv", "0", "Writes the basic block vector of every this many instructions to <prefix>.bb, for SimPoint; 0 for none.");
+
+KNOB<BOOL> KnobOnlyMainImage(KNOB_MODE_WRITEONCE, "pintool", "only_main_image", "0", "Only logs the branches of the program's executable, not of its libraries or the loader.");
+
+KNOB<string> KnobImage(KNOB_MODE_APPEND, "pintool", "img", "", "Only logs the branches of images whose name contains this; may be repeated.");
+
+KNOB<string> KnobExcludeImage(KNOB_MODE_APPEND, "pintool", "exclude_img", "", "Does not log the branches of images whose name contains this, e.g. libc; may be repeated.");
+
+KNOB<string> KnobRoutine(KNOB_MODE_APPEND, "pintool", "rtn", "", "Only logs the branches of the routines of this name; may be repeated.");
+
+KNOB<string> KnobExcludeRoutine(KNOB_MODE_APPEND, "pintool", "exclude_rtn", "", "Does not log the branches of the routines of this name; may be repeated.");
+
+KNOB<UINT32> KnobProgress(KNOB_MODE_WRITEONCE, "pintool", "progress", "1", "Seconds between the instructions/s and branches/s reports on stderr; 0 for none.");
+
+KNOB<string> KnobPredict(KNOB_MODE_APPEND, "pintool", "predict", "", "Runs this predictor on the branches instead of writing a trace, e.g. gshare or tournament:lhtBits=12; may be repeated.");
+
+KNOB<string> KnobShm(KNOB_MODE_WRITEONCE, "pintool", "shm", "", "Streams the first thread's branches to predictor --shm=<name> through /dev/shm/<name> instead of writing a trace.");
+
+KNOB<UINT32> KnobShmReaders(KNOB_MODE_WRITEONCE, "pintool", "shm_readers", "1", "Readers of the -shm ring; the program waits until all of them attach.");
+
+KNOB<BOOL> KnobIcount(KNOB_MODE_WRITEONCE, "pintool", "icount", "1", "Writes the instructions up to each branch since the one before to <trace>.icnt, one varint per record, for the simulator's MPKI; 0 for none.");
+
+KNOB<BOOL> KnobProfileOnly(KNOB_MODE_WRITEONCE, "pintool", "profile_only", "0", "Only counts the executions and taken runs of every branch, written to <prefix>.prof at exit, instead of tracing.");
+
+KNOB<BOOL> KnobFollowChild(KNOB_MODE_WRITEONCE, "pintool", "follow_child", "0", "Traces forked children and, with pin -follow_execv, exec'd programs, each process into files named with its program and pid.");
+
+KNOB<string> KnobMarkerBegin(KNOB_MODE_WRITEONCE, "pintool", "marker_begin", "", "Traces a thread's branches from its calls of this function on, e.g. __bp_trace_begin; until then, and after -marker_end, only its instructions are counted.");
+
+KNOB<string> KnobMarkerEnd(KNOB_MODE_WRITEONCE, "pintool", "marker_end", "", "Stops tracing a thread's branches at its calls of this function, e.g. __bp_trace_end.");
+
+KNOB<UINT32> KnobToggleSignal(KNOB_MODE_WRITEONCE, "pintool", "toggle_signal", "0", "Turns the tracing of every thread on and off each time the process gets this signal, e.g. 10 for SIGUSR1; it starts off. 0 for none.");
+
+KNOB<BOOL> KnobCrashSafe(KNOB_MODE_WRITEONCE, "pintool", "crash_safe", "1", "With -format bin or ids, writes each trace file through a shared mapping whose header counts the records after every block, so the trace of a killed program is readable up to its last block written; see src/bprecover. 0 writes through a stream.");
+
+KNOB<BOOL> KnobImageMap(KNOB_MODE_WRITEONCE, "pintool", "image_map", "1", "Writes the address range, load offset, build ID and path of every image loaded to <prefix>.imgmap, for src/bpsym; 0 for none.");
+
+KNOB<UINT32> KnobNumPagesInBuffer(KNOB_MODE_WRITEONCE, "pintool", "num_pages_in_buffer", "256", "number of 4096 byte pages of each thread's branch buffer");
 // KNOB<string> KnobOffset(KNOB_MODE_WRITEONCE, "pintool", "f", "0", "Starts saving instructions after seeing the first `f` instruction.");
 
-VOID write_on_axu()
+static VOID DrainWrites();
+
+// The thread's counts of the set ending now, once fileCounter has moved
+// past it
+static SET_END EndOfSet(THREAD_STATE *ts)
 {
-    axuFile << "!!! Number of Instructions = " << (icount - offset_inst - ((fileCounter - 1) * howManyBranch) + 1) << endl;
-    axuFile << "!!! Number of Unconditional branches = " << ubcount << endl;
-    axuFile << "!!! Number of Conditional branches = " << cbcount << endl;
-    axuFile << "!!! Number of Call branches = " << callcount << endl;
-    axuFile << "!!! Number of Ret branches = " << retcount << endl;
+    SET_END set;
+    set.windowStart = ts->windowStart;
+    if (samplePeriod)
+        set.instructions = ts->icount - ts->windowStart + 1;
+    else
+        set.instructions = ts->icount - offset_inst - ((ts->fileCounter - 1) * howManyBranch) + 1;
+    set.cbcount = ts->cbcount;
+    return set;
+}
+
+// The counts of the set 'set', once the writer has counted its records
+VOID write_on_axu(THREAD_STATE *ts, const SET_END &set)
+{
+    ofstream &axuFile = ts->axuFile;
+    UINT64 instructions = set.instructions;
+    if (samplePeriod)
+        axuFile << "!!! Window start instruction = " << set.windowStart << endl;
+    axuFile << "!!! Number of Instructions = " << instructions << endl;
+    axuFile << "!!! Number of Unconditional branches = " << ts->ubcount << endl;
+    axuFile << "!!! Number of Conditional branches = " << set.cbcount << endl;
+    axuFile << "!!! Number of Call branches = " << ts->callcount << endl;
+    axuFile << "!!! Number of Ret branches = " << ts->retcount << endl;
+    for (size_t i = 0; i < ts->predictors.size(); i++)
+    {
+        axuFile << "!!! " << predictNames[i] << " mispredictions = " << ts->mispredictions[i] << endl;
+        ts->totalMispredictions[i] += ts->mispredictions[i];
+    }
+    if (!ts->predictors.empty())
+    {
+        ts->totalPredicted += ts->predicted;
+        ts->totalInstructions += instructions;
+    }
 
     axuFile.close();
 }
 
+// The name of file 'base' of the thread's current set
+static string FileName(THREAD_STATE *ts, const string &base)
+{
+    ostringstream filePrefix;
+    filePrefix << base << processTag << "_";
+    if (ts->number)
+        filePrefix << "t" << ts->number << "_";
+    filePrefix << ts->outSet << ".out";
+    return filePrefix.str();
+}
+
+// Map the thread's trace file with 'len' bytes
+static bool SegmentMap(THREAD_STATE *ts, UINT64 len)
+{
+    if (ts->segMap)
+        munmap(ts->segMap, ts->segLen);
+    ts->segMap = NULL;
+    if (ftruncate(ts->segFd, len))
+        return false;
+    void *m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, ts->segFd, 0);
+    if (m == MAP_FAILED)
+        return false;
+    ts->segMap = static_cast<char *>(m);
+    ts->segLen = len;
+    return true;
+}
+
+// Append 'n' bytes to the mapped trace file, growing it as needed
+static VOID SegmentWrite(THREAD_STATE *ts, const char *data, size_t n)
+{
+    if (ts->segUsed + n > ts->segLen &&
+        !SegmentMap(ts, (ts->segUsed + n + SEGMENT_BYTES - 1) / SEGMENT_BYTES * SEGMENT_BYTES))
+    {
+        cerr << "Error: could not grow the trace file to " << ts->segUsed + n << " bytes" << endl;
+        PIN_ExitProcess(1);
+    }
+    memcpy(ts->segMap + ts->segUsed, data, n);
+    ts->segUsed += n;
+}
+
+// Store the records written so far in the header, after their bytes
+static VOID SegmentCommit(THREAD_STATE *ts)
+{
+    UINT64 *count = reinterpret_cast<UINT64 *>(ts->segMap + offsetof(BIN_HEADER, numRecords));
+    __atomic_store_n(count, ts->binRecords, __ATOMIC_RELEASE);
+}
+
+// Unmap the trace file; closed by the thread that opened it, it is
+// cut to the bytes written
+static VOID SegmentClose(THREAD_STATE *ts, bool trim)
+{
+    munmap(ts->segMap, ts->segLen);
+    ts->segMap = NULL;
+    if (trim && ftruncate(ts->segFd, ts->segUsed))
+        cerr << "Warning: could not trim the trace file to " << ts->segUsed << " bytes" << endl;
+    close(ts->segFd);
+}
+
+// Open the trace and info files of the thread's current set, only
+// the info file with -predict
+VOID OpenFiles(THREAD_STATE *ts)
+{
+    // Each set gets fresh streams: Pin's libc++ reopens a closed one
+    // unbuffered, writing it a character at a time
+    ofstream &OutFile = ts->OutFile;
+    bool trace = predictConfigs.empty() && !shmStream;
+    if (trace && binFormat)
+    {
+        BIN_HEADER hdr;
+        memcpy(hdr.magic, BIN_MAGIC, sizeof(hdr.magic));
+        hdr.version = idsFormat ? BIN_VERSION_IDS : 1;
+        hdr.recordSize = idsFormat ? 0 : BIN_RECORD_SIZE;
+        hdr.numRecords = 0;
+        // A named pipe, gen_trace.sh's into bpzip or tobin, can not be
+        // mapped and is written through the stream
+        string name = FileName(ts, KnobOutputFile.Value());
+        struct stat st;
+        if (crashSafe && (stat(name.c_str(), &st) || S_ISREG(st.st_mode)))
+        {
+            ts->segFd = open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (ts->segFd < 0 || !SegmentMap(ts, SEGMENT_BYTES))
+            {
+                cerr << "Error: could not map the trace file " << name << endl;
+                PIN_ExitProcess(1);
+            }
+            ts->segUsed = 0;
+            SegmentWrite(ts, reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+        }
+        else
+        {
+            OutFile = ofstream(name.c_str(), ios::binary);
+            OutFile.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+        }
+        ts->binRecords = 0;
+        ts->defined.assign(ts->defined.size(), false);
+    }
+    else if (trace)
+    {
+        OutFile = ofstream(FileName(ts, KnobOutputFile.Value()).c_str());
+        OutFile.setf(ios::showbase);
+    }
+    if (trace && icountRecords)
+    {
+        ts->icntFile = ofstream((FileName(ts, KnobOutputFile.Value()) + ".icnt").c_str(), ios::binary);
+        ts->icntFile.write(ICNT_MAGIC, sizeof(ICNT_MAGIC));
+    }
+
+    ts->axuFile = ofstream(FileName(ts, axuliryFileName).c_str());
+    ts->axuFile.setf(ios::showbase);
+}
+
+VOID CloseOutFile(THREAD_STATE *ts)
+{
+    if (ts->icntFile.is_open())
+        ts->icntFile.close();
+    if (ts->segMap)
+    {
+        SegmentCommit(ts);
+        SegmentClose(ts, true);
+        return;
+    }
+    if (!ts->OutFile.is_open())
+        return;
+    if (binFormat)
+    {
+        ts->OutFile.seekp(offsetof(BIN_HEADER, numRecords));
+        ts->OutFile.write(reinterpret_cast<const char *>(&ts->binRecords), sizeof(ts->binRecords));
+    }
+    ts->OutFile.close();
+}
+
+static VOID UpdateNextEvent(THREAD_STATE *ts);
+
+// Write the thread's block counts of the interval as a line of its .bb
+// file, "T" and ":<id>:<instructions>" for every block it ran, with
+// the ids from 1, and clear them
+static VOID WriteBbv(THREAD_STATE *ts)
+{
+    UINT32 blocks = __atomic_load_n(&numBlocks, __ATOMIC_RELAXED);
+    ofstream &out = ts->bbvFile;
+    out << "T";
+    for (UINT32 id = 0; id < blocks; id++)
+    {
+        if (!ts->bbv[id])
+            continue;
+        out << ":" << id + 1 << ":" << ts->bbv[id] << " ";
+        ts->bbv[id] = 0;
+    }
+    out << "\n";
+}
+
+// Write the last, partial, interval of the thread and close its file
+static VOID FinishBbv(THREAD_STATE *ts)
+{
+    if (!ts->bbv)
+        return;
+    UINT32 blocks = __atomic_load_n(&numBlocks, __ATOMIC_RELAXED);
+    UINT32 id = 0;
+    while (id < blocks && !ts->bbv[id])
+        id++;
+    if (id < blocks)
+        WriteBbv(ts);
+    ts->bbvFile.close();
+    delete[] ts->bbv;
+    ts->bbv = NULL;
+}
+
+// Write the thread's last set out; nothing more is recorded for it
+static VOID FinishThread(THREAD_STATE *ts)
+{
+    if (ts->done)
+        return;
+    ts->done = true;
+    if (ts->inWindow)
+    {
+        // the branches stay instrumented, if only for other threads
+        ts->inWindow = false;
+        __atomic_sub_fetch(&windowsOpen, 1, __ATOMIC_RELAXED);
+    }
+    UpdateNextEvent(ts);
+    DrainWrites();
+    write_on_axu(ts, EndOfSet(ts));
+    CloseOutFile(ts);
+    for (size_t i = 0; i < ts->predictors.size(); i++)
+        predictor_destroy(ts->predictors[i]);
+    ts->predictors.clear();
+    if (!ts->number)
+    {
+        // the readers see the end of the stream
+        shm_ring_finish(shmRing);
+        shmRing = NULL;
+    }
+}
+
+// The -predict totals of every thread's sets, on stderr since the
+// application may have closed stdout
+static VOID PrintPredictions()
+{
+    string who = processTag.empty() ? "" : processTag.substr(1) + " ";
+    for (size_t t = 0; t < threadStates.size(); t++)
+    {
+        THREAD_STATE *ts = threadStates[t];
+        for (size_t i = 0; i < ts->totalMispredictions.size(); i++)
+        {
+            UINT64 misses = ts->totalMispredictions[i];
+            char line[256];
+            snprintf(line, sizeof(line), "%s%s: %llu conditional branches, %llu incorrect, rate %.3f, MPKI %.3f",
+                     (who + (ts->number ? "Thread " + decstr(ts->number) + " " : "")).c_str(), predictNames[i].c_str(),
+                     (unsigned long long)ts->totalPredicted, (unsigned long long)misses,
+                     ts->totalPredicted ? 1000.0 * misses / ts->totalPredicted : 0.0,
+                     ts->totalInstructions ? 1000.0 * misses / ts->totalInstructions : 0.0);
+            cerr << line << endl;
+        }
+    }
+}
+
+// Write the static branch table of -format ids to <prefix>.tbl: per
+// branch its id, PC, the static flags in the column order of the text
+// trace (Conditional, Call, Ret, Direct) and its disassembly
+static VOID WriteBranchTable()
+{
+    ofstream tbl((KnobOutputFile.Value() + processTag + ".tbl").c_str());
+    tbl.setf(ios::showbase);
+    for (std::map<ADDRINT, UINT32>::const_iterator it = branchIds.begin(); it != branchIds.end(); ++it)
+    {
+        UINT32 kind = it->second;
+        tbl << (kind >> BRANCH_ID_SHIFT) << "\t" << hex << it->first << dec
+            << "\t" << ((kind & BRANCH_CONDITIONAL) != 0) << "\t" << ((kind & BRANCH_CALL) != 0)
+            << "\t" << ((kind & BRANCH_RET) != 0) << "\t" << ((kind & BRANCH_DIRECT) != 0)
+            << "\t" << disAssemblyMap[it->first] << endl;
+    }
+}
+
+// Write the -profile_only counts to <prefix>.prof: per branch that
+// ran its PC, executions, taken runs, the static flags in the column
+// order of the text trace (Conditional, Call, Ret, Direct) and its
+// disassembly, by PC
+static VOID WriteProfile()
+{
+    ofstream prof((KnobOutputFile.Value() + processTag + ".prof").c_str());
+    prof.setf(ios::showbase);
+    prof << "# pc\texecutions\ttaken\tconditional\tcall\tret\tdirect\tinstruction" << endl;
+    for (std::map<ADDRINT, PROFILE_SLOT *>::const_iterator it = profileSlots.begin(); it != profileSlots.end(); ++it)
+    {
+        const PROFILE_SLOT *slot = it->second;
+        if (!slot->execs)
+            continue;
+        UINT32 kind = profileKinds[it->first];
+        prof << hex << it->first << dec << "\t" << slot->execs << "\t" << slot->taken
+             << "\t" << ((kind & BRANCH_CONDITIONAL) != 0) << "\t" << ((kind & BRANCH_CALL) != 0)
+             << "\t" << ((kind & BRANCH_RET) != 0) << "\t" << ((kind & BRANCH_DIRECT) != 0)
+             << "\t" << disAssemblyMap[it->first] << "\n";
+    }
+}
+
 VOID Fini(INT32 code, VOID *v)
 {
     // Write to a file since cout and cerr maybe closed by the application
     cout << "Logging data..." << endl;
-    write_on_axu();
-    OutFile.close();
+    if (profileOnly)
+    {
+        WriteProfile();
+        return;
+    }
+    PIN_GetLock(&threadLock, 1);
+    for (size_t i = 0; i < threadStates.size(); i++)
+    {
+        FinishThread(threadStates[i]);
+        FinishBbv(threadStates[i]);
+    }
+    PrintPredictions();
+    PIN_ReleaseLock(&threadLock);
+    if (idsFormat)
+        WriteBranchTable();
 }
 
-VOID reset_var()
+static VOID StopWriter(VOID *v);
+static VOID StopProgress(VOID *v);
+
+// Pin is about to detach: the other threads are finished as at exit,
+// and the internal threads stopped since they end with Pin
+static VOID Detach(VOID *v)
 {
-    cbcount = 0;
-    ubcount = 0;
-    callcount = 0;
-    retcount = 0;
-    first_inst_count_after_offset = 0;
+    Fini(0, v);
+    StopWriter(v);
+    StopProgress(v);
 }
 
-UINT32 file_init()
+// Clear the writer's counts of the set
+VOID reset_var(THREAD_STATE *ts)
 {
-    cout << "Writing " << fileCounter - 1 << endl;
+    ts->ubcount = 0;
+    ts->callcount = 0;
+    ts->retcount = 0;
+    ts->predicted = 0;
+    ts->mispredictions.assign(ts->predictors.size(), 0);
+}
 
-    write_on_axu();
+// The writer's end of a set: its info, then the next set's files
+static VOID RotateFiles(THREAD_STATE *ts, const SET_END &set)
+{
+    write_on_axu(ts, set);
+    CloseOutFile(ts);
+    ts->outSet++;
+    OpenFiles(ts);
+    reset_var(ts);
+    ts->icountLast = set.nextBase;
+}
 
-    OutFile.close();
-    filePrefix.str("");
-    filePrefix.clear();
-    filePrefix << KnobOutputFile.Value() << "_" << fileCounter << ".out";
-    OutFile.open(filePrefix.str().c_str());
-    OutFile.setf(ios::showbase);
+static VOID QueueBlock(WRITE_BLOCK *block);
+static UINT64 RecordPoint(THREAD_STATE *ts);
 
-    filePrefix.str("");
-    filePrefix.clear();
-    filePrefix << axuliryFileName << "_" << fileCounter << ".out";
-    axuFile.open(filePrefix.str().c_str());
-    axuFile.setf(ios::showbase);
+// End the set of the thread, which goes on with the next one while the
+// writer moves to its files
+UINT32 file_init(THREAD_STATE *ts)
+{
+    if (ts->number)
+        cout << "Thread " << ts->number << ": ";
+    cout << "Writing " << ts->fileCounter - 1 << endl;
+
+    WRITE_BLOCK *block = new WRITE_BLOCK;
+    block->ts = ts;
+    block->rotate = true;
+    block->set = EndOfSet(ts);
+    // the next set starts after the split, or with the next window
+    block->set.nextBase = samplePeriod ? RecordPoint(ts) - 1 : ts->icount;
+    QueueBlock(block);
 
-    reset_var();
+    ts->cbcount = 0;
 
     return 0;
 }
 
-// This function is called before every instruction is executed
-VOID docount()
+static VOID FlushBuffer(THREAD_STATE *ts, CONTEXT *ctxt);
+
+// Instructions are counted a whole basic block at a time, so nothing
+// runs per instruction. Whatever has to happen at a given instruction
+// count of a thread (the start of its recording, a split, the branch
+// limit) is an "event": the count it is due at is kept in nextEvent,
+// and a block running past it calls BblEvent, which finds where in the
+// block it falls
+
+// Whether the sets are split by instruction count, every -m
+// instructions or at the start of the next window
+static BOOL Splitting()
+{
+    return samplePeriod || howManyBranch > 0;
+}
+
+// The instruction count at which the thread moves to its next file,
+// once every howManyBranch instructions (-m), or -sample_period
+static UINT64 SplitPoint(THREAD_STATE *ts)
+{
+    if (samplePeriod)
+        return samplePeriod * (ts->fileCounter + 1) + offset_inst - 1;
+    return howManyBranch * (ts->fileCounter + 1) + offset_inst - 1;
+}
+
+// The instruction count at which recording starts: the -f offset, or
+// the start of the thread's next window
+static UINT64 RecordPoint(THREAD_STATE *ts)
+{
+    return offset_inst + samplePeriod * ts->fileCounter;
+}
+
+// The count of the next event of the trace itself
+static UINT64 NextTraceEvent(THREAD_STATE *ts)
+{
+    if (ts->done)
+        return ~(UINT64)0;
+    if (!ts->recording)
+        return RecordPoint(ts) ? RecordPoint(ts) - 1 : 0;
+    if (ts->cbcount >= CBCOUNT_LIMIT)
+        return 0;
+    return Splitting() ? SplitPoint(ts) : ~(UINT64)0;
+}
+
+// The next event of the trace or the end of the -bbv interval
+static VOID UpdateNextEvent(THREAD_STATE *ts)
+{
+    ts->nextEvent = NextTraceEvent(ts);
+    if (ts->bbv && ts->bbvEnd - 1 < ts->nextEvent)
+        ts->nextEvent = ts->bbvEnd - 1;
+}
+
+// Stop tracing the thread: the whole program for its first thread, or
+// for any thread once attached, or just this one. The program then
+// runs on natively after detaching (-detach), or ends as a single
+// threaded trace always did
+static VOID EndThread(THREAD_STATE *ts, const char *reason)
 {
-    // cerr<< "I:" << icount << "V:" << (howManyBranch+ offset_inst - 1) << (!((icount) % (howManyBranch+ offset_inst - 1))? "Tr":"Fa") << endl;
-    if (howManyBranch > 0)
+    if (ts->number && !attached)
     {
-        if (!((icount) % ((howManyBranch * (fileCounter + 1)) + offset_inst - 1)) && icount > 0)
-        {
-            fileCounter++;
-            if (fileCounter > howManySet - 1)
-            {
-                cout << "Exiting because of user conditions" << endl;
-                Fini(0, 0);
-                exit(0);
-            }
-            else
-            {
-                file_init();
-            }
-        }
+        cout << "Thread " << ts->number << " done because of " << reason << endl;
+        FinishThread(ts);
+        return;
     }
+    FinishThread(ts);
+    if (attached && __atomic_exchange_n(&detaching, TRUE, __ATOMIC_RELAXED))
+        return;
+    if (bbvInterval && !attached)
+    {
+        // the other threads finish themselves at their next block, then
+        // only the blocks are counted
+        cout << "Counting blocks on, the trace is done because of " << reason << endl;
+        branchesDone = TRUE;
+        PIN_GetLock(&threadLock, 1);
+        for (size_t i = 0; i < threadStates.size(); i++)
+            threadStates[i]->nextEvent = 0;
+        PIN_ReleaseLock(&threadLock);
+        UpdateNextEvent(ts);
+        PIN_RemoveInstrumentation();
+        return;
+    }
+    if (KnobDetach || attached)
+    {
+        cout << "Detaching because of " << reason << endl;
+        PIN_RemoveFiniFunctions();
+        PIN_Detach(); // Detach finishes the other threads
+        return;
+    }
+    cout << "Exiting because of " << reason << endl;
+    PIN_ExitApplication(0); // Fini finishes the other threads
+}
 
-    icount++;
+// Move to the next file with the count at 'at', ending after the last set
+static VOID Split(THREAD_STATE *ts, CONTEXT *ctxt, UINT64 at)
+{
+    UINT64 end = ts->icount;
+    ts->icount = at;
+    FlushBuffer(ts, ctxt);
+    ts->fileCounter++;
+    if (ts->fileCounter > howManySet - 1)
+        EndThread(ts, "user conditions");
+    else
+        file_init(ts);
+    ts->windowStart = at + 1;
+    ts->icount = end;
+}
 
-    if (cbcount != prev_cbcount && cbcount % 10000 == 0)
-        cout << icount << " "<< cbcount << endl;
-    prev_cbcount = cbcount;
+// The thread enters or leaves a window. The branches are instrumented
+// again when the first window opens and after the last one closes
+//
+// Returns True if the instrumentation changes
+//
+static BOOL SetWindow(THREAD_STATE *ts, bool open)
+{
+    if (ts->inWindow == open)
+        return FALSE;
+    ts->inWindow = open;
+    INT32 n = __atomic_add_fetch(&windowsOpen, open ? 1 : -1, __ATOMIC_RELAXED);
+    if (n != (open ? 1 : 0))
+        return FALSE;
+    PIN_RemoveInstrumentation();
+    return TRUE;
+}
+
+// Close the thread's window with the count at 'at': its set is done,
+// and nothing is recorded until the next one
+static VOID CloseWindow(THREAD_STATE *ts, CONTEXT *ctxt, UINT64 at)
+{
+    UINT64 end = ts->icount;
+    ts->icount = at;
+    FlushBuffer(ts, ctxt);
+    ts->fileCounter++;
+    if (ts->fileCounter > howManySet - 1)
+        EndThread(ts, "user conditions");
+    else
+        file_init(ts);
+    ts->recording = false;
+    SetWindow(ts, false);
+    ts->icount = end;
+}
 
-    if (cbcount >= CBCOUNT_LIMIT)
+// This function is called before every basic block is executed, with
+// its number of instructions
+//
+// Returns True when an event is due within the block
+static ADDRINT PIN_FAST_ANALYSIS_CALL CountBbl(THREAD_STATE *ts, UINT32 numIns)
+{
+    ts->icount += numIns;
+    return ts->icount > ts->nextEvent;
+}
+
+// The events of a block of 'numIns' instructions, in the order they
+// would come if the instructions were counted one by one. Only the
+// last instruction of a block can be a branch, so every event falls
+// before any branch of the block is recorded
+static VOID BblEvent(THREAD_STATE *ts, CONTEXT *ctxt, UINT32 numIns)
+{
+    UINT64 end = ts->icount;
+    UINT64 start = end - numIns;
+
+    // -toggle_signal turned the thread's tracing over: the block runs
+    // again in the other version, counted once. Only the traced
+    // version adds to the -icount register
+    if (gating && PIN_GetContextReg(ctxt, gateReg) != (ADDRINT)ts->gated)
+    {
+        PIN_SetContextReg(ctxt, gateReg, ts->gated);
+        if (icountRecords && ts->gated)
+            PIN_SetContextReg(ctxt, icountReg, PIN_GetContextReg(ctxt, icountReg) - numIns);
+        ts->icount = start;
+        UpdateNextEvent(ts);
+        PIN_ExecuteAt(ctxt);
+    }
+    if (ts->bbv && end >= ts->bbvEnd)
     {
-        fileCounter++;
-        cout << "Exiting because of CBCOUNT_LIMIT" << endl;
-        Fini(0, 0);
-        exit(0);
+        WriteBbv(ts);
+        while (ts->bbvEnd <= end)
+            ts->bbvEnd += bbvInterval;
     }
+    if (branchesDone && !ts->done)
+    {
+        FlushBuffer(ts, ctxt);
+        FinishThread(ts);
+    }
+
+    if (ts->recording && Splitting() && SplitPoint(ts) <= start)
+        Split(ts, ctxt, start);
 
-    if (icount >= offset_inst && fileCounter == 0)
+    // the conditional branch limit was reached by the branch before,
+    // which only ends the window when sampling
+    if (ts->recording && !ts->done && ts->cbcount >= CBCOUNT_LIMIT)
     {
-        // cout << "Here!" << endl;
-        first_inst_count_after_offset++; // Although here is going to be increased by one, it will be set to 1 whenever it reaches to fist branch;
-        record = true;
+        if (samplePeriod)
+        {
+            CloseWindow(ts, ctxt, start + 1);
+        }
+        else
+        {
+            ts->icount = start + 1;
+            FlushBuffer(ts, ctxt);
+            ts->fileCounter++;
+            EndThread(ts, "CBCOUNT_LIMIT");
+            ts->icount = end;
+        }
     }
-    else if (fileCounter > 0)
+
+    // Branches are recorded from the start, and those before the
+    // offset are dropped here. The window turning the branches'
+    // instrumentation on runs the block again with it, counting its
+    // instructions once more, so that its branch is recorded
+    if (!ts->done && !ts->recording && end >= RecordPoint(ts))
     {
-        first_inst_count_after_offset++;
+        if (samplePeriod && SetWindow(ts, true))
+        {
+            ts->icount = start;
+            if (icountRecords)
+                PIN_SetContextReg(ctxt, icountReg, start);
+            UpdateNextEvent(ts);
+            PIN_ExecuteAt(ctxt);
+        }
+        ts->written = static_cast<BRANCH_RECORD *>(PIN_GetBufferPointer(ctxt, bufId));
+        ts->cbcount = 0;
+        ts->recording = true;
+        ts->windowStart = RecordPoint(ts);
     }
+
+    while (!ts->done && Splitting() && SplitPoint(ts) < end)
+        Split(ts, ctxt, SplitPoint(ts));
+    UpdateNextEvent(ts);
 }
 
-VOID ImageLoad(IMG img, VOID *v)
+// Count a conditional branch
+//
+// Returns True when it reaches the limit
+static ADDRINT PIN_FAST_ANALYSIS_CALL CountConditional(THREAD_STATE *ts)
+{
+    return ++ts->cbcount >= CBCOUNT_LIMIT;
+}
+
+static VOID BranchEvent(THREAD_STATE *ts)
+{
+    if (!ts->recording || ts->done)
+        return;
+    if (ts->cbcount >= CBCOUNT_LIMIT)
+        ts->nextEvent = 0;
+}
+
+// Whether one of the values of 'knob' is in 'name', or, for routines
+// with 'whole', is 'name'
+static BOOL KnobMatches(KNOB<string> &knob, const string &name, BOOL whole)
+{
+    for (UINT32 i = 0; i < knob.NumberOfValues(); i++)
+    {
+        const string &value = knob.Value(i);
+        if (!value.empty() && (whole ? name == value : name.find(value) != string::npos))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static BOOL InRanges(const RANGES &ranges, ADDRINT addr)
+{
+    RANGES::const_iterator it = ranges.upper_bound(addr);
+    return it != ranges.begin() && addr < (--it)->second;
+}
+
+// Drop the ranges that start in [low, high]
+static VOID EraseRanges(RANGES &ranges, ADDRINT low, ADDRINT high)
+{
+    ranges.erase(ranges.lower_bound(low), ranges.upper_bound(high));
+}
+
+// Whether the branch at 'addr' passes the filters
+static BOOL Logged(ADDRINT addr)
+{
+    if (filterImages && !InRanges(keptImages, addr))
+        return FALSE;
+    if (filterRoutines && !InRanges(keptRoutines, addr))
+        return FALSE;
+    return !InRanges(skipped, addr);
+}
+
+// Place a new image and its routines in the filters
+// A call of -marker_begin, 'closed' FALSE, or of -marker_end
+//
+// Returns the thread's gateReg
+static ADDRINT PIN_FAST_ANALYSIS_CALL Marker(THREAD_STATE *ts, ADDRINT closed)
+{
+    ts->gated = closed;
+    return closed;
+}
+
+// Set gateReg at each call of the marker 'name' of 'img', if it has one
+static VOID InstrumentMarker(IMG img, const string &name, BOOL closed)
 {
+    if (name.empty())
+        return;
+    RTN rtn = RTN_FindByName(img, name.c_str());
+    if (!RTN_Valid(rtn))
+        return;
+    RTN_Open(rtn);
+    RTN_InsertCall(rtn, IPOINT_BEFORE, (AFUNPTR)Marker, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, stateReg, IARG_ADDRINT, (ADDRINT)closed, IARG_RETURN_REGS, gateReg, IARG_END);
+    RTN_Close(rtn);
+}
 
-    printf("ImageLoad %s\n", IMG_Name(img).c_str());
+// -image_map lists every image the program loads in <prefix>.imgmap,
+// one line each: its lowest and highest address, the offset it was
+// loaded at from its link addresses, its GNU build ID and its path.
+// src/bpsym finds the function and line of a traced PC from them,
+// even with the PC truncated to 32 bits. The file is written again at
+// each load, as they are few, and the lines are kept so a forked
+// child lists the images it inherited under its own name
+static std::vector<string> imageMapLines;
+
+// The GNU build ID of 'img' in hex, from its note in memory, or "-"
+static string ImageBuildId(IMG img)
+{
+    for (SEC sec = IMG_SecHead(img); SEC_Valid(sec); sec = SEC_Next(sec))
+    {
+        if (SEC_Name(sec) != ".note.gnu.build-id" || !SEC_Mapped(sec))
+            continue;
+        // namesz, descsz, type, then "GNU" padded to 4 bytes and the ID
+        UINT8 note[256];
+        size_t size = SEC_Size(sec) < sizeof(note) ? SEC_Size(sec) : sizeof(note);
+        if (size < 12 || PIN_SafeCopy(note, reinterpret_cast<VOID *>(SEC_Address(sec)), size) != size)
+            return "-";
+        UINT32 namesz, descsz;
+        memcpy(&namesz, note, 4);
+        memcpy(&descsz, note + 4, 4);
+        size_t desc = 12 + ((namesz + 3) & ~3U);
+        if (!descsz || desc + descsz > size)
+            return "-";
+        static const char digits[] = "0123456789abcdef";
+        string id;
+        for (size_t i = 0; i < descsz; i++)
+        {
+            id += digits[note[desc + i] >> 4];
+            id += digits[note[desc + i] & 15];
+        }
+        return id;
+    }
+    return "-";
+}
+
+static VOID WriteImageMap()
+{
+    ofstream map((KnobOutputFile.Value() + processTag + ".imgmap").c_str());
+    map << "# low\thigh\tload_offset\tbuild_id\tpath\n";
+    for (size_t i = 0; i < imageMapLines.size(); i++)
+        map << imageMapLines[i];
+}
+
+VOID ImageLoad(IMG img, VOID *v)
+{
+    if (KnobImageMap)
+    {
+        ostringstream line;
+        line << hex << showbase << IMG_LowAddress(img) << "\t" << IMG_HighAddress(img) + 1 << "\t"
+             << IMG_LoadOffset(img) << "\t" << ImageBuildId(img) << "\t" << IMG_Name(img) << "\n";
+        imageMapLines.push_back(line.str());
+        WriteImageMap();
+    }
+    InstrumentMarker(img, KnobMarkerBegin.Value(), FALSE);
+    InstrumentMarker(img, KnobMarkerEnd.Value(), TRUE);
+    const string &name = IMG_Name(img);
+    BOOL kept = !filterImages || (KnobOnlyMainImage && IMG_IsMainExecutable(img)) || KnobMatches(KnobImage, name, FALSE);
+    BOOL excluded = KnobMatches(KnobExcludeImage, name, FALSE);
+    for (UINT32 r = 0; r < IMG_NumRegions(img); r++)
+    {
+        ADDRINT low = IMG_RegionLowAddress(img, r);
+        ADDRINT high = IMG_RegionHighAddress(img, r) + 1;
+        if (kept && filterImages)
+            keptImages[low] = high;
+        if (excluded)
+            skipped[low] = high;
+    }
+    if (!kept || excluded || (!filterRoutines && !KnobExcludeRoutine.NumberOfValues()))
+        return;
     for (SEC sec = IMG_SecHead(img); SEC_Valid(sec); sec = SEC_Next(sec))
     {
         for (RTN rtn = SEC_RtnHead(sec); RTN_Valid(rtn); rtn = RTN_Next(rtn))
         {
-            if (strcmp(RTN_Name(rtn).c_str(), "_dl_debug_state") == 0)
-            {
-                printf("  RTN %s at %p\n", RTN_Name(rtn).c_str(), reinterpret_cast<void *>(RTN_Address(rtn)));
-                printf("    ** found _dl_debug_state\n");
-                dl_debug_state_Addr = RTN_Address(rtn);
-                justFoundDlDebugState = TRUE;
-            }
-            else if (justFoundDlDebugState)
-            {
-                printf("  RTN %s at %p\n", RTN_Name(rtn).c_str(), reinterpret_cast<void *>(RTN_Address(rtn)));
-                dl_debug_state_AddrEnd = RTN_Address(rtn);
-                justFoundDlDebugState = FALSE;
-                printf("    ** _dl_debug_state from %p to %p\n", reinterpret_cast<void *>(dl_debug_state_Addr), reinterpret_cast<void *>(dl_debug_state_AddrEnd));
-            }
+            const string &rtnName = RTN_Name(rtn);
+            ADDRINT low = RTN_Address(rtn);
+            if (filterRoutines && KnobMatches(KnobRoutine, rtnName, TRUE))
+                keptRoutines[low] = low + RTN_Size(rtn);
+            if (KnobMatches(KnobExcludeRoutine, rtnName, TRUE))
+                skipped[low] = low + RTN_Size(rtn);
         }
     }
 }
 
+// Forget its ranges, as another image may load at the same addresses
+VOID ImageUnload(IMG img, VOID *v)
+{
+    ADDRINT low = IMG_LowAddress(img);
+    ADDRINT high = IMG_HighAddress(img);
+    EraseRanges(keptImages, low, high);
+    EraseRanges(keptRoutines, low, high);
+    EraseRanges(skipped, low, high);
+}
+
 /************
  *
- * JMP segment
+ * Trace buffer
+ *
+ * Each branch is a BRANCH_RECORD filled into a Pin trace buffer by
+ * inlined code. BufferFull formats the whole block into the text
+ * format and writes it at once, so there is no formatted, flushed
+ * write per dynamic branch
  *
  */
 
-static VOID UnconDirectJMP(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t0"                         // Unconditional
-            << "\t0"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t1"                         // Direct
-            << "\n"
-            << flush;
-    ubcount++;
-}
-
-static VOID UnconUnDirectJMP(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t0"                         // Unconditional
-            << "\t0"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t0"                         // Not Direct
-            << "\n"
-            << flush;
-    ubcount++;
-}
-
-static VOID ConDirectJMP(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t1"                         // Conditional
-            << "\t0"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t1"                         // Direct
-            << "\n"
-            << flush;
-    cbcount++;
-}
-static VOID ConUnDirectJMP(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t1"                         // Conditional
-            << "\t0"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t0"                         // Not Direct
-            << "\n"
-            << flush;
-    cbcount++;
+// Start the trace of a thread numbered already: its predictors, its
+// files and its first event
+static VOID BeginThread(THREAD_STATE *ts)
+{
+    for (size_t i = 0; i < predictConfigs.size(); i++)
+        ts->predictors.push_back(predictor_create(&predictConfigs[i]));
+    ts->mispredictions.assign(ts->predictors.size(), 0);
+    ts->totalMispredictions.assign(ts->predictors.size(), 0);
+    OpenFiles(ts);
+    ts->icountLast = RecordPoint(ts) ? RecordPoint(ts) - 1 : 0;
+    if (bbvInterval)
+    {
+        ostringstream name;
+        name << KnobOutputFile.Value() << processTag;
+        if (ts->number)
+            name << "_t" << ts->number;
+        name << ".bb";
+        ts->bbvFile = ofstream(name.str().c_str());
+        ts->bbv = new UINT32[BBV_MAX_BLOCKS]();
+        ts->bbvEnd = bbvInterval;
+    }
+    UpdateNextEvent(ts);
 }
-//****************************************************************
 
-/************
- *
- * Ret segment
- *
- */
+static VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v)
+{
+    if (profileOnly)
+        return;
+    THREAD_STATE *ts = new THREAD_STATE();
+    ts->written = static_cast<BRANCH_RECORD *>(PIN_GetBufferPointer(ctxt, bufId));
+    PIN_GetLock(&threadLock, tid + 1);
+    ts->number = threadStates.size();
+    threadStates.push_back(ts);
+    PIN_ReleaseLock(&threadLock);
+    ts->gated = __atomic_load_n(&gateClosed, __ATOMIC_RELAXED);
+    BeginThread(ts);
+    PIN_SetThreadData(stateKey, ts, tid);
+    PIN_SetContextReg(ctxt, stateReg, reinterpret_cast<ADDRINT>(ts));
+    PIN_SetContextReg(ctxt, icountReg, ts->icount);
+    if (gating)
+        PIN_SetContextReg(ctxt, gateReg, ts->gated);
+}
 
-static VOID UnconDirectRet(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t0"                         // Unconditional
-            << "\t0"                         // Not Call
-            << "\t1"                         // Ret
-            << "\t1"                         // Direct
-            << "\n"
-            << flush;
-    ubcount++;
-    retcount++;
-}
-
-static VOID UnconUnDirectRet(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t0"                         // Unconditional
-            << "\t0"                         // Not Call
-            << "\t1"                         // Ret
-            << "\t0"                         // Not Direct
-            << "\n"
-            << flush;
-    ubcount++;
-    retcount++;
-}
-
-static VOID ConDirectRet(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t1"                         // Unconditional
-            << "\t0"                         // Not Call
-            << "\t1"                         // Not Ret
-            << "\t1"                         // Direct
-            << "\n"
-            << flush;
-    cbcount++;
-    retcount++;
-}
-static VOID ConUnDirectRet(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t1"                         // Unconditional
-            << "\t0"                         // Not Call
-            << "\t1"                         // Not Ret
-            << "\t0"                         // Direct
-            << "\n"
-            << flush;
-    cbcount++;
-    retcount++;
+// The thread's last records are in by now, see BufferFull
+static VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v)
+{
+    if (profileOnly)
+        return;
+    THREAD_STATE *ts = static_cast<THREAD_STATE *>(PIN_GetThreadData(stateKey, tid));
+    if (ts->number)
+        FinishThread(ts);
+    FinishBbv(ts);
 }
-//****************************************************************
 
-/************
- *
- * Call segment
- *
- */
-static VOID UnconDirectCall(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t0"                         // Unconditional
-            << "\t1"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t1"                         // Direct
-            << "\n"
-            << flush;
-    ubcount++;
-    callcount++;
-}
-static VOID UnconUnDirectCall(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t0"                         // Unconditional
-            << "\t1"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t0"                         // Direct
-            << "\n"
-            << flush;
-    ubcount++;
-    callcount++;
-}
-static VOID ConDirectCall(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t1"                         // Unconditional
-            << "\t1"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t1"                         // Direct
-            << "\n"
-            << flush;
-    cbcount++;
-    callcount++;
-}
-static VOID ConUnDirectCall(ADDRINT ip, ADDRINT target, BOOL taken)
-{
-    OutFile << std::hex
-            << (ip & 0xffffffff)             // PC
-            << "\t" << (target & 0xffffffff) // Target
-            << (taken ? "\t1" : "\t0")       // T-N
-            << "\t1"                         // Unconditional
-            << "\t1"                         // Not Call
-            << "\t0"                         // Not Ret
-            << "\t0"                         // Direct
-            << "\n"
-            << flush;
-    cbcount++;
-    callcount++;
+// "0x" and the lowercase hex digits of 'v', as std::hex with showbase
+// prints it: just "0" for 0
+static char *PutHex(char *p, UINT32 v)
+{
+    if (!v)
+    {
+        *p++ = '0';
+        return p;
+    }
+    *p++ = '0';
+    *p++ = 'x';
+    int shift = 28;
+    while (!(v >> shift))
+        shift -= 4;
+    for (; shift >= 0; shift -= 4)
+        *p++ = "0123456789abcdef"[(v >> shift) & 0xf];
+    return p;
+}
+
+// The records of [begin, end) packed, for -format bin
+static char *PutBinary(char *p, const BRANCH_RECORD *begin, const BRANCH_RECORD *end)
+{
+    for (const BRANCH_RECORD *r = begin; r < end; r++)
+    {
+        UINT32 pc = r->pc & 0xffffffff;
+        UINT32 target = r->target & 0xffffffff;
+        memcpy(p, &pc, 4);
+        memcpy(p + 4, &target, 4);
+        p[8] = (r->taken ? BIN_F_TAKEN : 0) |
+               (r->kind & BRANCH_CONDITIONAL ? BIN_F_CONDITION : 0) |
+               (r->kind & BRANCH_CALL ? BIN_F_CALL : 0) |
+               (r->kind & BRANCH_RET ? BIN_F_RET : 0) |
+               (r->kind & BRANCH_DIRECT ? BIN_F_DIRECT : 0);
+        p += BIN_RECORD_SIZE;
+    }
+    return p;
+}
+
+// The records of [begin, end) of the thread as static ids, for
+// -format ids, defining each id the first time the file has it
+static char *PutIds(THREAD_STATE *ts, char *p, const BRANCH_RECORD *begin, const BRANCH_RECORD *end)
+{
+    UINT32 run = 0;
+    for (const BRANCH_RECORD *r = begin; r < end; r++)
+    {
+        if (r > begin && r->kind == r[-1].kind && !r->taken == !r[-1].taken && r->target == r[-1].target)
+        {
+            run++;
+            continue;
+        }
+        if (run)
+        {
+            UINT32 word = run << IDS_ID_SHIFT | IDS_REPEAT;
+            memcpy(p, &word, 4);
+            p += 4;
+            run = 0;
+        }
+
+        UINT32 id = r->kind >> BRANCH_ID_SHIFT;
+        if (id >= ts->defined.size())
+            ts->defined.resize(id + 1 + id / 2, false);
+        if (!ts->defined[id])
+        {
+            ts->defined[id] = true;
+            UINT32 word = id << IDS_ID_SHIFT | IDS_DEFINE;
+            UINT64 pc = r->pc;
+            UINT64 target = r->kind & BRANCH_DIRECT ? r->target : 0;
+            memcpy(p, &word, 4);
+            memcpy(p + 4, &pc, 8);
+            memcpy(p + 12, &target, 8);
+            p[20] = (r->kind & BRANCH_CONDITIONAL ? BIN_F_CONDITION : 0) |
+                    (r->kind & BRANCH_CALL ? BIN_F_CALL : 0) |
+                    (r->kind & BRANCH_RET ? BIN_F_RET : 0) |
+                    (r->kind & BRANCH_DIRECT ? BIN_F_DIRECT : 0);
+            p += 21;
+        }
+        UINT32 word = id << IDS_ID_SHIFT | (r->taken ? IDS_TAKEN : 0);
+        memcpy(p, &word, 4);
+        p += 4;
+        if (!(r->kind & BRANCH_DIRECT))
+        {
+            // the distance from the PC, within a module, or the far
+            // escape and the whole target
+            INT64 delta = (INT64)(r->target - r->pc);
+            INT32 near = delta == (INT32)delta ? (INT32)delta : IDS_FAR;
+            memcpy(p, &near, 4);
+            p += 4;
+            if (near == IDS_FAR)
+            {
+                UINT64 target = r->target;
+                memcpy(p, &target, 8);
+                p += 8;
+            }
+        }
+    }
+    if (run)
+    {
+        UINT32 word = run << IDS_ID_SHIFT | IDS_REPEAT;
+        memcpy(p, &word, 4);
+        p += 4;
+    }
+    return p;
+}
+
+// The records of [begin, end) as lines of text
+static char *PutText(char *p, const BRANCH_RECORD *begin, const BRANCH_RECORD *end)
+{
+    for (const BRANCH_RECORD *r = begin; r < end; r++)
+    {
+        p = PutHex(p, r->pc & 0xffffffff);                 // PC
+        *p++ = '\t';
+        p = PutHex(p, r->target & 0xffffffff);             // Target
+        *p++ = '\t';
+        *p++ = r->taken ? '1' : '0';                       // T-N
+        *p++ = '\t';
+        *p++ = r->kind & BRANCH_CONDITIONAL ? '1' : '0';   // Conditional
+        *p++ = '\t';
+        *p++ = r->kind & BRANCH_CALL ? '1' : '0';          // Call
+        *p++ = '\t';
+        *p++ = r->kind & BRANCH_RET ? '1' : '0';           // Ret
+        *p++ = '\t';
+        *p++ = r->kind & BRANCH_DIRECT ? '1' : '0';        // Direct
+        *p++ = '\n';
+    }
+    return p;
+}
+
+// The -icount deltas of the records of [begin, end) of the thread, as
+// varints of 7 bits a byte, low bits first
+#define ICNT_VARINT_MAX 10
+static char *PutIcounts(THREAD_STATE *ts, char *p, const BRANCH_RECORD *begin, const BRANCH_RECORD *end)
+{
+    for (const BRANCH_RECORD *r = begin; r < end; r++)
+    {
+        UINT64 delta = r->icount - ts->icountLast;
+        ts->icountLast = r->icount;
+        while (delta >= 0x80)
+        {
+            *p++ = (char)(delta | 0x80);
+            delta >>= 7;
+        }
+        *p++ = (char)delta;
+    }
+    return p;
+}
+
+// Hand the records of [begin, end) to the -shm readers, packed into
+// the ring's slots where they lie
+static VOID Publish(const BRANCH_RECORD *begin, const BRANCH_RECORD *end)
+{
+    while (begin < end && shmRing)
+    {
+        const BRANCH_RECORD *last = end - begin > SHM_RING_SLOT_RECORDS ? begin + SHM_RING_SLOT_RECORDS : end;
+        PutBinary(shm_ring_slot(shmRing), begin, last);
+        shm_ring_publish(shmRing, last - begin);
+        begin = last;
+    }
+}
+
+// Write the records of [begin, end) to the thread's file at once, or
+// run them through its predictors or publish them to the ring,
+// counting the unconditional, call and RET ones
+static VOID FormatRecords(THREAD_STATE *ts, const BRANCH_RECORD *begin, const BRANCH_RECORD *end)
+{
+    for (const BRANCH_RECORD *r = begin; r < end; r++)
+    {
+        ts->ubcount += !(r->kind & BRANCH_CONDITIONAL);
+        ts->callcount += (r->kind & BRANCH_CALL) != 0;
+        ts->retcount += (r->kind & BRANCH_RET) != 0;
+        ts->predicted += (r->kind & BRANCH_CONDITIONAL) != 0;
+    }
+
+    PIN_GetLock(&outLock, 1);
+    size_t n = end - begin;
+    size_t most = idsFormat ? IDS_RECORD_MAX : BRANCH_TEXT_MAX;
+    if (textBuf.size() < n * most)
+        textBuf.resize(n * most);
+    if (!ts->predictors.empty())
+    {
+        PutBinary(&textBuf[0], begin, end);
+        const predictor_branch_t *batch = reinterpret_cast<const predictor_branch_t *>(&textBuf[0]);
+        for (size_t i = 0; i < ts->predictors.size(); i++)
+            ts->mispredictions[i] += predictor_predict_batch(ts->predictors[i], batch, n, NULL);
+        __atomic_store_n(&recordsWritten, recordsWritten + n, __ATOMIC_RELAXED);
+        PIN_ReleaseLock(&outLock);
+        return;
+    }
+    if (shmStream)
+    {
+        if (!ts->number)
+        {
+            Publish(begin, end);
+            __atomic_store_n(&recordsWritten, recordsWritten + n, __ATOMIC_RELAXED);
+        }
+        PIN_ReleaseLock(&outLock);
+        return;
+    }
+    char *p = idsFormat ? PutIds(ts, &textBuf[0], begin, end)
+              : binFormat ? PutBinary(&textBuf[0], begin, end)
+              : PutText(&textBuf[0], begin, end);
+    if (ts->segMap)
+        SegmentWrite(ts, &textBuf[0], p - &textBuf[0]);
+    else
+        ts->OutFile.write(&textBuf[0], p - &textBuf[0]);
+    if (ts->icntFile.is_open())
+    {
+        if (icntBuf.size() < n * ICNT_VARINT_MAX)
+            icntBuf.resize(n * ICNT_VARINT_MAX);
+        char *q = PutIcounts(ts, &icntBuf[0], begin, end);
+        ts->icntFile.write(&icntBuf[0], q - &icntBuf[0]);
+        if (ts->segMap)
+            ts->icntFile.flush();
+    }
+    ts->binRecords += n;
+    if (ts->segMap)
+        SegmentCommit(ts);
+    __atomic_store_n(&recordsWritten, recordsWritten + n, __ATOMIC_RELAXED);
+    PIN_ReleaseLock(&outLock);
+}
+
+// Write the records of a block, or end its set, and free it
+static VOID WriteBlock(WRITE_BLOCK *block)
+{
+    if (block->rotate)
+        RotateFiles(block->ts, block->set);
+    else
+        FormatRecords(block->ts, &block->records[0], &block->records[0] + block->records.size());
+    delete block;
+}
+
+// The internal thread writing the queued blocks
+static VOID Writer(VOID *arg)
+{
+    for (;;)
+    {
+        PIN_SemaphoreWait(&writeReady);
+        PIN_GetLock(&writeLock, 1);
+        if (!writeCount)
+        {
+            PIN_SemaphoreClear(&writeReady);
+            bool stop = writeStop;
+            PIN_ReleaseLock(&writeLock);
+            if (stop)
+                return;
+            continue;
+        }
+        WRITE_BLOCK *block = writeQueue[writeHead];
+        PIN_ReleaseLock(&writeLock);
+
+        WriteBlock(block);
+
+        PIN_GetLock(&writeLock, 1);
+        writeHead = (writeHead + 1) % WRITE_QUEUE;
+        writeCount--;
+        PIN_SemaphoreSet(&writeDone);
+        PIN_ReleaseLock(&writeLock);
+    }
+}
+
+// Wait until the writer has written every queued block
+static VOID DrainWrites()
+{
+    PIN_GetLock(&writeLock, 1);
+    while (writeCount)
+    {
+        PIN_SemaphoreClear(&writeDone);
+        PIN_ReleaseLock(&writeLock);
+        PIN_SemaphoreWait(&writeDone);
+        PIN_GetLock(&writeLock, 1);
+    }
+    PIN_ReleaseLock(&writeLock);
+}
+
+// Queue a block for the writer, waiting while the queue is full. Once
+// the writer is stopping it is written here
+static VOID QueueBlock(WRITE_BLOCK *block)
+{
+    PIN_GetLock(&writeLock, 1);
+    while (writeCount == WRITE_QUEUE && !writeStop)
+    {
+        PIN_SemaphoreClear(&writeDone);
+        PIN_ReleaseLock(&writeLock);
+        PIN_SemaphoreWait(&writeDone);
+        PIN_GetLock(&writeLock, 1);
+    }
+    if (writeStop)
+    {
+        PIN_ReleaseLock(&writeLock);
+        DrainWrites();
+        WriteBlock(block);
+        return;
+    }
+    writeQueue[(writeHead + writeCount) % WRITE_QUEUE] = block;
+    writeCount++;
+    PIN_SemaphoreSet(&writeReady);
+    PIN_ReleaseLock(&writeLock);
+}
+
+// Queue the thread's records of [begin, end) for the writer. Records
+// before the offset or after the last set are dropped
+static VOID WriteRecords(THREAD_STATE *ts, const BRANCH_RECORD *begin, const BRANCH_RECORD *end)
+{
+    if (begin >= end || !ts->recording || ts->done)
+        return;
+    WRITE_BLOCK *block = new WRITE_BLOCK;
+    block->ts = ts;
+    block->records.assign(begin, end);
+    block->rotate = false;
+    QueueBlock(block);
+}
+
+// Let the writer finish the queue and exit, before Pin's Fini
+static VOID StopWriter(VOID *v)
+{
+    PIN_GetLock(&writeLock, 1);
+    writeStop = true;
+    PIN_SemaphoreSet(&writeReady);
+    PIN_ReleaseLock(&writeLock);
+    PIN_WaitForThreadTermination(writerUid, PIN_INFINITE_TIMEOUT, NULL);
+}
+
+// The internal thread reporting the rates of each interval until
+// StopProgress. Branches are counted as the writer writes them
+static VOID Progress(VOID *arg)
+{
+    UINT32 seconds = KnobProgress.Value();
+    UINT64 lastInstructions = 0;
+    UINT64 lastBranches = 0;
+    while (!PIN_SemaphoreTimedWait(&progressStop, seconds * 1000))
+    {
+        UINT64 instructions = 0;
+        PIN_GetLock(&threadLock, 1);
+        for (size_t i = 0; i < threadStates.size(); i++)
+            instructions += __atomic_load_n(&threadStates[i]->icount, __ATOMIC_RELAXED);
+        PIN_ReleaseLock(&threadLock);
+        UINT64 branches = __atomic_load_n(&recordsWritten, __ATOMIC_RELAXED);
+        cerr << "Progress: " << (instructions - lastInstructions) / seconds << " instructions/s, "
+             << (branches - lastBranches) / seconds << " branches/s, " << instructions << " instructions, "
+             << branches << " branches written" << endl;
+        lastInstructions = instructions;
+        lastBranches = branches;
+    }
+}
+
+static VOID StopProgress(VOID *v)
+{
+    if (!progressRunning)
+        return;
+    progressRunning = FALSE;
+    PIN_SemaphoreSet(&progressStop);
+    PIN_WaitForThreadTermination(progressUid, PIN_INFINITE_TIMEOUT, NULL);
+}
+
+// The -follow_child tag of this process, by the name of its program
+static VOID SetProcessTag()
+{
+    char path[4096];
+    ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    string program = "program";
+    if (n > 0)
+    {
+        path[n] = 0;
+        program = path;
+        program = program.substr(program.rfind('/') + 1);
+    }
+    processTag = "_" + program + "_" + decstr(PIN_GetPid());
+}
+
+// The forking thread holds off the others until the fork is done:
+// everything queued is written, and its own streams flushed, so the
+// child inherits no buffered output of the parent to write again
+static VOID BeforeFork(THREADID tid, const CONTEXT *ctxt, VOID *v)
+{
+    THREAD_STATE *ts = static_cast<THREAD_STATE *>(PIN_GetThreadData(stateKey, tid));
+    PIN_GetLock(&threadLock, tid + 1);
+    PIN_GetLock(&writeLock, tid + 1);
+    while (writeCount)
+    {
+        PIN_SemaphoreClear(&writeDone);
+        PIN_ReleaseLock(&writeLock);
+        PIN_SemaphoreWait(&writeDone);
+        PIN_GetLock(&writeLock, tid + 1);
+    }
+    ts->OutFile.flush();
+    ts->axuFile.flush();
+    ts->bbvFile.flush();
+}
+
+static VOID AfterForkInParent(THREADID tid, const CONTEXT *ctxt, VOID *v)
+{
+    PIN_ReleaseLock(&writeLock);
+    PIN_ReleaseLock(&threadLock);
+}
+
+// The child is a process of its own, with the forking thread as its
+// only thread: its state starts over in place, as the tool register
+// of the thread points to it, with files of the child's pid. The
+// other threads did not come along, nor did the internal ones
+static VOID AfterForkInChild(THREADID tid, const CONTEXT *ctxt, VOID *v)
+{
+    THREAD_STATE *ts = static_cast<THREAD_STATE *>(PIN_GetThreadData(stateKey, tid));
+    BOOL reinstrument = branchesDone || (samplePeriod && windowsOpen > 0);
+    SetProcessTag();
+    if (KnobImageMap)
+        WriteImageMap();
+    for (size_t i = 0; i < ts->predictors.size(); i++)
+        predictor_destroy(ts->predictors[i]);
+    delete[] ts->bbv;
+    if (ts->segMap)
+        SegmentClose(ts, false); // the parent's mapping, which it goes on writing
+    ts->~THREAD_STATE(); // closes the parent's files, flushed before the fork
+    new (ts) THREAD_STATE();
+    ts->written = static_cast<BRANCH_RECORD *>(PIN_GetBufferPointer(const_cast<CONTEXT *>(ctxt), bufId));
+    if (gating)
+        ts->gated = PIN_GetContextReg(ctxt, gateReg); // as the parent's thread was
+    threadStates.assign(1, ts);
+    branchesDone = FALSE;
+    windowsOpen = 0;
+    recordsWritten = 0;
+    BeginThread(ts);
+    PIN_ReleaseLock(&writeLock);
+    PIN_ReleaseLock(&threadLock);
+
+    if (PIN_SpawnInternalThread(Writer, 0, 0, &writerUid) == INVALID_THREADID)
+    {
+        cerr << "Error: could not start the writer thread of the child" << endl;
+        PIN_ExitProcess(1);
+    }
+    if (progressRunning)
+        progressRunning = PIN_SpawnInternalThread(Progress, 0, 0, &progressUid) != INVALID_THREADID;
+    if (reinstrument)
+        PIN_RemoveInstrumentation();
+}
+
+// The process is about to exec a program Pin follows: its own trace
+// ends here, the program's starts under another copy of the tool
+static BOOL FollowChild(CHILD_PROCESS child, VOID *v)
+{
+    Fini(0, v);
+    return TRUE;
+}
+
+// Write what the thread's buffer holds so far, before the trace moves
+// to another file or ends early
+static VOID FlushBuffer(THREAD_STATE *ts, CONTEXT *ctxt)
+{
+    BRANCH_RECORD *cur = static_cast<BRANCH_RECORD *>(PIN_GetBufferPointer(ctxt, bufId));
+    WriteRecords(ts, ts->written, cur);
+    ts->written = cur;
+}
+
+// The buffer is full or its thread exits. Records already written by
+// FlushBuffer are skipped; the same buffer is filled again from its start
+static VOID *BufferFull(BUFFER_ID id, THREADID tid, const CONTEXT *ctxt, VOID *buf, UINT64 numElements, VOID *v)
+{
+    THREAD_STATE *ts = static_cast<THREAD_STATE *>(PIN_GetThreadData(stateKey, tid));
+    BRANCH_RECORD *begin = static_cast<BRANCH_RECORD *>(buf);
+    BRANCH_RECORD *end = begin + numElements;
+    BRANCH_RECORD *written = ts->written;
+    WriteRecords(ts, written >= begin && written <= end ? written : begin, end);
+    ts->written = begin;
+    return buf;
 }
 //****************************************************************
 
-static VOID Instruction(INS ins, VOID *v)
+
+// The BRANCH_* bits of branch 'ins': conditional unless it has no
+// fall through; a call is never also counted as a RET
+static UINT32 StaticKind(INS ins)
 {
-    // Insert a call to docount before every instruction, no arguments are passed
+    UINT32 kind = 0;
+    if (INS_HasFallThrough(ins))
+        kind |= BRANCH_CONDITIONAL;
+    if (INS_IsCall(ins))
+        kind |= BRANCH_CALL;
+    else if (INS_IsRet(ins))
+        kind |= BRANCH_RET;
+    if (INS_IsDirectControlFlow(ins))
+        kind |= BRANCH_DIRECT;
+    return kind;
+}
 
-    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)docount, IARG_END);
+static VOID PIN_FAST_ANALYSIS_CALL CountEdge(PROFILE_SLOT *slot, BOOL taken)
+{
+    slot->execs++;
+    slot->taken += taken;
+}
 
-    if (record)
+// The -profile_only count of branch 'ins', in the slot of its PC
+static VOID ProfileInstruction(INS ins)
+{
+    if (!INS_IsValidForIpointTakenBranch(ins) || !Logged(INS_Address(ins)))
+        return;
+    ADDRINT pc = INS_Address(ins);
+    std::map<ADDRINT, PROFILE_SLOT *>::iterator known = profileSlots.find(pc);
+    PROFILE_SLOT *slot;
+    if (known != profileSlots.end())
+    {
+        slot = known->second;
+    }
+    else
     {
-        if (INS_IsValidForIpointTakenBranch(ins))
+        if (profileChunkUsed == PROFILE_CHUNK)
         {
-            if (first_record)
-            { // Detected the first branch
-                first_inst_count_after_offset = 1;
-                first_record = false;
-            }
-            if (INS_HasFallThrough(ins) == false)
-            { // It is unconditional branch
-                if (INS_IsCall(ins))
-                { // It is call
-                    if (INS_IsDirectControlFlow(ins) == true)
-                    { // direct
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)UnconDirectCall, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                    else
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)UnconUnDirectCall, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                }
-                else if (INS_IsRet(ins))
-                { // It is RET
-                    if (INS_IsDirectControlFlow(ins) == true)
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)UnconDirectRet, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                    else
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)UnconUnDirectRet, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                }
-                else
-                { // It is JMP
-                    if (INS_IsDirectControlFlow(ins) == true)
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)UnconDirectJMP, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                    else
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)UnconUnDirectJMP, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                }
-            }
-            else
-            { // It is conditional branch
-                if (INS_IsCall(ins))
-                { // It is call
-                    if (INS_IsDirectControlFlow(ins) == true)
-                    { // direct
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ConDirectCall, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                    else
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ConUnDirectCall, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                }
-                else if (INS_IsRet(ins))
-                { // It is RET
-                    if (INS_IsDirectControlFlow(ins) == true)
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ConDirectRet, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                    else
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ConUnDirectRet, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                }
-                else
-                { // It is JMP
-                    if (INS_IsDirectControlFlow(ins) == true)
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ConDirectJMP, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                    else
-                    {
-                        INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)ConUnDirectJMP, IARG_INST_PTR, IARG_BRANCH_TARGET_ADDR, IARG_BRANCH_TAKEN, IARG_END);
-                    }
-                }
-            }
+            profileChunk = new PROFILE_SLOT[PROFILE_CHUNK]();
+            profileChunkUsed = 0;
         }
+        slot = &profileChunk[profileChunkUsed++];
+        profileSlots[pc] = slot;
+        profileKinds[pc] = StaticKind(ins);
+        disAssemblyMap[pc] = INS_Disassemble(ins);
+    }
+    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)CountEdge, IARG_FAST_ANALYSIS_CALL, IARG_PTR, slot, IARG_BRANCH_TAKEN, IARG_END);
+}
+
+// The calls of instruction 'ins' of a block, at most a counted and
+// recorded branch
+static VOID Instruction(INS ins)
+{
+    if (!INS_IsValidForIpointTakenBranch(ins) || !Logged(INS_Address(ins)))
+        return;
+    UINT32 kind = BRANCH_RECORDED | StaticKind(ins);
+
+    // The same PC keeps its id when it is instrumented again
+    std::map<ADDRINT, UINT32>::iterator known = branchIds.find(INS_Address(ins));
+    if (known != branchIds.end())
+    {
+        kind = known->second;
+    }
+    else if (branchIds.size() < BRANCH_ID_MAX)
+    {
+        kind |= branchIds.size() << BRANCH_ID_SHIFT;
+        branchIds[INS_Address(ins)] = kind;
+        if (idsFormat)
+            disAssemblyMap[INS_Address(ins)] = INS_Disassemble(ins);
+    }
+    else
+    {
+        cerr << "Error: more than " << BRANCH_ID_MAX << " static branches" << endl;
+        PIN_ExitProcess(1);
+    }
+
+    if (kind & BRANCH_CONDITIONAL)
+    {
+        INS_InsertIfCall(ins, IPOINT_BEFORE, (AFUNPTR)CountConditional, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, stateReg, IARG_END);
+        INS_InsertThenCall(ins, IPOINT_BEFORE, (AFUNPTR)BranchEvent, IARG_REG_VALUE, stateReg, IARG_END);
     }
+
+    // Branches are one record of the trace buffer, filled by inlined code
+    INS_InsertFillBuffer(ins, IPOINT_BEFORE, bufId,
+                         IARG_INST_PTR, offsetof(BRANCH_RECORD, pc),
+                         IARG_BRANCH_TARGET_ADDR, offsetof(BRANCH_RECORD, target),
+                         IARG_BRANCH_TAKEN, offsetof(BRANCH_RECORD, taken),
+                         IARG_UINT32, kind, offsetof(BRANCH_RECORD, kind),
+                         IARG_REG_VALUE, icountReg, offsetof(BRANCH_RECORD, icount),
+                         IARG_END);
     // We do not care about instrunctions that are not branches.
-    // else
-    //    INS_InsertCall(ins, IPOINT_BEFORE, (AFUNPTR)AtNonBranch, IARG_INST_PTR, IARG_END);
 }
 
+// The -bbv id of block 'bbl', by its address
+static UINT32 BlockId(BBL bbl)
+{
+    std::map<ADDRINT, UINT32>::iterator known = bblIds.find(BBL_Address(bbl));
+    if (known != bblIds.end())
+        return known->second;
+    if (bblIds.size() == BBV_MAX_BLOCKS)
+    {
+        cerr << "Error: more than " << BBV_MAX_BLOCKS << " basic blocks" << endl;
+        PIN_ExitProcess(1);
+    }
+    UINT32 id = bblIds.size();
+    bblIds[BBL_Address(bbl)] = id;
+    __atomic_store_n(&numBlocks, id + 1, __ATOMIC_RELAXED);
+    return id;
+}
+
+static VOID PIN_FAST_ANALYSIS_CALL CountBbv(THREAD_STATE *ts, UINT32 id, UINT32 numIns)
+{
+    ts->bbv[id] += numIns;
+}
+
+// The -icount register past a block of 'numIns' instructions
+static ADDRINT PIN_FAST_ANALYSIS_CALL CountIcount(ADDRINT icount, UINT32 numIns)
+{
+    return icount + numIns;
+}
+
+// -toggle_signal: every thread takes the new state up at its next
+// block, in BblEvent. The signal is not passed on
+static BOOL ToggleSignal(THREADID tid, INT32 sig, CONTEXT *ctxt, BOOL hasHandler, const EXCEPTION_INFO *pExceptInfo, VOID *v)
+{
+    PIN_GetLock(&threadLock, tid + 1);
+    gateClosed = !gateClosed;
+    for (size_t i = 0; i < threadStates.size(); i++)
+    {
+        threadStates[i]->gated = gateClosed;
+        threadStates[i]->nextEvent = 0;
+    }
+    PIN_ReleaseLock(&threadLock);
+    cout << "Tracing " << (gateClosed ? "off" : "on") << " by signal " << sig << endl;
+    return FALSE;
+}
+
+// One inlined count per basic block, with the branches' calls, only
+// inside a region of the controller, and a window when sampling. The
+// gated version of a trace has only the counts
+static VOID Trace(TRACE trace, VOID *v)
+{
+    if (!roiActive)
+        return;
+    if (profileOnly)
+    {
+        for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+            for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+                ProfileInstruction(ins);
+        return;
+    }
+    BOOL branches = !branchesDone && (!samplePeriod || __atomic_load_n(&windowsOpen, __ATOMIC_RELAXED) > 0);
+    BOOL gated = gating && TRACE_Version(trace) == VERSION_GATED;
+    if (gating)
+    {
+        INS head = BBL_InsHead(TRACE_BblHead(trace));
+        if (gated)
+            INS_InsertVersionCase(head, gateReg, FALSE, VERSION_TRACED, IARG_END);
+        else
+            INS_InsertVersionCase(head, gateReg, TRUE, VERSION_GATED, IARG_END);
+    }
+    for (BBL bbl = TRACE_BblHead(trace); BBL_Valid(bbl); bbl = BBL_Next(bbl))
+    {
+        if (bbvInterval)
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)CountBbv, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, stateReg, IARG_UINT32, BlockId(bbl), IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        if (icountRecords && !gated)
+            BBL_InsertCall(bbl, IPOINT_BEFORE, (AFUNPTR)CountIcount, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, icountReg, IARG_UINT32, BBL_NumIns(bbl), IARG_RETURN_REGS, icountReg, IARG_END);
+        BBL_InsertIfCall(bbl, IPOINT_BEFORE, (AFUNPTR)CountBbl, IARG_FAST_ANALYSIS_CALL, IARG_REG_VALUE, stateReg, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        BBL_InsertThenCall(bbl, IPOINT_BEFORE, (AFUNPTR)BblEvent, IARG_REG_VALUE, stateReg, IARG_CONTEXT, IARG_UINT32, BBL_NumIns(bbl), IARG_END);
+        if (!branches || gated)
+            continue;
+        for (INS ins = BBL_InsHead(bbl); INS_Valid(ins); ins = INS_Next(ins))
+            Instruction(ins);
+    }
+}
+
+// A region of the controller starts or stops: the code cache is
+// flushed so the traces are instrumented again, with or without the
+// branch logging. The rest of the current trace is re-instrumented too
+static VOID ControlHandler(EVENT_TYPE ev, VOID *v, CONTEXT *ctxt, VOID *ip, THREADID tid, BOOL bcast)
+{
+    switch (ev)
+    {
+    case EVENT_START:
+        if (roiActive)
+            return;
+        roiActive = TRUE;
+        break;
+    case EVENT_STOP:
+        if (!roiActive)
+            return;
+        roiActive = FALSE;
+        break;
+    default:
+        return;
+    }
+    PIN_RemoveInstrumentation();
+    if (ctxt)
+        PIN_ExecuteAt(ctxt);
+}
+
+
 /* ===================================================================== */
 /* Print Help Message                                                    */
 /* ===================================================================== */
@@ -535,21 +1957,91 @@ INT32 Usage()
 
 INT32 InitFile()
 {
-    filePrefix.str("");
-    filePrefix.clear();
-    filePrefix << KnobOutputFile.Value() << "_" << fileCounter << ".out";
-    OutFile.open(filePrefix.str().c_str());
-    OutFile.setf(ios::showbase);
-
-    filePrefix.str("");
-    filePrefix.clear();
-    filePrefix << axuliryFileName << "_" << fileCounter << ".out";
-    axuFile.open(filePrefix.str().c_str());
-    axuFile.setf(ios::showbase);
+    idsFormat = KnobFormat.Value() == "ids";
+    binFormat = idsFormat || KnobFormat.Value() == "bin";
+    crashSafe = binFormat && KnobCrashSafe;
 
     howManyBranch = strtoull(KnobHowManyBranch.Value().c_str(), NULL, 0);
     howManySet = strtoull(KnobHowManySet.Value().c_str(), NULL, 0);
     offset_inst = strtoull(KnobOffset.Value().c_str(), NULL, 0);
+    CBCOUNT_LIMIT = KnobBranchLimit.Value();
+    samplePeriod = KnobSamplePeriod.Value();
+    bbvInterval = KnobBbv.Value();
+    if (samplePeriod)
+        CBCOUNT_LIMIT = KnobSampleLength.Value();
+    filterImages = KnobOnlyMainImage || KnobImage.NumberOfValues() > 0;
+    filterRoutines = KnobRoutine.NumberOfValues() > 0;
+    for (UINT32 i = 0; i < KnobPredict.NumberOfValues(); i++)
+    {
+        // name[:key=value]..., with the keys of predictor_config_set
+        string spec = KnobPredict.Value(i);
+        size_t colon = spec.find(':');
+        int type = predictor_type_by_name(spec.substr(0, colon).c_str());
+        if (type < 0 || type == PLUGIN)
+        {
+            cerr << "Error: unknown predictor " << spec << endl;
+            return 1;
+        }
+        predictor_config_t cfg = predictor_default_config(type);
+        while (colon != string::npos)
+        {
+            size_t next = spec.find(':', colon + 1);
+            string field = spec.substr(colon + 1, next == string::npos ? string::npos : next - colon - 1);
+            size_t eq = field.find('=');
+            if (eq == string::npos || !predictor_config_set(&cfg, field.substr(0, eq).c_str(), strtol(field.c_str() + eq + 1, NULL, 0)))
+            {
+                cerr << "Error: bad predictor setting " << field << endl;
+                return 1;
+            }
+            colon = next;
+        }
+        predictor_t *p = predictor_create(&cfg);
+        if (!p)
+        {
+            cerr << "Error: invalid predictor configuration " << spec << endl;
+            return 1;
+        }
+        predictor_destroy(p);
+        predictNames.push_back(spec);
+        predictConfigs.push_back(cfg);
+    }
+    shmStream = !KnobShm.Value().empty();
+    if (shmStream && !predictConfigs.empty())
+    {
+        cerr << "Error: -shm and -predict can not be combined" << endl;
+        return 1;
+    }
+    profileOnly = KnobProfileOnly;
+    if (profileOnly && (shmStream || !predictConfigs.empty() || bbvInterval || samplePeriod || KnobFollowChild))
+    {
+        cerr << "Error: -profile_only can not be combined with -shm, -predict, -bbv, -sample_period or -follow_child" << endl;
+        return 1;
+    }
+    gating = !KnobMarkerBegin.Value().empty() || !KnobMarkerEnd.Value().empty() || KnobToggleSignal.Value();
+    gateClosed = gating;
+    if (gating && profileOnly)
+    {
+        cerr << "Error: -profile_only can not be combined with -marker_begin, -marker_end or -toggle_signal" << endl;
+        return 1;
+    }
+    if (shmStream && KnobFollowChild)
+    {
+        cerr << "Error: -shm and -follow_child can not be combined" << endl;
+        return 1;
+    }
+    if (KnobFollowChild)
+        SetProcessTag();
+    if (shmStream)
+    {
+        shmRing = shm_ring_create(KnobShm.Value().c_str(), KnobShmReaders.Value());
+        if (!shmRing)
+        {
+            cerr << "Error: could not create the ring /dev/shm/" << KnobShm.Value() << " for "
+                 << KnobShmReaders.Value() << " readers, 1 to " << SHM_RING_MAX_READERS << endl;
+            return 1;
+        }
+    }
+    icountRecords = KnobIcount && predictConfigs.empty() && !shmStream && !profileOnly;
     cout << "My offset " << offset_inst << endl;
 
     cout << KnobHowManyBranch.Value() << endl;
@@ -561,14 +2053,66 @@ int main(INT32 argc, CHAR **argv)
 {
     PIN_Init(argc, argv);
     PIN_InitSymbols();
+    attached = PIN_IsAttaching();
 
-    InitFile();
+    if (InitFile())
+        return 1;
 
-    INS_AddInstrumentFunction(Instruction, 0);
+    bufId = PIN_DefineTraceBuffer(sizeof(BRANCH_RECORD), KnobNumPagesInBuffer, BufferFull, 0);
+    stateReg = PIN_ClaimToolRegister();
+    icountReg = PIN_ClaimToolRegister();
+    gateReg = PIN_ClaimToolRegister();
+    if (bufId == BUFFER_ID_INVALID || !REG_valid(stateReg) || !REG_valid(icountReg) || !REG_valid(gateReg))
+    {
+        cerr << "Error: could not allocate the branch buffer" << endl;
+        return 1;
+    }
+    if (KnobToggleSignal.Value() &&
+        (!PIN_InterceptSignal(KnobToggleSignal.Value(), ToggleSignal, 0) || !PIN_UnblockSignal(KnobToggleSignal.Value(), TRUE)))
+    {
+        cerr << "Error: could not intercept signal " << KnobToggleSignal.Value() << endl;
+        return 1;
+    }
+    stateKey = PIN_CreateThreadDataKey(0);
+    PIN_InitLock(&threadLock);
+    PIN_InitLock(&outLock);
+    PIN_InitLock(&writeLock);
+    PIN_SemaphoreInit(&writeReady);
+    PIN_SemaphoreInit(&writeDone);
+    if (PIN_SpawnInternalThread(Writer, 0, 0, &writerUid) == INVALID_THREADID)
+    {
+        cerr << "Error: could not start the writer thread" << endl;
+        return 1;
+    }
+    PIN_AddPrepareForFiniFunction(StopWriter, 0);
+    PIN_SemaphoreInit(&progressStop);
+    if (KnobProgress.Value() && !profileOnly)
+    {
+        progressRunning = PIN_SpawnInternalThread(Progress, 0, 0, &progressUid) != INVALID_THREADID;
+        PIN_AddPrepareForFiniFunction(StopProgress, 0);
+    }
+    PIN_AddThreadStartFunction(ThreadStart, 0);
+    PIN_AddThreadFiniFunction(ThreadFini, 0);
+    if (KnobFollowChild)
+    {
+        PIN_AddForkFunction(FPOINT_BEFORE, BeforeFork, 0);
+        PIN_AddForkFunction(FPOINT_AFTER_IN_PARENT, AfterForkInParent, 0);
+        PIN_AddForkFunction(FPOINT_AFTER_IN_CHILD, AfterForkInChild, 0);
+        PIN_AddFollowChildProcessFunction(FollowChild, 0);
+    }
+
+    TRACE_AddInstrumentFunction(Trace, 0);
     IMG_AddInstrumentFunction(ImageLoad, 0);
+    IMG_AddUnloadFunction(ImageUnload, 0);
+
+    // Without -control the default start event opens the region at the
+    // first instruction
+    control.RegisterHandler(ControlHandler, 0, TRUE);
+    control.Activate();
 
     // Register Fini to be called when the application exits
     PIN_AddFiniFunction(Fini, 0);
+    PIN_AddDetachFunction(Detach, 0);
 
     PIN_StartProgram();
     return 0;
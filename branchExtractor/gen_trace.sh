@@ -1,13 +1,168 @@
 #!/bin/bash
+# ./gen_trace.sh <program> <trace_name> [text|bin|ids|zstd]
+# ./gen_trace.sh -p <pid> <trace_name> [bin|text|ids|zstd]
+# ./gen_trace.sh -batch <manifest> [jobs] [out_dir]
 BRANCH_EXT_ROOT=$(dirname $(realpath -s $0))
 
-make -C ${BRANCH_EXT_ROOT}
+# The jobs of a batch are started built
+build() {
+    [ -n "$GEN_TRACE_BUILT" ] || make -C "$@"
+}
 
-${BRANCH_EXT_ROOT}/pin_tool/pin -t ${BRANCH_EXT_ROOT}/obj-intel64/branchExt.so -- $1
+if [ "$1" = -batch ]; then
+    # Trace every workload of the manifest, a line "<name> <format>
+    # <command...>" each ('#' starts a comment), <jobs> at a time (half
+    # the cores by default). A job gets cores of its own, with taskset,
+    # and runs in <out_dir>/<name> (default traces/<name>), so its files
+    # can not collide with another job's; it compresses its trace as it
+    # is written, as a single run does. <out_dir>/index.tsv sums the
+    # jobs up once all are done
+    MANIFEST=$2
+    CORES=$(nproc)
+    JOBS=${3:-$(( CORES > 1 ? CORES / 2 : 1 ))}
+    DIR=${4:-traces}
+    PER_JOB=$(( CORES / JOBS > 0 ? CORES / JOBS : 1 ))
+    [ -r "$MANIFEST" ] || { echo "Error: can not read $MANIFEST" >&2; exit 1; }
+    make -C ${BRANCH_EXT_ROOT} && make -C ${BRANCH_EXT_ROOT}/../src tobin bpzip || exit 1
+    mkdir -p "$DIR" || exit 1
 
-mv branches_0.out $2
-mv generalInfo_0.out "$2.txt"
+    declare -A SLOT_PID FORMATS
+    NAMES=()
+    while read -r NAME FORMAT COMMAND; do
+        case "$NAME" in ''|'#'*) continue ;; esac
+        if [ -n "${FORMATS[$NAME]}" ] || [ -z "$COMMAND" ]; then
+            echo "Error: $MANIFEST: $NAME is given twice or has no command" >&2
+            exit 1
+        fi
+        NAMES+=("$NAME")
+        FORMATS[$NAME]=$FORMAT
+        # the first slot whose job is done
+        SLOT=
+        while [ -z "$SLOT" ]; do
+            for ((s = 0; s < JOBS; s++)); do
+                if [ -z "${SLOT_PID[$s]}" ] || ! kill -0 ${SLOT_PID[$s]} 2>/dev/null; then
+                    SLOT=$s
+                    break
+                fi
+            done
+            [ -n "$SLOT" ] || wait -n
+        done
+        FIRST=$(( SLOT * PER_JOB % CORES ))
+        CPUS=$FIRST-$(( FIRST + PER_JOB - 1 ))
+        echo "$NAME on cores $CPUS"
+        mkdir -p "$DIR/$NAME"
+        (
+            cd "$DIR/$NAME" || exit 1
+            START=$(date +%s)
+            GEN_TRACE_BUILT=1 taskset -c $CPUS "$BRANCH_EXT_ROOT/gen_trace.sh" "$COMMAND" "$NAME" "$FORMAT" < /dev/null > log 2>&1
+            echo "$? $(( $(date +%s) - START ))" > status
+        ) &
+        SLOT_PID[$SLOT]=$!
+    done < "$MANIFEST"
+    wait
 
-echo "bzip2 in progress - it may take a while"
+    FAILED=0
+    printf 'name\tformat\tstatus\tseconds\ttrace\tbytes\tinstructions\tconditional\tunconditional\n' > "$DIR/index.tsv"
+    for NAME in "${NAMES[@]}"; do
+        JOB="$DIR/$NAME"
+        read STATUS ELAPSED < "$JOB/status" 2>/dev/null
+        TRACE=$(cd "$JOB" && ls "$NAME.bz2" "$NAME.bpz" 2>/dev/null | head -1)
+        # a tool that fails, e.g. on its trace file, still leaves the
+        # script's status 0, but no info file and an empty trace
+        if [ "$STATUS" = 0 ] && { [ -z "$TRACE" ] || [ ! -s "$JOB/$TRACE" ] || [ ! -s "$JOB/$NAME.txt" ]; }; then
+            STATUS=1
+        fi
+        count() {
+            sed -n "s/^!!! Number of $1 = //p" "$JOB/$NAME.txt" 2>/dev/null | head -1
+        }
+        printf '%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n' "$NAME" "${FORMATS[$NAME]}" "$STATUS" "$ELAPSED" \
+            "$NAME/$TRACE" "$( [ -n "$TRACE" ] && stat -c %s "$JOB/$TRACE")" \
+            "$(count Instructions)" "$(count 'Conditional branches')" "$(count 'Unconditional branches')" >> "$DIR/index.tsv"
+        if [ "$STATUS" != 0 ] || [ -z "$TRACE" ]; then
+            echo "$NAME failed, see $JOB/log" >&2
+            FAILED=1
+        fi
+    done
+    echo "${#NAMES[@]} traces in $DIR, see $DIR/index.tsv"
+    exit $FAILED
+fi
 
-bzip2 -f $2
\ No newline at end of file
+if [ "$1" = -p ]; then
+    # Attach to a running process: Pin returns once it is attached, the
+    # tool writes the trace into the process's working directory and
+    # detaches when it is done
+    PID=$2
+    OUT=$(readlink /proc/$PID/cwd) || exit 1
+    TARGET="-pid $PID"
+    PROGRAM=
+    NAME=$3
+    FORMAT=${4:-bin}
+    rm -f "$OUT/branches_0.out" "$OUT/branches_0.out.icnt" "$OUT/generalInfo_0.out" "$OUT/branches.tbl"
+else
+    OUT=.
+    TARGET=
+    PROGRAM="-- $1"
+    NAME=$2
+    FORMAT=${3:-text}
+fi
+
+# An attached trace is done once the process has closed its files, or
+# has exited: the info file, or the branch table written after it
+wait_trace() {
+    [ -n "$PID" ] || return 0
+    LAST=generalInfo_0.out
+    [ "$FORMAT" = ids ] && LAST=branches.tbl
+    while [ ! -e "$OUT/$LAST" ] && kill -0 $PID 2>/dev/null; do
+        sleep 1
+    done
+    while ls -l /proc/$PID/fd 2>/dev/null | grep -q "$OUT/\(branches_0.out\|generalInfo_0.out\|branches.tbl\)"; do
+        sleep 1
+    done
+}
+
+# A program Pin could not start never opens the pipe, and its reader
+# would wait in open for ever: opening it both ways never blocks, and
+# closing it again is the end of the trace. Pin returns from an attach
+# before the tool opens it, so not then
+release_pipe() {
+    [ -n "$PID" ] || : <> "$OUT/branches_0.out"
+}
+
+build ${BRANCH_EXT_ROOT}
+
+if [ "$FORMAT" = zstd ]; then
+    # The binary trace goes through a pipe into tobin, which writes the
+    # seekable zstd container as it arrives
+    build ${BRANCH_EXT_ROOT}/../src tobin
+    rm -f "$OUT/branches_0.out"
+    mkfifo "$OUT/branches_0.out"
+    ${BRANCH_EXT_ROOT}/../src/tobin --codec=zstd "$OUT/branches_0.out" "$NAME.bpz" &
+    ${BRANCH_EXT_ROOT}/pin_tool/pin $TARGET -t ${BRANCH_EXT_ROOT}/obj-intel64/branchExt.so -format bin $PROGRAM
+    release_pipe
+    wait
+    wait_trace
+    rm -f "$OUT/branches_0.out"
+    mv "$OUT/branches_0.out.icnt" "$NAME.bpz.icnt" 2>/dev/null
+    mv "$OUT/generalInfo_0.out" "$NAME.txt"
+    exit 0
+fi
+
+# The other formats go through a pipe into bpzip, which compresses
+# them on a pool of threads as they arrive, into one bzip2 stream per
+# chunk that the simulator decodes in parallel
+build ${BRANCH_EXT_ROOT}/../src bpzip
+rm -f "$OUT/branches_0.out"
+mkfifo "$OUT/branches_0.out"
+${BRANCH_EXT_ROOT}/../src/bpzip "$OUT/branches_0.out" "$NAME.bz2" &
+${BRANCH_EXT_ROOT}/pin_tool/pin $TARGET -t ${BRANCH_EXT_ROOT}/obj-intel64/branchExt.so -format ${FORMAT} $PROGRAM
+release_pipe
+wait
+wait_trace
+rm -f "$OUT/branches_0.out"
+
+# the instruction counts keep the name without .bz2, see src/icount.h
+mv "$OUT/branches_0.out.icnt" "$NAME.icnt" 2>/dev/null
+mv "$OUT/generalInfo_0.out" "$NAME.txt"
+if [ "$FORMAT" = ids ]; then
+    mv "$OUT/branches.tbl" "$NAME.tbl"
+fi
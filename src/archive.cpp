@@ -0,0 +1,348 @@
+//========================================================//
+//  archive.cpp                                           //
+//  Source file for trace archives                        //
+//                                                        //
+//  The archive is mapped; a reader decodes one chunk at  //
+//  a time into a buffer of its own, so a member streams  //
+//  at the speed of zstd and seeks to any chunk           //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "archive.h"
+#include "codec.h"
+
+struct archive_reader
+{
+  void *map;
+  size_t map_len;
+  archive_chunk_t *chunks; // of the member, in stream order
+  uint64_t *starts;        // stream offset of each, and the size
+  uint64_t num_chunks;
+  codec_dict_t *codec;
+  char *chunk; // the decoded chunk next_chunk - 1
+  size_t chunk_len, chunk_pos;
+  uint64_t next_chunk;
+};
+
+// Random 64-bit values per byte value, from splitmix64, fixed as the
+// boundaries of archives already written depend on them
+static uint64_t archive_gear[256];
+
+static void archive_gear_init()
+{
+  uint64_t x = 0x9E3779B97F4A7C15ULL;
+  for (int i = 0; i < 256; i++)
+  {
+    uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    archive_gear[i] = z ^ (z >> 31);
+  }
+}
+
+size_t archive_cut(const char *p, size_t len)
+{
+  if (!archive_gear[0])
+  {
+    archive_gear_init();
+  }
+  if (len <= ARCHIVE_CHUNK_MIN)
+  {
+    return len;
+  }
+  // The hash shifts left, so its high bits see the last 64 bytes; a
+  // boundary is where those bits are clear
+  const uint64_t mask = ((1ULL << ARCHIVE_CHUNK_BITS) - 1) << (64 - ARCHIVE_CHUNK_BITS);
+  size_t end = len < ARCHIVE_CHUNK_MAX ? len : ARCHIVE_CHUNK_MAX;
+  uint64_t h = 0;
+  for (size_t i = ARCHIVE_CHUNK_MIN - 64; i < ARCHIVE_CHUNK_MIN; i++)
+  {
+    h = (h << 1) + archive_gear[(uint8_t)p[i]];
+  }
+  for (size_t i = ARCHIVE_CHUNK_MIN; i < end; i++)
+  {
+    h = (h << 1) + archive_gear[(uint8_t)p[i]];
+    if (!(h & mask))
+    {
+      return i + 1;
+    }
+  }
+  return end;
+}
+
+int archive_is_path(const char *path)
+{
+  if (!path)
+  {
+    return 0;
+  }
+  size_t n = strlen(path), s = strlen(ARCHIVE_SUFFIX);
+  return strstr(path, ARCHIVE_SUFFIX ":") || (n > s && !strcmp(path + n - s, ARCHIVE_SUFFIX));
+}
+
+// Split 'path' into the archive file and the member name, "" for none
+//
+static void archive_split(const char *path, std::string *file, std::string *member)
+{
+  const char *colon = strstr(path, ARCHIVE_SUFFIX ":");
+  if (colon)
+  {
+    colon += strlen(ARCHIVE_SUFFIX);
+    *file = std::string(path, colon - path);
+    *member = colon + 1;
+  }
+  else
+  {
+    *file = path;
+    *member = "";
+  }
+}
+
+// Map the archive 'file' and check its header and tables
+//
+// Returns the mapping, NULL if it can not be read, which is reported
+//
+static const archive_header_t *archive_map(const char *file, size_t *map_len)
+{
+  int fd = open(file, O_RDONLY);
+  if (fd < 0)
+  {
+    fprintf(stderr, "Error: can not open %s\n", file);
+    return NULL;
+  }
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (!fstat(fd, &st) && (size_t)st.st_size >= sizeof(archive_header_t))
+  {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    fprintf(stderr, "Error: %s is not a trace archive\n", file);
+    return NULL;
+  }
+  const archive_header_t *hdr = (const archive_header_t *)map;
+  size_t len = st.st_size;
+  if (memcmp(hdr->magic, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LEN) || hdr->version != ARCHIVE_VERSION ||
+      hdr->dict_offset + hdr->dict_size > len || hdr->num_chunks > len / sizeof(archive_chunk_t) ||
+      hdr->chunks_offset + hdr->num_chunks * sizeof(archive_chunk_t) > len ||
+      hdr->members_offset + (uint64_t)hdr->num_members * sizeof(archive_member_t) > len ||
+      hdr->num_refs > len / sizeof(uint32_t) || hdr->refs_offset + hdr->num_refs * sizeof(uint32_t) > len)
+  {
+    fprintf(stderr, "Error: %s is not a trace archive of version %u\n", file, ARCHIVE_VERSION);
+    munmap(map, len);
+    return NULL;
+  }
+  *map_len = len;
+  return hdr;
+}
+
+static void archive_member(const archive_header_t *hdr, uint32_t i, archive_member_t *m)
+{
+  memcpy(m, (const char *)hdr + hdr->members_offset + (uint64_t)i * sizeof(archive_member_t), sizeof(*m));
+  m->name[ARCHIVE_NAME_LEN - 1] = '\0';
+}
+
+int archive_expand(const char *path, std::vector<std::string> *paths, std::vector<uint64_t> *sizes)
+{
+  if (!archive_is_path(path))
+  {
+    return -1;
+  }
+  std::string file, name;
+  archive_split(path, &file, &name);
+  size_t map_len;
+  const archive_header_t *hdr = archive_map(file.c_str(), &map_len);
+  if (!hdr)
+  {
+    return -1;
+  }
+  int n = 0;
+  for (uint32_t i = 0; i < hdr->num_members; i++)
+  {
+    archive_member_t m;
+    archive_member(hdr, i, &m);
+    if (name.empty() || name == m.name)
+    {
+      paths->push_back(file + ":" + m.name);
+      sizes->push_back(m.size);
+      n++;
+    }
+  }
+  munmap((void *)hdr, map_len);
+  return n;
+}
+
+archive_reader_t *archive_open(const char *path)
+{
+  std::string file, name;
+  archive_split(path, &file, &name);
+  size_t map_len;
+  const archive_header_t *hdr = archive_map(file.c_str(), &map_len);
+  if (!hdr)
+  {
+    return NULL;
+  }
+  archive_reader_t *a = (archive_reader_t *)calloc(1, sizeof(archive_reader_t));
+  a->map = (void *)hdr;
+  a->map_len = map_len;
+
+  // The member by name, or the only one
+  archive_member_t m;
+  uint32_t i = 0;
+  for (; i < hdr->num_members; i++)
+  {
+    archive_member(hdr, i, &m);
+    if (name.empty() ? hdr->num_members == 1 : name == m.name)
+    {
+      break;
+    }
+  }
+  if (i == hdr->num_members)
+  {
+    fprintf(stderr, "Error: %s %s, its members are\n", file.c_str(),
+            name.empty() ? "holds several traces" : "has no such trace");
+    for (i = 0; i < hdr->num_members; i++)
+    {
+      archive_member(hdr, i, &m);
+      fprintf(stderr, "  %s:%s\n", file.c_str(), m.name);
+    }
+    archive_close(a);
+    return NULL;
+  }
+
+  // Its chunks in stream order
+  const char *base = (const char *)hdr;
+  int ok = m.first_ref + m.num_refs <= hdr->num_refs;
+  a->num_chunks = ok ? m.num_refs : 0;
+  a->chunks = (archive_chunk_t *)malloc((a->num_chunks + 1) * sizeof(archive_chunk_t));
+  a->starts = (uint64_t *)malloc((a->num_chunks + 1) * sizeof(uint64_t));
+  a->chunk = (char *)malloc(ARCHIVE_CHUNK_MAX);
+  if (!a->chunks || !a->starts || !a->chunk)
+  {
+    fprintf(stderr, "Error: archive reader malloc failed\n");
+    exit(1);
+  }
+  uint64_t size = 0;
+  for (uint64_t k = 0; ok && k < a->num_chunks; k++)
+  {
+    uint32_t ref;
+    memcpy(&ref, base + hdr->refs_offset + (m.first_ref + k) * sizeof(uint32_t), sizeof(ref));
+    ok = ref < hdr->num_chunks;
+    if (ok)
+    {
+      memcpy(&a->chunks[k], base + hdr->chunks_offset + (uint64_t)ref * sizeof(archive_chunk_t), sizeof(archive_chunk_t));
+      ok = a->chunks[k].offset + a->chunks[k].comp_size <= map_len && a->chunks[k].raw_size <= ARCHIVE_CHUNK_MAX;
+      a->starts[k] = size;
+      size += a->chunks[k].raw_size;
+    }
+  }
+  a->starts[a->num_chunks] = size;
+  a->codec = ok && size == m.size ? codec_dict_open(base + hdr->dict_offset, hdr->dict_size, 0) : NULL;
+  if (!a->codec)
+  {
+    fprintf(stderr, "Error: %s can not be read%s\n", path, ok && size == m.size ? ", zstd is missing" : "");
+    archive_close(a);
+    return NULL;
+  }
+  madvise(a->map, a->map_len, MADV_SEQUENTIAL);
+  return a;
+}
+
+// Decode the next chunk of the stream
+//
+// Returns True if Successful
+//
+static int archive_next(archive_reader_t *a)
+{
+  if (a->next_chunk == a->num_chunks)
+  {
+    return 0;
+  }
+  const archive_chunk_t *c = &a->chunks[a->next_chunk];
+  a->chunk_len = codec_dict_decompress(a->codec, a->chunk, ARCHIVE_CHUNK_MAX, (const char *)a->map + c->offset,
+                                       c->comp_size);
+  a->chunk_pos = 0;
+  if (a->chunk_len != c->raw_size)
+  {
+    fprintf(stderr, "Error: trace archive chunk %llu is corrupt\n", (unsigned long long)a->next_chunk);
+    a->next_chunk = a->num_chunks;
+    a->chunk_len = 0;
+    return 0;
+  }
+  a->next_chunk++;
+  return 1;
+}
+
+size_t archive_read(archive_reader_t *a, char *dst, size_t cap)
+{
+  size_t n = 0;
+  while (n < cap && (a->chunk_pos < a->chunk_len || archive_next(a)))
+  {
+    size_t k = a->chunk_len - a->chunk_pos < cap - n ? a->chunk_len - a->chunk_pos : cap - n;
+    memcpy(dst + n, a->chunk + a->chunk_pos, k);
+    a->chunk_pos += k;
+    n += k;
+  }
+  return n;
+}
+
+int archive_seek(archive_reader_t *a, uint64_t offset)
+{
+  if (offset > a->starts[a->num_chunks])
+  {
+    return 0;
+  }
+
+  // Last chunk starting at or before 'offset'
+  uint64_t lo = 0, hi = a->num_chunks;
+  while (hi - lo > 1)
+  {
+    uint64_t mid = (lo + hi) / 2;
+    if (a->starts[mid] <= offset)
+    {
+      lo = mid;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  a->next_chunk = lo;
+  a->chunk_pos = a->chunk_len = 0;
+  if (offset == a->starts[a->num_chunks])
+  {
+    a->next_chunk = a->num_chunks;
+    return 1;
+  }
+  if (!archive_next(a))
+  {
+    return 0;
+  }
+  a->chunk_pos = offset - a->starts[lo];
+  return 1;
+}
+
+void archive_close(archive_reader_t *a)
+{
+  if (!a)
+  {
+    return;
+  }
+  codec_dict_close(a->codec);
+  if (a->map)
+  {
+    munmap(a->map, a->map_len);
+  }
+  free(a->chunks);
+  free(a->starts);
+  free(a->chunk);
+  free(a);
+}
@@ -0,0 +1,109 @@
+//========================================================//
+//  archive.h                                             //
+//  Header file for trace archives                        //
+//                                                        //
+//  An archive holds a family of traces, e.g. one binary  //
+//  under several inputs, as the binary trace stream of   //
+//  each cut into content-defined chunks. A chunk common  //
+//  to several traces, or repeated in one, is stored      //
+//  once, and every chunk is compressed with zstd and a   //
+//  dictionary trained on the whole family, see bparchive //
+//========================================================//
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// An archive is an archive_header_t, the dictionary, the compressed
+// chunks, then the tables: num_chunks archive_chunk_t, num_members
+// archive_member_t and num_refs uint32 chunk numbers, each member the
+// num_refs of them from first_ref in stream order. All little endian
+#define ARCHIVE_MAGIC "BPARCHV1"
+#define ARCHIVE_MAGIC_LEN 8
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_NAME_LEN 64
+
+// A trace in an archive is named "<archive>.bpa:<member>"; the archive
+// alone stands for all its members, or its only one
+#define ARCHIVE_SUFFIX ".bpa"
+
+// Chunk boundaries: a gear hash of the bytes since the chunk began
+// with its low ARCHIVE_CHUNK_BITS clear, past the minimum size
+#define ARCHIVE_CHUNK_MIN (16 << 10)
+#define ARCHIVE_CHUNK_BITS 16
+#define ARCHIVE_CHUNK_MAX (256 << 10)
+
+typedef struct __attribute__((packed))
+{
+  char magic[ARCHIVE_MAGIC_LEN]; // ARCHIVE_MAGIC, not NUL terminated
+  uint32_t version;              // ARCHIVE_VERSION
+  uint32_t num_members;
+  uint64_t num_chunks;
+  uint64_t num_refs;
+  uint64_t dict_offset;
+  uint64_t dict_size; // 0 when the chunks are compressed without one
+  uint64_t chunks_offset;
+  uint64_t members_offset;
+  uint64_t refs_offset;
+} archive_header_t;
+
+typedef struct __attribute__((packed))
+{
+  uint64_t offset; // of the compressed bytes in the archive
+  uint32_t comp_size;
+  uint32_t raw_size;
+} archive_chunk_t;
+
+typedef struct __attribute__((packed))
+{
+  char name[ARCHIVE_NAME_LEN]; // NUL terminated
+  uint64_t size;               // of the stream
+  uint64_t first_ref;
+  uint64_t num_refs;
+} archive_member_t;
+
+// Length of the next chunk of the 'len' bytes at 'p', all of them at
+// the end of the stream
+//
+size_t archive_cut(const char *p, size_t len);
+
+typedef struct archive_reader archive_reader_t;
+
+// Returns True if 'path' is of an archive, "<file>.bpa" or
+// "<file>.bpa:<member>"
+//
+int archive_is_path(const char *path);
+
+// The member paths 'path' stands for, with the sizes of their streams
+//
+// Returns the number of members, -1 if 'path' is not of an archive or
+// can not be read
+//
+int archive_expand(const char *path, std::vector<std::string> *paths, std::vector<uint64_t> *sizes);
+
+// Open the stream of the member 'path' names
+//
+// Returns NULL if the archive can not be read or has no such member,
+// which is reported
+//
+archive_reader_t *archive_open(const char *path);
+
+// Copy up to 'cap' next bytes of the stream into 'dst'
+//
+// Returns the number of bytes copied, 0 at the end of the stream or on
+// a corrupt chunk, which is reported
+//
+size_t archive_read(archive_reader_t *a, char *dst, size_t cap);
+
+// Continue the stream from byte 'offset', decoding only its chunk
+//
+// Returns True if Successful
+//
+int archive_seek(archive_reader_t *a, uint64_t offset);
+
+void archive_close(archive_reader_t *a);
+
+#endif
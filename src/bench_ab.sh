@@ -0,0 +1,143 @@
+#!/bin/bash
+#
+# A/B speed comparison of two simulator builds: each is a predictor
+# binary, or a plugin .so run by ./predictor --plugin. Over each trace
+# in ../traces, converted once to a mapped binary in $WORK, the two run
+# in turn A, B, A, B, ... $RUNS times each, pinned to core $CPU, so
+# drift over the session hits both alike, after one untimed round.
+#
+#   bench_ab.sh <a> <b>
+#
+# Per trace and over all of them (the sum of one round's traces) it
+# prints the median wall times and the speedup of B over A: the
+# Hodges-Lehmann estimate, the median of every A/B time ratio, with
+# the 95% confidence interval and p-value of the Mann-Whitney rank
+# test. Every run's output, but for the lines of --stats, must be the
+# same as the first; if not, the first difference is shown and the
+# script exits 1.
+#
+# TRACES (glob), PREDICTORS (default the --gshare --tournament --custom
+# options, ignored by plugins), ARGS (more options for both), COUNT
+# (branches per trace, default 5000000), RUNS (default 10) and CPU
+# (default the last core) come from the environment.
+
+SRC=$(dirname $(realpath -s $0))
+TRACES=${TRACES:-$SRC/../traces/*.bz2}
+PREDICTORS=${PREDICTORS:---gshare --tournament --custom}
+COUNT=${COUNT:-5000000}
+RUNS=${RUNS:-10}
+CPU=${CPU:-$(($(nproc) - 1))}
+WORK=${WORK:-${TMPDIR:-/tmp}/bench_e2e}
+
+if [ $# -ne 2 ]; then
+  echo "Usage: bench_ab.sh <predictor binary or plugin.so> <predictor binary or plugin.so>" >&2
+  exit 2
+fi
+
+# build_cmd <build>: the command line running a build
+build_cmd() {
+  case $1 in
+    *.so) echo "$SRC/predictor --plugin=$(realpath $1)" ;;
+    *)    echo "$(realpath $1) $PREDICTORS" ;;
+  esac
+}
+CMD_A=$(build_cmd $1)
+CMD_B=$(build_cmd $2)
+PIN=
+if command -v taskset > /dev/null; then
+  PIN="taskset -c $CPU"
+fi
+
+mkdir -p $WORK || exit 2
+BINS=
+for trace in $TRACES; do
+  name=$(basename $trace .bz2)
+  if [ ! -s $WORK/$name.bin ]; then
+    bzip2 -dc $trace | $SRC/tobin - $WORK/$name.bin > /dev/null || exit 2
+  fi
+  BINS="$BINS $WORK/$name.bin"
+done
+
+# run <command> <trace> <output>: prints the wall microseconds
+run() {
+  local start=$(date +%s%N)
+  $PIN $1 $ARGS --count=$COUNT $2 > $3 || exit 2
+  echo $(( ($(date +%s%N) - start) / 1000 ))
+}
+
+# The accuracy output, without the timings of --stats
+strip() {
+  grep -v -e '^Wall time:' -e '^Peak RSS:' -e '^Branches/sec:' -e 'ns/branch' -e 'Predict+train' -e 'seconds' $1
+}
+
+TIMES=$WORK/ab.times
+: > $TIMES
+# round 0 warms the page cache and is not timed
+for round in $(seq 0 $RUNS); do
+  for side in A B; do
+    cmd=CMD_$side
+    for bin in $BINS; do
+      name=$(basename $bin .bin)
+      us=$(run "${!cmd}" $bin $WORK/ab.out) || exit 2
+      [ $round = 0 ] || echo "$name $side $round $us" >> $TIMES
+      if [ ! -e $WORK/ab.$name.ref ]; then
+        strip $WORK/ab.out > $WORK/ab.$name.ref
+      elif ! strip $WORK/ab.out | diff -q $WORK/ab.$name.ref - > /dev/null; then
+        echo "Outputs differ on $name, run $round of $side:" >&2
+        strip $WORK/ab.out | diff $WORK/ab.$name.ref - | head -10 >&2
+        rm -f $WORK/ab.*.ref
+        exit 1
+      fi
+    done
+    echo "round $round $side" >&2
+  done
+done
+rm -f $WORK/ab.*.ref
+
+echo "A: $CMD_A"
+echo "B: $CMD_B"
+echo "$RUNS runs each of $COUNT branches per trace, ABAB order${PIN:+, on core $CPU}; outputs identical"
+awk '
+  { t[$1, $2, $3] = $4; sum[$2, $3] += $4; names[$1] = 1; runs = $3 > runs ? $3 : runs }
+
+  function median(v, n,    i, j, x) {
+    for (i = 2; i <= n; i++) { x = v[i]; for (j = i - 1; j > 0 && v[j] > x; j--) v[j + 1] = v[j]; v[j + 1] = x }
+    return n % 2 ? v[(n + 1) / 2] : (v[n / 2] + v[n / 2 + 1]) / 2
+  }
+
+  # Hodges-Lehmann speedup, its 95% interval and the Mann-Whitney
+  # p-value (normal approximation) of the A and B times in a[], b[]
+  function compare(label, a, b, n,    i, j, k, d, va, vb, u, mu, sd, z, p, c, lo, hi, x) {
+    k = 0; u = 0
+    for (i = 1; i <= n; i++) {
+      va[i] = a[i]; vb[i] = b[i]
+      for (j = 1; j <= n; j++) {
+        d[++k] = log(a[i] / b[j])
+        u += a[i] > b[j] ? 1 : a[i] == b[j] ? 0.5 : 0
+      }
+    }
+    for (i = 2; i <= k; i++) { x = d[i]; for (j = i - 1; j > 0 && d[j] > x; j--) d[j + 1] = d[j]; d[j + 1] = x }
+    mu = n * n / 2; sd = sqrt(n * n * (2 * n + 1) / 12)
+    z = sd > 0 ? (u - mu) / sd : 0
+    p = erfc(z < 0 ? -z : z)
+    c = int(mu - 1.96 * sd); c = c < 0 ? 0 : c
+    lo = d[c + 1]; hi = d[k - c]
+    printf "%-16s %10.1f %10.1f %8.3fx  [%.3f, %.3f]  p=%.2g\n", label, median(va, n) / 1000, median(vb, n) / 1000,
+           exp(k % 2 ? d[(k + 1) / 2] : (d[k / 2] + d[k / 2 + 1]) / 2), exp(lo), exp(hi), p
+  }
+
+  # erfc(x / sqrt(2)), the two-sided normal tail, by Abramowitz and Stegun 7.1.26
+  function erfc(z,    x, t) {
+    x = z / sqrt(2); t = 1 / (1 + 0.3275911 * x)
+    return t * (0.254829592 + t * (-0.284496736 + t * (1.421413741 + t * (-1.453152027 + t * 1.061405429)))) * exp(-x * x)
+  }
+
+  END {
+    printf "%-16s %10s %10s %9s  %-16s %s\n", "Trace", "A ms", "B ms", "Speedup", "95% interval", "Mann-Whitney"
+    for (name in names) {
+      for (r = 1; r <= runs; r++) { a[r] = t[name, "A", r]; b[r] = t[name, "B", r] }
+      compare(name, a, b, runs)
+    }
+    for (r = 1; r <= runs; r++) { a[r] = sum["A", r]; b[r] = sum["B", r] }
+    compare("all", a, b, runs)
+  }' $TIMES
@@ -0,0 +1,90 @@
+#!/bin/bash
+#
+# End to end replay benchmark: every predictor over each trace in
+# ../traces, read three ways
+#
+#   pipe  bzip2 -dc trace | ./predictor ... -
+#   bz2   ./predictor ... trace.bz2, decompressed in-process
+#   bin   ./predictor ... trace.bin, converted by tobin first and mapped
+#
+# Each run prints --stats; the wall time, peak RSS, branches/sec and
+# the ns/branch of every predictor go to $OUT, one "trace mode metric
+# value" line each, with the hot loop counts of a make HOTCHECK=1
+# build, any of which above 0 fails the run. Given a baseline of the
+# same form, a metric more than $TOLERANCE percent worse is reported
+# and the script exits 1.
+#
+#   bench_e2e.sh [baseline]
+#
+# TRACES (glob), PREDICTORS, COUNT (branches per trace, all by
+# default), TOLERANCE (default 25) and OUT (default bench_e2e.out)
+# come from the environment. The binary traces are kept in $WORK.
+
+SRC=$(dirname $(realpath -s $0))
+TRACES=${TRACES:-$SRC/../traces/*.bz2}
+PREDICTORS=${PREDICTORS:---static --gshare --tournament --custom --perceptron}
+TOLERANCE=${TOLERANCE:-25}
+OUT=${OUT:-bench_e2e.out}
+WORK=${WORK:-${TMPDIR:-/tmp}/bench_e2e}
+BASELINE=$1
+ARGS="--stats $PREDICTORS"
+if [ -n "$COUNT" ]; then
+  ARGS="$ARGS --count=$COUNT"
+fi
+
+mkdir -p $WORK || exit 2
+: > $OUT
+
+# run <trace name> <mode> <command...>
+run() {
+  local name=$1 mode=$2
+  shift 2
+  echo "$name $mode" >&2
+  "$@" | awk -v t=$name -v m=$mode '
+    /^Wall time:/      { print t, m, "wall_s", $3 }
+    /^Peak RSS:/       { print t, m, "rss_mb", $3 }
+    /^Branches\/sec:/  { print t, m, "mbranches_per_s", $2 }
+    /Predict\+train/   { p = NF > 6 ? $2 : "all"; print t, m, p "_ns", $(NF - 1) }
+    /^  Allocations:/  { print t, m, "hot_allocations", $2 }
+    /^  Frees:/        { print t, m, "hot_frees", $2 }
+    /^  Read calls:/   { print t, m, "hot_reads", $3 }
+    /^  Write calls:/  { print t, m, "hot_writes", $3 }
+  ' >> $OUT
+}
+
+for trace in $TRACES; do
+  name=$(basename $trace .bz2)
+  if [ ! -s $WORK/$name.bin ]; then
+    bzip2 -dc $trace | $SRC/tobin - $WORK/$name.bin > /dev/null || exit 2
+  fi
+  run $name pipe bash -c "bzip2 -dc $trace | $SRC/predictor $ARGS -"
+  run $name bz2 $SRC/predictor $ARGS $trace
+  run $name bin $SRC/predictor $ARGS $WORK/$name.bin
+done
+
+# A make HOTCHECK=1 build counts what the replay loop allocates and
+# reads or writes after its first batch, which must be nothing
+if ! awk '$3 ~ /^hot_/ && $4 > 0 { print "Hot loop:", $0; bad = 1 } END { exit bad }' $OUT; then
+  exit 1
+fi
+
+if [ -z "$BASELINE" ]; then
+  exit 0
+fi
+
+# Lower is better for everything but the branch rate
+awk -v tol=$TOLERANCE '
+  NR == FNR { base[$1 " " $2 " " $3] = $4; next }
+  {
+    key = $1 " " $2 " " $3
+    if (!(key in base) || base[key] <= 0) next
+    change = 100 * ($4 - base[key]) / base[key]
+    if ($3 == "mbranches_per_s") change = -change
+    flag = change > tol ? "  WORSE" : ""
+    worse += flag != ""
+    printf "%-32s %12.3f %12.3f %+8.1f%%%s\n", key, base[key], $4, change, flag
+  }
+  END {
+    if (worse) { printf "%d metrics more than %s%% worse than the baseline\n", worse, tol; exit 1 }
+  }
+' $BASELINE $OUT
@@ -0,0 +1,112 @@
+#!/bin/bash
+#
+# Sweep scaling benchmark: fixed sweep grids over each trace in
+# ../traces, at 1, 2, 4, ... and $MAX_JOBS worker threads, under each
+# engine a sweep of that predictor can use. With the 4 shipped traces
+# each grid is 64 points
+#
+#   gshare  16 points, ghistoryBits=10..25
+#           lockstep  packs of 8 points reading the records once
+#           split     lockstep, plus --sweep-split of idle workers
+#   tage    16 points, tageTaggedBits=8..11 x tageBimodalBits=10..13
+#           serial     one point after the other per worker
+#           interleave --sweep-interleave, 2 points per worker
+#           split      --sweep-split of idle workers
+#           block      --sweep-block, 8 points per worker a block each
+#
+# A gshare sweep always replays in lockstep, so it has no serial row.
+# Every run is one JSON object in $OUT: the points, wall seconds,
+# points per second, the parallel efficiency against the same grid and
+# engine on one thread, and with perf(1) installed the memory traffic
+# from the last level cache misses, or null.
+#
+#   bench_scale.sh
+#
+# TRACES (glob), COUNT (records per trace, default 5000000), MAX_JOBS
+# (default one per core) and OUT (default bench_scale.json) come from
+# the environment. The binary traces are kept in $WORK.
+
+SRC=$(dirname $(realpath -s $0))
+TRACES=${TRACES:-$SRC/../traces/*.bz2}
+COUNT=${COUNT:-5000000}
+MAX_JOBS=${MAX_JOBS:-$(nproc)}
+OUT=${OUT:-bench_scale.json}
+WORK=${WORK:-${TMPDIR:-/tmp}/bench_e2e}
+PERF=$(command -v perf)
+
+mkdir -p $WORK || exit 2
+BINS=
+for trace in $TRACES; do
+  name=$(basename $trace .bz2)
+  if [ ! -s $WORK/$name.bin ]; then
+    bzip2 -dc $trace | $SRC/tobin - $WORK/$name.bin > /dev/null || exit 2
+  fi
+  BINS="$BINS $WORK/$name.bin"
+done
+
+GRID_gshare="--sweep=gshare.ghistoryBits=10..25"
+GRID_tage="--sweep=custom.tageTaggedBits=8..11 --sweep=custom.tageBimodalBits=10..13"
+ENGINES_gshare="lockstep split"
+ENGINES_tage="serial interleave split block"
+
+engine_args() {
+  case $1 in
+    interleave) echo --sweep-interleave ;;
+    split)      echo --sweep-split ;;
+    block)      echo --sweep-block ;;
+  esac
+}
+
+# run <grid> <engine> <jobs>: prints "points seconds bytes"
+run() {
+  local grid=GRID_$1
+  local args="${!grid} $(engine_args $2) --jobs=$3 --count=$COUNT"
+  local points=0 bytes=0 start=$(date +%s%N)
+  for bin in $BINS; do
+    if [ -n "$PERF" ]; then
+      n=$($PERF stat -x, -e LLC-load-misses,LLC-store-misses -o $WORK/perf.out $SRC/predictor $args $bin |
+          awk '/^Sweep:/ { print $2 }')
+      bytes=$((bytes + $(awk -F, '$1 ~ /^[0-9]+$/ { n += $1 } END { print n * 64 }' $WORK/perf.out)))
+    else
+      n=$($SRC/predictor $args $bin | awk '/^Sweep:/ { print $2 }')
+    fi
+    points=$((points + ${n:-0}))
+  done
+  echo $points $(( ($(date +%s%N) - start) / 1000 )) $([ -n "$PERF" ] && echo $bytes || echo -)
+}
+
+echo "[" > $OUT
+first=1
+for grid in gshare tage; do
+  engines=ENGINES_$grid
+  for engine in ${!engines}; do
+    base=
+    jobs=1
+    while [ $jobs -le $MAX_JOBS ]; do
+      echo "$grid $engine $jobs" >&2
+      set -- $(run $grid $engine $jobs)
+      [ $first = 1 ] || echo "," >> $OUT
+      first=0
+      awk -v grid=$grid -v engine=$engine -v jobs=$jobs -v points=$1 -v us=$2 -v bytes=$3 -v base=$base '
+        BEGIN {
+          s = us / 1e6
+          pps = s > 0 ? points / s : 0
+          eff = base > 0 ? pps / (jobs * base) : 1
+          mem = bytes == "-" ? "null" : sprintf("%.0f", s > 0 ? bytes / s : 0)
+          printf "  {\"grid\": \"%s\", \"engine\": \"%s\", \"threads\": %d, \"points\": %d, \"seconds\": %.3f,",
+                 grid, engine, jobs, points, s
+          printf " \"points_per_s\": %.3f, \"efficiency\": %.3f, \"memory_bytes_per_s\": %s}", pps, eff, mem
+        }' >> $OUT
+      if [ -z "$base" ]; then
+        base=$(awk -v p=$1 -v us=$2 'BEGIN { printf "%.6f", (us > 0 ? p * 1e6 / us : 0) }')
+      fi
+      if [ $jobs -lt $MAX_JOBS ] && [ $((jobs * 2)) -gt $MAX_JOBS ]; then
+        jobs=$MAX_JOBS
+      else
+        jobs=$((jobs * 2))
+      fi
+    done
+  done
+done
+echo "" >> $OUT
+echo "]" >> $OUT
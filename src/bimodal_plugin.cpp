@@ -0,0 +1,97 @@
+//========================================================//
+//  bimodal_plugin.cpp                                    //
+//  Example predictor plugin                              //
+//                                                        //
+//  A table of 2-bit counters indexed by the pc, built    //
+//  with 'make plugins' and run with                      //
+//  --plugin=libbimodal.so                                //
+//========================================================//
+
+#include <stdio.h>
+#include "bpplugin.h"
+
+#define BIMODAL_BITS 14
+
+typedef struct
+{
+  uint8_t counters[1 << BIMODAL_BITS];
+} bimodal_t;
+
+static void *bimodal_init(void)
+{
+  bimodal_t *b = (bimodal_t *)malloc(sizeof(bimodal_t));
+  if (b)
+  {
+    memset(b->counters, WN, sizeof(b->counters));
+  }
+  return b;
+}
+
+static uint8_t bimodal_predict(void *state, uint32_t pc)
+{
+  bimodal_t *b = (bimodal_t *)state;
+  return b->counters[pc & ((1 << BIMODAL_BITS) - 1)] >= WT;
+}
+
+static uint8_t bimodal_predict_and_train(void *state, uint32_t pc, uint8_t outcome)
+{
+  bimodal_t *b = (bimodal_t *)state;
+  uint8_t *c = &b->counters[pc & ((1 << BIMODAL_BITS) - 1)];
+  uint8_t pred = *c >= WT;
+  if (outcome && *c < ST)
+  {
+    (*c)++;
+  }
+  else if (!outcome && *c > SN)
+  {
+    (*c)--;
+  }
+  return pred;
+}
+
+static void bimodal_train(void *state, uint32_t pc, uint8_t outcome)
+{
+  bimodal_predict_and_train(state, pc, outcome);
+}
+
+static uint64_t bimodal_predict_batch(void *state, const predictor_branch_t *br, size_t n, uint64_t *predictions)
+{
+  uint64_t mispredictions = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (!(br[i].flags & BP_F_CONDITION))
+    {
+      continue;
+    }
+    uint8_t outcome = br[i].flags & BP_F_TAKEN;
+    uint8_t pred = bimodal_predict_and_train(state, br[i].pc, outcome);
+    mispredictions += pred != outcome;
+    if (predictions && pred)
+    {
+      predictions[i >> 6] |= 1ULL << (i & 63);
+    }
+  }
+  return mispredictions;
+}
+
+static void bimodal_free(void *state)
+{
+  free(state);
+}
+
+static uint64_t bimodal_describe(char *buf, size_t len)
+{
+  snprintf(buf, len, "bimodalBits=%d", BIMODAL_BITS);
+  return 2ULL << BIMODAL_BITS;
+}
+
+static const bp_plugin_t bimodal_plugin = {
+  BP_PLUGIN_ABI, "bimodal",
+  bimodal_init, bimodal_predict, bimodal_train, bimodal_predict_and_train,
+  bimodal_predict_batch, bimodal_free, bimodal_describe,
+};
+
+const bp_plugin_t *bp_plugin_info(void)
+{
+  return &bimodal_plugin;
+}
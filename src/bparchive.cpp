@@ -0,0 +1,365 @@
+//========================================================//
+//  bparchive.cpp                                         //
+//  Packs a family of traces into one archive             //
+//                                                        //
+//  ./bparchive gcc.bpa gcc_ref1.bz2 gcc_ref2.bz2         //
+//  ./bparchive --list gcc.bpa                            //
+//  ./predictor --gshare gcc.bpa:gcc_ref1                 //
+//                                                        //
+//  The traces are read twice: once to sample their       //
+//  chunks for the zstd dictionary, then to store each    //
+//  chunk not stored yet, see archive.h                   //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "archive.h"
+#include "codec.h"
+#include "trace.h"
+
+void usage()
+{
+  fprintf(stderr, "Usage: bparchive [options] <output.bpa> <input trace>...\n");
+  fprintf(stderr, "       bparchive --list <archive.bpa>\n");
+  fprintf(stderr, " Options:\n");
+  fprintf(stderr, " --level=<n>               zstd level (default 19)\n");
+  fprintf(stderr, " --dict-size=<KB>          Dictionary size, 0 for none (default 112)\n");
+}
+
+// Samples of the chunks the dictionary is trained on, the first
+// ARCHIVE_SAMPLE bytes of each, kept for a uniform choice of up to
+// ARCHIVE_SAMPLES chunks
+#define ARCHIVE_SAMPLE 4096
+#define ARCHIVE_SAMPLES 4096
+
+typedef struct
+{
+  std::string path, name;
+  uint64_t num_records;
+  uint64_t first_ref, num_refs;
+} bparchive_input_t;
+
+static int level = 19;
+static size_t dict_cap = 112 << 10;
+
+static std::vector<char> samples;       // ARCHIVE_SAMPLE bytes per slot
+static std::vector<size_t> sample_sizes;
+static uint64_t chunks_seen;
+static uint64_t sample_rng = 0x853C49E6748FEA9BULL;
+
+static FILE *out;
+static uint64_t out_offset;
+static codec_dict_t *codec;
+static std::vector<char> comp;
+static std::vector<char> verify;
+static std::vector<archive_chunk_t> chunks;
+static std::vector<uint32_t> refs;
+static std::unordered_multimap<uint64_t, uint32_t> chunk_by_hash;
+static uint64_t dedup_bytes;
+
+// Member name of the trace at 'path': its file name up to the first dot
+//
+static std::string bparchive_name(const std::string &path)
+{
+  size_t slash = path.rfind('/');
+  std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+  return name.substr(0, name.find('.'));
+}
+
+static uint64_t bparchive_hash(const char *p, size_t len)
+{
+  uint64_t h = len * 0x9E3779B97F4A7C15ULL;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8)
+  {
+    uint64_t w;
+    memcpy(&w, p + i, 8);
+    h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 32;
+  }
+  for (; i < len; i++)
+  {
+    h = (h ^ (uint8_t)p[i]) * 0xC4CEB9FE1A85EC53ULL;
+  }
+  return h ^ (h >> 29);
+}
+
+// Pass 1: keep a sample of the chunk, replacing a random one once
+// the slots are full
+//
+static void bparchive_sample(const char *p, size_t len)
+{
+  size_t n = len < ARCHIVE_SAMPLE ? len : ARCHIVE_SAMPLE;
+  uint64_t slot = chunks_seen++;
+  if (slot >= ARCHIVE_SAMPLES)
+  {
+    sample_rng = sample_rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    slot = (sample_rng >> 33) % chunks_seen;
+    if (slot >= ARCHIVE_SAMPLES)
+    {
+      return;
+    }
+  }
+  if (slot == sample_sizes.size())
+  {
+    sample_sizes.push_back(0);
+    samples.resize(samples.size() + ARCHIVE_SAMPLE);
+  }
+  memcpy(&samples[slot * ARCHIVE_SAMPLE], p, n);
+  sample_sizes[slot] = n;
+}
+
+// Pass 2: refer to the stored chunk equal to this one, or store it
+//
+static void bparchive_store(const char *p, size_t len)
+{
+  uint64_t h = bparchive_hash(p, len);
+  auto range = chunk_by_hash.equal_range(h);
+  for (auto it = range.first; it != range.second; ++it)
+  {
+    const archive_chunk_t *c = &chunks[it->second];
+    if (c->raw_size != len)
+    {
+      continue;
+    }
+    // Equal hashes are checked against the bytes stored
+    fflush(out);
+    comp.resize(c->comp_size);
+    verify.resize(ARCHIVE_CHUNK_MAX);
+    if (pread(fileno(out), comp.data(), c->comp_size, c->offset) == (ssize_t)c->comp_size &&
+        codec_dict_decompress(codec, verify.data(), verify.size(), comp.data(), c->comp_size) == len &&
+        !memcmp(verify.data(), p, len))
+    {
+      refs.push_back(it->second);
+      dedup_bytes += len;
+      return;
+    }
+  }
+
+  comp.resize(codec_bound(CODEC_ZSTD, len));
+  size_t n = codec_dict_compress(codec, comp.data(), comp.size(), p, len);
+  if (!n || fwrite(comp.data(), 1, n, out) != n)
+  {
+    fprintf(stderr, "Error: compressing a chunk failed\n");
+    exit(1);
+  }
+  archive_chunk_t c;
+  c.offset = out_offset;
+  c.comp_size = (uint32_t)n;
+  c.raw_size = (uint32_t)len;
+  out_offset += n;
+  chunk_by_hash.emplace(h, (uint32_t)chunks.size());
+  refs.push_back((uint32_t)chunks.size());
+  chunks.push_back(c);
+}
+
+// Cut the binary trace stream of 'in' into chunks for 'chunk', a
+// header counting 'num_records' and then its records
+//
+// Returns the number of records
+//
+static uint64_t bparchive_stream(const bparchive_input_t *in, uint64_t num_records, void (*chunk)(const char *, size_t))
+{
+  trace_reader_t *tr = trace_open(in->path.c_str());
+  if (!tr)
+  {
+    fprintf(stderr, "Error: can not open %s\n", in->path.c_str());
+    exit(1);
+  }
+  std::vector<char> buf(2 * ARCHIVE_CHUNK_MAX + TRACE_BATCH * sizeof(branch_record_t));
+  std::vector<branch_record_t> recs(TRACE_BATCH);
+  trace_header_t hdr;
+  memcpy(hdr.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+  hdr.version = TRACE_VERSION;
+  hdr.record_size = sizeof(branch_record_t);
+  hdr.num_records = num_records;
+  memcpy(buf.data(), &hdr, sizeof(hdr));
+  size_t len = sizeof(hdr);
+  uint64_t records = 0;
+  for (;;)
+  {
+    const branch_record_t *view;
+    size_t n = trace_read_span(tr, recs.data(), TRACE_BATCH, &view);
+    memcpy(buf.data() + len, view, n * sizeof(branch_record_t));
+    len += n * sizeof(branch_record_t);
+    records += n;
+
+    // Whole chunks while another may follow, the rest at the end
+    size_t done = 0;
+    while (len - done >= (n ? ARCHIVE_CHUNK_MAX : 1))
+    {
+      size_t k = archive_cut(buf.data() + done, len - done);
+      chunk(buf.data() + done, k);
+      done += k;
+    }
+    memmove(buf.data(), buf.data() + done, len - done);
+    len -= done;
+    if (!n)
+    {
+      break;
+    }
+  }
+  trace_close(tr);
+  return records;
+}
+
+static int bparchive_list(const char *path)
+{
+  std::vector<std::string> paths;
+  std::vector<uint64_t> sizes;
+  if (archive_expand(path, &paths, &sizes) < 0)
+  {
+    return 1;
+  }
+  for (size_t i = 0; i < paths.size(); i++)
+  {
+    printf("%s %llu records\n", paths[i].c_str(),
+           (unsigned long long)((sizes[i] - sizeof(trace_header_t)) / sizeof(branch_record_t)));
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  std::vector<bparchive_input_t> inputs;
+  const char *path = NULL;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strcmp(argv[i], "--list") && i + 1 < argc)
+    {
+      return bparchive_list(argv[i + 1]);
+    }
+    else if (!strncmp(argv[i], "--level=", 8))
+    {
+      level = atoi(argv[i] + 8);
+    }
+    else if (!strncmp(argv[i], "--dict-size=", 12))
+    {
+      dict_cap = (size_t)atoi(argv[i] + 12) << 10;
+    }
+    else if (!strncmp(argv[i], "--", 2))
+    {
+      usage();
+      exit(1);
+    }
+    else if (!path)
+    {
+      path = argv[i];
+    }
+    else
+    {
+      bparchive_input_t in;
+      in.path = argv[i];
+      in.name = bparchive_name(in.path);
+      if (in.name.empty() || in.name.size() >= ARCHIVE_NAME_LEN)
+      {
+        fprintf(stderr, "Error: %s does not name a trace of the archive\n", argv[i]);
+        exit(1);
+      }
+      for (size_t k = 0; k < inputs.size(); k++)
+      {
+        if (inputs[k].name == in.name)
+        {
+          fprintf(stderr, "Error: %s and %s are both named %s\n", inputs[k].path.c_str(), argv[i], in.name.c_str());
+          exit(1);
+        }
+      }
+      inputs.push_back(in);
+    }
+  }
+  if (!path || inputs.empty())
+  {
+    usage();
+    exit(1);
+  }
+  if (!codec_available(CODEC_ZSTD))
+  {
+    fprintf(stderr, "Error: libzstd.so.1 can not be loaded\n");
+    exit(1);
+  }
+
+  // Pass 1: count the records and train the dictionary
+  for (size_t i = 0; i < inputs.size(); i++)
+  {
+    inputs[i].num_records = bparchive_stream(&inputs[i], 0, bparchive_sample);
+  }
+  std::vector<char> dict(dict_cap + 1);
+  size_t dict_size = dict_cap ? codec_dict_train(dict.data(), dict_cap, samples.data(), sample_sizes.data(),
+                                                 (unsigned)sample_sizes.size())
+                              : 0;
+  if (dict_cap && !dict_size)
+  {
+    fprintf(stderr, "Too few chunks to train a dictionary on, compressing without one\n");
+  }
+  codec = codec_dict_open(dict.data(), dict_size, level);
+
+  out = fopen(path, "wb+");
+  if (!out || !codec)
+  {
+    fprintf(stderr, "Error: can not create %s\n", path);
+    exit(1);
+  }
+  archive_header_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  fwrite(&hdr, sizeof(hdr), 1, out);
+  hdr.dict_offset = sizeof(hdr);
+  hdr.dict_size = dict_size;
+  fwrite(dict.data(), 1, dict_size, out);
+  out_offset = hdr.dict_offset + dict_size;
+
+  // Pass 2: store the chunks
+  uint64_t raw_bytes = 0;
+  for (size_t i = 0; i < inputs.size(); i++)
+  {
+    inputs[i].first_ref = refs.size();
+    uint64_t n = bparchive_stream(&inputs[i], inputs[i].num_records, bparchive_store);
+    inputs[i].num_refs = refs.size() - inputs[i].first_ref;
+    if (n != inputs[i].num_records)
+    {
+      fprintf(stderr, "Error: %s changed while it was read\n", inputs[i].path.c_str());
+      exit(1);
+    }
+    raw_bytes += sizeof(trace_header_t) + n * sizeof(branch_record_t);
+  }
+
+  // The tables, then the header pointing to them
+  hdr.chunks_offset = out_offset;
+  hdr.num_chunks = chunks.size();
+  fwrite(chunks.data(), sizeof(archive_chunk_t), chunks.size(), out);
+  hdr.members_offset = hdr.chunks_offset + chunks.size() * sizeof(archive_chunk_t);
+  hdr.num_members = inputs.size();
+  for (size_t i = 0; i < inputs.size(); i++)
+  {
+    archive_member_t m;
+    memset(&m, 0, sizeof(m));
+    strcpy(m.name, inputs[i].name.c_str());
+    m.size = sizeof(trace_header_t) + inputs[i].num_records * sizeof(branch_record_t);
+    m.first_ref = inputs[i].first_ref;
+    m.num_refs = inputs[i].num_refs;
+    fwrite(&m, sizeof(m), 1, out);
+  }
+  hdr.refs_offset = hdr.members_offset + inputs.size() * sizeof(archive_member_t);
+  hdr.num_refs = refs.size();
+  fwrite(refs.data(), sizeof(uint32_t), refs.size(), out);
+  uint64_t size = hdr.refs_offset + refs.size() * sizeof(uint32_t);
+  memcpy(hdr.magic, ARCHIVE_MAGIC, ARCHIVE_MAGIC_LEN);
+  hdr.version = ARCHIVE_VERSION;
+  if (fseek(out, 0, SEEK_SET) || fwrite(&hdr, sizeof(hdr), 1, out) != 1 || fclose(out))
+  {
+    fprintf(stderr, "Error: writing %s failed\n", path);
+    exit(1);
+  }
+  codec_dict_close(codec);
+
+  printf("%zu traces, %llu bytes in %zu chunks, %zu stored (%llu bytes deduplicated), dictionary %zu bytes\n",
+         inputs.size(), (unsigned long long)raw_bytes, refs.size(), chunks.size(), (unsigned long long)dedup_bytes,
+         dict_size);
+  printf("%s: %llu bytes\n", path, (unsigned long long)size);
+  return 0;
+}
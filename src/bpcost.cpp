@@ -0,0 +1,69 @@
+//========================================================//
+//  bpcost.cpp                                            //
+//  Source file for the predictor cycle cost histograms   //
+//========================================================//
+
+#include <string.h>
+#include "bpcost.h"
+
+static const char *bp_cost_entry_names[BP_COST_ENTRIES] = {"predict", "train", "predict_and_train"};
+
+// Width of the bar of a bucket holding all samples
+#define BP_COST_BAR 40
+
+void bp_cost_init(bp_cost_t *c)
+{
+  memset(c, 0, sizeof(*c));
+  // The least of a few empty pairs, so the samples are the call alone
+  uint32_t least = UINT32_MAX;
+  for (int i = 0; i < 64; i++)
+  {
+    _mm_lfence();
+    uint64_t t0 = __rdtsc();
+    _mm_lfence();
+    unsigned aux;
+    uint64_t t1 = __rdtscp(&aux);
+    _mm_lfence();
+    if (t1 - t0 < least)
+    {
+      least = (uint32_t)(t1 - t0);
+    }
+  }
+  c->overhead = least;
+}
+
+void bp_cost_print(const bp_cost_t *c, const char *name, FILE *out)
+{
+  for (int e = 0; e < BP_COST_ENTRIES; e++)
+  {
+    if (!c->samples[e])
+    {
+      continue;
+    }
+    fprintf(out, "%s %s: %llu calls, %llu sampled, %.1f cycles/call\n", name, bp_cost_entry_names[e],
+            (unsigned long long)c->calls[e], (unsigned long long)c->samples[e],
+            (double)c->cycles[e] / c->samples[e]);
+    for (int b = 0; b < BP_COST_BUCKETS; b++)
+    {
+      if (!c->hist[e][b])
+      {
+        continue;
+      }
+      double share = (double)c->hist[e][b] / c->samples[e];
+      unsigned long long lo = b ? 1ULL << (b - 1) : 0, hi = b ? (1ULL << b) - 1 : 0;
+      if (b == BP_COST_BUCKETS - 1)
+      {
+        fprintf(out, "  %7llu+        %6.2f%% ", lo, 100 * share);
+      }
+      else
+      {
+        fprintf(out, "  %7llu-%-7llu %6.2f%% ", lo, hi, 100 * share);
+      }
+      for (int k = 0; k < (int)(share * BP_COST_BAR + 0.5); k++)
+      {
+        fputc('#', out);
+      }
+      fputc('\n', out);
+    }
+  }
+}
@@ -0,0 +1,90 @@
+//========================================================//
+//  bpcost.h                                              //
+//  Header file for the predictor cycle cost histograms   //
+//                                                        //
+//  Built with -DBP_COST (make COST=1), every predictor   //
+//  times 1 in BP_COST_SAMPLE calls of each entry point   //
+//  with rdtsc into log2 buckets of cycles. Without it    //
+//  nothing below is compiled into the predictors         //
+//========================================================//
+
+#ifndef BPCOST_H
+#define BPCOST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <x86intrin.h>
+#include "predictor.h"
+
+// Calls per sample, a power of 2
+#ifndef BP_COST_SAMPLE
+#define BP_COST_SAMPLE 64
+#endif
+
+// Bucket b counts samples of 2^(b-1) to 2^b - 1 cycles, bucket 0 the
+// ones at or below the timer overhead
+#define BP_COST_BUCKETS 24
+
+// Entry points timed. Batches time the predict_and_train of each
+// conditional branch they replay
+#define BP_COST_PREDICT 0
+#define BP_COST_TRAIN 1
+#define BP_COST_PREDICT_AND_TRAIN 2
+#define BP_COST_ENTRIES 3
+
+typedef struct
+{
+  uint64_t calls[BP_COST_ENTRIES];
+  uint64_t samples[BP_COST_ENTRIES];
+  uint64_t cycles[BP_COST_ENTRIES];  // sum over the samples, less the overhead
+  uint64_t hist[BP_COST_ENTRIES][BP_COST_BUCKETS];
+  uint32_t overhead;                 // cycles of an empty begin/end pair
+} bp_cost_t;
+
+// Clear 'c' and measure the timer overhead
+//
+void bp_cost_init(bp_cost_t *c);
+
+// Start timing a call of 'entry' when it is sampled
+//
+// Returns the start time, 0 when not sampled
+//
+static inline uint64_t bp_cost_begin(bp_cost_t *c, int entry)
+{
+  if (++c->calls[entry] & (BP_COST_SAMPLE - 1))
+  {
+    return 0;
+  }
+  _mm_lfence();
+  uint64_t t = __rdtsc();
+  _mm_lfence();
+  return t;
+}
+
+static inline void bp_cost_end(bp_cost_t *c, int entry, uint64_t start)
+{
+  if (!start)
+  {
+    return;
+  }
+  unsigned aux;
+  uint64_t t = __rdtscp(&aux);
+  _mm_lfence();
+  uint64_t cycles = t - start > c->overhead ? t - start - c->overhead : 0;
+  int b = cycles ? 64 - __builtin_clzll(cycles) : 0;
+  c->samples[entry]++;
+  c->cycles[entry] += cycles;
+  c->hist[entry][b < BP_COST_BUCKETS ? b : BP_COST_BUCKETS - 1]++;
+}
+
+// Print the histogram of every entry point 'c' sampled, under 'name'
+//
+void bp_cost_print(const bp_cost_t *c, const char *name, FILE *out);
+
+#ifdef BP_COST
+// The histograms of 'p', only with the instrumentation built in
+//
+const bp_cost_t *predictor_cost(const predictor_t *p);
+#endif
+
+#endif
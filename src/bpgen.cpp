@@ -0,0 +1,209 @@
+//========================================================//
+//  bpgen.cpp                                             //
+//  Generates synthetic binary branch traces              //
+//                                                        //
+//  ./bpgen periodic,records=4G,seed=7 trace.bin          //
+//  ./bpgen mix,records=1G - | ./predictor -              //
+//                                                        //
+//  The patterns are those of synth.h; every thread       //
+//  generates whole chunks where they go in the file, so  //
+//  the trace only depends on the spec                    //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "trace.h"
+#include "synth.h"
+
+// Records generated and written at a time by a thread
+#define BPGEN_CHUNK (1 << 20)
+
+void usage()
+{
+  fprintf(stderr, "Usage: bpgen [options] <pattern>[,key=value...] <output|->\n");
+  fprintf(stderr, " Patterns: loops, biased, correlated, periodic, mix\n");
+  fprintf(stderr, " Keys:\n");
+  fprintf(stderr, "  records=<n>              Length of the trace, with an optional k, M\n");
+  fprintf(stderr, "                           or G suffix (default %llu)\n", SYNTH_RECORDS);
+  fprintf(stderr, "  seed=<n>                 Seed of the generator (default 1)\n");
+  fprintf(stderr, "  branches=<n>             Static conditional branches (default %d)\n", SYNTH_BRANCHES);
+  fprintf(stderr, "  period=<n>               Records repeated by periodic (default %d)\n", SYNTH_PERIOD);
+  fprintf(stderr, " Options:\n");
+  fprintf(stderr, " --threads=<n>             Generating threads (default one per core)\n");
+  fprintf(stderr, " The same spec after synth: is read by predictor without a file\n");
+}
+
+// Generate the chunks of 's' on 'threads' threads and write each at its
+// place in the regular file 'fd'
+//
+// Returns True if Successful
+//
+static int bpgen_pwrite(const synth_t *s, int fd, int threads)
+{
+  uint64_t records = s->cfg.records;
+  uint64_t chunks = (records + BPGEN_CHUNK - 1) / BPGEN_CHUNK;
+  std::atomic<uint64_t> next(0);
+  std::atomic<int> ok(1);
+  auto worker = [&]()
+  {
+    char *buf = (char *)malloc((size_t)BPGEN_CHUNK * SYNTH_RECORD_SIZE);
+    if (!buf)
+    {
+      ok = 0;
+      return;
+    }
+    for (uint64_t c; ok && (c = next++) < chunks;)
+    {
+      uint64_t first = c * BPGEN_CHUNK;
+      size_t n = records - first < BPGEN_CHUNK ? records - first : BPGEN_CHUNK;
+      synth_generate(s, first, buf, n);
+      size_t len = n * SYNTH_RECORD_SIZE;
+      off_t off = sizeof(trace_header_t) + first * SYNTH_RECORD_SIZE;
+      for (size_t done = 0; done < len;)
+      {
+        ssize_t w = pwrite(fd, buf + done, len - done, off + done);
+        if (w <= 0)
+        {
+          ok = 0;
+          break;
+        }
+        done += w;
+      }
+    }
+    free(buf);
+  };
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; t++)
+  {
+    pool.push_back(std::thread(worker));
+  }
+  for (auto &t : pool)
+  {
+    t.join();
+  }
+  return ok;
+}
+
+// Generate 'threads' chunks at a time and write them in order to the
+// stream 'out', which can not seek
+//
+// Returns True if Successful
+//
+static int bpgen_stream(const synth_t *s, FILE *out, int threads)
+{
+  uint64_t records = s->cfg.records;
+  std::vector<char *> bufs(threads);
+  std::vector<size_t> lens(threads);
+  int ok = 1;
+  for (int t = 0; t < threads; t++)
+  {
+    bufs[t] = (char *)malloc((size_t)BPGEN_CHUNK * SYNTH_RECORD_SIZE);
+    ok = ok && bufs[t];
+  }
+  for (uint64_t first = 0; ok && first < records;)
+  {
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++)
+    {
+      uint64_t at = first + (uint64_t)t * BPGEN_CHUNK;
+      lens[t] = at >= records ? 0 : records - at < BPGEN_CHUNK ? records - at : BPGEN_CHUNK;
+      pool.push_back(std::thread(synth_generate, s, at, bufs[t], lens[t]));
+    }
+    for (int t = 0; t < threads; t++)
+    {
+      pool[t].join();
+      ok = ok && fwrite(bufs[t], SYNTH_RECORD_SIZE, lens[t], out) == lens[t];
+      first += lens[t];
+    }
+  }
+  for (int t = 0; t < threads; t++)
+  {
+    free(bufs[t]);
+  }
+  return ok;
+}
+
+int main(int argc, char *argv[])
+{
+  int threads = 0;
+  const char *spec = NULL, *path = NULL;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strncmp(argv[i], "--threads=", 10))
+    {
+      threads = atoi(argv[i] + 10);
+    }
+    else if (!spec && strncmp(argv[i], "--", 2))
+    {
+      spec = argv[i];
+    }
+    else if (!path && (strncmp(argv[i], "--", 2) || !strcmp(argv[i], "-")))
+    {
+      path = argv[i];
+    }
+    else
+    {
+      usage();
+      exit(1);
+    }
+  }
+  if (!spec || !path)
+  {
+    usage();
+    exit(1);
+  }
+  synth_config_t cfg;
+  synth_t *s = synth_parse(spec, &cfg) ? synth_open(&cfg) : NULL;
+  if (!s)
+  {
+    fprintf(stderr, "Error: invalid pattern %s\n", spec);
+    usage();
+    exit(1);
+  }
+  if (threads <= 0)
+  {
+    threads = std::thread::hardware_concurrency();
+    threads = threads > 0 ? threads : 1;
+  }
+
+  FILE *out = strcmp(path, "-") ? fopen(path, "wb") : stdout;
+  if (!out)
+  {
+    fprintf(stderr, "Error: can not create %s\n", path);
+    exit(1);
+  }
+  uint64_t start_ns = trace_clock_ns();
+  struct stat sb;
+  int ok = trace_write_header(out, cfg.records) && !fflush(out);
+  if (ok && !fstat(fileno(out), &sb) && S_ISREG(sb.st_mode))
+  {
+    ok = bpgen_pwrite(s, fileno(out), threads);
+  }
+  else if (ok)
+  {
+    ok = bpgen_stream(s, out, threads);
+  }
+  ok = !fflush(out) && ok;
+  uint64_t elapsed_ns = trace_clock_ns() - start_ns;
+  if (out != stdout && fclose(out))
+  {
+    ok = 0;
+  }
+  synth_close(s);
+  if (!ok)
+  {
+    fprintf(stderr, "Error: writing %s failed\n", path);
+    exit(1);
+  }
+  double bytes = (double)cfg.records * SYNTH_RECORD_SIZE;
+  fprintf(stderr, "%llu records, %.3f s, %.2f GB/s\n", (unsigned long long)cfg.records, elapsed_ns / 1e9,
+          elapsed_ns ? bytes / elapsed_ns : 0.0);
+  return 0;
+}
@@ -0,0 +1,825 @@
+//========================================================//
+//  bplbr.cpp                                             //
+//  Captures sampled branch stacks into a binary trace    //
+//                                                        //
+//  ./bplbr trace.bin -- ./server --port 8080             //
+//  ./bplbr -p 4242 --duration=30 trace.bin               //
+//  ./bplbr --brstack=script.txt --exe=./a.out trace.bin  //
+//                                                        //
+//  The last branch records of the CPU (LBR), read with   //
+//  perf_event_open every so many branches, run at close  //
+//  to native speed where Pin would slow the program down //
+//  a hundredfold. A stack lists the last taken branches  //
+//  only, so the not-taken conditional branches between   //
+//  two of them are found in the disassembly of the code  //
+//  run in between. Each stack becomes a stretch of       //
+//  records after a TRACE_F_BREAK one, for                //
+//  predictor --sample=breaks                             //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "trace.h"
+
+#define BPLBR_PERIOD 200003      // branches between samples
+#define BPLBR_DURATION 10        // seconds of a -p capture
+#define BPLBR_RING_PAGES 256     // data pages of each ring, a power of 2
+#define BPLBR_MAX_GAP (64 << 10) // bytes of code walked between two taken branches
+
+// A branch instruction of the disassembly, at its run time address
+typedef struct
+{
+  uint64_t addr;
+  uint64_t target; // of a direct one
+  uint8_t flags;   // TRACE_F_* bits but TRACE_F_TAKEN
+} bplbr_insn_t;
+
+// An executable mapping of a file, and the branches found in it once
+// a stack reaches it
+typedef struct
+{
+  uint64_t start, end;
+  uint64_t pgoff;
+  std::string path;
+  int loaded;
+  std::vector<bplbr_insn_t> insns;
+} bplbr_map_t;
+
+typedef struct
+{
+  uint64_t samples;
+  uint64_t lost;
+  uint64_t records;
+  uint64_t not_taken;  // found in the disassembly
+  uint64_t unresolved; // gaps that could not be walked, each a break
+} bplbr_stats_t;
+
+static std::vector<bplbr_map_t> maps;
+static volatile sig_atomic_t stop_capture = 0;
+
+void usage()
+{
+  fprintf(stderr, "Usage: bplbr [options] <output> -- <command> [args]\n");
+  fprintf(stderr, "       bplbr [options] -p <pid> <output>\n");
+  fprintf(stderr, "       bplbr --brstack=<file> --exe=<file>[@<bias>]... <output>\n");
+  fprintf(stderr, " Options:\n");
+  fprintf(stderr, " --period=<n>    User branches between samples (default %d)\n", BPLBR_PERIOD);
+  fprintf(stderr, " --duration=<s>  Seconds to record a running process (default %d)\n", BPLBR_DURATION);
+  fprintf(stderr, " --brstack=<file>  Convert the output of perf script -F brstack of a\n");
+  fprintf(stderr, "                 perf record -b instead, with the code of each --exe\n");
+  fprintf(stderr, "                 loaded at its link address plus bias\n");
+}
+
+static void on_signal(int)
+{
+  stop_capture = 1;
+}
+
+//------------------------------------//
+//            Disassembly             //
+//------------------------------------//
+
+// The flags of the branch instruction 'mnemonic', with 'operand'
+//
+// Returns False if it is not a branch
+//
+static int bplbr_classify(const char *mnemonic, const char *operand, uint8_t *flags)
+{
+  int direct = *operand && *operand != '*';
+  if (!strncmp(mnemonic, "call", 4))
+  {
+    *flags = TRACE_F_CALL | (direct ? TRACE_F_DIRECT : 0);
+  }
+  else if (!strncmp(mnemonic, "ret", 3))
+  {
+    *flags = TRACE_F_RET;
+  }
+  else if (!strncmp(mnemonic, "jmp", 3))
+  {
+    *flags = direct ? TRACE_F_DIRECT : 0;
+  }
+  else if (mnemonic[0] == 'j' || !strncmp(mnemonic, "loop", 4))
+  {
+    *flags = TRACE_F_CONDITION | TRACE_F_DIRECT;
+  }
+  else
+  {
+    return 0;
+  }
+  return 1;
+}
+
+// The link address of byte 'pgoff' of the ELF file 'path'
+//
+// Returns True if Successful
+//
+static int bplbr_vaddr(const char *path, uint64_t pgoff, uint64_t *vaddr)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+  {
+    return 0;
+  }
+  Elf64_Ehdr eh;
+  int found = 0;
+  if (fread(&eh, sizeof(eh), 1, f) == 1 && !memcmp(eh.e_ident, ELFMAG, SELFMAG) && eh.e_ident[EI_CLASS] == ELFCLASS64)
+  {
+    for (int i = 0; i < eh.e_phnum && !found; i++)
+    {
+      Elf64_Phdr ph;
+      if (fseek(f, eh.e_phoff + (uint64_t)i * eh.e_phentsize, SEEK_SET) || fread(&ph, sizeof(ph), 1, f) != 1)
+      {
+        break;
+      }
+      if (ph.p_type == PT_LOAD && pgoff >= ph.p_offset && pgoff < ph.p_offset + ph.p_filesz)
+      {
+        *vaddr = ph.p_vaddr + (pgoff - ph.p_offset);
+        found = 1;
+      }
+    }
+  }
+  fclose(f);
+  return found;
+}
+
+// Find the branch instructions of mapping 'm' with objdump
+//
+static void bplbr_disassemble(bplbr_map_t *m)
+{
+  m->loaded = 1;
+  uint64_t vaddr;
+  if (m->path.find('\'') != std::string::npos || !bplbr_vaddr(m->path.c_str(), m->pgoff, &vaddr))
+  {
+    return;
+  }
+  uint64_t bias = m->start - vaddr;
+  char cmd[4096];
+  snprintf(cmd, sizeof(cmd), "objdump -d -w --no-show-raw-insn --start-address=0x%llx --stop-address=0x%llx '%s'",
+           (unsigned long long)vaddr, (unsigned long long)(vaddr + (m->end - m->start)), m->path.c_str());
+  FILE *p = popen(cmd, "r");
+  if (!p)
+  {
+    return;
+  }
+  static const char *prefixes[] = {"bnd", "notrack", "rep", "repz", "repnz", "repe", "repne", "lock",
+                                   "data16", "addr32", "cs", "ds", "es", "ss", NULL};
+  char line[1024];
+  while (fgets(line, sizeof(line), p))
+  {
+    char *end;
+    uint64_t addr = strtoull(line, &end, 16);
+    if (end == line || *end != ':' || end[1] != '\t')
+    {
+      continue;
+    }
+    char *s = end + 2;
+    char mnemonic[32] = "";
+    int len = 0;
+    for (;;)
+    {
+      if (sscanf(s, "%31s%n", mnemonic, &len) != 1)
+      {
+        break;
+      }
+      int prefix = 0;
+      for (int k = 0; prefixes[k] && !prefix; k++)
+      {
+        prefix = !strcmp(mnemonic, prefixes[k]);
+      }
+      if (!prefix)
+      {
+        break;
+      }
+      s += len;
+    }
+    const char *operand = s + len;
+    while (*operand == ' ')
+    {
+      operand++;
+    }
+    bplbr_insn_t in;
+    if (!bplbr_classify(mnemonic, operand, &in.flags))
+    {
+      continue;
+    }
+    in.addr = addr + bias;
+    in.target = in.flags & TRACE_F_DIRECT ? strtoull(operand, NULL, 16) + bias : 0;
+    m->insns.push_back(in);
+  }
+  pclose(p);
+  std::sort(m->insns.begin(), m->insns.end(),
+            [](const bplbr_insn_t &a, const bplbr_insn_t &b) { return a.addr < b.addr; });
+}
+
+// The mapping holding 'addr', disassembled on the first call
+//
+// Returns NULL if no file is mapped there
+//
+static bplbr_map_t *bplbr_find_map(uint64_t addr)
+{
+  for (size_t i = maps.size(); i-- > 0;)
+  {
+    if (addr >= maps[i].start && addr < maps[i].end)
+    {
+      if (!maps[i].loaded)
+      {
+        bplbr_disassemble(&maps[i]);
+      }
+      return &maps[i];
+    }
+  }
+  return NULL;
+}
+
+static void bplbr_add_map(uint64_t start, uint64_t end, uint64_t pgoff, const char *path)
+{
+  if (path[0] != '/')
+  {
+    return;
+  }
+  bplbr_map_t m;
+  m.start = start;
+  m.end = end;
+  m.pgoff = pgoff;
+  m.path = path;
+  m.loaded = 0;
+  maps.push_back(m);
+}
+
+// The executable mappings of 'pid' from /proc
+//
+static void bplbr_read_maps(pid_t pid)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/proc/%d/maps", (int)pid);
+  FILE *f = fopen(name, "r");
+  if (!f)
+  {
+    return;
+  }
+  char line[4096];
+  while (fgets(line, sizeof(line), f))
+  {
+    unsigned long long start, end, pgoff;
+    char perms[8];
+    int at = 0;
+    if (sscanf(line, "%llx-%llx %7s %llx %*s %*s %n", &start, &end, perms, &pgoff, &at) < 4 || perms[2] != 'x')
+    {
+      continue;
+    }
+    line[strcspn(line, "\n")] = 0;
+    bplbr_add_map(start, end, pgoff, line + at);
+  }
+  fclose(f);
+}
+
+// The executable segments of the ELF file 'spec', <path>[@<bias>]
+//
+// Returns True if Successful
+//
+static int bplbr_add_exe(const char *spec)
+{
+  std::string path = spec;
+  uint64_t bias = 0;
+  size_t at = path.rfind('@');
+  if (at != std::string::npos)
+  {
+    bias = strtoull(path.c_str() + at + 1, NULL, 0);
+    path.resize(at);
+  }
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f)
+  {
+    return 0;
+  }
+  Elf64_Ehdr eh;
+  int found = 0;
+  if (fread(&eh, sizeof(eh), 1, f) == 1 && !memcmp(eh.e_ident, ELFMAG, SELFMAG) && eh.e_ident[EI_CLASS] == ELFCLASS64)
+  {
+    for (int i = 0; i < eh.e_phnum; i++)
+    {
+      Elf64_Phdr ph;
+      if (fseek(f, eh.e_phoff + (uint64_t)i * eh.e_phentsize, SEEK_SET) || fread(&ph, sizeof(ph), 1, f) != 1)
+      {
+        break;
+      }
+      if (ph.p_type == PT_LOAD && (ph.p_flags & PF_X))
+      {
+        bplbr_add_map(ph.p_vaddr + bias, ph.p_vaddr + ph.p_memsz + bias, ph.p_offset, path.c_str());
+        found = 1;
+      }
+    }
+  }
+  fclose(f);
+  return found;
+}
+
+//------------------------------------//
+//             Conversion             //
+//------------------------------------//
+
+// The TRACE_F_* bits of a taken branch, from its LBR type or else
+// from the disassembly
+//
+static uint8_t bplbr_flags(const struct perf_branch_entry *e)
+{
+  switch (e->type)
+  {
+  case PERF_BR_COND:
+    return TRACE_F_TAKEN | TRACE_F_CONDITION | TRACE_F_DIRECT;
+  case PERF_BR_UNCOND:
+    return TRACE_F_TAKEN | TRACE_F_DIRECT;
+  case PERF_BR_IND:
+    return TRACE_F_TAKEN;
+  case PERF_BR_CALL:
+    return TRACE_F_TAKEN | TRACE_F_CALL | TRACE_F_DIRECT;
+  case PERF_BR_IND_CALL:
+    return TRACE_F_TAKEN | TRACE_F_CALL;
+  case PERF_BR_RET:
+    return TRACE_F_TAKEN | TRACE_F_RET;
+  }
+  bplbr_map_t *m = bplbr_find_map(e->from);
+  if (m)
+  {
+    bplbr_insn_t key = {e->from, 0, 0};
+    auto it = std::lower_bound(m->insns.begin(), m->insns.end(), key,
+                               [](const bplbr_insn_t &a, const bplbr_insn_t &b) { return a.addr < b.addr; });
+    if (it != m->insns.end() && it->addr == e->from)
+    {
+      return TRACE_F_TAKEN | it->flags;
+    }
+  }
+  return TRACE_F_TAKEN | TRACE_F_DIRECT;
+}
+
+static void bplbr_emit(std::vector<branch_record_t> &out, uint64_t pc, uint64_t target, uint8_t flags)
+{
+  branch_record_t r;
+  r.pc = (uint32_t)pc;
+  r.target = (uint32_t)target;
+  r.flags = flags;
+  out.push_back(r);
+}
+
+// Append the records of the branches from 'from', where the code
+// continued after a taken branch, up to the next taken branch at
+// 'to': the conditional ones, not taken
+//
+// Returns False when the code in between is unknown or holds an
+// unconditional branch, so the stack skipped some
+//
+static int bplbr_walk(uint64_t from, uint64_t to, std::vector<branch_record_t> &out, bplbr_stats_t *st)
+{
+  bplbr_map_t *m = from <= to && to - from <= BPLBR_MAX_GAP ? bplbr_find_map(from) : NULL;
+  if (!m || to >= m->end || m->insns.empty())
+  {
+    return 0;
+  }
+  bplbr_insn_t key = {from, 0, 0};
+  auto it = std::lower_bound(m->insns.begin(), m->insns.end(), key,
+                             [](const bplbr_insn_t &a, const bplbr_insn_t &b) { return a.addr < b.addr; });
+  for (; it != m->insns.end() && it->addr < to; ++it)
+  {
+    if (!(it->flags & TRACE_F_CONDITION))
+    {
+      return 0;
+    }
+    bplbr_emit(out, it->addr, it->target, it->flags);
+    st->not_taken++;
+  }
+  return 1;
+}
+
+// Write the stacks stored in 'samples' to 'tw', oldest branch first
+//
+// Returns True if Successful
+//
+static int bplbr_convert(FILE *samples, trace_writer_t *tw, bplbr_stats_t *st)
+{
+  std::vector<struct perf_branch_entry> stack;
+  std::vector<branch_record_t> out;
+  uint32_t nr;
+  rewind(samples);
+  while (fread(&nr, sizeof(nr), 1, samples) == 1)
+  {
+    stack.resize(nr);
+    if (fread(stack.data(), sizeof(struct perf_branch_entry), nr, samples) != nr)
+    {
+      return 0;
+    }
+    out.clear();
+    if (st->records)
+    {
+      bplbr_emit(out, 0, 0, TRACE_F_BREAK);
+    }
+    for (uint32_t i = nr; i-- > 0;)
+    {
+      const struct perf_branch_entry *e = &stack[i];
+      if (i + 1 < nr && !bplbr_walk(stack[i + 1].to, e->from, out, st))
+      {
+        bplbr_emit(out, 0, 0, TRACE_F_BREAK);
+        st->unresolved++;
+      }
+      bplbr_emit(out, e->from, e->to, bplbr_flags(e));
+    }
+    if (!trace_writer_write(tw, out.data(), out.size()))
+    {
+      return 0;
+    }
+    st->records += out.size();
+  }
+  return 1;
+}
+
+//------------------------------------//
+//              Capture               //
+//------------------------------------//
+
+typedef struct
+{
+  int fd;
+  struct perf_event_mmap_page *meta;
+  char *data;
+  uint64_t size;
+} bplbr_ring_t;
+
+static int perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu)
+{
+  return syscall(SYS_perf_event_open, attr, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// Open a sampling event with a ring on thread 'pid' and 'cpu', as
+// perf_event_open takes them
+//
+// Returns True if Successful
+//
+static int bplbr_open(bplbr_ring_t *r, pid_t pid, int cpu, uint64_t period, int on_exec)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_BRANCH_INSTRUCTIONS;
+  attr.sample_period = period;
+  attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_BRANCH_STACK;
+  attr.branch_sample_type = PERF_SAMPLE_BRANCH_USER | PERF_SAMPLE_BRANCH_ANY | PERF_SAMPLE_BRANCH_TYPE_SAVE;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.mmap = 1;
+  attr.mmap2 = 1;
+  attr.inherit = cpu >= 0;
+  attr.disabled = on_exec;
+  attr.enable_on_exec = on_exec;
+  r->fd = perf_event_open(&attr, pid, cpu);
+  if (r->fd < 0 && errno == EINVAL)
+  {
+    // Kernels before 4.14 save no branch types
+    attr.branch_sample_type &= ~PERF_SAMPLE_BRANCH_TYPE_SAVE;
+    r->fd = perf_event_open(&attr, pid, cpu);
+  }
+  if (r->fd < 0)
+  {
+    return 0;
+  }
+  long page = sysconf(_SC_PAGESIZE);
+  r->size = (uint64_t)BPLBR_RING_PAGES * page;
+  void *map = mmap(NULL, r->size + page, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+  if (map == MAP_FAILED)
+  {
+    close(r->fd);
+    return 0;
+  }
+  r->meta = (struct perf_event_mmap_page *)map;
+  r->data = (char *)map + page;
+  return 1;
+}
+
+// Store the stacks of the samples in the ring into 'samples' and take
+// note of the new mappings
+//
+static void bplbr_drain(bplbr_ring_t *r, FILE *samples, bplbr_stats_t *st)
+{
+  static std::vector<char> rec;
+  uint64_t head = __atomic_load_n(&r->meta->data_head, __ATOMIC_ACQUIRE);
+  uint64_t tail = r->meta->data_tail;
+  while (tail < head)
+  {
+    struct perf_event_header hdr;
+    for (size_t k = 0; k < sizeof(hdr); k++)
+    {
+      ((char *)&hdr)[k] = r->data[(tail + k) % r->size];
+    }
+    rec.resize(hdr.size);
+    for (size_t k = 0; k < hdr.size; k++)
+    {
+      rec[k] = r->data[(tail + k) % r->size];
+    }
+    const char *body = rec.data() + sizeof(hdr);
+    if (hdr.type == PERF_RECORD_SAMPLE)
+    {
+      // pid, tid, nr, then the entries, newest first
+      uint64_t nr;
+      memcpy(&nr, body + 8, 8);
+      uint32_t n32 = (uint32_t)nr;
+      if (nr && fwrite(&n32, sizeof(n32), 1, samples) == 1)
+      {
+        fwrite(body + 16, sizeof(struct perf_branch_entry), nr, samples);
+        st->samples++;
+      }
+    }
+    else if (hdr.type == PERF_RECORD_MMAP2 && (hdr.misc & PERF_RECORD_MISC_USER))
+    {
+      // pid, tid, addr, len, pgoff, 24 bytes of device and inode, prot,
+      // flags, filename
+      uint64_t addr, len, pgoff;
+      uint32_t prot;
+      memcpy(&addr, body + 8, 8);
+      memcpy(&len, body + 16, 8);
+      memcpy(&pgoff, body + 24, 8);
+      memcpy(&prot, body + 56, 4);
+      if (prot & PROT_EXEC)
+      {
+        bplbr_add_map(addr, addr + len, pgoff, body + 64);
+      }
+    }
+    else if (hdr.type == PERF_RECORD_LOST)
+    {
+      uint64_t lost;
+      memcpy(&lost, body + 8, 8);
+      st->lost += lost;
+    }
+    tail += hdr.size;
+  }
+  __atomic_store_n(&r->meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+// Open a ring on every thread of the running process 'pid'
+//
+static void bplbr_attach(pid_t pid, uint64_t period, std::vector<bplbr_ring_t> &rings)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/proc/%d/task", (int)pid);
+  DIR *d = opendir(name);
+  struct dirent *de;
+  while (d && (de = readdir(d)))
+  {
+    bplbr_ring_t r;
+    if (de->d_name[0] != '.' && bplbr_open(&r, atoi(de->d_name), -1, period, 0))
+    {
+      rings.push_back(r);
+    }
+  }
+  if (d)
+  {
+    closedir(d);
+  }
+}
+
+// Start 'argv' stopped before its exec, with a ring on every CPU that
+// its threads and children inherit
+//
+// Returns the pid of the command, -1 if it could not be started
+//
+static pid_t bplbr_launch(char *const *argv, uint64_t period, std::vector<bplbr_ring_t> &rings)
+{
+  int go[2];
+  if (pipe(go))
+  {
+    return -1;
+  }
+  pid_t child = fork();
+  if (child == 0)
+  {
+    char c;
+    close(go[1]);
+    if (read(go[0], &c, 1) != 1)
+    {
+      _exit(127);
+    }
+    execvp(argv[0], argv);
+    fprintf(stderr, "Error: can not run %s (%s)\n", argv[0], strerror(errno));
+    _exit(127);
+  }
+  close(go[0]);
+  if (child < 0)
+  {
+    close(go[1]);
+    return -1;
+  }
+  long cpus = sysconf(_SC_NPROCESSORS_CONF);
+  for (int cpu = 0; cpu < cpus; cpu++)
+  {
+    bplbr_ring_t r;
+    if (bplbr_open(&r, child, cpu, period, 1))
+    {
+      rings.push_back(r);
+    }
+  }
+  if (rings.empty())
+  {
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+    close(go[1]);
+    return -1;
+  }
+  if (write(go[1], "g", 1) != 1)
+  {
+    kill(child, SIGKILL);
+  }
+  close(go[1]);
+  return child;
+}
+
+int main(int argc, char *argv[])
+{
+  uint64_t period = BPLBR_PERIOD;
+  int duration = BPLBR_DURATION;
+  pid_t pid = 0;
+  const char *brstack = NULL, *path = NULL;
+  char **command = NULL;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strcmp(argv[i], "--"))
+    {
+      command = argv + i + 1;
+      break;
+    }
+    else if (!strncmp(argv[i], "--period=", 9))
+    {
+      period = strtoull(argv[i] + 9, NULL, 0);
+    }
+    else if (!strncmp(argv[i], "--duration=", 11))
+    {
+      duration = atoi(argv[i] + 11);
+    }
+    else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+    {
+      pid = atoi(argv[++i]);
+    }
+    else if (!strncmp(argv[i], "--brstack=", 10))
+    {
+      brstack = argv[i] + 10;
+    }
+    else if (!strncmp(argv[i], "--exe=", 6))
+    {
+      if (!bplbr_add_exe(argv[i] + 6))
+      {
+        fprintf(stderr, "Error: %s is not a 64-bit ELF file\n", argv[i] + 6);
+        exit(1);
+      }
+    }
+    else if (!path && strncmp(argv[i], "--", 2))
+    {
+      path = argv[i];
+    }
+    else
+    {
+      usage();
+      exit(1);
+    }
+  }
+  if (!path || !period || (!!brstack + !!pid + !!(command && *command)) != 1)
+  {
+    usage();
+    exit(1);
+  }
+
+  FILE *samples = tmpfile();
+  if (!samples)
+  {
+    fprintf(stderr, "Error: can not create a temporary file\n");
+    exit(1);
+  }
+  bplbr_stats_t st;
+  memset(&st, 0, sizeof(st));
+  uint64_t start_ns = trace_clock_ns();
+
+  if (brstack)
+  {
+    // One sample per line, entries <from>/<to>/<flags>..., newest first
+    FILE *in = strcmp(brstack, "-") ? fopen(brstack, "r") : stdin;
+    if (!in)
+    {
+      fprintf(stderr, "Error: can not open %s\n", brstack);
+      exit(1);
+    }
+    std::vector<struct perf_branch_entry> stack;
+    char line[65536];
+    while (fgets(line, sizeof(line), in))
+    {
+      stack.clear();
+      for (char *tok = strtok(line, " \t\n"); tok; tok = strtok(NULL, " \t\n"))
+      {
+        struct perf_branch_entry e;
+        memset(&e, 0, sizeof(e));
+        char *end;
+        e.from = strtoull(tok, &end, 16);
+        if (*end == '/')
+        {
+          e.to = strtoull(end + 1, &end, 16);
+          stack.push_back(e);
+        }
+      }
+      uint32_t nr = stack.size();
+      if (nr && fwrite(&nr, sizeof(nr), 1, samples) == 1)
+      {
+        fwrite(stack.data(), sizeof(struct perf_branch_entry), nr, samples);
+        st.samples++;
+      }
+    }
+    if (in != stdin)
+    {
+      fclose(in);
+    }
+  }
+  else
+  {
+    std::vector<bplbr_ring_t> rings;
+    pid_t child = -1;
+    if (pid)
+    {
+      bplbr_read_maps(pid);
+      bplbr_attach(pid, period, rings);
+    }
+    else
+    {
+      child = bplbr_launch(command, period, rings);
+    }
+    if (rings.empty())
+    {
+      fprintf(stderr, "Error: can not sample branch stacks (%s), see perf_event_paranoid; VMs often hide LBR\n",
+              strerror(errno));
+      exit(1);
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    std::vector<struct pollfd> fds(rings.size());
+    for (size_t r = 0; r < rings.size(); r++)
+    {
+      fds[r].fd = rings[r].fd;
+      fds[r].events = POLLIN;
+    }
+    uint64_t until = trace_clock_ns() + (uint64_t)duration * 1000000000ULL;
+    for (;;)
+    {
+      poll(fds.data(), fds.size(), 100);
+      for (size_t r = 0; r < rings.size(); r++)
+      {
+        bplbr_drain(&rings[r], samples, &st);
+      }
+      int status;
+      if (stop_capture || (child > 0 && waitpid(child, &status, WNOHANG) == child) ||
+          (pid && (kill(pid, 0) || trace_clock_ns() >= until)))
+      {
+        break;
+      }
+    }
+    for (size_t r = 0; r < rings.size(); r++)
+    {
+      bplbr_drain(&rings[r], samples, &st);
+      munmap(rings[r].meta, rings[r].size + sysconf(_SC_PAGESIZE));
+      close(rings[r].fd);
+    }
+    if (stop_capture && child > 0)
+    {
+      waitpid(child, NULL, 0);
+    }
+  }
+
+  trace_writer_t *tw = trace_writer_open(path, -1, 0, 0, 0);
+  if (!tw)
+  {
+    fprintf(stderr, "Error: can not create %s\n", path);
+    exit(1);
+  }
+  int ok = bplbr_convert(samples, tw, &st);
+  ok = trace_writer_close(tw) && ok;
+  fclose(samples);
+  if (!ok)
+  {
+    fprintf(stderr, "Error: failed to write %s\n", path);
+    exit(1);
+  }
+  fprintf(stderr, "%llu samples (%llu lost), %llu records, %llu not taken from the code, %llu gaps not walked, %.1f s\n",
+          (unsigned long long)st.samples, (unsigned long long)st.lost, (unsigned long long)st.records,
+          (unsigned long long)st.not_taken, (unsigned long long)st.unresolved,
+          (trace_clock_ns() - start_ns) / 1e9);
+  return 0;
+}
@@ -0,0 +1,195 @@
+//========================================================//
+//  bpmap.h                                               //
+//  Header file for the unbounded predictor tables        //
+//                                                        //
+//  An open-addressing map from a 64-bit key to a 32-bit  //
+//  entry that only grows, standing in for a table of     //
+//  fixed size when nothing is to be evicted              //
+//========================================================//
+
+#ifndef BPMAP_H
+#define BPMAP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <emmintrin.h>
+
+// Slots are probed in groups of 16 control bytes, each BP_MAP_FREE or
+// the low 7 bits of its key's hash, so one SSE2 compare finds every
+// candidate of a group. Groups are visited by triangular steps, which
+// reach all of them, and slots fill to 7/8 before the map doubles
+#define BP_MAP_GROUP 16
+#define BP_MAP_FREE 0x80
+#define BP_MAP_MIN_SLOTS 1024
+
+// An entry, in the order entries were added. Nothing is removed, so
+// the count is also the peak
+typedef struct
+{
+  uint64_t key;
+  uint32_t value;
+  uint32_t spare;           // 0, so a saved entry has no stray bytes
+} bp_map_entry_t;
+
+typedef struct
+{
+  uint8_t *ctrl;            // a control byte per slot
+  uint32_t *slots;          // the entry of each full slot
+  bp_map_entry_t *entries;
+  uint32_t count;           // entries in use
+  uint32_t capacity;        // and allocated
+  uint32_t mask;            // slots - 1
+} bp_map_t;
+
+// murmur3's finalizer: the control byte takes the low bits and the
+// group the high ones
+static inline uint64_t bp_map_hash(uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ULL;
+  return key ^ (key >> 33);
+}
+
+static inline void *bp_map_alloc(void *old, size_t bytes)
+{
+  void *m = realloc(old, bytes);
+  if (!m)
+  {
+    fprintf(stderr, "Error: unbounded table malloc failed\n");
+    exit(1);
+  }
+  return m;
+}
+
+// Put entry 'i', of hash 'h', in the first free slot of its probe
+// sequence
+static inline void bp_map_place(bp_map_t *m, uint64_t h, uint32_t i)
+{
+  uint32_t groups = (m->mask + 1) / BP_MAP_GROUP;
+  uint32_t g = (uint32_t)(h >> 32) & (groups - 1);
+  for (uint32_t step = 1;; g = (g + step++) & (groups - 1))
+  {
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)(m->ctrl + g * BP_MAP_GROUP));
+    uint32_t open = _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)BP_MAP_FREE)));
+    if (open)
+    {
+      uint32_t s = g * BP_MAP_GROUP + __builtin_ctz(open);
+      m->ctrl[s] = h & 0x7F;
+      m->slots[s] = i;
+      return;
+    }
+  }
+}
+
+// Point a slot at every entry, in 'slots' slots
+static inline void bp_map_index(bp_map_t *m, uint32_t slots)
+{
+  free(m->ctrl);
+  free(m->slots);
+  m->ctrl = (uint8_t *)bp_map_alloc(NULL, slots);
+  m->slots = (uint32_t *)bp_map_alloc(NULL, (size_t)slots * sizeof(uint32_t));
+  m->mask = slots - 1;
+  memset(m->ctrl, BP_MAP_FREE, slots);
+  for (uint32_t i = 0; i < m->count; i++)
+  {
+    bp_map_place(m, bp_map_hash(m->entries[i].key), i);
+  }
+}
+
+// An empty map
+static inline void bp_map_init(bp_map_t *m)
+{
+  memset(m, 0, sizeof(*m));
+  bp_map_index(m, BP_MAP_MIN_SLOTS);
+}
+
+static inline void bp_map_free(bp_map_t *m)
+{
+  free(m->ctrl);
+  free(m->slots);
+  free(m->entries);
+  memset(m, 0, sizeof(*m));
+}
+
+// Room for 'count' entries, with as many slots as that takes
+static inline void bp_map_reserve(bp_map_t *m, uint32_t count)
+{
+  if (count > m->capacity)
+  {
+    uint32_t capacity = m->capacity ? m->capacity : BP_MAP_MIN_SLOTS / 2;
+    while (capacity < count)
+    {
+      capacity *= 2;
+    }
+    m->entries = (bp_map_entry_t *)bp_map_alloc(m->entries, (size_t)capacity * sizeof(bp_map_entry_t));
+    m->capacity = capacity;
+  }
+  uint32_t slots = m->mask + 1;
+  while ((uint64_t)count * 8 > (uint64_t)slots * 7)
+  {
+    slots *= 2;
+  }
+  if (slots != m->mask + 1)
+  {
+    bp_map_index(m, slots);
+  }
+}
+
+// Returns the entry of 'key', or NULL
+static inline bp_map_entry_t *bp_map_find(const bp_map_t *m, uint64_t key)
+{
+  uint64_t h = bp_map_hash(key);
+  uint32_t groups = (m->mask + 1) / BP_MAP_GROUP;
+  uint32_t g = (uint32_t)(h >> 32) & (groups - 1);
+  __m128i want = _mm_set1_epi8((char)(h & 0x7F)), empty = _mm_set1_epi8((char)BP_MAP_FREE);
+  for (uint32_t step = 1;; g = (g + step++) & (groups - 1))
+  {
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)(m->ctrl + g * BP_MAP_GROUP));
+    for (uint32_t hits = _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, want)); hits; hits &= hits - 1)
+    {
+      bp_map_entry_t *e = &m->entries[m->slots[g * BP_MAP_GROUP + __builtin_ctz(hits)]];
+      if (e->key == key)
+      {
+        return e;
+      }
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, empty)))
+    {
+      return NULL;
+    }
+  }
+}
+
+// Add 'key', which is not in the map, with 'value'
+//
+// Returns its entry
+//
+static inline bp_map_entry_t *bp_map_add(bp_map_t *m, uint64_t key, uint32_t value)
+{
+  bp_map_reserve(m, m->count + 1);
+  bp_map_entry_t *e = &m->entries[m->count];
+  e->key = key;
+  e->value = value;
+  e->spare = 0;
+  bp_map_place(m, bp_map_hash(key), m->count++);
+  return e;
+}
+
+// Returns the entry of 'key', added with 'value' if it was not there
+static inline bp_map_entry_t *bp_map_get(bp_map_t *m, uint64_t key, uint32_t value)
+{
+  bp_map_entry_t *e = bp_map_find(m, key);
+  return e ? e : bp_map_add(m, key, value);
+}
+
+// Bytes allocated for 'm'
+static inline size_t bp_map_bytes(const bp_map_t *m)
+{
+  return (size_t)(m->mask + 1) * (1 + sizeof(uint32_t)) + (size_t)m->capacity * sizeof(bp_map_entry_t);
+}
+
+#endif
@@ -0,0 +1,364 @@
+//========================================================//
+//  bpmodule.cpp                                          //
+//  Python bindings of the traces and predictors          //
+//                                                        //
+//  make python builds the bp module on the Python C API: //
+//                                                        //
+//  recs = bp.load("trace.bin")                           //
+//  g = bp.Predictor("gshare", ghistoryBits=12)           //
+//  res = g.run(recs)                                     //
+//                                                        //
+//  The records export the buffer protocol as packed      //
+//  structs of pc, target and flags, so NumPy views them  //
+//  as a structured array with numpy.asarray(recs)        //
+//========================================================//
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include "predictor.h"
+#include "replay.h"
+#include "trace.h"
+
+// PEP 3118 format of a branch_record_t, little endian and packed
+#define BP_RECORD_FORMAT "T{<I:pc:<I:target:B:flags:}"
+
+// The records of bp.load: the reader and decoded records behind them,
+// freed once the object and every buffer viewing it are gone
+typedef struct
+{
+  PyObject_HEAD
+  trace_reader_t *tr;
+  branch_record_t *owned; // decoded records, NULL when mapped
+  const branch_record_t *recs;
+  Py_ssize_t n;
+  Py_ssize_t stride;
+} bp_records_t;
+
+// A predictor instance, run by one thread at a time
+typedef struct
+{
+  PyObject_HEAD
+  predictor_t *p;
+  std::mutex *lock;
+} bp_predictor_t;
+
+static void bp_records_dealloc(bp_records_t *self)
+{
+  free(self->owned);
+  if (self->tr)
+  {
+    trace_close(self->tr);
+  }
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+// The records as one dimension of BP_RECORD_FORMAT items, read only
+// when mapped
+static int bp_records_getbuffer(bp_records_t *self, Py_buffer *view, int flags)
+{
+  if ((flags & PyBUF_WRITABLE) && !self->owned)
+  {
+    PyErr_SetString(PyExc_BufferError, "the records of a mapped trace are read only");
+    return -1;
+  }
+  view->obj = (PyObject *)self;
+  Py_INCREF(self);
+  view->buf = (void *)self->recs;
+  view->len = self->n * (Py_ssize_t)sizeof(branch_record_t);
+  view->readonly = !self->owned;
+  view->itemsize = sizeof(branch_record_t);
+  view->format = flags & PyBUF_FORMAT ? (char *)BP_RECORD_FORMAT : NULL;
+  view->ndim = 1;
+  view->shape = flags & PyBUF_ND ? &self->n : NULL;
+  view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? &self->stride : NULL;
+  view->suboffsets = NULL;
+  view->internal = NULL;
+  return 0;
+}
+
+static Py_ssize_t bp_records_length(bp_records_t *self)
+{
+  return self->n;
+}
+
+// Record 'i' as a tuple of its pc, target and flags
+static PyObject *bp_records_item(bp_records_t *self, Py_ssize_t i)
+{
+  if (i < 0 || i >= self->n)
+  {
+    PyErr_SetString(PyExc_IndexError, "record index out of range");
+    return NULL;
+  }
+  const branch_record_t *r = &self->recs[i];
+  return Py_BuildValue("(IIB)", r->pc, r->target, r->flags);
+}
+
+static PyBufferProcs bp_records_buffer = {(getbufferproc)bp_records_getbuffer, NULL};
+
+static PySequenceMethods bp_records_sequence = {
+    (lenfunc)bp_records_length, NULL, NULL, (ssizeargfunc)bp_records_item,
+};
+
+static PyTypeObject bp_records_type = {PyVarObject_HEAD_INIT(NULL, 0)};
+
+// bp.load(path, start=0, count=-1): the records of the trace at 'path',
+// from branch 'start', at most 'count'. Plain binary traces are viewed
+// where they are mapped and come back read only, others are decoded
+// once
+static PyObject *bp_load(PyObject *module, PyObject *args, PyObject *kw)
+{
+  static const char *keys[] = {"path", "start", "count", NULL};
+  const char *path;
+  unsigned long long start = 0;
+  long long count = -1;
+  if (!PyArg_ParseTupleAndKeywords(args, kw, "s|KL", (char **)keys, &path, &start, &count))
+  {
+    return NULL;
+  }
+  trace_reader_t *tr = trace_open(path);
+  if (!tr)
+  {
+    return PyErr_Format(PyExc_ValueError, "unable to open trace %s", path);
+  }
+  if (start && !trace_seek(tr, start) && trace_skip(tr, start) != start)
+  {
+    trace_close(tr);
+    return PyErr_Format(PyExc_ValueError, "trace %s ends before branch %llu", path, start);
+  }
+  bp_records_t *self = PyObject_New(bp_records_t, &bp_records_type);
+  if (!self)
+  {
+    trace_close(tr);
+    return NULL;
+  }
+  self->tr = tr;
+  self->owned = NULL;
+  self->stride = sizeof(branch_record_t);
+  size_t n;
+  Py_BEGIN_ALLOW_THREADS
+  n = replay_load(tr, count < 0 ? ~0ULL : (uint64_t)count, &self->recs, &self->owned);
+  Py_END_ALLOW_THREADS
+  self->n = n;
+  return (PyObject *)self;
+}
+
+static void bp_predictor_dealloc(bp_predictor_t *self)
+{
+  if (self->p)
+  {
+    predictor_destroy(self->p);
+  }
+  delete self->lock;
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+// bp.Predictor(name, **fields): a predictor of type 'name' with the
+// fields of predictor_config_set
+static int bp_predictor_init(bp_predictor_t *self, PyObject *args, PyObject *kw)
+{
+  const char *name;
+  if (!PyArg_ParseTuple(args, "s", &name))
+  {
+    return -1;
+  }
+  int type = predictor_type_by_name(name);
+  if (type < 0)
+  {
+    PyErr_Format(PyExc_ValueError, "unknown predictor %s", name);
+    return -1;
+  }
+  predictor_config_t cfg = predictor_default_config(type);
+  PyObject *key, *value;
+  Py_ssize_t pos = 0;
+  while (kw && PyDict_Next(kw, &pos, &key, &value))
+  {
+    const char *field = PyUnicode_AsUTF8(key);
+    long v = PyLong_AsLong(value);
+    if (!field || (v == -1 && PyErr_Occurred()))
+    {
+      return -1;
+    }
+    if (v < INT_MIN || v > INT_MAX || !predictor_config_set(&cfg, field, (int)v))
+    {
+      PyErr_Format(PyExc_ValueError, "bad field %s of %s", field, name);
+      return -1;
+    }
+  }
+  predictor_t *p = predictor_create(&cfg);
+  if (!p)
+  {
+    PyErr_Format(PyExc_ValueError, "invalid configuration of %s", name);
+    return -1;
+  }
+  if (self->p)
+  {
+    predictor_destroy(self->p);
+  }
+  self->p = p;
+  if (!self->lock)
+  {
+    self->lock = new std::mutex();
+  }
+  return 0;
+}
+
+// Predictor.run(records, predictions=True): predict and train on every
+// record of 'records', any contiguous buffer of packed records, in
+// order, without the GIL, through predictor_predict_batch
+//
+// Returns a dict of the conditional branches, mispredictions, mpki,
+// seconds, records and, with 'predictions', the bitmap of the
+// conditional branches predicted taken as a memoryview of unsigned
+// 64-bit words, bit i of word i / 64 for record i
+static PyObject *bp_predictor_run(bp_predictor_t *self, PyObject *args, PyObject *kw)
+{
+  static const char *keys[] = {"records", "predictions", NULL};
+  PyObject *obj;
+  int predictions = 1;
+  if (!PyArg_ParseTupleAndKeywords(args, kw, "O|p", (char **)keys, &obj, &predictions))
+  {
+    return NULL;
+  }
+  if (!self->p)
+  {
+    PyErr_SetString(PyExc_ValueError, "predictor not initialized");
+    return NULL;
+  }
+  Py_buffer view;
+  if (PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS) < 0)
+  {
+    return NULL;
+  }
+  if (view.len % sizeof(branch_record_t))
+  {
+    PyBuffer_Release(&view);
+    return PyErr_Format(PyExc_ValueError, "records must be a whole number of %d byte records",
+                        (int)sizeof(branch_record_t));
+  }
+  size_t n = view.len / sizeof(branch_record_t);
+  const branch_record_t *r = (const branch_record_t *)view.buf;
+  PyObject *bits = PyByteArray_FromStringAndSize(NULL, predictions ? (n + 63) / 64 * 8 : 0);
+  if (!bits)
+  {
+    PyBuffer_Release(&view);
+    return NULL;
+  }
+  uint64_t *words = predictions ? (uint64_t *)PyByteArray_AS_STRING(bits) : NULL;
+  replay_stats_t st = {0, 0};
+  uint64_t ns;
+  Py_BEGIN_ALLOW_THREADS
+  std::lock_guard<std::mutex> lock(*self->lock);
+  st.branches = replay_count_conditional(r, n);
+  uint64_t t0 = trace_clock_ns();
+  st.mispredictions = predictor_predict_batch(self->p, replay_branches(r), n, words);
+  ns = trace_clock_ns() - t0;
+  Py_END_ALLOW_THREADS
+  PyBuffer_Release(&view);
+
+  PyObject *res = Py_BuildValue("{s:K,s:K,s:d,s:d,s:n}", "branches", (unsigned long long)st.branches,
+                                "mispredictions", (unsigned long long)st.mispredictions, "mpki",
+                                st.branches ? replay_rate(&st) : 0.0, "runtime_s", ns / 1e9, "records",
+                                (Py_ssize_t)n);
+  if (res && predictions)
+  {
+    PyObject *bytes = PyMemoryView_FromObject(bits);
+    PyObject *mv = bytes ? PyObject_CallMethod(bytes, "cast", "s", "Q") : NULL;
+    Py_XDECREF(bytes);
+    if (!mv || PyDict_SetItemString(res, "predictions", mv) < 0)
+    {
+      Py_CLEAR(res);
+    }
+    Py_XDECREF(mv);
+  }
+  Py_DECREF(bits);
+  return res;
+}
+
+static PyObject *bp_predictor_config(bp_predictor_t *self, void *)
+{
+  char buf[1024];
+  predictor_config_format(predictor_config(self->p), buf, sizeof(buf));
+  return PyUnicode_FromString(buf);
+}
+
+static PyObject *bp_predictor_memory(bp_predictor_t *self, void *)
+{
+  return PyLong_FromUnsignedLongLong(predictor_memory(self->p));
+}
+
+static PyObject *bp_predictor_budget_bits(bp_predictor_t *self, void *)
+{
+  return PyLong_FromUnsignedLongLong(predictor_budget_bits(predictor_config(self->p)));
+}
+
+static PyMethodDef bp_predictor_methods[] = {
+    {"run", (PyCFunction)(void (*)(void))bp_predictor_run, METH_VARARGS | METH_KEYWORDS,
+     "Predict and train on the records in order, continuing from earlier runs"},
+    {NULL, NULL, 0, NULL},
+};
+
+static PyGetSetDef bp_predictor_getset[] = {
+    {"config", (getter)bp_predictor_config, NULL, "The configuration, as --format prints it", NULL},
+    {"memory", (getter)bp_predictor_memory, NULL, "Host bytes of the predictor", NULL},
+    {"budget_bits", (getter)bp_predictor_budget_bits, NULL, "Bits of its tables and registers", NULL},
+    {NULL, NULL, NULL, NULL, NULL},
+};
+
+static PyTypeObject bp_predictor_type = {PyVarObject_HEAD_INIT(NULL, 0)};
+
+static PyMethodDef bp_methods[] = {
+    {"load", (PyCFunction)(void (*)(void))bp_load, METH_VARARGS | METH_KEYWORDS,
+     "The records of a trace, without a copy for plain binary traces"},
+    {NULL, NULL, 0, NULL},
+};
+
+static PyModuleDef bp_module = {
+    PyModuleDef_HEAD_INIT, "bp", "Branch traces as record buffers and the predictors run on them", -1, bp_methods,
+};
+
+PyMODINIT_FUNC PyInit_bp()
+{
+  bp_records_type.tp_name = "bp.Records";
+  bp_records_type.tp_basicsize = sizeof(bp_records_t);
+  bp_records_type.tp_flags = Py_TPFLAGS_DEFAULT;
+  bp_records_type.tp_doc = "The records of a trace, a buffer of packed pc, target and flags";
+  bp_records_type.tp_dealloc = (destructor)bp_records_dealloc;
+  bp_records_type.tp_as_buffer = &bp_records_buffer;
+  bp_records_type.tp_as_sequence = &bp_records_sequence;
+
+  bp_predictor_type.tp_name = "bp.Predictor";
+  bp_predictor_type.tp_basicsize = sizeof(bp_predictor_t);
+  bp_predictor_type.tp_flags = Py_TPFLAGS_DEFAULT;
+  bp_predictor_type.tp_doc = "Predictor(name, **fields): a predictor with any configuration fields";
+  bp_predictor_type.tp_new = PyType_GenericNew;
+  bp_predictor_type.tp_init = (initproc)bp_predictor_init;
+  bp_predictor_type.tp_dealloc = (destructor)bp_predictor_dealloc;
+  bp_predictor_type.tp_methods = bp_predictor_methods;
+  bp_predictor_type.tp_getset = bp_predictor_getset;
+
+  if (PyType_Ready(&bp_records_type) < 0 || PyType_Ready(&bp_predictor_type) < 0)
+  {
+    return NULL;
+  }
+  PyObject *m = PyModule_Create(&bp_module);
+  if (!m)
+  {
+    return NULL;
+  }
+  Py_INCREF(&bp_predictor_type);
+  if (PyModule_AddObject(m, "Predictor", (PyObject *)&bp_predictor_type) < 0 ||
+      PyModule_AddStringConstant(m, "RECORD_FORMAT", BP_RECORD_FORMAT) < 0 ||
+      PyModule_AddIntConstant(m, "TAKEN", TRACE_F_TAKEN) < 0 ||
+      PyModule_AddIntConstant(m, "CONDITION", TRACE_F_CONDITION) < 0 ||
+      PyModule_AddIntConstant(m, "CALL", TRACE_F_CALL) < 0 || PyModule_AddIntConstant(m, "RET", TRACE_F_RET) < 0 ||
+      PyModule_AddIntConstant(m, "DIRECT", TRACE_F_DIRECT) < 0)
+  {
+    Py_DECREF(&bp_predictor_type);
+    Py_DECREF(m);
+    return NULL;
+  }
+  return m;
+}
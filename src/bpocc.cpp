@@ -0,0 +1,97 @@
+//========================================================//
+//  bpocc.cpp                                             //
+//  Source file for the table occupancy statistics        //
+//========================================================//
+
+#include <stdlib.h>
+#include <string.h>
+#include "bpocc.h"
+
+void bp_occ_init(bp_occ_t *o)
+{
+  memset(o, 0, sizeof(*o));
+}
+
+int bp_occ_table(bp_occ_t *o, const char *name, uint64_t entries, int aliasing)
+{
+  if (o->tables == BP_OCC_TABLES)
+  {
+    return 0;
+  }
+  bp_occ_table_t *tb = &o->table[o->tables];
+  memset(tb, 0, sizeof(*tb));
+  snprintf(tb->name, sizeof(tb->name), "%s", name);
+  tb->entries = entries;
+  while (entries >> tb->shift > BP_OCC_SAMPLE_MIN && (1 << tb->shift) < BP_OCC_SAMPLE)
+  {
+    tb->shift++;
+  }
+  uint64_t slots = ((entries - 1) >> tb->shift) + 1;
+  tb->touched = (uint64_t *)calloc((slots + 63) / 64, sizeof(uint64_t));
+  if (!tb->touched)
+  {
+    return 0;
+  }
+  if (aliasing)
+  {
+    tb->last_pc = (uint32_t *)calloc(slots, sizeof(uint32_t));
+    if (!o->shadow_key)
+    {
+      o->shadow_key = (uint64_t *)calloc(1 << BP_OCC_SHADOW_BITS, sizeof(uint64_t));
+      o->shadow_ctr = (uint8_t *)calloc(1 << BP_OCC_SHADOW_BITS, 1);
+    }
+    if (!tb->last_pc || !o->shadow_key || !o->shadow_ctr)
+    {
+      free(tb->touched);
+      free(tb->last_pc);
+      return 0;
+    }
+  }
+  o->tables++;
+  return 1;
+}
+
+void bp_occ_print(const bp_occ_t *o, const char *name, FILE *out)
+{
+  if (!o->tables)
+  {
+    return;
+  }
+  fprintf(out, "%s occupancy:\n", name);
+  for (int t = 0; t < o->tables; t++)
+  {
+    const bp_occ_table_t *tb = &o->table[t];
+    double touched = (double)(tb->touched_count << tb->shift) / tb->entries;
+    fprintf(out, "  %-10s %10llu entries %6.2f%% touched", tb->name, (unsigned long long)tb->entries,
+            100 * (touched < 1 ? touched : 1));
+    if (tb->shift)
+    {
+      fprintf(out, " (1 in %d tracked)", 1 << tb->shift);
+    }
+    if (tb->last_pc && tb->accesses)
+    {
+      fprintf(out, ", %.2f%% of accesses aliased: %.2f%% constructive, %.2f%% destructive",
+              100.0 * tb->aliased / tb->accesses, 100.0 * tb->constructive / tb->accesses,
+              100.0 * tb->destructive / tb->accesses);
+    }
+    if (o->lookups && (tb->hits || tb->allocations))
+    {
+      fprintf(out, ", hits %.2f%% of lookups, %.3f allocations/kbr, %.2f%% evicting",
+              100.0 * tb->hits / o->lookups, 1000.0 * tb->allocations / o->lookups,
+              tb->allocations ? 100.0 * tb->evictions / tb->allocations : 0.0);
+    }
+    fputc('\n', out);
+  }
+}
+
+void bp_occ_free(bp_occ_t *o)
+{
+  for (int t = 0; t < o->tables; t++)
+  {
+    free(o->table[t].touched);
+    free(o->table[t].last_pc);
+  }
+  free(o->shadow_key);
+  free(o->shadow_ctr);
+  bp_occ_init(o);
+}
@@ -0,0 +1,162 @@
+//========================================================//
+//  bpocc.h                                               //
+//  Header file for the table occupancy statistics        //
+//                                                        //
+//  Built with -DBP_OCCUPANCY (make OCCUPANCY=1), every   //
+//  predictor tracks 1 in BP_OCC_SAMPLE entries of each   //
+//  of its tables: whether a branch touched it, which     //
+//  branch used it last and, for the 2-bit counter tables //
+//  of gshare and the tournament global side, whether     //
+//  sharing it with other branches helped or hurt. TAGE   //
+//  also counts the hits, allocations and evictions of    //
+//  each component. Without it nothing below is           //
+//  compiled into the predictors                          //
+//========================================================//
+
+#ifndef BPOCC_H
+#define BPOCC_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "predictor.h"
+
+// Entries per tracked one in tables larger than BP_OCC_SAMPLE_MIN,
+// a power of 2. Smaller tables track every entry
+#ifndef BP_OCC_SAMPLE
+#define BP_OCC_SAMPLE 16
+#endif
+#define BP_OCC_SAMPLE_MIN 4096
+
+// The most tables of one predictor: the TAGE bimodal and tagged ones
+#define BP_OCC_TABLES (1 + TAGE_MAX_TAGGED)
+
+// Private counters of (entry, branch) pairs the aliasing is judged
+// against, direct mapped
+#define BP_OCC_SHADOW_BITS 18
+
+typedef struct
+{
+  char name[16];
+  uint64_t entries;
+  int shift;                  // log2 of the entries per tracked one
+  uint64_t *touched;          // bitmap of the tracked entries
+  uint64_t touched_count;     // bits set in it
+  uint32_t *last_pc;          // with aliasing, pc + 1 of the last branch at each tracked entry
+  uint64_t accesses;          // of tracked entries, with aliasing
+  uint64_t aliased;           // by another branch than the one before
+  uint64_t constructive;      // aliased, right where a private counter would be wrong
+  uint64_t destructive;       // and wrong where it would be right
+  uint64_t hits;              // TAGE: predictions this component provided
+  uint64_t allocations;
+  uint64_t evictions;         // allocations over an entry in use
+} bp_occ_table_t;
+
+typedef struct
+{
+  int tables;
+  bp_occ_table_t table[BP_OCC_TABLES];
+  uint64_t lookups;           // TAGE predictions, for the hit rates
+  uint64_t *shadow_key;       // entry, table and pc of each private counter, + 1
+  uint8_t *shadow_ctr;
+} bp_occ_t;
+
+// Clear 'o' of any table
+//
+void bp_occ_init(bp_occ_t *o);
+
+// Track the next table of 'entries' entries, judging its aliasing
+// when 'aliasing' is set
+//
+// Returns True if Successful
+//
+int bp_occ_table(bp_occ_t *o, const char *name, uint64_t entries, int aliasing);
+
+// Tracked slot of entry 'index' of table 't', -1 when not tracked
+static inline int64_t bp_occ_slot(const bp_occ_t *o, int t, uint64_t index)
+{
+  const bp_occ_table_t *tb = &o->table[t];
+  return index & ((1ULL << tb->shift) - 1) ? -1 : (int64_t)(index >> tb->shift);
+}
+
+static inline void bp_occ_mark(bp_occ_table_t *tb, int64_t slot)
+{
+  uint64_t bit = 1ULL << (slot & 63);
+  tb->touched_count += !(tb->touched[slot >> 6] & bit);
+  tb->touched[slot >> 6] |= bit;
+}
+
+// A branch read or wrote entry 'index' of table 't'
+static inline void bp_occ_touch(bp_occ_t *o, int t, uint64_t index)
+{
+  int64_t slot = bp_occ_slot(o, t, index);
+  if (slot >= 0)
+  {
+    bp_occ_mark(&o->table[t], slot);
+  }
+}
+
+// Branch 'pc' predicted 'pred' from the 2-bit counter at entry 'index'
+// of table 't', stored from 'init' like the table's, and went
+// 'outcome'. A private counter of the pair stands for the table with
+// no other branch at that entry
+static inline void bp_occ_alias(bp_occ_t *o, int t, uint64_t index, uint32_t pc, uint8_t pred, uint8_t outcome,
+                                uint8_t init)
+{
+  int64_t slot = bp_occ_slot(o, t, index);
+  if (slot < 0)
+  {
+    return;
+  }
+  bp_occ_table_t *tb = &o->table[t];
+  bp_occ_mark(tb, slot);
+  uint64_t key = (((uint64_t)t << 58) ^ (index << 32) ^ pc) + 1;
+  uint64_t h = (key * 0x9e3779b97f4a7c15ULL) >> (64 - BP_OCC_SHADOW_BITS);
+  if (o->shadow_key[h] != key)
+  {
+    o->shadow_key[h] = key;
+    o->shadow_ctr[h] = init;
+  }
+  uint8_t *c = &o->shadow_ctr[h];
+  uint8_t own = *c >= 2;
+  tb->accesses++;
+  if (tb->last_pc[slot] && tb->last_pc[slot] != pc + 1)
+  {
+    tb->aliased++;
+    tb->constructive += pred != own && pred == outcome;
+    tb->destructive += pred != own && pred != outcome;
+  }
+  tb->last_pc[slot] = pc + 1;
+  if (outcome ? *c < 3 : *c > 0)
+  {
+    *c += outcome ? 1 : -1;
+  }
+}
+
+// TAGE component 't' provided a prediction
+static inline void bp_occ_hit(bp_occ_t *o, int t)
+{
+  o->table[t].hits++;
+}
+
+// TAGE allocated entry 'index' of component 't', over one in use when
+// 'evicts' is set
+static inline void bp_occ_allocate(bp_occ_t *o, int t, uint64_t index, int evicts)
+{
+  o->table[t].allocations++;
+  o->table[t].evictions += evicts != 0;
+  bp_occ_touch(o, t, index);
+}
+
+// Print the tables of 'o' under 'name'
+//
+void bp_occ_print(const bp_occ_t *o, const char *name, FILE *out);
+
+void bp_occ_free(bp_occ_t *o);
+
+#ifdef BP_OCCUPANCY
+// The statistics of 'p', only with the instrumentation built in
+//
+const bp_occ_t *predictor_occupancy(const predictor_t *p);
+#endif
+
+#endif
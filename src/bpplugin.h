@@ -0,0 +1,75 @@
+//========================================================//
+//  bpplugin.h                                            //
+//  Header file for predictor plugins                     //
+//                                                        //
+//  A plugin is a shared object loaded with               //
+//  --plugin=<lib.so> and run as the predictor type       //
+//  PLUGIN. It exports bp_plugin_info, returning the      //
+//  table of entry points below.                          //
+//========================================================//
+
+#ifndef BPPLUGIN_H
+#define BPPLUGIN_H
+
+#include "predictor.h"
+
+// Bumped whenever bp_plugin_t changes
+#define BP_PLUGIN_ABI 1
+
+// Symbol looked up in the plugin
+#define BP_PLUGIN_ENTRY "bp_plugin_info"
+
+// Every entry is required. 'state' is the value init returned, one
+// per predictor instance; instances may run on different threads at
+// once but each is only used by one thread at a time
+typedef struct
+{
+  uint32_t abi;   // BP_PLUGIN_ABI
+  const char *name;
+
+  // Allocate the tables of one instance
+  //
+  // Returns NULL on failure
+  //
+  void *(*init)(void);
+
+  // Prediction for the conditional branch at 'pc', TAKEN or NOTTAKEN
+  //
+  uint8_t (*predict)(void *state, uint32_t pc);
+
+  // Train on the conditional branch at 'pc'
+  //
+  void (*train)(void *state, uint32_t pc, uint8_t outcome);
+
+  // predict followed by train, with the lookups done once
+  //
+  uint8_t (*predict_and_train)(void *state, uint32_t pc, uint8_t outcome);
+
+  // predict_and_train over the conditional branches among 'n', as
+  // predictor_predict_batch: bit i of 'predictions' (already zeroed,
+  // NULL for none) is set when branch i is predicted taken
+  //
+  // Returns the number of mispredicted conditional branches
+  //
+  uint64_t (*predict_batch)(void *state, const predictor_branch_t *br, size_t n, uint64_t *predictions);
+
+  // Release the tables of one instance
+  //
+  void (*free)(void *state);
+
+  // Write the configuration into 'buf' of 'len' bytes as
+  // "key=value ..."
+  //
+  // Returns the storage budget in bits
+  //
+  uint64_t (*describe)(char *buf, size_t len);
+} bp_plugin_t;
+
+// The entry point each plugin defines
+//
+#ifdef __cplusplus
+extern "C"
+#endif
+const bp_plugin_t *bp_plugin_info(void);
+
+#endif
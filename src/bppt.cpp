@@ -0,0 +1,540 @@
+//========================================================//
+//  bppt.cpp                                              //
+//  Decodes Intel Processor Trace into a binary trace     //
+//                                                        //
+//  perf record -e intel_pt/noretcomp/u -- ./server       //
+//  ./bppt perf.data trace.bin                            //
+//                                                        //
+//  The PT of every CPU (or thread) in perf.data is cut   //
+//  at PSB packets, where a decoder can start on its own, //
+//  into pieces of about BPPT_CHUNK_MB that the threads   //
+//  decode at once with the instruction flow decoder of   //
+//  libipt, over the files the process mapped. Every      //
+//  conditional branch, taken or not, becomes a record,   //
+//  as do the jumps, calls and returns, and the pieces    //
+//  are written in order. libipt is loaded at run time    //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "trace.h"
+
+#define BPPT_CHUNK_MB 4 // of PT per piece, at least
+
+// The perf.data records read, as in linux/perf_event.h and perf's
+// own headers
+#define PERF_FILE_MAGIC "PERFILE2"
+#define PERF_RECORD_MMAP 1
+#define PERF_RECORD_MMAP2 10
+#define PERF_RECORD_AUXTRACE 71
+#define PERF_RECORD_MISC_MMAP_DATA (1 << 13)
+
+// What of libipt is used, as in intel-pt.h, so that building needs no
+// libipt headers
+#define PTE_EOS 7
+#define PTS_EVENT_PENDING (1 << 2)
+#define PTIC_CALL 2
+#define PTIC_RETURN 3
+#define PTIC_JUMP 4
+#define PTIC_COND_JUMP 5
+#define PTEV_OVERFLOW 6
+#define PT_MAX_INSN_SIZE 15
+
+// The fields of struct pt_config up to the decode callback; libipt
+// takes the rest as zero
+typedef struct
+{
+  size_t size;
+  uint8_t *begin;
+  uint8_t *end;
+  void *callback;
+  void *context;
+} pt_config_prefix_t;
+
+typedef struct
+{
+  uint64_t ip;
+  int isid;
+  int mode;
+  int iclass;
+  uint8_t raw[PT_MAX_INSN_SIZE];
+  uint8_t size;
+  uint32_t speculative : 1;
+  uint32_t truncated : 1;
+} pt_insn_t;
+
+static struct
+{
+  int loaded;
+  void *(*insn_alloc_decoder)(const pt_config_prefix_t *);
+  void (*insn_free_decoder)(void *);
+  int (*insn_sync_forward)(void *);
+  int (*insn_next)(void *, pt_insn_t *, size_t);
+  int (*insn_event)(void *, void *, size_t);
+  void *(*insn_get_image)(void *);
+  int (*image_add_file)(void *, const char *, uint64_t, uint64_t, const void *, uint64_t);
+} ipt;
+
+static void bppt_load_ipt()
+{
+  void *lib = dlopen("libipt.so.2", RTLD_NOW | RTLD_LOCAL);
+  if (!lib)
+  {
+    lib = dlopen("libipt.so", RTLD_NOW | RTLD_LOCAL);
+  }
+  if (!lib)
+  {
+    return;
+  }
+  ipt.insn_alloc_decoder = (void *(*)(const pt_config_prefix_t *))dlsym(lib, "pt_insn_alloc_decoder");
+  ipt.insn_free_decoder = (void (*)(void *))dlsym(lib, "pt_insn_free_decoder");
+  ipt.insn_sync_forward = (int (*)(void *))dlsym(lib, "pt_insn_sync_forward");
+  ipt.insn_next = (int (*)(void *, pt_insn_t *, size_t))dlsym(lib, "pt_insn_next");
+  ipt.insn_event = (int (*)(void *, void *, size_t))dlsym(lib, "pt_insn_event");
+  ipt.insn_get_image = (void *(*)(void *))dlsym(lib, "pt_insn_get_image");
+  ipt.image_add_file =
+      (int (*)(void *, const char *, uint64_t, uint64_t, const void *, uint64_t))dlsym(lib, "pt_image_add_file");
+  ipt.loaded = ipt.insn_alloc_decoder && ipt.insn_free_decoder && ipt.insn_sync_forward && ipt.insn_next &&
+               ipt.insn_event && ipt.insn_get_image && ipt.image_add_file;
+}
+
+// An executable mapping of the traced process
+typedef struct
+{
+  uint64_t addr, len, pgoff;
+  std::string path;
+} bppt_map_t;
+
+// A piece of one PT stream, from a PSB to the next piece's
+typedef struct
+{
+  const uint8_t *begin, *end;
+  int first;                           // of its stream
+  std::vector<branch_record_t> records;
+  uint64_t instructions;
+  uint64_t resyncs;
+  int done;
+} bppt_chunk_t;
+
+static std::vector<bppt_map_t> maps;
+
+void usage()
+{
+  fprintf(stderr, "Usage: bppt [options] <perf.data> <output>\n");
+  fprintf(stderr, " Options:\n");
+  fprintf(stderr, " --threads=<n>   Decoding threads (default one per core)\n");
+  fprintf(stderr, " --pid=<n>       Process whose code is decoded (default the first mapped)\n");
+  fprintf(stderr, " --chunk=<mb>    PT per piece a thread decodes (default %d)\n", BPPT_CHUNK_MB);
+  fprintf(stderr, " Record with perf record -e intel_pt/noretcomp/u, so that a piece\n");
+  fprintf(stderr, " needs no returns from before it; libipt must be installed\n");
+}
+
+// The target of the direct branch encoded in 'raw' at 'ip'
+//
+// Returns False if it is indirect
+//
+static int bppt_direct_target(const pt_insn_t *in, uint64_t *target)
+{
+  const uint8_t *raw = in->raw;
+  int i = 0;
+  while (i < in->size && (raw[i] == 0x66 || raw[i] == 0x67 || raw[i] == 0xf2 || raw[i] == 0xf3 || raw[i] == 0x2e ||
+                          raw[i] == 0x3e || raw[i] == 0x26 || raw[i] == 0x36 || raw[i] == 0x64 || raw[i] == 0x65 ||
+                          (raw[i] & 0xf0) == 0x40))
+  {
+    i++;
+  }
+  int64_t rel;
+  if (i + 1 < in->size && ((raw[i] & 0xf0) == 0x70 || raw[i] == 0xeb || (raw[i] >= 0xe0 && raw[i] <= 0xe3)))
+  {
+    rel = (int8_t)raw[i + 1];
+  }
+  else if (i + 4 < in->size && (raw[i] == 0xe8 || raw[i] == 0xe9))
+  {
+    int32_t r;
+    memcpy(&r, raw + i + 1, 4);
+    rel = r;
+  }
+  else if (i + 5 < in->size && raw[i] == 0x0f && (raw[i + 1] & 0xf0) == 0x80)
+  {
+    int32_t r;
+    memcpy(&r, raw + i + 2, 4);
+    rel = r;
+  }
+  else
+  {
+    return 0;
+  }
+  *target = in->ip + in->size + rel;
+  return 1;
+}
+
+// The record of the branch 'in', with 'next' the instruction after it
+//
+static void bppt_emit(std::vector<branch_record_t> &out, const pt_insn_t *in, uint64_t next)
+{
+  uint64_t target = next;
+  int direct = bppt_direct_target(in, &target);
+  uint8_t flags = next != in->ip + in->size ? TRACE_F_TAKEN : 0;
+  flags |= direct ? TRACE_F_DIRECT : 0;
+  switch (in->iclass)
+  {
+  case PTIC_COND_JUMP:
+    flags |= TRACE_F_CONDITION;
+    break;
+  case PTIC_CALL:
+    flags |= TRACE_F_CALL;
+    break;
+  case PTIC_RETURN:
+    flags |= TRACE_F_RET;
+    break;
+  }
+  branch_record_t r;
+  r.pc = (uint32_t)in->ip;
+  r.target = (uint32_t)target;
+  r.flags = flags;
+  out.push_back(r);
+}
+
+// Decode the instructions of chunk 'c' into its records
+//
+static void bppt_decode(bppt_chunk_t *c)
+{
+  pt_config_prefix_t cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.size = sizeof(cfg);
+  cfg.begin = (uint8_t *)c->begin;
+  cfg.end = (uint8_t *)c->end;
+  void *dec = ipt.insn_alloc_decoder(&cfg);
+  if (!dec)
+  {
+    return;
+  }
+  void *image = ipt.insn_get_image(dec);
+  for (const bppt_map_t &m : maps)
+  {
+    ipt.image_add_file(image, m.path.c_str(), m.pgoff, m.len, NULL, m.addr);
+  }
+
+  // The last branch is written once the instruction after it shows
+  // where it went
+  pt_insn_t prev;
+  int pending = 0;
+  int status = ipt.insn_sync_forward(dec);
+  while (status != -PTE_EOS)
+  {
+    if (status < 0)
+    {
+      // Lost sync: drop the branch in flight and find the next PSB
+      pending = 0;
+      c->resyncs++;
+      branch_record_t b = {0, 0, TRACE_F_BREAK};
+      c->records.push_back(b);
+      status = ipt.insn_sync_forward(dec);
+      continue;
+    }
+    while (status & PTS_EVENT_PENDING)
+    {
+      uint64_t ev[64]; // struct pt_event, its type first
+      status = ipt.insn_event(dec, ev, sizeof(ev));
+      int type;
+      memcpy(&type, ev, sizeof(type));
+      if (status >= 0 && type == PTEV_OVERFLOW)
+      {
+        pending = 0;
+        branch_record_t b = {0, 0, TRACE_F_BREAK};
+        c->records.push_back(b);
+      }
+    }
+    if (status < 0)
+    {
+      continue;
+    }
+    pt_insn_t in;
+    status = ipt.insn_next(dec, &in, sizeof(in));
+    if (status < 0)
+    {
+      continue;
+    }
+    c->instructions++;
+    if (pending)
+    {
+      bppt_emit(c->records, &prev, in.ip);
+      pending = 0;
+    }
+    if (in.iclass >= PTIC_CALL && in.iclass <= PTIC_COND_JUMP)
+    {
+      prev = in;
+      pending = 1;
+    }
+  }
+  ipt.insn_free_decoder(dec);
+}
+
+// Offsets of the PSB packets of 'len' bytes of PT
+//
+static void bppt_find_psbs(const uint8_t *pt, size_t len, std::vector<size_t> &psbs)
+{
+  static const uint8_t psb[16] = {0x02, 0x82, 0x02, 0x82, 0x02, 0x82, 0x02, 0x82,
+                                  0x02, 0x82, 0x02, 0x82, 0x02, 0x82, 0x02, 0x82};
+  for (size_t i = 0; i + sizeof(psb) <= len;)
+  {
+    const uint8_t *p = (const uint8_t *)memchr(pt + i, 0x02, len - sizeof(psb) + 1 - i);
+    if (!p)
+    {
+      break;
+    }
+    i = p - pt;
+    if (!memcmp(p, psb, sizeof(psb)))
+    {
+      psbs.push_back(i);
+      i += sizeof(psb);
+    }
+    else
+    {
+      i++;
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int threads = 0;
+  int pid = -1;
+  size_t chunk_bytes = (size_t)BPPT_CHUNK_MB << 20;
+  const char *in_path = NULL, *path = NULL;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strncmp(argv[i], "--threads=", 10))
+    {
+      threads = atoi(argv[i] + 10);
+    }
+    else if (!strncmp(argv[i], "--pid=", 6))
+    {
+      pid = atoi(argv[i] + 6);
+    }
+    else if (!strncmp(argv[i], "--chunk=", 8))
+    {
+      chunk_bytes = (size_t)strtoull(argv[i] + 8, NULL, 0) << 20;
+    }
+    else if (!in_path && strncmp(argv[i], "--", 2))
+    {
+      in_path = argv[i];
+    }
+    else if (!path && strncmp(argv[i], "--", 2))
+    {
+      path = argv[i];
+    }
+    else
+    {
+      usage();
+      exit(1);
+    }
+  }
+  if (!in_path || !path || !chunk_bytes)
+  {
+    usage();
+    exit(1);
+  }
+  bppt_load_ipt();
+  if (!ipt.loaded)
+  {
+    fprintf(stderr, "Error: libipt.so.2 could not be loaded, install libipt\n");
+    exit(1);
+  }
+  if (threads <= 0)
+  {
+    threads = std::thread::hardware_concurrency();
+    threads = threads > 0 ? threads : 1;
+  }
+
+  // perf.data, mapped: the header, then the records of its data
+  // section, each AUXTRACE one followed by its bytes of PT
+  int fd = open(in_path, O_RDONLY);
+  struct stat sb;
+  if (fd < 0 || fstat(fd, &sb))
+  {
+    fprintf(stderr, "Error: can not open %s\n", in_path);
+    exit(1);
+  }
+  const uint8_t *file = sb.st_size ? (const uint8_t *)mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+  close(fd);
+  uint64_t data_off, data_size;
+  if (!file || file == MAP_FAILED || sb.st_size < 104 || memcmp(file, PERF_FILE_MAGIC, 8))
+  {
+    fprintf(stderr, "Error: %s is not a perf.data file (pipe mode and compressed ones aren't read)\n", in_path);
+    exit(1);
+  }
+  memcpy(&data_off, file + 40, 8);
+  memcpy(&data_size, file + 48, 8);
+  if (data_off > (uint64_t)sb.st_size || data_size > (uint64_t)sb.st_size - data_off)
+  {
+    fprintf(stderr, "Error: %s is truncated\n", in_path);
+    exit(1);
+  }
+
+  // The PT of each buffer index, a CPU or a thread, in order
+  std::map<uint32_t, std::vector<uint8_t>> streams;
+  for (uint64_t off = data_off; off + 8 <= data_off + data_size;)
+  {
+    uint32_t type;
+    uint16_t misc, size;
+    memcpy(&type, file + off, 4);
+    memcpy(&misc, file + off + 4, 2);
+    memcpy(&size, file + off + 6, 2);
+    if (size < 8 || off + size > data_off + data_size)
+    {
+      break;
+    }
+    const uint8_t *body = file + off + 8;
+    uint64_t next = off + size;
+    if (type == PERF_RECORD_AUXTRACE && size >= 48)
+    {
+      uint64_t aux_size;
+      uint32_t idx;
+      memcpy(&aux_size, body, 8);
+      memcpy(&idx, body + 24, 4);
+      if (aux_size > data_off + data_size - next)
+      {
+        break;
+      }
+      std::vector<uint8_t> &s = streams[idx];
+      s.insert(s.end(), file + next, file + next + aux_size);
+      next += aux_size;
+    }
+    else if ((type == PERF_RECORD_MMAP || type == PERF_RECORD_MMAP2) && !(misc & PERF_RECORD_MISC_MMAP_DATA))
+    {
+      // pid, tid, addr, len, pgoff, then for MMAP2 24 bytes of device
+      // and inode, prot and flags, then the file name
+      int map_pid;
+      bppt_map_t m;
+      memcpy(&map_pid, body, 4);
+      memcpy(&m.addr, body + 8, 8);
+      memcpy(&m.len, body + 16, 8);
+      memcpy(&m.pgoff, body + 24, 8);
+      uint32_t prot = PROT_EXEC;
+      if (type == PERF_RECORD_MMAP2)
+      {
+        memcpy(&prot, body + 56, 4);
+      }
+      const char *name = (const char *)body + (type == PERF_RECORD_MMAP2 ? 64 : 32);
+      pid = pid < 0 && name[0] == '/' ? map_pid : pid;
+      if (map_pid == pid && (prot & PROT_EXEC) && name[0] == '/')
+      {
+        m.path = name;
+        maps.push_back(m);
+      }
+    }
+    off = next;
+  }
+  if (streams.empty())
+  {
+    fprintf(stderr, "Error: %s holds no AUXTRACE data, record it with -e intel_pt//u\n", in_path);
+    exit(1);
+  }
+
+  // Pieces from one PSB to the first at least chunk_bytes after it
+  std::vector<bppt_chunk_t> chunks;
+  for (auto &s : streams)
+  {
+    std::vector<size_t> psbs;
+    bppt_find_psbs(s.second.data(), s.second.size(), psbs);
+    psbs.push_back(s.second.size());
+    size_t from = psbs[0];
+    int first = 1;
+    for (size_t k = 1; k < psbs.size(); k++)
+    {
+      if (psbs[k] - from >= chunk_bytes || k + 1 == psbs.size())
+      {
+        bppt_chunk_t c;
+        c.begin = s.second.data() + from;
+        c.end = s.second.data() + psbs[k];
+        c.first = first;
+        c.instructions = c.resyncs = 0;
+        c.done = 0;
+        chunks.push_back(c);
+        from = psbs[k];
+        first = 0;
+      }
+    }
+  }
+
+  trace_writer_t *tw = trace_writer_open(path, -1, 0, 0, 0);
+  if (!tw)
+  {
+    fprintf(stderr, "Error: can not create %s\n", path);
+    exit(1);
+  }
+
+  // The threads take the pieces in order, and this one writes each as
+  // soon as it and those before it are decoded
+  uint64_t start_ns = trace_clock_ns();
+  std::atomic<size_t> next_chunk(0);
+  std::mutex lock;
+  std::condition_variable decoded;
+  auto worker = [&]()
+  {
+    for (size_t k; (k = next_chunk++) < chunks.size();)
+    {
+      bppt_decode(&chunks[k]);
+      std::lock_guard<std::mutex> g(lock);
+      chunks[k].done = 1;
+      decoded.notify_all();
+    }
+  };
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; t++)
+  {
+    pool.push_back(std::thread(worker));
+  }
+  int ok = 1;
+  uint64_t records = 0, instructions = 0, resyncs = 0;
+  for (size_t k = 0; k < chunks.size(); k++)
+  {
+    {
+      std::unique_lock<std::mutex> g(lock);
+      decoded.wait(g, [&]() { return chunks[k].done; });
+    }
+    bppt_chunk_t *c = &chunks[k];
+    if (c->first && records)
+    {
+      branch_record_t b = {0, 0, TRACE_F_BREAK};
+      ok = ok && trace_writer_write(tw, &b, 1);
+      records++;
+    }
+    ok = ok && trace_writer_write(tw, c->records.data(), c->records.size());
+    records += c->records.size();
+    instructions += c->instructions;
+    resyncs += c->resyncs;
+    std::vector<branch_record_t>().swap(c->records);
+  }
+  for (auto &t : pool)
+  {
+    t.join();
+  }
+  ok = trace_writer_close(tw) && ok;
+  munmap((void *)file, sb.st_size);
+  if (!ok)
+  {
+    fprintf(stderr, "Error: failed to write %s\n", path);
+    exit(1);
+  }
+  double secs = (trace_clock_ns() - start_ns) / 1e9;
+  fprintf(stderr, "%zu streams, %zu pieces on %d threads, %llu instructions, %llu records, %llu resyncs, %.1f s\n",
+          streams.size(), chunks.size(), threads, (unsigned long long)instructions, (unsigned long long)records,
+          (unsigned long long)resyncs, secs);
+  return 0;
+}
@@ -0,0 +1,278 @@
+//========================================================//
+//  bprecover.cpp                                         //
+//  Recovers the traces of a killed branchExt run         //
+//                                                        //
+//  ./bprecover branches_0.out                            //
+//  ./bprecover --prefix=gcc_ gcc_12_0.out gcc_12_1.out   //
+//                                                        //
+//  branchExt -crash_safe counts the records of a trace   //
+//  in its header after every block, so a file left by a  //
+//  program that was killed reads up to the last block    //
+//  written, ahead of unused bytes. This cuts the file    //
+//  and its .icnt sidecar to those records and writes the //
+//  generalInfo file Fini never wrote                     //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include "trace.h"
+#include "icount.h"
+
+void usage()
+{
+  fprintf(stderr, "Usage: bprecover [options] <trace>...\n");
+  fprintf(stderr, " Options:\n");
+  fprintf(stderr, " --prefix=<name>          The -o prefix of the traces (default branches),\n");
+  fprintf(stderr, "                          replaced by generalInfo in the info file's name\n");
+  fprintf(stderr, " --dry-run                Only print what would be done\n");
+}
+
+// Records read at a time
+#define RECOVER_BATCH 4096
+
+// Counts of the records of a trace, as the info file gives them
+typedef struct
+{
+  uint64_t records;
+  uint64_t conditional, unconditional, call, ret;
+  uint64_t bytes;        // of the header and the records
+  uint64_t header_count; // records the header counts
+} recover_counts_t;
+
+// Read the trace at 'path' to its end
+//
+// Returns True if Successful, False if it is not a plain binary trace
+//
+int recover_count(const char *path, recover_counts_t *c)
+{
+  trace_reader_t *tr = trace_open(path);
+  if (!tr)
+  {
+    fprintf(stderr, "Error: can not open %s\n", path);
+    return 0;
+  }
+  if (tr->format != TRACE_FMT_BIN || tr->frames || !tr->data_offset)
+  {
+    fprintf(stderr, "Error: %s is not a plain binary trace of branchExt -format bin or ids\n", path);
+    trace_close(tr);
+    return 0;
+  }
+  memset(c, 0, sizeof(*c));
+  trace_header_t hdr;
+  memcpy(&hdr, tr->data, sizeof(hdr));
+  c->header_count = hdr.num_records;
+  // a version 1 reader goes on to the end of the file, over the tail
+  branch_record_t recs[RECOVER_BATCH];
+  while (c->records < c->header_count)
+  {
+    uint64_t left = c->header_count - c->records;
+    size_t n = trace_read_batch(tr, recs, left < RECOVER_BATCH ? left : RECOVER_BATCH);
+    if (!n)
+    {
+      break;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+      uint8_t f = recs[i].flags;
+      c->conditional += (f & TRACE_F_CONDITION) != 0;
+      c->unconditional += !(f & TRACE_F_CONDITION);
+      c->call += (f & TRACE_F_CALL) != 0;
+      c->ret += (f & TRACE_F_RET) != 0;
+    }
+    c->records += n;
+  }
+  c->bytes = tr->base + tr->pos;
+  trace_close(tr);
+  return 1;
+}
+
+// Cut the .icnt sidecar of the trace at 'path' to 'records' varints,
+// adding up the instructions they count into 'instructions'
+//
+// Returns True if Successful, False if there is no sidecar or it is
+// shorter
+//
+int recover_icount(const char *path, uint64_t records, int dry_run, uint64_t *instructions)
+{
+  std::string name = std::string(path) + ".icnt";
+  FILE *f = fopen(name.c_str(), dry_run ? "rb" : "r+b");
+  if (!f)
+  {
+    return 0;
+  }
+  char magic[ICOUNT_MAGIC_LEN];
+  if (fread(magic, 1, ICOUNT_MAGIC_LEN, f) != ICOUNT_MAGIC_LEN || memcmp(magic, ICOUNT_MAGIC, ICOUNT_MAGIC_LEN))
+  {
+    fprintf(stderr, "Warning: %s is not an instruction count sidecar\n", name.c_str());
+    fclose(f);
+    return 0;
+  }
+  uint64_t sum = 0, delta = 0, offset = ICOUNT_MAGIC_LEN, n = 0;
+  int shift = 0, ch;
+  while (n < records && (ch = getc(f)) != EOF)
+  {
+    offset++;
+    delta |= (uint64_t)(ch & 0x7F) << shift;
+    shift += 7;
+    if (!(ch & 0x80))
+    {
+      sum += delta;
+      delta = 0;
+      shift = 0;
+      n++;
+    }
+  }
+  if (n < records)
+  {
+    fprintf(stderr, "Warning: %s ends before the trace's %llu records\n", name.c_str(), (unsigned long long)records);
+    fclose(f);
+    return 0;
+  }
+  if (!dry_run && ftruncate(fileno(f), offset))
+  {
+    fprintf(stderr, "Warning: can not cut %s to %llu bytes\n", name.c_str(), (unsigned long long)offset);
+  }
+  fclose(f);
+  *instructions = sum;
+  return 1;
+}
+
+// The info file of the trace at 'path', the -o 'prefix' of its name
+// replaced by generalInfo, or "" if it does not start with 'prefix'
+std::string recover_info_name(const char *path, const char *prefix)
+{
+  std::string p = path;
+  size_t slash = p.rfind('/');
+  size_t base = slash == std::string::npos ? 0 : slash + 1;
+  if (p.compare(base, strlen(prefix), prefix))
+  {
+    return "";
+  }
+  return p.substr(0, base) + "generalInfo" + p.substr(base + strlen(prefix));
+}
+
+// Recover the trace at 'path'
+//
+// Returns True if Successful
+//
+int recover(const char *path, const char *prefix, int dry_run)
+{
+  recover_counts_t c;
+  if (!recover_count(path, &c))
+  {
+    return 0;
+  }
+  FILE *f = fopen(path, dry_run ? "rb" : "r+b");
+  if (!f || fseek(f, 0, SEEK_END))
+  {
+    fprintf(stderr, "Error: can not open %s\n", path);
+    if (f)
+    {
+      fclose(f);
+    }
+    return 0;
+  }
+  uint64_t size = ftell(f);
+  printf("%s: %llu records in %llu of %llu bytes\n", path, (unsigned long long)c.records,
+         (unsigned long long)c.bytes, (unsigned long long)size);
+  if (!dry_run && c.records != c.header_count)
+  {
+    // records lost after the header counted them
+    if (fseek(f, offsetof(trace_header_t, num_records), SEEK_SET) ||
+        fwrite(&c.records, sizeof(c.records), 1, f) != 1)
+    {
+      fprintf(stderr, "Error: can not write the record count of %s\n", path);
+      fclose(f);
+      return 0;
+    }
+  }
+  if (!dry_run && size > c.bytes && (fflush(f) || ftruncate(fileno(f), c.bytes)))
+  {
+    fprintf(stderr, "Error: can not cut %s to %llu bytes\n", path, (unsigned long long)c.bytes);
+    fclose(f);
+    return 0;
+  }
+  fclose(f);
+
+  std::string info = recover_info_name(path, prefix);
+  if (info.empty())
+  {
+    fprintf(stderr, "Warning: %s does not start with %s, no info file written\n", path, prefix);
+    return 1;
+  }
+  // The tool creates the file at its start and fills it in Fini, so an
+  // empty one is the killed run's
+  struct stat st;
+  if (!stat(info.c_str(), &st) && st.st_size)
+  {
+    printf("%s: kept\n", info.c_str());
+    return 1;
+  }
+  uint64_t instructions = 0;
+  int icnt = recover_icount(path, c.records, dry_run, &instructions);
+  printf("%s: %s%s\n", info.c_str(), dry_run ? "to write" : "written", icnt ? "" : " without instructions");
+  if (dry_run)
+  {
+    return 1;
+  }
+  FILE *out = fopen(info.c_str(), "w");
+  if (!out)
+  {
+    fprintf(stderr, "Error: can not write %s\n", info.c_str());
+    return 0;
+  }
+  if (icnt)
+  {
+    fprintf(out, "!!! Number of Instructions = %llu\n", (unsigned long long)instructions);
+  }
+  fprintf(out, "!!! Number of Unconditional branches = %llu\n", (unsigned long long)c.unconditional);
+  fprintf(out, "!!! Number of Conditional branches = %llu\n", (unsigned long long)c.conditional);
+  fprintf(out, "!!! Number of Call branches = %llu\n", (unsigned long long)c.call);
+  fprintf(out, "!!! Number of Ret branches = %llu\n", (unsigned long long)c.ret);
+  fclose(out);
+  return 1;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *prefix = "branches";
+  int dry_run = 0;
+  int paths = 0;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strncmp(argv[i], "--prefix=", 9))
+    {
+      prefix = argv[i] + 9;
+    }
+    else if (!strcmp(argv[i], "--dry-run"))
+    {
+      dry_run = 1;
+    }
+    else if (!strncmp(argv[i], "--", 2))
+    {
+      usage();
+      exit(1);
+    }
+    else
+    {
+      argv[paths++] = argv[i];
+    }
+  }
+  if (!paths)
+  {
+    usage();
+    exit(1);
+  }
+
+  int failed = 0;
+  for (int i = 0; i < paths; i++)
+  {
+    failed |= !recover(argv[i], prefix, dry_run);
+  }
+  return failed;
+}
@@ -0,0 +1,98 @@
+//========================================================//
+//  bpstat.cpp                                            //
+//  Characterizes a branch trace for sizing predictors    //
+//                                                        //
+//  ./bpstat trace.bin                                    //
+//                                                        //
+//  One pass over the trace with fixed size sketches, see //
+//  tracestat.h, printing the distinct PCs, the working   //
+//  set of (PC, history) pairs by history length, the     //
+//  taken and indirect shares and the reuse distances,    //
+//  and writing the sidecar <trace>.stat of --sweep-prune //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+#include "tracestat.h"
+
+void usage()
+{
+  fprintf(stderr, "Usage: bpstat [options] <trace|->\n");
+  fprintf(stderr, " Options:\n");
+  fprintf(stderr, " --no-sidecar             Only print, do not write <trace>.stat\n");
+}
+
+int main(int argc, char *argv[])
+{
+  int sidecar = 1;
+  const char *path = NULL;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strcmp(argv[i], "--no-sidecar"))
+    {
+      sidecar = 0;
+    }
+    else if (!path && (strncmp(argv[i], "--", 2) || !strcmp(argv[i], "-")))
+    {
+      path = argv[i];
+    }
+    else
+    {
+      usage();
+      exit(1);
+    }
+  }
+  if (!path)
+  {
+    usage();
+    exit(1);
+  }
+
+  trace_reader_t *tr = trace_open(path);
+  if (!tr)
+  {
+    fprintf(stderr, "Error: can not open %s\n", path);
+    exit(1);
+  }
+  trace_stat_sketch_t *s = (trace_stat_sketch_t *)malloc(sizeof(trace_stat_sketch_t));
+  branch_record_t *batch = (branch_record_t *)malloc(TRACE_BATCH * sizeof(branch_record_t));
+  if (!s || !batch)
+  {
+    fprintf(stderr, "Error: malloc failed\n");
+    exit(1);
+  }
+  trace_stat_init(s);
+
+  // mapped binary traces are read where they lie
+  uint64_t start_ns = trace_clock_ns();
+  for (;;)
+  {
+    const branch_record_t *recs;
+    size_t n = trace_read_span(tr, batch, TRACE_BATCH, &recs);
+    if (!n)
+    {
+      break;
+    }
+    trace_stat_add(s, recs, n);
+  }
+  uint64_t elapsed_ns = trace_clock_ns() - start_ns;
+  trace_close(tr);
+
+  trace_stat_t st;
+  trace_stat_finish(s, &st);
+  free(s);
+  free(batch);
+  trace_stat_print(&st, stdout);
+  fprintf(stderr, "%.3f s, %.1f M records/s\n", elapsed_ns / 1e9,
+          elapsed_ns ? st.records * 1e3 / elapsed_ns : 0.0);
+
+  if (sidecar && strcmp(path, "-") && !trace_stat_write(path, &st))
+  {
+    fprintf(stderr, "Error: can not write %s.stat\n", path);
+    exit(1);
+  }
+  return 0;
+}
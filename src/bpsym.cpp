@@ -0,0 +1,735 @@
+//========================================================//
+//  bpsym.cpp                                             //
+//  Names the function and line of branch PCs in batch    //
+//                                                        //
+//  ./predictor --profile-pcs=50 trace.bin |              //
+//      ./bpsym trace.imgmap                              //
+//  ./bpsym trace.imgmap 0x9abf0a57 0x9b24f00c            //
+//                                                        //
+//  branchExt -image_map lists the images of a traced     //
+//  program with their load addresses and build IDs, so   //
+//  a PC is placed in its image even when the trace kept  //
+//  only its low 32 bits. Each image's functions and line //
+//  table are read from its DWARF once, through the       //
+//  libdwarf of pin_tool/extras/libdwarf loaded at run    //
+//  time, into arrays sorted by address, and kept in a    //
+//  cache file named by build ID, so the next report      //
+//  looks every PC up with two binary searches            //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cxxabi.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define BPSYM_LIBDWARF_ENV "BP_LIBDWARF"
+#define BPSYM_MAGIC "BPSYM1\n"
+#define BPSYM_NAME_DEPTH 4 // DW_AT_specification and abstract_origin links followed
+
+// A line table row: the code from 'addr' to the next row's is of
+// 'line' of 'file', or of no line when 'line' is 0
+typedef struct
+{
+  uint64_t addr;
+  uint32_t file; // offset in the image's strings
+  uint32_t line;
+} bpsym_row_t;
+
+typedef struct
+{
+  uint64_t low, high;
+  uint32_t name; // offset in the image's strings
+  uint32_t pad;
+} bpsym_func_t;
+
+// An image of the map, with its tables once a PC falls in it
+typedef struct
+{
+  uint64_t low, high;
+  uint64_t load_offset; // run time address less link address
+  std::string build_id; // "-" for none
+  std::string path;
+  int loaded;           // 1 with tables, -1 when they could not be read
+  std::vector<bpsym_row_t> rows;
+  std::vector<bpsym_func_t> funcs;
+  std::string strings;
+} bpsym_image_t;
+
+void usage()
+{
+  fprintf(stderr, "Usage: bpsym [options] <imgmap> [pc...]\n");
+  fprintf(stderr, " Without PCs, every line of stdin is copied to stdout with the function,\n");
+  fprintf(stderr, " file and line of the first hex number in it appended\n");
+  fprintf(stderr, " Options:\n");
+  fprintf(stderr, " --debug-dir=<dir>  Also look for <dir>/.build-id/xx/yyyy.debug, and for\n");
+  fprintf(stderr, "                    each image's path under dir (default /usr/lib/debug)\n");
+  fprintf(stderr, " --cache-dir=<dir>  Keep the tables read there (default ~/.cache/bpsym)\n");
+  fprintf(stderr, " --no-cache         Read every image's DWARF again\n");
+  fprintf(stderr, " $%s names libdwarf.so, e.g. the build of pin_tool/extras/libdwarf\n",
+          BPSYM_LIBDWARF_ENV);
+}
+
+//------------------------------------//
+//              libdwarf              //
+//------------------------------------//
+
+// The libdwarf 0.4 calls used, declared here as it is loaded at run
+// time, so building needs no libdwarf headers
+typedef struct Dwarf_Debug_s *Dwarf_Debug;
+typedef struct Dwarf_Die_s *Dwarf_Die;
+typedef struct Dwarf_Error_s *Dwarf_Error;
+typedef struct Dwarf_Attribute_s *Dwarf_Attribute;
+typedef struct Dwarf_Line_s *Dwarf_Line;
+typedef struct Dwarf_Line_Context_s *Dwarf_Line_Context;
+typedef void (*Dwarf_Handler)(Dwarf_Error, void *);
+
+#define DW_DLV_OK 0
+#define DW_DLA_STRING 0x01
+#define DW_TAG_subprogram 0x2e
+#define DW_AT_name 0x03
+#define DW_AT_abstract_origin 0x31
+#define DW_AT_specification 0x47
+#define DW_AT_linkage_name 0x6e
+#define DW_AT_MIPS_linkage_name 0x2007
+#define DW_FORM_CLASS_CONSTANT 3
+
+static struct
+{
+  int tried, loaded;
+  int (*init_path)(const char *, char *, unsigned, unsigned, Dwarf_Handler, void *, Dwarf_Debug *, Dwarf_Error *);
+  int (*finish)(Dwarf_Debug);
+  int (*next_cu_header_d)(Dwarf_Debug, int, uint64_t *, uint16_t *, uint64_t *, uint16_t *, uint16_t *, uint16_t *,
+                          void *, uint64_t *, uint64_t *, uint16_t *, Dwarf_Error *);
+  int (*siblingof_b)(Dwarf_Debug, Dwarf_Die, int, Dwarf_Die *, Dwarf_Error *);
+  int (*child)(Dwarf_Die, Dwarf_Die *, Dwarf_Error *);
+  int (*tag)(Dwarf_Die, uint16_t *, Dwarf_Error *);
+  int (*lowpc)(Dwarf_Die, uint64_t *, Dwarf_Error *);
+  int (*highpc_b)(Dwarf_Die, uint64_t *, uint16_t *, int *, Dwarf_Error *);
+  int (*attr)(Dwarf_Die, uint16_t, Dwarf_Attribute *, Dwarf_Error *);
+  int (*formstring)(Dwarf_Attribute, char **, Dwarf_Error *);
+  int (*global_formref)(Dwarf_Attribute, uint64_t *, Dwarf_Error *);
+  int (*offdie_b)(Dwarf_Debug, uint64_t, int, Dwarf_Die *, Dwarf_Error *);
+  int (*srclines_b)(Dwarf_Die, uint64_t *, uint8_t *, Dwarf_Line_Context *, Dwarf_Error *);
+  int (*srclines_from_linecontext)(Dwarf_Line_Context, Dwarf_Line **, int64_t *, Dwarf_Error *);
+  void (*srclines_dealloc_b)(Dwarf_Line_Context);
+  int (*lineaddr)(Dwarf_Line, uint64_t *, Dwarf_Error *);
+  int (*lineno)(Dwarf_Line, uint64_t *, Dwarf_Error *);
+  int (*linesrc)(Dwarf_Line, char **, Dwarf_Error *);
+  int (*lineendsequence)(Dwarf_Line, int *, Dwarf_Error *);
+  void (*dealloc)(Dwarf_Debug, void *, uint64_t);
+  void (*dealloc_die)(Dwarf_Die);
+  void (*dealloc_attribute)(Dwarf_Attribute);
+} dw;
+
+// Loaded when the first image is not in the cache
+//
+// Returns True if Successful
+//
+static int bpsym_load_libdwarf()
+{
+  if (dw.tried)
+  {
+    return dw.loaded;
+  }
+  dw.tried = 1;
+  const char *names[] = {getenv(BPSYM_LIBDWARF_ENV), "libdwarf.so", "libdwarf.so.0", "libdwarf.so.1"};
+  void *lib = NULL;
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]) && !lib; i++)
+  {
+    lib = names[i] && *names[i] ? dlopen(names[i], RTLD_NOW | RTLD_LOCAL) : NULL;
+  }
+  if (!lib)
+  {
+    fprintf(stderr, "bpsym: libdwarf not found, set $%s to its libdwarf.so; cached images only\n",
+            BPSYM_LIBDWARF_ENV);
+    return 0;
+  }
+#define BPSYM_DW(field, name) (*(void **)&dw.field = dlsym(lib, name)) != NULL
+  dw.loaded = BPSYM_DW(init_path, "dwarf_init_path") && BPSYM_DW(finish, "dwarf_finish") &&
+              BPSYM_DW(next_cu_header_d, "dwarf_next_cu_header_d") && BPSYM_DW(siblingof_b, "dwarf_siblingof_b") &&
+              BPSYM_DW(child, "dwarf_child") && BPSYM_DW(tag, "dwarf_tag") && BPSYM_DW(lowpc, "dwarf_lowpc") &&
+              BPSYM_DW(highpc_b, "dwarf_highpc_b") && BPSYM_DW(attr, "dwarf_attr") &&
+              BPSYM_DW(formstring, "dwarf_formstring") && BPSYM_DW(global_formref, "dwarf_global_formref") &&
+              BPSYM_DW(offdie_b, "dwarf_offdie_b") && BPSYM_DW(srclines_b, "dwarf_srclines_b") &&
+              BPSYM_DW(srclines_from_linecontext, "dwarf_srclines_from_linecontext") &&
+              BPSYM_DW(srclines_dealloc_b, "dwarf_srclines_dealloc_b") && BPSYM_DW(lineaddr, "dwarf_lineaddr") &&
+              BPSYM_DW(lineno, "dwarf_lineno") && BPSYM_DW(linesrc, "dwarf_linesrc") &&
+              BPSYM_DW(lineendsequence, "dwarf_lineendsequence") && BPSYM_DW(dealloc, "dwarf_dealloc") &&
+              BPSYM_DW(dealloc_die, "dwarf_dealloc_die") && BPSYM_DW(dealloc_attribute, "dwarf_dealloc_attribute");
+#undef BPSYM_DW
+  if (!dw.loaded)
+  {
+    fprintf(stderr, "bpsym: libdwarf older than 0.4: %s\n", dlerror());
+  }
+  return dw.loaded;
+}
+
+// Errors are returned as DW_DLV_ERROR, and the image skipped, rather
+// than ending the program
+static void bpsym_dwarf_error(Dwarf_Error, void *)
+{
+}
+
+// The string of attribute 'at' of 'die', or NULL
+static const char *bpsym_attr_string(Dwarf_Die die, uint16_t at)
+{
+  Dwarf_Attribute attr;
+  char *s = NULL;
+  if (dw.attr(die, at, &attr, NULL) != DW_DLV_OK)
+  {
+    return NULL;
+  }
+  if (dw.formstring(attr, &s, NULL) != DW_DLV_OK)
+  {
+    s = NULL;
+  }
+  dw.dealloc_attribute(attr);
+  return s;
+}
+
+// The name of the function of 'die', demangled, following the
+// declaration or abstract instance it completes for one it lacks
+static std::string bpsym_die_name(Dwarf_Debug dbg, Dwarf_Die die, int depth)
+{
+  const char *linkage = bpsym_attr_string(die, DW_AT_linkage_name);
+  linkage = linkage ? linkage : bpsym_attr_string(die, DW_AT_MIPS_linkage_name);
+  if (linkage)
+  {
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(linkage, NULL, NULL, &status);
+    std::string name = status == 0 && demangled ? demangled : linkage;
+    free(demangled);
+    return name;
+  }
+  const char *name = bpsym_attr_string(die, DW_AT_name);
+  if (name)
+  {
+    return name;
+  }
+  const uint16_t links[2] = {DW_AT_specification, DW_AT_abstract_origin};
+  for (int l = 0; l < 2 && depth < BPSYM_NAME_DEPTH; l++)
+  {
+    Dwarf_Attribute attr;
+    uint64_t off;
+    Dwarf_Die target;
+    if (dw.attr(die, links[l], &attr, NULL) != DW_DLV_OK)
+    {
+      continue;
+    }
+    int ok = dw.global_formref(attr, &off, NULL) == DW_DLV_OK && dw.offdie_b(dbg, off, 1, &target, NULL) == DW_DLV_OK;
+    dw.dealloc_attribute(attr);
+    if (ok)
+    {
+      std::string found = bpsym_die_name(dbg, target, depth + 1);
+      dw.dealloc_die(target);
+      return found;
+    }
+  }
+  return "";
+}
+
+// Offset of 's' in the strings of 'img', adding it
+static uint32_t bpsym_intern(bpsym_image_t *img, const char *s, std::vector<std::pair<std::string, uint32_t> > *seen)
+{
+  // Lines repeat their file many times in a row
+  if (!seen->empty() && seen->back().first == s)
+  {
+    return seen->back().second;
+  }
+  for (const auto &e : *seen)
+  {
+    if (e.first == s)
+    {
+      return e.second;
+    }
+  }
+  uint32_t off = (uint32_t)img->strings.size();
+  img->strings.append(s);
+  img->strings.push_back(0);
+  seen->push_back(std::make_pair(std::string(s), off));
+  return off;
+}
+
+// Add the functions defined below 'die', but not those nested in them
+static void bpsym_walk(Dwarf_Debug dbg, Dwarf_Die die, bpsym_image_t *img,
+                       std::vector<std::pair<std::string, uint32_t> > *names)
+{
+  Dwarf_Die child;
+  if (dw.child(die, &child, NULL) != DW_DLV_OK)
+  {
+    return;
+  }
+  while (child)
+  {
+    uint16_t tag = 0;
+    uint64_t low, high;
+    uint16_t form;
+    int form_class;
+    dw.tag(child, &tag, NULL);
+    if (tag == DW_TAG_subprogram)
+    {
+      if (dw.lowpc(child, &low, NULL) == DW_DLV_OK && dw.highpc_b(child, &high, &form, &form_class, NULL) == DW_DLV_OK)
+      {
+        high = form_class == DW_FORM_CLASS_CONSTANT ? low + high : high;
+        std::string name = bpsym_die_name(dbg, child, 0);
+        img->funcs.push_back({low, high, bpsym_intern(img, name.c_str(), names), 0});
+      }
+    }
+    else
+    {
+      bpsym_walk(dbg, child, img, names);
+    }
+    Dwarf_Die next = NULL;
+    if (dw.siblingof_b(dbg, child, 1, &next, NULL) != DW_DLV_OK)
+    {
+      next = NULL;
+    }
+    dw.dealloc_die(child);
+    child = next;
+  }
+}
+
+// Read the functions and line table of the DWARF of 'path'
+//
+// Returns True if Successful
+//
+static int bpsym_read_dwarf(const char *path, bpsym_image_t *img)
+{
+  Dwarf_Debug dbg;
+  if (dw.init_path(path, NULL, 0, 0, bpsym_dwarf_error, NULL, &dbg, NULL) != DW_DLV_OK)
+  {
+    return 0;
+  }
+  std::vector<std::pair<std::string, uint32_t> > files, names;
+  uint64_t length, abbrev, typeoffset, next;
+  uint16_t version, address_size, length_size, extension_size, cu_type;
+  char signature[8];
+  while (dw.next_cu_header_d(dbg, 1, &length, &version, &abbrev, &address_size, &length_size, &extension_size,
+                             signature, &typeoffset, &next, &cu_type, NULL) == DW_DLV_OK)
+  {
+    Dwarf_Die cu;
+    if (dw.siblingof_b(dbg, NULL, 1, &cu, NULL) != DW_DLV_OK)
+    {
+      continue;
+    }
+    bpsym_walk(dbg, cu, img, &names);
+
+    uint64_t line_version;
+    uint8_t tables;
+    Dwarf_Line_Context context;
+    Dwarf_Line *lines;
+    int64_t count;
+    if (dw.srclines_b(cu, &line_version, &tables, &context, NULL) == DW_DLV_OK)
+    {
+      if (dw.srclines_from_linecontext(context, &lines, &count, NULL) == DW_DLV_OK)
+      {
+        for (int64_t i = 0; i < count; i++)
+        {
+          uint64_t addr, lineno = 0;
+          int end = 0;
+          char *src = NULL;
+          if (dw.lineaddr(lines[i], &addr, NULL) != DW_DLV_OK)
+          {
+            continue;
+          }
+          dw.lineendsequence(lines[i], &end, NULL);
+          bpsym_row_t row = {addr, 0, 0};
+          if (!end && dw.lineno(lines[i], &lineno, NULL) == DW_DLV_OK &&
+              dw.linesrc(lines[i], &src, NULL) == DW_DLV_OK)
+          {
+            row.file = bpsym_intern(img, src, &files);
+            row.line = (uint32_t)lineno;
+            dw.dealloc(dbg, src, DW_DLA_STRING);
+          }
+          img->rows.push_back(row);
+        }
+      }
+      dw.srclines_dealloc_b(context);
+    }
+    dw.dealloc_die(cu);
+  }
+  dw.finish(dbg);
+
+  // An end of sequence sorts after a row at the same address that
+  // starts the next one
+  std::stable_sort(img->rows.begin(), img->rows.end(), [](const bpsym_row_t &a, const bpsym_row_t &b) {
+    return a.addr < b.addr || (a.addr == b.addr && a.line != 0 && b.line == 0);
+  });
+  std::sort(img->funcs.begin(), img->funcs.end(),
+            [](const bpsym_func_t &a, const bpsym_func_t &b) { return a.low < b.low; });
+  return 1;
+}
+
+//------------------------------------//
+//            Table cache             //
+//------------------------------------//
+
+// The cache file of 'img': its build ID, or the hash of its path,
+// size and modification time without one
+static std::string bpsym_cache_path(const char *dir, const bpsym_image_t *img, const char *file)
+{
+  if (img->build_id != "-")
+  {
+    return std::string(dir) + "/" + img->build_id + ".lines";
+  }
+  struct stat st;
+  if (stat(file, &st))
+  {
+    return "";
+  }
+  char key[256];
+  snprintf(key, sizeof(key), "%s:%lld:%lld", img->path.c_str(), (long long)st.st_size, (long long)st.st_mtime);
+  uint64_t h = 1469598103934665603ULL; // FNV-1a
+  for (const char *c = key; *c; c++)
+  {
+    h = (h ^ (uint8_t)*c) * 1099511628211ULL;
+  }
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.lines", (unsigned long long)h);
+  return std::string(dir) + name;
+}
+
+// Returns True if Successful
+static int bpsym_cache_read(const std::string &path, bpsym_image_t *img)
+{
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f)
+  {
+    return 0;
+  }
+  char magic[8];
+  uint64_t counts[3];
+  int ok = fread(magic, 1, 8, f) == 8 && !memcmp(magic, BPSYM_MAGIC, 8) && fread(counts, sizeof(counts), 1, f) == 1;
+  if (ok)
+  {
+    img->rows.resize(counts[0]);
+    img->funcs.resize(counts[1]);
+    img->strings.resize(counts[2]);
+    ok = fread(img->rows.data(), sizeof(bpsym_row_t), counts[0], f) == counts[0] &&
+         fread(img->funcs.data(), sizeof(bpsym_func_t), counts[1], f) == counts[1] &&
+         fread(&img->strings[0], 1, counts[2], f) == counts[2];
+  }
+  fclose(f);
+  return ok;
+}
+
+// Written under a temporary name and renamed, so concurrent reports
+// read a whole file or none
+static void bpsym_cache_write(const std::string &path, const bpsym_image_t *img)
+{
+  std::string tmp = path + "." + std::to_string(getpid());
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if (!f)
+  {
+    return;
+  }
+  uint64_t counts[3] = {img->rows.size(), img->funcs.size(), img->strings.size()};
+  int ok = fwrite(BPSYM_MAGIC, 1, 8, f) == 8 && fwrite(counts, sizeof(counts), 1, f) == 1 &&
+           fwrite(img->rows.data(), sizeof(bpsym_row_t), counts[0], f) == counts[0] &&
+           fwrite(img->funcs.data(), sizeof(bpsym_func_t), counts[1], f) == counts[1] &&
+           fwrite(img->strings.data(), 1, counts[2], f) == counts[2];
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()))
+  {
+    unlink(tmp.c_str());
+  }
+}
+
+//------------------------------------//
+//              Lookup                //
+//------------------------------------//
+
+static std::vector<bpsym_image_t> images;
+static std::vector<std::string> debug_dirs;
+static std::string cache_dir;
+
+// Read the image map branchExt -image_map wrote
+//
+// Returns True if Successful
+//
+static int bpsym_read_map(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+  {
+    return 0;
+  }
+  char line[8192];
+  while (fgets(line, sizeof(line), f))
+  {
+    if (line[0] == '#')
+    {
+      continue;
+    }
+    char *fields[5], *save = NULL;
+    int n = 0;
+    for (char *tok = strtok_r(line, "\t\r\n", &save); tok && n < 5; tok = strtok_r(NULL, n == 4 ? "\r\n" : "\t\r\n", &save))
+    {
+      fields[n++] = tok;
+    }
+    if (n < 5)
+    {
+      continue;
+    }
+    bpsym_image_t img;
+    img.low = strtoull(fields[0], NULL, 0);
+    img.high = strtoull(fields[1], NULL, 0);
+    img.load_offset = strtoull(fields[2], NULL, 0);
+    img.build_id = fields[3];
+    img.path = fields[4];
+    img.loaded = 0;
+    images.push_back(img);
+  }
+  fclose(f);
+  return 1;
+}
+
+// The file with the DWARF of 'img': a separate debug file found by its
+// build ID or path under the debug directories, else the image itself
+static std::string bpsym_find_file(const bpsym_image_t *img)
+{
+  for (const std::string &dir : debug_dirs)
+  {
+    std::vector<std::string> candidates;
+    if (img->build_id.size() > 2 && img->build_id != "-")
+    {
+      candidates.push_back(dir + "/.build-id/" + img->build_id.substr(0, 2) + "/" + img->build_id.substr(2) + ".debug");
+    }
+    candidates.push_back(dir + img->path + ".debug");
+    candidates.push_back(dir + img->path);
+    for (const std::string &c : candidates)
+    {
+      if (!access(c.c_str(), R_OK))
+      {
+        return c;
+      }
+    }
+  }
+  return img->path;
+}
+
+// Fill the tables of 'img' from the cache or its DWARF
+static void bpsym_load(bpsym_image_t *img)
+{
+  std::string file = bpsym_find_file(img);
+  std::string cache = cache_dir.empty() ? "" : bpsym_cache_path(cache_dir.c_str(), img, file.c_str());
+  if (!cache.empty() && bpsym_cache_read(cache, img))
+  {
+    img->loaded = 1;
+    return;
+  }
+  img->rows.clear();
+  img->funcs.clear();
+  img->strings.clear();
+  if (!bpsym_load_libdwarf() || !bpsym_read_dwarf(file.c_str(), img))
+  {
+    fprintf(stderr, "bpsym: no DWARF read from %s\n", file.c_str());
+    img->loaded = -1;
+    return;
+  }
+  img->loaded = 1;
+  if (!cache.empty())
+  {
+    mkdir(cache_dir.c_str(), 0755);
+    bpsym_cache_write(cache, img);
+  }
+}
+
+// The image holding 'pc' and its full address, the last loaded one
+// when several did. A PC of 32 bits or less matches every address of
+// an image with the same low 32 bits
+static bpsym_image_t *bpsym_image_of(uint64_t pc, uint64_t *addr)
+{
+  for (size_t i = images.size(); i-- > 0;)
+  {
+    bpsym_image_t *img = &images[i];
+    if (pc >= img->low && pc < img->high)
+    {
+      *addr = pc;
+      return img;
+    }
+    if (pc >> 32)
+    {
+      continue;
+    }
+    // the range spans at most two 4 GB windows
+    for (uint64_t base = img->low & ~0xffffffffULL; base < img->high; base += 1ULL << 32)
+    {
+      uint64_t full = base | pc;
+      if (full >= img->low && full < img->high)
+      {
+        *addr = full;
+        return img;
+      }
+    }
+  }
+  return NULL;
+}
+
+// Append the function, file and line of 'pc' to 'out'
+//
+// Returns True if Successful
+//
+static int bpsym_lookup(uint64_t pc, std::string *out)
+{
+  uint64_t addr;
+  bpsym_image_t *img = bpsym_image_of(pc, &addr);
+  if (!img)
+  {
+    return 0;
+  }
+  if (!img->loaded)
+  {
+    bpsym_load(img);
+  }
+  const char *base = strrchr(img->path.c_str(), '/');
+  base = base ? base + 1 : img->path.c_str();
+  if (img->loaded < 0)
+  {
+    *out += std::string("?? (") + base + ")";
+    return 1;
+  }
+  uint64_t link = addr - img->load_offset;
+  auto f = std::upper_bound(img->funcs.begin(), img->funcs.end(), link,
+                            [](uint64_t a, const bpsym_func_t &fn) { return a < fn.low; });
+  const char *func = "??";
+  // The nearest functions below, for one nested in another
+  for (int back = 0; back < 4 && f != img->funcs.begin(); back++)
+  {
+    --f;
+    if (link < f->high)
+    {
+      func = &img->strings[f->name];
+      break;
+    }
+  }
+  *out += func;
+  auto r = std::upper_bound(img->rows.begin(), img->rows.end(), link,
+                            [](uint64_t a, const bpsym_row_t &row) { return a < row.addr; });
+  if (r != img->rows.begin() && (r - 1)->line)
+  {
+    char line[16];
+    snprintf(line, sizeof(line), ":%u", (r - 1)->line);
+    *out += std::string(" ") + &img->strings[(r - 1)->file] + line;
+  }
+  *out += std::string(" (") + base + ")";
+  return 1;
+}
+
+// The first hex number of 'line', 0x-prefixed or not
+//
+// Returns True if Successful
+//
+static int bpsym_find_pc(const char *line, uint64_t *pc)
+{
+  for (const char *c = line; *c; c++)
+  {
+    if (c[0] == '0' && (c[1] == 'x' || c[1] == 'X') && isxdigit((unsigned char)c[2]) &&
+        (c == line || !isalnum((unsigned char)c[-1])))
+    {
+      *pc = strtoull(c, NULL, 16);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *map = NULL;
+  std::vector<uint64_t> pcs;
+  int use_cache = 1;
+  const char *home = getenv("HOME");
+  if (home)
+  {
+    cache_dir = std::string(home) + "/.cache/bpsym";
+  }
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strncmp(argv[i], "--debug-dir=", 12))
+    {
+      debug_dirs.push_back(argv[i] + 12);
+    }
+    else if (!strncmp(argv[i], "--cache-dir=", 12))
+    {
+      cache_dir = argv[i] + 12;
+    }
+    else if (!strcmp(argv[i], "--no-cache"))
+    {
+      use_cache = 0;
+    }
+    else if (!strncmp(argv[i], "--", 2))
+    {
+      usage();
+      exit(1);
+    }
+    else if (!map)
+    {
+      map = argv[i];
+    }
+    else
+    {
+      pcs.push_back(strtoull(argv[i], NULL, 16));
+    }
+  }
+  if (!map)
+  {
+    usage();
+    exit(1);
+  }
+  if (!use_cache)
+  {
+    cache_dir.clear();
+  }
+  if (debug_dirs.empty())
+  {
+    debug_dirs.push_back("/usr/lib/debug");
+  }
+  if (!bpsym_read_map(map))
+  {
+    fprintf(stderr, "Error: can't read image map %s\n", map);
+    exit(1);
+  }
+
+  std::string out;
+  if (!pcs.empty())
+  {
+    for (uint64_t pc : pcs)
+    {
+      char hex[24];
+      snprintf(hex, sizeof(hex), "%#llx\t", (unsigned long long)pc);
+      out = hex;
+      if (!bpsym_lookup(pc, &out))
+      {
+        out += "??";
+      }
+      printf("%s\n", out.c_str());
+    }
+    return 0;
+  }
+  char line[8192];
+  while (fgets(line, sizeof(line), stdin))
+  {
+    size_t len = strcspn(line, "\n");
+    line[len] = 0;
+    uint64_t pc;
+    out = line;
+    if (bpsym_find_pc(line, &pc))
+    {
+      out += "  ";
+      if (!bpsym_lookup(pc, &out))
+      {
+        out.resize(len);
+      }
+    }
+    printf("%s\n", out.c_str());
+  }
+  return 0;
+}
@@ -0,0 +1,226 @@
+//========================================================//
+//  bpzip.cpp                                             //
+//  Compresses a trace as it is written into independent  //
+//  bzip2 streams                                         //
+//                                                        //
+//  ./bpzip branches_0.out trace.bz2                      //
+//  ./branchExt ... | ./bpzip - trace.bz2                 //
+//                                                        //
+//  Every chunk of the input is a whole bzip2 stream of   //
+//  its own, compressed on a pool of threads and written  //
+//  in order, as pbzip2 does: bunzip2 reads the streams   //
+//  back to back, and the reader decodes them in parallel //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <bzlib.h>
+
+void usage()
+{
+  fprintf(stderr, "Usage: bpzip [options] <input|-> <output.bz2>\n");
+  fprintf(stderr, " Options:\n");
+  fprintf(stderr, " --level=<n>               bzip2 block size in 100 kB, 1 to 9 (default 9)\n");
+  fprintf(stderr, " --threads=<n>             Compressing threads (default one per core)\n");
+}
+
+// Chunk states
+#define BPZIP_FREE 0
+#define BPZIP_PENDING 1
+#define BPZIP_BUSY 2
+#define BPZIP_DONE 3
+
+typedef struct
+{
+  char *in;
+  unsigned in_len;
+  char *out;
+  unsigned out_len;
+  int state;
+  int error; // BZ_* of a failed compression
+} bpzip_chunk_t;
+
+static std::mutex lock;
+static std::condition_variable cond;
+static std::vector<bpzip_chunk_t> chunks; // a ring, chunk i in slot i % size
+static uint64_t next_job;                // next chunk to compress
+static uint64_t num_read;                // chunks read so far
+static int finished;
+static int level = 9;
+
+// Compress the chunks in the order they were read
+//
+static void bpzip_worker()
+{
+  std::unique_lock<std::mutex> guard(lock);
+  for (;;)
+  {
+    cond.wait(guard, [] { return finished || next_job < num_read; });
+    if (next_job == num_read)
+    {
+      return;
+    }
+    bpzip_chunk_t *c = &chunks[next_job++ % chunks.size()];
+    c->state = BPZIP_BUSY;
+    guard.unlock();
+    c->out_len = c->in_len + c->in_len / 100 + 600;
+    c->error = BZ2_bzBuffToBuffCompress(c->out, &c->out_len, c->in, c->in_len, level, 0, 0);
+    guard.lock();
+    c->state = BPZIP_DONE;
+    cond.notify_all();
+  }
+}
+
+// Wait for chunk 'c' and write it out
+//
+// Returns True if Successful
+//
+static int bpzip_write(bpzip_chunk_t *c, FILE *out)
+{
+  {
+    std::unique_lock<std::mutex> guard(lock);
+    cond.wait(guard, [c] { return c->state == BPZIP_DONE; });
+  }
+  c->state = BPZIP_FREE;
+  if (c->error != BZ_OK)
+  {
+    fprintf(stderr, "Error: bzip2 compression failed (%d)\n", c->error);
+    return 0;
+  }
+  return fwrite(c->out, 1, c->out_len, out) == c->out_len;
+}
+
+int main(int argc, char *argv[])
+{
+  int threads = 0;
+  const char *in_path = NULL, *out_path = NULL;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strncmp(argv[i], "--threads=", 10))
+    {
+      threads = atoi(argv[i] + 10);
+    }
+    else if (!strncmp(argv[i], "--level=", 8))
+    {
+      level = atoi(argv[i] + 8);
+      if (level < 1 || level > 9)
+      {
+        fprintf(stderr, "Error: --level must be 1 to 9\n");
+        exit(1);
+      }
+    }
+    else if (!in_path && (strncmp(argv[i], "--", 2) || !strcmp(argv[i], "-")))
+    {
+      in_path = argv[i];
+    }
+    else if (!out_path && strncmp(argv[i], "--", 2))
+    {
+      out_path = argv[i];
+    }
+    else
+    {
+      usage();
+      exit(1);
+    }
+  }
+  if (!in_path || !out_path)
+  {
+    usage();
+    exit(1);
+  }
+  if (threads <= 0)
+  {
+    threads = std::thread::hardware_concurrency();
+    threads = threads > 0 ? threads : 1;
+  }
+
+  FILE *in = strcmp(in_path, "-") ? fopen(in_path, "rb") : stdin;
+  if (!in)
+  {
+    fprintf(stderr, "Error: can not open %s\n", in_path);
+    exit(1);
+  }
+  FILE *out = fopen(out_path, "wb");
+  if (!out)
+  {
+    fprintf(stderr, "Error: can not create %s\n", out_path);
+    exit(1);
+  }
+
+  // One bzip2 block per stream: a chunk a little under the block size,
+  // as the run-length stage can grow the input
+  unsigned chunk = level * 100000 - 10000;
+  chunks.resize(threads * 2);
+  for (size_t i = 0; i < chunks.size(); i++)
+  {
+    chunks[i].in = (char *)malloc(chunk);
+    chunks[i].out = (char *)malloc(chunk + chunk / 100 + 600);
+    if (!chunks[i].in || !chunks[i].out)
+    {
+      fprintf(stderr, "Error: chunk malloc failed\n");
+      exit(1);
+    }
+  }
+  std::vector<std::thread> pool;
+  for (int t = 0; t < threads; t++)
+  {
+    pool.emplace_back(bpzip_worker);
+  }
+
+  // Read chunk i once chunk i - size, in the same slot, is written
+  int ok = 1;
+  uint64_t written = 0;
+  for (;;)
+  {
+    bpzip_chunk_t *c = &chunks[num_read % chunks.size()];
+    if (c->state != BPZIP_FREE)
+    {
+      ok = bpzip_write(c, out);
+      written++;
+      if (!ok)
+      {
+        break;
+      }
+    }
+    size_t n = fread(c->in, 1, chunk, in);
+    if (n == 0)
+    {
+      break;
+    }
+    c->in_len = n;
+    std::lock_guard<std::mutex> guard(lock);
+    c->state = BPZIP_PENDING;
+    num_read++;
+    cond.notify_all();
+  }
+  for (; ok && written < num_read; written++)
+  {
+    ok = bpzip_write(&chunks[written % chunks.size()], out);
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    finished = 1;
+    cond.notify_all();
+  }
+  for (auto &t : pool)
+  {
+    t.join();
+  }
+  if (ferror(in))
+  {
+    fprintf(stderr, "Error: reading %s failed\n", in_path);
+    ok = 0;
+  }
+  if (fclose(out) || !ok)
+  {
+    fprintf(stderr, "Error: writing %s failed\n", out_path);
+    exit(1);
+  }
+  return 0;
+}
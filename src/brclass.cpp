@@ -0,0 +1,87 @@
+//========================================================//
+//  brclass.cpp                                           //
+//  Source file for the per-class misprediction counts    //
+//========================================================//
+
+#include "brclass.h"
+
+const char *class_names[CLASS_COUNT] = {"direct", "indirect", "call", "return", "forward", "backward", "loop"};
+
+// Bits of a kind
+#define KIND_CONDITION 1
+#define KIND_CALL      2
+#define KIND_RET       4
+#define KIND_DIRECT    8
+#define KIND_BACKWARD  16
+#define KIND_LOOP      32
+
+void class_batch(const branch_record_t *recs, size_t n, class_batch_t *b, class_counts_t *branches)
+{
+  b->n = n;
+  uint64_t *kinds = branches->kinds;
+  for (size_t w = 0; w < (n + 63) / 64; w++)
+  {
+    const branch_record_t *r = recs + w * 64;
+    uint8_t *kind = b->kind + w * 64;
+    size_t m = n - w * 64 < 64 ? n - w * 64 : 64;
+    uint64_t c = 0, t = 0;
+    for (size_t i = 0; i < m; i++)
+    {
+      uint32_t f = r[i].flags, pc = r[i].pc, target = r[i].target;
+      uint32_t backward = target <= pc, loop = backward & (pc - target < CLASS_LOOP_SPAN);
+      uint32_t k = ((f >> 1) & 15) | backward << 4 | loop << 5;
+      kind[i] = (uint8_t)k;
+      kinds[k]++;
+      c |= (uint64_t)((f >> 1) & 1) << i;
+      t |= (uint64_t)(f & 1) << i;
+    }
+    b->cond[w] = c;
+    b->taken[w] = t;
+  }
+}
+
+void class_add(class_counts_t *misses, const class_batch_t *b, const uint64_t *predictions)
+{
+  for (size_t w = 0; w < (b->n + 63) / 64; w++)
+  {
+    // Only visit the set bits, mispredictions are rare
+    for (uint64_t m = b->cond[w] & (predictions[w] ^ b->taken[w]); m; m &= m - 1)
+    {
+      misses->kinds[b->kind[w * 64 + __builtin_ctzll(m)]]++;
+    }
+  }
+}
+
+// Sum the conditional kinds of 'c' into their classes
+static void class_fold(const class_counts_t *c, uint64_t *classes)
+{
+  for (int k = 0; k < CLASS_COUNT; k++)
+  {
+    classes[k] = 0;
+  }
+  for (int k = KIND_CONDITION; k < CLASS_KINDS; k += 2)
+  {
+    uint64_t v = c->kinds[k];
+    classes[k & KIND_DIRECT ? CLASS_DIRECT : CLASS_INDIRECT] += v;
+    classes[CLASS_CALL] += k & KIND_CALL ? v : 0;
+    classes[CLASS_RET] += k & KIND_RET ? v : 0;
+    classes[k & KIND_BACKWARD ? CLASS_BACKWARD : CLASS_FORWARD] += v;
+    classes[CLASS_LOOP] += k & KIND_LOOP ? v : 0;
+  }
+}
+
+void class_print(FILE *out, const char *name, const class_counts_t *branches, const class_counts_t *misses)
+{
+  uint64_t b[CLASS_COUNT], m[CLASS_COUNT];
+  class_fold(branches, b);
+  class_fold(misses, m);
+  // Every conditional branch is either direct or indirect
+  uint64_t total = m[CLASS_DIRECT] + m[CLASS_INDIRECT];
+  fprintf(out, "\n%s by class:\n", name);
+  fprintf(out, "%-10s %12s %10s %8s %7s\n", "Class", "Branches", "Incorrect", "Rate", "Share");
+  for (int k = 0; k < CLASS_COUNT; k++)
+  {
+    fprintf(out, "%-10s %12llu %10llu %8.3f %6.2f%%\n", class_names[k], (unsigned long long)b[k],
+            (unsigned long long)m[k], b[k] ? 1000.0 * m[k] / b[k] : 0.0, total ? 100.0 * m[k] / total : 0.0);
+  }
+}
@@ -0,0 +1,76 @@
+//========================================================//
+//  brclass.h                                             //
+//  Header file for the per-class misprediction counts    //
+//                                                        //
+//  --classes splits the conditional branches and their   //
+//  mispredictions by the class the flags and target of   //
+//  each record give: direct or indirect, call, return,   //
+//  forward or backward and loop-like. Records are        //
+//  counted without branches in a fixed array by kind,    //
+//  which fixes their classes, once per batch; each       //
+//  predictor only visits its mispredictions              //
+//========================================================//
+
+#ifndef BRCLASS_H
+#define BRCLASS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "trace.h"
+
+// Classes, bits of a record's mask
+//  - direct, indirect: TRACE_F_DIRECT set or not
+//  - call, return: the conditional calls and returns of ConDirectCall
+//    and ConDirectRet
+//  - forward, backward: target above the PC, or at or below it
+//  - loop: backward by less than CLASS_LOOP_SPAN bytes
+#define CLASS_DIRECT   0
+#define CLASS_INDIRECT 1
+#define CLASS_CALL     2
+#define CLASS_RET      3
+#define CLASS_FORWARD  4
+#define CLASS_BACKWARD 5
+#define CLASS_LOOP     6
+#define CLASS_COUNT    7
+
+#define CLASS_LOOP_SPAN 4096
+
+// Records are counted by kind, the flags but TRACE_F_TAKEN with
+// whether they are backward and loop-like, which fixes their classes
+#define CLASS_KINDS 64
+
+extern const char *class_names[CLASS_COUNT];
+
+// Records of each kind
+typedef struct
+{
+  uint64_t kinds[CLASS_KINDS];
+} class_counts_t;
+
+// Kind of every record of a batch, and bitmaps of the conditional and
+// the taken ones
+typedef struct
+{
+  uint8_t kind[TRACE_BATCH];
+  uint64_t cond[TRACE_BATCH / 64];
+  uint64_t taken[TRACE_BATCH / 64];
+  size_t n;
+} class_batch_t;
+
+// Fill 'b' from 'n' records, at most TRACE_BATCH, and count them in
+// 'branches'
+//
+void class_batch(const branch_record_t *recs, size_t n, class_batch_t *b, class_counts_t *branches);
+
+// Count in 'misses' the conditional records of 'b' mispredicted
+// according to the bitmap filled by predictor_predict_batch
+//
+void class_add(class_counts_t *misses, const class_batch_t *b, const uint64_t *predictions);
+
+// Print a line per class of the branches, mispredictions, their rate
+// per thousand and share of all mispredictions of 'name'
+//
+void class_print(FILE *out, const char *name, const class_counts_t *branches, const class_counts_t *misses);
+
+#endif
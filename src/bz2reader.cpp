@@ -0,0 +1,442 @@
+//========================================================//
+//  bz2reader.cpp                                         //
+//  Source file for the in-process bzip2 decoder          //
+//                                                        //
+//  A bzip2 stream is a sequence of blocks that each     //
+//  start with a 48-bit magic at an arbitrary bit offset  //
+//  and carry their own CRC. Each block is re-wrapped as  //
+//  a standalone single-block stream and handed to        //
+//  libbz2 on a worker; the results are read back in      //
+//  file order.                                           //
+//========================================================//
+
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <bzlib.h>
+#include "bz2reader.h"
+
+#define BZ2_BLOCK_MAGIC 0x314159265359ULL // pi
+#define BZ2_EOS_MAGIC   0x177245385090ULL // sqrt(pi)
+#define BZ2_MAGIC_MASK  0xffffffffffffULL
+#define BZ2_IN_FLIGHT   2                 // decoded blocks buffered per worker
+
+typedef struct
+{
+  uint64_t start; // bit offset of the block magic
+  uint64_t end;   // bit offset of the next block or end-of-stream magic
+  char *data;     // decompressed bytes, owned until consumed
+  size_t len;
+  int state;      // 0 pending, 1 decoding, 2 done, -1 failed
+  uint64_t out_start; // decompressed offset, set as the consumer reaches it
+} bz2_block_t;
+
+struct bz2_reader
+{
+  const uint8_t *comp; // whole compressed file
+  size_t comp_len;
+  uint8_t *owned;      // comp when it was read into memory here
+
+  // Sequential fallback, used with a single thread
+  bz_stream strm;
+  size_t comp_pos;
+  int seq_done;
+
+  // Parallel decoding
+  std::vector<bz2_block_t> blocks;
+  std::vector<std::thread> workers;
+  std::mutex lock;
+  std::condition_variable cond;
+  size_t next_job;  // next block handed to a worker
+  size_t next_read; // block the consumer is copying from
+  size_t read_pos;  // offset inside blocks[next_read]
+  size_t window;    // blocks allowed ahead of the consumer
+  int closing;
+};
+
+int bz2_is_bzip2(const char *buf, size_t len)
+{
+  return len >= 4 && buf[0] == 'B' && buf[1] == 'Z' && buf[2] == 'h' && buf[3] >= '1' && buf[3] <= '9';
+}
+
+// Find the bit offsets of all block and end-of-stream markers
+//
+static void bz2_scan(bz2_reader_t *bz)
+{
+  uint64_t window = 0;
+  int in_block = 0;
+  for (size_t i = 0; i < bz->comp_len; i++)
+  {
+    uint8_t byte = bz->comp[i];
+    for (int b = 7; b >= 0; b--)
+    {
+      window = (window << 1) | ((byte >> b) & 1);
+      uint64_t m = window & BZ2_MAGIC_MASK;
+      if (m != BZ2_BLOCK_MAGIC && m != BZ2_EOS_MAGIC)
+      {
+        continue;
+      }
+      uint64_t pos = (uint64_t)i * 8 + (7 - b) - 47;
+      if (in_block)
+      {
+        bz->blocks.back().end = pos;
+      }
+      in_block = (m == BZ2_BLOCK_MAGIC);
+      if (in_block)
+      {
+        bz2_block_t blk = {pos, 0, NULL, 0, 0, 0};
+        bz->blocks.push_back(blk);
+      }
+    }
+  }
+  if (in_block)
+  {
+    // truncated stream, let libbz2 report it
+    bz->blocks.back().end = (uint64_t)bz->comp_len * 8;
+  }
+}
+
+static inline uint32_t bz2_bits(const uint8_t *src, uint64_t bit, int n)
+{
+  uint32_t v = 0;
+  for (int i = 0; i < n; i++, bit++)
+  {
+    v = (v << 1) | ((src[bit >> 3] >> (7 - (bit & 7))) & 1);
+  }
+  return v;
+}
+
+// Re-wrap one block as a standalone stream and decompress it
+//
+// Returns True if Successful
+//
+static int bz2_decode_block(const bz2_reader_t *bz, bz2_block_t *blk)
+{
+  uint64_t nbits = blk->end - blk->start;
+  size_t wrapped_len = 4 + (nbits + 48 + 32 + 7) / 8;
+  uint8_t *wrapped = (uint8_t *)calloc(wrapped_len, 1);
+  if (!wrapped)
+  {
+    return 0;
+  }
+  memcpy(wrapped, "BZh9", 4);
+
+  // Byte-aligned copy of the block bits
+  const uint8_t *src = bz->comp;
+  uint64_t s = blk->start;
+  int shift = s & 7;
+  size_t whole = nbits / 8;
+  size_t sb = s >> 3;
+  for (size_t j = 0; j < whole; j++)
+  {
+    uint8_t hi = src[sb + j] << shift;
+    uint8_t lo = (shift && sb + j + 1 < bz->comp_len) ? src[sb + j + 1] >> (8 - shift) : 0;
+    wrapped[4 + j] = hi | lo;
+  }
+
+  // Tail bits, end-of-stream magic and the combined CRC, which for a
+  // single block stream equals the block CRC
+  uint64_t out = (uint64_t)(4 + whole) * 8;
+  uint64_t tail_bits = nbits & 7;
+  uint64_t crc = bz2_bits(src, s + 48, 32);
+  uint64_t tail = bz2_bits(src, s + whole * 8, tail_bits);
+  struct { uint64_t v; int n; } fields[3] = {{tail, (int)tail_bits}, {BZ2_EOS_MAGIC, 48}, {crc, 32}};
+  for (int f = 0; f < 3; f++)
+  {
+    for (int i = fields[f].n - 1; i >= 0; i--, out++)
+    {
+      if ((fields[f].v >> i) & 1)
+      {
+        wrapped[out >> 3] |= 0x80 >> (out & 7);
+      }
+    }
+  }
+
+  bz_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK)
+  {
+    free(wrapped);
+    return 0;
+  }
+  size_t cap = 1 << 22;
+  char *data = (char *)malloc(cap);
+  size_t len = 0;
+  strm.next_in = (char *)wrapped;
+  strm.avail_in = wrapped_len;
+  int ret = BZ_OK;
+  while (data && ret == BZ_OK)
+  {
+    if (len == cap)
+    {
+      cap *= 2;
+      data = (char *)realloc(data, cap);
+      if (!data)
+      {
+        break;
+      }
+    }
+    strm.next_out = data + len;
+    strm.avail_out = cap - len;
+    ret = BZ2_bzDecompress(&strm);
+    len = cap - strm.avail_out;
+  }
+  BZ2_bzDecompressEnd(&strm);
+  free(wrapped);
+
+  if (ret != BZ_STREAM_END)
+  {
+    free(data);
+    return 0;
+  }
+  blk->data = data;
+  blk->len = len;
+  return 1;
+}
+
+static void bz2_worker(bz2_reader_t *bz)
+{
+  std::unique_lock<std::mutex> guard(bz->lock);
+  for (;;)
+  {
+    bz->cond.wait(guard, [bz] {
+      return bz->closing || bz->next_job >= bz->blocks.size() ||
+             bz->next_job < bz->next_read + bz->window;
+    });
+    if (bz->closing || bz->next_job >= bz->blocks.size())
+    {
+      return;
+    }
+    bz2_block_t *blk = &bz->blocks[bz->next_job++];
+    blk->state = 1;
+    guard.unlock();
+    int ok = bz2_decode_block(bz, blk);
+    guard.lock();
+    blk->state = ok ? 2 : -1;
+    bz->cond.notify_all();
+  }
+}
+
+// Start decoding bz->comp on 'threads' workers
+//
+static bz2_reader_t *bz2_start(bz2_reader_t *bz, int threads)
+{
+  if (threads <= 0)
+  {
+    threads = std::thread::hardware_concurrency();
+  }
+  if (threads <= 1)
+  {
+    if (BZ2_bzDecompressInit(&bz->strm, 0, 0) != BZ_OK)
+    {
+      fprintf(stderr, "Error: bzip2 init failed\n");
+      exit(1);
+    }
+    return bz;
+  }
+
+  bz2_scan(bz);
+  bz->window = (size_t)threads * BZ2_IN_FLIGHT;
+  for (int t = 0; t < threads; t++)
+  {
+    bz->workers.push_back(std::thread(bz2_worker, bz));
+  }
+  return bz;
+}
+
+bz2_reader_t *bz2_open(FILE *in, const char *prefix, size_t prefix_len, int threads)
+{
+  bz2_reader_t *bz = new bz2_reader_t();
+
+  // Slurp the compressed file, it is a fraction of the decoded size
+  size_t cap = prefix_len > (1 << 22) ? prefix_len * 2 : (1 << 22);
+  uint8_t *comp = (uint8_t *)malloc(cap);
+  memcpy(comp, prefix, prefix_len);
+  size_t comp_len = prefix_len;
+  for (;;)
+  {
+    if (comp_len == cap)
+    {
+      cap *= 2;
+      comp = (uint8_t *)realloc(comp, cap);
+    }
+    if (!comp)
+    {
+      fprintf(stderr, "Error: bzip2 input malloc failed\n");
+      exit(1);
+    }
+    size_t n = fread(comp + comp_len, 1, cap - comp_len, in);
+    if (n == 0)
+    {
+      break;
+    }
+    comp_len += n;
+  }
+
+  bz->comp = bz->owned = comp;
+  bz->comp_len = comp_len;
+  return bz2_start(bz, threads);
+}
+
+bz2_reader_t *bz2_open_mem(const char *data, size_t len, int threads)
+{
+  bz2_reader_t *bz = new bz2_reader_t();
+  bz->comp = (const uint8_t *)data;
+  bz->comp_len = len;
+  return bz2_start(bz, threads);
+}
+
+// Single threaded decoding of (possibly concatenated) streams
+//
+static size_t bz2_read_seq(bz2_reader_t *bz, char *dst, size_t cap)
+{
+  size_t got = 0;
+  while (got < cap && !bz->seq_done)
+  {
+    bz->strm.next_in = (char *)bz->comp + bz->comp_pos;
+    bz->strm.avail_in = bz->comp_len - bz->comp_pos;
+    bz->strm.next_out = dst + got;
+    bz->strm.avail_out = cap - got;
+    int ret = BZ2_bzDecompress(&bz->strm);
+    bz->comp_pos = bz->comp_len - bz->strm.avail_in;
+    got = cap - bz->strm.avail_out;
+    if (ret == BZ_STREAM_END)
+    {
+      BZ2_bzDecompressEnd(&bz->strm);
+      memset(&bz->strm, 0, sizeof(bz->strm));
+      if (bz2_is_bzip2((char *)bz->comp + bz->comp_pos, bz->comp_len - bz->comp_pos))
+      {
+        BZ2_bzDecompressInit(&bz->strm, 0, 0);
+      }
+      else
+      {
+        bz->seq_done = 1;
+      }
+    }
+    else if (ret != BZ_OK || (bz->strm.avail_in == 0 && bz->strm.avail_out != 0))
+    {
+      fprintf(stderr, "Error: corrupt bzip2 stream (%d)\n", ret);
+      exit(1);
+    }
+  }
+  return got;
+}
+
+size_t bz2_read(bz2_reader_t *bz, char *dst, size_t cap)
+{
+  if (bz->workers.empty())
+  {
+    return bz2_read_seq(bz, dst, cap);
+  }
+
+  size_t got = 0;
+  std::unique_lock<std::mutex> guard(bz->lock);
+  while (got < cap && bz->next_read < bz->blocks.size())
+  {
+    bz2_block_t *blk = &bz->blocks[bz->next_read];
+    bz->cond.wait(guard, [blk] { return blk->state == 2 || blk->state == -1; });
+    if (blk->state == -1)
+    {
+      fprintf(stderr, "Error: failed to decode bzip2 block %zu, retry with --decode-threads=1\n", bz->next_read);
+      exit(1);
+    }
+    guard.unlock();
+    size_t n = blk->len - bz->read_pos;
+    if (n > cap - got)
+    {
+      n = cap - got;
+    }
+    memcpy(dst + got, blk->data + bz->read_pos, n);
+    got += n;
+    bz->read_pos += n;
+    guard.lock();
+    if (bz->read_pos == blk->len)
+    {
+      free(blk->data);
+      blk->data = NULL;
+      if (bz->next_read + 1 < bz->blocks.size())
+      {
+        bz->blocks[bz->next_read + 1].out_start = blk->out_start + blk->len;
+      }
+      bz->next_read++;
+      bz->read_pos = 0;
+      bz->cond.notify_all();
+    }
+  }
+  return got;
+}
+
+size_t bz2_block_starts(bz2_reader_t *bz, uint64_t *starts)
+{
+  if (bz->workers.empty())
+  {
+    return 0;
+  }
+  std::lock_guard<std::mutex> guard(bz->lock);
+  for (size_t i = 0; starts && i < bz->blocks.size(); i++)
+  {
+    starts[i] = bz->blocks[i].out_start;
+  }
+  return bz->blocks.size();
+}
+
+int bz2_seek_block(bz2_reader_t *bz, size_t block)
+{
+  if (bz->workers.empty() || block > bz->blocks.size())
+  {
+    return 0;
+  }
+  std::unique_lock<std::mutex> guard(bz->lock);
+
+  // Let the blocks being decoded land before dropping them
+  bz->cond.wait(guard, [bz] {
+    for (size_t i = bz->next_read; i < bz->next_job; i++)
+    {
+      if (bz->blocks[i].state == 1)
+      {
+        return false;
+      }
+    }
+    return true;
+  });
+  for (size_t i = 0; i < bz->blocks.size(); i++)
+  {
+    free(bz->blocks[i].data);
+    bz->blocks[i].data = NULL;
+    bz->blocks[i].state = 0;
+  }
+  bz->next_job = bz->next_read = block;
+  bz->read_pos = 0;
+  bz->cond.notify_all();
+  return 1;
+}
+
+void bz2_close(bz2_reader_t *bz)
+{
+  if (!bz)
+  {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(bz->lock);
+    bz->closing = 1;
+  }
+  bz->cond.notify_all();
+  for (size_t t = 0; t < bz->workers.size(); t++)
+  {
+    bz->workers[t].join();
+  }
+  if (bz->workers.empty() && !bz->seq_done)
+  {
+    BZ2_bzDecompressEnd(&bz->strm);
+  }
+  for (size_t i = 0; i < bz->blocks.size(); i++)
+  {
+    free(bz->blocks[i].data);
+  }
+  free(bz->owned);
+  delete bz;
+}
@@ -0,0 +1,56 @@
+//========================================================//
+//  bz2reader.h                                           //
+//  Header file for the in-process bzip2 decoder          //
+//                                                        //
+//  Splits a .bz2 file at its block boundaries and        //
+//  decompresses the blocks on several threads            //
+//========================================================//
+
+#ifndef BZ2READER_H
+#define BZ2READER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct bz2_reader bz2_reader_t;
+
+// Returns True if 'buf' starts with a bzip2 stream header
+//
+int bz2_is_bzip2(const char *buf, size_t len);
+
+// Take over the compressed stream 'in', whose first 'prefix_len'
+// bytes were already read into 'prefix', and start decoding it on
+// 'threads' worker threads (0 picks the number of online cores)
+//
+bz2_reader_t *bz2_open(FILE *in, const char *prefix, size_t prefix_len, int threads);
+
+// Decode the compressed image 'data', which must stay valid until
+// bz2_close, e.g. a mapped file
+//
+bz2_reader_t *bz2_open_mem(const char *data, size_t len, int threads);
+
+// Copy up to 'cap' decompressed bytes into 'dst', in order
+//
+// Returns the number of bytes copied, 0 at the end of the data
+//
+size_t bz2_read(bz2_reader_t *bz, char *dst, size_t cap);
+
+// Number of blocks found by the parallel decoder, 0 when decoding
+// sequentially; with 'starts' non NULL it receives the decompressed
+// offset of each block, valid once the whole stream has been read
+// in order
+//
+size_t bz2_block_starts(bz2_reader_t *bz, uint64_t *starts);
+
+// Restart decoding at block 'block' of the parallel decoder,
+// dropping everything decoded so far
+//
+// Returns True if Successful
+//
+int bz2_seek_block(bz2_reader_t *bz, size_t block);
+
+// Stop the workers and release the decoder
+//
+void bz2_close(bz2_reader_t *bz);
+
+#endif
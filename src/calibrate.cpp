@@ -0,0 +1,368 @@
+//========================================================//
+//  calibrate.cpp                                         //
+//  Source file for warmup calibration                    //
+//                                                        //
+//  Batches are cut at every cold start and window end,   //
+//  so each batch is replayed whole by the serial         //
+//  predictor and the cold ones it falls in. A cold start //
+//  keeps, per batch, its mispredictions minus the serial //
+//  ones; warming w branches is safe when every sum of    //
+//  those past w stays within the tolerance               //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "calibrate.h"
+#include "replay.h"
+
+typedef struct
+{
+  predictor_t *p;
+  uint64_t from;                 // first branch replayed
+  std::vector<uint64_t> ends;    // branches replayed at the end of each batch
+  std::vector<int64_t> excess;   // mispredictions over the serial ones per batch
+  std::vector<uint64_t> serial;  // serial mispredictions per batch
+  uint64_t warmup;               // needed, the window if it never converged
+} calibrate_start_t;
+
+// "<predictor> <configuration>" of 'cfg', the key of the sidecar
+//
+static std::string calibrate_key(const predictor_config_t *cfg)
+{
+  char config[1024];
+  predictor_config_format(cfg, config, sizeof(config));
+  return std::string(bpName[cfg->type]) + " " + config;
+}
+
+// Size and modification time identifying the trace contents
+//
+// Returns True if Successful
+//
+static int calibrate_source(const char *path, uint64_t *size, uint64_t *mtime)
+{
+  struct stat sb;
+  if (stat(path, &sb) || !S_ISREG(sb.st_mode))
+  {
+    return 0;
+  }
+  *size = sb.st_size;
+  *mtime = sb.st_mtime;
+  return 1;
+}
+
+// Read the entries of '<path>.warm' into 'keys' and 'warmups'
+//
+// Returns False if it is missing or older than the trace
+//
+static int calibrate_read(const char *path, std::vector<std::string> *keys, std::vector<uint64_t> *warmups)
+{
+  uint64_t size, mtime;
+  if (!calibrate_source(path, &size, &mtime))
+  {
+    return 0;
+  }
+  FILE *in = fopen((std::string(path) + ".warm").c_str(), "r");
+  if (!in)
+  {
+    return 0;
+  }
+  char line[1280];
+  char magic[16];
+  int version;
+  unsigned long long s, m;
+  int ok = fgets(line, sizeof(line), in) && sscanf(line, "%15s %d %llu %llu", magic, &version, &s, &m) == 4 &&
+           !strcmp(magic, CALIBRATE_MAGIC) && version == CALIBRATE_VERSION && s == size && m == mtime;
+  while (ok && fgets(line, sizeof(line), in))
+  {
+    char *tab = strchr(line, '\t');
+    if (tab)
+    {
+      line[strcspn(line, "\n")] = '\0';
+      warmups->push_back(strtoull(line, NULL, 10));
+      keys->push_back(tab + 1);
+    }
+  }
+  fclose(in);
+  return ok;
+}
+
+int calibrate_load(const char *path, const predictor_config_t *cfg, uint64_t *warmup)
+{
+  std::vector<std::string> keys;
+  std::vector<uint64_t> warmups;
+  if (!path || !calibrate_read(path, &keys, &warmups))
+  {
+    return 0;
+  }
+  std::string key = calibrate_key(cfg);
+  for (size_t i = 0; i < keys.size(); i++)
+  {
+    if (keys[i] == key)
+    {
+      *warmup = warmups[i];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Set the warmups of the configurations 'set' to 'to' in '<path>.warm',
+// keeping the others, through a temporary file
+//
+// Returns True if Successful
+//
+static int calibrate_store(const char *path, const std::vector<std::string> &set, const std::vector<uint64_t> &to)
+{
+  uint64_t size, mtime;
+  if (!calibrate_source(path, &size, &mtime))
+  {
+    return 0;
+  }
+  std::vector<std::string> keys;
+  std::vector<uint64_t> warmups;
+  calibrate_read(path, &keys, &warmups);
+  for (size_t j = 0; j < set.size(); j++)
+  {
+    size_t i = 0;
+    while (i < keys.size() && keys[i] != set[j])
+    {
+      i++;
+    }
+    if (i == keys.size())
+    {
+      keys.push_back(set[j]);
+      warmups.push_back(0);
+    }
+    warmups[i] = to[j];
+  }
+  std::string file = std::string(path) + ".warm", tmp = file + ".tmp";
+  FILE *out = fopen(tmp.c_str(), "w");
+  if (!out)
+  {
+    return 0;
+  }
+  fprintf(out, "%s %d %llu %llu\n", CALIBRATE_MAGIC, CALIBRATE_VERSION, (unsigned long long)size,
+          (unsigned long long)mtime);
+  for (size_t i = 0; i < keys.size(); i++)
+  {
+    fprintf(out, "%llu\t%s\n", (unsigned long long)warmups[i], keys[i].c_str());
+  }
+  int ok = !ferror(out);
+  ok = fclose(out) == 0 && ok;
+  if (ok && rename(tmp.c_str(), file.c_str()))
+  {
+    ok = 0;
+  }
+  if (!ok)
+  {
+    unlink(tmp.c_str());
+  }
+  return ok;
+}
+
+// The shortest warmup of 'c' past which the mispredictions it adds
+// stay within the tolerance of the serial ones, from every later
+// start up to the last quarter of its window, which is always measured
+//
+// Returns a warmup in that last quarter if it never converged
+//
+static uint64_t calibrate_converged(const calibrate_start_t *c)
+{
+  uint64_t limit = c->ends.back() - c->ends.back() / 4;
+  int64_t excess = 0;
+  uint64_t serial = 0;
+  for (size_t j = c->excess.size(); j-- > 0;)
+  {
+    excess += c->excess[j];
+    serial += c->serial[j];
+    if ((j ? c->ends[j - 1] : 0) <= limit && llabs(excess) > CALIBRATE_TOLERANCE * serial)
+    {
+      return c->ends[j];
+    }
+  }
+  return 0;
+}
+
+int calibrate_run(trace_reader_t *tr, const char *path, const calibrate_config_t *cfg)
+{
+  // The cold starts a window apart after the first, closer when the
+  // trace is too short for that
+  uint64_t stride = cfg->window;
+  if (tr->num_records != ~0ULL)
+  {
+    uint64_t span = tr->num_records > cfg->start ? tr->num_records - cfg->start : 0;
+    if (span <= cfg->window)
+    {
+      fprintf(stderr, "The trace has %llu branches from --start, too few for windows of %llu\n",
+              (unsigned long long)span, (unsigned long long)cfg->window);
+      return 0;
+    }
+    if (span < (cfg->starts + 1) * cfg->window)
+    {
+      stride = (span - cfg->window) / cfg->starts;
+    }
+  }
+
+  // gshare replays the serial predictor and every cold start as lanes
+  // of one bit-sliced table, lane 0 the serial one, so many cold starts
+  // cost about what one does
+  predictor_t *serial[NUM_BP_TYPES];
+  predictor_slice_t *slice[NUM_BP_TYPES];
+  std::vector<calibrate_start_t> cold[NUM_BP_TYPES];
+  std::vector<uint64_t> lane_misses(cfg->starts + 1);
+  for (int p = 0; p < cfg->num_types; p++)
+  {
+    predictor_config_t pc = predictor_default_config(cfg->types[p]);
+    slice[p] = predictor_slice_create(&pc, cfg->starts + 1);
+    serial[p] = slice[p] ? NULL : predictor_create(&pc);
+    if (slice[p])
+    {
+      predictor_slice_start(slice[p], 0);
+    }
+    else if (!serial[p])
+    {
+      fprintf(stderr, "Invalid %s predictor configuration\n", bpName[cfg->types[p]]);
+      exit(1);
+    }
+    cold[p].resize(cfg->starts);
+    for (int s = 0; s < cfg->starts; s++)
+    {
+      cold[p][s].p = NULL;
+      cold[p][s].from = cfg->start + (s + 1) * stride;
+    }
+  }
+
+  // One pass to the end of the last window
+  branch_record_t *batch = (branch_record_t *)malloc(TRACE_BATCH * sizeof(branch_record_t));
+  if (!batch)
+  {
+    fprintf(stderr, "Error: calibration malloc failed\n");
+    exit(1);
+  }
+  uint64_t pos = cfg->start, end = cfg->start + cfg->starts * stride + cfg->window;
+  size_t got = 0;
+  while (pos < end)
+  {
+    uint64_t next = end;
+    for (int s = 0; s < cfg->starts; s++)
+    {
+      uint64_t from = cfg->start + (s + 1) * stride;
+      next = from > pos && from < next ? from : next;
+      next = from + cfg->window > pos && from + cfg->window < next ? from + cfg->window : next;
+    }
+    const branch_record_t *recs;
+    if (!(got = trace_read_span(tr, batch, next - pos < TRACE_BATCH ? next - pos : TRACE_BATCH, &recs)))
+    {
+      break;
+    }
+    for (int p = 0; p < cfg->num_types; p++)
+    {
+      if (slice[p])
+      {
+        for (int s = 0; s < cfg->starts; s++)
+        {
+          calibrate_start_t *c = &cold[p][s];
+          int inside = pos >= c->from && pos < c->from + cfg->window;
+          if (inside && c->ends.empty())
+          {
+            predictor_slice_start(slice[p], s + 1);
+          }
+          else if (!inside && !c->ends.empty())
+          {
+            predictor_slice_stop(slice[p], s + 1);
+          }
+        }
+        std::fill(lane_misses.begin(), lane_misses.end(), 0);
+        predictor_slice_batch(slice[p], replay_branches(recs), got, lane_misses.data());
+        for (int s = 0; s < cfg->starts; s++)
+        {
+          calibrate_start_t *c = &cold[p][s];
+          if (pos >= c->from && pos < c->from + cfg->window)
+          {
+            c->excess.push_back((int64_t)lane_misses[s + 1] - (int64_t)lane_misses[0]);
+            c->ends.push_back(pos + got - c->from);
+            c->serial.push_back(lane_misses[0]);
+          }
+        }
+        continue;
+      }
+      uint64_t m = predictor_predict_batch(serial[p], replay_branches(recs), got, NULL);
+      for (int s = 0; s < cfg->starts; s++)
+      {
+        calibrate_start_t *c = &cold[p][s];
+        if (pos < c->from || pos >= c->from + cfg->window)
+        {
+          continue;
+        }
+        if (!c->p)
+        {
+          predictor_config_t pc = predictor_default_config(cfg->types[p]);
+          c->p = predictor_create(&pc);
+        }
+        uint64_t mc = predictor_predict_batch(c->p, replay_branches(recs), got, NULL);
+        c->excess.push_back((int64_t)mc - (int64_t)m);
+        c->ends.push_back(pos + got - c->from);
+        c->serial.push_back(m);
+      }
+    }
+    pos += got;
+  }
+  free(batch);
+
+  // The safe warmup of each predictor is its longest
+  printf("Warmup calibration, %d cold starts %llu branches apart, %llu branches each\n", cfg->starts,
+         (unsigned long long)stride, (unsigned long long)cfg->window);
+  std::vector<std::string> keys;
+  std::vector<uint64_t> warmups;
+  int ok = 1;
+  for (int p = 0; p < cfg->num_types; p++)
+  {
+    uint64_t safe = 0;
+    int converged = 1, replayed = 0;
+    printf("%-12s", bpName[cfg->types[p]]);
+    for (int s = 0; s < cfg->starts; s++)
+    {
+      calibrate_start_t *c = &cold[p][s];
+      if (c->excess.empty())
+      {
+        continue;
+      }
+      replayed++;
+      c->warmup = calibrate_converged(c);
+      if (c->warmup > c->ends.back() - c->ends.back() / 4)
+      {
+        converged = 0;
+        printf(" >%llu", (unsigned long long)c->warmup);
+      }
+      else
+      {
+        printf(" %llu", (unsigned long long)c->warmup);
+      }
+      safe = c->warmup > safe ? c->warmup : safe;
+      predictor_destroy(c->p);
+    }
+    predictor_destroy(serial[p]);
+    predictor_slice_destroy(slice[p]);
+    if (!replayed)
+    {
+      printf("  the trace ends before the first cold start\n");
+      ok = 0;
+      continue;
+    }
+    printf("  warmup %llu%s\n", (unsigned long long)safe, converged ? "" : ", not converged, try a longer --count");
+    predictor_config_t pc = predictor_default_config(cfg->types[p]);
+    keys.push_back(calibrate_key(&pc));
+    warmups.push_back(safe);
+  }
+  if (!keys.empty() && (!path || !calibrate_store(path, keys, warmups)))
+  {
+    fprintf(stderr, "Warning: can not write %s.warm, the warmups are not recorded\n", path ? path : "-");
+  }
+  return ok;
+}
@@ -0,0 +1,62 @@
+//========================================================//
+//  calibrate.h                                           //
+//  Header file for warmup calibration                    //
+//                                                        //
+//  Replays a trace once from the start and, alongside,   //
+//  cold predictors from a few later starts, and finds    //
+//  how many branches each cold start needs before its    //
+//  mispredictions stop drifting from the serial ones. A  //
+//  sidecar <trace>.warm keeps the warmup per predictor   //
+//  configuration for --shard-warmup=auto and             //
+//  --sample-skip=auto                                    //
+//========================================================//
+
+#ifndef CALIBRATE_H
+#define CALIBRATE_H
+
+#include <stdint.h>
+#include "predictor.h"
+#include "trace.h"
+
+// The sidecar is the line "BPWARM <version> <size> <mtime>" of the
+// trace, then one line "<warmup>\t<predictor> <configuration>" per
+// configuration calibrated, as predictor_config_format prints it
+#define CALIBRATE_MAGIC "BPWARM"
+#define CALIBRATE_VERSION 1
+
+// Default cold starts and branches replayed from each
+#define CALIBRATE_STARTS 3
+#define CALIBRATE_WINDOW 4000000
+
+// A warmup is safe once the mispredictions a cold start adds from
+// there to the end of its window, against the serial replay, stay
+// within this fraction of the serial ones over the same branches. The
+// longer the window the more a cold start is diluted, so it should be
+// about as long as the shards or sample periods that will use it
+#define CALIBRATE_TOLERANCE 0.01
+
+typedef struct
+{
+  const int *types;  // predictor types to calibrate, in their default configurations
+  int num_types;
+  uint64_t start;    // first branch of the serial replay
+  uint64_t window;   // branches replayed from each cold start
+  int starts;        // cold starts
+} calibrate_config_t;
+
+// Calibrate cfg->types on 'tr', opened from 'path' and positioned at
+// cfg->start, print the warmup each start needed and write the safe
+// one, the longest, to '<path>.warm'
+//
+// Returns True if Successful
+//
+int calibrate_run(trace_reader_t *tr, const char *path, const calibrate_config_t *cfg);
+
+// The calibrated warmup of 'cfg' on the trace at 'path' into 'warmup'
+//
+// Returns False if the sidecar is missing, older than the trace or
+// has no such configuration
+//
+int calibrate_load(const char *path, const predictor_config_t *cfg, uint64_t *warmup);
+
+#endif
@@ -0,0 +1,69 @@
+#!/bin/bash
+#
+# Coordinator check: a sweep of $POINTS gshare points over a synthetic
+# trace in $WORK is coordinated on 127.0.0.1:$PORT with one local
+# worker, first into an empty --memo store and then into the same
+# store, now holding every point. The Memo line must count only the
+# results the store held before each run:
+#
+#   fresh store   Memo: 0 results found in <store>, $POINTS added
+#   full store    Memo: $POINTS results found in <store>, 0 added
+#
+# and both runs must print the same sweep.
+#
+#   check_coordinate.sh
+#
+# PORT (default 47123) and WORK come from the environment. Exits 1 on
+# a failed check.
+
+SRC=$(dirname $(realpath -s $0))
+PORT=${PORT:-47123}
+WORK=${WORK:-${TMPDIR:-/tmp}/bench_e2e}
+SWEEP=gshare.ghistoryBits=10..13
+POINTS=4
+
+mkdir -p $WORK || exit 2
+TRACE=$WORK/coordinate.bin
+STORE=$WORK/coordinate.memo
+$SRC/bpgen mix,records=400k,seed=3 $TRACE > /dev/null 2>&1 || exit 2
+rm -f $STORE
+
+# coordinate <run>: the sweep coordinated with one worker, its table
+# in $WORK/coordinate.<run>.out and its messages in .err
+coordinate() {
+  $SRC/predictor --coordinate=127.0.0.1:$PORT --memo=$STORE --sweep=$SWEEP $TRACE \
+    > $WORK/coordinate.$1.out 2> $WORK/coordinate.$1.err &
+  local coordinator=$!
+  # the worker keeps trying to connect until the coordinator listens,
+  # and is not needed once the store holds every point
+  timeout 120 $SRC/predictor --worker=127.0.0.1:$PORT > /dev/null 2>&1 &
+  local worker=$!
+  wait $coordinator || { cat $WORK/coordinate.$1.err >&2; kill $worker 2>/dev/null; exit 2; }
+  kill $worker 2>/dev/null
+  wait $worker 2>/dev/null
+}
+
+status=0
+# expect <run> <found> <added>
+expect() {
+  local want="Memo: $2 results found in $STORE, $3 added"
+  local got=$(grep '^Memo:' $WORK/coordinate.$1.err)
+  if [ "$got" != "$want" ]; then
+    echo "$1 store: '$got', expected '$want'" >&2
+    status=1
+  else
+    echo "$1 store: $got"
+  fi
+}
+
+coordinate fresh
+expect fresh 0 $POINTS
+coordinate full
+expect full $POINTS 0
+# both print every point from the store
+if ! diff $WORK/coordinate.fresh.out $WORK/coordinate.full.out >&2; then
+  echo "The two runs print different sweeps" >&2
+  status=1
+fi
+rm -f $TRACE $STORE $WORK/coordinate.{fresh,full}.{out,err}
+exit $status
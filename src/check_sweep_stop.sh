@@ -0,0 +1,70 @@
+#!/bin/bash
+#
+# Early stop check: over each trace in ../traces, converted once to a
+# mapped binary in $WORK, a sweep is replayed whole and with
+# --sweep-stop. The best point of the whole sweep must not be stopped,
+# and must count the same mispredictions both ways. To show the check
+# covers a best point that starts behind, which a stop judged on the
+# first windows kills, the sweep is also replayed over the first
+# $PREFIX records: on at least one trace another point must lead
+# there.
+#
+#   check_sweep_stop.sh
+#
+# TRACES (glob), SWEEP (default gshare.ghistoryBits=8..14, where on U1
+# the 14 bit table, best in the end, is behind after 1.5M records; the
+# configurations it prints must hold no comma, as gshare's) and PREFIX
+# (default 1500000) come from the environment. Exits 1 on a failed
+# check.
+
+SRC=$(dirname $(realpath -s $0))
+TRACES=${TRACES:-$SRC/../traces/*.bz2}
+SWEEP=${SWEEP:-gshare.ghistoryBits=8..14}
+PREFIX=${PREFIX:-1500000}
+WORK=${WORK:-${TMPDIR:-/tmp}/bench_e2e}
+
+mkdir -p $WORK || exit 2
+BINS=
+for trace in $TRACES; do
+  name=$(basename $trace .bz2)
+  if [ ! -s $WORK/$name.bin ]; then
+    bzip2 -dc $trace | $SRC/tobin - $WORK/$name.bin > /dev/null || exit 2
+  fi
+  BINS="$BINS $WORK/$name.bin"
+done
+
+# best <csv>: the configuration and mispredictions of the point with
+# the fewest
+best() {
+  tail -n +2 $1 | sort -t, -k5,5n | head -1 | cut -d, -f3,5
+}
+
+status=0
+behind=0
+for bin in $BINS; do
+  name=$(basename $bin .bin)
+  $SRC/predictor --format=csv --sweep=$SWEEP $bin > $WORK/stop.whole || exit 2
+  $SRC/predictor --format=csv --sweep=$SWEEP --sweep-stop $bin > $WORK/stop.stopped || exit 2
+  $SRC/predictor --format=csv --sweep=$SWEEP --count=$PREFIX $bin > $WORK/stop.prefix || exit 2
+  whole=$(best $WORK/stop.whole)
+  lead=$(best $WORK/stop.prefix)
+  cfg=${whole%,*}
+  full=$(grep ",$cfg," $WORK/stop.whole | cut -d, -f4,5)
+  kept=$(grep ",$cfg," $WORK/stop.stopped | cut -d, -f4,5)
+  stopped=$(tail -n +2 $WORK/stop.stopped | awk -F, -v n=${full%,*} '$4 < n' | wc -l)
+  if [ "$kept" != "$full" ]; then
+    echo "$name: best point $cfg stopped at $kept branches,mispredictions of $full" >&2
+    status=1
+  elif [ "${lead%,*}" != "$cfg" ]; then
+    behind=1
+    echo "$name: best $cfg kept, $stopped points stopped; ${lead%,*} led after $PREFIX records"
+  else
+    echo "$name: best $cfg kept, $stopped points stopped; it led after $PREFIX records too"
+  fi
+done
+rm -f $WORK/stop.whole $WORK/stop.stopped $WORK/stop.prefix
+if [ $behind = 0 ]; then
+  echo "No trace's best point started behind; the check proves nothing" >&2
+  status=1
+fi
+exit $status
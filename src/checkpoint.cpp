@@ -0,0 +1,434 @@
+//========================================================//
+//  checkpoint.cpp                                        //
+//  Source file for predictor state snapshots             //
+//                                                        //
+//  Snapshots and libraries are written to a temporary    //
+//  file and renamed into place, and mapped when loaded   //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "checkpoint.h"
+#include "codec.h"
+
+#define CHECKPOINT_ALIGN(n) (((n) + 7) & ~(uint64_t)7)
+
+// Write the snapshot, with the counts 'counted' of a sweep point or
+// NULL
+//
+// Returns True if Successful
+//
+static int checkpoint_write(const char *path, predictor_t *const *predictors, int n, uint64_t position,
+                            const uint64_t *counted)
+{
+  std::string tmp = std::string(path) + ".tmp";
+  FILE *out = fopen(tmp.c_str(), "wb");
+  if (!out)
+  {
+    return 0;
+  }
+  checkpoint_header_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+  hdr.version = CHECKPOINT_VERSION;
+  hdr.num_predictors = n;
+  hdr.position = position;
+  if (counted)
+  {
+    hdr.branches = counted[0];
+    hdr.mispredictions = counted[1];
+    hdr.runtime_ns = counted[2];
+  }
+  int ok = fwrite(&hdr, sizeof(hdr), 1, out) == 1;
+
+  for (int i = 0; ok && i < n; i++)
+  {
+    checkpoint_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.cfg = *predictor_config(predictors[i]);
+    entry.state_size = predictor_state_size(predictors[i]);
+    size_t padded = CHECKPOINT_ALIGN(entry.state_size);
+    char *state = (char *)calloc(padded ? padded : 1, 1);
+    if (!state)
+    {
+      ok = 0;
+      break;
+    }
+    predictor_save_state(predictors[i], state);
+    ok = fwrite(&entry, sizeof(entry), 1, out) == 1 && fwrite(state, 1, padded, out) == padded;
+    free(state);
+  }
+  ok = fclose(out) == 0 && ok;
+  if (ok && rename(tmp.c_str(), path))
+  {
+    ok = 0;
+  }
+  if (!ok)
+  {
+    unlink(tmp.c_str());
+  }
+  return ok;
+}
+
+int checkpoint_save(const char *path, predictor_t *const *predictors, int n, uint64_t position)
+{
+  return checkpoint_write(path, predictors, n, position, NULL);
+}
+
+int checkpoint_save_point(const char *path, predictor_t *p, uint64_t position, uint64_t branches,
+                          uint64_t mispredictions, uint64_t runtime_ns)
+{
+  uint64_t counted[3] = {branches, mispredictions, runtime_ns};
+  return checkpoint_write(path, &p, 1, position, counted);
+}
+
+// checkpoint_load, also reading the counts of a sweep point into
+// 'counted' when it is not NULL
+//
+static int checkpoint_read(const char *path, predictor_t **predictors, const int *types, int n, uint64_t *position,
+                           uint64_t *counted)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  struct stat st;
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(checkpoint_header_t))
+  {
+    close(fd);
+    return 0;
+  }
+  size_t len = st.st_size;
+  void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    return 0;
+  }
+
+  const char *data = (const char *)map;
+  const checkpoint_header_t *hdr = (const checkpoint_header_t *)data;
+  int ok = !memcmp(hdr->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) && hdr->version == CHECKPOINT_VERSION;
+  for (int i = 0; i < n; i++)
+  {
+    predictors[i] = NULL;
+  }
+
+  // Hand each saved predictor to the slot asking for its type
+  size_t off = sizeof(checkpoint_header_t);
+  for (uint32_t e = 0; ok && e < hdr->num_predictors; e++)
+  {
+    if (len - off < sizeof(checkpoint_entry_t))
+    {
+      ok = 0;
+      break;
+    }
+    const checkpoint_entry_t *entry = (const checkpoint_entry_t *)(data + off);
+    off += sizeof(checkpoint_entry_t);
+    if (entry->state_size > len - off || CHECKPOINT_ALIGN(entry->state_size) > len - off)
+    {
+      ok = 0;
+      break;
+    }
+    for (int i = 0; i < n; i++)
+    {
+      if (types[i] == entry->cfg.type && !predictors[i])
+      {
+        predictors[i] = predictor_load_state(&entry->cfg, data + off, entry->state_size);
+        ok = predictors[i] != NULL;
+        break;
+      }
+    }
+    off += CHECKPOINT_ALIGN(entry->state_size);
+  }
+  for (int i = 0; i < n; i++)
+  {
+    ok = ok && predictors[i];
+  }
+  if (!ok)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      predictor_destroy(predictors[i]);
+      predictors[i] = NULL;
+    }
+  }
+  *position = hdr->position;
+  if (counted)
+  {
+    counted[0] = hdr->branches;
+    counted[1] = hdr->mispredictions;
+    counted[2] = hdr->runtime_ns;
+  }
+  munmap(map, len);
+  return ok;
+}
+
+int checkpoint_load(const char *path, predictor_t **predictors, const int *types, int n, uint64_t *position)
+{
+  return checkpoint_read(path, predictors, types, n, position, NULL);
+}
+
+int checkpoint_load_point(const char *path, predictor_t **p, int type, uint64_t *position, uint64_t *branches,
+                          uint64_t *mispredictions, uint64_t *runtime_ns)
+{
+  uint64_t counted[3];
+  if (!checkpoint_read(path, p, &type, 1, position, counted))
+  {
+    return 0;
+  }
+  *branches = counted[0];
+  *mispredictions = counted[1];
+  *runtime_ns = counted[2];
+  return 1;
+}
+
+struct checkpoint_library
+{
+  FILE *out;
+  std::string path;                               // renamed from path.tmp
+  checkpoint_library_header_t hdr;
+  std::vector<checkpoint_library_index_t> index;
+  size_t len;                                     // bytes of all the states
+  uint64_t next;                                  // position of the next snapshot
+  uint64_t offset;                                // of the next one in the file
+  char *state;                                    // states of this snapshot
+  char *prev;                                     // and of the one before
+  char *comp;
+  size_t comp_cap;
+};
+
+// Total state bytes of the 'n' predictors, each padded to 8 bytes
+static size_t checkpoint_states_size(predictor_t *const *predictors, int n)
+{
+  size_t len = 0;
+  for (int i = 0; i < n; i++)
+  {
+    len += CHECKPOINT_ALIGN(predictor_state_size(predictors[i]));
+  }
+  return len;
+}
+
+checkpoint_library_t *checkpoint_library_create(const char *path, predictor_t *const *predictors, int n,
+                                                uint64_t every)
+{
+  checkpoint_library_t *lib = new checkpoint_library_t();
+  lib->path = path;
+  memcpy(lib->hdr.magic, CHECKPOINT_LIBRARY_MAGIC, sizeof(CHECKPOINT_LIBRARY_MAGIC));
+  lib->hdr.version = CHECKPOINT_LIBRARY_VERSION;
+  lib->hdr.num_predictors = n;
+  lib->hdr.codec = codec_available(CODEC_ZSTD) ? CODEC_ZSTD : codec_available(CODEC_LZ4) ? CODEC_LZ4 : CODEC_NONE;
+  lib->hdr.every = every;
+  lib->next = 0;
+  lib->len = checkpoint_states_size(predictors, n);
+  lib->comp_cap = codec_bound(lib->hdr.codec, lib->len);
+  lib->state = (char *)calloc(lib->len ? lib->len : 1, 1);
+  lib->prev = (char *)calloc(lib->len ? lib->len : 1, 1);
+  lib->comp = (char *)malloc(lib->comp_cap ? lib->comp_cap : 1);
+  lib->out = fopen((lib->path + ".tmp").c_str(), "wb");
+  int ok = lib->state && lib->prev && lib->comp && lib->out &&
+           fwrite(&lib->hdr, sizeof(lib->hdr), 1, lib->out) == 1;
+  for (int i = 0; ok && i < n; i++)
+  {
+    checkpoint_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.cfg = *predictor_config(predictors[i]);
+    entry.state_size = predictor_state_size(predictors[i]);
+    ok = fwrite(&entry, sizeof(entry), 1, lib->out) == 1;
+  }
+  lib->offset = sizeof(lib->hdr) + n * sizeof(checkpoint_entry_t);
+  if (!ok)
+  {
+    if (lib->out)
+    {
+      fclose(lib->out);
+      unlink((lib->path + ".tmp").c_str());
+    }
+    free(lib->state);
+    free(lib->prev);
+    free(lib->comp);
+    delete lib;
+    return NULL;
+  }
+  return lib;
+}
+
+int checkpoint_library_add(checkpoint_library_t *lib, predictor_t *const *predictors, uint64_t position)
+{
+  if (!lib || position < lib->next)
+  {
+    return 1;
+  }
+  size_t off = 0;
+  for (uint32_t i = 0; i < lib->hdr.num_predictors; i++)
+  {
+    predictor_save_state(predictors[i], lib->state + off);
+    off += CHECKPOINT_ALIGN(predictor_state_size(predictors[i]));
+  }
+
+  // A key snapshot is XOR nothing, the others XOR the one before
+  int key = lib->index.size() % CHECKPOINT_KEY_EVERY == 0;
+  if (!key)
+  {
+    for (size_t i = 0; i < lib->len; i++)
+    {
+      lib->prev[i] ^= lib->state[i];
+    }
+  }
+  size_t comp = codec_compress(lib->hdr.codec, lib->comp, lib->comp_cap, key ? lib->state : lib->prev, lib->len, 1);
+  if (!comp || fwrite(lib->comp, 1, comp, lib->out) != comp)
+  {
+    return 0;
+  }
+  checkpoint_library_index_t e = {position, lib->offset, comp};
+  lib->index.push_back(e);
+  lib->offset += comp;
+  std::swap(lib->state, lib->prev);
+  lib->next = position - position % lib->hdr.every + lib->hdr.every;
+  return 1;
+}
+
+int checkpoint_library_close(checkpoint_library_t *lib)
+{
+  lib->hdr.snapshots = lib->index.size();
+  lib->hdr.index_offset = lib->offset;
+  int ok = fwrite(lib->index.data(), sizeof(checkpoint_library_index_t), lib->index.size(), lib->out) ==
+               lib->index.size() &&
+           fseek(lib->out, 0, SEEK_SET) == 0 && fwrite(&lib->hdr, sizeof(lib->hdr), 1, lib->out) == 1;
+  ok = fclose(lib->out) == 0 && ok;
+  std::string tmp = lib->path + ".tmp";
+  if (ok && rename(tmp.c_str(), lib->path.c_str()))
+  {
+    ok = 0;
+  }
+  if (!ok)
+  {
+    unlink(tmp.c_str());
+  }
+  free(lib->state);
+  free(lib->prev);
+  free(lib->comp);
+  delete lib;
+  return ok;
+}
+
+int checkpoint_is_library(const char *path)
+{
+  char magic[8] = {0};
+  FILE *in = fopen(path, "rb");
+  int ok = in && fread(magic, sizeof(magic), 1, in) == 1 && !memcmp(magic, CHECKPOINT_LIBRARY_MAGIC,
+                                                                      sizeof(CHECKPOINT_LIBRARY_MAGIC));
+  if (in)
+  {
+    fclose(in);
+  }
+  return ok;
+}
+
+int checkpoint_library_load(const char *path, predictor_t **predictors, const int *types, int n, uint64_t branch,
+                            uint64_t *position)
+{
+  for (int i = 0; i < n; i++)
+  {
+    predictors[i] = NULL;
+  }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  struct stat st;
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(checkpoint_library_header_t))
+  {
+    close(fd);
+    return 0;
+  }
+  size_t len = st.st_size;
+  void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    return 0;
+  }
+
+  const char *data = (const char *)map;
+  const checkpoint_library_header_t *hdr = (const checkpoint_library_header_t *)data;
+  size_t entries = sizeof(*hdr);
+  int ok = !memcmp(hdr->magic, CHECKPOINT_LIBRARY_MAGIC, sizeof(CHECKPOINT_LIBRARY_MAGIC)) &&
+           hdr->version == CHECKPOINT_LIBRARY_VERSION && hdr->num_predictors <= NUM_BP_TYPES &&
+           entries + hdr->num_predictors * sizeof(checkpoint_entry_t) <= len && hdr->index_offset <= len &&
+           hdr->snapshots <= (len - hdr->index_offset) / sizeof(checkpoint_library_index_t);
+  const checkpoint_entry_t *entry = (const checkpoint_entry_t *)(data + entries);
+  const checkpoint_library_index_t *index = (const checkpoint_library_index_t *)(data + hdr->index_offset);
+
+  // The last snapshot at or before 'branch', from the key before it
+  uint64_t k = 0;
+  ok = ok && hdr->snapshots && index[0].position <= branch;
+  while (ok && k + 1 < hdr->snapshots && index[k + 1].position <= branch)
+  {
+    k++;
+  }
+  size_t states = 0;
+  for (uint32_t e = 0; ok && e < hdr->num_predictors; e++)
+  {
+    states += CHECKPOINT_ALIGN(entry[e].state_size);
+  }
+  char *state = ok ? (char *)malloc(states ? states : 1) : NULL;
+  char *delta = ok ? (char *)malloc(states ? states : 1) : NULL;
+  ok = ok && state && delta;
+  for (uint64_t s = k - k % CHECKPOINT_KEY_EVERY; ok && s <= k; s++)
+  {
+    ok = index[s].offset <= len && index[s].length <= len - index[s].offset &&
+         codec_decompress(hdr->codec, s == k - k % CHECKPOINT_KEY_EVERY ? state : delta, states,
+                          data + index[s].offset, index[s].length) == states;
+    for (size_t i = 0; ok && s != k - k % CHECKPOINT_KEY_EVERY && i < states; i++)
+    {
+      state[i] ^= delta[i];
+    }
+  }
+
+  // Hand each saved predictor to the slot asking for its type
+  size_t off = 0;
+  for (uint32_t e = 0; ok && e < hdr->num_predictors; e++)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      if (types[i] == entry[e].cfg.type && !predictors[i])
+      {
+        predictors[i] = predictor_load_state(&entry[e].cfg, state + off, entry[e].state_size);
+        ok = predictors[i] != NULL;
+        break;
+      }
+    }
+    off += CHECKPOINT_ALIGN(entry[e].state_size);
+  }
+  for (int i = 0; i < n; i++)
+  {
+    ok = ok && predictors[i];
+  }
+  if (!ok)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      predictor_destroy(predictors[i]);
+      predictors[i] = NULL;
+    }
+  }
+  else
+  {
+    *position = index[k].position;
+  }
+  free(state);
+  free(delta);
+  munmap(map, len);
+  return ok;
+}
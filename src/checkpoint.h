@@ -0,0 +1,140 @@
+//========================================================//
+//  checkpoint.h                                          //
+//  Header file for predictor state snapshots             //
+//                                                        //
+//  Saves the tables and history registers of warmed up   //
+//  predictors, with the trace position they reached, so  //
+//  later runs can start from there, or a library of them //
+//  taken every N records of one pass                     //
+//========================================================//
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include "predictor.h"
+
+// A snapshot is a checkpoint_header_t followed, for each predictor,
+// by a checkpoint_entry_t and its predictor_save_state bytes, padded
+// to 8 bytes
+#define CHECKPOINT_MAGIC "BPSTATE"
+#define CHECKPOINT_VERSION 13
+
+typedef struct
+{
+  char magic[8];           // CHECKPOINT_MAGIC, NUL terminated
+  uint32_t version;        // CHECKPOINT_VERSION
+  uint32_t num_predictors;
+  uint64_t position;       // trace record following the last one replayed
+  uint64_t branches;       // counted up to position by a sweep point,
+  uint64_t mispredictions; // see checkpoint_save_point, else 0
+  uint64_t runtime_ns;
+} checkpoint_header_t;
+
+typedef struct
+{
+  predictor_config_t cfg;
+  uint32_t reserved;
+  uint64_t state_size;     // bytes of predictor state that follow
+} checkpoint_entry_t;
+
+// Write the 'n' predictors of 'predictors' and the trace 'position'
+// to 'path'
+//
+// Returns True if Successful
+//
+int checkpoint_save(const char *path, predictor_t *const *predictors, int n, uint64_t position);
+
+// Restore predictors[i] of type types[i] for each of the 'n' types
+// from the snapshot 'path', with the configuration it was saved
+// with, and its trace position into *position
+//
+// Returns True if Successful
+//
+int checkpoint_load(const char *path, predictor_t **predictors, const int *types, int n, uint64_t *position);
+
+// checkpoint_save of the predictor of a sweep point that has counted
+// 'branches' and 'mispredictions' in 'runtime_ns' up to 'position',
+// so a sweep stopped midway resumes it there, see --sweep-checkpoint
+//
+// Returns True if Successful
+//
+int checkpoint_save_point(const char *path, predictor_t *p, uint64_t position, uint64_t branches,
+                          uint64_t mispredictions, uint64_t runtime_ns);
+
+// Restore the predictor of type 'type' and the counts saved with it by
+// checkpoint_save_point
+//
+// Returns True if Successful
+//
+int checkpoint_load_point(const char *path, predictor_t **p, int type, uint64_t *position, uint64_t *branches,
+                          uint64_t *mispredictions, uint64_t *runtime_ns);
+
+// A library is a checkpoint_library_header_t, the checkpoint_entry_t
+// of each predictor, its snapshots and at 'index_offset' one
+// checkpoint_library_index_t per snapshot. A snapshot is the states
+// of all the predictors, each padded to 8 bytes, XOR those of the
+// snapshot before it, compressed with 'codec'. Every
+// CHECKPOINT_KEY_EVERY-th is XOR nothing, so a restore decodes at most
+// that many snapshots
+#define CHECKPOINT_LIBRARY_MAGIC "BPCKLIB"
+#define CHECKPOINT_LIBRARY_VERSION 1
+#define CHECKPOINT_KEY_EVERY 16
+
+typedef struct
+{
+  char magic[8];           // CHECKPOINT_LIBRARY_MAGIC, NUL terminated
+  uint32_t version;        // CHECKPOINT_LIBRARY_VERSION
+  uint32_t num_predictors;
+  uint32_t codec;          // CODEC_*, see codec.h
+  uint32_t reserved;
+  uint64_t every;          // records between snapshots asked for
+  uint64_t snapshots;
+  uint64_t index_offset;
+} checkpoint_library_header_t;
+
+typedef struct
+{
+  uint64_t position;       // trace record following the last one replayed
+  uint64_t offset;         // of the compressed snapshot in the file
+  uint64_t length;         // its compressed bytes
+} checkpoint_library_index_t;
+
+typedef struct checkpoint_library checkpoint_library_t;
+
+// Start a library in 'path' for the 'n' predictors of 'predictors',
+// to take a snapshot every 'every' records
+//
+// Returns NULL if the file can not be written
+//
+checkpoint_library_t *checkpoint_library_create(const char *path, predictor_t *const *predictors, int n,
+                                                uint64_t every);
+
+// Take a snapshot of the predictors at trace 'position' if it is the
+// first or has reached the next multiple of the library's 'every'
+// records; a run adds once per batch, so the snapshots land at the
+// first batch end past each multiple
+//
+// Returns True if Successful
+//
+int checkpoint_library_add(checkpoint_library_t *lib, predictor_t *const *predictors, uint64_t position);
+
+// Write the index and header and release the library
+//
+// Returns True if Successful
+//
+int checkpoint_library_close(checkpoint_library_t *lib);
+
+// Returns True if 'path' is a checkpoint library
+//
+int checkpoint_is_library(const char *path);
+
+// checkpoint_load of the library snapshot nearest 'branch' at or
+// before it
+//
+// Returns True if Successful, False also when all are after 'branch'
+//
+int checkpoint_library_load(const char *path, predictor_t **predictors, const int *types, int n, uint64_t branch,
+                            uint64_t *position);
+
+#endif
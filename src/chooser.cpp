@@ -0,0 +1,170 @@
+//========================================================//
+//  chooser.cpp                                           //
+//  Source file for the cached chooser sweep              //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "chooser.h"
+#include "predictor.h"
+#include "replay.h"
+
+// The streams start with a word of not taken branches, the register
+// the tournament starts from, so every window of history is in range
+#define CHOOSER_PAD 64
+
+static const char *chooser_names[CHOOSER_KINDS] = {"ghist", "pc", "gshare"};
+
+typedef struct
+{
+  std::vector<uint64_t> local, global, taken; // bit CHOOSER_PAD + k of conditional branch k
+  std::vector<uint32_t> pcs;                   // of conditional branch k
+  uint64_t first;                              // bit of the first counted branch
+  uint64_t end;                                // bit after the last
+} chooser_streams_t;
+
+// 'bits' bits of 's' from bit 'pos'
+static inline uint32_t chooser_window(const uint64_t *s, uint64_t pos, int bits)
+{
+  uint64_t w = pos >> 6;
+  int sh = pos & 63;
+  uint64_t v = s[w] >> sh;
+  if (sh + bits > 64)
+  {
+    v |= s[w + 1] << (64 - sh);
+  }
+  return (uint32_t)v & ((1u << bits) - 1);
+}
+
+// Mispredictions of a chooser of 'kind' with 'bits' index bits where
+// the components disagree, the only branches it decides and trains on
+static uint64_t chooser_eval(const chooser_streams_t *s, int kind, int bits, int init, uint8_t *table)
+{
+  memset(table, init, (size_t)1 << bits);
+  const uint64_t *local = s->local.data(), *global = s->global.data(), *taken = s->taken.data();
+  uint32_t mask = (1u << bits) - 1;
+  uint64_t misses = 0;
+  for (uint64_t w = CHOOSER_PAD / 64; w <= (s->end - 1) / 64; w++)
+  {
+    for (uint64_t d = local[w] ^ global[w]; d; d &= d - 1)
+    {
+      uint64_t pos = w * 64 + __builtin_ctzll(d);
+      uint32_t idx;
+      if (kind == CHOOSER_PC)
+      {
+        idx = s->pcs[pos - CHOOSER_PAD] & mask;
+      }
+      else
+      {
+        idx = chooser_window(taken, pos - bits, bits);
+        idx = kind == CHOOSER_GSHARE ? (idx ^ s->pcs[pos - CHOOSER_PAD]) & mask : idx;
+      }
+      // the component it prefers is right or the other one is
+      int global_right = ((global[w] ^ taken[w]) >> (pos & 63) & 1) == 0;
+      uint8_t c = table[idx];
+      misses += pos >= s->first && (c >= 2) != global_right;
+      table[idx] = global_right ? (c < 3 ? c + 1 : 3) : (c > 0 ? c - 1 : 0);
+    }
+  }
+  return misses;
+}
+
+int chooser_run(trace_reader_t *tr, uint64_t warmup, uint64_t count, int lo, int hi)
+{
+  uint64_t t0 = trace_clock_ns();
+  predictor_config_t cfg = predictor_default_config(TOURNAMENT);
+  predictor_t *p = predictor_create(&cfg);
+  predictor_components_t info;
+  if (!p || !predictor_components(p, &info))
+  {
+    fprintf(stderr, "--chooser-sweep needs a tournament without updateDelay or --unbounded\n");
+    if (p)
+    {
+      predictor_destroy(p);
+    }
+    return 0;
+  }
+
+  const branch_record_t *recs;
+  branch_record_t *owned;
+  size_t n = replay_load(tr, warmup + count < warmup ? ~0ULL : warmup + count, &recs, &owned);
+  size_t nwarm = n < warmup ? n : warmup;
+  uint64_t cwarm = replay_count_conditional(recs, nwarm);
+  uint64_t conds = cwarm + replay_count_conditional(recs + nwarm, n - nwarm);
+
+  // one word past the last for the windows of chooser_window
+  chooser_streams_t s;
+  size_t words = (CHOOSER_PAD + conds) / 64 + 2;
+  s.local.assign(words, 0);
+  s.global.assign(words, 0);
+  s.taken.assign(words, 0);
+  s.pcs.reserve(conds);
+  for (size_t i = 0; i < n; i++)
+  {
+    if (recs[i].flags & TRACE_F_CONDITION)
+    {
+      s.pcs.push_back(recs[i].pc);
+    }
+  }
+  s.first = CHOOSER_PAD + cwarm;
+  s.end = CHOOSER_PAD + conds;
+
+  uint64_t *bits[2] = {s.local.data(), s.global.data()};
+  uint64_t warm_misses = 0, misses = 0;
+  predictor_predict_components(p, replay_branches(recs), nwarm, CHOOSER_PAD, bits, s.taken.data(), &warm_misses);
+  predictor_predict_components(p, replay_branches(recs + nwarm), n - nwarm, s.first, bits, s.taken.data(),
+                               &misses);
+  predictor_destroy(p);
+  free(owned);
+  uint64_t t1 = trace_clock_ns();
+
+  // Where the components agree the chooser does not matter, and both
+  // missing is the miss of any chooser
+  uint64_t agree = 0, only_local = 0, only_global = 0;
+  for (uint64_t w = s.first / 64; w < words; w++)
+  {
+    uint64_t in = w == s.first / 64 ? ~0ULL << (s.first & 63) : ~0ULL;
+    uint64_t lm = (s.local[w] ^ s.taken[w]) & in, gm = (s.global[w] ^ s.taken[w]) & in;
+    agree += __builtin_popcountll(lm & gm);
+    only_local += __builtin_popcountll(lm);
+    only_global += __builtin_popcountll(gm);
+  }
+
+  uint64_t counted = conds - cwarm;
+  double scale = counted ? 1000.0 / counted : 0.0;
+  printf("Chooser sweep:   %llu conditional branches, components recorded in %.1f ms\n",
+         (unsigned long long)counted, (t1 - t0) / 1e6);
+  printf("Tournament, ghrBits %-7d%12llu %8.3f\n", info.chooser_bits, (unsigned long long)misses,
+         misses * scale);
+  printf("Local only                 %12llu %8.3f\n", (unsigned long long)only_local, only_local * scale);
+  printf("Global only                %12llu %8.3f\n", (unsigned long long)only_global, only_global * scale);
+  printf("Either right               %12llu %8.3f\n", (unsigned long long)agree, agree * scale);
+  printf("Bits ");
+  for (int k = 0; k < CHOOSER_KINDS; k++)
+  {
+    printf(" %12s %8s", chooser_names[k], "Rate");
+  }
+  printf("\n");
+
+  uint8_t *table = (uint8_t *)malloc((size_t)1 << hi);
+  if (!table)
+  {
+    fprintf(stderr, "Error: chooser table malloc failed\n");
+    return 0;
+  }
+  for (int b = lo; b <= hi; b++)
+  {
+    printf("%-5d", b);
+    for (int k = 0; k < CHOOSER_KINDS; k++)
+    {
+      uint64_t m = agree + chooser_eval(&s, k, b, info.chooser_init, table);
+      printf(" %12llu %8.3f", (unsigned long long)m, m * scale);
+    }
+    printf("\n");
+  }
+  free(table);
+  printf("Evaluated in %.1f ms\n", (trace_clock_ns() - t1) / 1e6);
+  return 1;
+}
@@ -0,0 +1,45 @@
+//========================================================//
+//  chooser.h                                             //
+//  Header file for the cached chooser sweep              //
+//                                                        //
+//  --chooser-sweep replays the tournament once and keeps //
+//  what its local and global components predicted for   //
+//  every conditional branch as bitstreams. The choosers  //
+//  only train where the two disagree, so each one of a   //
+//  sweep is evaluated from the streams alone, visiting   //
+//  just those branches, without replaying the tables     //
+//========================================================//
+
+#ifndef CHOOSER_H
+#define CHOOSER_H
+
+#include <stdint.h>
+#include "trace.h"
+
+// Chooser tables, indexed by
+//  - ghist: the outcomes of the last <bits> conditional branches, as
+//    the tournament's own chooser, which it reproduces exactly at its
+//    ghrBits
+//  - pc: the low <bits> of the branch's PC
+//  - gshare: the two XORed
+#define CHOOSER_GHIST  0
+#define CHOOSER_PC     1
+#define CHOOSER_GSHARE 2
+#define CHOOSER_KINDS  3
+
+// Default and widest index of --chooser-sweep
+#define CHOOSER_LO 4
+#define CHOOSER_HI 20
+#define CHOOSER_MAX_BITS 28
+
+// Replay 'warmup' and 'count' records of 'tr' through the tournament
+// of the current configuration, recording its components, then print
+// the mispredictions of every chooser kind with 'lo' to 'hi' index
+// bits over the counted branches, next to the bounds of the local
+// component alone, the global alone and either being right
+//
+// Returns True if Successful
+//
+int chooser_run(trace_reader_t *tr, uint64_t warmup, uint64_t count, int lo, int hi);
+
+#endif
@@ -0,0 +1,693 @@
+//========================================================//
+//  cluster.cpp                                           //
+//  Source file for sweeps spread over remote workers     //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cluster.h"
+#include "replay.h"
+#include "tracecache.h"
+#include "memo.h"
+
+// One end of a connection, with the bytes read past the last line
+typedef struct
+{
+  int fd;
+  std::string pending;
+} cluster_conn_t;
+
+// Send all of 'out'
+//
+// Returns True if Successful
+//
+static int cluster_send(cluster_conn_t *c, const std::string &out)
+{
+  for (size_t sent = 0; sent < out.size();)
+  {
+    ssize_t k = send(c->fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+    if (k <= 0)
+    {
+      return 0;
+    }
+    sent += k;
+  }
+  return 1;
+}
+
+// The next line of 'c' into 'line', without its newline
+//
+// Returns False at the end of the connection or for a line too long
+//
+static int cluster_line(cluster_conn_t *c, std::string *line)
+{
+  char buf[CLUSTER_LINE_MAX];
+  size_t nl;
+  while ((nl = c->pending.find('\n')) == std::string::npos)
+  {
+    ssize_t k = c->pending.size() > CLUSTER_LINE_MAX ? 0 : read(c->fd, buf, sizeof(buf));
+    if (k <= 0)
+    {
+      return 0;
+    }
+    c->pending.append(buf, k);
+  }
+  *line = c->pending.substr(0, nl);
+  c->pending.erase(0, nl + 1);
+  if (!line->empty() && (*line)[line->size() - 1] == '\r')
+  {
+    line->erase(line->size() - 1);
+  }
+  return 1;
+}
+
+// Split "[host]:port" into 'host', empty for any, and 'port'
+//
+// Returns True if Successful
+//
+static int cluster_address(const char *address, std::string *host, std::string *port)
+{
+  const char *colon = strrchr(address, ':');
+  if (!colon || !colon[1])
+  {
+    fprintf(stderr, "Address %s is not <host>:<port>\n", address);
+    return 0;
+  }
+  host->assign(address, colon - address);
+  port->assign(colon + 1);
+  return 1;
+}
+
+//------------------------------------//
+//            Coordinator             //
+//------------------------------------//
+
+enum
+{
+  CLUSTER_QUEUED,
+  CLUSTER_OUT,  // with a worker
+  CLUSTER_DONE, // stored or failed
+};
+
+static const cluster_coordinator_t *cluster_cfg;
+static std::mutex cluster_lock;
+static std::condition_variable cluster_finished;
+static std::vector<int> cluster_state;
+static std::deque<size_t> cluster_queue;
+static size_t cluster_left;   // tasks not done
+static int cluster_workers;   // connections that said HELLO
+static uint64_t cluster_failed;
+
+// Send the trace file to 'c'
+//
+// Returns True if Successful
+//
+static int cluster_send_trace(cluster_conn_t *c)
+{
+  int fd = open(cluster_cfg->trace_path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st))
+  {
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    return cluster_send(c, "NO unable to read the trace\n");
+  }
+  char head[64];
+  snprintf(head, sizeof(head), "DATA %llu\n", (unsigned long long)st.st_size);
+  int ok = cluster_send(c, head);
+  off_t off = 0;
+  while (ok && off < st.st_size)
+  {
+    ok = sendfile(c->fd, fd, &off, st.st_size - off) > 0;
+  }
+  close(fd);
+  return ok;
+}
+
+// Put 'task' back at the front of the queue, or mark it done
+static void cluster_release(size_t task, int done)
+{
+  std::lock_guard<std::mutex> lock(cluster_lock);
+  if (cluster_state[task] != CLUSTER_OUT)
+  {
+    return;
+  }
+  if (done)
+  {
+    cluster_state[task] = CLUSTER_DONE;
+    if (--cluster_left == 0)
+    {
+      cluster_finished.notify_all();
+    }
+  }
+  else
+  {
+    cluster_state[task] = CLUSTER_QUEUED;
+    cluster_queue.push_front(task);
+  }
+}
+
+// Answer the worker connected on 'fd' until it leaves
+static void cluster_serve(int fd, std::string peer)
+{
+  cluster_conn_t conn = {fd, ""};
+  std::string line;
+  if (!cluster_line(&conn, &line) || line.compare(0, 6, "HELLO "))
+  {
+    close(fd);
+    return;
+  }
+  if (line.substr(6) != predictor_build_id())
+  {
+    fprintf(stderr, "Warning: worker %s is of build %s, not %s\n", peer.c_str(), line.c_str() + 6,
+            predictor_build_id());
+    cluster_send(&conn, "NO another build\n");
+    close(fd);
+    return;
+  }
+  cluster_send(&conn, "OK\n");
+  {
+    std::lock_guard<std::mutex> lock(cluster_lock);
+    cluster_workers++;
+  }
+
+  const char *hash_end = strchr(cluster_cfg->scope, ' ');
+  std::string hash(cluster_cfg->scope, hash_end - cluster_cfg->scope);
+  const char *base = strrchr(cluster_cfg->trace_path, '/');
+  base = base ? base + 1 : cluster_cfg->trace_path;
+  const char *dot = strrchr(base, '.');
+  std::string suffix = dot && !strchr(dot, ' ') ? dot : "-";
+
+  long held = -1; // the task with this worker
+  uint64_t replayed = 0;
+  int ok = 1;
+  while (ok && cluster_line(&conn, &line))
+  {
+    if (line == "NEXT")
+    {
+      std::string reply;
+      {
+        std::lock_guard<std::mutex> lock(cluster_lock);
+        if (held >= 0)
+        {
+          // a worker asks again only once it gave up on its point
+          cluster_state[held] = CLUSTER_QUEUED;
+          cluster_queue.push_front(held);
+          held = -1;
+        }
+        if (!cluster_queue.empty())
+        {
+          held = cluster_queue.front();
+          cluster_queue.pop_front();
+          cluster_state[held] = CLUSTER_OUT;
+        }
+        else
+        {
+          reply = cluster_left ? "WAIT\n" : "DONE\n";
+        }
+      }
+      if (held >= 0)
+      {
+        const predictor_config_t *cfg = &cluster_cfg->cfgs[held];
+        char config[1024], head[256];
+        predictor_config_format(cfg, config, sizeof(config));
+        snprintf(head, sizeof(head), "JOB %ld %s %s %llu %llu %llu %s ", held, hash.c_str(), suffix.c_str(),
+                 (unsigned long long)cluster_cfg->start, (unsigned long long)cluster_cfg->warmup,
+                 (unsigned long long)cluster_cfg->count, bpName[cfg->type]);
+        reply = std::string(head) + config + "\n";
+      }
+      ok = cluster_send(&conn, reply);
+    }
+    else if (!line.compare(0, 6, "TRACE "))
+    {
+      ok = line.substr(6) == hash ? cluster_send_trace(&conn) : cluster_send(&conn, "NO unknown trace\n");
+    }
+    else if (!line.compare(0, 7, "RESULT "))
+    {
+      long task;
+      unsigned long long v[5];
+      if (sscanf(line.c_str() + 7, "%ld %llu %llu %llu %llu %llu", &task, &v[0], &v[1], &v[2], &v[3], &v[4]) != 6 ||
+          task != held)
+      {
+        break;
+      }
+      memo_result_t r = {{v[0], v[1]}, v[2], v[3], v[4]};
+      if (!memo_store(cluster_cfg->scope, &cluster_cfg->cfgs[task], &r))
+      {
+        fprintf(stderr, "Error: failed to write %s\n", memo_path);
+      }
+      cluster_release(task, 1);
+      held = -1;
+      replayed++;
+    }
+    else if (!line.compare(0, 5, "FAIL "))
+    {
+      long task;
+      int used = 0;
+      if (sscanf(line.c_str() + 5, "%ld %n", &task, &used) != 1 || task != held)
+      {
+        break;
+      }
+      fprintf(stderr, "Warning: point %ld failed on %s (%s), left to this sweep\n", task, peer.c_str(),
+              line.c_str() + 5 + used);
+      {
+        std::lock_guard<std::mutex> lock(cluster_lock);
+        cluster_failed++;
+      }
+      cluster_release(task, 1);
+      held = -1;
+    }
+    else
+    {
+      break;
+    }
+  }
+  if (held >= 0)
+  {
+    cluster_release(held, 0);
+  }
+  close(fd);
+  std::lock_guard<std::mutex> lock(cluster_lock);
+  if (cluster_left)
+  {
+    fprintf(stderr, "Worker %s left after %llu points%s\n", peer.c_str(), (unsigned long long)replayed,
+            held >= 0 ? ", its point is queued again" : "");
+  }
+}
+
+// Take connections on 'fd' for the rest of the run
+static void cluster_accept(int fd)
+{
+  for (;;)
+  {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    int client = accept(fd, (struct sockaddr *)&addr, &len);
+    if (client < 0)
+    {
+      continue;
+    }
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+    std::string peer = "?";
+    if (!getnameinfo((struct sockaddr *)&addr, len, host, sizeof(host), port, sizeof(port),
+                     NI_NUMERICHOST | NI_NUMERICSERV))
+    {
+      peer = std::string(host) + ":" + port;
+    }
+    std::thread(cluster_serve, client, peer).detach();
+  }
+}
+
+int cluster_coordinate(const cluster_coordinator_t *cfg)
+{
+  cluster_cfg = cfg;
+  cluster_state.assign(cfg->n, CLUSTER_DONE);
+  for (size_t i = 0; i < cfg->n; i++)
+  {
+    memo_result_t r;
+    if (cfg->cfgs[i].type != PLUGIN && !memo_lookup(cfg->scope, &cfg->cfgs[i], &r))
+    {
+      cluster_state[i] = CLUSTER_QUEUED;
+      cluster_queue.push_back(i);
+    }
+  }
+  cluster_left = cluster_queue.size();
+  size_t queued = cluster_left;
+  if (!cluster_left)
+  {
+    fprintf(stderr, "Coordinator: the store holds every point\n");
+    return 1;
+  }
+
+  std::string host, port;
+  if (!cluster_address(cfg->address, &host, &port))
+  {
+    return 0;
+  }
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  int fd = -1;
+  if (!getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &res))
+  {
+    for (struct addrinfo *a = res; a && fd < 0; a = a->ai_next)
+    {
+      fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+      int one = 1;
+      if (fd >= 0 && (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ||
+                      bind(fd, a->ai_addr, a->ai_addrlen) || listen(fd, CLUSTER_BACKLOG)))
+      {
+        close(fd);
+        fd = -1;
+      }
+    }
+    freeaddrinfo(res);
+  }
+  if (fd < 0)
+  {
+    fprintf(stderr, "Unable to listen on %s\n", cfg->address);
+    return 0;
+  }
+  fprintf(stderr, "Coordinating %zu of %zu points on %s\n", cluster_left, cfg->n, cfg->address);
+  std::thread(cluster_accept, fd).detach();
+
+  std::unique_lock<std::mutex> lock(cluster_lock);
+  cluster_finished.wait(lock, [] { return cluster_left == 0; });
+  fprintf(stderr, "Coordinator: %zu points from %d workers, %llu failed\n", queued, cluster_workers,
+          (unsigned long long)cluster_failed);
+  return 1;
+}
+
+//------------------------------------//
+//              Worker                //
+//------------------------------------//
+
+// A fetched trace, decoded on first use and kept until the worker exits
+typedef struct
+{
+  std::once_flag once;
+  trace_reader_t *tr;
+  const branch_record_t *recs;
+  branch_record_t *owned; // decoded records, NULL when mapped
+  size_t n;
+  std::string error;
+} cluster_trace_t;
+
+static const cluster_worker_t *worker_cfg;
+static std::string worker_dir;
+static std::mutex worker_lock;
+static std::map<std::string, std::unique_ptr<cluster_trace_t> > worker_traces; // by hash
+static uint64_t worker_points;
+
+// Connect to the coordinator, trying again for CLUSTER_CONNECT_SECONDS
+//
+// Returns the socket, or -1
+//
+static int worker_connect()
+{
+  std::string host, port;
+  if (!cluster_address(worker_cfg->address, &host, &port))
+  {
+    return -1;
+  }
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  for (int tries = 0; tries < CLUSTER_CONNECT_SECONDS; tries++)
+  {
+    if (tries)
+    {
+      sleep(1);
+    }
+    if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &res))
+    {
+      continue;
+    }
+    int fd = -1;
+    for (struct addrinfo *a = res; a && fd < 0; a = a->ai_next)
+    {
+      fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+      if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen))
+      {
+        close(fd);
+        fd = -1;
+      }
+    }
+    freeaddrinfo(res);
+    if (fd >= 0)
+    {
+      return fd;
+    }
+  }
+  return -1;
+}
+
+// Fetch the trace of 'hash' over 'c' into 'path', through a temporary
+// file renamed into place once its content hash is checked
+//
+// Returns an error, empty if Successful
+//
+static std::string worker_fetch(cluster_conn_t *c, const std::string &hash, const std::string &path)
+{
+  std::string line;
+  unsigned long long size;
+  if (!cluster_send(c, "TRACE " + hash + "\n") || !cluster_line(c, &line))
+  {
+    return "coordinator went away";
+  }
+  if (sscanf(line.c_str(), "DATA %llu", &size) != 1)
+  {
+    return line;
+  }
+  char tmp[4096];
+  snprintf(tmp, sizeof(tmp), "%s.tmp.%d.%zx", path.c_str(), (int)getpid(),
+           std::hash<std::thread::id>()(std::this_thread::get_id()));
+  FILE *out = fopen(tmp, "wb");
+  if (!out)
+  {
+    return std::string("unable to write ") + tmp;
+  }
+  size_t take = c->pending.size() < size ? c->pending.size() : size;
+  int ok = fwrite(c->pending.data(), 1, take, out) == take;
+  c->pending.erase(0, take);
+  char buf[1 << 16];
+  for (unsigned long long got = take; ok && got < size;)
+  {
+    ssize_t k = read(c->fd, buf, size - got < sizeof(buf) ? size - got : sizeof(buf));
+    ok = k > 0 && fwrite(buf, 1, k, out) == (size_t)k;
+    got += k > 0 ? k : 0;
+  }
+  ok = fclose(out) == 0 && ok;
+  char check[MEMO_HASH_LEN + 1];
+  if (!ok || !memo_trace_hash(tmp, check) || hash != check || rename(tmp, path.c_str()))
+  {
+    remove(tmp);
+    return ok ? "fetched trace does not match its hash" : "trace transfer failed";
+  }
+  return "";
+}
+
+// The records of the trace of 'hash', fetched over 'c' the first time
+// any connection needs it
+//
+// Returns NULL if it can not be had, with the reason in 'error'
+//
+static const cluster_trace_t *worker_trace(cluster_conn_t *c, const std::string &hash, const std::string &suffix,
+                                           std::string *error)
+{
+  cluster_trace_t *t;
+  {
+    std::lock_guard<std::mutex> lock(worker_lock);
+    std::unique_ptr<cluster_trace_t> &slot = worker_traces[hash];
+    if (!slot)
+    {
+      slot.reset(new cluster_trace_t());
+    }
+    t = slot.get();
+  }
+  std::call_once(t->once, [&]() {
+    std::string path = worker_dir + "/" + hash + (suffix == "-" ? "" : suffix);
+    if (access(path.c_str(), R_OK))
+    {
+      t->error = worker_fetch(c, hash, path);
+    }
+    if (t->error.empty())
+    {
+      t->tr = trace_cache_open(worker_cfg->cache_dir, path.c_str());
+      if (t->tr)
+      {
+        t->n = replay_load(t->tr, ~0ULL, &t->recs, &t->owned);
+      }
+      else
+      {
+        t->error = "unable to open " + path;
+      }
+    }
+  });
+  *error = t->error;
+  return t->tr ? t : NULL;
+}
+
+// Replay the point of the JOB line 'line'
+//
+// Returns the RESULT or FAIL line to send back
+//
+static std::string worker_job(cluster_conn_t *c, const std::string &line)
+{
+  long task;
+  char hash[MEMO_HASH_LEN + 1], suffix[256], type_name[64], out[256];
+  unsigned long long start, warmup, count;
+  int used = 0;
+  if (sscanf(line.c_str(), "JOB %ld %32s %255s %llu %llu %llu %63s %n", &task, hash, suffix, &start, &warmup, &count,
+             type_name, &used) != 7 || !used)
+  {
+    return "";
+  }
+  std::string fail = "FAIL " + std::to_string(task) + " ";
+  int type = predictor_type_by_name(type_name);
+  if (type < 0)
+  {
+    return fail + "unknown predictor " + type_name + "\n";
+  }
+
+  // The configuration is rebuilt from its fields and must format the
+  // same, or it would be stored as another point
+  std::string config = line.substr(used);
+  predictor_config_t cfg = predictor_default_config(type);
+  std::vector<char> fields(config.begin(), config.end());
+  fields.push_back('\0');
+  char *save;
+  for (char *tok = strtok_r(fields.data(), " ", &save); tok; tok = strtok_r(NULL, " ", &save))
+  {
+    // a list, as the history lengths, sets "<key>.<i>" for each value
+    char *eq = strchr(tok, '=');
+    int ok = eq && eq[1];
+    std::string key(tok, eq ? eq - tok : 0);
+    const char *value = eq ? eq + 1 : "";
+    for (int i = 0; ok && *value; i++)
+    {
+      char *end;
+      long v = strtol(value, &end, 0);
+      ok = end != value && (*end == ',' || !*end);
+      ok = ok && (predictor_config_set(&cfg, (key + "." + std::to_string(i)).c_str(), (int)v) ||
+                  (i == 0 && !*end && predictor_config_set(&cfg, key.c_str(), (int)v)));
+      value = *end ? end + 1 : end;
+    }
+    if (!ok)
+    {
+      return fail + "bad field " + tok + "\n";
+    }
+  }
+  char check[1024];
+  predictor_config_format(&cfg, check, sizeof(check));
+  if (config != check)
+  {
+    return fail + "configuration does not round trip\n";
+  }
+
+  std::string error;
+  const cluster_trace_t *t = worker_trace(c, hash, suffix, &error);
+  if (!t)
+  {
+    return fail + error + "\n";
+  }
+  size_t lo = start < t->n ? start : t->n;
+  size_t warm = warmup < t->n - lo ? warmup : t->n - lo;
+  size_t n = count < t->n - lo - warm ? count : t->n - lo - warm;
+  predictor_t *p = predictor_create(&cfg);
+  if (!p)
+  {
+    return fail + "invalid configuration\n";
+  }
+  uint64_t t0 = trace_clock_ns();
+  replay_warmup(p, t->recs + lo, warm);
+  replay_stats_t st = {0, 0};
+  replay_records(p, t->recs + lo + warm, n, &st);
+  uint64_t runtime_ns = trace_clock_ns() - t0;
+  snprintf(out, sizeof(out), "RESULT %ld %llu %llu %llu %llu %llu\n", task, (unsigned long long)st.branches,
+           (unsigned long long)st.mispredictions, (unsigned long long)n, (unsigned long long)runtime_ns,
+           (unsigned long long)predictor_memory(p));
+  predictor_destroy(p);
+  return out;
+}
+
+// One connection, taking points until there are none
+//
+// Returns False if the coordinator can not be reached or refused it
+//
+static int worker_run()
+{
+  int fd = worker_connect();
+  if (fd < 0)
+  {
+    fprintf(stderr, "Unable to reach the coordinator at %s\n", worker_cfg->address);
+    return 0;
+  }
+  cluster_conn_t conn = {fd, ""};
+  std::string line;
+  if (!cluster_send(&conn, std::string("HELLO ") + predictor_build_id() + "\n") || !cluster_line(&conn, &line) ||
+      line != "OK")
+  {
+    fprintf(stderr, "The coordinator at %s refused this worker: %s\n", worker_cfg->address,
+            line.empty() ? "no answer" : line.c_str());
+    close(fd);
+    return 0;
+  }
+  while (cluster_send(&conn, "NEXT\n") && cluster_line(&conn, &line))
+  {
+    if (line == "WAIT")
+    {
+      usleep(CLUSTER_WAIT_MS * 1000);
+      continue;
+    }
+    std::string reply = line.compare(0, 4, "JOB ") ? "" : worker_job(&conn, line);
+    if (reply.empty() || !cluster_send(&conn, reply))
+    {
+      break;
+    }
+    if (!reply.compare(0, 7, "RESULT "))
+    {
+      std::lock_guard<std::mutex> lock(worker_lock);
+      worker_points++;
+    }
+  }
+  close(fd);
+  return 1;
+}
+
+int cluster_work(const cluster_worker_t *cfg)
+{
+  worker_cfg = cfg;
+  if (cfg->trace_dir)
+  {
+    worker_dir = cfg->trace_dir;
+  }
+  else
+  {
+    const char *tmp = getenv("TMPDIR");
+    worker_dir = std::string(tmp && *tmp ? tmp : "/tmp") + "/" + CLUSTER_TRACE_DIR;
+  }
+  if (mkdir(worker_dir.c_str(), 0777) && errno != EEXIST)
+  {
+    fprintf(stderr, "Unable to create %s\n", worker_dir.c_str());
+    return 0;
+  }
+
+  int jobs = cfg->jobs > 0 ? cfg->jobs : std::thread::hardware_concurrency();
+  jobs = jobs > 0 ? jobs : 1;
+  std::vector<std::thread> threads;
+  std::vector<int> ok(jobs);
+  for (int j = 0; j < jobs; j++)
+  {
+    threads.push_back(std::thread([&ok, j]() { ok[j] = worker_run(); }));
+  }
+  int reached = 0;
+  for (int j = 0; j < jobs; j++)
+  {
+    threads[j].join();
+    reached |= ok[j];
+  }
+  fprintf(stderr, "Worker: %llu points on %d connections\n", (unsigned long long)worker_points, jobs);
+  return reached;
+}
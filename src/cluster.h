@@ -0,0 +1,82 @@
+//========================================================//
+//  cluster.h                                             //
+//  Header file for sweeps spread over remote workers     //
+//                                                        //
+//  --coordinate=<host:port> keeps the points of a sweep  //
+//  in a queue and their results in the --memo store,     //
+//  and --worker=<host:port> processes on any machine     //
+//  take points from it one at a time per thread and      //
+//  send each result back. A worker fetches the trace     //
+//  once and keeps it under its content hash. Workers     //
+//  may join or leave at any time: the point a worker     //
+//  held when it left is queued again                     //
+//========================================================//
+
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "predictor.h"
+
+// A worker connection is lines over TCP. It opens with
+//  HELLO <build id>    answered OK, or NO <reason> for another build
+// and then sends any of
+//  NEXT                answered JOB <task> <hash> <suffix> <start>
+//                      <warmup> <count> <type> <configuration>, WAIT
+//                      while every point left is with a worker, or DONE
+//  TRACE <hash>        answered DATA <bytes> and the trace file's
+//                      bytes, or NO <reason>
+//  RESULT <task> <branches> <mispredictions> <records> <runtime_ns> <memory>
+//  FAIL <task> <reason>  the point is left to the coordinator's sweep
+// A task is the point's index in the coordinator's queue, the
+// configuration is as predictor_config_format writes it, and the
+// suffix is "." and the extension of the trace's name or "-"
+#define CLUSTER_LINE_MAX 4096
+#define CLUSTER_BACKLOG 64
+
+// Milliseconds a worker told to WAIT sleeps before asking again, and
+// seconds it keeps trying to reach a coordinator not yet listening
+#define CLUSTER_WAIT_MS 500
+#define CLUSTER_CONNECT_SECONDS 60
+
+// Directory under $TMPDIR, or /tmp, of the traces a worker fetched,
+// when --worker-dir is not given
+#define CLUSTER_TRACE_DIR "bpworker"
+
+typedef struct
+{
+  const char *address;    // [host]:port to listen on
+  const char *trace_path; // the trace file of the sweep
+  const char *scope;      // its memo_scope over the window
+  uint64_t start, warmup, count;
+  const predictor_config_t *cfgs; // the points, see sweep_configs
+  size_t n;
+} cluster_coordinator_t;
+
+// Queue the points of cfg->cfgs the --memo store does not hold over
+// cfg->scope, hand them to the workers connecting to cfg->address and
+// store each result they send, until every point has a result or
+// failed. The listener keeps answering DONE afterwards
+//
+// Returns True if Successful, False if the socket can not be set up
+//
+int cluster_coordinate(const cluster_coordinator_t *cfg);
+
+typedef struct
+{
+  const char *address;   // host:port of the coordinator
+  int jobs;              // connections, one point each, 0 for one per core
+  const char *trace_dir; // fetched traces, NULL for CLUSTER_TRACE_DIR
+  const char *cache_dir; // see tracecache.h, NULL or "" for none
+} cluster_worker_t;
+
+// Replay the points of the coordinator at cfg->address on cfg->jobs
+// connections until it has none left or goes away
+//
+// Returns True if Successful, False if it can not be reached or is of
+// another build
+//
+int cluster_work(const cluster_worker_t *cfg);
+
+#endif
@@ -0,0 +1,305 @@
+//========================================================//
+//  codec.cpp                                             //
+//  Source file for the frame compression codecs          //
+//                                                        //
+//  Only stable one-shot and dictionary entry points of   //
+//  libzstd and liblz4 are used, resolved with dlsym      //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <mutex>
+#include "codec.h"
+
+typedef size_t (*zstd_compress_fn)(void *, size_t, const void *, size_t, int);
+typedef size_t (*zstd_decompress_fn)(void *, size_t, const void *, size_t);
+typedef size_t (*zstd_bound_fn)(size_t);
+typedef unsigned (*zstd_iserror_fn)(size_t);
+typedef void *(*zstd_create_fn)();
+typedef size_t (*zstd_free_fn)(void *);
+typedef void *(*zstd_create_cdict_fn)(const void *, size_t, int);
+typedef void *(*zstd_create_ddict_fn)(const void *, size_t);
+typedef size_t (*zstd_compress_cctx_fn)(void *, void *, size_t, const void *, size_t, int);
+typedef size_t (*zstd_decompress_dctx_fn)(void *, void *, size_t, const void *, size_t);
+typedef size_t (*zstd_compress_cdict_fn)(void *, void *, size_t, const void *, size_t, const void *);
+typedef size_t (*zstd_decompress_ddict_fn)(void *, void *, size_t, const void *, size_t, const void *);
+typedef size_t (*zdict_train_fn)(void *, size_t, const void *, const size_t *, unsigned);
+typedef int (*lz4_compress_fn)(const char *, char *, int, int, int);
+typedef int (*lz4_decompress_fn)(const char *, char *, int, int);
+typedef int (*lz4_bound_fn)(int);
+
+static struct
+{
+  int loaded[3];
+  zstd_compress_fn zstd_compress;
+  zstd_decompress_fn zstd_decompress;
+  zstd_bound_fn zstd_bound;
+  zstd_iserror_fn zstd_iserror;
+  int dict_loaded;
+  zstd_create_fn create_cctx, create_dctx;
+  zstd_free_fn free_cctx, free_dctx, free_cdict, free_ddict;
+  zstd_create_cdict_fn create_cdict;
+  zstd_create_ddict_fn create_ddict;
+  zstd_compress_cctx_fn compress_cctx;
+  zstd_decompress_dctx_fn decompress_dctx;
+  zstd_compress_cdict_fn compress_cdict;
+  zstd_decompress_ddict_fn decompress_ddict;
+  zdict_train_fn zdict_train;
+  zstd_iserror_fn zdict_iserror;
+  lz4_compress_fn lz4_compress;
+  lz4_decompress_fn lz4_decompress;
+  lz4_bound_fn lz4_bound;
+} codecs;
+
+static std::once_flag codecs_once;
+
+static void codec_load()
+{
+  codecs.loaded[CODEC_NONE] = 1;
+
+  void *zstd = dlopen("libzstd.so.1", RTLD_NOW | RTLD_LOCAL);
+  if (zstd)
+  {
+    codecs.zstd_compress = (zstd_compress_fn)dlsym(zstd, "ZSTD_compress");
+    codecs.zstd_decompress = (zstd_decompress_fn)dlsym(zstd, "ZSTD_decompress");
+    codecs.zstd_bound = (zstd_bound_fn)dlsym(zstd, "ZSTD_compressBound");
+    codecs.zstd_iserror = (zstd_iserror_fn)dlsym(zstd, "ZSTD_isError");
+    codecs.loaded[CODEC_ZSTD] = codecs.zstd_compress && codecs.zstd_decompress &&
+                                codecs.zstd_bound && codecs.zstd_iserror;
+
+    // The dictionary entry points, stable since zstd 1.0
+    codecs.create_cctx = (zstd_create_fn)dlsym(zstd, "ZSTD_createCCtx");
+    codecs.create_dctx = (zstd_create_fn)dlsym(zstd, "ZSTD_createDCtx");
+    codecs.free_cctx = (zstd_free_fn)dlsym(zstd, "ZSTD_freeCCtx");
+    codecs.free_dctx = (zstd_free_fn)dlsym(zstd, "ZSTD_freeDCtx");
+    codecs.free_cdict = (zstd_free_fn)dlsym(zstd, "ZSTD_freeCDict");
+    codecs.free_ddict = (zstd_free_fn)dlsym(zstd, "ZSTD_freeDDict");
+    codecs.create_cdict = (zstd_create_cdict_fn)dlsym(zstd, "ZSTD_createCDict");
+    codecs.create_ddict = (zstd_create_ddict_fn)dlsym(zstd, "ZSTD_createDDict");
+    codecs.compress_cctx = (zstd_compress_cctx_fn)dlsym(zstd, "ZSTD_compressCCtx");
+    codecs.decompress_dctx = (zstd_decompress_dctx_fn)dlsym(zstd, "ZSTD_decompressDCtx");
+    codecs.compress_cdict = (zstd_compress_cdict_fn)dlsym(zstd, "ZSTD_compress_usingCDict");
+    codecs.decompress_ddict = (zstd_decompress_ddict_fn)dlsym(zstd, "ZSTD_decompress_usingDDict");
+    codecs.zdict_train = (zdict_train_fn)dlsym(zstd, "ZDICT_trainFromBuffer");
+    codecs.zdict_iserror = (zstd_iserror_fn)dlsym(zstd, "ZDICT_isError");
+    codecs.dict_loaded = codecs.loaded[CODEC_ZSTD] && codecs.create_cctx && codecs.create_dctx && codecs.free_cctx &&
+                         codecs.free_dctx && codecs.free_cdict && codecs.free_ddict && codecs.create_cdict &&
+                         codecs.create_ddict && codecs.compress_cctx && codecs.decompress_dctx &&
+                         codecs.compress_cdict && codecs.decompress_ddict;
+  }
+
+  void *lz4 = dlopen("liblz4.so.1", RTLD_NOW | RTLD_LOCAL);
+  if (lz4)
+  {
+    codecs.lz4_compress = (lz4_compress_fn)dlsym(lz4, "LZ4_compress_fast");
+    codecs.lz4_decompress = (lz4_decompress_fn)dlsym(lz4, "LZ4_decompress_safe");
+    codecs.lz4_bound = (lz4_bound_fn)dlsym(lz4, "LZ4_compressBound");
+    codecs.loaded[CODEC_LZ4] = codecs.lz4_compress && codecs.lz4_decompress && codecs.lz4_bound;
+  }
+}
+
+int codec_by_name(const char *name)
+{
+  if (!strcmp(name, "none"))
+  {
+    return CODEC_NONE;
+  }
+  else if (!strcmp(name, "zstd"))
+  {
+    return CODEC_ZSTD;
+  }
+  else if (!strcmp(name, "lz4"))
+  {
+    return CODEC_LZ4;
+  }
+  return -1;
+}
+
+const char *codec_name(int codec)
+{
+  static const char *names[3] = {"none", "zstd", "lz4"};
+  return (codec >= 0 && codec < 3) ? names[codec] : "unknown";
+}
+
+int codec_available(int codec)
+{
+  std::call_once(codecs_once, codec_load);
+  return codec >= 0 && codec < 3 && codecs.loaded[codec];
+}
+
+size_t codec_bound(int codec, size_t len)
+{
+  if (!codec_available(codec))
+  {
+    return 0;
+  }
+  switch (codec)
+  {
+  case CODEC_ZSTD:
+    return codecs.zstd_bound(len);
+  case CODEC_LZ4:
+    return codecs.lz4_bound((int)len);
+  default:
+    return len;
+  }
+}
+
+size_t codec_compress(int codec, char *dst, size_t cap, const char *src, size_t len, int level)
+{
+  if (!codec_available(codec))
+  {
+    return 0;
+  }
+  switch (codec)
+  {
+  case CODEC_ZSTD:
+  {
+    size_t n = codecs.zstd_compress(dst, cap, src, len, level);
+    return codecs.zstd_iserror(n) ? 0 : n;
+  }
+  case CODEC_LZ4:
+  {
+    int n = codecs.lz4_compress(src, dst, (int)len, (int)cap, level > 0 ? 1 : -level);
+    return n > 0 ? (size_t)n : 0;
+  }
+  default:
+    if (len > cap)
+    {
+      return 0;
+    }
+    memcpy(dst, src, len);
+    return len;
+  }
+}
+
+size_t codec_decompress(int codec, char *dst, size_t cap, const char *src, size_t comp_len)
+{
+  if (!codec_available(codec))
+  {
+    return 0;
+  }
+  switch (codec)
+  {
+  case CODEC_ZSTD:
+  {
+    size_t n = codecs.zstd_decompress(dst, cap, src, comp_len);
+    return codecs.zstd_iserror(n) ? 0 : n;
+  }
+  case CODEC_LZ4:
+  {
+    int n = codecs.lz4_decompress(src, dst, (int)comp_len, (int)cap);
+    return n > 0 ? (size_t)n : 0;
+  }
+  default:
+    if (comp_len > cap)
+    {
+      return 0;
+    }
+    memcpy(dst, src, comp_len);
+    return comp_len;
+  }
+}
+
+struct codec_dict
+{
+  char *dict;
+  size_t len;
+  int level;
+  void *cctx, *dctx;
+  void *cdict, *ddict; // digested on first use
+};
+
+size_t codec_dict_train(char *dict, size_t cap, const char *samples, const size_t *sizes, unsigned n)
+{
+  if (!codec_available(CODEC_ZSTD) || !codecs.zdict_train || !codecs.zdict_iserror)
+  {
+    return 0;
+  }
+  size_t len = codecs.zdict_train(dict, cap, samples, sizes, n);
+  return codecs.zdict_iserror(len) ? 0 : len;
+}
+
+codec_dict_t *codec_dict_open(const char *dict, size_t len, int level)
+{
+  if (!codec_available(CODEC_ZSTD) || !codecs.dict_loaded)
+  {
+    return NULL;
+  }
+  codec_dict_t *d = (codec_dict_t *)calloc(1, sizeof(codec_dict_t));
+  d->dict = (char *)malloc(len + 1);
+  if (!d->dict)
+  {
+    fprintf(stderr, "Error: codec dictionary malloc failed\n");
+    exit(1);
+  }
+  memcpy(d->dict, dict, len);
+  d->len = len;
+  d->level = level;
+  return d;
+}
+
+size_t codec_dict_compress(codec_dict_t *d, char *dst, size_t cap, const char *src, size_t len)
+{
+  if (!d->cctx)
+  {
+    d->cctx = codecs.create_cctx();
+  }
+  if (d->len && !d->cdict)
+  {
+    d->cdict = codecs.create_cdict(d->dict, d->len, d->level);
+  }
+  if (!d->cctx || (d->len && !d->cdict))
+  {
+    return 0;
+  }
+  size_t n = d->len ? codecs.compress_cdict(d->cctx, dst, cap, src, len, d->cdict)
+                    : codecs.compress_cctx(d->cctx, dst, cap, src, len, d->level);
+  return codecs.zstd_iserror(n) ? 0 : n;
+}
+
+size_t codec_dict_decompress(codec_dict_t *d, char *dst, size_t cap, const char *src, size_t comp_len)
+{
+  if (!d->dctx)
+  {
+    d->dctx = codecs.create_dctx();
+  }
+  if (d->len && !d->ddict)
+  {
+    d->ddict = codecs.create_ddict(d->dict, d->len);
+  }
+  if (!d->dctx || (d->len && !d->ddict))
+  {
+    return 0;
+  }
+  size_t n = d->len ? codecs.decompress_ddict(d->dctx, dst, cap, src, comp_len, d->ddict)
+                    : codecs.decompress_dctx(d->dctx, dst, cap, src, comp_len);
+  return codecs.zstd_iserror(n) ? 0 : n;
+}
+
+void codec_dict_close(codec_dict_t *d)
+{
+  if (!d)
+  {
+    return;
+  }
+  if (d->cctx)
+  {
+    codecs.free_cctx(d->cctx);
+  }
+  if (d->dctx)
+  {
+    codecs.free_dctx(d->dctx);
+  }
+  if (d->cdict)
+  {
+    codecs.free_cdict(d->cdict);
+  }
+  if (d->ddict)
+  {
+    codecs.free_ddict(d->ddict);
+  }
+  free(d->dict);
+  free(d);
+}
@@ -0,0 +1,77 @@
+//========================================================//
+//  codec.h                                               //
+//  Header file for the frame compression codecs          //
+//                                                        //
+//  zstd and LZ4 are loaded from the system libraries at  //
+//  run time, so the tools build without their headers    //
+//========================================================//
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+
+// Codec identifiers stored in framed traces
+#define CODEC_NONE 0
+#define CODEC_ZSTD 1
+#define CODEC_LZ4 2
+
+// Look up a codec by name ("none", "zstd", "lz4")
+//
+// Returns the codec id, -1 if unknown
+//
+int codec_by_name(const char *name);
+
+const char *codec_name(int codec);
+
+// Returns True if the codec's library could be loaded
+//
+int codec_available(int codec);
+
+// Upper bound of the compressed size of 'len' bytes
+//
+size_t codec_bound(int codec, size_t len);
+
+// Compress 'len' bytes of 'src' into 'dst' of capacity 'cap'
+//
+// Returns the compressed size, 0 on failure
+//
+size_t codec_compress(int codec, char *dst, size_t cap, const char *src, size_t len, int level);
+
+// Decompress 'comp_len' bytes into 'dst' of capacity 'cap'
+//
+// Returns the decompressed size, 0 on failure
+//
+size_t codec_decompress(int codec, char *dst, size_t cap, const char *src, size_t comp_len);
+
+// zstd with a dictionary trained on samples of many small inputs,
+// as the chunks of a trace archive are, see archive.h. A codec_dict_t
+// holds the contexts of one thread
+typedef struct codec_dict codec_dict_t;
+
+// Train a dictionary of up to 'cap' bytes into 'dict' on the 'n'
+// samples of 'sizes' bytes laid end to end in 'samples'
+//
+// Returns the dictionary size, 0 if zstd is missing or there are too
+// few samples to train on
+//
+size_t codec_dict_train(char *dict, size_t cap, const char *samples, const size_t *sizes, unsigned n);
+
+// Compress at 'level' and decompress with the 'len' bytes of 'dict',
+// copied; with 'len' 0 without a dictionary
+//
+// Returns NULL if zstd can not be loaded
+//
+codec_dict_t *codec_dict_open(const char *dict, size_t len, int level);
+
+// Returns the compressed size, 0 on failure
+//
+size_t codec_dict_compress(codec_dict_t *d, char *dst, size_t cap, const char *src, size_t len);
+
+// Returns the decompressed size, 0 on failure
+//
+size_t codec_dict_decompress(codec_dict_t *d, char *dst, size_t cap, const char *src, size_t comp_len);
+
+void codec_dict_close(codec_dict_t *d);
+
+#endif
@@ -0,0 +1,187 @@
+//========================================================//
+//  columnar.cpp                                          //
+//  Source file for the columnar frame layout             //
+//                                                        //
+//  Layout: n, PC column bytes, target column bytes, the  //
+//  PC column, the target column, then flag plane b (one  //
+//  bit per record, n rounded up to 64 bits) for b=0..4.  //
+//  Deltas restart at every frame so frames decode        //
+//  independently.                                        //
+//========================================================//
+
+#include <string.h>
+#include "columnar.h"
+
+#define COLUMNAR_FLAG_BITS 5
+
+static inline size_t columnar_plane_words(size_t n)
+{
+  return (n + 63) / 64;
+}
+
+size_t columnar_bound(size_t n)
+{
+  return 12 + n * 10 + COLUMNAR_FLAG_BITS * columnar_plane_words(n) * 8;
+}
+
+static inline uint32_t zigzag(int32_t v)
+{
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline char *put_varint(char *p, uint32_t v)
+{
+  while (v >= 0x80)
+  {
+    *p++ = (char)(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (char)v;
+  return p;
+}
+
+// Decode one varint, NULL if it runs past 'end'
+//
+static inline const char *get_varint(const char *p, const char *end, uint32_t *v)
+{
+  uint32_t x = 0;
+  for (int shift = 0; p < end && shift < 35; shift += 7)
+  {
+    uint8_t b = (uint8_t)*p++;
+    x |= (uint32_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+    {
+      *v = x;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+size_t columnar_encode(const branch_record_t *recs, size_t n, char *out)
+{
+  uint32_t hdr[3] = {(uint32_t)n, 0, 0};
+  char *p = out + sizeof(hdr);
+
+  uint32_t prev = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    p = put_varint(p, zigzag((int32_t)(recs[i].pc - prev)));
+    prev = recs[i].pc;
+  }
+  hdr[1] = p - (out + sizeof(hdr));
+
+  char *t = p;
+  for (size_t i = 0; i < n; i++)
+  {
+    p = put_varint(p, zigzag((int32_t)(recs[i].target - recs[i].pc)));
+  }
+  hdr[2] = p - t;
+
+  size_t words = columnar_plane_words(n);
+  for (int b = 0; b < COLUMNAR_FLAG_BITS; b++)
+  {
+    for (size_t w = 0; w < words; w++)
+    {
+      uint64_t plane = 0;
+      size_t end = (w + 1) * 64 < n ? (w + 1) * 64 : n;
+      for (size_t i = w * 64; i < end; i++)
+      {
+        plane |= (uint64_t)((recs[i].flags >> b) & 1) << (i & 63);
+      }
+      memcpy(p, &plane, 8);
+      p += 8;
+    }
+  }
+
+  memcpy(out, hdr, sizeof(hdr));
+  return p - out;
+}
+
+// Decode up to COLUMNAR_BLOCK varints; one byte values, the common
+// case for loop code, take the straight path
+//
+static inline const char *columnar_block(const char *p, const char *end, uint32_t *v, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    if (p < end && !(*p & 0x80))
+    {
+      v[i] = (uint8_t)*p++;
+    }
+    else if (!(p = get_varint(p, end, &v[i])))
+    {
+      return NULL;
+    }
+  }
+  return p;
+}
+
+size_t columnar_decode(const char *in, size_t len, branch_record_t *recs, size_t max, uint32_t fields)
+{
+  uint32_t hdr[3];
+  if (len < sizeof(hdr))
+  {
+    return 0;
+  }
+  memcpy(hdr, in, sizeof(hdr));
+  size_t n = hdr[0];
+  size_t words = columnar_plane_words(n);
+  if (n > max || sizeof(hdr) + (size_t)hdr[1] + hdr[2] + COLUMNAR_FLAG_BITS * words * 8 > len)
+  {
+    return 0;
+  }
+  const char *pcs = in + sizeof(hdr);
+  const char *pcs_end = pcs + hdr[1];
+  const char *tgts = pcs_end;
+  const char *tgts_end = tgts + hdr[2];
+  const char *planes = tgts_end;
+
+  // Without the target its column is not walked at all
+  int targets = !!(fields & TRACE_FIELD_TARGET);
+  uint32_t keep = TRACE_F_TAKEN | TRACE_F_CONDITION | (fields & (TRACE_FIELD_CALL | TRACE_FIELD_RET | TRACE_FIELD_DIRECT));
+  uint32_t dpc[COLUMNAR_BLOCK];
+  uint32_t dtgt[COLUMNAR_BLOCK];
+  uint32_t pc = 0;
+  for (size_t base = 0; base < n; base += COLUMNAR_BLOCK)
+  {
+    size_t k = n - base < COLUMNAR_BLOCK ? n - base : COLUMNAR_BLOCK;
+    pcs = columnar_block(pcs, pcs_end, dpc, k);
+    if (targets)
+    {
+      tgts = columnar_block(tgts, tgts_end, dtgt, k);
+    }
+    if (!pcs || !tgts)
+    {
+      return 0;
+    }
+
+    // Flag planes for this block are one word each
+    uint64_t plane[COLUMNAR_FLAG_BITS];
+    for (int b = 0; b < COLUMNAR_FLAG_BITS; b++)
+    {
+      plane[b] = 0;
+      if (keep & (1u << b))
+      {
+        memcpy(&plane[b], planes + (b * words + base / 64) * 8, 8);
+      }
+    }
+
+    for (size_t i = 0; i < k; i++)
+    {
+      pc += (uint32_t)unzigzag(dpc[i]);
+      branch_record_t *rec = &recs[base + i];
+      rec->pc = pc;
+      rec->target = targets ? pc + (uint32_t)unzigzag(dtgt[i]) : 0;
+      rec->flags = (uint8_t)(((plane[0] >> i) & 1) | (((plane[1] >> i) & 1) << 1) |
+                             (((plane[2] >> i) & 1) << 2) | (((plane[3] >> i) & 1) << 3) |
+                             (((plane[4] >> i) & 1) << 4));
+    }
+  }
+  return n;
+}
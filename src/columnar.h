@@ -0,0 +1,38 @@
+//========================================================//
+//  columnar.h                                            //
+//  Header file for the columnar frame layout             //
+//                                                        //
+//  Stores a run of records as three columns: zig-zag     //
+//  varint PC deltas, zig-zag varint target-minus-PC      //
+//  offsets and five bit planes of flags                  //
+//========================================================//
+
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include <stddef.h>
+#include "trace.h"
+
+// Records decoded per column block
+#define COLUMNAR_BLOCK 64
+
+// Largest encoding of 'n' records
+//
+size_t columnar_bound(size_t n);
+
+// Encode 'n' records into 'out' of at least columnar_bound(n) bytes
+//
+// Returns the encoded size
+//
+size_t columnar_encode(const branch_record_t *recs, size_t n, char *out);
+
+// Decode an encoding of 'len' bytes into at most 'max' records, with
+// only the TRACE_FIELD_* 'fields' beyond the pc, the outcome and the
+// condition: the target column and the other flag planes are not
+// read, and the records hold 0 in their place
+//
+// Returns the number of records, 0 if the encoding is malformed
+//
+size_t columnar_decode(const char *in, size_t len, branch_record_t *recs, size_t max, uint32_t fields);
+
+#endif
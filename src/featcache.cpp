@@ -0,0 +1,195 @@
+//========================================================//
+//  featcache.cpp                                         //
+//  Source file for the derived feature cache             //
+//                                                        //
+//  A missing entry is computed in one pass over the      //
+//  records, written to a temporary file and renamed      //
+//  into place, so concurrent runs never see a partial    //
+//  one; the run that computed it keeps its own copy      //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "featcache.h"
+
+uint64_t featcache_key(const branch_record_t *recs, size_t n)
+{
+  // FNV-1a over 8-byte words, as the trace cache keys its entries
+  const char *data = (const char *)recs;
+  size_t len = n * sizeof(branch_record_t);
+  uint64_t h = 0xcbf29ce484222325ULL;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8)
+  {
+    uint64_t w;
+    memcpy(&w, data + i, 8);
+    h = (h ^ w) * 0x100000001b3ULL;
+  }
+  for (; i < len; i++)
+  {
+    h = (h ^ (uint8_t)data[i]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// Fill 'column' with the local histories of 'recs', as local_find
+// and local_push keep them with one way
+//
+template <class T>
+static void featcache_fill_local(const branch_record_t *recs, size_t n, int lht_bits, int hist_bits, T *column)
+{
+  T *table = (T *)calloc((size_t)1 << lht_bits, sizeof(T));
+  if (!table)
+  {
+    fprintf(stderr, "Error: feature cache malloc failed\n");
+    exit(1);
+  }
+  uint32_t mask = (1u << lht_bits) - 1;
+  uint32_t hist_mask = (1u << hist_bits) - 1;
+  for (size_t i = 0; i < n; i++)
+  {
+    T *slot = &table[recs[i].pc & mask];
+    T hist = *slot;
+    column[i] = hist;
+    if (recs[i].flags & TRACE_F_CONDITION)
+    {
+      *slot = ((hist << 1) | (recs[i].flags & TRACE_F_TAKEN)) & hist_mask;
+    }
+  }
+  free(table);
+}
+
+// Map the entry at 'path' if it holds the histories asked for
+//
+// Returns True if Successful
+//
+static int featcache_map(const char *path, size_t n, int lht_bits, int hist_bits, featcache_column_t *col)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  struct stat st;
+  size_t len = sizeof(featcache_header_t) + n * col->entry;
+  if (fstat(fd, &st) || (size_t)st.st_size != len)
+  {
+    close(fd);
+    return 0;
+  }
+  void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    return 0;
+  }
+  const featcache_header_t *hdr = (const featcache_header_t *)map;
+  if (strcmp(hdr->magic, FEATCACHE_MAGIC) || hdr->version != FEATCACHE_VERSION || hdr->entry != col->entry ||
+      hdr->records != n || hdr->lht_bits != (uint32_t)lht_bits || hdr->hist_bits != (uint32_t)hist_bits)
+  {
+    munmap(map, len);
+    return 0;
+  }
+  col->map = map;
+  col->len = len;
+  col->column = (const char *)map + sizeof(featcache_header_t);
+  return 1;
+}
+
+// Write 'col', computed in memory, to the entry at 'path'
+//
+// Returns True if Successful
+//
+static int featcache_store(const char *path, size_t n, int lht_bits, int hist_bits, const featcache_column_t *col)
+{
+  size_t len = strlen(path) + 32;
+  char *tmp = (char *)malloc(len);
+  snprintf(tmp, len, "%s.tmp.%d", path, (int)getpid());
+  FILE *out = fopen(tmp, "wb");
+  if (!out)
+  {
+    free(tmp);
+    return 0;
+  }
+  featcache_header_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  strcpy(hdr.magic, FEATCACHE_MAGIC);
+  hdr.version = FEATCACHE_VERSION;
+  hdr.entry = col->entry;
+  hdr.records = n;
+  hdr.lht_bits = lht_bits;
+  hdr.hist_bits = hist_bits;
+  int ok = fwrite(&hdr, sizeof(hdr), 1, out) == 1 && fwrite(col->column, col->entry, n, out) == n;
+  ok = fclose(out) == 0 && ok;
+  ok = ok && rename(tmp, path) == 0;
+  if (!ok)
+  {
+    remove(tmp);
+  }
+  free(tmp);
+  return ok;
+}
+
+int featcache_local(const char *dir, uint64_t key, const branch_record_t *recs, size_t n, int lht_bits,
+                    int hist_bits, featcache_column_t *col)
+{
+  col->entry = hist_bits <= 8 ? 1 : hist_bits <= 16 ? 2 : 4;
+  col->map = NULL;
+  size_t len = strlen(dir) + 96;
+  char *path = (char *)malloc(len);
+  snprintf(path, len, "%s/%016llx-%llu.local%dx%d", dir, (unsigned long long)key, (unsigned long long)n, lht_bits,
+           hist_bits);
+  if (featcache_map(path, n, lht_bits, hist_bits, col))
+  {
+    free(path);
+    return 1;
+  }
+
+  // Miss: compute it once for every run to map
+  void *column = malloc(n ? n * col->entry : 1);
+  if (!column)
+  {
+    free(path);
+    return 0;
+  }
+  if (col->entry == 1)
+  {
+    featcache_fill_local(recs, n, lht_bits, hist_bits, (uint8_t *)column);
+  }
+  else if (col->entry == 2)
+  {
+    featcache_fill_local(recs, n, lht_bits, hist_bits, (uint16_t *)column);
+  }
+  else
+  {
+    featcache_fill_local(recs, n, lht_bits, hist_bits, (uint32_t *)column);
+  }
+  col->column = column;
+  col->len = 0;
+  mkdir(dir, 0777);
+  if (!featcache_store(path, n, lht_bits, hist_bits, col))
+  {
+    fprintf(stderr, "Warning: can not write feature cache entry %s (%s)\n", path, strerror(errno));
+  }
+  free(path);
+  return 1;
+}
+
+void featcache_release(featcache_column_t *col)
+{
+  if (col->len)
+  {
+    munmap(col->map, col->len);
+  }
+  else
+  {
+    free((void *)col->column);
+  }
+  col->column = col->map = NULL;
+}
@@ -0,0 +1,58 @@
+//========================================================//
+//  featcache.h                                           //
+//  Header file for the derived feature cache             //
+//                                                        //
+//  Streams that depend on the records alone, such as     //
+//  the local history each branch finds in a direct-      //
+//  mapped table, computed once into the cache directory  //
+//  and mapped by every sweep point that reads them       //
+//========================================================//
+
+#ifndef FEATCACHE_H
+#define FEATCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "trace.h"
+
+// An entry is a featcache_header_t then one column entry per record,
+// named "<key>-<records>.local<lhtBits>x<histBits>" after the records
+// it was computed from
+#define FEATCACHE_MAGIC "BPFEAT"
+#define FEATCACHE_VERSION 1
+
+typedef struct
+{
+  char magic[8];     // FEATCACHE_MAGIC
+  uint32_t version;  // FEATCACHE_VERSION
+  uint32_t entry;    // bytes per record, 1, 2 or 4
+  uint64_t records;
+  uint32_t lht_bits;
+  uint32_t hist_bits;
+} featcache_header_t;
+
+typedef struct
+{
+  const void *column; // one entry per record
+  size_t entry;       // its bytes, the narrowest holding the histories
+  void *map;          // the mapped entry, NULL when computed in memory
+  size_t len;         // of the mapping
+} featcache_column_t;
+
+// Key of the 'n' records 'recs', a hash of their bytes
+//
+uint64_t featcache_key(const branch_record_t *recs, size_t n);
+
+// The local history before each of the 'n' records 'recs', of key
+// 'key', in a table of 1 << 'lht_bits' histories of 'hist_bits' bits
+// indexed by the low PC bits, all starting at 0, into 'col'. It is
+// mapped from 'dir' or computed and written there first
+//
+// Returns True if Successful
+//
+int featcache_local(const char *dir, uint64_t key, const branch_record_t *recs, size_t n, int lht_bits,
+                    int hist_bits, featcache_column_t *col);
+
+void featcache_release(featcache_column_t *col);
+
+#endif
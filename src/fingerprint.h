@@ -0,0 +1,98 @@
+//========================================================//
+//  fingerprint.h                                         //
+//  Header file for prediction stream fingerprints        //
+//                                                        //
+//  A 64-bit hash of every prediction of a run, one bit   //
+//  per conditional branch, mixed in a word of 64         //
+//  predictions at a time. Two builds with the same       //
+//  fingerprint on a trace predicted it bit for bit the   //
+//  same                                                  //
+//========================================================//
+
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "predictor.h"
+
+typedef struct
+{
+  uint64_t hash;
+  uint64_t word; // the predictions past the last full word
+  uint64_t bits; // predictions added
+} fingerprint_t;
+
+static inline void fingerprint_init(fingerprint_t *f)
+{
+  f->hash = 0x9E3779B97F4A7C15ULL;
+  f->word = 0;
+  f->bits = 0;
+}
+
+static inline uint64_t fingerprint_mix(uint64_t h, uint64_t w)
+{
+  h ^= w * 0x87C37B91114253D5ULL;
+  h = (h << 31) | (h >> 33);
+  return h * 0x4CF5AD432745937FULL;
+}
+
+// Append the low 'k' predictions of 'w', 0 < k <= 64
+static inline void fingerprint_push(fingerprint_t *f, uint64_t w, unsigned k)
+{
+  unsigned used = f->bits & 63;
+  f->bits += k;
+  w = k < 64 ? w & ((1ULL << k) - 1) : w;
+  f->word |= w << used;
+  if (used + k >= 64)
+  {
+    f->hash = fingerprint_mix(f->hash, f->word);
+    f->word = used ? w >> (64 - used) : 0;
+  }
+}
+
+// Add the predictions of the conditional branches of the 'n' records
+// 'br', from their bitmap as predictor_predict_batch sets it. The bits
+// of the other records are dropped before mixing, so the fingerprint
+// depends neither on how the records are cut into batches nor on the
+// unconditional branches a trace keeps
+static inline void fingerprint_add(fingerprint_t *f, const predictor_branch_t *br, const uint64_t *predictions,
+                                   size_t n)
+{
+  for (size_t i = 0; i < n; i += 64)
+  {
+    size_t k = n - i < 64 ? n - i : 64;
+    uint64_t w = predictions[i / 64], m = 0;
+    for (size_t j = 0; j < k; j++)
+    {
+      m |= (uint64_t)(br[i + j].flags >> 1 & 1) << j;
+    }
+    unsigned c = (unsigned)k;
+    if (m != ~0ULL >> (64 - k))
+    {
+      // gather the conditional records' bits at the bottom
+      uint64_t packed = 0;
+      for (c = 0; m; m &= m - 1)
+      {
+        packed |= (w >> __builtin_ctzll(m) & 1) << c++;
+      }
+      w = packed;
+    }
+    if (c)
+    {
+      fingerprint_push(f, w, c);
+    }
+  }
+}
+
+// The fingerprint of the predictions added so far
+static inline uint64_t fingerprint_value(const fingerprint_t *f)
+{
+  uint64_t h = fingerprint_mix(f->hash, f->word) ^ f->bits;
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  return h;
+}
+
+#endif
@@ -0,0 +1,25 @@
+//========================================================//
+//  foldhist.h                                            //
+//  Header file for folded global histories               //
+//                                                        //
+//  A history of L bits XOR folded down to W bits, kept   //
+//  up to date one bit at a time, as the TAGE tables and  //
+//  the ITTAGE of the front end model index and tag by    //
+//========================================================//
+
+#ifndef FOLDHIST_H
+#define FOLDHIST_H
+
+#include <stdint.h>
+
+// Shift 'in' into a history folded to 'width' bits and take out
+// 'out', the bit leaving its window of L bits, at 'outpoint', L % width
+static inline uint32_t fold_push(uint32_t folded, uint8_t in, uint8_t out, int outpoint, int width)
+{
+  folded = (folded << 1) ^ in;
+  folded ^= (uint32_t)out << outpoint;
+  folded ^= folded >> width;
+  return folded & ((1u << width) - 1);
+}
+
+#endif
@@ -0,0 +1,472 @@
+//========================================================//
+//  foreign.cpp                                           //
+//  Source file for the readers of other trace formats    //
+//========================================================//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "foreign.h"
+
+// Bytes of the trace held at a time
+#define FOREIGN_BUF_SIZE (1 << 20)
+
+//------------------------------------//
+//          ChampSim Format           //
+//------------------------------------//
+
+typedef struct __attribute__((packed))
+{
+  uint64_t ip;
+  uint8_t is_branch;
+  uint8_t branch_taken;
+  uint8_t destination_registers[2];
+  uint8_t source_registers[4];
+  uint64_t destination_memory[2];
+  uint64_t source_memory[4];
+} champsim_instr_t;
+
+// Registers ChampSim infers the branch type from
+#define CHAMPSIM_REG_SP 6
+#define CHAMPSIM_REG_FLAGS 25
+#define CHAMPSIM_REG_IP 26
+
+//------------------------------------//
+//            BT9 Format              //
+//------------------------------------//
+
+#define BT9_MAGIC "BT9_SPA_TRACE_FORMAT"
+
+#define BT9_HEADER 0
+#define BT9_NODES 1
+#define BT9_EDGES 2
+#define BT9_SEQUENCE 3
+#define BT9_DONE 4
+
+typedef struct
+{
+  uint32_t pc;
+  uint8_t flags; // TRACE_F_* but TRACE_F_TAKEN
+  uint8_t branch; // has a branch class, unlike the start node
+} bt9_node_t;
+
+typedef struct
+{
+  branch_record_t rec;
+  uint8_t branch;
+} bt9_edge_t;
+
+struct foreign
+{
+  int kind;
+  foreign_read_fn read;
+  void *ctx;
+
+  // Window of undecoded bytes: the head handed in, then buf
+  const char *data;
+  size_t pos;
+  size_t len;
+  char *buf;
+  int eof;
+
+  // ChampSim: the last branch, waiting for the next instruction's ip
+  // as its target
+  int pending;
+  branch_record_t pending_rec;
+
+  // BT9
+  int section;
+  std::vector<bt9_node_t> nodes;
+  std::vector<bt9_edge_t> edges;
+};
+
+int foreign_detect(const char *path, const char *head, size_t len)
+{
+  if (len >= sizeof(BT9_MAGIC) - 1 && !memcmp(head, BT9_MAGIC, sizeof(BT9_MAGIC) - 1))
+  {
+    return FOREIGN_BT9;
+  }
+  if (path && strstr(path, ".champsimtrace"))
+  {
+    return FOREIGN_CHAMPSIM;
+  }
+  return FOREIGN_NONE;
+}
+
+const char *foreign_name(int kind)
+{
+  return kind == FOREIGN_CHAMPSIM ? "ChampSim" : kind == FOREIGN_BT9 ? "BT9" : "none";
+}
+
+foreign_t *foreign_open(int kind, const char *head, size_t len, foreign_read_fn read, void *ctx)
+{
+  foreign_t *f = new foreign_t();
+  f->kind = kind;
+  f->read = read;
+  f->ctx = ctx;
+  f->buf = (char *)malloc(FOREIGN_BUF_SIZE);
+  if (!f->buf)
+  {
+    fprintf(stderr, "Error: trace buffer malloc failed\n");
+    exit(1);
+  }
+  f->data = head;
+  f->len = len;
+  if (len <= FOREIGN_BUF_SIZE)
+  {
+    memcpy(f->buf, head, len);
+    f->data = f->buf;
+  }
+  return f;
+}
+
+// Make at least 'need' bytes, at most FOREIGN_BUF_SIZE, contiguous in
+// the window, moving from the head to buf once it runs short
+//
+// Returns the number of bytes available
+//
+static size_t foreign_fill(foreign_t *f, size_t need)
+{
+  size_t avail = f->len - f->pos;
+  if (avail >= need || f->eof || avail > FOREIGN_BUF_SIZE)
+  {
+    return avail;
+  }
+  memmove(f->buf, f->data + f->pos, avail);
+  f->data = f->buf;
+  f->pos = 0;
+  f->len = avail;
+  while (f->len < FOREIGN_BUF_SIZE && !f->eof)
+  {
+    size_t n = f->read ? f->read(f->ctx, f->buf + f->len, FOREIGN_BUF_SIZE - f->len) : 0;
+    f->eof = n == 0;
+    f->len += n;
+  }
+  return f->len;
+}
+
+// Branch flags of a ChampSim instruction from the registers it reads
+// and writes, as ChampSim itself classifies it
+//
+// Returns False if it is not a branch
+//
+static int champsim_classify(const champsim_instr_t *in, uint8_t *flags)
+{
+  int writes_sp = 0, writes_ip = 0, reads_sp = 0, reads_flags = 0, reads_ip = 0, reads_other = 0;
+  for (int i = 0; i < 2; i++)
+  {
+    writes_sp |= in->destination_registers[i] == CHAMPSIM_REG_SP;
+    writes_ip |= in->destination_registers[i] == CHAMPSIM_REG_IP;
+  }
+  for (int i = 0; i < 4; i++)
+  {
+    uint8_t r = in->source_registers[i];
+    reads_sp |= r == CHAMPSIM_REG_SP;
+    reads_flags |= r == CHAMPSIM_REG_FLAGS;
+    reads_ip |= r == CHAMPSIM_REG_IP;
+    reads_other |= r && r != CHAMPSIM_REG_SP && r != CHAMPSIM_REG_FLAGS && r != CHAMPSIM_REG_IP;
+  }
+  if (!in->is_branch || !writes_ip)
+  {
+    return 0;
+  }
+  if (!reads_sp && !reads_flags && !reads_other)
+  {
+    *flags = TRACE_F_DIRECT; // direct jump
+  }
+  else if (!reads_sp && !reads_flags)
+  {
+    *flags = 0; // indirect jump
+  }
+  else if (!reads_sp && reads_ip && !writes_sp && reads_flags && !reads_other)
+  {
+    *flags = TRACE_F_CONDITION | TRACE_F_DIRECT;
+  }
+  else if (reads_sp && reads_ip && writes_sp && !reads_flags)
+  {
+    *flags = TRACE_F_CALL | (reads_other ? 0 : TRACE_F_DIRECT);
+  }
+  else if (reads_sp && !reads_ip && writes_sp)
+  {
+    *flags = TRACE_F_RET;
+  }
+  else
+  {
+    *flags = 0; // other, taken as an indirect jump
+  }
+  return 1;
+}
+
+static size_t foreign_read_champsim(foreign_t *f, branch_record_t *recs, size_t max)
+{
+  size_t out = 0;
+  while (out < max)
+  {
+    if (foreign_fill(f, sizeof(champsim_instr_t)) < sizeof(champsim_instr_t))
+    {
+      // the last branch has no next instruction to give its target
+      if (f->pending)
+      {
+        f->pending = 0;
+        recs[out++] = f->pending_rec;
+      }
+      break;
+    }
+    const char *p = f->data + f->pos;
+    size_t n = (f->len - f->pos) / sizeof(champsim_instr_t);
+    size_t i = 0;
+    for (; i < n && out < max; i++, p += sizeof(champsim_instr_t))
+    {
+      champsim_instr_t in;
+      memcpy(&in, p, sizeof(in));
+      if (f->pending)
+      {
+        f->pending = 0;
+        if (f->pending_rec.flags & TRACE_F_TAKEN)
+        {
+          f->pending_rec.target = (uint32_t)in.ip;
+        }
+        recs[out++] = f->pending_rec;
+        if (out == max)
+        {
+          // hand this instruction over to the next call
+          break;
+        }
+      }
+      uint8_t flags;
+      if (champsim_classify(&in, &flags))
+      {
+        int taken = !(flags & TRACE_F_CONDITION) || in.branch_taken;
+        f->pending = 1;
+        f->pending_rec.pc = (uint32_t)in.ip;
+        f->pending_rec.target = 0;
+        f->pending_rec.flags = flags | (taken ? TRACE_F_TAKEN : 0);
+      }
+    }
+    f->pos += i * sizeof(champsim_instr_t);
+  }
+  return out;
+}
+
+// Next line of a BT9 trace without its newline, NULL at the end
+//
+static const char *bt9_next_line(foreign_t *f, const char **end)
+{
+  for (;;)
+  {
+    const char *p = f->data + f->pos;
+    const char *nl = (const char *)memchr(p, '\n', f->len - f->pos);
+    if (nl || f->eof)
+    {
+      if (!nl && f->pos == f->len)
+      {
+        return NULL;
+      }
+      *end = nl ? nl : f->data + f->len;
+      f->pos = *end - f->data + (nl != NULL);
+      return p;
+    }
+    size_t before = f->len - f->pos;
+    if (foreign_fill(f, before + 1) <= before && before >= FOREIGN_BUF_SIZE)
+    {
+      fprintf(stderr, "Error: BT9 line longer than %d bytes\n", FOREIGN_BUF_SIZE);
+      exit(1);
+    }
+  }
+}
+
+// Split a line at white space into at most 'max' tokens
+//
+// Returns the number of tokens
+//
+static int bt9_tokens(const char *p, const char *end, const char **tok, size_t *tok_len, int max)
+{
+  int n = 0;
+  while (p < end && n < max)
+  {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+    {
+      p++;
+    }
+    const char *start = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+    {
+      p++;
+    }
+    if (p > start)
+    {
+      tok[n] = start;
+      tok_len[n++] = p - start;
+    }
+  }
+  return n;
+}
+
+static int bt9_is(const char *tok, size_t len, const char *word)
+{
+  return len == strlen(word) && !memcmp(tok, word, len);
+}
+
+static uint64_t bt9_number(const char *tok, size_t len)
+{
+  char num[32];
+  if (len >= sizeof(num))
+  {
+    len = sizeof(num) - 1;
+  }
+  memcpy(num, tok, len);
+  num[len] = '\0';
+  return strtoull(num, NULL, 0);
+}
+
+// Whether the branch class token 'cls', e.g. JMP+DIR+CND, has 'part'
+//
+static int bt9_class_has(const char *cls, size_t len, const char *part)
+{
+  size_t n = strlen(part);
+  for (size_t i = 0; i + n <= len; i++)
+  {
+    if (!memcmp(cls + i, part, n) && (i + n == len || cls[i + n] == '+') && (i == 0 || cls[i - 1] == '+'))
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Read the node and edge tables, up to the edge sequence
+//
+static void bt9_read_tables(foreign_t *f)
+{
+  const char *tok[16];
+  size_t tok_len[16];
+  const char *p, *end;
+  while (f->section != BT9_SEQUENCE && (p = bt9_next_line(f, &end)))
+  {
+    int n = bt9_tokens(p, end, tok, tok_len, 16);
+    if (n == 0 || tok[0][0] == '#')
+    {
+      continue;
+    }
+    if (bt9_is(tok[0], tok_len[0], "BT9_NODES"))
+    {
+      f->section = BT9_NODES;
+    }
+    else if (bt9_is(tok[0], tok_len[0], "BT9_EDGES"))
+    {
+      f->section = BT9_EDGES;
+    }
+    else if (bt9_is(tok[0], tok_len[0], "BT9_EDGE_SEQUENCE"))
+    {
+      f->section = BT9_SEQUENCE;
+    }
+    else if (f->section == BT9_NODES && bt9_is(tok[0], tok_len[0], "NODE") && n >= 3)
+    {
+      // NODE id virtual_address physical_address opcode size class: <class>
+      uint64_t id = bt9_number(tok[1], tok_len[1]);
+      if (id >= f->nodes.size())
+      {
+        f->nodes.resize(id + 1);
+      }
+      bt9_node_t *node = &f->nodes[id];
+      node->pc = (uint32_t)bt9_number(tok[2], tok_len[2]);
+      for (int i = 3; i + 1 < n; i++)
+      {
+        if (bt9_is(tok[i], tok_len[i], "class:"))
+        {
+          const char *cls = tok[i + 1];
+          size_t len = tok_len[i + 1];
+          node->branch = 1;
+          node->flags = (bt9_class_has(cls, len, "CND") ? TRACE_F_CONDITION : 0) |
+                        (bt9_class_has(cls, len, "CALL") ? TRACE_F_CALL : 0) |
+                        (bt9_class_has(cls, len, "RET") ? TRACE_F_RET : 0) |
+                        (bt9_class_has(cls, len, "DIR") ? TRACE_F_DIRECT : 0);
+        }
+      }
+    }
+    else if (f->section == BT9_EDGES && bt9_is(tok[0], tok_len[0], "EDGE") && n >= 6)
+    {
+      // EDGE id src_id dest_id taken br_virt_target br_phy_target inst_cnt
+      uint64_t id = bt9_number(tok[1], tok_len[1]);
+      uint64_t src = bt9_number(tok[2], tok_len[2]);
+      if (id >= f->edges.size())
+      {
+        f->edges.resize(id + 1);
+      }
+      bt9_edge_t *edge = &f->edges[id];
+      if (src < f->nodes.size() && f->nodes[src].branch)
+      {
+        int taken = tok[4][0] == 'T';
+        edge->branch = 1;
+        edge->rec.pc = f->nodes[src].pc;
+        edge->rec.target = (uint32_t)bt9_number(tok[5], tok_len[5]);
+        edge->rec.flags = f->nodes[src].flags | (taken ? TRACE_F_TAKEN : 0);
+      }
+    }
+  }
+  if (f->section != BT9_SEQUENCE)
+  {
+    fprintf(stderr, "Error: BT9 trace without an edge sequence\n");
+    exit(1);
+  }
+}
+
+static size_t foreign_read_bt9(foreign_t *f, branch_record_t *recs, size_t max)
+{
+  if (f->section < BT9_SEQUENCE)
+  {
+    bt9_read_tables(f);
+  }
+  size_t out = 0;
+  const char *p, *end;
+  while (out < max && f->section == BT9_SEQUENCE && (p = bt9_next_line(f, &end)))
+  {
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+      p++;
+    }
+    if (p == end || *p == '#' || *p == '\r')
+    {
+      continue;
+    }
+    if (*p < '0' || *p > '9')
+    {
+      // EOF
+      f->section = BT9_DONE;
+      break;
+    }
+    uint64_t id = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+      id = id * 10 + (*p - '0');
+    }
+    if (id >= f->edges.size())
+    {
+      fprintf(stderr, "Error: BT9 edge %llu is not in the edge table\n", (unsigned long long)id);
+      exit(1);
+    }
+    // the edge out of the start node is no branch
+    if (f->edges[id].branch)
+    {
+      recs[out++] = f->edges[id].rec;
+    }
+  }
+  return out;
+}
+
+size_t foreign_read(foreign_t *f, branch_record_t *recs, size_t max)
+{
+  return f->kind == FOREIGN_CHAMPSIM ? foreign_read_champsim(f, recs, max) : foreign_read_bt9(f, recs, max);
+}
+
+void foreign_close(foreign_t *f)
+{
+  if (!f)
+  {
+    return;
+  }
+  free(f->buf);
+  delete f;
+}
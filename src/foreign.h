@@ -0,0 +1,58 @@
+//========================================================//
+//  foreign.h                                             //
+//  Header file for the readers of other trace formats    //
+//                                                        //
+//  ChampSim instruction traces and CBP-2016 BT9 traces   //
+//  are decoded straight into branch records, so they     //
+//  are replayed without converting them first            //
+//========================================================//
+
+#ifndef FOREIGN_H
+#define FOREIGN_H
+
+#include <stddef.h>
+#include "trace.h"
+
+// Formats recognized by foreign_detect
+//  - champsim: 64-byte input_instr records of every instruction, no
+//    header; recognized by .champsimtrace in the file name
+//  - bt9: the text format of CBP-2016, a table of branch nodes, a
+//    table of edges between them and the sequence of edges taken;
+//    recognized by its BT9_SPA_TRACE_FORMAT first line
+#define FOREIGN_NONE 0
+#define FOREIGN_CHAMPSIM 1
+#define FOREIGN_BT9 2
+
+typedef struct foreign foreign_t;
+
+// Source of the (decompressed) trace bytes after the ones handed to
+// foreign_open
+//
+// Returns the number of bytes read, 0 at the end
+//
+typedef size_t (*foreign_read_fn)(void *ctx, char *dst, size_t cap);
+
+// Format of the trace at 'path' whose data starts with 'head'
+//
+// Returns FOREIGN_CHAMPSIM, FOREIGN_BT9 or FOREIGN_NONE
+//
+int foreign_detect(const char *path, const char *head, size_t len);
+
+const char *foreign_name(int kind);
+
+// Start decoding a 'kind' trace from the 'len' bytes of 'head', then
+// what 'read' returns. 'head' is copied when it is at most 1 MB, else
+// it must stay valid until foreign_close, e.g. a mapped file
+//
+foreign_t *foreign_open(int kind, const char *head, size_t len, foreign_read_fn read, void *ctx);
+
+// Decode up to 'max' branch records into 'recs'. PCs and targets keep
+// their low 32 bits
+//
+// Returns the number of records, 0 at the end
+//
+size_t foreign_read(foreign_t *f, branch_record_t *recs, size_t max);
+
+void foreign_close(foreign_t *f);
+
+#endif
@@ -0,0 +1,73 @@
+//========================================================//
+//  framecheck.cpp                                        //
+//  Source file for the frame checksums of framed traces  //
+//========================================================//
+
+#include <stdio.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "framecheck.h"
+#include "xxh3.h"
+
+static uint64_t frame_check_clock_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int frame_check(trace_reader_t *tr, const char *path, int threads, frame_check_t *res)
+{
+  if (!tr->frames || !tr->frame_sums || tr->remote)
+  {
+    return 0;
+  }
+  uint64_t n = tr->frame_hdr.num_frames;
+  if (threads <= 0)
+  {
+    threads = std::thread::hardware_concurrency();
+  }
+  if ((uint64_t)threads > n)
+  {
+    threads = n ? (int)n : 1;
+  }
+
+  // Threads take a frame at a time, a few MB. The index was bounds
+  // checked when the trace was opened, the frames' extents not
+  std::atomic<uint64_t> next(0), bytes(0), corrupt(0);
+  uint64_t start = frame_check_clock_ns();
+  auto work = [&]() {
+    uint64_t done = 0;
+    for (uint64_t f; (f = next++) < n;)
+    {
+      const trace_frame_t *frame = &tr->frames[f];
+      int ok = frame->offset + frame->comp_size <= tr->frame_hdr.index_offset &&
+               xxh3_64(tr->image + frame->offset, frame->comp_size) == tr->frame_sums[f];
+      done += frame->comp_size;
+      if (!ok && corrupt++ < FRAME_CHECK_REPORT)
+      {
+        fprintf(stderr, "Error: %s: frame %llu (records %llu to %llu) is corrupt\n", path, (unsigned long long)f,
+                (unsigned long long)frame->first_record,
+                (unsigned long long)(frame->first_record + frame->num_records - 1));
+      }
+    }
+    bytes += done;
+  };
+  std::vector<std::thread> pool;
+  for (int t = 1; t < threads; t++)
+  {
+    pool.push_back(std::thread(work));
+  }
+  work();
+  for (std::thread &t : pool)
+  {
+    t.join();
+  }
+  res->frames = n;
+  res->bytes = bytes;
+  res->corrupt = corrupt;
+  res->ns = frame_check_clock_ns() - start;
+  return 1;
+}
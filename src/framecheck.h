@@ -0,0 +1,37 @@
+//========================================================//
+//  framecheck.h                                          //
+//  Header file for the frame checksums of framed traces  //
+//                                                        //
+//  Each frame of a version 3 framed trace carries the    //
+//  XXH3-64 of its compressed bytes. The frames are       //
+//  independent, so all of them are checked at once on a //
+//  thread per core at close to memory bandwidth, before  //
+//  hours of replay are spent on a corrupt copy           //
+//========================================================//
+
+#ifndef FRAMECHECK_H
+#define FRAMECHECK_H
+
+#include <stdint.h>
+#include "trace.h"
+
+// Corrupt frames reported before the rest are only counted
+#define FRAME_CHECK_REPORT 10
+
+typedef struct
+{
+  uint64_t frames;  // checked
+  uint64_t bytes;   // compressed bytes hashed
+  uint64_t corrupt; // frames whose checksum differs
+  uint64_t ns;      // wall time
+} frame_check_t;
+
+// Check every frame of 'tr', opened from 'path', on 'threads' threads
+// (0 for one per core) and report the corrupt ones. Frames of a
+// remote trace are checked as they are fetched instead, see remote.h
+//
+// Returns True if the trace has checksums to check, which fills '*res'
+//
+int frame_check(trace_reader_t *tr, const char *path, int threads, frame_check_t *res);
+
+#endif
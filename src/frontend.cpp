@@ -0,0 +1,334 @@
+//========================================================//
+//  frontend.cpp                                          //
+//  Source file for the branch target model               //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <emmintrin.h>
+#include "frontend.h"
+#include "foldhist.h"
+
+static const char *fe_class_names[FE_CLASSES] = {"Conditional", "Jump", "Call", "Indirect", "Return"};
+static const char *fe_replace_names[] = {"lru", "fifo", "random"};
+
+// History lengths of the ITTAGE tables, geometric as TAGE's
+static const int fe_it_lengths[FE_IT_TABLES] = {4, 8, 14, 24, 40, 70, 120, 200};
+static_assert(sizeof(fe_it_entry_t) * FE_IT_TABLES == 64, "an ITTAGE row is one cache line");
+
+int fe_parse(const char *spec, fe_config_t *cfg)
+{
+  char *end;
+  unsigned long sets = strtoul(spec, &end, 0);
+  if (*end != 'x')
+  {
+    return 0;
+  }
+  long ways = strtol(end + 1, &end, 0);
+  if (*end || !sets || (sets & (sets - 1)) || sets > (1UL << 24) || ways < 1 || ways > FE_BTB_MAX_WAYS)
+  {
+    return 0;
+  }
+  cfg->sets = sets;
+  cfg->ways = ways;
+  return 1;
+}
+
+int fe_replace_by_name(const char *name)
+{
+  for (int r = 0; r < (int)(sizeof(fe_replace_names) / sizeof(fe_replace_names[0])); r++)
+  {
+    if (!strcasecmp(name, fe_replace_names[r]))
+    {
+      return r;
+    }
+  }
+  return -1;
+}
+
+// Allocate the ITTAGE of 1 << 'bits' rows, every table empty
+//
+// Returns True if Successful
+//
+static int fe_it_init(fe_ittage_t *it, int bits)
+{
+  size_t rows = (size_t)1 << bits;
+  size_t bytes = rows * (FE_IT_TABLES * sizeof(fe_it_entry_t) + sizeof(uint32_t)) + FE_IT_HIST_BUF;
+  if (posix_memalign(&it->arena, 64, bytes))
+  {
+    it->arena = NULL;
+    return 0;
+  }
+  memset(it->arena, 0, bytes);
+  it->rows = (fe_it_entry_t *)it->arena;
+  it->base = (uint32_t *)(it->rows + rows * FE_IT_TABLES);
+  it->hbuf = (uint8_t *)(it->base + rows);
+  return 1;
+}
+
+// Push one history bit into every folded register
+static inline void fe_it_push(fe_ittage_t *it, int bits, uint8_t bit)
+{
+  uint64_t pos = ++it->pos;
+  it->hbuf[pos & (FE_IT_HIST_BUF - 1)] = bit;
+  uint8_t out = it->hbuf[(pos - FE_IT_INDEX_LEN) & (FE_IT_HIST_BUF - 1)];
+  it->idx = fold_push(it->idx, bit, out, FE_IT_INDEX_LEN % bits, bits);
+  for (int t = 0; t < FE_IT_TABLES; t++)
+  {
+    int len = fe_it_lengths[t];
+    out = it->hbuf[(pos - len) & (FE_IT_HIST_BUF - 1)];
+    it->tag0[t] = fold_push(it->tag0[t], bit, out, len % FE_IT_TAG_BITS, FE_IT_TAG_BITS);
+    it->tag1[t] = fold_push(it->tag1[t], bit, out, len % (FE_IT_TAG_BITS - 1), FE_IT_TAG_BITS - 1);
+  }
+}
+
+// Predict the target of the indirect branch at 'pc' and train on the
+// real one, as TAGE does: the longest matching table provides, a wrong
+// provider loses confidence and then its target, and a miss allocates
+// one entry of a longer history
+//
+// Returns True if the prediction was 'target'
+//
+static int fe_it_predict_and_train(fe_ittage_t *it, int bits, uint32_t pc, uint32_t target)
+{
+  uint32_t mask = (1u << bits) - 1;
+  fe_it_entry_t *row = it->rows + (size_t)((pc ^ (pc >> bits) ^ it->idx) & mask) * FE_IT_TABLES;
+  uint32_t *base = &it->base[(pc ^ (pc >> bits)) & mask];
+  uint16_t tags[FE_IT_TABLES];
+  int provider = -1, alt = -1;
+  for (int t = FE_IT_TABLES - 1; t >= 0; t--)
+  {
+    tags[t] = (pc ^ it->tag0[t] ^ (it->tag1[t] << 1) ^ (t * 0x9e5u)) & ((1u << FE_IT_TAG_BITS) - 1);
+    if (row[t].target && row[t].tag == tags[t])
+    {
+      if (provider < 0)
+      {
+        provider = t;
+      }
+      else if (alt < 0)
+      {
+        alt = t;
+      }
+    }
+  }
+  uint32_t alt_target = alt >= 0 ? row[alt].target : *base;
+  uint32_t pred = provider >= 0 ? row[provider].target : *base;
+  int right = pred == target;
+
+  if (provider >= 0)
+  {
+    fe_it_entry_t *e = &row[provider];
+    if (right)
+    {
+      e->conf += e->conf < FE_IT_CONF_MAX;
+      e->useful |= alt_target != target;
+    }
+    else if (e->conf)
+    {
+      e->conf--;
+      e->useful = 0;
+    }
+    else
+    {
+      e->target = target;
+      e->useful = 0;
+    }
+  }
+  if (!right)
+  {
+    int t = provider + 1;
+    while (t < FE_IT_TABLES && row[t].useful)
+    {
+      t++;
+    }
+    if (t < FE_IT_TABLES)
+    {
+      row[t].target = target;
+      row[t].tag = tags[t];
+      row[t].conf = 0;
+    }
+    else
+    {
+      for (t = provider + 1; t < FE_IT_TABLES; t++)
+      {
+        row[t].useful = 0;
+      }
+    }
+  }
+  *base = target;
+
+  // the path: some bits of where it went
+  for (int b = 0; b < FE_IT_PATH_BITS; b++)
+  {
+    fe_it_push(it, bits, (target >> (2 + b)) & 1);
+  }
+  return right;
+}
+
+int fe_init(fe_model_t *m, const fe_config_t *cfg)
+{
+  memset(m, 0, sizeof(*m));
+  m->cfg = *cfg;
+  m->stride = (cfg->ways + 3) & ~3;
+  size_t slots = (size_t)cfg->sets * m->stride;
+  if (posix_memalign((void **)&m->tags, 16, slots * sizeof(uint32_t)))
+  {
+    m->tags = NULL;
+    return 0;
+  }
+  memset(m->tags, 0, slots * sizeof(uint32_t));
+  m->targets = (uint32_t *)calloc(slots, sizeof(uint32_t));
+  m->stamps = (uint64_t *)calloc(slots, sizeof(uint64_t));
+  m->ras = (uint32_t *)calloc(cfg->ras_depth > 0 ? cfg->ras_depth : 1, sizeof(uint32_t));
+  m->rng = 0x9e3779b97f4a7c15ULL;
+  if (cfg->it_bits && !fe_it_init(&m->it, cfg->it_bits))
+  {
+    return 0;
+  }
+  return m->targets && m->stamps && m->ras;
+}
+
+// Way of set 's' holding 'pc', -1 if none does
+static inline int fe_btb_find(const fe_model_t *m, uint32_t s, uint32_t pc)
+{
+  const uint32_t *tags = m->tags + (size_t)s * m->stride;
+  __m128i key = _mm_set1_epi32((int)pc);
+  for (int w = 0; w < m->stride; w += 4)
+  {
+    __m128i eq = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *)(tags + w)), key);
+    int hit = _mm_movemask_ps(_mm_castsi128_ps(eq));
+    if (hit)
+    {
+      return w + __builtin_ctz(hit);
+    }
+  }
+  return -1;
+}
+
+// Way of set 's' to replace: an empty one, else by cfg.replace
+static inline int fe_btb_victim(fe_model_t *m, uint32_t s)
+{
+  size_t base = (size_t)s * m->stride;
+  int victim = 0;
+  for (int w = 0; w < m->cfg.ways; w++)
+  {
+    if (!m->tags[base + w])
+    {
+      return w;
+    }
+    if (m->stamps[base + w] < m->stamps[base + victim])
+    {
+      victim = w;
+    }
+  }
+  if (m->cfg.replace == FE_REPLACE_RANDOM)
+  {
+    m->rng ^= m->rng << 13;
+    m->rng ^= m->rng >> 7;
+    m->rng ^= m->rng << 17;
+    victim = m->rng % m->cfg.ways;
+  }
+  return victim;
+}
+
+void fe_add(fe_model_t *m, const branch_record_t *recs, size_t n, int counted)
+{
+  uint32_t set_mask = m->cfg.sets - 1;
+  for (size_t i = 0; i < n; i++)
+  {
+    uint8_t flags = recs[i].flags;
+    if (m->cfg.it_bits && (flags & TRACE_F_CONDITION))
+    {
+      fe_it_push(&m->it, m->cfg.it_bits, flags & TRACE_F_TAKEN);
+    }
+    if (!(flags & TRACE_F_TAKEN))
+    {
+      continue;
+    }
+    uint32_t pc = recs[i].pc, target = recs[i].target;
+    int cls = (flags & TRACE_F_RET)          ? FE_CLASS_RETURN
+              : !(flags & TRACE_F_DIRECT)    ? FE_CLASS_INDIRECT
+              : (flags & TRACE_F_CALL)       ? FE_CLASS_CALL
+              : (flags & TRACE_F_CONDITION)  ? FE_CLASS_COND
+                                             : FE_CLASS_JUMP;
+    int right;
+    if (cls == FE_CLASS_RETURN)
+    {
+      right = 0;
+      if (m->ras_count)
+      {
+        m->ras_top = m->ras_top ? m->ras_top - 1 : m->cfg.ras_depth - 1;
+        m->ras_count--;
+        right = target - m->ras[m->ras_top] - 1 < FE_CALL_MAX_LEN;
+      }
+    }
+    else if (cls == FE_CLASS_INDIRECT && m->cfg.it_bits)
+    {
+      right = fe_it_predict_and_train(&m->it, m->cfg.it_bits, pc, target);
+    }
+    else
+    {
+      uint32_t s = pc & set_mask;
+      size_t base = (size_t)s * m->stride;
+      int w = fe_btb_find(m, s, pc);
+      right = w >= 0 && m->targets[base + w] == target;
+      if (w < 0)
+      {
+        w = fe_btb_victim(m, s);
+        m->tags[base + w] = pc;
+        m->stamps[base + w] = ++m->clock;
+      }
+      else if (m->cfg.replace == FE_REPLACE_LRU)
+      {
+        m->stamps[base + w] = ++m->clock;
+      }
+      m->targets[base + w] = target;
+    }
+    if ((flags & TRACE_F_CALL) && m->cfg.ras_depth > 0)
+    {
+      m->ras[m->ras_top] = pc;
+      m->ras_top = m->ras_top + 1 == m->cfg.ras_depth ? 0 : m->ras_top + 1;
+      m->ras_count += m->ras_count < m->cfg.ras_depth;
+    }
+    if (counted)
+    {
+      m->taken[cls]++;
+      m->misses[cls] += !right;
+    }
+  }
+}
+
+void fe_print(const fe_model_t *m, FILE *out)
+{
+  fprintf(out, "Front end:       BTB %u sets x %d ways, %s; RAS %d entries", m->cfg.sets, m->cfg.ways,
+          fe_replace_names[m->cfg.replace], m->cfg.ras_depth);
+  if (m->cfg.it_bits)
+  {
+    fprintf(out, "; ITTAGE %d rows x %d tables", 1 << m->cfg.it_bits, FE_IT_TABLES);
+  }
+  fputc('\n', out);
+  fprintf(out, "Class              Taken  Incorrect     Rate\n");
+  uint64_t taken = 0, misses = 0;
+  for (int c = 0; c <= FE_CLASSES; c++)
+  {
+    // the last line is the total of the others
+    uint64_t t = c < FE_CLASSES ? m->taken[c] : taken;
+    uint64_t x = c < FE_CLASSES ? m->misses[c] : misses;
+    fprintf(out, "%-12s %11llu %10llu %8.3f\n", c < FE_CLASSES ? fe_class_names[c] : "Total",
+            (unsigned long long)t, (unsigned long long)x, t ? 1000.0 * x / t : 0.0);
+    taken += c < FE_CLASSES ? t : 0;
+    misses += c < FE_CLASSES ? x : 0;
+  }
+}
+
+void fe_free(fe_model_t *m)
+{
+  free(m->tags);
+  free(m->targets);
+  free(m->stamps);
+  free(m->ras);
+  free(m->it.arena);
+  memset(m, 0, sizeof(*m));
+}
@@ -0,0 +1,137 @@
+//========================================================//
+//  frontend.h                                            //
+//  Header file for the branch target model               //
+//                                                        //
+//  A set associative BTB and a circular return address   //
+//  stack replayed next to the direction predictors,      //
+//  counting the taken branches of each class whose       //
+//  target they would not have supplied. Optionally an    //
+//  ITTAGE predicts the targets of indirect branches      //
+//========================================================//
+
+#ifndef FRONTEND_H
+#define FRONTEND_H
+
+#include <stdint.h>
+#include "trace.h"
+
+// Classes of taken branches, by their trace flags. Returns take their
+// target from the RAS, indirect branches from the ITTAGE when there is
+// one, every other class from the BTB
+#define FE_CLASS_COND 0      // conditional, direct
+#define FE_CLASS_JUMP 1      // unconditional direct jump
+#define FE_CLASS_CALL 2      // direct call
+#define FE_CLASS_INDIRECT 3  // indirect jump or call
+#define FE_CLASS_RETURN 4
+#define FE_CLASSES 5
+
+// BTB victim choice within a set
+#define FE_REPLACE_LRU 0
+#define FE_REPLACE_FIFO 1
+#define FE_REPLACE_RANDOM 2
+
+// Defaults of --btb and --ras
+#define FE_BTB_SETS 1024
+#define FE_BTB_WAYS 4
+#define FE_BTB_MAX_WAYS 16
+#define FE_RAS_DEPTH 16
+
+// The trace has no instruction lengths, so a return is predicted
+// when its target is 1 to FE_CALL_MAX_LEN bytes past the call on top
+// of the RAS, the longest x86 instruction
+#define FE_CALL_MAX_LEN 15
+
+// ITTAGE: a last-target table by PC and FE_IT_TABLES tagged tables of
+// longer and longer global histories. The tagged tables share one row
+// index, from the PC and the last FE_IT_INDEX_LEN history bits, so the
+// entries of every table for a branch lie in one cache line and a
+// prediction reads two lines. History takes the outcome of every
+// conditional branch and FE_IT_PATH_BITS target bits of every indirect
+// branch
+#define FE_IT_ROW_BITS 10                 // default rows of --ittage
+#define FE_IT_TABLES 8
+#define FE_IT_TAG_BITS 12
+#define FE_IT_INDEX_LEN 8
+#define FE_IT_PATH_BITS 2
+#define FE_IT_CONF_MAX 3
+#define FE_IT_HIST_BUF 512                // history bits kept, above the longest length
+
+typedef struct
+{
+  uint32_t sets;  // a power of 2
+  int ways;       // 1 to FE_BTB_MAX_WAYS
+  int replace;    // FE_REPLACE_*
+  int ras_depth;  // entries, the oldest overwritten when full
+  int it_bits;    // log2 rows of the ITTAGE, 0 for none
+} fe_config_t;
+
+typedef struct
+{
+  uint32_t target;  // 0 when empty
+  uint16_t tag;
+  uint8_t conf;     // 0 to FE_IT_CONF_MAX
+  uint8_t useful;
+} fe_it_entry_t;
+
+// One allocation holds the rows, of FE_IT_TABLES entries each and
+// cache line aligned, the last-target table and the history bits
+typedef struct
+{
+  void *arena;
+  fe_it_entry_t *rows;
+  uint32_t *base;
+  uint8_t *hbuf;                   // one bit per byte, by position
+  uint64_t pos;                    // bits pushed so far
+  uint32_t idx;                    // last FE_IT_INDEX_LEN bits folded to the row bits
+  uint32_t tag0[FE_IT_TABLES];     // each table's history folded to the tag width
+  uint32_t tag1[FE_IT_TABLES];     // and to one bit less
+} fe_ittage_t;
+
+// Tags, targets and replacement stamps of the BTB are separate arrays.
+// Each set's tags fill a multiple of 4 slots, so they match in SSE2
+// compares of 4 ways; the spare slots stay 0 and no branch is at PC 0
+typedef struct
+{
+  fe_config_t cfg;
+  int stride;              // tag slots per set
+  uint32_t *tags;          // full PC of each way, 0 when empty
+  uint32_t *targets;
+  uint64_t *stamps;        // last use (LRU) or insertion (FIFO)
+  uint64_t clock;
+  uint64_t rng;            // FE_REPLACE_RANDOM, xorshift64
+  uint32_t *ras;           // call PCs
+  int ras_top;             // next slot to push
+  int ras_count;           // valid entries, up to ras_depth
+  fe_ittage_t it;          // with cfg.it_bits
+  uint64_t taken[FE_CLASSES];
+  uint64_t misses[FE_CLASSES];
+} fe_model_t;
+
+// Parse "<sets>x<ways>" of --btb into 'cfg'
+//
+// Returns True if Successful
+//
+int fe_parse(const char *spec, fe_config_t *cfg);
+
+// Returns the FE_REPLACE_* named 'name', -1 if none is
+//
+int fe_replace_by_name(const char *name);
+
+// Allocate an empty BTB and RAS for 'cfg'
+//
+// Returns True if Successful
+//
+int fe_init(fe_model_t *m, const fe_config_t *cfg);
+
+// Look up and train on 'n' records, adding to the counts only when
+// 'counted' is True
+//
+void fe_add(fe_model_t *m, const branch_record_t *recs, size_t n, int counted);
+
+// Print the configuration and the counts of every class to 'out'
+//
+void fe_print(const fe_model_t *m, FILE *out);
+
+void fe_free(fe_model_t *m);
+
+#endif
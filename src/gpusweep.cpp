@@ -0,0 +1,431 @@
+//========================================================//
+//  gpusweep.cpp                                          //
+//  Source file for the OpenCL sweep backend              //
+//                                                        //
+//  The device works on the predictor_save_state bytes of //
+//  each point, so it starts from exactly the tables the  //
+//  CPU would and steps the same packed counters          //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <string>
+#include <vector>
+#include "gpusweep.h"
+
+// The few OpenCL 1.2 types and entry points used, looked up in
+// libOpenCL at run time
+typedef int32_t cl_int;
+typedef uint32_t cl_uint;
+typedef uint64_t cl_ulong;
+typedef struct _cl_platform_id *cl_platform_id;
+typedef struct _cl_device_id *cl_device_id;
+typedef struct _cl_context *cl_context;
+typedef struct _cl_command_queue *cl_command_queue;
+typedef struct _cl_program *cl_program;
+typedef struct _cl_kernel *cl_kernel;
+typedef struct _cl_mem *cl_mem;
+
+#define CL_SUCCESS 0
+#define CL_TRUE 1
+#define CL_DEVICE_TYPE_ALL 0xFFFFFFFF
+#define CL_MEM_READ_WRITE (1 << 0)
+#define CL_MEM_WRITE_ONLY (1 << 1)
+#define CL_MEM_READ_ONLY (1 << 2)
+#define CL_MEM_COPY_HOST_PTR (1 << 5)
+#define CL_PROGRAM_BUILD_LOG 0x1183
+
+static struct
+{
+  cl_int (*GetPlatformIDs)(cl_uint, cl_platform_id *, cl_uint *);
+  cl_int (*GetDeviceIDs)(cl_platform_id, cl_ulong, cl_uint, cl_device_id *, cl_uint *);
+  cl_context (*CreateContext)(const intptr_t *, cl_uint, const cl_device_id *,
+                              void (*)(const char *, const void *, size_t, void *), void *, cl_int *);
+  cl_command_queue (*CreateCommandQueue)(cl_context, cl_device_id, cl_ulong, cl_int *);
+  cl_program (*CreateProgramWithSource)(cl_context, cl_uint, const char **, const size_t *, cl_int *);
+  cl_int (*BuildProgram)(cl_program, cl_uint, const cl_device_id *, const char *, void (*)(cl_program, void *),
+                         void *);
+  cl_int (*GetProgramBuildInfo)(cl_program, cl_device_id, cl_uint, size_t, void *, size_t *);
+  cl_kernel (*CreateKernel)(cl_program, const char *, cl_int *);
+  cl_mem (*CreateBuffer)(cl_context, cl_ulong, size_t, void *, cl_int *);
+  cl_int (*SetKernelArg)(cl_kernel, cl_uint, size_t, const void *);
+  cl_int (*EnqueueNDRangeKernel)(cl_command_queue, cl_kernel, cl_uint, const size_t *, const size_t *,
+                                 const size_t *, cl_uint, const void *, void *);
+  cl_int (*EnqueueReadBuffer)(cl_command_queue, cl_mem, cl_uint, size_t, size_t, void *, cl_uint, const void *,
+                              void *);
+  cl_int (*Finish)(cl_command_queue);
+  cl_int (*ReleaseMemObject)(cl_mem);
+} cl;
+
+// One work item replays one point over the whole trace. The tables
+// are the point's predictor_save_state bytes; the counter helpers
+// mirror ctr_get and ctr_step_field in predictor.cpp, each counter
+// stored XOR its initial value 'init', and a tournament global entry
+// holds the chooser above its counter
+static const char *gpu_sweep_source = R"CL(
+uint ctr_get(__global const ulong *t, uint i, uint field, uint bits, uint init)
+{
+  uint per_word = 64 / field;
+  return ((uint)(t[i / per_word] >> (i % per_word * field)) & ((1u << bits) - 1)) ^ init;
+}
+
+// Step the 'bits' wide counter 'at' bits into entry i of a table of
+// 'field' bit entries
+void ctr_field_step(__global ulong *t, uint i, uint field, uint at, uint bits, uint init, uint outcome)
+{
+  uint per_word = 64 / field;
+  uint shift = i % per_word * field + at;
+  uint max = (1u << bits) - 1;
+  uint c = ((uint)(t[i / per_word] >> shift) & max) ^ init;
+  if (c != (outcome ? max : 0))
+  {
+    uint next = outcome ? c + 1 : c - 1;
+    t[i / per_word] ^= (ulong)((c ^ next) & max) << shift;
+  }
+}
+
+void ctr_step(__global ulong *t, uint i, uint field, uint bits, uint init, uint outcome)
+{
+  ctr_field_step(t, i, field, 0, bits, init, outcome);
+}
+
+ulong replay_gshare(__global const uchar *recs, ulong nwarm, ulong n, uint bits, __global ulong *s)
+{
+  ulong hist = s[0], miss = 0;
+  __global ulong *bht = s + 1;
+  uint mask = (1u << bits) - 1;
+  for (ulong i = 0; i < nwarm + n; i++)
+  {
+    __global const uchar *r = recs + i * RECORD_SIZE;
+    if (!(r[8] & F_CONDITION))
+    {
+      continue;
+    }
+    uint pc = r[0] | (r[1] << 8) | (r[2] << 16) | ((uint)r[3] << 24);
+    uint outcome = r[8] & F_TAKEN;
+    uint index = (uint)((pc ^ hist) & mask);
+    miss += i >= nwarm && (ctr_get(bht, index, 2, 2, 1) >= 2) != outcome;
+    ctr_step(bht, index, 2, 2, 1, outcome);
+    hist = (hist << 1) | outcome;
+  }
+  s[0] = hist;
+  return miss;
+}
+
+ulong replay_tournament(__global const uchar *recs, ulong nwarm, ulong n, uint lht_bits, uint ghr_bits,
+                        __global ulong *s)
+{
+  ulong ghr = s[0], miss = 0;
+  uint lht_mask = (1u << lht_bits) - 1, gpt_mask = (1u << ghr_bits) - 1;
+  __global uchar *lht8 = (__global uchar *)(s + 1);
+  __global ushort *lht16 = (__global ushort *)(s + 1);
+  __global uint *lht32 = (__global uint *)(s + 1);
+  ulong lht_bytes = (ulong)(lht_mask + 1) * (lht_bits <= 8 ? 1 : lht_bits <= 16 ? 2 : 4);
+  __global ulong *lpt = s + 1 + lht_bytes / 8;
+  __global ulong *global = lpt + (lht_mask + 16) / 16;
+  for (ulong i = 0; i < nwarm + n; i++)
+  {
+    __global const uchar *r = recs + i * RECORD_SIZE;
+    if (!(r[8] & F_CONDITION))
+    {
+      continue;
+    }
+    uint pc = r[0] | (r[1] << 8) | (r[2] << 16) | ((uint)r[3] << 24);
+    uint outcome = r[8] & F_TAKEN;
+    uint lht_index = pc & lht_mask;
+    uint local_hist = lht_bits <= 8 ? lht8[lht_index] : lht_bits <= 16 ? lht16[lht_index] : lht32[lht_index];
+    uint local_index = local_hist & lht_mask;
+    uint local_taken = ctr_get(lpt, local_index, 4, 3, 1) >= 4;
+    uint global_index = (uint)(ghr & gpt_mask);
+    uint entry = ctr_get(global, global_index, 4, 4, 1 | 1 << 2);
+    uint global_taken = (entry & 3) >= 2;
+    uint pred = entry >> 2 >= 2 ? global_taken : local_taken;
+    miss += i >= nwarm && pred != outcome;
+    ctr_step(lpt, local_index, 4, 3, 1, outcome);
+    ctr_field_step(global, global_index, 4, 0, 2, 1, outcome);
+    if (local_taken != global_taken && (global_taken == outcome || local_taken == outcome))
+    {
+      ctr_field_step(global, global_index, 4, 2, 2, 1, global_taken == outcome);
+    }
+    local_hist = ((local_hist << 1) | outcome) & lht_mask;
+    if (lht_bits <= 8)
+    {
+      lht8[lht_index] = (uchar)local_hist;
+    }
+    else if (lht_bits <= 16)
+    {
+      lht16[lht_index] = (ushort)local_hist;
+    }
+    else
+    {
+      lht32[lht_index] = local_hist;
+    }
+    ghr = ((ghr << 1) | outcome) & gpt_mask;
+  }
+  s[0] = ghr;
+  return miss;
+}
+
+__kernel void sweep_replay(__global const uchar *recs, ulong nwarm, ulong n, __global const uint *params,
+                           __global const ulong *offsets, __global uchar *state, __global ulong *misses, uint count)
+{
+  uint k = get_global_id(0);
+  if (k >= count)
+  {
+    return;
+  }
+  __global ulong *s = (__global ulong *)(state + offsets[k]);
+  if (params[3 * k] == TYPE_GSHARE)
+  {
+    misses[k] = replay_gshare(recs, nwarm, n, params[3 * k + 1], s);
+  }
+  else
+  {
+    misses[k] = replay_tournament(recs, nwarm, n, params[3 * k + 1], params[3 * k + 2], s);
+  }
+}
+)CL";
+
+static int gpu_state = -1; // gpu_sweep_init result, -1 before the first call
+static cl_context gpu_context;
+static cl_command_queue gpu_queue;
+static cl_kernel gpu_kernel;
+
+int gpu_sweep_supported(const predictor_config_t *cfg)
+{
+  // Fewer than 8 tournament local histories of a byte would leave the
+  // counter words of the state unaligned; the kernel runs the default
+  // local engine only and trains every branch at once, on arrays
+  return !cfg->updateDelay && !cfg->unbounded &&
+         (cfg->type == GSHARE || (cfg->type == TOURNAMENT && cfg->lhtBits >= 3 && !cfg->localHistBits &&
+                                  cfg->localWays == 1 && !cfg->localPatternBits));
+}
+
+// Look up every entry point of 'cl' in 'lib'
+//
+// Returns True if Successful
+//
+static int gpu_sweep_bind(void *lib)
+{
+  static const char *names[] = {
+    "clGetPlatformIDs", "clGetDeviceIDs", "clCreateContext", "clCreateCommandQueue",
+    "clCreateProgramWithSource", "clBuildProgram", "clGetProgramBuildInfo", "clCreateKernel",
+    "clCreateBuffer", "clSetKernelArg", "clEnqueueNDRangeKernel", "clEnqueueReadBuffer",
+    "clFinish", "clReleaseMemObject",
+  };
+  static_assert(sizeof(names) / sizeof(names[0]) * sizeof(void *) == sizeof(cl), "one name per entry point");
+  void **fns = (void **)&cl;
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+  {
+    if (!(fns[i] = dlsym(lib, names[i])))
+    {
+      fprintf(stderr, "--gpu: %s not found in libOpenCL\n", names[i]);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int gpu_sweep_init()
+{
+  if (gpu_state >= 0)
+  {
+    return gpu_state;
+  }
+  gpu_state = 0;
+  void *lib = dlopen("libOpenCL.so.1", RTLD_NOW | RTLD_LOCAL);
+  if (!lib)
+  {
+    lib = dlopen("libOpenCL.so", RTLD_NOW | RTLD_LOCAL);
+  }
+  if (!lib)
+  {
+    fprintf(stderr, "--gpu: unable to load libOpenCL: %s\n", dlerror());
+    return 0;
+  }
+  if (!gpu_sweep_bind(lib))
+  {
+    return 0;
+  }
+
+  // The first device of the first platform that has one
+  cl_platform_id platforms[16];
+  cl_uint num_platforms = 0;
+  cl_device_id device = NULL;
+  if (cl.GetPlatformIDs(16, platforms, &num_platforms) != CL_SUCCESS)
+  {
+    num_platforms = 0;
+  }
+  for (cl_uint i = 0; i < num_platforms && i < 16 && !device; i++)
+  {
+    cl_uint num_devices = 0;
+    if (cl.GetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, 1, &device, &num_devices) != CL_SUCCESS || !num_devices)
+    {
+      device = NULL;
+    }
+  }
+  if (!device)
+  {
+    fprintf(stderr, "--gpu: no OpenCL device found\n");
+    return 0;
+  }
+
+  cl_int err;
+  gpu_context = cl.CreateContext(NULL, 1, &device, NULL, NULL, &err);
+  if (err == CL_SUCCESS)
+  {
+    gpu_queue = cl.CreateCommandQueue(gpu_context, device, 0, &err);
+  }
+  if (err != CL_SUCCESS)
+  {
+    fprintf(stderr, "--gpu: unable to open the device (%d)\n", (int)err);
+    return 0;
+  }
+
+  // The record layout and flag bits come from the headers
+  char options[256];
+  snprintf(options, sizeof(options), "-DRECORD_SIZE=%d -DF_TAKEN=%d -DF_CONDITION=%d -DTYPE_GSHARE=%d",
+           (int)sizeof(branch_record_t), BP_F_TAKEN, BP_F_CONDITION, GSHARE);
+  cl_program program = cl.CreateProgramWithSource(gpu_context, 1, &gpu_sweep_source, NULL, &err);
+  if (err != CL_SUCCESS || cl.BuildProgram(program, 1, &device, options, NULL, NULL) != CL_SUCCESS)
+  {
+    char log[4096] = "";
+    if (err == CL_SUCCESS)
+    {
+      cl.GetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, sizeof(log) - 1, log, NULL);
+    }
+    fprintf(stderr, "--gpu: kernel build failed\n%s\n", log);
+    return 0;
+  }
+  gpu_kernel = cl.CreateKernel(program, "sweep_replay", &err);
+  if (err != CL_SUCCESS)
+  {
+    fprintf(stderr, "--gpu: kernel build failed (%d)\n", (int)err);
+    return 0;
+  }
+  gpu_state = 1;
+  return 1;
+}
+
+// Run the points of 'cfgs' whose states fit in one launch
+//
+// Returns True if Successful
+//
+static int gpu_sweep_launch(cl_mem recs, size_t nwarm, size_t n, const predictor_config_t *cfgs, size_t k,
+                            uint64_t *mispredictions)
+{
+  std::vector<cl_uint> params(3 * k);
+  std::vector<cl_ulong> offsets(k);
+  std::vector<char> state;
+  for (size_t i = 0; i < k; i++)
+  {
+    predictor_t *p = predictor_create(&cfgs[i]);
+    if (!p)
+    {
+      return 0;
+    }
+    offsets[i] = state.size();
+    state.resize(offsets[i] + ((predictor_state_size(p) + 7) & ~(size_t)7));
+    predictor_save_state(p, state.data() + offsets[i]);
+    predictor_destroy(p);
+    params[3 * i] = cfgs[i].type;
+    params[3 * i + 1] = cfgs[i].type == GSHARE ? cfgs[i].ghistoryBits : cfgs[i].lhtBits;
+    params[3 * i + 2] = cfgs[i].type == GSHARE ? 0 : cfgs[i].ghrBits;
+  }
+
+  cl_int err = CL_SUCCESS, e;
+  cl_mem bufs[4];
+  bufs[0] = cl.CreateBuffer(gpu_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, params.size() * sizeof(cl_uint),
+                            params.data(), &e);
+  err |= e;
+  bufs[1] = cl.CreateBuffer(gpu_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, k * sizeof(cl_ulong),
+                            offsets.data(), &e);
+  err |= e;
+  bufs[2] = cl.CreateBuffer(gpu_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, state.size(), state.data(), &e);
+  err |= e;
+  bufs[3] = cl.CreateBuffer(gpu_context, CL_MEM_WRITE_ONLY, k * sizeof(cl_ulong), NULL, &e);
+  err |= e;
+
+  std::vector<cl_ulong> misses(k);
+  cl_ulong warm = nwarm, count = n;
+  cl_uint points = k;
+  size_t global = k;
+  if (err == CL_SUCCESS)
+  {
+    err |= cl.SetKernelArg(gpu_kernel, 0, sizeof(cl_mem), &recs);
+    err |= cl.SetKernelArg(gpu_kernel, 1, sizeof(cl_ulong), &warm);
+    err |= cl.SetKernelArg(gpu_kernel, 2, sizeof(cl_ulong), &count);
+    for (int b = 0; b < 4; b++)
+    {
+      err |= cl.SetKernelArg(gpu_kernel, 3 + b, sizeof(cl_mem), &bufs[b]);
+    }
+    err |= cl.SetKernelArg(gpu_kernel, 7, sizeof(cl_uint), &points);
+  }
+  if (err == CL_SUCCESS)
+  {
+    err = cl.EnqueueNDRangeKernel(gpu_queue, gpu_kernel, 1, NULL, &global, NULL, 0, NULL, NULL);
+  }
+  if (err == CL_SUCCESS)
+  {
+    err = cl.EnqueueReadBuffer(gpu_queue, bufs[3], CL_TRUE, 0, k * sizeof(cl_ulong), misses.data(), 0, NULL, NULL);
+  }
+  cl.Finish(gpu_queue);
+  for (int b = 0; b < 4; b++)
+  {
+    if (bufs[b])
+    {
+      cl.ReleaseMemObject(bufs[b]);
+    }
+  }
+  if (err != CL_SUCCESS)
+  {
+    fprintf(stderr, "--gpu: replay failed (%d)\n", (int)err);
+    return 0;
+  }
+  for (size_t i = 0; i < k; i++)
+  {
+    mispredictions[i] += misses[i];
+  }
+  return 1;
+}
+
+int gpu_sweep_replay(const branch_record_t *recs, size_t nwarm, size_t n, const predictor_config_t *cfgs, size_t k,
+                     uint64_t *mispredictions)
+{
+  if (!gpu_sweep_init())
+  {
+    return 0;
+  }
+  cl_int err;
+  cl_mem buf = cl.CreateBuffer(gpu_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                               (nwarm + n) * sizeof(branch_record_t), (void *)recs, &err);
+  if (err != CL_SUCCESS)
+  {
+    fprintf(stderr, "--gpu: unable to upload the trace (%d)\n", (int)err);
+    return 0;
+  }
+
+  // Launches of points whose tables together fit GPU_SWEEP_MAX_BYTES
+  int ok = 1;
+  for (size_t first = 0; ok && first < k;)
+  {
+    size_t last = first, bytes = 0;
+    for (; last < k; last++)
+    {
+      predictor_t *p = predictor_create(&cfgs[last]);
+      size_t size = p ? predictor_state_size(p) : 0;
+      predictor_destroy(p);
+      if (last > first && bytes + size > GPU_SWEEP_MAX_BYTES)
+      {
+        break;
+      }
+      bytes += size;
+    }
+    ok = gpu_sweep_launch(buf, nwarm, n, cfgs + first, last - first, mispredictions + first);
+    first = last;
+  }
+  cl.ReleaseMemObject(buf);
+  return ok;
+}
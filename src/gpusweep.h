@@ -0,0 +1,46 @@
+//========================================================//
+//  gpusweep.h                                            //
+//  Header file for the OpenCL sweep backend              //
+//                                                        //
+//  With --gpu, sweep points of the counter based         //
+//  predictors replay on an OpenCL device, one work item  //
+//  per point over the whole trace. libOpenCL is loaded   //
+//  at run time, so the build needs no OpenCL headers     //
+//========================================================//
+
+#ifndef GPUSWEEP_H
+#define GPUSWEEP_H
+
+#include <stdint.h>
+#include "predictor.h"
+#include "trace.h"
+
+// Most bytes of predictor tables resident on the device at once;
+// larger grids run in several launches
+#define GPU_SWEEP_MAX_BYTES (1ULL << 30)
+
+// Sweep points replayed again on the CPU to check the device results
+#define GPU_SWEEP_VERIFY 2
+
+// Returns True if 'cfg' is a type the device replays: gshare or
+// tournament
+//
+int gpu_sweep_supported(const predictor_config_t *cfg);
+
+// Load libOpenCL and build the kernels for the first device found,
+// once; later calls return the first result
+//
+// Returns True if Successful, printing why not otherwise
+//
+int gpu_sweep_init();
+
+// Replay 'nwarm' records that only train and then 'n' counted ones,
+// starting at 'recs', for each of the 'k' configurations in 'cfgs',
+// and add the mispredictions of cfgs[i] to mispredictions[i]
+//
+// Returns True if Successful
+//
+int gpu_sweep_replay(const branch_record_t *recs, size_t nwarm, size_t n, const predictor_config_t *cfgs, size_t k,
+                     uint64_t *mispredictions);
+
+#endif
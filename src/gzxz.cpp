@@ -0,0 +1,278 @@
+//========================================================//
+//  gzxz.cpp                                              //
+//  Source file for the in-process gzip and xz decoders   //
+//                                                        //
+//  The stream structs below follow zlib.h and lzma.h,    //
+//  whose layouts are part of those libraries' ABI        //
+//========================================================//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <mutex>
+#include "gzxz.h"
+
+// Compressed bytes read from the stream at a time
+#define GZXZ_IN_SIZE (1 << 20)
+
+typedef struct
+{
+  const uint8_t *next_in;
+  unsigned avail_in;
+  unsigned long total_in;
+  uint8_t *next_out;
+  unsigned avail_out;
+  unsigned long total_out;
+  const char *msg;
+  void *state;
+  void *zalloc;
+  void *zfree;
+  void *opaque;
+  int data_type;
+  unsigned long adler;
+  unsigned long reserved;
+} gzxz_zstream_t;
+
+typedef struct
+{
+  const uint8_t *next_in;
+  size_t avail_in;
+  uint64_t total_in;
+  uint8_t *next_out;
+  size_t avail_out;
+  uint64_t total_out;
+  const void *allocator;
+  void *internal;
+  void *reserved_ptr[4];
+  uint64_t reserved_int1;
+  uint64_t reserved_int2;
+  size_t reserved_int3;
+  size_t reserved_int4;
+  int reserved_enum1;
+  int reserved_enum2;
+} gzxz_lzma_t;
+
+#define GZXZ_Z_STREAM_END 1
+#define GZXZ_Z_BUF_ERROR (-5)
+#define GZXZ_LZMA_RUN 0
+#define GZXZ_LZMA_FINISH 3
+#define GZXZ_LZMA_STREAM_END 1
+#define GZXZ_LZMA_CONCATENATED 0x08
+
+typedef const char *(*zlib_version_fn)(void);
+typedef int (*inflate_init_fn)(gzxz_zstream_t *, int, const char *, int);
+typedef int (*inflate_fn)(gzxz_zstream_t *, int);
+typedef int (*inflate_reset_fn)(gzxz_zstream_t *);
+typedef int (*inflate_end_fn)(gzxz_zstream_t *);
+typedef int (*lzma_decoder_fn)(gzxz_lzma_t *, uint64_t, uint32_t);
+typedef int (*lzma_code_fn)(gzxz_lzma_t *, int);
+typedef void (*lzma_end_fn)(gzxz_lzma_t *);
+
+static struct
+{
+  int loaded[3];
+  zlib_version_fn zlib_version;
+  inflate_init_fn inflate_init;
+  inflate_fn inflate;
+  inflate_reset_fn inflate_reset;
+  inflate_end_fn inflate_end;
+  lzma_decoder_fn lzma_decoder;
+  lzma_code_fn lzma_code;
+  lzma_end_fn lzma_end;
+} libs;
+
+static std::once_flag libs_once;
+
+static void gzxz_load()
+{
+  void *z = dlopen("libz.so.1", RTLD_NOW | RTLD_LOCAL);
+  if (z)
+  {
+    libs.zlib_version = (zlib_version_fn)dlsym(z, "zlibVersion");
+    libs.inflate_init = (inflate_init_fn)dlsym(z, "inflateInit2_");
+    libs.inflate = (inflate_fn)dlsym(z, "inflate");
+    libs.inflate_reset = (inflate_reset_fn)dlsym(z, "inflateReset");
+    libs.inflate_end = (inflate_end_fn)dlsym(z, "inflateEnd");
+    libs.loaded[GZXZ_GZIP] = libs.zlib_version && libs.inflate_init && libs.inflate && libs.inflate_reset &&
+                             libs.inflate_end;
+  }
+
+  void *xz = dlopen("liblzma.so.5", RTLD_NOW | RTLD_LOCAL);
+  if (xz)
+  {
+    libs.lzma_decoder = (lzma_decoder_fn)dlsym(xz, "lzma_stream_decoder");
+    libs.lzma_code = (lzma_code_fn)dlsym(xz, "lzma_code");
+    libs.lzma_end = (lzma_end_fn)dlsym(xz, "lzma_end");
+    libs.loaded[GZXZ_XZ] = libs.lzma_decoder && libs.lzma_code && libs.lzma_end;
+  }
+}
+
+struct gzxz_reader
+{
+  int kind;
+  FILE *in;
+  const char *prefix;   // bytes handed in before the stream
+  size_t prefix_len;
+  int prefix_done;
+  char *buf;            // compressed bytes read from 'in'
+  const uint8_t *next;  // unconsumed compressed bytes
+  size_t avail;
+  int in_eof;           // nothing more to read
+  int done;             // the data ended or was corrupt
+  gzxz_zstream_t zs;
+  gzxz_lzma_t xs;
+};
+
+int gzxz_detect(const char *buf, size_t len)
+{
+  static const unsigned char xz_magic[6] = {0xfd, '7', 'z', 'X', 'Z', 0};
+  if (len >= 2 && (unsigned char)buf[0] == 0x1f && (unsigned char)buf[1] == 0x8b)
+  {
+    return GZXZ_GZIP;
+  }
+  if (len >= sizeof(xz_magic) && !memcmp(buf, xz_magic, sizeof(xz_magic)))
+  {
+    return GZXZ_XZ;
+  }
+  return GZXZ_NONE;
+}
+
+gzxz_reader_t *gzxz_open(int kind, FILE *in, const char *prefix, size_t prefix_len)
+{
+  std::call_once(libs_once, gzxz_load);
+  if (kind != GZXZ_GZIP && kind != GZXZ_XZ)
+  {
+    return NULL;
+  }
+  if (!libs.loaded[kind])
+  {
+    fprintf(stderr, "Error: %s is not available to decode the trace\n", kind == GZXZ_GZIP ? "libz.so.1" : "liblzma.so.5");
+    return NULL;
+  }
+  gzxz_reader_t *z = (gzxz_reader_t *)calloc(1, sizeof(gzxz_reader_t));
+  z->kind = kind;
+  z->in = in;
+  z->prefix = prefix;
+  z->prefix_len = prefix_len;
+  z->in_eof = !in;
+  z->buf = in ? (char *)malloc(GZXZ_IN_SIZE) : NULL;
+  // 15 + 32 takes a gzip or zlib header
+  int ok = kind == GZXZ_GZIP ? libs.inflate_init(&z->zs, 15 + 32, libs.zlib_version(), sizeof(z->zs)) == 0
+                             : libs.lzma_decoder(&z->xs, UINT64_MAX, GZXZ_LZMA_CONCATENATED) == 0;
+  if (!ok || (in && !z->buf))
+  {
+    fprintf(stderr, "Error: unable to start decoding the trace\n");
+    free(z->buf);
+    free(z);
+    return NULL;
+  }
+  return z;
+}
+
+// Point at the next compressed bytes once the ones before are used
+//
+static void gzxz_refill(gzxz_reader_t *z)
+{
+  if (z->avail || (z->prefix_done && z->in_eof))
+  {
+    return;
+  }
+  if (!z->prefix_done)
+  {
+    z->prefix_done = 1;
+    z->next = (const uint8_t *)z->prefix;
+    z->avail = z->prefix_len;
+    if (z->avail)
+    {
+      return;
+    }
+  }
+  if (!z->in_eof)
+  {
+    z->avail = fread(z->buf, 1, GZXZ_IN_SIZE, z->in);
+    z->next = (const uint8_t *)z->buf;
+    z->in_eof = z->avail == 0;
+  }
+}
+
+size_t gzxz_read(gzxz_reader_t *z, char *dst, size_t cap)
+{
+  size_t out = 0;
+  while (out < cap && !z->done)
+  {
+    gzxz_refill(z);
+    int end = !z->avail && z->prefix_done && z->in_eof;
+    if (z->kind == GZXZ_GZIP)
+    {
+      if (end)
+      {
+        break;
+      }
+      z->zs.next_in = z->next;
+      z->zs.avail_in = z->avail > UINT32_MAX ? UINT32_MAX : (unsigned)z->avail;
+      z->zs.next_out = (uint8_t *)dst + out;
+      z->zs.avail_out = cap - out > UINT32_MAX ? UINT32_MAX : (unsigned)(cap - out);
+      unsigned before_in = z->zs.avail_in, before_out = z->zs.avail_out;
+      int ret = libs.inflate(&z->zs, 0);
+      z->next += before_in - z->zs.avail_in;
+      z->avail -= before_in - z->zs.avail_in;
+      out += before_out - z->zs.avail_out;
+      if (ret == GZXZ_Z_STREAM_END)
+      {
+        // another gzip member may follow
+        libs.inflate_reset(&z->zs);
+      }
+      else if (ret != 0 && ret != GZXZ_Z_BUF_ERROR)
+      {
+        fprintf(stderr, "Error: corrupt gzip trace (%s)\n", z->zs.msg ? z->zs.msg : "inflate failed");
+        z->done = 1;
+      }
+    }
+    else
+    {
+      z->xs.next_in = z->next;
+      z->xs.avail_in = z->avail;
+      z->xs.next_out = (uint8_t *)dst + out;
+      z->xs.avail_out = cap - out;
+      int ret = libs.lzma_code(&z->xs, end ? GZXZ_LZMA_FINISH : GZXZ_LZMA_RUN);
+      z->next += z->avail - z->xs.avail_in;
+      z->avail = z->xs.avail_in;
+      size_t got = cap - out - z->xs.avail_out;
+      out += got;
+      if (ret == GZXZ_LZMA_STREAM_END)
+      {
+        z->done = 1;
+      }
+      else if (ret != 0)
+      {
+        fprintf(stderr, "Error: corrupt xz trace (lzma error %d)\n", ret);
+        z->done = 1;
+      }
+      else if (end && !got)
+      {
+        fprintf(stderr, "Error: truncated xz trace\n");
+        z->done = 1;
+      }
+    }
+  }
+  return out;
+}
+
+void gzxz_close(gzxz_reader_t *z)
+{
+  if (!z)
+  {
+    return;
+  }
+  if (z->kind == GZXZ_GZIP)
+  {
+    libs.inflate_end(&z->zs);
+  }
+  else
+  {
+    libs.lzma_end(&z->xs);
+  }
+  free(z->buf);
+  free(z);
+}
@@ -0,0 +1,46 @@
+//========================================================//
+//  gzxz.h                                                //
+//  Header file for the in-process gzip and xz decoders   //
+//                                                        //
+//  zlib and liblzma are loaded from the system libraries //
+//  at run time like the codecs, see codec.h              //
+//========================================================//
+
+#ifndef GZXZ_H
+#define GZXZ_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Compressions recognized by gzxz_detect
+#define GZXZ_NONE 0
+#define GZXZ_GZIP 1
+#define GZXZ_XZ 2
+
+typedef struct gzxz_reader gzxz_reader_t;
+
+// Compression of the data starting with 'buf'
+//
+// Returns GZXZ_GZIP, GZXZ_XZ or GZXZ_NONE
+//
+int gzxz_detect(const char *buf, size_t len);
+
+// Start decoding a 'kind' stream: the 'prefix_len' bytes of 'prefix'
+// first, then the rest of 'in' when it is not NULL. 'prefix' must stay
+// valid until gzxz_close, e.g. a mapped file; several concatenated
+// streams are decoded as one
+//
+// Returns NULL if the library of 'kind' can not be loaded
+//
+gzxz_reader_t *gzxz_open(int kind, FILE *in, const char *prefix, size_t prefix_len);
+
+// Copy up to 'cap' decompressed bytes into 'dst'
+//
+// Returns the number of bytes copied, 0 at the end of the data or on
+// a corrupt stream, which is reported
+//
+size_t gzxz_read(gzxz_reader_t *z, char *dst, size_t cap);
+
+void gzxz_close(gzxz_reader_t *z);
+
+#endif
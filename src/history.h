@@ -0,0 +1,212 @@
+//========================================================//
+//  history.h                                             //
+//  Header file for the shared global history             //
+//                                                        //
+//  Outcome, path and target history of the records of a  //
+//  trace, advanced once per batch by the driver and read //
+//  by every predictor replaying that batch               //
+//========================================================//
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include <string.h>
+#include "predictor.h"
+#include "foldhist.h"
+
+// Most records history_fill takes at once
+#define HISTORY_BATCH 4096
+
+// The registers, as a mask of those a predictor reads, see
+// predictor_history_regs
+#define HISTORY_OUTCOMES (1 << 0)
+#define HISTORY_PATH     (1 << 1)
+#define HISTORY_TARGETS  (1 << 2)
+#define HISTORY_ALL      (HISTORY_OUTCOMES | HISTORY_PATH | HISTORY_TARGETS)
+
+// Bits each branch shifts into the path and target registers
+#define HISTORY_PATH_BITS 2
+#define HISTORY_TARGET_BITS 2
+
+// The registers, newest bits lowest. Outcomes are of conditional
+// branches only, as in the predictors' own registers; the path takes
+// the low PC bits of every branch, unconditional jumps and calls
+// included, and the targets bits 2 and up of every taken one
+typedef struct bp_history
+{
+  uint64_t outcomes;
+  uint64_t path;
+  uint64_t targets;
+} bp_history_t;
+
+// The conditional branches of a batch of records, in order, with the
+// registers of 'regs' before each. A predictor walks these instead of
+// the records and skips no unconditional ones
+typedef struct bp_history_batch
+{
+  size_t n;                          // records the batch was filled from
+  size_t count;                      // conditional branches among them
+  int regs;
+  uint16_t index[HISTORY_BATCH];     // of the record
+  uint8_t taken[HISTORY_BATCH];
+  uint32_t pc[HISTORY_BATCH];
+  uint64_t outcomes[HISTORY_BATCH];
+  uint64_t path[HISTORY_BATCH];
+  uint64_t targets[HISTORY_BATCH];
+} bp_history_batch_t;
+
+// Advance 'h' past one record. The flags select the shifts instead of
+// branches, which would mispredict on every record the trace's own way.
+// A gap summary shifts in the bits of all the branches it stands for
+static inline void history_push(bp_history_t *h, const predictor_branch_t *br)
+{
+  uint64_t cond = (br->flags / BP_F_CONDITION) & 1;
+  uint64_t taken = br->flags & BP_F_TAKEN;
+  uint64_t summary = (br->flags / BP_F_SUMMARY) & 1;
+  uint32_t low = (1u << BP_SUMMARY_SHIFT) - 1;
+  uint64_t branches = summary ? br->pc >> BP_SUMMARY_SHIFT : 1;
+  uint64_t path = summary ? br->pc & low : br->pc & ((1u << HISTORY_PATH_BITS) - 1);
+  uint64_t takens = summary ? br->target >> BP_SUMMARY_SHIFT : taken;
+  uint64_t targets = summary ? br->target & low : ((br->target >> 2) & ((1u << HISTORY_TARGET_BITS) - 1)) & -taken;
+  h->outcomes = (h->outcomes << cond) | (taken & cond);
+  h->path = (h->path << (branches * HISTORY_PATH_BITS)) | path;
+  h->targets = (h->targets << (takens * HISTORY_TARGET_BITS)) | targets;
+}
+
+// Gather the conditional branches of the 'n' records, up to
+// HISTORY_BATCH, into 'b' with the registers 'regs' before each, and
+// advance 'h' past them all. Every record is written to the next slot
+// and only a conditional one moves past it, so nothing branches on the
+// flags. The registers not in 'regs' are not advanced, so a stream is
+// filled with the same 'regs' throughout
+static inline void history_fill(bp_history_t *h, const predictor_branch_t *br, size_t n, int regs,
+                                bp_history_batch_t *b)
+{
+  // in locals, the stores to 'b' could otherwise alias them
+  bp_history_t r = *h;
+  size_t k = 0;
+  b->n = n;
+  b->regs = regs;
+  if (!(regs & ~HISTORY_OUTCOMES))
+  {
+    // only the outcomes, what the built-in predictors read
+    for (size_t i = 0; i < n; i++)
+    {
+      uint64_t cond = (br[i].flags / BP_F_CONDITION) & 1;
+      uint64_t taken = br[i].flags & BP_F_TAKEN;
+      b->index[k] = i;
+      b->taken[k] = taken;
+      b->pc[k] = br[i].pc;
+      b->outcomes[k] = r.outcomes;
+      r.outcomes = (r.outcomes << cond) | (taken & cond);
+      k += cond;
+    }
+    h->outcomes = r.outcomes;
+    b->count = k;
+    return;
+  }
+  for (size_t i = 0; i < n; i++)
+  {
+    b->index[k] = i;
+    b->taken[k] = br[i].flags & BP_F_TAKEN;
+    b->pc[k] = br[i].pc;
+    b->outcomes[k] = r.outcomes;
+    b->path[k] = r.path;
+    b->targets[k] = r.targets;
+    k += (br[i].flags / BP_F_CONDITION) & 1;
+    history_push(&r, &br[i]);
+  }
+  *h = r;
+  b->count = k;
+}
+
+// Folded histories shared by the TAGE predictors replaying one stream,
+// see predictor_fold_attach: each distinct pair of a history length
+// and a width is folded once per conditional branch, however many
+// tables of however many predictors read it. Up to HISTORY_FOLDS_MAX
+// pairs, over batches of up to HISTORY_FOLD_BATCH records
+#define HISTORY_FOLDS_MAX 128
+#define HISTORY_FOLD_BATCH 1024
+#define HISTORY_FOLD_BUF 2048 // outcomes kept, above TAGE_MAX_HIST
+
+typedef struct bp_folds
+{
+  int n;                                 // pairs
+  uint16_t len[HISTORY_FOLDS_MAX];
+  uint8_t width[HISTORY_FOLDS_MAX];
+  uint8_t outpoint[HISTORY_FOLDS_MAX];   // len % width, where the oldest outcome leaves
+  uint32_t value[HISTORY_FOLDS_MAX];     // after the last branch filled
+  uint64_t pos;                          // outcomes pushed so far
+  uint64_t ghist;                        // last 64 outcomes, newest in bit 0
+  uint8_t buf[HISTORY_FOLD_BUF];         // last outcomes, one per byte, by position
+  // the conditional branches of the batch last filled, in order, with
+  // the registers before each; row k holds the n values before branch k
+  size_t records;
+  size_t count;
+  uint16_t index[HISTORY_FOLD_BATCH];    // of the record
+  uint8_t taken[HISTORY_FOLD_BATCH];
+  uint32_t pc[HISTORY_FOLD_BATCH];
+  uint64_t ghists[HISTORY_FOLD_BATCH];
+  uint32_t rows[HISTORY_FOLD_BATCH * HISTORY_FOLDS_MAX];
+} bp_folds_t;
+
+// Returns the slot of the history of 'len' outcomes folded to 'width'
+// bits in 'f', added when new, or -1 when 'f' is full or has started
+static inline int history_fold_add(bp_folds_t *f, int len, int width)
+{
+  for (int i = 0; i < f->n; i++)
+  {
+    if (f->len[i] == len && f->width[i] == width)
+    {
+      return i;
+    }
+  }
+  if (f->n == HISTORY_FOLDS_MAX || f->pos || len >= HISTORY_FOLD_BUF)
+  {
+    return -1;
+  }
+  f->len[f->n] = (uint16_t)len;
+  f->width[f->n] = (uint8_t)width;
+  f->outpoint[f->n] = (uint8_t)(len % width);
+  f->value[f->n] = 0;
+  return f->n++;
+}
+
+// Gather the conditional branches of the 'n' records, up to
+// HISTORY_FOLD_BATCH, into 'f' with the folded histories before each,
+// and advance them past them all
+static inline void history_fold_fill(bp_folds_t *f, const predictor_branch_t *br, size_t n)
+{
+  int folds = f->n;
+  uint64_t pos = f->pos, ghist = f->ghist;
+  size_t k = 0;
+  f->records = n;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (!(br[i].flags & BP_F_CONDITION))
+    {
+      continue;
+    }
+    uint8_t taken = br[i].flags & BP_F_TAKEN;
+    f->index[k] = (uint16_t)i;
+    f->taken[k] = taken;
+    f->pc[k] = br[i].pc;
+    f->ghists[k] = ghist;
+    memcpy(&f->rows[k * folds], f->value, folds * sizeof(uint32_t));
+    k++;
+    pos++;
+    f->buf[pos & (HISTORY_FOLD_BUF - 1)] = taken;
+    ghist = (ghist << 1) | taken;
+    for (int j = 0; j < folds; j++)
+    {
+      uint8_t out = f->buf[(pos - f->len[j]) & (HISTORY_FOLD_BUF - 1)];
+      f->value[j] = fold_push(f->value[j], taken, out, f->outpoint[j], f->width[j]);
+    }
+  }
+  f->pos = pos;
+  f->ghist = ghist;
+  f->count = k;
+}
+
+#endif
@@ -0,0 +1,167 @@
+//========================================================//
+//  hotcheck.cpp                                          //
+//  Source file for the hot loop allocation and system    //
+//  call counters                                         //
+//                                                        //
+//  The allocator entry points forward to glibc's own.    //
+//  System calls are the syscr and syscw counts of        //
+//  /proc/self/io, which include the writes stdio makes   //
+//  from inside libc, less those of reading the file      //
+//========================================================//
+
+#ifdef BP_HOTCHECK
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include "hotcheck.h"
+
+extern "C"
+{
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t n, size_t size);
+  void *__libc_realloc(void *ptr, size_t size);
+  void *__libc_memalign(size_t align, size_t size);
+  void __libc_free(void *ptr);
+}
+
+static std::atomic<int> active;
+static std::atomic<uint64_t> allocs, frees;
+static uint64_t reads, writes, records, batches;
+static uint64_t read_base, write_base;
+static int64_t probe_reads = -1; // syscr of reading /proc/self/io once
+
+extern "C"
+{
+  void *malloc(size_t size)
+  {
+    if (active.load(std::memory_order_relaxed))
+    {
+      allocs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return __libc_malloc(size);
+  }
+
+  void *calloc(size_t n, size_t size)
+  {
+    if (active.load(std::memory_order_relaxed))
+    {
+      allocs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return __libc_calloc(n, size);
+  }
+
+  void *realloc(void *ptr, size_t size)
+  {
+    if (active.load(std::memory_order_relaxed))
+    {
+      allocs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return __libc_realloc(ptr, size);
+  }
+
+  void *memalign(size_t align, size_t size)
+  {
+    if (active.load(std::memory_order_relaxed))
+    {
+      allocs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return __libc_memalign(align, size);
+  }
+
+  void *aligned_alloc(size_t align, size_t size)
+  {
+    return memalign(align, size);
+  }
+
+  int posix_memalign(void **out, size_t align, size_t size)
+  {
+    void *p = memalign(align, size);
+    if (!p)
+    {
+      return ENOMEM;
+    }
+    *out = p;
+    return 0;
+  }
+
+  void free(void *ptr)
+  {
+    if (ptr && active.load(std::memory_order_relaxed))
+    {
+      frees.fetch_add(1, std::memory_order_relaxed);
+    }
+    __libc_free(ptr);
+  }
+}
+
+// The syscr and syscw counts of the process
+//
+// Returns True if Successful
+//
+static int hotcheck_io(uint64_t *syscr, uint64_t *syscw)
+{
+  char buf[512];
+  int fd = open("/proc/self/io", O_RDONLY);
+  ssize_t n = fd >= 0 ? read(fd, buf, sizeof(buf) - 1) : -1;
+  if (fd >= 0)
+  {
+    close(fd);
+  }
+  if (n <= 0)
+  {
+    return 0;
+  }
+  buf[n] = '\0';
+  const char *r = strstr(buf, "syscr:"), *w = strstr(buf, "syscw:");
+  if (!r || !w)
+  {
+    return 0;
+  }
+  *syscr = strtoull(r + 6, NULL, 10);
+  *syscw = strtoull(w + 6, NULL, 10);
+  return 1;
+}
+
+void hotcheck_begin()
+{
+  if (probe_reads < 0)
+  {
+    // two reads back to back differ by the reads of one
+    uint64_t r0, r1, w;
+    probe_reads = hotcheck_io(&r0, &w) && hotcheck_io(&r1, &w) ? (int64_t)(r1 - r0) : 0;
+  }
+  hotcheck_io(&read_base, &write_base);
+  active.store(batches > 0, std::memory_order_relaxed);
+}
+
+void hotcheck_end(uint64_t n)
+{
+  int counted = active.exchange(0, std::memory_order_relaxed);
+  uint64_t r, w;
+  if (counted && hotcheck_io(&r, &w))
+  {
+    uint64_t own = (uint64_t)probe_reads;
+    reads += r - read_base > own ? r - read_base - own : 0;
+    writes += w - write_base;
+    records += n;
+  }
+  batches++;
+}
+
+int hotcheck_report(FILE *out)
+{
+  double per = records ? 1e6 / records : 0;
+  uint64_t a = allocs.load(), f = frees.load();
+  fprintf(out, "Hot loop:      %10llu records after the first batch\n", (unsigned long long)records);
+  fprintf(out, "  Allocations: %10llu (%.2f per M records)\n", (unsigned long long)a, a * per);
+  fprintf(out, "  Frees:       %10llu (%.2f per M records)\n", (unsigned long long)f, f * per);
+  fprintf(out, "  Read calls:  %10llu (%.2f per M records)\n", (unsigned long long)reads, reads * per);
+  fprintf(out, "  Write calls: %10llu (%.2f per M records)\n", (unsigned long long)writes, writes * per);
+  return !a && !f && !reads && !writes;
+}
+
+#endif
@@ -0,0 +1,53 @@
+//========================================================//
+//  hotcheck.h                                            //
+//  Header file for the hot loop allocation and system    //
+//  call counters                                         //
+//                                                        //
+//  Built with -DBP_HOTCHECK (make HOTCHECK=1), malloc    //
+//  and free are interposed, and the allocations, frees   //
+//  and read and write system calls of the process are   //
+//  counted while a batch of the replay loop is being    //
+//  simulated. Without it the calls below are empty      //
+//========================================================//
+
+#ifndef HOTCHECK_H
+#define HOTCHECK_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef BP_HOTCHECK
+
+// Open the window of one batch, after its records are read
+//
+void hotcheck_begin();
+
+// Close the window of a batch of 'records' records. The first batch
+// sets up lazily allocated state and is not counted
+//
+void hotcheck_end(uint64_t records);
+
+// Print the counts per million records of the counted batches
+//
+// Returns True if there were none
+//
+int hotcheck_report(FILE *out);
+
+#else
+
+static inline void hotcheck_begin()
+{
+}
+
+static inline void hotcheck_end(uint64_t)
+{
+}
+
+static inline int hotcheck_report(FILE *)
+{
+  return 1;
+}
+
+#endif
+
+#endif
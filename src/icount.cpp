@@ -0,0 +1,131 @@
+//========================================================//
+//  icount.cpp                                            //
+//  Source file for the instruction count sidecar         //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "icount.h"
+
+struct icount
+{
+  const uint8_t *map;
+  size_t len;
+  size_t pos;  // of the next record's varint
+  int ended;   // a read ran past the end
+};
+
+// Map 'path' as a sidecar
+//
+// Returns NULL if it is missing or has not the magic
+//
+static icount_t *icount_map(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    return NULL;
+  }
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (!fstat(fd, &st) && (size_t)st.st_size >= ICOUNT_MAGIC_LEN)
+  {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    return NULL;
+  }
+  if (memcmp(map, ICOUNT_MAGIC, ICOUNT_MAGIC_LEN))
+  {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  icount_t *ic = (icount_t *)calloc(1, sizeof(icount_t));
+  ic->map = (const uint8_t *)map;
+  ic->len = st.st_size;
+  ic->pos = ICOUNT_MAGIC_LEN;
+  return ic;
+}
+
+icount_t *icount_open(const char *trace_path)
+{
+  if (!trace_path || !strcmp(trace_path, "-"))
+  {
+    return NULL;
+  }
+  size_t len = strlen(trace_path);
+  char *path = (char *)malloc(len + 6);
+  snprintf(path, len + 6, "%s.icnt", trace_path);
+  icount_t *ic = icount_map(path);
+  if (!ic && len > 4 && !strcmp(trace_path + len - 4, ".bz2"))
+  {
+    snprintf(path, len + 6, "%.*s.icnt", (int)(len - 4), trace_path);
+    ic = icount_map(path);
+  }
+  free(path);
+  return ic;
+}
+
+uint64_t icount_read(icount_t *ic, uint32_t *deltas, uint64_t n)
+{
+  const uint8_t *p = ic->map + ic->pos;
+  const uint8_t *end = ic->map + ic->len;
+  uint64_t sum = 0;
+  uint64_t i = 0;
+  for (; i < n && p < end; i++)
+  {
+    // one byte deltas, the common case, take the straight path
+    uint64_t v = *p++;
+    if (v & 0x80)
+    {
+      v &= 0x7f;
+      for (int shift = 7; p < end && shift < 64; shift += 7)
+      {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+          break;
+        }
+      }
+    }
+    if (deltas)
+    {
+      deltas[i] = v < UINT32_MAX ? (uint32_t)v : UINT32_MAX;
+    }
+    sum += v;
+  }
+  if (i < n)
+  {
+    ic->ended = 1;
+    if (deltas)
+    {
+      memset(deltas + i, 0, (n - i) * sizeof(uint32_t));
+    }
+  }
+  ic->pos = p - ic->map;
+  return sum;
+}
+
+int icount_short(const icount_t *ic)
+{
+  return ic->ended;
+}
+
+void icount_close(icount_t *ic)
+{
+  if (!ic)
+  {
+    return;
+  }
+  munmap((void *)ic->map, ic->len);
+  free(ic);
+}
@@ -0,0 +1,48 @@
+//========================================================//
+//  icount.h                                              //
+//  Header file for the instruction count sidecar         //
+//                                                        //
+//  branchExt -icount writes <trace>.icnt next to each    //
+//  trace file: ICOUNT_MAGIC, then per record in trace    //
+//  order the instructions since the record before, up    //
+//  to and through the branch's block, as an LEB128       //
+//  varint. The first record of a file counts from the    //
+//  start of its set. With it the simulator reports       //
+//  misses per thousand instructions                      //
+//========================================================//
+
+#ifndef ICOUNT_H
+#define ICOUNT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ICOUNT_MAGIC "BPICNT1"
+#define ICOUNT_MAGIC_LEN 8
+
+typedef struct icount icount_t;
+
+// Open the sidecar of the trace at 'trace_path': <trace_path>.icnt,
+// or for a .bz2 trace the name without .bz2 and .icnt
+//
+// Returns NULL if there is none or it is not a sidecar
+//
+icount_t *icount_open(const char *trace_path);
+
+// Decode the deltas of the next 'n' records into 'deltas', or only
+// add them up with 'deltas' NULL
+//
+// Returns the instructions of the records, 0 past the end
+//
+uint64_t icount_read(icount_t *ic, uint32_t *deltas, uint64_t n);
+
+// Whether the sidecar ended before the records asked for, as when it
+// is of another trace
+//
+int icount_short(const icount_t *ic);
+
+// Release the sidecar
+//
+void icount_close(icount_t *ic);
+
+#endif
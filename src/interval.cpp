@@ -0,0 +1,207 @@
+//========================================================//
+//  interval.cpp                                          //
+//  Source file for the interval time series              //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "interval.h"
+
+int interval_init(interval_series_t *s, const char *path, uint64_t interval, const int *types, int num_types)
+{
+  memset(s, 0, sizeof(*s));
+  memcpy(s->hdr.magic, INTERVAL_MAGIC, sizeof(INTERVAL_MAGIC));
+  s->hdr.version = INTERVAL_VERSION;
+  s->hdr.num_predictors = num_types;
+  s->hdr.interval = interval;
+  for (int p = 0; p < num_types; p++)
+  {
+    s->hdr.types[p] = (uint8_t)types[p];
+  }
+  size_t len = strlen(path);
+  s->csv = len >= 4 && !strcmp(path + len - 4, ".csv");
+  if (!(s->out = fopen(path, "wb")))
+  {
+    return 0;
+  }
+  // The binary header is written again with the counts at the end
+  return s->csv || fwrite(&s->hdr, sizeof(s->hdr), 1, s->out) == 1;
+}
+
+// Start the file once it is known whether the rows have instructions
+//
+// Returns True if Successful
+//
+static int interval_start(interval_series_t *s, int instructions)
+{
+  s->started = 1;
+  s->instructions = instructions;
+  if (!s->csv)
+  {
+    // Binary instructions follow all the rows, so they wait in a file
+    return !instructions || (s->ins_rows = tmpfile()) != NULL;
+  }
+  fprintf(s->out, "window,first_branch,branches%s", instructions ? ",instructions" : "");
+  for (uint32_t p = 0; p < s->hdr.num_predictors; p++)
+  {
+    const char *name = bpName[s->hdr.types[p]];
+    fprintf(s->out, ",%s,%s_mpki", name, name);
+    if (instructions)
+    {
+      fprintf(s->out, ",%s_per_kinst", name);
+    }
+  }
+  fprintf(s->out, "\n");
+  return !ferror(s->out);
+}
+
+// Write the open window of 'branches' branches and clear it
+//
+// Returns True if Successful
+//
+static int interval_flush(interval_series_t *s, uint64_t branches)
+{
+  uint32_t np = s->hdr.num_predictors;
+  int ok = 1;
+  if (s->csv)
+  {
+    uint64_t w = s->hdr.windows;
+    fprintf(s->out, "%llu,%llu,%llu", (unsigned long long)w, (unsigned long long)(w * s->hdr.interval),
+            (unsigned long long)branches);
+    if (s->instructions)
+    {
+      fprintf(s->out, ",%llu", (unsigned long long)s->ins);
+    }
+    for (uint32_t p = 0; p < np; p++)
+    {
+      uint32_t m = s->misses[p];
+      fprintf(s->out, ",%u,%.3f", m, 1000.0 * m / branches);
+      if (s->instructions)
+      {
+        fprintf(s->out, ",%.3f", s->ins ? 1000.0 * m / s->ins : 0.0);
+      }
+    }
+    fprintf(s->out, "\n");
+    ok = !ferror(s->out);
+  }
+  else
+  {
+    ok = fwrite(s->misses, sizeof(uint32_t), np, s->out) == np &&
+         (!s->ins_rows || fwrite(&s->ins, sizeof(uint64_t), 1, s->ins_rows) == 1);
+  }
+  s->hdr.windows++;
+  s->in_window = 0;
+  s->ins = 0;
+  memset(s->misses, 0, sizeof(s->misses));
+  return ok;
+}
+
+// Add the instructions of records [from, to) to the open window
+static inline void interval_add_instructions(interval_series_t *s, const uint32_t *ins, size_t from, size_t to)
+{
+  uint64_t sum = 0;
+  for (size_t i = from; i < to; i++)
+  {
+    sum += ins[i];
+  }
+  s->ins += sum;
+}
+
+int interval_add(interval_series_t *s, const uint64_t *cond, const uint64_t *const *misses, const uint32_t *ins,
+                 size_t n)
+{
+  uint32_t np = s->hdr.num_predictors;
+  if (!s->started && !interval_start(s, ins != NULL))
+  {
+    return 0;
+  }
+  ins = s->instructions ? ins : NULL;
+  size_t counted = 0; // records whose instructions are in a window
+  for (size_t w = 0; w < (n + 63) / 64; w++)
+  {
+    // Split the word where windows end, one popcount per piece
+    uint64_t left = cond[w];
+    while (left)
+    {
+      uint64_t mask = ~0ULL;
+      uint64_t need = s->hdr.interval - s->in_window;
+      uint64_t bits = __builtin_popcountll(left);
+      if (bits >= need)
+      {
+        uint64_t last = left;
+        for (uint64_t k = 1; k < need; k++)
+        {
+          last &= last - 1;
+        }
+        last &= -last;
+        mask = last | (last - 1);
+        bits = need;
+      }
+      for (uint32_t p = 0; p < np; p++)
+      {
+        s->misses[p] += __builtin_popcountll(misses[p][w] & left & mask);
+      }
+      s->in_window += bits;
+      left &= ~mask;
+      if (s->in_window == s->hdr.interval)
+      {
+        // the window ends with the record of its last branch
+        if (ins)
+        {
+          size_t last = w * 64 + 63 - __builtin_clzll(cond[w] & mask);
+          interval_add_instructions(s, ins, counted, last + 1);
+          counted = last + 1;
+        }
+        if (!interval_flush(s, s->hdr.interval))
+        {
+          return 0;
+        }
+      }
+    }
+  }
+  if (ins)
+  {
+    interval_add_instructions(s, ins, counted, n);
+  }
+  return 1;
+}
+
+int interval_write(interval_series_t *s)
+{
+  uint64_t full = s->hdr.windows;
+  int ok = s->started || interval_start(s, 0);
+  s->hdr.last_branches = s->in_window ? s->in_window : full ? s->hdr.interval : 0;
+  if (ok && s->in_window)
+  {
+    ok = interval_flush(s, s->in_window);
+  }
+  if (ok && s->ins_rows)
+  {
+    // Append the instructions and count the rows in the header
+    char buf[1 << 16];
+    size_t got;
+    rewind(s->ins_rows);
+    while (ok && (got = fread(buf, 1, sizeof(buf), s->ins_rows)) > 0)
+    {
+      ok = fwrite(buf, 1, got, s->out) == got;
+    }
+    ok = ok && !ferror(s->ins_rows);
+  }
+  if (ok && !s->csv)
+  {
+    s->hdr.version = s->instructions ? INTERVAL_VERSION_INSTRUCTIONS : INTERVAL_VERSION;
+    ok = fseek(s->out, 0, SEEK_SET) == 0 && fwrite(&s->hdr, sizeof(s->hdr), 1, s->out) == 1;
+  }
+  if (s->ins_rows)
+  {
+    fclose(s->ins_rows);
+  }
+  if (fclose(s->out) != 0)
+  {
+    ok = 0;
+  }
+  s->out = NULL;
+  s->ins_rows = NULL;
+  return ok;
+}
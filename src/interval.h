@@ -0,0 +1,80 @@
+//========================================================//
+//  interval.h                                            //
+//  Header file for the interval time series              //
+//                                                        //
+//  Counts the mispredictions of each predictor in every  //
+//  window of N conditional branches, writing each row    //
+//  out as its window closes, in the same memory for a    //
+//  trace of any length                                   //
+//========================================================//
+
+#ifndef INTERVAL_H
+#define INTERVAL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "predictor.h"
+
+// A binary series is an interval_header_t followed by 'windows' rows
+// of 'num_predictors' uint32_t misprediction counts each. Every window
+// holds 'interval' conditional branches except the last, which holds
+// 'last_branches'. Version INTERVAL_VERSION_INSTRUCTIONS series then
+// have the uint64_t instructions of each window, from the trace's
+// instruction count sidecar (see icount.h)
+#define INTERVAL_MAGIC "BPIVL1"
+#define INTERVAL_VERSION 1
+#define INTERVAL_VERSION_INSTRUCTIONS 2
+
+typedef struct
+{
+  char magic[8];               // INTERVAL_MAGIC, NUL terminated
+  uint32_t version;            // INTERVAL_VERSION
+  uint32_t num_predictors;
+  uint64_t interval;
+  uint64_t windows;
+  uint64_t last_branches;
+  uint8_t types[NUM_BP_TYPES]; // predictor type of each column
+  uint8_t reserved[8 - NUM_BP_TYPES % 8];
+} interval_header_t;
+
+typedef struct
+{
+  interval_header_t hdr;
+  FILE *out;
+  int csv;                         // a CSV series, else binary
+  int started;                     // the first records were added
+  int instructions;                // the rows have instruction counts
+  FILE *ins_rows;                  // binary: those counts until the end
+  uint32_t misses[NUM_BP_TYPES];   // of the open window
+  uint64_t ins;                    // of the open window
+  uint64_t in_window;              // branches of the open window so far
+} interval_series_t;
+
+// Start a series of 'interval' branch windows for 'num_types'
+// predictors of 'types' in 'path', as CSV if it ends in ".csv" and in
+// the binary format otherwise, whose header is rewritten at the end so
+// the file has to be seekable
+//
+// Returns True if Successful
+//
+int interval_init(interval_series_t *s, const char *path, uint64_t interval, const int *types, int num_types);
+
+// Add 'n' records, given the pc_profile_outcomes 'cond' bitmap and
+// the pc_profile_misses bitmap of each predictor, and 'ins' the
+// instructions of each record when known, else NULL. A record's
+// instructions go to the window of its branch, those of the records
+// after a window's last conditional branch to the next window
+//
+// Returns True if Successful
+//
+int interval_add(interval_series_t *s, const uint64_t *cond, const uint64_t *const *misses, const uint32_t *ins,
+                 size_t n);
+
+// Write the open window and finish the file. Series with instructions
+// add them to each CSV row with the misses per 1000 of them
+//
+// Returns True if Successful
+//
+int interval_write(interval_series_t *s);
+
+#endif
@@ -0,0 +1,156 @@
+//========================================================//
+//  kernels.h                                             //
+//  Header file for the CPU dispatch of the SIMD kernels  //
+//                                                        //
+//  Each hot kernel is built in a variant per instruction //
+//  set, and the best the host runs is picked once at     //
+//  startup, so one binary runs at full speed on AVX2,    //
+//  AVX-512 and ARM hosts alike                           //
+//========================================================//
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#ifdef __aarch64__
+#include <sys/auxv.h>
+#endif
+
+// The instruction sets a kernel variant can take. The x86 ones each
+// include those before them, as NEON does for SVE:
+//  sse4.2  SSE4.2 and PCLMULQDQ
+//  avx2    AVX2
+//  avx512  AVX-512 F, CD, BW, DQ and VL, as on Skylake-SP and later
+enum
+{
+  KERNEL_SCALAR,
+  KERNEL_SSE42,
+  KERNEL_AVX2,
+  KERNEL_AVX512,
+  KERNEL_NEON,
+  KERNEL_SVE,
+  KERNEL_ISAS
+};
+
+static const char *const kernel_isa_names[KERNEL_ISAS] = {"scalar", "sse4.2", "avx2", "avx512", "neon", "sve"};
+
+// Names the highest instruction set the kernels may use, e.g.
+// BP_KERNELS=avx2 on an AVX-512 host, or scalar to rule out SIMD
+#define KERNELS_ENV "BP_KERNELS"
+
+// A kernel and the variant picked for this host, for --kernels
+typedef struct
+{
+  const char *kernel;
+  const char *variant;
+} kernel_choice_t;
+
+// Position of 'isa' in its family, scalar being 0 in both
+static inline int kernel_rank(int isa)
+{
+  return isa >= KERNEL_NEON ? isa - KERNEL_NEON + 1 : isa;
+}
+
+// Returns 1 if the host runs 'isa'
+//
+// On x86 it asks CPUID rather than __builtin_cpu_supports, whose
+// libgcc data Pin's C library lacks, and XGETBV whether the OS saves
+// the AVX and AVX-512 registers
+static inline int kernel_host_has(int isa)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned a, b, c, d;
+  if (isa == KERNEL_SCALAR)
+  {
+    return 1;
+  }
+  if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_2) || !(c & bit_PCLMUL))
+  {
+    return 0;
+  }
+  if (isa == KERNEL_SSE42)
+  {
+    return 1;
+  }
+  if (!(c & bit_OSXSAVE) || !(c & bit_AVX) || __get_cpuid_max(0, NULL) < 7)
+  {
+    return 0;
+  }
+  unsigned xcr0, xcr0_high;
+  __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_high) : "c"(0));
+  __cpuid_count(7, 0, a, b, c, d);
+  if ((xcr0 & 0x6) != 0x6 || !(b & bit_AVX2))
+  {
+    return 0;
+  }
+  if (isa == KERNEL_AVX2)
+  {
+    return 1;
+  }
+  const unsigned avx512 = bit_AVX512F | bit_AVX512CD | bit_AVX512BW | bit_AVX512DQ | bit_AVX512VL;
+  return isa == KERNEL_AVX512 && (xcr0 & 0xe0) == 0xe0 && (b & avx512) == avx512;
+#elif defined(__aarch64__)
+  unsigned long hwcap = getauxval(AT_HWCAP);
+  switch (isa)
+  {
+  case KERNEL_SCALAR:
+    return 1;
+  case KERNEL_NEON:
+    return (hwcap & HWCAP_ASIMD) != 0;
+  case KERNEL_SVE:
+    return (hwcap & HWCAP_ASIMD) && (hwcap & HWCAP_SVE);
+  }
+  return 0;
+#else
+  return isa == KERNEL_SCALAR;
+#endif
+}
+
+// The instruction set named by $BP_KERNELS, or -1 when it is unset
+//
+// Exits on a name that is not one
+static inline int kernel_cap()
+{
+  const char *name = getenv(KERNELS_ENV);
+  if (!name || !*name)
+  {
+    return -1;
+  }
+  for (int isa = 0; isa < KERNEL_ISAS; isa++)
+  {
+    if (!strcmp(name, kernel_isa_names[isa]))
+    {
+      return isa;
+    }
+  }
+  fprintf(stderr, "Invalid %s=%s, expected scalar, sse4.2, avx2, avx512, neon or sve\n", KERNELS_ENV, name);
+  exit(1);
+}
+
+// Returns 1 if a kernel variant for 'isa' may run: the host has it and
+// $BP_KERNELS allows it
+static inline int kernel_usable(int isa)
+{
+  int cap = kernel_cap();
+  return kernel_host_has(isa) && (cap < 0 || kernel_rank(isa) <= kernel_rank(cap));
+}
+
+// The highest instruction set the kernels may use
+static inline int kernel_best()
+{
+  for (int isa = KERNEL_ISAS - 1; isa > KERNEL_SCALAR; isa--)
+  {
+    if (kernel_usable(isa))
+    {
+      return isa;
+    }
+  }
+  return KERNEL_SCALAR;
+}
+
+#endif
@@ -0,0 +1,152 @@
+//========================================================//
+//  libbp.cpp                                             //
+//  Source file for libbp, the predictors as a library    //
+//                                                        //
+//  A libbp_t is a predictor_t; only the names here are   //
+//  exported from libbp.a and libbp.so                    //
+//========================================================//
+
+#include <stdlib.h>
+#include <string.h>
+#include "libbp.h"
+#include "predictor.h"
+
+#define LIBBP_EXPORT __attribute__((visibility("default")))
+
+static_assert(sizeof(libbp_branch_t) == sizeof(predictor_branch_t), "branch layout");
+static_assert(LIBBP_F_TAKEN == BP_F_TAKEN && LIBBP_F_CONDITION == BP_F_CONDITION && LIBBP_F_CALL == BP_F_CALL &&
+              LIBBP_F_RET == BP_F_RET && LIBBP_F_DIRECT == BP_F_DIRECT, "branch flags");
+
+// A checkpoint is the API version, the configuration and the state
+typedef struct
+{
+  uint32_t version;        // LIBBP_API_VERSION
+  uint32_t reserved;
+  predictor_config_t cfg;
+} libbp_checkpoint_t;
+
+static inline predictor_t *libbp_predictor(libbp_t *bp)
+{
+  return (predictor_t *)bp;
+}
+
+extern "C" {
+
+LIBBP_EXPORT int libbp_api_version(void)
+{
+  return LIBBP_API_VERSION;
+}
+
+LIBBP_EXPORT libbp_t *libbp_create(const char *spec)
+{
+  char name[32];
+  const char *colon = strchr(spec, ':');
+  size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+  if (len >= sizeof(name))
+  {
+    return NULL;
+  }
+  memcpy(name, spec, len);
+  name[len] = '\0';
+  int type = predictor_type_by_name(name);
+  if (type < 0 || type == PLUGIN)
+  {
+    return NULL;
+  }
+  predictor_config_t cfg = predictor_default_config(type);
+
+  // key=value pairs, comma separated
+  for (const char *at = colon ? colon + 1 : NULL; at && *at;)
+  {
+    const char *end = strchr(at, ',');
+    size_t n = end ? (size_t)(end - at) : strlen(at);
+    char pair[64];
+    if (n >= sizeof(pair))
+    {
+      return NULL;
+    }
+    memcpy(pair, at, n);
+    pair[n] = '\0';
+    char *eq = strchr(pair, '=');
+    char *rest;
+    if (!eq)
+    {
+      return NULL;
+    }
+    *eq = '\0';
+    long value = strtol(eq + 1, &rest, 0);
+    if (rest == eq + 1 || *rest || !predictor_config_set(&cfg, pair, (int)value))
+    {
+      return NULL;
+    }
+    at = end ? end + 1 : NULL;
+  }
+  return (libbp_t *)predictor_create(&cfg);
+}
+
+LIBBP_EXPORT void libbp_destroy(libbp_t *bp)
+{
+  predictor_destroy(libbp_predictor(bp));
+}
+
+LIBBP_EXPORT int libbp_predict(libbp_t *bp, const libbp_branch_t *br)
+{
+  return predictor_predict(libbp_predictor(bp), br->pc, br->target, (br->flags & LIBBP_F_DIRECT) != 0) == TAKEN;
+}
+
+LIBBP_EXPORT void libbp_train(libbp_t *bp, const libbp_branch_t *br)
+{
+  uint8_t f = br->flags;
+  predictor_train(libbp_predictor(bp), br->pc, br->target, (f & LIBBP_F_TAKEN) != 0, (f & LIBBP_F_CONDITION) != 0,
+                  (f & LIBBP_F_CALL) != 0, (f & LIBBP_F_RET) != 0, (f & LIBBP_F_DIRECT) != 0);
+}
+
+LIBBP_EXPORT int libbp_predict_train(libbp_t *bp, const libbp_branch_t *br)
+{
+  uint8_t f = br->flags;
+  return predictor_predict_and_train(libbp_predictor(bp), br->pc, br->target, (f & LIBBP_F_TAKEN) != 0,
+                                     (f & LIBBP_F_CONDITION) != 0, (f & LIBBP_F_CALL) != 0, (f & LIBBP_F_RET) != 0,
+                                     (f & LIBBP_F_DIRECT) != 0) == TAKEN;
+}
+
+LIBBP_EXPORT uint64_t libbp_predict_batch(libbp_t *bp, const libbp_branch_t *br, size_t n, uint64_t *predictions)
+{
+  return predictor_predict_batch(libbp_predictor(bp), (const predictor_branch_t *)br, n, predictions);
+}
+
+LIBBP_EXPORT size_t libbp_checkpoint_size(libbp_t *bp)
+{
+  return sizeof(libbp_checkpoint_t) + predictor_state_size(libbp_predictor(bp));
+}
+
+LIBBP_EXPORT void libbp_checkpoint(libbp_t *bp, void *buf)
+{
+  libbp_checkpoint_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.version = LIBBP_API_VERSION;
+  hdr.cfg = *predictor_config(libbp_predictor(bp));
+  memcpy(buf, &hdr, sizeof(hdr));
+  predictor_save_state(libbp_predictor(bp), (char *)buf + sizeof(hdr));
+}
+
+LIBBP_EXPORT libbp_t *libbp_restore(const void *buf, size_t len)
+{
+  libbp_checkpoint_t hdr;
+  if (len < sizeof(hdr))
+  {
+    return NULL;
+  }
+  memcpy(&hdr, buf, sizeof(hdr));
+  if (hdr.version != LIBBP_API_VERSION)
+  {
+    return NULL;
+  }
+  return (libbp_t *)predictor_load_state(&hdr.cfg, (const char *)buf + sizeof(hdr), len - sizeof(hdr));
+}
+
+LIBBP_EXPORT void libbp_describe(const libbp_t *bp, char *buf, size_t len)
+{
+  predictor_config_format(predictor_config((const predictor_t *)bp), buf, len);
+}
+
+}
@@ -0,0 +1,100 @@
+//========================================================//
+//  libbp.h                                               //
+//  Header file for libbp, the predictors as a library    //
+//                                                        //
+//  A C interface for embedding the predictors in another //
+//  simulator: one handle per instance, no global state,  //
+//  nothing printed. Instances are independent, so each   //
+//  thread can drive its own at the same time; a single   //
+//  instance is used by one thread at a time.             //
+//========================================================//
+
+#ifndef LIBBP_H
+#define LIBBP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bumped whenever a declaration below changes
+#define LIBBP_API_VERSION 1
+
+typedef struct libbp libbp_t;
+
+// One branch, laid out like the packed records of the binary trace
+// format so a trace's records can be passed as they are
+typedef struct __attribute__((packed))
+{
+  uint32_t pc;
+  uint32_t target;
+  uint8_t flags;   // LIBBP_F_* bits
+} libbp_branch_t;
+
+#define LIBBP_F_TAKEN     (1 << 0)
+#define LIBBP_F_CONDITION (1 << 1)
+#define LIBBP_F_CALL      (1 << 2)
+#define LIBBP_F_RET       (1 << 3)
+#define LIBBP_F_DIRECT    (1 << 4)
+
+// LIBBP_API_VERSION of the library linked
+//
+int libbp_api_version(void);
+
+// Create a predictor from 'spec': a type name (static, gshare,
+// tournament, custom, perceptron, yags) and optionally ':' and
+// comma-separated key=value pairs of the --sweep parameters, e.g.
+// "custom:tageSC=1,tageTaggedBits=11"
+//
+// Returns NULL if the spec is invalid or out of memory
+//
+libbp_t *libbp_create(const char *spec);
+
+void libbp_destroy(libbp_t *bp);
+
+// Prediction for the conditional branch 'br', 1 taken or 0 not taken,
+// its outcome ignored
+//
+int libbp_predict(libbp_t *bp, const libbp_branch_t *br);
+
+// Train on the branch 'br', conditional or not, after libbp_predict
+//
+void libbp_train(libbp_t *bp, const libbp_branch_t *br);
+
+// libbp_predict then libbp_train with one lookup; the prediction is
+// only meaningful for a conditional branch
+//
+int libbp_predict_train(libbp_t *bp, const libbp_branch_t *br);
+
+// libbp_predict_train over 'n' branches in order. With 'predictions'
+// non NULL, bit i of it (word i / 64) is set when branch i is
+// predicted taken
+//
+// Returns the number of mispredicted conditional branches
+//
+uint64_t libbp_predict_batch(libbp_t *bp, const libbp_branch_t *br, size_t n, uint64_t *predictions);
+
+// Bytes libbp_checkpoint writes: the configuration and every table
+// and register
+//
+size_t libbp_checkpoint_size(libbp_t *bp);
+
+void libbp_checkpoint(libbp_t *bp, void *buf);
+
+// A new predictor from a libbp_checkpoint of this library version
+//
+// Returns NULL if 'buf' is not one
+//
+libbp_t *libbp_restore(const void *buf, size_t len);
+
+// The configuration of 'bp' as key=value pairs into 'buf'
+//
+void libbp_describe(const libbp_t *bp, char *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
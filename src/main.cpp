@@ -4,157 +4,2275 @@
 //  Students need to implement various Branch Predictors  //
 //========================================================//
 
+#include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include "predictor.h"
+#include "trace.h"
+#include "tracepipe.h"
+#include "traceidx.h"
+#include "tracecache.h"
+#include "sweep.h"
+#include "numa.h"
+#include "memo.h"
+#include "runner.h"
+#include "replay.h"
+#include "preddump.h"
+#include "missevents.h"
+#include "pcprof.h"
+#include "checkpoint.h"
+#include "sample.h"
+#include "shard.h"
+#include "partition.h"
+#include "results.h"
+#include "interval.h"
+#include "frontend.h"
+#include "oracle.h"
+#include "verify.h"
+#include "framecheck.h"
+#include "brclass.h"
+#include "progress.h"
+#include "probes.h"
+#include "remote.h"
+#include "server.h"
+#include "cluster.h"
+#include "synth.h"
+#include "chooser.h"
+#include "bpcost.h"
+#include "hotcheck.h"
+#include "bpocc.h"
+#include "perfctr.h"
+#include "icount.h"
+#include "timeline.h"
+#include "fingerprint.h"
+#include "calibrate.h"
+#include <string>
+#include <thread>
 
-FILE *stream;
-char *buf = NULL;
-size_t len = 0;
+trace_reader_t *trace;
+trace_pipe_t *pipe_reader = NULL;
+const char *trace_path = NULL;
+const char *shm_name = NULL;    // live records of branchExt -shm, see shmring.h
+int async_read = -1; // -1 picks based on the number of cores
+branch_record_t batch[TRACE_BATCH];
+const branch_record_t *pending; // rest of a batch split by the warmup
+size_t pending_len = 0;
+const char *cache_dir = NULL;   // decoded trace cache, see tracecache.h
+int compose_flush = 0;          // reset the predictors whenever a composed trace switches parts
+int bp_types[NUM_BP_TYPES];     // predictors replayed side by side
+int num_bp_types = 0;
+int jobs = 0;                   // sweep worker threads, 0 for one per core
+int trace_lanes = 1;            // traces a multi-trace worker replays interleaved
+uint64_t sweep_stop = 0;        // sweep early stop window, 0 for none
+uint64_t sweep_budget = 0;      // storage bits a sweep point may need, 0 for any
+uint64_t sweep_memory = 0;      // host bytes of the sweep's live predictors, 0 for any
+uint64_t sweep_prune = 0;       // skip sweep points this many times larger than the trace, 0 for none
+int sweep_gpu = 0;              // replay sweep points on an OpenCL device
+uint64_t sweep_split = 0;       // records a split sweep point trains on, 0 for no splits
+int sweep_interleave = 0;       // TAGE sweep points interleaved per worker, 0 for none
+int sweep_folds = 0;            // TAGE sweep points share their folded histories
+int sweep_block = 0;            // records each blocked sweep point replays in turn, 0 for none
+int sweep_halving = 0;          // fraction 1/n of sweep points kept each round, 0 for no rounds
+const char *sweep_checkpoint = NULL; // directory of resumable sweep point snapshots
+uint64_t sweep_checkpoint_seconds = SWEEP_CHECKPOINT_SECONDS;
+std::string sweep_memo_path;    // --memo in sweep_checkpoint when not given
+int shards = 0;                 // parallel shards of a single trace
+uint64_t shard_warmup = SHARD_WARMUP;
+int shard_warmup_auto = 0;      // the calibrated warmup of <trace>.warm
+int shard_exact = 0;            // re-run the shards whose warmup did not converge
+uint64_t start_branch = 0;      // first branch to replay
+int start_given = 0;            // --start overrides a loaded position
+uint64_t branch_count = ~0ULL;  // branches to replay from there
+uint64_t warmup = 0;            // branches that train but are not counted
+int sampling = 0;               // measure periodic windows only
+sample_config_t sample_cfg;
+int sample_skip_auto = 0;       // the calibrated warmup of <trace>.warm before each window
+int calibrate_starts = 0;       // cold starts of --calibrate-warmup, 0 for no calibration
+int stats = 0;                  // print timing after the results
+const char *dump_path = NULL;   // prediction dump, see preddump.h
+const char *events_path = NULL; // misprediction events, see missevents.h
+int event_pcs = 0;              // with the PC of each event
+int profile_top = 0;            // hot branches listed per predictor
+const char *pprof_path = NULL;  // the per-PC profiles as a pprof profile.proto
+const char *pprof_symbols = NULL; // and the nm symbol table naming its functions
+int classes = 0;                // mispredictions per branch class
+const char *serve_path = NULL;  // socket of --serve, see server.h
+const char *coordinate_address = NULL; // listening address of --coordinate, see cluster.h
+const char *worker_address = NULL;     // coordinator of --worker
+const char *worker_dir = NULL;         // traces a worker fetched
+const char *save_state_path = NULL; // predictor snapshots, see checkpoint.h
+const char *load_state_path = NULL;
+uint64_t checkpoint_every = 0;    // records between library snapshots
+const char *checkpoint_path = NULL;
+uint64_t interval = 0;          // branches per window of the time series
+const char *interval_path = NULL;
+const char *timeline_path = NULL; // Chrome trace of the replay spans, see timeline.h
+int frontend = 0;               // replay the BTB and RAS model
+fe_config_t fe_cfg = {FE_BTB_SETS, FE_BTB_WAYS, FE_REPLACE_LRU, FE_RAS_DEPTH, 0};
+int oracle_len = 0;             // replay the oracle bounds, with this local history
+int chooser_lo = 0, chooser_hi = 0; // index bits of --chooser-sweep, 0 for none
+int perf_counters = 0;          // host counters of the replay, 2 also per predictor
+int verify = 0;                 // check the replay against the reference path
+int verify_frames = 0;          // check the frame checksums of the traces first
+uint64_t verify_state_every = 0; // conditional branches between state compares
+verify_t verifier;
+int pipeline = 0;               // split the one predictor's replay over threads
+int partitions = 0;             // split the predictors' tables over threads
+int parallel = 0;               // each predictor on its own thread, sharing one reader
 
 // Print out the Usage information to stderr
 //
 void usage()
 {
-  fprintf(stderr, "Usage: predictor <options> [<trace>]\n");
+  fprintf(stderr, "Usage: predictor <options> [<trace>...]\n");
   fprintf(stderr, "       bunzip2 -kc trace.bz2 | predictor <options>\n");
+  fprintf(stderr, "       <trace> may be text, .bz2 or a binary trace written by tobin\n");
+  fprintf(stderr, "       several traces, directories or quoted globs run on --jobs threads\n");
+  fprintf(stderr, "       predictor merge <results>...  combines --results files of a --shard run\n");
   fprintf(stderr, " Options:\n");
   fprintf(stderr, " --help       Print this message\n");
+  fprintf(stderr, " --kernels    Print the SIMD kernel variants picked for this host; %s=<isa>\n", KERNELS_ENV);
+  fprintf(stderr, "              caps them at scalar, sse4.2, avx2, avx512, neon or sve\n");
   fprintf(stderr, " --verbose    Print predictions on stdout\n");
-  fprintf(stderr, " --<type>     Branch prediction scheme:\n");
-  fprintf(stderr, "    static\n"
-                  "    gshare\n"
-                  "    tournament\n"
-                  "    custom\n");
+  fprintf(stderr, " --decode-threads=<n>  Threads decompressing .bz2 traces\n");
+  fprintf(stderr, " --no-mmap    Read trace files through stdio instead of mapping them\n");
+  fprintf(stderr, " --uring[=direct]  Read trace files through io_uring, several reads ahead,\n");
+  fprintf(stderr, "              with O_DIRECT if given, instead of mapping them\n");
+  fprintf(stderr, " --remote-cache=<MB>  Frames of http(s):// and s3:// traces kept (default %d)\n",
+          REMOTE_CACHE_MB);
+  fprintf(stderr, " --verify     Check the checksum of every frame of the framed traces on --jobs\n");
+  fprintf(stderr, "              threads before replaying them, and stop at a corrupt one\n");
+  fprintf(stderr, " --[no-]async Decode the trace on a separate reader thread\n");
+  fprintf(stderr, " --shm=<name> Replay the records branchExt -shm <name> publishes as it traces\n");
+  fprintf(stderr, " --compose=<spec>  Replay concat(<a>,<b>,...) or interleave(<a>,<b>,...[,slice=<n>])\n");
+  fprintf(stderr, "              of traces, n records of each in turn (default %d)\n", TRACE_COMPOSE_SLICE);
+  fprintf(stderr, " --compose-flush  Reset the predictors and history whenever it switches traces\n");
+  fprintf(stderr, " --cache-dir=<dir>  Replay text and .bz2 traces from decoded copies in dir\n");
+  fprintf(stderr, "              (default $%s, --no-cache to disable), and the local\n", TRACE_CACHE_ENV);
+  fprintf(stderr, "              histories tournament sweep points read; framed traces have their\n");
+  fprintf(stderr, "              frames checked the first time they are replayed through it\n");
+  fprintf(stderr, " --sweep=<type>.<param>=<lo..hi[:step]|a,b,...>\n");
+  fprintf(stderr, "              Replay one predictor per parameter point, e.g.\n");
+  fprintf(stderr, "              --sweep=gshare.ghistoryBits=10..20\n");
+  fprintf(stderr, " --sweep-stop[=<n>]  Stop sweep points whose rate is clearly worse than the\n");
+  fprintf(stderr, "              best, checked every n records (default 1%% of the trace)\n");
+  fprintf(stderr, " --sweep-budget[=<bits>]  Skip sweep points whose tables and registers need more\n");
+  fprintf(stderr, "              bits (default %d, 64 Kbit + 1024)\n", PREDICTOR_BUDGET_BITS);
+  fprintf(stderr, " --sweep-memory=<MB>  Create sweep predictors only while their host memory fits\n");
+  fprintf(stderr, " --sweep-prune[=<x>]  Skip gshare and perceptron sweep points whose tables have\n");
+  fprintf(stderr, "              x times the entries the trace fills (default %d), from\n", SWEEP_PRUNE_FACTOR);
+  fprintf(stderr, "              the <trace>.stat of bpstat\n");
+  fprintf(stderr, " --sweep-split[=<n>]  Split the rest of a long sweep point when a worker is\n");
+  fprintf(stderr, "              idle, the new part training on the n records before it\n");
+  fprintf(stderr, "              (default %d); its rate is then approximate\n", SWEEP_SPLIT_WARMUP);
+  fprintf(stderr, " --sweep-interleave[=<k>]  Replay k TAGE sweep points per worker at once, a\n");
+  fprintf(stderr, "              branch of each in turn (default %d)\n", SWEEP_INTERLEAVE);
+  fprintf(stderr, " --sweep-folds  Replay up to %d TAGE sweep points per worker at once, folding\n",
+          PREDICTOR_LOCKSTEP_MAX);
+  fprintf(stderr, "              each history length they share once for all of them\n");
+  fprintf(stderr, " --sweep-block[=<n>]  Replay up to %d sweep points per worker over each block\n",
+          PREDICTOR_LOCKSTEP_MAX);
+  fprintf(stderr, "              of n records in turn (default %d)\n", SWEEP_BLOCK);
+  fprintf(stderr, " --sweep-halving[=<n>]  Search by successive halving: replay all points on a\n");
+  fprintf(stderr, "              prefix, keep the best 1/n (default %d) on one n times as long\n",
+          SWEEP_HALVING);
+  fprintf(stderr, "              and so on until the end of the trace\n");
+  fprintf(stderr, " --sweep-checkpoint=<dir>  Keep each completed sweep point and a snapshot of\n");
+  fprintf(stderr, "              each long one in dir, from which a restarted sweep resumes\n");
+  fprintf(stderr, " --sweep-checkpoint-every=<s>  Seconds between snapshots (default %d)\n",
+          SWEEP_CHECKPOINT_SECONDS);
+  fprintf(stderr, " --gpu        Replay gshare and tournament sweep points on an OpenCL\n");
+  fprintf(stderr, "              device, checking a few of them on the CPU\n");
+  fprintf(stderr, " --shard=<i>/<n>  Run only sweep points or traces i, i+n, i+2n, ...\n");
+  fprintf(stderr, " --results=<file>  Also write the sweep or multi-trace results to file,\n");
+  fprintf(stderr, "              to be combined with: predictor merge <file>...\n");
+  fprintf(stderr, " --memo=<file>  Keep every result in file and print the stored ones of a\n");
+  fprintf(stderr, "              run, sweep point or trace instead of replaying them\n");
+  fprintf(stderr, " --format=<text|json|csv>  Print the results as tables, JSON or CSV\n");
+  fprintf(stderr, " --serve=<socket>  Keep traces resident and answer jobs sent to the Unix\n");
+  fprintf(stderr, "              socket, one line each, with a line of JSON, see server.h\n");
+  fprintf(stderr, " --coordinate=<host:port>  Hand the sweep's points to the --worker processes\n");
+  fprintf(stderr, "              connecting there, keeping their results in --memo, then\n");
+  fprintf(stderr, "              print the sweep\n");
+  fprintf(stderr, " --worker=<host:port>  Replay points of that coordinator on --jobs connections\n");
+  fprintf(stderr, " --worker-dir=<dir>  Keep the traces a worker fetches in dir (default\n");
+  fprintf(stderr, "              $TMPDIR/%s)\n", CLUSTER_TRACE_DIR);
+  fprintf(stderr, " --jobs=<n>   Sweep and multi-trace worker threads (default one per core)\n");
+  fprintf(stderr, " --numa       Pin sweep and multi-trace workers to cores over the NUMA nodes,\n");
+  fprintf(stderr, "              with a copy of the sweep trace on each, and print each\n");
+  fprintf(stderr, "              node's throughput\n");
+  fprintf(stderr, " --lanes=<k>  Replay k traces at a time per multi-trace worker, a batch\n");
+  fprintf(stderr, "              of each in turn (1 to %d, default 1)\n", PREDICTOR_LOCKSTEP_MAX);
+  fprintf(stderr, " --start=<n>  Skip the first n branches of the trace\n");
+  fprintf(stderr, " --count=<n>  Replay at most n branches\n");
+  fprintf(stderr, " --warmup=<n> Train on n branches before counting, from --start\n");
+  fprintf(stderr, " --sample=<m>/<p>  Measure m branches out of every p and estimate the rate,\n");
+  fprintf(stderr, "              training on the branches in between\n");
+  fprintf(stderr, " --sample-skip=<w>  Skip between windows instead, training on w before each,\n");
+  fprintf(stderr, "              or auto for the calibrated warmup of <trace>.warm\n");
+  fprintf(stderr, " --sample=breaks[:<w>]  Measure the samples between the break records of a\n");
+  fprintf(stderr, "              bplbr trace, training on the first w branches of each (default %d)\n",
+          SAMPLE_BREAK_WARMUP);
+  fprintf(stderr, " --calibrate-warmup[=<k>]  Replay k cold starts (default %d) of --count\n",
+          CALIBRATE_STARTS);
+  fprintf(stderr, "              branches (default %d) next to a serial replay and write\n",
+          CALIBRATE_WINDOW);
+  fprintf(stderr, "              the warmup each predictor needs to <trace>.warm\n");
+  fprintf(stderr, " --shards=<k> Replay k parts of the trace at once, each warmed up on\n");
+  fprintf(stderr, " --shard-warmup=<w>  the w branches before it (default %d), or auto for the\n", SHARD_WARMUP);
+  fprintf(stderr, "              calibrated warmup of <trace>.warm\n");
+  fprintf(stderr, " --shard-exact  Compare each shard's state after its warmup with the state\n");
+  fprintf(stderr, "              the previous one ends in, and re-run it from there if they differ\n");
+  fprintf(stderr, " --partitions=<k>  Replay k ranges of each gshare table at once, with the\n");
+  fprintf(stderr, "              results of the serial replay\n");
+  fprintf(stderr, " --stats      Print wall time and throughput per phase\n");
+  fprintf(stderr, " --perf-counters[=each]  Count the host's cycles, cache, TLB and branch misses\n");
+  fprintf(stderr, "              per branch replayed, with each also per predictor\n");
+  fprintf(stderr, " --dump-predictions=<file>  Write every prediction as one bit, see preddiff\n");
+  fprintf(stderr, " --emit-mispredicts=<file>  Write where the conditional branches were\n");
+  fprintf(stderr, "              mispredicted, see missevents.h\n");
+  fprintf(stderr, " --emit-mispredicts-pc  and the PC of each\n");
+  fprintf(stderr, " --profile-pcs[=<n>]  List the n most mispredicted branches (default %d)\n", PC_PROFILE_TOP);
+  fprintf(stderr, " --pprof=<file>  Also write the per-PC profiles to file as a pprof profile.proto\n");
+  fprintf(stderr, " --pprof-symbols=<file>  Name its functions from an 'nm' symbol table\n");
+  fprintf(stderr, " --progress  Print the records replayed, their rate and the time left every second\n");
+  fprintf(stderr, " --classes  Split the mispredictions by branch class, see brclass.h\n");
+  fprintf(stderr, " --timeline=<file>  Write the decode, predict, sweep and pipeline spans of\n");
+  fprintf(stderr, "              every thread to file as a Chrome trace for Perfetto\n");
+  fprintf(stderr, " --interval=<n>  Count the mispredictions of every n conditional branches\n");
+  fprintf(stderr, " --interval-out=<file>  and write them to file, as CSV for a .csv name\n");
+  fprintf(stderr, " --btb[=<sets>x<ways>]  Also model a BTB (default %dx%d) and RAS and count the\n",
+          FE_BTB_SETS, FE_BTB_WAYS);
+  fprintf(stderr, "              taken branches of each class given a wrong target\n");
+  fprintf(stderr, " --btb-replace=<lru|fifo|random>  BTB replacement (default lru)\n");
+  fprintf(stderr, " --ras=<n>    Return address stack entries (default %d)\n", FE_RAS_DEPTH);
+  fprintf(stderr, " --ittage[=<b>]  Predict indirect targets with a 2^b row ITTAGE (default %d)\n",
+          FE_IT_ROW_BITS);
+  fprintf(stderr, " --oracle[=<l>]  Also count the mispredictions of the best static direction,\n");
+  fprintf(stderr, "              l-outcome local histories (default %d) and gshare, each with\n",
+          ORACLE_LOCAL_LEN);
+  fprintf(stderr, "              private unbounded tables per branch\n");
+  fprintf(stderr, " --verify-against=reference  Step a twin of each predictor one branch at a\n");
+  fprintf(stderr, "              time through the scalar predict and train calls, and stop at the\n");
+  fprintf(stderr, "              first prediction the replay does not share with it\n");
+  fprintf(stderr, " --verify-state=<n>  Also compare their tables every n conditional branches\n");
+  fprintf(stderr, " --pipeline    Replay a single --custom predictor on three threads: history\n");
+  fprintf(stderr, "              and hashes, table reads and updates, and the counts\n");
+  fprintf(stderr, " --parallel    Replay each of several predictors on a thread of its own, all\n");
+  fprintf(stderr, "              reading the batches of one reader thread\n");
+  fprintf(stderr, " --chooser-sweep[=<lo..hi>]  Replay the tournament once and evaluate choosers of\n");
+  fprintf(stderr, "              lo to hi index bits (default %d..%d) by global history, PC and\n",
+          CHOOSER_LO, CHOOSER_HI);
+  fprintf(stderr, "              both from its recorded component predictions\n");
+  fprintf(stderr, " --save-state=<file>  Save the predictors and trace position at the end\n");
+  fprintf(stderr, " --load-state=<file>  Start from saved predictors, at the saved position\n");
+  fprintf(stderr, " --checkpoint-every=<n>  Save the predictors every n records to a library,\n");
+  fprintf(stderr, " --checkpoint-out=<file>  whose snapshot nearest --start --load-state restores\n");
+  fprintf(stderr, "              unless --start is given\n");
+  fprintf(stderr, " --<type>     Branch prediction scheme, several may be given:\n");
+  for (int t = 0; t < NUM_BP_TYPES; t++)
+  {
+    if (t == PLUGIN)
+    {
+      continue;
+    }
+    char name[32];
+    size_t i = 0;
+    for (; bpName[t][i] && i + 1 < sizeof(name); i++)
+    {
+      name[i] = tolower((unsigned char)bpName[t][i]);
+    }
+    name[i] = '\0';
+    fprintf(stderr, "    %s\n", name);
+  }
+  fprintf(stderr, " --plugin=<lib.so>  Also run the predictor of a shared object, see bpplugin.h\n");
+  fprintf(stderr, " --hugepages[=<2M|1G>]  Put tables of 2 MB or more on reserved huge pages,\n");
+  fprintf(stderr, "              falling back to transparent ones (default 2M)\n");
+  fprintf(stderr, " --update-delay=<n>  Train each branch only after the next n are predicted,\n");
+  fprintf(stderr, "              with the history still updated at once\n");
+  fprintf(stderr, " --unbounded  Give gshare, tournament and custom an entry per distinct index\n");
+  fprintf(stderr, "              and tag, never evicted; --stats reports the entries each grew to\n");
+}
+
+// Print the SIMD kernels, with the variants picked for this host
+//
+void print_kernels()
+{
+  kernel_choice_t k[16];
+  int n = trace_kernels(k);
+  n += predictor_kernels(k + n);
+  const char *cap = getenv(KERNELS_ENV);
+  printf("host: %s%s%s\n", kernel_isa_names[kernel_best()], cap ? ", capped by " KERNELS_ENV "=" : "", cap ? cap : "");
+  for (int i = 0; i < n; i++)
+  {
+    printf("  %-26s %s\n", k[i].kernel, k[i].variant);
+  }
+}
+
+// Add 'type' to the predictors of this run
+//
+void select_predictor(int type)
+{
+  bpType = type;
+  for (int i = 0; i < num_bp_types; i++)
+  {
+    if (bp_types[i] == type)
+    {
+      return;
+    }
+  }
+  bp_types[num_bp_types++] = type;
+}
+
+// Type named by the option text 'name', up to a ':' if any
+//
+// Returns -1 if it names no predictor
+//
+int predictor_option_type(const char *name)
+{
+  const char *colon = strchr(name, ':');
+  return predictor_type_by_name(colon ? std::string(name, colon - name).c_str() : name);
+}
+
+// Parse the whole of 's' as an integer of 'lo' to 'hi' into 'v'
+//
+// Returns True if Successful
+//
+int parse_int_option(const char *s, int lo, int hi, int *v)
+{
+  char *end;
+  errno = 0;
+  long x = strtol(s, &end, 0);
+  if (!*s || *end || errno || x < lo || x > hi)
+  {
+    return 0;
+  }
+  *v = (int)x;
+  return 1;
+}
+
+// Process an option and update the predictor
+// configuration variables accordingly
+//
+// Returns True if Successful
+//
+int handle_option(char *arg)
+{
+  if (!strncmp(arg, "--plugin=", 9))
+  {
+    if (!predictor_plugin_load(arg + 9))
+    {
+      exit(1);
+    }
+    select_predictor(PLUGIN);
+  }
+  else if (!strncmp(arg, "--", 2) && predictor_option_type(arg + 2) >= 0)
+  {
+    select_predictor(predictor_option_type(arg + 2));
+  }
+  else if (!strcmp(arg, "--verbose"))
+  {
+    verbose = 1;
+  }
+  else if (!strcmp(arg, "--hugepages") || !strcmp(arg, "--hugepages=2M"))
+  {
+    hugePages = 2;
+  }
+  else if (!strcmp(arg, "--hugepages=1G"))
+  {
+    hugePages = 1024;
+  }
+  else if (!strncmp(arg, "--update-delay=", 15))
+  {
+    if (!parse_int_option(arg + 15, 0, PREDICTOR_DELAY_MAX, &updateDelay))
+    {
+      fprintf(stderr, "--update-delay takes 0 to %d branches\n", PREDICTOR_DELAY_MAX);
+      exit(1);
+    }
+  }
+  else if (!strcmp(arg, "--unbounded"))
+  {
+    unbounded = 1;
+  }
+  else if (!strncmp(arg, "--decode-threads=", 17))
+  {
+    if (!parse_int_option(arg + 17, 1, TRACE_DECODE_THREADS_MAX, &trace_decode_threads))
+    {
+      fprintf(stderr, "--decode-threads takes 1 to %d threads\n", TRACE_DECODE_THREADS_MAX);
+      exit(1);
+    }
+  }
+  else if (!strcmp(arg, "--no-mmap"))
+  {
+    trace_use_mmap = 0;
+  }
+  else if (!strcmp(arg, "--uring") || !strcmp(arg, "--uring=direct"))
+  {
+    trace_use_uring = arg[7] ? URING_DIRECT : URING_BUFFERED;
+  }
+  else if (!strncmp(arg, "--remote-cache=", 15))
+  {
+    remote_cache_bytes = (size_t)atoi(arg + 15) << 20;
+  }
+  else if (!strcmp(arg, "--verify"))
+  {
+    verify_frames = 1;
+  }
+  else if (!strcmp(arg, "--async"))
+  {
+    async_read = 1;
+  }
+  else if (!strcmp(arg, "--no-async"))
+  {
+    async_read = 0;
+  }
+  else if (!strncmp(arg, "--compose=", 10))
+  {
+    trace_path = arg + 10;
+  }
+  else if (!strcmp(arg, "--compose-flush"))
+  {
+    compose_flush = 1;
+  }
+  else if (!strncmp(arg, "--shm=", 6))
+  {
+    shm_name = arg + 6;
+  }
+  else if (!strncmp(arg, "--cache-dir=", 12))
+  {
+    cache_dir = arg + 12;
+  }
+  else if (!strcmp(arg, "--no-cache"))
+  {
+    cache_dir = "";
+  }
+  else if (!strncmp(arg, "--sweep=", 8))
+  {
+    if (!sweep_add(arg + 8))
+    {
+      fprintf(stderr, "Invalid sweep %s\n", arg + 8);
+      exit(1);
+    }
+  }
+  else if (!strcmp(arg, "--sweep-stop"))
+  {
+    sweep_stop = SWEEP_STOP_AUTO;
+  }
+  else if (!strncmp(arg, "--sweep-stop=", 13))
+  {
+    sweep_stop = strtoull(arg + 13, NULL, 0);
+  }
+  else if (!strcmp(arg, "--sweep-budget"))
+  {
+    sweep_budget = PREDICTOR_BUDGET_BITS;
+  }
+  else if (!strncmp(arg, "--sweep-budget=", 15))
+  {
+    sweep_budget = strtoull(arg + 15, NULL, 0);
+  }
+  else if (!strncmp(arg, "--sweep-memory=", 15))
+  {
+    sweep_memory = strtoull(arg + 15, NULL, 0) << 20;
+  }
+  else if (!strcmp(arg, "--sweep-prune"))
+  {
+    sweep_prune = SWEEP_PRUNE_FACTOR;
+  }
+  else if (!strncmp(arg, "--sweep-prune=", 14))
+  {
+    sweep_prune = strtoull(arg + 14, NULL, 0);
+  }
+  else if (!strcmp(arg, "--sweep-split"))
+  {
+    sweep_split = SWEEP_SPLIT_WARMUP;
+  }
+  else if (!strncmp(arg, "--sweep-split=", 14))
+  {
+    sweep_split = strtoull(arg + 14, NULL, 0);
+  }
+  else if (!strcmp(arg, "--sweep-halving"))
+  {
+    sweep_halving = SWEEP_HALVING;
+  }
+  else if (!strncmp(arg, "--sweep-halving=", 16))
+  {
+    sweep_halving = atoi(arg + 16);
+    if (sweep_halving < 2)
+    {
+      fprintf(stderr, "--sweep-halving keeps 1/n of the points each round, n from 2\n");
+      exit(1);
+    }
+  }
+  else if (!strcmp(arg, "--sweep-interleave"))
+  {
+    sweep_interleave = SWEEP_INTERLEAVE;
+  }
+  else if (!strncmp(arg, "--sweep-interleave=", 19))
+  {
+    sweep_interleave = atoi(arg + 19);
+    if (sweep_interleave < 1 || sweep_interleave > PREDICTOR_LOCKSTEP_MAX)
+    {
+      fprintf(stderr, "--sweep-interleave takes 1 to %d points\n", PREDICTOR_LOCKSTEP_MAX);
+      exit(1);
+    }
+  }
+  else if (!strcmp(arg, "--sweep-folds"))
+  {
+    sweep_folds = 1;
+  }
+  else if (!strcmp(arg, "--sweep-block"))
+  {
+    sweep_block = SWEEP_BLOCK;
+  }
+  else if (!strncmp(arg, "--sweep-block=", 14))
+  {
+    sweep_block = atoi(arg + 14);
+    if (sweep_block < 1)
+    {
+      fprintf(stderr, "--sweep-block takes a block of records from 1\n");
+      exit(1);
+    }
+  }
+  else if (!strcmp(arg, "--gpu"))
+  {
+    sweep_gpu = 1;
+  }
+  else if (!strncmp(arg, "--sweep-checkpoint=", 19))
+  {
+    sweep_checkpoint = arg + 19;
+  }
+  else if (!strncmp(arg, "--sweep-checkpoint-every=", 25))
+  {
+    sweep_checkpoint_seconds = strtoull(arg + 25, NULL, 0);
+  }
+  else if (!strncmp(arg, "--shards=", 9))
+  {
+    if (!parse_int_option(arg + 9, 1, SHARD_MAX, &shards))
+    {
+      fprintf(stderr, "--shards takes 1 to %d shards\n", SHARD_MAX);
+      exit(1);
+    }
+  }
+  else if (!strncmp(arg, "--partitions=", 13))
+  {
+    partitions = atoi(arg + 13);
+    if (partitions < 1 || partitions > PARTITION_MAX)
+    {
+      fprintf(stderr, "--partitions takes 1 to %d ranges\n", PARTITION_MAX);
+      exit(1);
+    }
+  }
+  else if (!strcmp(arg, "--shard-exact"))
+  {
+    shard_exact = 1;
+  }
+  else if (!strcmp(arg, "--shard-warmup=auto"))
+  {
+    shard_warmup_auto = 1;
+  }
+  else if (!strncmp(arg, "--shard-warmup=", 15))
+  {
+    shard_warmup = strtoull(arg + 15, NULL, 0);
+  }
+  else if (!strncmp(arg, "--shard=", 8))
+  {
+    if (!results_parse_shard(arg + 8))
+    {
+      fprintf(stderr, "Invalid shard %s\n", arg + 8);
+      exit(1);
+    }
+  }
+  else if (!strncmp(arg, "--results=", 10))
+  {
+    result_path = arg + 10;
+  }
+  else if (!strncmp(arg, "--memo=", 7))
+  {
+    memo_path = arg + 7;
+  }
+  else if (!strncmp(arg, "--format=", 9))
+  {
+    if (!results_parse_format(arg + 9))
+    {
+      fprintf(stderr, "Invalid format %s\n", arg + 9);
+      exit(1);
+    }
+  }
+  else if (!strncmp(arg, "--serve=", 8))
+  {
+    serve_path = arg + 8;
+  }
+  else if (!strncmp(arg, "--coordinate=", 13))
+  {
+    coordinate_address = arg + 13;
+  }
+  else if (!strncmp(arg, "--worker=", 9))
+  {
+    worker_address = arg + 9;
+  }
+  else if (!strncmp(arg, "--worker-dir=", 13))
+  {
+    worker_dir = arg + 13;
+  }
+  else if (!strncmp(arg, "--jobs=", 7))
+  {
+    if (!parse_int_option(arg + 7, 1, RUNNER_JOBS_MAX, &jobs))
+    {
+      fprintf(stderr, "--jobs takes 1 to %d threads\n", RUNNER_JOBS_MAX);
+      exit(1);
+    }
+  }
+  else if (!strcmp(arg, "--numa"))
+  {
+    numa_enabled = 1;
+  }
+  else if (!strncmp(arg, "--lanes=", 8))
+  {
+    trace_lanes = atoi(arg + 8);
+    if (trace_lanes < 1 || trace_lanes > PREDICTOR_LOCKSTEP_MAX)
+    {
+      fprintf(stderr, "--lanes takes 1 to %d traces\n", PREDICTOR_LOCKSTEP_MAX);
+      exit(1);
+    }
+  }
+  else if (!strncmp(arg, "--start=", 8))
+  {
+    start_branch = strtoull(arg + 8, NULL, 0);
+    start_given = 1;
+  }
+  else if (!strncmp(arg, "--count=", 8))
+  {
+    branch_count = strtoull(arg + 8, NULL, 0);
+  }
+  else if (!strncmp(arg, "--warmup=", 9))
+  {
+    warmup = strtoull(arg + 9, NULL, 0);
+  }
+  else if (!strncmp(arg, "--sample=", 9))
+  {
+    if (!sample_parse(arg + 9, &sample_cfg))
+    {
+      fprintf(stderr, "Invalid sample %s\n", arg + 9);
+      exit(1);
+    }
+    sampling = 1;
+  }
+  else if (!strncmp(arg, "--sample-skip=", 14))
+  {
+    sample_cfg.skip = 1;
+    sample_skip_auto = !strcmp(arg + 14, "auto");
+    sample_cfg.gap_warmup = strtoull(arg + 14, NULL, 0);
+  }
+  else if (!strcmp(arg, "--calibrate-warmup") || !strncmp(arg, "--calibrate-warmup=", 19))
+  {
+    calibrate_starts = arg[18] ? atoi(arg + 19) : CALIBRATE_STARTS;
+    if (calibrate_starts < 1)
+    {
+      fprintf(stderr, "--calibrate-warmup takes at least 1 cold start\n");
+      exit(1);
+    }
+  }
+  else if (!strcmp(arg, "--stats"))
+  {
+    stats = 1;
+  }
+  else if (!strcmp(arg, "--perf-counters") || !strcmp(arg, "--perf-counters=each"))
+  {
+    perf_counters = arg[15] ? 2 : 1;
+  }
+  else if (!strncmp(arg, "--dump-predictions=", 19))
+  {
+    dump_path = arg + 19;
+  }
+  else if (!strncmp(arg, "--emit-mispredicts=", 19))
+  {
+    events_path = arg + 19;
+  }
+  else if (!strcmp(arg, "--emit-mispredicts-pc"))
+  {
+    event_pcs = 1;
+  }
+  else if (!strcmp(arg, "--profile-pcs"))
+  {
+    profile_top = PC_PROFILE_TOP;
+  }
+  else if (!strncmp(arg, "--profile-pcs=", 14))
+  {
+    profile_top = atoi(arg + 14);
+  }
+  else if (!strncmp(arg, "--pprof=", 8))
+  {
+    pprof_path = arg + 8;
+  }
+  else if (!strncmp(arg, "--pprof-symbols=", 16))
+  {
+    pprof_symbols = arg + 16;
+  }
+  else if (!strcmp(arg, "--progress"))
+  {
+    progress_enabled = 1;
+  }
+  else if (!strcmp(arg, "--classes"))
+  {
+    classes = 1;
+  }
+  else if (!strncmp(arg, "--interval=", 11))
+  {
+    interval = strtoull(arg + 11, NULL, 0);
+  }
+  else if (!strncmp(arg, "--interval-out=", 15))
+  {
+    interval_path = arg + 15;
+  }
+  else if (!strncmp(arg, "--timeline=", 11))
+  {
+    timeline_path = arg + 11;
+  }
+  else if (!strcmp(arg, "--btb"))
+  {
+    frontend = 1;
+  }
+  else if (!strncmp(arg, "--btb=", 6))
+  {
+    frontend = 1;
+    if (!fe_parse(arg + 6, &fe_cfg))
+    {
+      fprintf(stderr, "Invalid BTB %s, sets a power of 2 and 1 to %d ways\n", arg + 6, FE_BTB_MAX_WAYS);
+      exit(1);
+    }
+  }
+  else if (!strncmp(arg, "--btb-replace=", 14))
+  {
+    frontend = 1;
+    if ((fe_cfg.replace = fe_replace_by_name(arg + 14)) < 0)
+    {
+      fprintf(stderr, "Invalid BTB replacement %s\n", arg + 14);
+      exit(1);
+    }
+  }
+  else if (!strncmp(arg, "--ras=", 6))
+  {
+    frontend = 1;
+    fe_cfg.ras_depth = atoi(arg + 6);
+  }
+  else if (!strcmp(arg, "--ittage") || !strncmp(arg, "--ittage=", 9))
+  {
+    frontend = 1;
+    fe_cfg.it_bits = arg[8] ? atoi(arg + 9) : FE_IT_ROW_BITS;
+    if (fe_cfg.it_bits < FE_IT_INDEX_LEN / 2 || fe_cfg.it_bits > 24)
+    {
+      fprintf(stderr, "Invalid ITTAGE rows 2^%d\n", fe_cfg.it_bits);
+      exit(1);
+    }
+  }
+  else if (!strcmp(arg, "--oracle") || !strncmp(arg, "--oracle=", 9))
+  {
+    oracle_len = arg[8] ? atoi(arg + 9) : ORACLE_LOCAL_LEN;
+    if (oracle_len < 1 || oracle_len > ORACLE_MAX_LEN)
+    {
+      fprintf(stderr, "Invalid oracle local history %s, 1 to %d\n", arg + 9, ORACLE_MAX_LEN);
+      exit(1);
+    }
+  }
+  else if (!strncmp(arg, "--verify-against=", 17))
+  {
+    if (strcmp(arg + 17, "reference"))
+    {
+      fprintf(stderr, "Invalid verify target %s, only reference\n", arg + 17);
+      exit(1);
+    }
+    verify = 1;
+  }
+  else if (!strncmp(arg, "--verify-state=", 15))
+  {
+    verify_state_every = strtoull(arg + 15, NULL, 0);
+  }
+  else if (!strcmp(arg, "--pipeline"))
+  {
+    pipeline = 1;
+  }
+  else if (!strcmp(arg, "--parallel"))
+  {
+    parallel = 1;
+  }
+  else if (!strcmp(arg, "--chooser-sweep") || !strncmp(arg, "--chooser-sweep=", 16))
+  {
+    chooser_lo = CHOOSER_LO;
+    chooser_hi = CHOOSER_HI;
+    if (arg[15] && (sscanf(arg + 16, "%d..%d", &chooser_lo, &chooser_hi) != 2 || chooser_lo < 1 ||
+                    chooser_hi < chooser_lo || chooser_hi > CHOOSER_MAX_BITS))
+    {
+      fprintf(stderr, "Invalid chooser index bits %s, lo..hi within 1..%d\n", arg + 16, CHOOSER_MAX_BITS);
+      exit(1);
+    }
+  }
+  else if (!strncmp(arg, "--save-state=", 13))
+  {
+    save_state_path = arg + 13;
+  }
+  else if (!strncmp(arg, "--load-state=", 13))
+  {
+    load_state_path = arg + 13;
+  }
+  else if (!strncmp(arg, "--checkpoint-every=", 19))
+  {
+    checkpoint_every = strtoull(arg + 19, NULL, 0);
+  }
+  else if (!strncmp(arg, "--checkpoint-out=", 17))
+  {
+    checkpoint_path = arg + 17;
+  }
+  else
+  {
+    return 0;
+  }
+
+  return 1;
+}
+
+// Reads the next batch of records from the trace, either from the
+// reader thread or directly
+//
+// Returns the number of records, 0 at the end of the trace
+//
+static size_t next_branches(const branch_record_t **recs)
+{
+  if (pending_len)
+  {
+    *recs = pending;
+    size_t n = pending_len;
+    pending_len = 0;
+    return n;
+  }
+  if (pipe_reader)
+  {
+    return trace_pipe_next(pipe_reader, recs);
+  }
+  return trace_read_span(trace, batch, TRACE_BATCH, recs);
+}
+
+// next_branches between the decode probes, see probes.h
+//
+size_t read_branches(const branch_record_t **recs)
+{
+  BP_PROBE0(decode_start);
+  BP_TASK_BEGIN("decode");
+  size_t n = next_branches(recs);
+  BP_TASK_END();
+  BP_PROBE1(decode_done, n);
+  return n;
+}
+
+// Put the predictors and the shared history back to 'images', their
+// state before the replay, when the composed trace has switched parts
+// since the last call
+//
+void flush_on_switch(predictor_t **predictors, predictor_snapshot_t **images, replay_history_t *hist)
+{
+  static uint64_t seen = 0;
+  if (trace->switches == seen)
+  {
+    return;
+  }
+  seen = trace->switches;
+  for (int p = 0; p < num_bp_types; p++)
+  {
+    predictor_restore(predictors[p], images[p]);
+  }
+  if (verify)
+  {
+    verify_restart(&verifier);
+  }
+  if (hist)
+  {
+    memset(&hist->hist, 0, sizeof(hist->hist));
+  }
+}
+
+// Check the frames of the traces of the run for --verify
+//
+// Returns True if none is corrupt
+//
+int verify_traces()
+{
+  std::vector<const char *> paths;
+  for (int i = 0; i < runner_count(); i++)
+  {
+    paths.push_back(runner_path(i));
+  }
+  if (trace_path && !runner_count())
+  {
+    paths.push_back(trace_path);
+  }
+  int ok = 1;
+  for (const char *path : paths)
+  {
+    trace_reader_t *tr = trace_open(path);
+    frame_check_t res;
+    if (tr && frame_check(tr, path, jobs, &res))
+    {
+      double s = res.ns / 1e9;
+      fprintf(stderr, "Verified %s: %llu frames, %.1f MB in %.3f s (%.1f GB/s)%s\n", path,
+              (unsigned long long)res.frames, res.bytes / 1e6, s, s > 0 ? res.bytes / 1e9 / s : 0.0,
+              res.corrupt ? ", CORRUPT" : "");
+      ok = ok && !res.corrupt;
+    }
+    else if (tr)
+    {
+      fprintf(stderr, "Verified %s: no frame checksums\n", path);
+    }
+    if (tr)
+    {
+      trace_close(tr);
+    }
+  }
+  return ok;
+}
+
+// Print how many results --memo found and added, when given
+//
+void print_memo()
+{
+  uint64_t found, added;
+  memo_counts(&found, &added);
+  if (memo_path)
+  {
+    fflush(stdout);
+    fprintf(stderr, "Memo: %llu results found in %s, %llu added\n", (unsigned long long)found, memo_path,
+            (unsigned long long)added);
+  }
+}
+
+// The longest calibrated warmup of the selected predictors on the
+// trace, for --shard-warmup=auto and --sample-skip=auto
+//
+uint64_t calibrated_warmup()
+{
+  uint64_t longest = 0;
+  for (int p = 0; p < num_bp_types; p++)
+  {
+    predictor_config_t cfg = predictor_default_config(bp_types[p]);
+    uint64_t w;
+    if (!calibrate_load(trace_path, &cfg, &w))
+    {
+      fprintf(stderr, "%s.warm has no warmup of this %s predictor, run --calibrate-warmup first\n",
+              trace_path ? trace_path : "-", bpName[bp_types[p]]);
+      exit(1);
+    }
+    longest = w > longest ? w : longest;
+  }
+  return longest;
+}
+
+// Print one --stats phase: seconds, share of the wall time and
+// nanoseconds per trace record
+//
+void print_phase(const char *name, uint64_t ns, uint64_t wall_ns, uint64_t records)
+{
+  printf("  %-24s %9.3f s %5.1f%% %8.2f ns/branch\n", name, ns / 1e9,
+         wall_ns ? 100.0 * ns / wall_ns : 0.0, records ? (double)ns / records : 0.0);
 }
 
-// Process an option and update the predictor
-// configuration variables accordingly
-//
-// Returns True if Successful
-//
-int handle_option(char *arg)
-{
-  if (!strcmp(arg, "--static"))
+int main(int argc, char *argv[])
+{
+  uint64_t start_ns = trace_clock_ns();
+
+  // Set defaults
+  bpType = STATIC;
+  verbose = 0;
+
+  // Combine the result files of a sharded run
+  if (argc > 1 && !strcmp(argv[1], "merge"))
+  {
+    int first = 2;
+    for (; first < argc && !strncmp(argv[first], "--format=", 9); first++)
+    {
+      if (!results_parse_format(argv[first] + 9))
+      {
+        fprintf(stderr, "Invalid format %s\n", argv[first] + 9);
+        exit(1);
+      }
+    }
+    return first < argc && results_merge(argc - first, argv + first) ? 0 : 1;
+  }
+
+  // Process cmdline Arguments
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strcmp(argv[i], "--help"))
+    {
+      usage();
+      exit(0);
+    }
+    else if (!strcmp(argv[i], "--kernels"))
+    {
+      print_kernels();
+      exit(0);
+    }
+    else if (!strncmp(argv[i], "--", 2))
+    {
+      if (!handle_option(argv[i]))
+      {
+        printf("Unrecognized option %s\n", argv[i]);
+        usage();
+        exit(1);
+      }
+    }
+    else if (!runner_add(argv[i]))
+    {
+      // Use as input file, stdin or an error below
+      trace_path = argv[i];
+    }
+  }
+
+  if (num_bp_types == 0)
+  {
+    select_predictor(STATIC);
+  }
+
+  if (timeline_path)
+  {
+    if (!timeline_open(timeline_path))
+    {
+      exit(1);
+    }
+    predictor_span = timeline_event;
+  }
+
+  if (!cache_dir)
+  {
+    cache_dir = getenv(TRACE_CACHE_ENV);
+  }
+
+  // pprof output reads the tables of --profile-pcs
+  if (pprof_path && !profile_top)
+  {
+    profile_top = PC_PROFILE_TOP;
+  }
+  if (pprof_symbols && !pprof_path)
+  {
+    fprintf(stderr, "--pprof-symbols takes --pprof\n");
+    exit(1);
+  }
+
+  if (sampling && (sweep_active() || (runner_count() > 1 && !trace_path) || dump_path || profile_top || save_state_path))
+  {
+    fprintf(stderr, "--sample takes a single trace and no --sweep, --dump-predictions, --profile-pcs or --save-state\n");
+    exit(1);
+  }
+  if (sample_cfg.breaks && sample_cfg.skip)
+  {
+    fprintf(stderr, "--sample=breaks takes no --sample-skip\n");
+    exit(1);
+  }
+  if (events_path && (sweep_active() || (runner_count() > 1 && !trace_path) || sampling || shards > 1))
+  {
+    fprintf(stderr, "--emit-mispredicts takes a single trace and no --sweep, --sample or --shards\n");
+    exit(1);
+  }
+  if (progress_enabled && ((runner_count() > 1 && !trace_path) || sampling || shards > 1))
+  {
+    fprintf(stderr, "--progress takes a single trace or a --sweep and no --sample or --shards\n");
+    exit(1);
+  }
+  if (classes && (sweep_active() || (runner_count() > 1 && !trace_path) || sampling || shards > 1))
+  {
+    fprintf(stderr, "--classes takes a single trace and no --sweep, --sample or --shards\n");
+    exit(1);
+  }
+  if (event_pcs && !events_path)
+  {
+    fprintf(stderr, "--emit-mispredicts-pc takes --emit-mispredicts=<file>\n");
+    exit(1);
+  }
+  if ((save_state_path || load_state_path) && (sweep_active() || (runner_count() > 1 && !trace_path)))
+  {
+    fprintf(stderr, "--save-state and --load-state take a single trace and no --sweep\n");
+    exit(1);
+  }
+  if (!checkpoint_every != !checkpoint_path)
+  {
+    fprintf(stderr, "--checkpoint-every=<n> takes --checkpoint-out=<file>\n");
+    exit(1);
+  }
+  if (checkpoint_every && (sweep_active() || (runner_count() > 1 && !trace_path) || sampling || shards > 1 ||
+                           partitions || chooser_hi))
+  {
+    fprintf(stderr, "--checkpoint-every takes a single trace and no --sweep, --sample, --shards, --partitions\n"
+                    "or --chooser-sweep\n");
+    exit(1);
+  }
+  int plugin_selected = 0;
+  for (int p = 0; p < num_bp_types; p++)
+  {
+    plugin_selected |= bp_types[p] == PLUGIN;
+  }
+  if ((save_state_path || load_state_path || checkpoint_every) && plugin_selected)
+  {
+    fprintf(stderr, "--save-state, --load-state and --checkpoint-every can't save the tables of a --plugin\n");
+    exit(1);
+  }
+  if (shards > 1 && (sweep_active() || (runner_count() > 1 && !trace_path) || sampling || verbose || dump_path ||
+                     profile_top || save_state_path || load_state_path))
+  {
+    fprintf(stderr, "--shards takes a single trace and no --sweep, --sample, --verbose, --dump-predictions,\n"
+                    "--profile-pcs, --save-state or --load-state\n");
+    exit(1);
+  }
+  if ((result_shards > 1 || result_path) && !sweep_active() && !(runner_count() > 1 && !trace_path))
+  {
+    fprintf(stderr, "--shard and --results take a --sweep or several traces\n");
+    exit(1);
+  }
+  if (result_format != RESULT_FORMAT_TEXT && (sampling || shards > 1 || verbose || profile_top || stats ||
+                                              perf_counters))
+  {
+    fprintf(stderr, "--format takes no --sample, --shards, --verbose, --profile-pcs, --stats or --perf-counters\n");
+    exit(1);
+  }
+  if (!interval != !interval_path || interval > UINT32_MAX)
+  {
+    fprintf(stderr, "--interval=<n> takes --interval-out=<file>, with n below 2^32\n");
+    exit(1);
+  }
+  if (interval && (sweep_active() || (runner_count() > 1 && !trace_path) || sampling || shards > 1))
+  {
+    fprintf(stderr, "--interval takes a single trace and no --sweep, --sample or --shards\n");
+    exit(1);
+  }
+  if (frontend && (sweep_active() || (runner_count() > 1 && !trace_path) || sampling || shards > 1))
+  {
+    fprintf(stderr, "--btb takes a single trace and no --sweep, --sample or --shards\n");
+    exit(1);
+  }
+  if (oracle_len && (sweep_active() || (runner_count() > 1 && !trace_path) || sampling || shards > 1))
+  {
+    fprintf(stderr, "--oracle takes a single trace and no --sweep, --sample or --shards\n");
+    exit(1);
+  }
+  if (verify && (sweep_active() || (runner_count() > 1 && !trace_path) || sampling || shards > 1))
+  {
+    fprintf(stderr, "--verify-against takes a single trace and no --sweep, --sample or --shards\n");
+    exit(1);
+  }
+  if (verify_state_every && !verify)
+  {
+    fprintf(stderr, "--verify-state takes --verify-against\n");
+    exit(1);
+  }
+  if (pipeline && (num_bp_types != 1 || sweep_active() || (runner_count() > 1 && !trace_path) || sampling ||
+                   shards > 1 || chooser_hi))
+  {
+    fprintf(stderr, "--pipeline takes a single trace and predictor and no --sweep, --sample, --shards or\n"
+                    "--chooser-sweep\n");
+    exit(1);
+  }
+  if (parallel && (num_bp_types < 2 || sweep_active() || (runner_count() > 1 && !trace_path) || sampling ||
+                   shards > 1 || chooser_hi || pipeline || partitions || calibrate_starts || shm_name ||
+                   compose_flush))
+  {
+    fprintf(stderr, "--parallel takes a single trace and several predictors and no --sweep, --sample,\n"
+                    "--shards, --chooser-sweep, --pipeline, --partitions, --calibrate-warmup, --shm or\n"
+                    "--compose-flush\n");
+    exit(1);
+  }
+  if (parallel && (verbose || dump_path || events_path || profile_top || classes || interval || verify || frontend ||
+                   oracle_len || checkpoint_every || perf_counters || progress_enabled))
+  {
+    fprintf(stderr, "--parallel takes none of the per-batch reports: --verbose, --dump-predictions,\n"
+                    "--emit-mispredicts, --profile-pcs, --classes, --interval, --verify-against, the\n"
+                    "front end models, --oracle, --checkpoint-every, --perf-counters or --progress\n");
+    exit(1);
+  }
+  for (int p = 0; p < num_bp_types && unbounded && !sweep_active(); p++)
+  {
+    if (bp_types[p] != GSHARE && bp_types[p] != TOURNAMENT && bp_types[p] != CUSTOM)
+    {
+      fprintf(stderr, "--unbounded takes gshare, tournament and custom predictors, not %s\n", bpName[bp_types[p]]);
+      exit(1);
+    }
+  }
+  if (unbounded && (verify || compose_flush))
+  {
+    fprintf(stderr, "--unbounded takes no --verify-against or --compose-flush, whose snapshots copy arrays\n");
+    exit(1);
+  }
+  if (partitions && (sweep_active() || (runner_count() > 1 && !trace_path) || sampling || shards > 1 ||
+                     chooser_hi || pipeline))
+  {
+    fprintf(stderr, "--partitions takes a single trace and no --sweep, --sample, --shards, --chooser-sweep\n"
+                    "or --pipeline\n");
+    exit(1);
+  }
+  if (calibrate_starts && (sweep_active() || (runner_count() > 1 && !trace_path) || sampling || shards > 1 ||
+                           chooser_hi || partitions || pipeline || load_state_path || plugin_selected))
+  {
+    fprintf(stderr, "--calibrate-warmup takes a single trace and no --sweep, --sample, --shards,\n"
+                    "--chooser-sweep, --partitions, --pipeline, --load-state or --plugin\n");
+    exit(1);
+  }
+  if (chooser_hi && (sweep_active() || (runner_count() > 1 && !trace_path) || sampling || shards > 1))
+  {
+    fprintf(stderr, "--chooser-sweep takes a single trace and no --sweep, --sample or --shards\n");
+    exit(1);
+  }
+  if (perf_counters && (sweep_active() || (runner_count() > 1 && !trace_path) || sampling || shards > 1))
+  {
+    fprintf(stderr, "--perf-counters takes a single trace and no --sweep, --sample or --shards\n");
+    exit(1);
+  }
+  if (sweep_split && (sweep_stop || profile_top))
+  {
+    fprintf(stderr, "--sweep-split can't be combined with --sweep-stop or --profile-pcs\n");
+    exit(1);
+  }
+  if (sweep_halving && (sweep_stop || sweep_split || profile_top || sweep_gpu))
+  {
+    fprintf(stderr, "--sweep-halving can't be combined with --sweep-stop, --sweep-split, --profile-pcs or --gpu\n");
+    exit(1);
+  }
+  if (sweep_checkpoint && (sweep_stop || sweep_split || sweep_halving || profile_top))
+  {
+    fprintf(stderr, "--sweep-checkpoint can't be combined with --sweep-stop, --sweep-split, --sweep-halving or "
+                    "--profile-pcs\n");
+    exit(1);
+  }
+  if (sweep_checkpoint)
+  {
+    // the completed points go into the store, in the directory unless
+    // --memo names one
+    if (mkdir(sweep_checkpoint, 0755) && errno != EEXIST)
+    {
+      fprintf(stderr, "Unable to create %s for --sweep-checkpoint\n", sweep_checkpoint);
+      exit(1);
+    }
+    if (!memo_path)
+    {
+      sweep_memo_path = std::string(sweep_checkpoint) + "/results.memo";
+      memo_path = sweep_memo_path.c_str();
+    }
+  }
+  if (sweep_stop && profile_top)
+  {
+    fprintf(stderr, "--sweep-stop and --profile-pcs can't be combined\n");
+    exit(1);
+  }
+  if (memo_path && !memo_open())
+  {
+    fprintf(stderr, "Unable to open %s for --memo\n", memo_path);
+    exit(1);
+  }
+  if (serve_path)
+  {
+    if (trace_path || runner_count() || shm_name || sweep_active())
+    {
+      fprintf(stderr, "--serve takes no trace, --shm or --sweep, the jobs name them\n");
+      exit(1);
+    }
+    server_config_t cfg = {serve_path, jobs, cache_dir};
+    return server_run(&cfg) ? 0 : 1;
+  }
+  if (worker_address)
+  {
+    if (trace_path || runner_count() || shm_name || sweep_active() || coordinate_address)
+    {
+      fprintf(stderr, "--worker takes no trace, --shm or --sweep, the coordinator names them\n");
+      exit(1);
+    }
+    cluster_worker_t cfg = {worker_address, jobs, worker_dir, cache_dir};
+    return cluster_work(&cfg) ? 0 : 1;
+  }
+  if (coordinate_address && !sweep_active())
+  {
+    fprintf(stderr, "--coordinate takes a --sweep\n");
+    exit(1);
+  }
+  if (shm_name && (trace_path || runner_count() || sampling || shards > 1))
+  {
+    fprintf(stderr, "--shm takes no trace, --sample or --shards\n");
+    exit(1);
+  }
+  if (verify_frames && !verify_traces())
+  {
+    exit(1);
+  }
+  if (runner_count() > 1 && !trace_path)
+  {
+    if (sweep_active())
+    {
+      fprintf(stderr, "--sweep takes a single trace\n");
+      exit(1);
+    }
+    runner_config_t cfg = {bp_types,  num_bp_types, start_branch, branch_count, jobs,
+                           cache_dir, warmup,       trace_lanes,  memo_path != NULL};
+    int ok = runner_run(&cfg);
+    print_memo();
+    return ok ? 0 : 1;
+  }
+  if (runner_count() == 1 && !trace_path)
+  {
+    trace_path = runner_path(0);
+  }
+  trace = shm_name ? trace_open_shm(shm_name) : trace_cache_open(cache_dir, trace_path);
+  if (!trace)
+  {
+    fprintf(stderr, "Unable to open trace %s\n", shm_name ? shm_name : trace_path);
+    exit(1);
+  }
+
+  // Warm predictors from a snapshot continue where it was taken, and
+  // from a library snapshot train on up to --start
+  predictor_t *predictors[NUM_BP_TYPES];
+  uint64_t restored = start_branch;
+  if (load_state_path)
+  {
+    int library = checkpoint_is_library(load_state_path);
+    if (library && !start_given)
+    {
+      fprintf(stderr, "--load-state of a --checkpoint-every library takes --start\n");
+      exit(1);
+    }
+    uint64_t position;
+    if (library ? !checkpoint_library_load(load_state_path, predictors, bp_types, num_bp_types, start_branch, &position)
+                : !checkpoint_load(load_state_path, predictors, bp_types, num_bp_types, &position))
+    {
+      fprintf(stderr, "Unable to load the selected predictors from %s\n", load_state_path);
+      exit(1);
+    }
+    if (!start_given)
+    {
+      start_branch = position;
+    }
+    restored = library ? position : start_branch;
+  }
+  trace_seek_branch(trace, trace_path, restored);
+  if (restored < start_branch)
+  {
+    branch_record_t *batch = (branch_record_t *)malloc(TRACE_BATCH * sizeof(branch_record_t));
+    size_t got;
+    while (batch && restored < start_branch &&
+           (got = trace_read_batch(trace, batch, start_branch - restored < TRACE_BATCH ? start_branch - restored
+                                                                                      : TRACE_BATCH)) > 0)
+    {
+      replay_batch(predictors, num_bp_types, batch, got, NULL, NULL);
+      restored += got;
+    }
+    free(batch);
+  }
+  uint64_t open_ns = trace_clock_ns() - start_ns;
+  uint64_t open_read_ns = trace->read_ns;
+  uint64_t open_decompress_ns = trace->decompress_ns;
+
+  if (sweep_active())
+  {
+    // a sidecar missing or older than the trace prunes nothing
+    trace_stat_t stat;
+    int have_stat = sweep_prune && trace_path && trace_stat_load(trace_path, &stat);
+    if (sweep_prune && !have_stat)
+    {
+      fprintf(stderr, "Warning: no current %s.stat, run bpstat on the trace to prune the sweep\n",
+              trace_path ? trace_path : "-");
+    }
+    char scope[MEMO_SCOPE_LEN];
+    int memo_sweep = memo_path && memo_scope(trace_path, start_branch, warmup, branch_count, scope);
+    if (sweep_checkpoint && !memo_sweep)
+    {
+      fprintf(stderr, "--sweep-checkpoint takes a trace file, not stdin\n");
+      exit(1);
+    }
+    if (coordinate_address)
+    {
+      // Workers replay whole points, which the sweep then prints from
+      // the store
+      if (!memo_sweep || !strncmp(trace_path, SYNTH_PREFIX, SYNTH_PREFIX_LEN))
+      {
+        fprintf(stderr, "--coordinate takes --memo and a trace file\n");
+        exit(1);
+      }
+      if (sweep_stop || profile_top || sweep_halving || sweep_gpu || sweep_checkpoint)
+      {
+        fprintf(stderr, "--coordinate can't be combined with --sweep-stop, --profile-pcs, --sweep-halving, "
+                        "--gpu or --sweep-checkpoint\n");
+        exit(1);
+      }
+      predictor_config_t *cfgs;
+      size_t n = sweep_configs(sweep_budget, have_stat ? &stat : NULL, sweep_prune, &cfgs);
+      cluster_coordinator_t cfg = {coordinate_address, trace_path, scope, start_branch, warmup, branch_count,
+                                   cfgs, n};
+      if (!cfgs || !cluster_coordinate(&cfg))
+      {
+        exit(1);
+      }
+      free(cfgs);
+    }
+    int ok = sweep_run(trace, trace_path, warmup, branch_count, jobs, profile_top, pprof_path, pprof_symbols,
+                       sweep_stop, sweep_gpu,
+                       sweep_budget, sweep_memory, have_stat ? &stat : NULL, sweep_prune,
+                       sweep_interleave, sweep_folds, sweep_block, sweep_split, memo_sweep ? scope : NULL, sweep_halving,
+                       sweep_checkpoint, sweep_checkpoint_seconds * 1000000000ULL, cache_dir);
+    trace_close(trace);
+    print_memo();
+    return ok ? 0 : 1;
+  }
+  if (chooser_hi)
+  {
+    int ok = chooser_run(trace, warmup, branch_count, chooser_lo, chooser_hi);
+    trace_close(trace);
+    return ok ? 0 : 1;
+  }
+  if (calibrate_starts)
+  {
+    calibrate_config_t cfg = {bp_types, num_bp_types, start_branch,
+                              branch_count != ~0ULL ? branch_count : CALIBRATE_WINDOW, calibrate_starts};
+    int ok = calibrate_run(trace, trace_path, &cfg);
+    trace_close(trace);
+    return ok ? 0 : 1;
+  }
+  if (shards > 1 && shard_warmup_auto)
+  {
+    shard_warmup = calibrated_warmup();
+  }
+  if (shards > 1)
+  {
+    shard_config_t cfg = {bp_types, num_bp_types, trace_path, cache_dir, start_branch, branch_count, warmup,
+                          shards, shard_warmup, shard_exact};
+    int ok = shard_run(trace, &cfg);
+    trace_close(trace);
+    return ok ? 0 : 1;
+  }
+
+  // Initialize the predictors, one instance each
+  for (int p = 0; p < num_bp_types && !load_state_path; p++)
+  {
+    predictor_config_t cfg = predictor_default_config(bp_types[p]);
+    predictors[p] = predictor_create(&cfg);
+    if (!predictors[p])
+    {
+      fprintf(stderr, "Invalid %s predictor configuration\n", bpName[bp_types[p]]);
+      exit(1);
+    }
+  }
+
+  if (partitions)
+  {
+    partition_config_t cfg = {bp_types, num_bp_types, branch_count, warmup, partitions};
+    int ok = partition_run(trace, predictors, &cfg);
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      predictor_destroy(predictors[p]);
+    }
+    trace_close(trace);
+    return ok ? 0 : 1;
+  }
+
+  // Sampling seeks between windows, so it reads the trace directly
+  if (sampling)
+  {
+    sample_cfg.warmup = warmup;
+    if (sample_skip_auto)
+    {
+      sample_cfg.gap_warmup = calibrated_warmup();
+    }
+    sample_run(trace, trace_path, start_branch, branch_count, predictors, bp_types, num_bp_types, &sample_cfg);
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      predictor_destroy(predictors[p]);
+    }
+    trace_close(trace);
+    return 0;
+  }
+
+  // With --memo a plain run whose every predictor is stored prints the
+  // stored results instead of replaying, and any other stores its own
+  char scope[MEMO_SCOPE_LEN];
+  int memo_run = memo_path && !load_state_path && !save_state_path && !checkpoint_every && !compose_flush && !shm_name && !verbose &&
+                 !dump_path && !events_path && !profile_top && !classes && !interval && !frontend && !oracle_len &&
+                 !verify && !perf_counters && !stats && memo_scope(trace_path, start_branch, warmup, branch_count, scope);
+  memo_result_t stored[NUM_BP_TYPES];
+  int memoized = memo_run;
+  for (int p = 0; p < num_bp_types && memoized; p++)
+  {
+    memoized = memo_lookup(scope, predictor_config(predictors[p]), &stored[p]) &&
+               stored[p].records == stored[0].records && stored[p].stats.branches == stored[0].stats.branches;
+  }
+  if (memoized)
+  {
+    async_read = 0;
+    parallel = 0;
+  }
+
+  // a flush needs each batch within one part, as the views are
+  predictor_snapshot_t *images[NUM_BP_TYPES];
+  if (compose_flush)
+  {
+    if (!trace->parts)
+    {
+      fprintf(stderr, "--compose-flush takes a --compose trace\n");
+      exit(1);
+    }
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      if (!(images[p] = predictor_snapshot(predictors[p])))
+      {
+        fprintf(stderr, "Error: can not snapshot the %s predictor for --compose-flush\n", bpName[bp_types[p]]);
+        exit(1);
+      }
+    }
+    async_read = 0;
+  }
+
+  // Only the fields the predictors read are decoded, unless the run
+  // reports on the branches themselves
+  uint32_t fields = TRACE_FIELD_ALL;
+  if (!verbose && !dump_path && !events_path && !profile_top && !classes && !frontend && !oracle_len)
   {
-    bpType = STATIC;
+    fields = 0;
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      fields |= predictor_fields(predictor_config(predictors[p]));
+    }
   }
-  else if (!strncmp(arg, "--gshare", 8))
+  trace_set_fields(trace, fields);
+
+  // the ring's slots are replayed in place, with the extractor as the
+  // reader thread
+  if (async_read < 0)
   {
-    bpType = GSHARE;
+    async_read = !shm_name && std::thread::hardware_concurrency() > 1;
   }
-  else if (!strncmp(arg, "--tournament", 12))
+  if (parallel)
   {
-    bpType = TOURNAMENT;
+    pipe_reader = trace_pipe_start_shared(trace, num_bp_types);
   }
-  else if (!strncmp(arg, "--custom", 8))
+  else if (async_read)
   {
-    bpType = CUSTOM;
+    pipe_reader = trace_pipe_start(trace);
   }
-  else if (!strcmp(arg, "--verbose"))
+
+  uint64_t num_branches = 0;
+  uint64_t mispredictions[NUM_BP_TYPES] = {0};
+  uint64_t num_records = 0;
+  uint64_t wait_ns = 0;                       // main thread waiting for records
+  uint64_t predict_ns[NUM_BP_TYPES] = {0};
+  uint64_t consumer_wait_ns[NUM_BP_TYPES] = {0}; // each --parallel thread waiting
+  const branch_record_t *recs;
+  size_t n;
+  if (memoized)
   {
-    verbose = 1;
+    num_branches = stored[0].stats.branches;
+    num_records = stored[0].records;
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      mispredictions[p] = stored[p].stats.mispredictions;
+      predict_ns[p] = stored[p].runtime_ns;
+    }
+    warmup = branch_count = 0;
   }
-  else
+  // Prediction bitmaps of the current batch, for verbose output, the
+  // prediction dump and the fingerprints
+  static uint64_t predictions[NUM_BP_TYPES][TRACE_BATCH / 64];
+  const uint64_t *prediction_bits[NUM_BP_TYPES];
+  // Only JSON and CSV report the fingerprints
+  int fingerprint = result_format != RESULT_FORMAT_TEXT;
+  fingerprint_t fingerprints[NUM_BP_TYPES];
+  for (int p = 0; p < num_bp_types; p++)
   {
-    return 0;
+    prediction_bits[p] = predictions[p];
+    fingerprint_init(&fingerprints[p]);
+  }
+  // Dense ids of the PCs seen, for the per-PC profiles
+  static uint32_t ids[TRACE_BATCH];
+  static uint64_t cond[TRACE_BATCH / 64], taken[TRACE_BATCH / 64], misses[TRACE_BATCH / 64];
+  pc_map_t pc_map;
+  pc_counts_t pc_execs;
+  pc_counts_t pc_misses[NUM_BP_TYPES];
+  if (profile_top)
+  {
+    pc_map_init(&pc_map);
+    pc_counts_init(&pc_execs);
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      pc_counts_init(&pc_misses[p]);
+    }
+  }
+  // Class of every record of a batch, for the per-class counts
+  static class_batch_t class_kinds;
+  class_counts_t class_branches, class_misses[NUM_BP_TYPES];
+  memset(&class_branches, 0, sizeof(class_branches));
+  memset(class_misses, 0, sizeof(class_misses));
+  // Mispredictions per window, written as each window closes
+  static uint64_t interval_misses[NUM_BP_TYPES][TRACE_BATCH / 64];
+  const uint64_t *interval_bits[NUM_BP_TYPES];
+  interval_series_t series;
+  if (interval)
+  {
+    if (!interval_init(&series, interval_path, interval, bp_types, num_bp_types))
+    {
+      fprintf(stderr, "Error: failed to write %s\n", interval_path);
+      exit(1);
+    }
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      interval_bits[p] = interval_misses[p];
+    }
+  }
+  // Mispredicted records of the current batch, for the event stream
+  static uint64_t event_misses[NUM_BP_TYPES][TRACE_BATCH / 64];
+  const uint64_t *event_bits[NUM_BP_TYPES];
+  for (int p = 0; p < num_bp_types; p++)
+  {
+    event_bits[p] = event_misses[p];
+  }
+  fe_model_t fe;
+  uint64_t fe_ns = 0;
+  uint64_t hist_ns = 0;
+  if (frontend && !fe_init(&fe, &fe_cfg))
+  {
+    fprintf(stderr, "Error: BTB malloc failed\n");
+    exit(1);
+  }
+  oracle_t oracle;
+  uint64_t oracle_ns = 0;
+  if (oracle_len && !oracle_init(&oracle, oracle_len, predictor_default_config(GSHARE).ghistoryBits))
+  {
+    fprintf(stderr, "Error: oracle malloc failed\n");
+    exit(1);
+  }
+  pred_dump_t *dump = NULL;
+  if (dump_path && !(dump = pred_dump_open(dump_path, bp_types, num_bp_types)))
+  {
+    fprintf(stderr, "Unable to create %s\n", dump_path);
+    exit(1);
+  }
+  miss_events_t *events = NULL;
+  if (events_path &&
+      !(events = miss_events_open(events_path, bp_types, num_bp_types, event_pcs, start_branch + warmup)))
+  {
+    fprintf(stderr, "Unable to create %s\n", events_path);
+    exit(1);
   }
 
-  return 1;
-}
+  // Instructions of each record, when the trace has a sidecar of them
+  icount_t *icount = memoized || shm_name ? NULL : icount_open(trace_path);
+  static uint32_t instructions[TRACE_BATCH];
+  uint64_t num_instructions = 0;
+  if (icount)
+  {
+    icount_read(icount, NULL, start_branch);
+  }
 
-// Reads a line from the input stream and extracts the
-// PC and Outcome of a branch
-//
-// Returns True if Successful
-//
-int read_branch(uint32_t *pc, uint32_t *target, uint32_t *outcome, uint32_t *condition, uint32_t *call, uint32_t *ret, uint32_t *direct)
-{
-  if (getline(&buf, &len, stream) == -1)
+  // Twins of the predictors, from their state now
+  if (verify)
   {
-    return 0;
+    const char *names[NUM_BP_TYPES];
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      names[p] = bpName[bp_types[p]];
+    }
+    if (!verify_init(&verifier, predictors, names, num_bp_types, verify_state_every))
+    {
+      fprintf(stderr, "Error: can not create the reference predictors for --verify-against\n");
+      exit(1);
+    }
   }
 
-  sscanf(buf, "0x%x\t0x%x\t%d\t%d\t%d\t%d\t%d\n", pc, target, outcome, condition, call, ret, direct);
+  // Several predictors read one history, advanced once per batch
+  replay_history_t *hist = parallel ? NULL : replay_history_new(predictors, num_bp_types);
 
-  return 1;
-}
+  // or the one predictor takes three threads
+  predictor_pipeline_t *stages = NULL;
+  if (pipeline && !(stages = predictor_pipeline_start(predictors[0])))
+  {
+    fprintf(stderr, "--pipeline takes a --custom predictor without an updateDelay or --unbounded\n");
+    exit(1);
+  }
 
-int main(int argc, char *argv[])
-{
-  // Set defaults
-  stream = stdin;
-  bpType = STATIC;
-  verbose = 0;
+  // Snapshots of the predictors every checkpoint_every records
+  checkpoint_library_t *library = NULL;
+  if (checkpoint_every &&
+      (!(library = checkpoint_library_create(checkpoint_path, predictors, num_bp_types, checkpoint_every)) ||
+       !checkpoint_library_add(library, predictors, start_branch)))
+  {
+    fprintf(stderr, "Error: failed to write %s\n", checkpoint_path);
+    exit(1);
+  }
 
-  // Process cmdline Arguments
-  for (int i = 1; i < argc; ++i)
+  // Train on the warmup branches first, the batch they end in is
+  // finished by the loop below
+  uint64_t warmed = 0;
+  if (parallel)
   {
-    if (!strcmp(argv[i], "--help"))
+    // or each predictor takes them all on its own thread, leaving
+    // nothing to the loops
+    replay_consumer_t consumers[NUM_BP_TYPES];
+    replay_parallel(pipe_reader, predictors, num_bp_types, warmup, branch_count, fingerprint, consumers);
+    warmed = consumers[0].warmed;
+    num_records = consumers[0].records;
+    num_branches = consumers[0].st.branches;
+    for (int p = 0; p < num_bp_types; p++)
     {
-      usage();
-      exit(0);
+      mispredictions[p] = consumers[p].st.mispredictions;
+      predict_ns[p] = consumers[p].predict_ns;
+      consumer_wait_ns[p] = consumers[p].wait_ns;
+      fingerprints[p] = consumers[p].fingerprint;
     }
-    else if (!strncmp(argv[i], "--", 2))
+    if (icount)
     {
-      if (!handle_option(argv[i]))
+      icount_read(icount, NULL, warmed);
+      num_instructions += icount_read(icount, NULL, num_records);
+    }
+    warmup = branch_count = 0;
+  }
+  while (warmed < warmup && (n = read_branches(&recs)) > 0)
+  {
+    if (compose_flush)
+    {
+      flush_on_switch(predictors, images, hist);
+    }
+    size_t m = n < warmup - warmed ? n : warmup - warmed;
+    replay_batch(predictors, num_bp_types, recs, m, hist, NULL);
+    if (verify)
+    {
+      verify_warmup(&verifier, recs, m);
+    }
+    if (icount)
+    {
+      icount_read(icount, NULL, m);
+    }
+    if (frontend)
+    {
+      fe_add(&fe, recs, m, 0);
+    }
+    if (oracle_len)
+    {
+      oracle_add(&oracle, recs, m, 0);
+    }
+    warmed += m;
+    if (!checkpoint_library_add(library, predictors, start_branch + warmed))
+    {
+      fprintf(stderr, "Error: failed to write %s\n", checkpoint_path);
+      exit(1);
+    }
+    if (m < n)
+    {
+      pending = recs + m;
+      pending_len = n - m;
+    }
+  }
+
+  // The host counters of the loop below and, with =each, of every
+  // predictor's share of it
+  perfctr_group_t perf_all, perf_each[NUM_BP_TYPES];
+  if (perf_counters)
+  {
+    if (!perfctr_open(&perf_all))
+    {
+      fprintf(stderr, "No perf counters (%s), see /proc/sys/kernel/perf_event_paranoid\n", strerror(errno));
+      perf_counters = 0;
+    }
+    for (int p = 0; p < num_bp_types && perf_counters == 2; p++)
+    {
+      perfctr_open(&perf_each[p]);
+    }
+    perfctr_start(&perf_all);
+  }
+
+  // The report counts from here, against the records left by the
+  // header or a sidecar, or else the offset of a streamed file
+  if (progress_enabled)
+  {
+    uint64_t records = trace->num_records;
+    trace_index_t *idx = records == ~0ULL && trace_path ? trace_index_load(trace_path) : NULL;
+    trace_stat_t st;
+    if (idx)
+    {
+      records = idx->hdr.num_records;
+      trace_index_free(idx);
+    }
+    else if (records == ~0ULL && trace_path && trace_stat_load(trace_path, &st))
+    {
+      records = st.records;
+    }
+    uint64_t left = records != ~0ULL && records > start_branch + warmed ? records - start_branch - warmed : 0;
+    struct stat sb;
+    int fd = trace->stream && !trace->map && !trace->uring ? fileno(trace->stream) : -1;
+    int sized = fd >= 0 && !fstat(fd, &sb) && S_ISREG(sb.st_mode);
+    progress_start(left && left < branch_count ? left : branch_count != ~0ULL ? branch_count : 0, sized ? fd : -1,
+                   sized ? sb.st_size : 0);
+  }
+
+  // Reach each branch from the trace, every predictor sees it
+  uint64_t t = trace_clock_ns();
+  while (branch_count > 0 && (n = read_branches(&recs)) > 0)
+  {
+    if (compose_flush)
+    {
+      flush_on_switch(predictors, images, hist);
+    }
+    uint64_t now = trace_clock_ns();
+    wait_ns += now - t;
+    t = now;
+    if (n > branch_count)
+    {
+      n = branch_count;
+    }
+    hotcheck_begin();
+    branch_count -= n;
+    uint64_t first_record = start_branch + warmed + num_records;
+    num_records += n;
+    num_branches += replay_count_conditional(recs, n);
+    if (icount)
+    {
+      num_instructions += icount_read(icount, instructions, n);
+    }
+
+    // Make the predictions, compare with actual outcomes and train
+    if (hist)
+    {
+      replay_history_fill(hist, recs, n);
+      now = trace_clock_ns();
+      hist_ns += now - t;
+      t = now;
+    }
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      uint64_t *bits = verbose || dump || events || profile_top || classes || interval || verify || fingerprint
+                       ? predictions[p] : NULL;
+      if (perf_counters == 2)
       {
-        printf("Unrecognized option %s\n", argv[i]);
-        usage();
+        perfctr_start(&perf_each[p]);
+      }
+      BP_PROBE1(predict_start, p);
+      BP_TASK_BEGIN("predict");
+      uint64_t missed = stages ? predictor_pipeline_batch(stages, replay_branches(recs), n, bits)
+                        : hist   ? predictor_predict_shared(predictors[p], replay_branches(recs), &hist->batch, bits)
+                                 : predictor_predict_batch(predictors[p], replay_branches(recs), n, bits);
+      BP_TASK_END();
+      BP_PROBE3(predict_done, p, n, missed);
+      mispredictions[p] += missed;
+      if (fingerprint)
+      {
+        fingerprint_add(&fingerprints[p], replay_branches(recs), bits, n);
+      }
+      if (perf_counters == 2)
+      {
+        perfctr_stop(&perf_each[p]);
+      }
+      now = trace_clock_ns();
+      predict_ns[p] += now - t;
+      t = now;
+    }
+    if (!checkpoint_library_add(library, predictors, first_record + n))
+    {
+      fprintf(stderr, "Error: failed to write %s\n", checkpoint_path);
+      exit(1);
+    }
+    if (verify)
+    {
+      if (!verify_batch(&verifier, recs, n, first_record, prediction_bits))
+      {
+        exit(1);
+      }
+      t = trace_clock_ns();
+    }
+    if (frontend)
+    {
+      fe_add(&fe, recs, n, 1);
+      now = trace_clock_ns();
+      fe_ns += now - t;
+      t = now;
+    }
+    if (oracle_len)
+    {
+      oracle_add(&oracle, recs, n, 1);
+      now = trace_clock_ns();
+      oracle_ns += now - t;
+      t = now;
+    }
+    if (profile_top)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        ids[i] = pc_map_id(&pc_map, recs[i].pc);
+      }
+      pc_profile_outcomes(recs, n, cond, taken);
+      pc_counts_add(&pc_execs, ids, n, pc_map.count, cond);
+      for (int p = 0; p < num_bp_types; p++)
+      {
+        pc_profile_misses(cond, taken, predictions[p], n, misses);
+        pc_counts_add(&pc_misses[p], ids, n, pc_map.count, misses);
+      }
+      t = trace_clock_ns();
+    }
+    if (classes)
+    {
+      class_batch(recs, n, &class_kinds, &class_branches);
+      for (int p = 0; p < num_bp_types; p++)
+      {
+        class_add(&class_misses[p], &class_kinds, predictions[p]);
+      }
+      t = trace_clock_ns();
+    }
+    if (interval)
+    {
+      if (!profile_top)
+      {
+        pc_profile_outcomes(recs, n, cond, taken);
+      }
+      for (int p = 0; p < num_bp_types; p++)
+      {
+        pc_profile_misses(cond, taken, predictions[p], n, interval_misses[p]);
+      }
+      if (!interval_add(&series, cond, interval_bits, icount ? instructions : NULL, n))
+      {
+        fprintf(stderr, "Error: failed to write %s\n", interval_path);
+        exit(1);
+      }
+      t = trace_clock_ns();
+    }
+    if (events)
+    {
+      if (!profile_top && !interval)
+      {
+        pc_profile_outcomes(recs, n, cond, taken);
+      }
+      for (int p = 0; p < num_bp_types; p++)
+      {
+        pc_profile_misses(cond, taken, predictions[p], n, event_misses[p]);
+      }
+      if (!miss_events_write(events, first_record, recs, n, event_bits))
+      {
+        fprintf(stderr, "Error: failed to write %s\n", events_path);
         exit(1);
       }
+      t = trace_clock_ns();
+    }
+    if (dump && !pred_dump_write(dump, recs, n, prediction_bits))
+    {
+      fprintf(stderr, "Error: failed to write %s\n", dump_path);
+      exit(1);
+    }
+    if (verbose != 0)
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        if (!TRACE_FLAG(&recs[i], TRACE_F_CONDITION))
+        {
+          continue;
+        }
+        for (int p = 0; p < num_bp_types; p++)
+        {
+          printf(p + 1 < num_bp_types ? "%d " : "%d\n", (int)((predictions[p][i >> 6] >> (i & 63)) & 1));
+        }
+      }
+      t = trace_clock_ns();
+    }
+    if (progress_enabled)
+    {
+      uint64_t missed = 0;
+      for (int p = 0; p < num_bp_types; p++)
+      {
+        missed += mispredictions[p];
+      }
+      progress_set(0, num_records, num_branches * num_bp_types, missed);
+    }
+    hotcheck_end(n);
+  }
+  if (progress_enabled)
+  {
+    progress_stop();
+  }
+  if (perf_counters)
+  {
+    perfctr_stop(&perf_all);
+  }
+
+  if (dump && !pred_dump_close(dump))
+  {
+    fprintf(stderr, "Error: failed to write %s\n", dump_path);
+    exit(1);
+  }
+
+  if (events && !miss_events_close(events))
+  {
+    fprintf(stderr, "Error: failed to write %s\n", events_path);
+    exit(1);
+  }
+
+  for (int p = 0; p < num_bp_types && memo_run && !memoized; p++)
+  {
+    memo_result_t r = {{num_branches, mispredictions[p]}, num_records, predict_ns[p], predictor_memory(predictors[p])};
+    if (!memo_store(scope, predictor_config(predictors[p]), &r))
+    {
+      fprintf(stderr, "Error: failed to write %s\n", memo_path);
+      exit(1);
+    }
+  }
+
+  if (interval && !interval_write(&series))
+  {
+    fprintf(stderr, "Error: failed to write %s\n", interval_path);
+    exit(1);
+  }
+
+  // Print out the mispredict statistics, one block per predictor
+  // when several were replayed
+  std::vector<result_row_t> rows;
+  for (int p = 0; p < num_bp_types && result_format != RESULT_FORMAT_TEXT; p++)
+  {
+    result_row_t r;
+    r.kind = RESULT_TRACE;
+    r.index = 0;
+    r.type = bp_types[p];
+    r.status = RESULT_OK;
+    r.stats.branches = num_branches;
+    r.stats.mispredictions = mispredictions[p];
+    r.replayed = r.records = num_records;
+    r.runtime_ns = predict_ns[p];
+    r.memory = predictor_memory(predictors[p]);
+    r.budget_bits = predictor_budget_bits(predictor_config(predictors[p]));
+    r.name = trace_path ? trace_path : "-";
+    char config[256];
+    predictor_config_format(predictor_config(predictors[p]), config, sizeof(config));
+    r.config = config;
+    if (!memoized)
+    {
+      char hex[17];
+      snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)fingerprint_value(&fingerprints[p]));
+      r.fingerprint = hex;
+    }
+    rows.push_back(r);
+  }
+  if (!rows.empty())
+  {
+    results_report(rows);
+  }
+  for (int p = 0; p < num_bp_types && result_format == RESULT_FORMAT_TEXT; p++)
+  {
+    if (num_bp_types > 1)
+    {
+      printf("%s:\n", bpName[bp_types[p]]);
+    }
+    replay_stats_t st = {num_branches, mispredictions[p]};
+    printf("Branches:        %10llu\n", (unsigned long long)num_branches);
+    printf("Incorrect:       %10llu\n", (unsigned long long)mispredictions[p]);
+    printf("Misprediction Rate: %7.3f\n", num_branches ? replay_rate(&st) : 0.0);
+    if (icount && !icount_short(icount))
+    {
+      printf("Instructions:    %10llu\n", (unsigned long long)num_instructions);
+      printf("Misses per KInst:   %7.3f\n", num_instructions ? 1000.0 * mispredictions[p] / num_instructions : 0.0);
+    }
+  }
+  if (icount && icount_short(icount))
+  {
+    fprintf(stderr, "Warning: the instruction counts of %s end before its records, they are not reported\n",
+            trace_path);
+  }
+  icount_close(icount);
+  if (frontend)
+  {
+    fe_print(&fe, result_format == RESULT_FORMAT_TEXT ? stdout : stderr);
+    fe_free(&fe);
+  }
+  if (classes)
+  {
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      class_print(result_format == RESULT_FORMAT_TEXT ? stdout : stderr, bpName[bp_types[p]], &class_branches,
+                  &class_misses[p]);
     }
-    else
+  }
+  if (oracle_len)
+  {
+    oracle_print(&oracle, result_format == RESULT_FORMAT_TEXT ? stdout : stderr);
+    oracle_free(&oracle);
+  }
+  if (verify)
+  {
+    fprintf(stderr, "Verified %llu conditional branches against the reference", (unsigned long long)verifier.branches);
+    if (verify_state_every)
     {
-      // Use as input file
-      stream = fopen(argv[i], "r");
+      fprintf(stderr, ", and the tables %llu times", (unsigned long long)verifier.states);
     }
+    fprintf(stderr, "\n");
+    verify_free(&verifier);
+  }
+  free(hist);
+  predictor_pipeline_stop(stages);
+  // Allocations and system calls of the loop, with make HOTCHECK=1
+  hotcheck_report(result_format == RESULT_FORMAT_TEXT ? stdout : stderr);
+#ifdef BP_COST
+  // Sampled cycles per call next to the statistics, on stderr when
+  // they are in a machine readable format
+  for (int p = 0; p < num_bp_types; p++)
+  {
+    bp_cost_print(predictor_cost(predictors[p]), bpName[bp_types[p]],
+                  result_format == RESULT_FORMAT_TEXT ? stdout : stderr);
+  }
+#endif
+#ifdef BP_OCCUPANCY
+  // Touched entries, aliasing and TAGE component rates, as above
+  for (int p = 0; p < num_bp_types; p++)
+  {
+    bp_occ_print(predictor_occupancy(predictors[p]), bpName[bp_types[p]],
+                 result_format == RESULT_FORMAT_TEXT ? stdout : stderr);
+  }
+#endif
+
+  if (library && !checkpoint_library_close(library))
+  {
+    fprintf(stderr, "Error: failed to write %s\n", checkpoint_path);
+    exit(1);
+  }
+  if (save_state_path && !checkpoint_save(save_state_path, predictors, num_bp_types, start_branch + warmed + num_records))
+  {
+    fprintf(stderr, "Error: failed to write %s\n", save_state_path);
+    exit(1);
   }
 
-  // Initialize the predictor
-  init_predictor();
+  // Most mispredicted static branches of each predictor
+  if (profile_top)
+  {
+    const pc_counts_t *profiles[NUM_BP_TYPES];
+    const char *names[NUM_BP_TYPES];
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      profiles[p] = &pc_misses[p];
+      names[p] = bpName[bp_types[p]];
+    }
+    if (pprof_path &&
+        !pc_profile_write_pprof(pprof_path, &pc_execs, profiles, names, num_bp_types, pc_map.pcs, pprof_symbols))
+    {
+      fprintf(stderr, "Error: failed to write %s\n", pprof_path);
+      exit(1);
+    }
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      printf("\n%s hot branches:\n", bpName[bp_types[p]]);
+      pc_profile_print(&pc_execs, &pc_misses[p], pc_map.pcs, profile_top);
+      pc_counts_free(&pc_misses[p]);
+    }
+    pc_counts_free(&pc_execs);
+    pc_map_free(&pc_map);
+  }
 
-  uint32_t num_branches = 0;
-  uint32_t mispredictions = 0;
-  uint32_t pc = 0;
-  uint32_t target = 0;
-  uint32_t outcome = NOTTAKEN;
-  uint32_t condition = 0;
-  uint32_t call = 0;
-  uint32_t ret = 0;
-  uint32_t direct = 0;
+  // Cleanup, keeping the sizes for --stats
+  uint64_t storage_bits[NUM_BP_TYPES], host_bytes[NUM_BP_TYPES];
+  uint64_t filtered[NUM_BP_TYPES], filter_checks[NUM_BP_TYPES];
+  const char *table_names[NUM_BP_TYPES][TAGE_MAX_TAGGED + 1];
+  uint64_t table_entries[NUM_BP_TYPES][TAGE_MAX_TAGGED + 1];
+  int tables[NUM_BP_TYPES];
+  for (int p = 0; p < num_bp_types; p++)
+  {
+    storage_bits[p] = predictor_budget_bits(predictor_config(predictors[p]));
+    host_bytes[p] = predictor_memory(predictors[p]);
+    predictor_filter_stats(predictors[p], &filtered[p], &filter_checks[p]);
+    tables[p] = predictor_unbounded_entries(predictors[p], table_names[p], table_entries[p], TAGE_MAX_TAGGED + 1);
+    predictor_destroy(predictors[p]);
+  }
+  if (pipe_reader)
+  {
+    trace_pipe_stop(pipe_reader);
+  }
 
-  // Reach each branch from the trace
-  while (read_branch(&pc, &target, &outcome, &condition, &call, &ret, &direct))
+  // Where the time went; decoding after the open runs on the reader
+  // thread with --async and overlaps the predictors
+  if (stats)
   {
-    if (condition == 1)
+    uint64_t wall_ns = trace_clock_ns() - start_ns;
+    uint64_t decompress_ns = trace->decompress_ns - open_decompress_ns;
+    uint64_t read_ns = trace->read_ns - open_read_ns;
+    printf("Wall time:       %10.3f s\n", wall_ns / 1e9);
+    printf("Branches/sec:    %10.3f M\n", wall_ns ? num_records * 1e3 / wall_ns : 0.0);
+    printf("ns/branch:       %10.2f\n", num_records ? (double)wall_ns / num_records : 0.0);
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    printf("Peak RSS:        %10.1f MB\n", ru.ru_maxrss / 1024.0);
+    print_phase("Open/seek", open_ns, wall_ns, num_records);
+    print_phase("Decompress", decompress_ns, wall_ns, num_records);
+    print_phase("Parse", read_ns > decompress_ns ? read_ns - decompress_ns : 0, wall_ns, num_records);
+    if (pipe_reader && !parallel)
+    {
+      print_phase("Reader wait", wait_ns, wall_ns, num_records);
+    }
+    for (int p = 0; p < num_bp_types && parallel; p++)
+    {
+      char name[64];
+      snprintf(name, sizeof(name), "Reader wait %s", bpName[bp_types[p]]);
+      print_phase(name, consumer_wait_ns[p], wall_ns, num_records);
+    }
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      char name[64];
+      snprintf(name, sizeof(name), num_bp_types > 1 ? "Predict+train %s" : "Predict+train", bpName[bp_types[p]]);
+      print_phase(name, predict_ns[p], wall_ns, num_records);
+    }
+    if (frontend)
+    {
+      print_phase("BTB and RAS", fe_ns, wall_ns, num_records);
+    }
+    if (oracle_len)
+    {
+      print_phase("Oracle bounds", oracle_ns, wall_ns, num_records);
+    }
+    if (hist)
     {
-      num_branches++;
-      // Make a prediction and compare with actual outcome
-      uint32_t prediction = make_prediction(pc, target, direct);
-      if (prediction != outcome)
+      print_phase("Shared history", hist_ns, wall_ns, num_records);
+    }
+    // What each would take in hardware, of the assignment's budget,
+    // and what it takes here
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      printf("Storage %-11s %10llu bits %6.1f%% of budget, %.1f KB host\n", bpName[bp_types[p]],
+             (unsigned long long)storage_bits[p], 100.0 * storage_bits[p] / PREDICTOR_BUDGET_BITS,
+             host_bytes[p] / 1024.0);
+    }
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      if (filter_checks[p])
       {
-        mispredictions++;
+        printf("Filter %-12s %10llu of %llu branches (%.2f%%) predicted by the bias filter alone\n",
+               bpName[bp_types[p]], (unsigned long long)filtered[p], (unsigned long long)filter_checks[p],
+               100.0 * filtered[p] / filter_checks[p]);
       }
-      if (verbose != 0)
+    }
+    // The entries an unbounded table grew to, the capacity it took to
+    // hold every index and tag without eviction
+    for (int p = 0; p < num_bp_types; p++)
+    {
+      for (int t = 0; t < tables[p]; t++)
       {
-        printf("%d\n", prediction);
+        printf("Entries %-11s %-10s %10llu unique\n", bpName[bp_types[p]], table_names[p][t],
+               (unsigned long long)table_entries[p][t]);
       }
     }
-    // Train the predictor
-    train_predictor(pc, target, outcome, condition, call, ret, direct);
   }
-
-  // Print out the mispredict statistics
-  printf("Branches:        %10d\n", num_branches);
-  printf("Incorrect:       %10d\n", mispredictions);
-  float mispredict_rate = 1000 * ((float)mispredictions / (float)num_branches);
-  printf("Misprediction Rate: %7.3f\n", mispredict_rate);
-
-  // Cleanup
-  fclose(stream);
-  free(buf);
+  if (perf_counters)
+  {
+    perfctr_print_header(stdout);
+    perfctr_read(&perf_all);
+    perfctr_print(stdout, "Replay", &perf_all, num_records);
+    perfctr_close(&perf_all);
+    for (int p = 0; p < num_bp_types && perf_counters == 2; p++)
+    {
+      perfctr_read(&perf_each[p]);
+      perfctr_print(stdout, bpName[bp_types[p]], &perf_each[p], num_records);
+      perfctr_close(&perf_each[p]);
+    }
+  }
+  for (int p = 0; p < num_bp_types && compose_flush; p++)
+  {
+    predictor_snapshot_free(images[p]);
+  }
+  trace_close(trace);
+  if (memo_run)
+  {
+    print_memo();
+  }
 
   return 0;
 }
@@ -0,0 +1,286 @@
+//========================================================//
+//  memo.cpp                                              //
+//  Source file for the memoized results store            //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "memo.h"
+#include "synth.h"
+
+const char *memo_path = NULL;
+
+typedef struct
+{
+  uint64_t size, mtime;
+  std::string hash;
+} memo_trace_t;
+
+static std::mutex memo_lock;
+static int memo_fd = -1;
+static std::unordered_map<std::string, memo_trace_t> memo_traces; // by path
+static std::unordered_map<std::string, memo_result_t> memo_results; // by key
+static uint64_t memo_found, memo_added;
+// keys found or added this run, so a result counts as found once, and
+// only if the store held it before the run
+static std::unordered_set<std::string> memo_counted;
+
+// Two 64-bit lanes of a multiply and rotate hash, fed 8 bytes at a time
+typedef struct
+{
+  uint64_t a, b, len;
+} memo_hash_t;
+
+static const uint64_t MEMO_K1 = 0x9e3779b97f4a7c15ULL, MEMO_K2 = 0xc2b2ae3d27d4eb4fULL;
+
+static inline uint64_t memo_rotl(uint64_t x, int r)
+{
+  return x << r | x >> (64 - r);
+}
+
+static void memo_hash_init(memo_hash_t *h)
+{
+  h->a = MEMO_K1;
+  h->b = MEMO_K2;
+  h->len = 0;
+}
+
+static void memo_hash_add(memo_hash_t *h, const void *data, size_t n)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  for (size_t i = 0; i < n; i += 8)
+  {
+    uint64_t w = 0;
+    memcpy(&w, p + i, n - i < 8 ? n - i : 8);
+    h->a = memo_rotl(h->a ^ (w * MEMO_K2), 31) * MEMO_K1;
+    h->b = memo_rotl(h->b + (w ^ h->a), 27) * MEMO_K2 + MEMO_K1;
+  }
+  h->len += n;
+}
+
+static inline uint64_t memo_mix(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// The hash as MEMO_HASH_LEN hex digits into 'out'
+static void memo_hash_hex(const memo_hash_t *h, char *out)
+{
+  uint64_t a = memo_mix(h->a ^ h->len), b = memo_mix(h->b ^ memo_rotl(h->len, 32) ^ a);
+  snprintf(out, MEMO_HASH_LEN + 1, "%016llx%016llx", (unsigned long long)a, (unsigned long long)b);
+}
+
+// Append 'line' with one write, so lines of several runs never mix
+static int memo_append(const std::string &line)
+{
+  return memo_fd >= 0 && write(memo_fd, line.data(), line.size()) == (ssize_t)line.size();
+}
+
+// Add one line of the store to the maps
+static void memo_parse_line(char *line)
+{
+  if (line[0] == 'T' && line[1] == ' ')
+  {
+    unsigned long long size, mtime;
+    char hash[MEMO_HASH_LEN + 1];
+    int used = 0;
+    if (sscanf(line + 2, "%llu %llu %32s %n", &size, &mtime, hash, &used) == 3 && used && line[2 + used])
+    {
+      line[strcspn(line, "\n")] = '\0';
+      memo_trace_t t = {size, mtime, hash};
+      memo_traces[line + 2 + used] = t;
+    }
+  }
+  else if (line[0] == 'R' && line[1] == ' ')
+  {
+    char key[MEMO_HASH_LEN + 1];
+    unsigned long long v[5];
+    if (sscanf(line + 2, "%32s %llu %llu %llu %llu %llu", key, &v[0], &v[1], &v[2], &v[3], &v[4]) == 6)
+    {
+      memo_result_t r = {{v[0], v[1]}, v[2], v[3], v[4]};
+      memo_results[key] = r;
+    }
+  }
+}
+
+int memo_open()
+{
+  std::lock_guard<std::mutex> lock(memo_lock);
+  memo_fd = open(memo_path, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (memo_fd < 0)
+  {
+    return 0;
+  }
+  FILE *in = fdopen(dup(memo_fd), "r");
+  if (!in)
+  {
+    return 0;
+  }
+  char line[4096];
+  int ok = 1;
+  if (!fgets(line, sizeof(line), in))
+  {
+    char magic[32];
+    snprintf(magic, sizeof(magic), "%s %d\n", MEMO_MAGIC, MEMO_VERSION);
+    ok = memo_append(magic);
+  }
+  else
+  {
+    int version = 0;
+    ok = !strncmp(line, MEMO_MAGIC " ", strlen(MEMO_MAGIC) + 1) &&
+         sscanf(line + strlen(MEMO_MAGIC), "%d", &version) == 1 && version == MEMO_VERSION;
+    while (ok && fgets(line, sizeof(line), in))
+    {
+      memo_parse_line(line);
+    }
+  }
+  fclose(in);
+  return ok;
+}
+
+// From the store while its size and modification time are the same
+int memo_trace_hash(const char *path, char *hash)
+{
+  struct stat sb;
+  if (stat(path, &sb) || !S_ISREG(sb.st_mode))
+  {
+    return 0;
+  }
+  {
+    std::lock_guard<std::mutex> lock(memo_lock);
+    auto it = memo_traces.find(path);
+    if (it != memo_traces.end() && it->second.size == (uint64_t)sb.st_size &&
+        it->second.mtime == (uint64_t)sb.st_mtime)
+    {
+      memcpy(hash, it->second.hash.c_str(), MEMO_HASH_LEN + 1);
+      return 1;
+    }
+  }
+  FILE *in = fopen(path, "rb");
+  if (!in)
+  {
+    return 0;
+  }
+  memo_hash_t h;
+  memo_hash_init(&h);
+  char *buf = (char *)malloc(1 << 20);
+  size_t n;
+  while (buf && (n = fread(buf, 1, 1 << 20, in)) > 0)
+  {
+    memo_hash_add(&h, buf, n);
+  }
+  int ok = buf && !ferror(in);
+  free(buf);
+  fclose(in);
+  if (!ok)
+  {
+    return 0;
+  }
+  memo_hash_hex(&h, hash);
+
+  std::lock_guard<std::mutex> lock(memo_lock);
+  memo_trace_t t = {(uint64_t)sb.st_size, (uint64_t)sb.st_mtime, hash};
+  memo_traces[path] = t;
+  char head[96];
+  snprintf(head, sizeof(head), "T %llu %llu %s ", (unsigned long long)t.size, (unsigned long long)t.mtime, hash);
+  memo_append(std::string(head) + path + "\n");
+  return 1;
+}
+
+int memo_scope(const char *path, uint64_t start, uint64_t warmup, uint64_t count, char *scope)
+{
+  char hash[MEMO_HASH_LEN + 1];
+  if (!path || !strcmp(path, "-"))
+  {
+    return 0;
+  }
+  if (!strncmp(path, SYNTH_PREFIX, SYNTH_PREFIX_LEN))
+  {
+    memo_hash_t h;
+    memo_hash_init(&h);
+    memo_hash_add(&h, path, strlen(path));
+    memo_hash_hex(&h, hash);
+  }
+  else if (!memo_trace_hash(path, hash))
+  {
+    return 0;
+  }
+  snprintf(scope, MEMO_SCOPE_LEN, "%s %llu %llu %llu", hash, (unsigned long long)start, (unsigned long long)warmup,
+           (unsigned long long)count);
+  return 1;
+}
+
+// The hash of the scope, the sources' fingerprint and every field of
+// the configuration
+void memo_key(const char *scope, const predictor_config_t *cfg, char *key)
+{
+  char config[1024];
+  predictor_config_format(cfg, config, sizeof(config));
+  memo_hash_t h;
+  memo_hash_init(&h);
+  std::string id = std::string(scope) + "\n" + predictor_build_id() + "\n" + bpName[cfg->type] + " " + config;
+  memo_hash_add(&h, id.data(), id.size());
+  memo_hash_hex(&h, key);
+}
+
+// A plugin's code is not part of the fingerprint, so its results are
+// never stored
+int memo_lookup(const char *scope, const predictor_config_t *cfg, memo_result_t *r)
+{
+  if (cfg->type == PLUGIN)
+  {
+    return 0;
+  }
+  char key[MEMO_HASH_LEN + 1];
+  memo_key(scope, cfg, key);
+  std::lock_guard<std::mutex> lock(memo_lock);
+  auto it = memo_results.find(key);
+  if (it == memo_results.end())
+  {
+    return 0;
+  }
+  if (memo_counted.insert(key).second)
+  {
+    memo_found++;
+  }
+  *r = it->second;
+  return 1;
+}
+
+int memo_store(const char *scope, const predictor_config_t *cfg, const memo_result_t *r)
+{
+  if (cfg->type == PLUGIN)
+  {
+    return 1;
+  }
+  char key[MEMO_HASH_LEN + 1], line[256];
+  memo_key(scope, cfg, key);
+  snprintf(line, sizeof(line), "R %s %llu %llu %llu %llu %llu\n", key, (unsigned long long)r->stats.branches,
+           (unsigned long long)r->stats.mispredictions, (unsigned long long)r->records,
+           (unsigned long long)r->runtime_ns, (unsigned long long)r->memory);
+  std::lock_guard<std::mutex> lock(memo_lock);
+  memo_results[key] = *r;
+  memo_counted.insert(key);
+  memo_added++;
+  return memo_append(line);
+}
+
+void memo_counts(uint64_t *found, uint64_t *added)
+{
+  std::lock_guard<std::mutex> lock(memo_lock);
+  *found = memo_found;
+  *added = memo_added;
+}
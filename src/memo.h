@@ -0,0 +1,91 @@
+//========================================================//
+//  memo.h                                                //
+//  Header file for the memoized results store            //
+//                                                        //
+//  --memo=<file> keeps the result of every predictor     //
+//  configuration replayed over a trace window in an      //
+//  append-only file, keyed by a hash of the trace's      //
+//  bytes, the window, the whole configuration and the    //
+//  fingerprint of the predictor sources. Single runs,    //
+//  sweeps and multi-trace runs print what it already     //
+//  holds and only replay what it does not                //
+//========================================================//
+
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdint.h>
+#include "predictor.h"
+#include "replay.h"
+
+// The file is the line "BPMEMO <version>" followed by lines of
+//  T <size> <mtime> <hash> <path>     the content hash of a trace
+//  R <key> <branches> <mispredictions> <records> <runtime_ns> <memory>
+// each written with a single append, so runs can share it. Later
+// lines win; lines that do not parse are skipped
+#define MEMO_MAGIC "BPMEMO"
+#define MEMO_VERSION 1
+
+// Hex digits of a trace hash, a window scope and a key
+#define MEMO_HASH_LEN 32
+#define MEMO_SCOPE_LEN 128
+
+typedef struct
+{
+  replay_stats_t stats;
+  uint64_t records;    // counted records replayed
+  uint64_t runtime_ns; // when it was replayed
+  uint64_t memory;     // predictor_memory bytes
+} memo_result_t;
+
+// Path of --memo, NULL for none
+extern const char *memo_path;
+
+// Load the store at memo_path, creating it if missing
+//
+// Returns True if Successful
+//
+int memo_open();
+
+// Write into 'scope' what identifies the trace at 'path' and the
+// window of 'warmup' and 'count' records after 'start': its content
+// hash, read from the store or computed and added to it, or the spec
+// of an in-process synthetic trace
+//
+// Returns True if Successful, False for stdin or a trace that can not
+// be read
+//
+int memo_scope(const char *path, uint64_t start, uint64_t warmup, uint64_t count, char *scope);
+
+// The content hash of the trace file at 'path' into 'hash', of
+// MEMO_HASH_LEN hex digits, the one its scope begins with
+//
+// Returns True if Successful
+//
+int memo_trace_hash(const char *path, char *hash);
+
+// The key of 'cfg' over the window of 'scope' into 'key', of
+// MEMO_HASH_LEN hex digits
+//
+void memo_key(const char *scope, const predictor_config_t *cfg, char *key);
+
+// The stored result of 'cfg' over the window of 'scope'
+//
+// Returns True if there is one
+//
+int memo_lookup(const char *scope, const predictor_config_t *cfg, memo_result_t *r);
+
+// Append the result of 'cfg' over the window of 'scope'
+//
+// Returns True if Successful
+//
+int memo_store(const char *scope, const predictor_config_t *cfg, const memo_result_t *r);
+
+// Results found in the store and added to it so far. A result is
+// found once however often it is looked up, as a coordinated sweep
+// looks each point up before and after its workers run, and not at
+// all when it was added during this run
+//
+void memo_counts(uint64_t *found, uint64_t *added);
+
+#endif
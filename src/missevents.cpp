@@ -0,0 +1,123 @@
+//========================================================//
+//  missevents.cpp                                        //
+//  Source file for the misprediction event stream        //
+//========================================================//
+
+#include <stdlib.h>
+#include <string.h>
+#include "missevents.h"
+
+// Bytes of events collected before each write
+#define MISS_EVENTS_BUF_SIZE (1 << 22)
+
+// Most bytes of one event: three 64-bit varints
+#define MISS_EVENTS_MAX_EVENT 30
+
+miss_events_t *miss_events_open(const char *path, const int *types, int num_types, int with_pc, uint64_t first_record)
+{
+  FILE *out = fopen(path, "wb");
+  if (!out)
+  {
+    return NULL;
+  }
+  miss_events_t *e = (miss_events_t *)calloc(1, sizeof(miss_events_t));
+  memcpy(e->hdr.magic, MISS_EVENTS_MAGIC, sizeof(MISS_EVENTS_MAGIC));
+  e->hdr.version = MISS_EVENTS_VERSION;
+  e->hdr.flags = with_pc ? MISS_EVENTS_F_PC : 0;
+  e->hdr.num_predictors = num_types;
+  e->hdr.first_record = first_record;
+  for (int p = 0; p < num_types; p++)
+  {
+    e->hdr.types[p] = (uint8_t)types[p];
+  }
+  e->out = out;
+  e->cap = MISS_EVENTS_BUF_SIZE;
+  e->buf = (uint8_t *)malloc(e->cap);
+
+  // The counts are filled in by miss_events_close
+  if (!e->buf || fwrite(&e->hdr, sizeof(e->hdr), 1, out) != 1)
+  {
+    fclose(out);
+    free(e->buf);
+    free(e);
+    return NULL;
+  }
+  return e;
+}
+
+static inline uint8_t *miss_events_put(uint8_t *p, uint64_t v)
+{
+  while (v >= 0x80)
+  {
+    *p++ = (uint8_t)v | 0x80;
+    v >>= 7;
+  }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+int miss_events_write(miss_events_t *e, uint64_t first, const branch_record_t *recs, size_t n,
+                      const uint64_t *const *misses)
+{
+  uint32_t np = e->hdr.num_predictors;
+  for (size_t w = 0; w < (n + 63) / 64; w++)
+  {
+    // the records some predictor missed, which are all conditional
+    uint64_t mask[NUM_BP_TYPES];
+    uint64_t any = 0;
+    for (uint32_t p = 0; p < np; p++)
+    {
+      mask[p] = misses[p][w];
+      any |= mask[p];
+    }
+    for (; any; any &= any - 1)
+    {
+      int b = __builtin_ctzll(any);
+      size_t i = w * 64 + b;
+      if (e->len + MISS_EVENTS_MAX_EVENT > e->cap)
+      {
+        if (fwrite(e->buf, 1, e->len, e->out) != e->len)
+        {
+          return 0;
+        }
+        e->len = 0;
+      }
+      uint8_t *p = e->buf + e->len;
+      p = miss_events_put(p, first + i - e->last);
+      e->last = first + i;
+      if (np > 1)
+      {
+        uint64_t who = 0;
+        for (uint32_t q = 0; q < np; q++)
+        {
+          who |= ((mask[q] >> b) & 1) << q;
+        }
+        p = miss_events_put(p, who);
+      }
+      if (e->hdr.flags & MISS_EVENTS_F_PC)
+      {
+        int64_t d = (int64_t)recs[i].pc - (int64_t)e->last_pc;
+        p = miss_events_put(p, d >= 0 ? (uint64_t)d << 1 : ((uint64_t)-d << 1) - 1);
+        e->last_pc = recs[i].pc;
+      }
+      e->len = p - e->buf;
+      e->hdr.num_events++;
+    }
+  }
+  e->hdr.num_records += n;
+  for (size_t i = 0; i < n; i++)
+  {
+    e->hdr.num_branches += TRACE_FLAG(&recs[i], TRACE_F_CONDITION);
+  }
+  return 1;
+}
+
+int miss_events_close(miss_events_t *e)
+{
+  int ok = !e->len || fwrite(e->buf, 1, e->len, e->out) == e->len;
+  ok = ok && fseek(e->out, 0, SEEK_SET) == 0 && fwrite(&e->hdr, sizeof(e->hdr), 1, e->out) == 1;
+  ok = fclose(e->out) == 0 && ok;
+  free(e->buf);
+  free(e);
+  return ok;
+}
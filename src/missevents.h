@@ -0,0 +1,82 @@
+//========================================================//
+//  missevents.h                                          //
+//  Header file for the misprediction event stream        //
+//                                                        //
+//  Records where the conditional branches were           //
+//  mispredicted, as the distance from one to the next,   //
+//  for timing models that charge the penalty without     //
+//  modeling a predictor                                  //
+//========================================================//
+
+#ifndef MISSEVENTS_H
+#define MISSEVENTS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "predictor.h"
+#include "trace.h"
+
+// A stream is a header followed by one event per mispredicted
+// conditional branch, each made of LEB128 varints (7 bits a byte,
+// least significant first, the top bit set on all but the last):
+//  - the record number in the trace, less that of the previous event
+//    (of 0 for the first), counting every record from the start
+//  - with several predictors, the mask of those that mispredicted it,
+//    bit p for predictor p; a branch no predictor missed has no event
+//  - with MISS_EVENTS_F_PC, the PC less that of the previous event,
+//    zigzag encoded (2d for d >= 0, -2d - 1 below)
+#define MISS_EVENTS_MAGIC "BPMISS1"
+#define MISS_EVENTS_VERSION 1
+#define MISS_EVENTS_F_PC 1
+
+typedef struct
+{
+  char magic[8];               // MISS_EVENTS_MAGIC, NUL terminated
+  uint32_t version;            // MISS_EVENTS_VERSION
+  uint32_t flags;              // MISS_EVENTS_F_*
+  uint32_t num_predictors;
+  uint32_t reserved;
+  uint64_t num_events;
+  uint64_t num_branches;       // conditional branches replayed
+  uint64_t first_record;       // first record replayed and counted
+  uint64_t num_records;        // records replayed and counted
+  uint8_t types[NUM_BP_TYPES]; // predictor type of each mask bit
+  uint8_t reserved2[8 - NUM_BP_TYPES % 8];
+} miss_events_header_t;
+
+typedef struct
+{
+  FILE *out;
+  miss_events_header_t hdr;
+  uint8_t *buf;      // encoded events not written yet
+  size_t cap;        // size of buf in bytes
+  size_t len;        // bytes in buf
+  uint64_t last;     // record number of the previous event
+  uint32_t last_pc;
+} miss_events_t;
+
+// Create the stream 'path' for 'num_types' predictors of 'types',
+// with the PC of each event when 'with_pc', replaying from record
+// 'first_record'
+//
+// Returns NULL if the file can not be created
+//
+miss_events_t *miss_events_open(const char *path, const int *types, int num_types, int with_pc, uint64_t first_record);
+
+// Append the mispredicted conditional branches of 'n' records, the
+// first being record number 'first' of the trace; record i was
+// mispredicted by predictor p when bit i of misses[p] is set, as
+// filled by pc_profile_misses
+//
+// Returns True if Successful
+//
+int miss_events_write(miss_events_t *e, uint64_t first, const branch_record_t *recs, size_t n,
+                      const uint64_t *const *misses);
+
+// Flush, record the counts and close the stream
+//
+// Returns True if Successful
+//
+int miss_events_close(miss_events_t *e);
+
+#endif
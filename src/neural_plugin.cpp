@@ -0,0 +1,473 @@
+//========================================================//
+//  neural_plugin.cpp                                     //
+//  Predictor plugin of offline-trained neural models     //
+//                                                        //
+//  Evaluates a quantized multilayer perceptron, trained  //
+//  elsewhere, on the global history window of every      //
+//  conditional branch. Built with 'make plugins' and run //
+//  with --plugin=libneural.so and BP_NEURAL_MODEL=<file> //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <mutex>
+#if defined(__AVX512VNNI__) || defined(__AVXVNNI__)
+#include <immintrin.h>
+#endif
+#include "bpplugin.h"
+
+// A model file, little endian, is a neural_header_t then per layer
+// its inputs and outputs (uint32), its scale (float), the bias of each
+// output (int32) and the weights (int8), output by output.
+//
+// The inputs of the first layer are the outcomes of the 'history'
+// last conditional branches, newest first, then the 'pc_bits' low
+// bits of the branch's pc, each +1 for taken or set and -1 otherwise.
+// A layer's outputs are its weights times its inputs plus the bias,
+// in int32; a hidden layer's are then multiplied by its scale, rounded
+// and clamped to 0..255 (a ReLU) as the inputs of the next. The last
+// layer has one output, predicting taken when above 0
+#define NEURAL_MAGIC "BPNEURL1"
+#define NEURAL_MAGIC_LEN 8
+#define NEURAL_MAX_HISTORY 1024
+#define NEURAL_MAX_PC_BITS 32
+#define NEURAL_MAX_LAYERS 8
+#define NEURAL_MAX_WIDTH 4096
+
+// Conditional branches evaluated together, one row each
+#define NEURAL_BATCH 256
+
+// With BP_NEURAL_TUNE=1 the last layer keeps training online, as a
+// perceptron on each misprediction, at this many bits of extra
+// resolution over its int8 weights
+#define NEURAL_TUNE_SHIFT 4
+
+typedef struct __attribute__((packed))
+{
+  char magic[NEURAL_MAGIC_LEN]; // NEURAL_MAGIC
+  uint32_t history;             // outcomes in the window, up to NEURAL_MAX_HISTORY
+  uint32_t pc_bits;             // up to NEURAL_MAX_PC_BITS
+  uint32_t num_layers;          // up to NEURAL_MAX_LAYERS
+  uint32_t reserved;
+} neural_header_t;
+
+typedef struct
+{
+  uint32_t inputs, outputs;
+  uint32_t in_pad;  // inputs rounded up to 4, the row stride of its input
+  uint32_t out_pad; // outputs rounded up to 16
+  float scale;
+  int32_t *bias;    // out_pad
+  int32_t *rowsum;  // the first layer's weight sums, for its +-1 inputs
+  int8_t *w;        // in_pad / 4 groups of out_pad outputs of 4 inputs
+} neural_layer_t;
+
+typedef struct
+{
+  uint32_t history, pc_bits, num_layers;
+  neural_layer_t layers[NEURAL_MAX_LAYERS];
+  uint64_t bits;    // storage of the weights and biases
+  const char *path;
+  int tune;
+} neural_model_t;
+
+typedef struct
+{
+  // Outcomes newest first at hist[pos..], written twice so the window
+  // never wraps
+  uint8_t hist[2 * NEURAL_MAX_HISTORY];
+  size_t pos;
+  int32_t *tuned;        // the last layer's weights and bias with tuning
+  uint8_t *act[2];       // NEURAL_BATCH rows of layer inputs
+  int32_t *acc;          // NEURAL_BATCH rows of layer outputs
+  uint32_t index[NEURAL_BATCH]; // record of each row in the batch
+  uint8_t outcome[NEURAL_BATCH];
+} neural_t;
+
+static neural_model_t *neural_model;
+static std::once_flag neural_once;
+
+// Load the model of BP_NEURAL_MODEL into neural_model, once
+//
+static void neural_load()
+{
+  const char *path = getenv("BP_NEURAL_MODEL");
+  FILE *in = path ? fopen(path, "rb") : NULL;
+  if (!in)
+  {
+    fprintf(stderr, "Error: set BP_NEURAL_MODEL to a model file, %s can not be read\n", path ? path : "none");
+    return;
+  }
+  neural_model_t *m = (neural_model_t *)calloc(1, sizeof(neural_model_t));
+  neural_header_t hdr;
+  int ok = fread(&hdr, sizeof(hdr), 1, in) == 1 && !memcmp(hdr.magic, NEURAL_MAGIC, NEURAL_MAGIC_LEN) &&
+           hdr.history <= NEURAL_MAX_HISTORY && hdr.pc_bits <= NEURAL_MAX_PC_BITS && hdr.num_layers >= 1 &&
+           hdr.num_layers <= NEURAL_MAX_LAYERS && hdr.history + hdr.pc_bits > 0;
+  m->history = hdr.history;
+  m->pc_bits = hdr.pc_bits;
+  m->num_layers = hdr.num_layers;
+  uint32_t inputs = hdr.history + hdr.pc_bits;
+  for (uint32_t l = 0; ok && l < m->num_layers; l++)
+  {
+    neural_layer_t *L = &m->layers[l];
+    uint32_t dims[2];
+    ok = fread(dims, sizeof(dims), 1, in) == 1 && fread(&L->scale, sizeof(float), 1, in) == 1 &&
+         dims[0] == inputs && dims[1] >= 1 && dims[1] <= NEURAL_MAX_WIDTH &&
+         (l + 1 < m->num_layers || dims[1] == 1);
+    if (!ok)
+    {
+      break;
+    }
+    L->inputs = dims[0];
+    L->outputs = dims[1];
+    L->in_pad = (L->inputs + 3) & ~3u;
+    L->out_pad = (L->outputs + 15) & ~15u;
+    L->bias = (int32_t *)calloc(L->out_pad, sizeof(int32_t));
+    L->rowsum = (int32_t *)calloc(L->out_pad, sizeof(int32_t));
+    L->w = (int8_t *)calloc((size_t)L->in_pad * L->out_pad, 1);
+    int8_t *row = (int8_t *)malloc(L->inputs);
+    ok = fread(L->bias, sizeof(int32_t), L->outputs, in) == L->outputs;
+    for (uint32_t o = 0; ok && o < L->outputs; o++)
+    {
+      ok = fread(row, 1, L->inputs, in) == L->inputs;
+      for (uint32_t i = 0; ok && i < L->inputs; i++)
+      {
+        L->w[((size_t)(i / 4) * L->out_pad + o) * 4 + i % 4] = row[i];
+        L->rowsum[o] += row[i];
+      }
+    }
+    free(row);
+    m->bits += (uint64_t)L->inputs * L->outputs * 8 + L->outputs * 32;
+    inputs = L->outputs;
+  }
+  fclose(in);
+  if (!ok)
+  {
+    fprintf(stderr, "Error: %s is not a neural model, see neural_plugin.cpp\n", path);
+    return;
+  }
+  m->path = path;
+  m->tune = getenv("BP_NEURAL_TUNE") && atoi(getenv("BP_NEURAL_TUNE"));
+  neural_model = m;
+}
+
+// out[r][o] = the weights of 'L' times in[r] for the 'rows' rows of
+// L->in_pad bytes, as unsigned bytes times signed weights summed four
+// at a time, the way VPDPBUSD does
+//
+#if defined(__AVX512VNNI__)
+static void neural_matmul(const neural_layer_t *L, const uint8_t *in, size_t rows, int32_t *out)
+{
+  const size_t groups = L->in_pad / 4;
+  for (size_t r = 0; r < rows; r++)
+  {
+    const uint8_t *x = in + r * L->in_pad;
+    for (uint32_t o = 0; o < L->out_pad; o += 16)
+    {
+      __m512i acc = _mm512_setzero_si512();
+      const int8_t *w = L->w + (size_t)o * 4;
+      for (size_t g = 0; g < groups; g++, w += (size_t)L->out_pad * 4)
+      {
+        int32_t quad;
+        memcpy(&quad, x + g * 4, 4);
+        acc = _mm512_dpbusd_epi32(acc, _mm512_set1_epi32(quad), _mm512_loadu_si512(w));
+      }
+      _mm512_storeu_si512(out + r * L->out_pad + o, acc);
+    }
+  }
+}
+#elif defined(__AVXVNNI__)
+static void neural_matmul(const neural_layer_t *L, const uint8_t *in, size_t rows, int32_t *out)
+{
+  const size_t groups = L->in_pad / 4;
+  for (size_t r = 0; r < rows; r++)
+  {
+    const uint8_t *x = in + r * L->in_pad;
+    for (uint32_t o = 0; o < L->out_pad; o += 8)
+    {
+      __m256i acc = _mm256_setzero_si256();
+      const int8_t *w = L->w + (size_t)o * 4;
+      for (size_t g = 0; g < groups; g++, w += (size_t)L->out_pad * 4)
+      {
+        int32_t quad;
+        memcpy(&quad, x + g * 4, 4);
+        acc = _mm256_dpbusd_avx_epi32(acc, _mm256_set1_epi32(quad), _mm256_loadu_si256((const __m256i *)w));
+      }
+      _mm256_storeu_si256((__m256i *)(out + r * L->out_pad + o), acc);
+    }
+  }
+}
+#else
+static void neural_matmul(const neural_layer_t *L, const uint8_t *in, size_t rows, int32_t *out)
+{
+  const size_t groups = L->in_pad / 4;
+  for (size_t r = 0; r < rows; r++)
+  {
+    const uint8_t *x = in + r * L->in_pad;
+    int32_t *y = out + r * L->out_pad;
+    memset(y, 0, L->out_pad * sizeof(int32_t));
+    for (size_t g = 0; g < groups; g++)
+    {
+      const int8_t *w = L->w + g * L->out_pad * 4;
+      for (uint32_t o = 0; o < L->out_pad; o++, w += 4)
+      {
+        y[o] += x[g * 4] * w[0] + x[g * 4 + 1] * w[1] + x[g * 4 + 2] * w[2] + x[g * 4 + 3] * w[3];
+      }
+    }
+  }
+}
+#endif
+
+static void *neural_init(void)
+{
+  std::call_once(neural_once, neural_load);
+  if (!neural_model)
+  {
+    return NULL;
+  }
+  const neural_model_t *m = neural_model;
+  neural_t *s = (neural_t *)calloc(1, sizeof(neural_t));
+  size_t width = 0;
+  for (uint32_t l = 0; l < m->num_layers; l++)
+  {
+    width = m->layers[l].in_pad > width ? m->layers[l].in_pad : width;
+    width = m->layers[l].out_pad > width ? m->layers[l].out_pad : width;
+  }
+  s->act[0] = (uint8_t *)calloc(NEURAL_BATCH, width);
+  s->act[1] = (uint8_t *)calloc(NEURAL_BATCH, width);
+  s->acc = (int32_t *)calloc(NEURAL_BATCH * width, sizeof(int32_t));
+  s->pos = NEURAL_MAX_HISTORY;
+  if (m->tune)
+  {
+    const neural_layer_t *L = &m->layers[m->num_layers - 1];
+    s->tuned = (int32_t *)calloc(L->inputs + 1, sizeof(int32_t));
+    for (uint32_t i = 0; i < L->inputs; i++)
+    {
+      s->tuned[i] = L->w[(size_t)(i / 4) * L->out_pad * 4 + i % 4] * (1 << NEURAL_TUNE_SHIFT);
+    }
+    s->tuned[L->inputs] = L->bias[0] * (1 << NEURAL_TUNE_SHIFT);
+  }
+  if (!s->act[0] || !s->act[1] || !s->acc || (m->tune && !s->tuned))
+  {
+    fprintf(stderr, "Error: neural plugin malloc failed\n");
+    exit(1);
+  }
+  return s;
+}
+
+// Write the first layer's inputs of the branch at 'pc' into 'row'
+//
+static inline void neural_row(const neural_t *s, uint32_t pc, uint8_t *row)
+{
+  const neural_model_t *m = neural_model;
+  memcpy(row, s->hist + s->pos, m->history);
+  for (uint32_t b = 0; b < m->pc_bits; b++)
+  {
+    row[m->history + b] = (pc >> b) & 1;
+  }
+}
+
+static inline void neural_push(neural_t *s, uint8_t outcome)
+{
+  if (s->pos == 0)
+  {
+    s->pos = NEURAL_MAX_HISTORY;
+  }
+  s->pos--;
+  s->hist[s->pos] = s->hist[s->pos + NEURAL_MAX_HISTORY] = outcome;
+}
+
+// Run the 'rows' rows of s->act[0] through the model, leaving each
+// row's last layer inputs in the returned buffer and its output in
+// s->acc[r * out_pad]
+//
+static const uint8_t *neural_forward(neural_t *s, size_t rows)
+{
+  const neural_model_t *m = neural_model;
+  uint8_t *in = s->act[0], *next = s->act[1];
+  for (uint32_t l = 0; l < m->num_layers; l++)
+  {
+    const neural_layer_t *L = &m->layers[l];
+    if (l + 1 == m->num_layers && m->tune)
+    {
+      return in;
+    }
+    neural_matmul(L, in, rows, s->acc);
+    for (size_t r = 0; r < rows; r++)
+    {
+      int32_t *y = s->acc + r * L->out_pad;
+      for (uint32_t o = 0; o < L->outputs; o++)
+      {
+        y[o] = (l == 0 ? 2 * y[o] - L->rowsum[o] : y[o]) + L->bias[o];
+      }
+      if (l + 1 == m->num_layers)
+      {
+        continue;
+      }
+      uint8_t *a = next + r * m->layers[l + 1].in_pad;
+      for (uint32_t o = 0; o < L->outputs; o++)
+      {
+        long v = lrintf(y[o] * L->scale);
+        a[o] = v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+      }
+    }
+    uint8_t *t = in;
+    in = next;
+    next = t;
+  }
+  return in;
+}
+
+// The input 'i' of the tuned last layer from its row 'a', +-1 when
+// that layer is also the first
+//
+static inline int32_t neural_input(const uint8_t *a, uint32_t i)
+{
+  return neural_model->num_layers == 1 ? 2 * a[i] - 1 : a[i];
+}
+
+// The output of the tuned last layer on its row 'a'
+//
+static inline int64_t neural_tuned(const neural_t *s, const uint8_t *a)
+{
+  const neural_layer_t *L = &neural_model->layers[neural_model->num_layers - 1];
+  int64_t z = s->tuned[L->inputs];
+  for (uint32_t i = 0; i < L->inputs; i++)
+  {
+    z += (int64_t)s->tuned[i] * neural_input(a, i);
+  }
+  return z;
+}
+
+// The prediction of row 'r', from the evaluated last layer or, with
+// tuning, from its tuned weights, which then train on 'outcome'
+//
+static inline uint8_t neural_decide(neural_t *s, const uint8_t *last, size_t r, uint8_t outcome)
+{
+  const neural_model_t *m = neural_model;
+  const neural_layer_t *L = &m->layers[m->num_layers - 1];
+  if (!m->tune)
+  {
+    return s->acc[r * L->out_pad] > 0;
+  }
+  const uint8_t *a = last + r * L->in_pad;
+  uint8_t pred = neural_tuned(s, a) > 0;
+  if (pred != outcome)
+  {
+    int32_t t = outcome ? 1 : -1;
+    for (uint32_t i = 0; i < L->inputs; i++)
+    {
+      s->tuned[i] += t * neural_input(a, i);
+    }
+    s->tuned[L->inputs] += t * (1 << NEURAL_TUNE_SHIFT);
+  }
+  return pred;
+}
+
+static uint8_t neural_predict(void *state, uint32_t pc)
+{
+  neural_t *s = (neural_t *)state;
+  neural_row(s, pc, s->act[0]);
+  const uint8_t *last = neural_forward(s, 1);
+  if (neural_model->tune)
+  {
+    return neural_tuned(s, last) > 0;
+  }
+  return s->acc[0] > 0;
+}
+
+static uint8_t neural_predict_and_train(void *state, uint32_t pc, uint8_t outcome)
+{
+  neural_t *s = (neural_t *)state;
+  neural_row(s, pc, s->act[0]);
+  uint8_t pred = neural_decide(s, neural_forward(s, 1), 0, outcome);
+  neural_push(s, outcome);
+  return pred;
+}
+
+static void neural_train(void *state, uint32_t pc, uint8_t outcome)
+{
+  neural_predict_and_train(state, pc, outcome);
+}
+
+// The history of a row only holds outcomes, never predictions, so a
+// whole batch of rows is built from the records first and evaluated
+// with one pass of matrix products per layer
+static uint64_t neural_predict_batch(void *state, const predictor_branch_t *br, size_t n, uint64_t *predictions)
+{
+  neural_t *s = (neural_t *)state;
+  const neural_layer_t *first = &neural_model->layers[0];
+  uint64_t mispredictions = 0;
+  size_t i = 0;
+  while (i < n)
+  {
+    size_t rows = 0;
+    for (; i < n && rows < NEURAL_BATCH; i++)
+    {
+      if (!(br[i].flags & BP_F_CONDITION))
+      {
+        continue;
+      }
+      uint8_t outcome = br[i].flags & BP_F_TAKEN;
+      neural_row(s, br[i].pc, s->act[0] + rows * first->in_pad);
+      s->index[rows] = i;
+      s->outcome[rows++] = outcome;
+      neural_push(s, outcome);
+    }
+    const uint8_t *last = neural_forward(s, rows);
+    for (size_t r = 0; r < rows; r++)
+    {
+      uint8_t pred = neural_decide(s, last, r, s->outcome[r]);
+      mispredictions += pred != s->outcome[r];
+      if (predictions && pred)
+      {
+        predictions[s->index[r] >> 6] |= 1ULL << (s->index[r] & 63);
+      }
+    }
+  }
+  return mispredictions;
+}
+
+static void neural_free(void *state)
+{
+  neural_t *s = (neural_t *)state;
+  free(s->tuned);
+  free(s->act[0]);
+  free(s->act[1]);
+  free(s->acc);
+  free(s);
+}
+
+static uint64_t neural_describe(char *buf, size_t len)
+{
+  std::call_once(neural_once, neural_load);
+  const neural_model_t *m = neural_model;
+  if (!m)
+  {
+    snprintf(buf, len, "model=none");
+    return 0;
+  }
+  int used = snprintf(buf, len, "model=%s history=%u pcBits=%u layers=", m->path, m->history, m->pc_bits);
+  for (uint32_t l = 0; l < m->num_layers && used > 0 && (size_t)used < len; l++)
+  {
+    used += snprintf(buf + used, len - used, l ? "x%u" : "%u", m->layers[l].outputs);
+  }
+  if (used > 0 && (size_t)used < len)
+  {
+    snprintf(buf + used, len - used, " tune=%d", m->tune);
+  }
+  return m->bits + NEURAL_MAX_HISTORY;
+}
+
+static const bp_plugin_t neural_plugin = {
+  BP_PLUGIN_ABI, "neural",
+  neural_init, neural_predict, neural_train, neural_predict_and_train,
+  neural_predict_batch, neural_free, neural_describe,
+};
+
+const bp_plugin_t *bp_plugin_info(void)
+{
+  return &neural_plugin;
+}
@@ -0,0 +1,163 @@
+//========================================================//
+//  numa.cpp                                              //
+//  Source file for the NUMA placement of workers         //
+//========================================================//
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "numa.h"
+
+int numa_enabled = 0;
+
+static std::once_flag numa_once;
+static std::vector<std::vector<int> > numa_cpus; // of each node in use
+
+// Add the CPUs of the sysfs list 's', as "0-3,8,10-11", to 'cpus'
+static void numa_parse_list(const char *s, std::vector<int> *cpus)
+{
+  while (*s >= '0' && *s <= '9')
+  {
+    char *end;
+    long lo = strtol(s, &end, 10), hi = lo;
+    if (*end == '-')
+    {
+      hi = strtol(end + 1, &end, 10);
+    }
+    for (long c = lo; c <= hi && c < CPU_SETSIZE; c++)
+    {
+      cpus->push_back((int)c);
+    }
+    s = *end == ',' ? end + 1 : end;
+  }
+}
+
+// The nodes with CPUs in ascending order, or one of the CPUs this
+// process may run on
+static void numa_read()
+{
+  std::vector<int> ids;
+  DIR *dir = opendir("/sys/devices/system/node");
+  for (struct dirent *e; dir && (e = readdir(dir));)
+  {
+    if (!strncmp(e->d_name, "node", 4) && e->d_name[4] >= '0' && e->d_name[4] <= '9')
+    {
+      ids.push_back(atoi(e->d_name + 4));
+    }
+  }
+  if (dir)
+  {
+    closedir(dir);
+  }
+  std::sort(ids.begin(), ids.end());
+  for (size_t i = 0; i < ids.size() && numa_cpus.size() < NUMA_MAX_NODES; i++)
+  {
+    char path[64], list[4096];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", ids[i]);
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+      continue;
+    }
+    std::vector<int> cpus;
+    if (fgets(list, sizeof(list), f))
+    {
+      numa_parse_list(list, &cpus);
+    }
+    fclose(f);
+    if (!cpus.empty())
+    {
+      numa_cpus.push_back(cpus);
+    }
+  }
+  if (numa_cpus.empty())
+  {
+    cpu_set_t set;
+    std::vector<int> cpus;
+    if (!sched_getaffinity(0, sizeof(set), &set))
+    {
+      for (int c = 0; c < CPU_SETSIZE; c++)
+      {
+        if (CPU_ISSET(c, &set))
+        {
+          cpus.push_back(c);
+        }
+      }
+    }
+    if (cpus.empty())
+    {
+      cpus.push_back(0);
+    }
+    numa_cpus.push_back(cpus);
+  }
+}
+
+int numa_init()
+{
+  std::call_once(numa_once, numa_read);
+  return numa_cpus.size();
+}
+
+int numa_place(int w, int *cpu)
+{
+  int nodes = numa_init();
+  int node = w % nodes;
+  const std::vector<int> &cpus = numa_cpus[node];
+  *cpu = cpus[(w / nodes) % cpus.size()];
+  return node;
+}
+
+int numa_pin(int cpu, int node)
+{
+  numa_init();
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (cpu >= 0)
+  {
+    CPU_SET(cpu, &set);
+  }
+  else
+  {
+    for (size_t c = 0; c < numa_cpus[node].size(); c++)
+    {
+      CPU_SET(numa_cpus[node][c], &set);
+    }
+  }
+  return !pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+branch_record_t *numa_replicate(const branch_record_t *recs, size_t n, int node)
+{
+  branch_record_t *copy = NULL;
+  std::thread t([&]() {
+    numa_pin(-1, node);
+    copy = (branch_record_t *)malloc(n ? n * sizeof(branch_record_t) : 1);
+    if (copy)
+    {
+      memcpy(copy, recs, n * sizeof(branch_record_t));
+    }
+  });
+  t.join();
+  return copy;
+}
+
+void numa_report(FILE *out, const int *workers, const uint64_t *records, const uint64_t *elapsed_ns)
+{
+  int nodes = numa_init();
+  for (int d = 0; d < nodes; d++)
+  {
+    if (!workers[d])
+    {
+      continue;
+    }
+    double rate = elapsed_ns[d] ? records[d] * 1e3 / elapsed_ns[d] : 0.0;
+    fprintf(out, "Node %-2d          %10d workers, %.1f M records/s, %.1f per worker\n", d, workers[d], rate,
+            rate / workers[d]);
+  }
+}
@@ -0,0 +1,58 @@
+//========================================================//
+//  numa.h                                                //
+//  Header file for the NUMA placement of workers         //
+//                                                        //
+//  With --numa the sweep and multi-trace workers are     //
+//  pinned to cores, dealt round robin over the nodes,    //
+//  the sweep gets a copy of the decoded trace on every   //
+//  node, and each worker creates its predictors after it //
+//  is pinned so their pages are first touched, and       //
+//  allocated, on its own node. The topology is read from //
+//  sysfs, no libnuma needed                              //
+//========================================================//
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "trace.h"
+
+#define NUMA_MAX_NODES 64
+
+// Whether --numa was given
+extern int numa_enabled;
+
+// Read the online nodes and their CPUs from /sys/devices/system/node,
+// or one node of every CPU when there is none, once
+//
+// Returns the number of nodes
+//
+int numa_init();
+
+// Node worker 'w' runs on, with all its CPUs in turn, and the CPU in
+// 'cpu'
+//
+int numa_place(int w, int *cpu);
+
+// Pin the calling thread to 'cpu', or to every CPU of node 'node'
+// when 'cpu' is negative
+//
+// Returns True if Successful
+//
+int numa_pin(int cpu, int node);
+
+// A copy of 'n' records whose pages a thread pinned to 'node' touched
+// first, so the kernel placed them there, to be freed
+//
+// Returns NULL if malloc failed
+//
+branch_record_t *numa_replicate(const branch_record_t *recs, size_t n, int node);
+
+// Print a line per node of the workers it ran, the records they
+// replayed over all predictors, and their rate over 'elapsed_ns'
+//
+void numa_report(FILE *out, const int *workers, const uint64_t *records, const uint64_t *elapsed_ns);
+
+#endif
@@ -0,0 +1,192 @@
+//========================================================//
+//  oracle.cpp                                            //
+//  Source file for the oracle bound predictors           //
+//========================================================//
+
+#include <stdlib.h>
+#include <string.h>
+#include "oracle.h"
+#include "predictor.h"
+
+#define ORACLE_INIT_SLOTS (1 << 16)
+#define ORACLE_CTR_SHIFT 56  // counter bits of a slot, above the key
+#define ORACLE_KEY_MASK ((1ULL << ORACLE_CTR_SHIFT) - 1)
+
+// Allocate 'slots' free entries, a power of 2
+//
+// Returns True if Successful
+//
+static int oracle_table_alloc(oracle_table_t *t, size_t slots)
+{
+  t->slots = (uint64_t *)calloc(slots, sizeof(uint64_t));
+  t->mask = slots - 1;
+  t->count = 0;
+  return t->slots != NULL;
+}
+
+static inline size_t oracle_hash(uint64_t key)
+{
+  key *= 0x9e3779b97f4a7c15ULL;
+  return (size_t)(key ^ (key >> 32));
+}
+
+// Double the slots, keeping the load factor under one half
+//
+static void oracle_table_grow(oracle_table_t *t)
+{
+  oracle_table_t old = *t;
+  if (!oracle_table_alloc(t, (old.mask + 1) * 2))
+  {
+    fprintf(stderr, "Error: oracle malloc failed\n");
+    exit(1);
+  }
+  for (size_t s = 0; s <= old.mask; s++)
+  {
+    if (!old.slots[s])
+    {
+      continue;
+    }
+    size_t i = oracle_hash(old.slots[s] & ORACLE_KEY_MASK) & t->mask;
+    while (t->slots[i])
+    {
+      i = (i + 1) & t->mask;
+    }
+    t->slots[i] = old.slots[s];
+  }
+  t->count = old.count;
+  free(old.slots);
+}
+
+// The slot of branch 'id' after 'history', its counter weakly not
+// taken when new
+static inline uint64_t *oracle_slot(oracle_table_t *t, uint32_t id, uint32_t history)
+{
+  uint64_t key = ((uint64_t)id << 32 | history) + 1;
+  size_t i = oracle_hash(key) & t->mask;
+  while ((t->slots[i] & ORACLE_KEY_MASK) != key)
+  {
+    if (!t->slots[i])
+    {
+      if ((t->count + 1) * 2 > t->mask + 1)
+      {
+        oracle_table_grow(t);
+        return oracle_slot(t, id, history);
+      }
+      t->slots[i] = key | (uint64_t)WN << ORACLE_CTR_SHIFT;
+      t->count++;
+      break;
+    }
+    i = (i + 1) & t->mask;
+  }
+  return &t->slots[i];
+}
+
+// Predict from the counter of slot 's' and step it toward 'outcome'
+//
+// Returns True if it mispredicted
+//
+static inline int oracle_step(uint64_t *s, uint8_t outcome)
+{
+  uint64_t c = *s >> ORACLE_CTR_SHIFT;
+  uint64_t step = outcome ? (uint64_t)(c < ST) : -(uint64_t)(c > SN);
+  *s += step << ORACLE_CTR_SHIFT;
+  return (c >= WT) != outcome;
+}
+
+int oracle_init(oracle_t *o, int local_len, int global_len)
+{
+  memset(o, 0, sizeof(*o));
+  if (local_len < 1 || local_len > ORACLE_MAX_LEN || global_len < 1 || global_len > ORACLE_MAX_LEN)
+  {
+    return 0;
+  }
+  o->local_len = local_len;
+  o->global_len = global_len;
+  pc_map_init(&o->pcs);
+  return oracle_table_alloc(&o->local, ORACLE_INIT_SLOTS) && oracle_table_alloc(&o->global, ORACLE_INIT_SLOTS);
+}
+
+// Make room for the arrays by id as the map hands out more
+//
+static void oracle_reserve(oracle_t *o)
+{
+  size_t cap = o->cap ? o->cap * 2 : 4096;
+  o->execs = (uint64_t *)realloc(o->execs, cap * sizeof(uint64_t));
+  o->taken = (uint64_t *)realloc(o->taken, cap * sizeof(uint64_t));
+  o->lhist = (uint32_t *)realloc(o->lhist, cap * sizeof(uint32_t));
+  if (!o->execs || !o->taken || !o->lhist)
+  {
+    fprintf(stderr, "Error: oracle malloc failed\n");
+    exit(1);
+  }
+  memset(o->execs + o->cap, 0, (cap - o->cap) * sizeof(uint64_t));
+  memset(o->taken + o->cap, 0, (cap - o->cap) * sizeof(uint64_t));
+  memset(o->lhist + o->cap, 0, (cap - o->cap) * sizeof(uint32_t));
+  o->cap = cap;
+}
+
+void oracle_add(oracle_t *o, const branch_record_t *recs, size_t n, int counted)
+{
+  uint32_t local_mask = o->local_len < 32 ? (1u << o->local_len) - 1 : ~0u;
+  uint32_t global_mask = o->global_len < 32 ? (1u << o->global_len) - 1 : ~0u;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (!TRACE_FLAG(&recs[i], TRACE_F_CONDITION))
+    {
+      continue;
+    }
+    uint8_t outcome = TRACE_FLAG(&recs[i], TRACE_F_TAKEN) != 0;
+    uint32_t id = pc_map_id(&o->pcs, recs[i].pc);
+    if (id >= o->cap)
+    {
+      oracle_reserve(o);
+    }
+    int local_miss = oracle_step(oracle_slot(&o->local, id, o->lhist[id] & local_mask), outcome);
+    int global_miss = oracle_step(oracle_slot(&o->global, id, o->ghist & global_mask), outcome);
+    o->lhist[id] = o->lhist[id] << 1 | outcome;
+    o->ghist = o->ghist << 1 | outcome;
+    if (counted)
+    {
+      o->execs[id]++;
+      o->taken[id] += outcome;
+      o->branches++;
+      o->local_misses += local_miss;
+      o->global_misses += global_miss;
+    }
+  }
+}
+
+void oracle_print(const oracle_t *o, FILE *out)
+{
+  // the best static direction of a branch misses its rarer one
+  uint64_t static_misses = 0;
+  for (uint32_t id = 0; id < o->pcs.count; id++)
+  {
+    uint64_t not_taken = o->execs[id] - o->taken[id];
+    static_misses += o->taken[id] < not_taken ? o->taken[id] : not_taken;
+  }
+  fprintf(out, "Oracle bounds:   %u branch PCs; %zu local and %zu global counters\n", o->pcs.count,
+          o->local.count, o->global.count);
+  fprintf(out, "Bound                         Incorrect     Rate\n");
+  uint64_t misses[3] = {static_misses, o->local_misses, o->global_misses};
+  char names[3][32];
+  snprintf(names[0], sizeof(names[0]), "Static, per PC");
+  snprintf(names[1], sizeof(names[1]), "Local %d, per PC", o->local_len);
+  snprintf(names[2], sizeof(names[2]), "Gshare %d, per PC", o->global_len);
+  for (int b = 0; b < 3; b++)
+  {
+    fprintf(out, "%-26s %12llu %8.3f\n", names[b], (unsigned long long)misses[b],
+            o->branches ? 1000.0 * misses[b] / o->branches : 0.0);
+  }
+}
+
+void oracle_free(oracle_t *o)
+{
+  pc_map_free(&o->pcs);
+  free(o->execs);
+  free(o->taken);
+  free(o->lhist);
+  free(o->local.slots);
+  free(o->global.slots);
+  memset(o, 0, sizeof(*o));
+}
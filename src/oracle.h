@@ -0,0 +1,71 @@
+//========================================================//
+//  oracle.h                                              //
+//  Header file for the oracle bound predictors           //
+//                                                        //
+//  Bounds replayed next to the direction predictors in   //
+//  the same pass, telling how much accuracy a tuning     //
+//  direction has at stake: the best static direction of  //
+//  each branch, and a local history and a gshare whose   //
+//  every branch has its own unbounded table, so no two   //
+//  branches ever share a counter                         //
+//========================================================//
+
+#ifndef ORACLE_H
+#define ORACLE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "trace.h"
+#include "pcmap.h"
+
+// Default and longest local history of --oracle
+#define ORACLE_LOCAL_LEN 10
+#define ORACLE_MAX_LEN 32
+
+// 2-bit counters by (PC id, history), open addressed. Only the pairs
+// seen take an entry, so a table is as large as the trace needs. A
+// slot holds the key, (id << 32 | history) + 1, under the counter in
+// its top byte, so a probe reads one word; 0 is a free slot
+typedef struct
+{
+  uint64_t *slots;
+  size_t mask;      // slots - 1
+  size_t count;     // slots in use
+} oracle_table_t;
+
+typedef struct
+{
+  int local_len;          // outcomes of the branch's own history
+  int global_len;         // outcomes of the global history, those of gshare
+  pc_map_t pcs;           // dense ids of the conditional branches
+  size_t cap;             // entries of the arrays by id
+  uint64_t *execs;        // counted executions of each id
+  uint64_t *taken;        // and the taken ones among them
+  uint32_t *lhist;        // local history of each id, newest outcome in bit 0
+  uint32_t ghist;
+  oracle_table_t local;
+  oracle_table_t global;
+  uint64_t branches;      // counted
+  uint64_t local_misses;
+  uint64_t global_misses;
+} oracle_t;
+
+// Set up empty bounds of local histories of 'local_len' outcomes and a
+// global one of 'global_len', both 1 to ORACLE_MAX_LEN
+//
+// Returns True if Successful
+//
+int oracle_init(oracle_t *o, int local_len, int global_len);
+
+// Predict and train on the conditional ones of 'n' records, adding to
+// the counts only when 'counted' is True
+//
+void oracle_add(oracle_t *o, const branch_record_t *recs, size_t n, int counted);
+
+// Print the mispredictions of each bound to 'out'
+//
+void oracle_print(const oracle_t *o, FILE *out);
+
+void oracle_free(oracle_t *o);
+
+#endif
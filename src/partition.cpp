@@ -0,0 +1,166 @@
+//========================================================//
+//  partition.cpp                                         //
+//  Source file for index-partitioned replay              //
+//                                                        //
+//  The main thread reads a round of records and turns    //
+//  each conditional branch into its table entry, the     //
+//  one serial walk of the history, while one thread per  //
+//  range replays the previous round's entries in its     //
+//  range. A range is whole cache lines of the table, so  //
+//  the threads share the predictor but never a line.     //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "partition.h"
+#include "replay.h"
+
+typedef struct
+{
+  branch_record_t *recs;
+  uint32_t *entries[NUM_BP_TYPES]; // see predictor_index_batch
+  size_t warm[NUM_BP_TYPES];       // leading entries of the warmup
+  size_t n[NUM_BP_TYPES];
+} partition_round_t;
+
+typedef struct
+{
+  predictor_t *const *predictors;
+  int num_types;
+  const int *parts;                             // ranges of each table
+  const uint32_t (*bounds)[PARTITION_MAX + 1];  // see predictor_index_split
+} partition_plan_t;
+
+// Read the next round, up to 'left' records of which the first 'warm'
+// are trained on only, and index it for every predictor
+//
+// Returns the number of records read
+//
+static size_t partition_fill(trace_reader_t *tr, const partition_plan_t *plan, partition_round_t *r, uint64_t left,
+                             uint64_t warm)
+{
+  size_t got = 0, n;
+  size_t max = left < PARTITION_ROUND ? (size_t)left : PARTITION_ROUND;
+  while (got < max && (n = trace_read_batch(tr, r->recs + got, max - got)) > 0)
+  {
+    got += n;
+  }
+  size_t w = warm < got ? (size_t)warm : got;
+  for (int p = 0; p < plan->num_types; p++)
+  {
+    predictor_t *bp = plan->predictors[p];
+    r->warm[p] = predictor_index_batch(bp, replay_branches(r->recs), w, r->entries[p]);
+    r->n[p] = r->warm[p] + predictor_index_batch(bp, replay_branches(r->recs + w), got - w, r->entries[p] + r->warm[p]);
+  }
+  return got;
+}
+
+// Replay range 't' of every table over the round, adding the counted
+// mispredictions to miss[]
+//
+static void partition_replay(const partition_plan_t *plan, const partition_round_t *r, int t, uint64_t *miss)
+{
+  for (int p = 0; p < plan->num_types; p++)
+  {
+    if (t >= plan->parts[p])
+    {
+      continue;
+    }
+    uint32_t lo = plan->bounds[p][t], hi = plan->bounds[p][t + 1];
+    predictor_predict_indexed(plan->predictors[p], r->entries[p], r->warm[p], lo, hi);
+    miss[p] += predictor_predict_indexed(plan->predictors[p], r->entries[p] + r->warm[p], r->n[p] - r->warm[p], lo, hi);
+  }
+}
+
+int partition_run(trace_reader_t *tr, predictor_t *const *predictors, const partition_config_t *cfg)
+{
+  int parts[NUM_BP_TYPES];
+  uint32_t bounds[NUM_BP_TYPES][PARTITION_MAX + 1];
+  int threads = 1;
+  for (int p = 0; p < cfg->num_types; p++)
+  {
+    if (!(parts[p] = predictor_index_split(predictors[p], cfg->partitions, bounds[p])))
+    {
+      fprintf(stderr, "--partitions takes gshare predictors with no updateDelay or --unbounded, not %s\n", bpName[cfg->types[p]]);
+      return 0;
+    }
+    threads = parts[p] > threads ? parts[p] : threads;
+  }
+  partition_plan_t plan = {predictors, cfg->num_types, parts, bounds};
+
+  partition_round_t rounds[2];
+  memset(rounds, 0, sizeof(rounds));
+  int ok = 1;
+  for (int b = 0; b < 2 && ok; b++)
+  {
+    ok = (rounds[b].recs = (branch_record_t *)malloc(PARTITION_ROUND * sizeof(branch_record_t))) != NULL;
+    for (int p = 0; p < cfg->num_types && ok; p++)
+    {
+      ok = (rounds[b].entries[p] = (uint32_t *)malloc(PARTITION_ROUND * sizeof(uint32_t))) != NULL;
+    }
+  }
+  std::vector<uint64_t> miss((size_t)threads * NUM_BP_TYPES, 0);
+  uint64_t branches[NUM_BP_TYPES] = {0};
+
+  // Round k replays while round k + 1 is read
+  uint64_t left = cfg->count == ~0ULL || cfg->warmup + cfg->count < cfg->warmup ? ~0ULL : cfg->warmup + cfg->count;
+  uint64_t warm = cfg->warmup;
+  int cur = 0;
+  size_t got = ok ? partition_fill(tr, &plan, &rounds[cur], left, warm) : 0;
+  while (got)
+  {
+    left -= left == ~0ULL ? 0 : got;
+    warm -= warm < got ? warm : got;
+    const partition_round_t *r = &rounds[cur];
+    for (int p = 0; p < cfg->num_types; p++)
+    {
+      branches[p] += r->n[p] - r->warm[p];
+    }
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+    {
+      workers.push_back(std::thread(partition_replay, &plan, r, t, &miss[(size_t)t * NUM_BP_TYPES]));
+    }
+    cur ^= 1;
+    got = left ? partition_fill(tr, &plan, &rounds[cur], left, warm) : 0;
+    for (size_t t = 0; t < workers.size(); t++)
+    {
+      workers[t].join();
+    }
+  }
+
+  for (int b = 0; b < 2; b++)
+  {
+    free(rounds[b].recs);
+    for (int p = 0; p < cfg->num_types; p++)
+    {
+      free(rounds[b].entries[p]);
+    }
+  }
+  if (!ok)
+  {
+    fprintf(stderr, "Error: out of memory for --partitions\n");
+    return 0;
+  }
+
+  printf("Partitions:      %10d\n", threads);
+  for (int p = 0; p < cfg->num_types; p++)
+  {
+    replay_stats_t total = {branches[p], 0};
+    for (int t = 0; t < threads; t++)
+    {
+      total.mispredictions += miss[(size_t)t * NUM_BP_TYPES + p];
+    }
+    if (cfg->num_types > 1)
+    {
+      printf("%s:\n", bpName[cfg->types[p]]);
+    }
+    printf("Branches:        %10llu\n", (unsigned long long)total.branches);
+    printf("Incorrect:       %10llu\n", (unsigned long long)total.mispredictions);
+    printf("Misprediction Rate: %7.3f\n", total.branches ? replay_rate(&total) : 0.0);
+  }
+  return 1;
+}
@@ -0,0 +1,41 @@
+//========================================================//
+//  partition.h                                           //
+//  Header file for index-partitioned replay              //
+//                                                        //
+//  Splits the tables of predictors whose entries only    //
+//  the branches indexing them train, see                 //
+//  predictor_index_split, into ranges replayed at the    //
+//  same time, with the results of a serial replay        //
+//========================================================//
+
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <stdint.h>
+#include "predictor.h"
+#include "trace.h"
+
+// Records read and indexed while the previous ones replay
+#define PARTITION_ROUND (1 << 20)
+
+// Most ranges each table is split into
+#define PARTITION_MAX 64
+
+typedef struct
+{
+  const int *types;       // predictor types, for the names
+  int num_types;
+  uint64_t count;         // branches counted after the warmup
+  uint64_t warmup;        // branches trained on first
+  int partitions;         // ranges of each table, one thread each
+} partition_config_t;
+
+// Replay the trace 'tr' on 'predictors', one per cfg->types, each
+// table split into cfg->partitions ranges, and print the statistics
+//
+// Returns True if Successful, False when a predictor does not split
+// by index
+//
+int partition_run(trace_reader_t *tr, predictor_t *const *predictors, const partition_config_t *cfg);
+
+#endif
@@ -0,0 +1,92 @@
+//========================================================//
+//  pcmap.cpp                                             //
+//  Source file for the dense branch PC id map            //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcmap.h"
+
+#define PC_MAP_INIT_SLOTS (1 << 12)
+
+static void pc_map_alloc(pc_map_t *m, size_t slots)
+{
+  m->keys = (uint32_t *)malloc(slots * sizeof(uint32_t));
+  m->ids = (uint32_t *)malloc(slots * sizeof(uint32_t));
+  if (!m->keys || !m->ids)
+  {
+    fprintf(stderr, "Error: pc map malloc failed\n");
+    exit(1);
+  }
+  memset(m->ids, 0xff, slots * sizeof(uint32_t));
+  m->mask = slots - 1;
+}
+
+void pc_map_init(pc_map_t *m)
+{
+  memset(m, 0, sizeof(*m));
+  pc_map_alloc(m, PC_MAP_INIT_SLOTS);
+}
+
+void pc_map_free(pc_map_t *m)
+{
+  free(m->keys);
+  free(m->ids);
+  free(m->pcs);
+  memset(m, 0, sizeof(*m));
+}
+
+// Double the slots, keeping the load factor under one half
+//
+static void pc_map_grow(pc_map_t *m)
+{
+  uint32_t *keys = m->keys;
+  uint32_t *ids = m->ids;
+  size_t slots = m->mask + 1;
+  pc_map_alloc(m, slots * 2);
+  for (size_t s = 0; s < slots; s++)
+  {
+    if (ids[s] == PC_MAP_EMPTY)
+    {
+      continue;
+    }
+    size_t i = pc_map_hash(keys[s]) & m->mask;
+    while (m->ids[i] != PC_MAP_EMPTY)
+    {
+      i = (i + 1) & m->mask;
+    }
+    m->keys[i] = keys[s];
+    m->ids[i] = ids[s];
+  }
+  free(keys);
+  free(ids);
+}
+
+uint32_t pc_map_insert(pc_map_t *m, uint32_t pc, size_t slot)
+{
+  if ((size_t)(m->count + 1) * 2 > m->mask + 1)
+  {
+    pc_map_grow(m);
+    slot = pc_map_hash(pc) & m->mask;
+    while (m->ids[slot] != PC_MAP_EMPTY)
+    {
+      slot = (slot + 1) & m->mask;
+    }
+  }
+  if (m->count == m->pcs_cap)
+  {
+    m->pcs_cap = m->pcs_cap ? m->pcs_cap * 2 : 1024;
+    m->pcs = (uint32_t *)realloc(m->pcs, m->pcs_cap * sizeof(uint32_t));
+    if (!m->pcs)
+    {
+      fprintf(stderr, "Error: pc map malloc failed\n");
+      exit(1);
+    }
+  }
+  uint32_t id = m->count++;
+  m->keys[slot] = pc;
+  m->ids[slot] = id;
+  m->pcs[id] = pc;
+  return id;
+}
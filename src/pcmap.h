@@ -0,0 +1,58 @@
+//========================================================//
+//  pcmap.h                                               //
+//  Header file for the dense branch PC id map            //
+//                                                        //
+//  Hands out ids 0, 1, 2, ... to branch PCs in order of  //
+//  first appearance, so per-branch state can live in     //
+//  flat arrays instead of hash tables                    //
+//========================================================//
+
+#ifndef PCMAP_H
+#define PCMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PC_MAP_EMPTY 0xffffffffu
+
+typedef struct
+{
+  uint32_t *keys;  // open addressed PC slots
+  uint32_t *ids;   // id of each slot, PC_MAP_EMPTY if free
+  size_t mask;     // slots - 1
+  uint32_t count;  // ids handed out
+  uint32_t *pcs;   // PC of each id
+  size_t pcs_cap;
+} pc_map_t;
+
+void pc_map_init(pc_map_t *m);
+void pc_map_free(pc_map_t *m);
+
+// Add 'pc' at the free slot 'slot' found by pc_map_id
+//
+// Returns the new id
+//
+uint32_t pc_map_insert(pc_map_t *m, uint32_t pc, size_t slot);
+
+static inline size_t pc_map_hash(uint32_t pc)
+{
+  return (size_t)((pc * 0x9e3779b1u) ^ (pc >> 15));
+}
+
+// Returns the id of 'pc', assigning the next one if it is new
+//
+static inline uint32_t pc_map_id(pc_map_t *m, uint32_t pc)
+{
+  size_t i = pc_map_hash(pc) & m->mask;
+  while (m->ids[i] != PC_MAP_EMPTY)
+  {
+    if (m->keys[i] == pc)
+    {
+      return m->ids[i];
+    }
+    i = (i + 1) & m->mask;
+  }
+  return pc_map_insert(m, pc, i);
+}
+
+#endif
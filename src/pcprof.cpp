@@ -0,0 +1,329 @@
+//========================================================//
+//  pcprof.cpp                                            //
+//  Source file for the per-PC misprediction profile      //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "pcprof.h"
+
+void pc_counts_init(pc_counts_t *c)
+{
+  memset(c, 0, sizeof(*c));
+}
+
+void pc_counts_free(pc_counts_t *c)
+{
+  free(c->counts);
+  memset(c, 0, sizeof(*c));
+}
+
+// Make room for ids below 'num_pcs', doubling so new PCs cost
+// nothing on average
+//
+static void pc_counts_reserve(pc_counts_t *c, uint32_t num_pcs)
+{
+  if (num_pcs > c->num_pcs)
+  {
+    c->num_pcs = num_pcs;
+  }
+  if (num_pcs <= c->cap)
+  {
+    return;
+  }
+  size_t cap = c->cap ? c->cap : 4096;
+  while (cap < num_pcs)
+  {
+    cap *= 2;
+  }
+  c->counts = (uint64_t *)realloc(c->counts, cap * sizeof(uint64_t));
+  if (!c->counts)
+  {
+    fprintf(stderr, "Error: PC profile malloc failed\n");
+    exit(1);
+  }
+  memset(c->counts + c->cap, 0, (cap - c->cap) * sizeof(uint64_t));
+  c->cap = cap;
+}
+
+void pc_counts_add(pc_counts_t *c, const uint32_t *ids, size_t n, uint32_t num_pcs, const uint64_t *bits)
+{
+  pc_counts_reserve(c, num_pcs);
+  uint64_t *counts = c->counts;
+  for (size_t w = 0; w < (n + 63) / 64; w++)
+  {
+    // Only visit the set bits, mispredictions are rare
+    for (uint64_t b = bits[w]; b; b &= b - 1)
+    {
+      counts[ids[w * 64 + __builtin_ctzll(b)]]++;
+    }
+  }
+}
+
+void pc_profile_outcomes(const branch_record_t *recs, size_t n, uint64_t *cond, uint64_t *taken)
+{
+  // One word at a time in registers
+  for (size_t w = 0; w < (n + 63) / 64; w++)
+  {
+    const branch_record_t *r = recs + w * 64;
+    size_t m = n - w * 64 < 64 ? n - w * 64 : 64;
+    uint64_t c = 0, t = 0;
+    for (size_t i = 0; i < m; i++)
+    {
+      uint64_t bit = (uint64_t)TRACE_FLAG(&r[i], TRACE_F_CONDITION) << i;
+      c |= bit;
+      t |= TRACE_FLAG(&r[i], TRACE_F_TAKEN) ? bit : 0;
+    }
+    cond[w] = c;
+    taken[w] = t;
+  }
+}
+
+void pc_profile_print(const pc_counts_t *execs, const pc_counts_t *misses, const uint32_t *pcs, int top)
+{
+  // Keep the 'top' worst ids sorted by insertion, the list is short
+  uint32_t *worst = (uint32_t *)malloc((top > 0 ? top : 1) * sizeof(uint32_t));
+  int nworst = 0;
+  uint64_t total = 0;
+  for (uint32_t id = 0; id < misses->num_pcs; id++)
+  {
+    uint64_t m = misses->counts[id];
+    total += m;
+    if (m == 0 || top <= 0 || (nworst == top && m <= misses->counts[worst[top - 1]]))
+    {
+      continue;
+    }
+    int j = nworst < top ? nworst++ : top - 1;
+    while (j > 0 && misses->counts[worst[j - 1]] < m)
+    {
+      worst[j] = worst[j - 1];
+      j--;
+    }
+    worst[j] = id;
+  }
+
+  printf("%6s %10s %12s %10s %7s %8s\n", "Rank", "PC", "Executions", "Incorrect", "Share", "Rate");
+  for (int i = 0; i < nworst; i++)
+  {
+    uint32_t id = worst[i];
+    printf("%6d %#10x %12llu %10llu %6.2f%% %8.3f\n", i + 1, pcs[id], (unsigned long long)execs->counts[id],
+           (unsigned long long)misses->counts[id], 100.0 * misses->counts[id] / total,
+           1000.0 * misses->counts[id] / execs->counts[id]);
+  }
+  free(worst);
+}
+
+// profile.proto is written by hand, the handful of fields it takes
+// being varints and length-delimited bytes
+//
+static void pb_varint(std::string *out, uint64_t v)
+{
+  while (v >= 0x80)
+  {
+    out->push_back((char)(v | 0x80));
+    v >>= 7;
+  }
+  out->push_back((char)v);
+}
+
+static void pb_uint(std::string *out, int field, uint64_t v)
+{
+  pb_varint(out, (uint64_t)field << 3);
+  pb_varint(out, v);
+}
+
+static void pb_bytes(std::string *out, int field, const std::string &bytes)
+{
+  pb_varint(out, (uint64_t)field << 3 | 2);
+  pb_varint(out, bytes.size());
+  out->append(bytes);
+}
+
+// A function of the symbol table
+typedef struct
+{
+  uint64_t addr;
+  std::string name;
+  uint64_t id; // in the profile, 0 until a location uses it
+} pc_symbol_t;
+
+// Read the symbols of 'path', one "<hex address> [<type>] <name>" per
+// line as 'nm' prints them, keeping the code ones, sorted by address
+//
+static int pc_symbols_load(const char *path, std::vector<pc_symbol_t> *syms)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+  {
+    fprintf(stderr, "Error: can't open symbols %s\n", path);
+    return 0;
+  }
+  char line[4096];
+  while (fgets(line, sizeof(line), f))
+  {
+    char *end;
+    uint64_t addr = strtoull(line, &end, 16);
+    if (end == line || (*end != ' ' && *end != '\t'))
+    {
+      continue; // undefined symbols have no address
+    }
+    while (*end == ' ' || *end == '\t')
+    {
+      end++;
+    }
+    if (end[0] && (end[1] == ' ' || end[1] == '\t'))
+    {
+      if (!strchr("TtWwi", end[0]))
+      {
+        continue;
+      }
+      end += 2;
+      while (*end == ' ' || *end == '\t')
+      {
+        end++;
+      }
+    }
+    size_t len = strcspn(end, "\r\n");
+    if (len)
+    {
+      syms->push_back({addr, std::string(end, len), 0});
+    }
+  }
+  fclose(f);
+  std::stable_sort(syms->begin(), syms->end(),
+                   [](const pc_symbol_t &a, const pc_symbol_t &b) { return a.addr < b.addr; });
+  return 1;
+}
+
+int pc_profile_write_pprof(const char *path, const pc_counts_t *execs, const pc_counts_t *const *misses,
+                           const char *const *names, int n, const uint32_t *pcs, const char *symbols)
+{
+  std::vector<pc_symbol_t> syms;
+  if (symbols && !pc_symbols_load(symbols, &syms))
+  {
+    return 0;
+  }
+  std::vector<std::string> strings;
+  std::unordered_map<std::string, uint64_t> string_ids;
+  auto str = [&](const std::string &s) {
+    auto it = string_ids.find(s);
+    if (it != string_ids.end())
+    {
+      return it->second;
+    }
+    strings.push_back(s);
+    return string_ids[s] = strings.size() - 1;
+  };
+  str("");
+
+  // Profile fields: 1 sample_type, 2 sample, 3 mapping, 4 location,
+  // 5 function, 6 string_table, 9 time_nanos, 11 period_type,
+  // 12 period, 14 default_sample_type
+  std::string out, msg, sub;
+  const char *types[2] = {"mispredictions", "executions"};
+  for (int t = 0; t < 2; t++)
+  {
+    msg.clear();
+    pb_uint(&msg, 1, str(types[t]));
+    pb_uint(&msg, 2, str("count"));
+    pb_bytes(&out, 1, msg);
+  }
+
+  // One location per executed PC, its id one above the PC's
+  uint64_t predictor_key = str("predictor");
+  for (int i = 0; i < n; i++)
+  {
+    uint64_t name = str(names[i]);
+    for (uint32_t id = 0; id < execs->num_pcs; id++)
+    {
+      if (!execs->counts[id])
+      {
+        continue;
+      }
+      msg.clear();
+      pb_uint(&msg, 1, id + 1);
+      sub.clear();
+      pb_varint(&sub, id < misses[i]->num_pcs ? misses[i]->counts[id] : 0);
+      pb_varint(&sub, execs->counts[id]);
+      pb_bytes(&msg, 2, sub);
+      sub.clear();
+      pb_uint(&sub, 1, predictor_key);
+      pb_uint(&sub, 2, name);
+      pb_bytes(&msg, 3, sub);
+      pb_bytes(&out, 2, msg);
+    }
+  }
+
+  // A single mapping over the 32-bit PCs, with functions when symbolized
+  msg.clear();
+  pb_uint(&msg, 1, 1);
+  pb_uint(&msg, 3, 1ULL << 32);
+  pb_uint(&msg, 5, str(symbols ? symbols : ""));
+  pb_uint(&msg, 7, symbols != NULL);
+  pb_bytes(&out, 3, msg);
+
+  uint64_t functions = 0;
+  for (uint32_t id = 0; id < execs->num_pcs; id++)
+  {
+    if (!execs->counts[id])
+    {
+      continue;
+    }
+    msg.clear();
+    pb_uint(&msg, 1, id + 1);
+    pb_uint(&msg, 2, 1);
+    pb_uint(&msg, 3, pcs[id]);
+    // The last symbol at or below the PC
+    auto it = std::upper_bound(syms.begin(), syms.end(), (uint64_t)pcs[id],
+                               [](uint64_t pc, const pc_symbol_t &s) { return pc < s.addr; });
+    if (it != syms.begin())
+    {
+      pc_symbol_t *sym = &*(it - 1);
+      if (!sym->id)
+      {
+        sym->id = ++functions;
+      }
+      sub.clear();
+      pb_uint(&sub, 1, sym->id);
+      pb_bytes(&msg, 4, sub);
+    }
+    pb_bytes(&out, 4, msg);
+  }
+  for (const pc_symbol_t &sym : syms)
+  {
+    if (sym.id)
+    {
+      msg.clear();
+      pb_uint(&msg, 1, sym.id);
+      pb_uint(&msg, 2, str(sym.name));
+      pb_uint(&msg, 3, str(sym.name));
+      pb_bytes(&out, 5, msg);
+    }
+  }
+
+  msg.clear();
+  pb_uint(&msg, 1, str("executions"));
+  pb_uint(&msg, 2, str("count"));
+  pb_bytes(&out, 11, msg);
+  pb_uint(&out, 12, 1);
+  pb_uint(&out, 14, str("mispredictions"));
+  pb_uint(&out, 9, (uint64_t)time(NULL) * 1000000000ULL);
+  for (const std::string &s : strings)
+  {
+    pb_bytes(&out, 6, s);
+  }
+
+  FILE *f = fopen(path, "wb");
+  if (!f)
+  {
+    return 0;
+  }
+  int ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+  return fclose(f) == 0 && ok;
+}
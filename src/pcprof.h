@@ -0,0 +1,69 @@
+//========================================================//
+//  pcprof.h                                              //
+//  Header file for the per-PC misprediction profile      //
+//                                                        //
+//  Counts executions and mispredictions of each static   //
+//  branch in flat arrays indexed by dense PC id, from    //
+//  the prediction bitmaps of predictor_predict_batch     //
+//========================================================//
+
+#ifndef PCPROF_H
+#define PCPROF_H
+
+#include <stdint.h>
+#include "trace.h"
+
+// Hot branches listed by --profile-pcs without a count
+#define PC_PROFILE_TOP 10
+
+// One counter per PC id
+typedef struct
+{
+  uint64_t *counts;
+  uint32_t num_pcs; // ids counted so far
+  size_t cap;       // entries of counts
+} pc_counts_t;
+
+void pc_counts_init(pc_counts_t *c);
+void pc_counts_free(pc_counts_t *c);
+
+// Count record i of 'n' under ids[i] when bit i of 'bits' is set;
+// all ids are below 'num_pcs'
+//
+void pc_counts_add(pc_counts_t *c, const uint32_t *ids, size_t n, uint32_t num_pcs, const uint64_t *bits);
+
+// Bitmaps of the conditional records among 'n', and of the taken
+// ones among those, (n + 63) / 64 words each
+//
+void pc_profile_outcomes(const branch_record_t *recs, size_t n, uint64_t *cond, uint64_t *taken);
+
+// The mispredicted records given the outcomes and the bitmap filled
+// by predictor_predict_batch
+//
+static inline void pc_profile_misses(const uint64_t *cond, const uint64_t *taken, const uint64_t *predictions,
+                                     size_t n, uint64_t *misses)
+{
+  for (size_t w = 0; w < (n + 63) / 64; w++)
+  {
+    misses[w] = cond[w] & (predictions[w] ^ taken[w]);
+  }
+}
+
+// Print the 'top' branches with the most mispredictions, with 'pcs'
+// mapping ids back to PCs
+//
+void pc_profile_print(const pc_counts_t *execs, const pc_counts_t *misses, const uint32_t *pcs, int top);
+
+// Write the counts of 'n' profiles, one per predictor or sweep point
+// named by 'names', to 'path' as an uncompressed pprof profile.proto.
+// Samples hold mispredictions and executions, labelled "predictor"
+// with the name, at one location per branch PC. With 'symbols', a
+// symbol table as printed by 'nm', each location gets the function
+// whose symbol is nearest below its PC
+//
+// Returns True if Successful
+//
+int pc_profile_write_pprof(const char *path, const pc_counts_t *execs, const pc_counts_t *const *misses,
+                           const char *const *names, int n, const uint32_t *pcs, const char *symbols);
+
+#endif
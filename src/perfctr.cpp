@@ -0,0 +1,167 @@
+//========================================================//
+//  perfctr.cpp                                           //
+//  Source file for the host performance counters         //
+//========================================================//
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perfctr.h"
+
+#define PERFCTR_CACHE(cache, result) \
+  ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | ((result) << 16))
+
+// Type and config of each event, in PERFCTR_* order
+static const struct
+{
+  uint32_t type;
+  uint64_t config;
+} perfctr_events[PERFCTR_EVENTS] = {
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {PERF_TYPE_HW_CACHE, PERFCTR_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  {PERF_TYPE_HW_CACHE, PERFCTR_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_RESULT_MISS)},
+  {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+  {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+int perfctr_open(perfctr_group_t *g)
+{
+  memset(g, 0, sizeof(*g));
+  g->leader = -1;
+  int first_errno = 0;
+  for (int e = 0; e < PERFCTR_EVENTS; e++)
+  {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = perfctr_events[e].type;
+    attr.config = perfctr_events[e].config;
+    attr.disabled = g->leader < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    g->fd[e] = syscall(SYS_perf_event_open, &attr, 0, -1, g->leader, 0);
+    if (g->fd[e] < 0)
+    {
+      first_errno = first_errno ? first_errno : errno;
+      continue;
+    }
+    if (g->leader < 0)
+    {
+      g->leader = g->fd[e];
+    }
+    g->slot[e] = g->opened++;
+  }
+  if (!g->opened)
+  {
+    errno = first_errno;
+  }
+  return g->opened;
+}
+
+void perfctr_start(perfctr_group_t *g)
+{
+  if (g->leader >= 0)
+  {
+    ioctl(g->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+}
+
+void perfctr_stop(perfctr_group_t *g)
+{
+  if (g->leader >= 0)
+  {
+    ioctl(g->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  }
+}
+
+int perfctr_read(perfctr_group_t *g)
+{
+  // nr, time enabled, time running, then a value per event
+  uint64_t buf[3 + PERFCTR_EVENTS];
+  memset(g->counts, 0, sizeof(g->counts));
+  if (g->leader < 0)
+  {
+    return 0;
+  }
+  ssize_t len = read(g->leader, buf, sizeof(buf));
+  if (len < (ssize_t)(3 * sizeof(uint64_t)) || buf[0] != (uint64_t)g->opened)
+  {
+    return 0;
+  }
+  // A group sharing the counters with others counted only part of
+  // the time it was enabled
+  g->missing = !buf[2] && buf[1];
+  double scale = buf[2] ? (double)buf[1] / buf[2] : 0.0;
+  for (int e = 0; e < PERFCTR_EVENTS; e++)
+  {
+    if (g->fd[e] >= 0)
+    {
+      g->counts[e] = (uint64_t)(buf[3 + g->slot[e]] * scale);
+    }
+  }
+  return 1;
+}
+
+void perfctr_print_header(FILE *out)
+{
+  fprintf(out, "Perf counters     cycles/br  instr/br    IPC  L1D/kbr  LLC/kbr dTLB/kbr  mispr/kbr faults/kbr\n");
+}
+
+// One column: 'count' per record, or per 1000 records for the misses
+static void perfctr_column(FILE *out, const perfctr_group_t *g, int e, uint64_t records, int width)
+{
+  if (g->fd[e] < 0 || g->missing || !records)
+  {
+    fprintf(out, " %*s", width, "-");
+    return;
+  }
+  double per = e <= PERFCTR_INSTRUCTIONS ? (double)records : records / 1000.0;
+  fprintf(out, " %*.3f", width, g->counts[e] / per);
+}
+
+void perfctr_print(FILE *out, const char *name, const perfctr_group_t *g, uint64_t records)
+{
+  fprintf(out, "  %-16s", name);
+  perfctr_column(out, g, PERFCTR_CYCLES, records, 9);
+  perfctr_column(out, g, PERFCTR_INSTRUCTIONS, records, 9);
+  if (g->fd[PERFCTR_CYCLES] < 0 || g->fd[PERFCTR_INSTRUCTIONS] < 0 || g->missing ||
+      !g->counts[PERFCTR_CYCLES])
+  {
+    fprintf(out, " %6s", "-");
+  }
+  else
+  {
+    fprintf(out, " %6.2f", (double)g->counts[PERFCTR_INSTRUCTIONS] / g->counts[PERFCTR_CYCLES]);
+  }
+  perfctr_column(out, g, PERFCTR_L1D_MISSES, records, 8);
+  perfctr_column(out, g, PERFCTR_LLC_MISSES, records, 8);
+  perfctr_column(out, g, PERFCTR_DTLB_MISSES, records, 8);
+  perfctr_column(out, g, PERFCTR_BRANCH_MISSES, records, 10);
+  perfctr_column(out, g, PERFCTR_PAGE_FAULTS, records, 10);
+  fputc('\n', out);
+}
+
+void perfctr_close(perfctr_group_t *g)
+{
+  // members first, the leader last
+  for (int e = PERFCTR_EVENTS - 1; e >= 0; e--)
+  {
+    if (g->fd[e] >= 0)
+    {
+      close(g->fd[e]);
+    }
+  }
+  for (int e = 0; e < PERFCTR_EVENTS; e++)
+  {
+    g->fd[e] = -1;
+  }
+  g->leader = -1;
+  g->opened = 0;
+}
@@ -0,0 +1,67 @@
+//========================================================//
+//  perfctr.h                                             //
+//  Header file for the host performance counters         //
+//                                                        //
+//  A perf_event_open group counting cycles, cache, TLB   //
+//  and branch misses of the simulator's own thread       //
+//  while it is started, so that a slow predictor can be  //
+//  told apart by where its time goes                     //
+//========================================================//
+
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// The events of a group; one the machine or the kernel does not offer
+// is left out and printed as "-"
+#define PERFCTR_CYCLES 0
+#define PERFCTR_INSTRUCTIONS 1
+#define PERFCTR_L1D_MISSES 2     // L1 data cache read misses
+#define PERFCTR_LLC_MISSES 3     // last level cache misses
+#define PERFCTR_DTLB_MISSES 4    // data TLB read misses
+#define PERFCTR_BRANCH_MISSES 5  // the host's own mispredicted branches
+#define PERFCTR_PAGE_FAULTS 6    // a software event, first touch of the tables
+#define PERFCTR_EVENTS 7
+
+typedef struct
+{
+  int leader;                    // fd the group is enabled through, -1 if none opened
+  int fd[PERFCTR_EVENTS];        // -1 for an event left out
+  int slot[PERFCTR_EVENTS];      // position of the event in a group read
+  int opened;
+  uint64_t counts[PERFCTR_EVENTS]; // by perfctr_read, scaled when multiplexed
+  int missing;                   // the kernel never scheduled the group
+} perfctr_group_t;
+
+// Open the events of this thread, none counting yet, user space only
+//
+// Returns the number of events opened, 0 with errno of the first
+// failure when there is none
+//
+int perfctr_open(perfctr_group_t *g);
+
+// Count from now, adding to what the group counted before
+//
+void perfctr_start(perfctr_group_t *g);
+
+// Stop counting until the next perfctr_start
+//
+void perfctr_stop(perfctr_group_t *g);
+
+// Read the totals into g->counts
+//
+// Returns True if Successful
+//
+int perfctr_read(perfctr_group_t *g);
+
+// Print the column names, then one line of counts per 'records' for
+// the group (read by perfctr_read) under 'name'
+//
+void perfctr_print_header(FILE *out);
+void perfctr_print(FILE *out, const char *name, const perfctr_group_t *g, uint64_t records);
+
+void perfctr_close(perfctr_group_t *g);
+
+#endif
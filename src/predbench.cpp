@@ -0,0 +1,806 @@
+//========================================================//
+//  predbench.cpp                                         //
+//  Microbenchmarks of the predictor entry points         //
+//                                                        //
+//  make bench                                            //
+//  make bench BASELINE=old.json THRESHOLD=10             //
+//  ./predbench --compare old.json new.json               //
+//  make bench-cliff                                      //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glob.h>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "predictor.h"
+#include "trace.h"
+#include "perfctr.h"
+
+// Records in each input stream, a slice that fits the outer caches
+// with the tables so that the numbers are of the predictor, not of
+// reading the input
+#define BENCH_RECORDS (1 << 16)
+
+// Every 8th record of a synthetic stream is an unconditional jump
+#define BENCH_JUMP_EVERY 8
+
+typedef struct
+{
+  std::string name;
+  std::vector<predictor_branch_t> recs;
+} bench_stream_t;
+
+static std::vector<bench_stream_t> bench_streams;
+
+// xorshift64, for streams that are the same on every run
+static uint64_t bench_rng = 0x2545f4914f6cdd1dULL;
+
+static uint64_t bench_random()
+{
+  bench_rng ^= bench_rng << 13;
+  bench_rng ^= bench_rng >> 7;
+  bench_rng ^= bench_rng << 17;
+  return bench_rng;
+}
+
+static predictor_branch_t bench_branch(uint32_t pc, int taken)
+{
+  predictor_branch_t b;
+  b.pc = pc;
+  b.target = pc + 0x40;
+  b.flags = BP_F_CONDITION | BP_F_DIRECT | (taken ? BP_F_TAKEN : 0);
+  return b;
+}
+
+static void bench_push(bench_stream_t *s, predictor_branch_t b)
+{
+  if (s->recs.size() % BENCH_JUMP_EVERY == BENCH_JUMP_EVERY - 1)
+  {
+    predictor_branch_t j = {b.pc - 0x10, b.pc + 0x100, BP_F_TAKEN | BP_F_DIRECT};
+    s->recs.push_back(j);
+  }
+  s->recs.push_back(b);
+}
+
+// The synthetic streams: random outcomes of 1024 branches, 64 loops
+// of 2 to 17 trips with an alternating branch in the body, and 4096
+// branches going their own way 15 times in 16
+static void bench_synthetic()
+{
+  bench_stream_t s;
+  s.name = "random";
+  while (s.recs.size() < BENCH_RECORDS)
+  {
+    uint64_t r = bench_random();
+    bench_push(&s, bench_branch(0x400000 + (r & 1023) * 4, (r >> 32) & 1));
+  }
+  bench_streams.push_back(s);
+
+  s.name = "loopy";
+  s.recs.clear();
+  while (s.recs.size() < BENCH_RECORDS)
+  {
+    uint32_t loop = 0x500000 + (bench_random() & 63) * 0x40;
+    int trips = 2 + loop / 0x40 % 16;
+    for (int t = 0; t < trips; t++)
+    {
+      bench_push(&s, bench_branch(loop + 0x10, t & 1));
+      bench_push(&s, bench_branch(loop + 0x20, t + 1 < trips));
+    }
+  }
+  bench_streams.push_back(s);
+
+  s.name = "biased";
+  s.recs.clear();
+  while (s.recs.size() < BENCH_RECORDS)
+  {
+    uint64_t r = bench_random();
+    uint32_t id = r & 4095;
+    // 1 in 16 against the bias, which is taken for odd ids
+    int against = ((r >> 32) & 15) == 0;
+    bench_push(&s, bench_branch(0x600000 + id * 4, (id & 1) ^ against));
+  }
+  bench_streams.push_back(s);
+}
+
+// The first BENCH_RECORDS records of every trace matching 'pattern'
+static void bench_traces(const char *pattern)
+{
+  glob_t g;
+  if (glob(pattern, 0, NULL, &g))
+  {
+    return;
+  }
+  for (size_t i = 0; i < g.gl_pathc; i++)
+  {
+    size_t n = strlen(g.gl_pathv[i]);
+    if (n > 4 && !strcmp(g.gl_pathv[i] + n - 4, ".idx"))
+    {
+      continue;
+    }
+    trace_reader_t *tr = trace_open(g.gl_pathv[i]);
+    if (!tr)
+    {
+      continue;
+    }
+    bench_stream_t s;
+    const char *base = strrchr(g.gl_pathv[i], '/');
+    s.name = base ? base + 1 : g.gl_pathv[i];
+    s.name = s.name.substr(0, s.name.find('.'));
+    s.recs.resize(BENCH_RECORDS);
+    size_t got = 0, m;
+    while (got < BENCH_RECORDS &&
+           (m = trace_read_batch(tr, (branch_record_t *)&s.recs[got],
+                                 BENCH_RECORDS - got < TRACE_BATCH ? BENCH_RECORDS - got : TRACE_BATCH)) > 0)
+    {
+      got += m;
+    }
+    trace_close(tr);
+    s.recs.resize(got);
+    if (got)
+    {
+      bench_streams.push_back(s);
+    }
+  }
+  globfree(&g);
+}
+
+//------------------------------------//
+//            Benchmarks              //
+//------------------------------------//
+
+// The entry point a benchmark times
+#define BENCH_PREDICT 0   // predictor_predict of each conditional branch
+#define BENCH_TRAIN 1     // predictor_train of every record
+#define BENCH_FUSED 2     // predictor_predict_and_train of every record
+#define BENCH_BATCH 3     // predictor_predict_batch of the stream
+#define BENCH_PATHS 4
+
+static const char *bench_path_names[BENCH_PATHS] = {"predict", "train", "fused", "batch"};
+
+static uint64_t bench_pass(predictor_t *p, int path, const predictor_branch_t *br, size_t n)
+{
+  uint64_t sum = 0;
+  switch (path)
+  {
+  case BENCH_PREDICT:
+    for (size_t i = 0; i < n; i++)
+    {
+      if (br[i].flags & BP_F_CONDITION)
+      {
+        sum += predictor_predict(p, br[i].pc, br[i].target, br[i].flags & BP_F_DIRECT);
+      }
+    }
+    break;
+  case BENCH_TRAIN:
+    for (size_t i = 0; i < n; i++)
+    {
+      uint8_t f = br[i].flags;
+      predictor_train(p, br[i].pc, br[i].target, f & BP_F_TAKEN, !!(f & BP_F_CONDITION), !!(f & BP_F_CALL),
+                      !!(f & BP_F_RET), !!(f & BP_F_DIRECT));
+    }
+    break;
+  case BENCH_FUSED:
+    for (size_t i = 0; i < n; i++)
+    {
+      uint8_t f = br[i].flags;
+      sum += predictor_predict_and_train(p, br[i].pc, br[i].target, f & BP_F_TAKEN, !!(f & BP_F_CONDITION),
+                                         !!(f & BP_F_CALL), !!(f & BP_F_RET), !!(f & BP_F_DIRECT));
+    }
+    break;
+  case BENCH_BATCH:
+    sum += predictor_predict_batch(p, br, n, NULL);
+    break;
+  }
+  return sum;
+}
+
+// One pass over the stream per iteration, after one to warm the
+// tables up, reporting ns_per_branch (per record) and, when the
+// counters are available, the cache, TLB and host branch misses per
+// branch
+static void bench_run(benchmark::State &state, int type, int path, const bench_stream_t *s)
+{
+  predictor_config_t cfg = predictor_default_config(type);
+  predictor_t *p = predictor_create(&cfg);
+  if (!p)
+  {
+    state.SkipWithError("predictor_create failed");
+    return;
+  }
+  const predictor_branch_t *br = s->recs.data();
+  size_t n = s->recs.size();
+  bench_pass(p, BENCH_FUSED, br, n);
+
+  perfctr_group_t perf;
+  perfctr_open(&perf);
+  perfctr_start(&perf);
+  uint64_t ns = 0, passes = 0;
+  for (auto _ : state)
+  {
+    uint64_t start = trace_clock_ns();
+    benchmark::DoNotOptimize(bench_pass(p, path, br, n));
+    ns += trace_clock_ns() - start;
+    passes++;
+  }
+  perfctr_stop(&perf);
+  if (perfctr_read(&perf) && !perf.missing)
+  {
+    static const struct
+    {
+      int event;
+      const char *name;
+    } counters[] = {{PERFCTR_LLC_MISSES, "misses_per_branch"},
+                    {PERFCTR_L1D_MISSES, "l1d_misses_per_branch"},
+                    {PERFCTR_DTLB_MISSES, "dtlb_misses_per_branch"},
+                    {PERFCTR_BRANCH_MISSES, "host_mispredicts_per_branch"}};
+    for (size_t c = 0; c < sizeof(counters) / sizeof(counters[0]); c++)
+    {
+      if (perf.fd[counters[c].event] >= 0)
+      {
+        state.counters[counters[c].name] = (double)perf.counts[counters[c].event] / ((double)passes * n);
+      }
+    }
+  }
+  perfctr_close(&perf);
+  state.counters["ns_per_branch"] = (double)ns / ((double)passes * n);
+  state.SetItemsProcessed(passes * n);
+  predictor_destroy(p);
+}
+
+//------------------------------------//
+//         Cache cliff sweep          //
+//------------------------------------//
+
+// --cliff times each predictor, and each table layout on its own, at
+// every table size in powers of 2 up to a working set of --cliff=<MB>,
+// on one random stream long enough to touch every line of the largest
+// table, and prints ns/branch against the bytes of the tables as CSV.
+// A step at least CLIFF_JUMP times slower than the one before is a
+// cliff, reported with the host caches the tables outgrew
+#define CLIFF_RECORDS (1 << 21)
+#define CLIFF_MAX_MB 256
+#define CLIFF_MIN_NS 200000000ULL // timed per point, after a warm pass
+#define CLIFF_JUMP 1.25
+#define CLIFF_MAX_CACHES 8
+
+typedef struct
+{
+  std::string series; // predictor/path or layout/<name>
+  const char *key;    // the size parameter swept
+  int bits;
+  size_t bytes;       // of the tables
+  double ns;          // per record
+} cliff_point_t;
+
+typedef struct
+{
+  int level;
+  size_t bytes;
+} cliff_cache_t;
+
+// The data and unified caches of cpu0, smallest first
+static size_t cliff_caches(cliff_cache_t *caches)
+{
+  size_t n = 0;
+  for (int i = 0; n < CLIFF_MAX_CACHES; i++)
+  {
+    char path[128], type[32] = "";
+    int level = 0;
+    unsigned long kb = 0;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+      break;
+    }
+    int ok = fscanf(f, "%31s", type) == 1;
+    fclose(f);
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+    if ((f = fopen(path, "r")))
+    {
+      ok &= fscanf(f, "%d", &level) == 1;
+      fclose(f);
+    }
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+    if ((f = fopen(path, "r")))
+    {
+      ok &= fscanf(f, "%luK", &kb) == 1;
+      fclose(f);
+    }
+    if (ok && strcmp(type, "Instruction"))
+    {
+      caches[n].level = level;
+      caches[n].bytes = (size_t)kb << 10;
+      n++;
+    }
+  }
+  return n;
+}
+
+// Random outcomes of branches at 2^20 PCs, so the histories, and the
+// indexes hashed from them, are spread over any table
+static void cliff_stream(std::vector<predictor_branch_t> *recs)
+{
+  recs->resize(CLIFF_RECORDS);
+  for (size_t i = 0; i < CLIFF_RECORDS; i++)
+  {
+    uint64_t r = bench_random();
+    (*recs)[i] = bench_branch(0x400000 + (r & 0xFFFFF) * 4, (r >> 32) & 1);
+  }
+}
+
+// Passes over 'recs' until CLIFF_MIN_NS have gone by, after one
+//
+// Returns ns per record
+//
+template <class F>
+static double cliff_time(F pass, size_t n)
+{
+  benchmark::DoNotOptimize(pass());
+  uint64_t ns = 0, passes = 0;
+  while (ns < CLIFF_MIN_NS || passes < 2)
+  {
+    uint64_t start = trace_clock_ns();
+    benchmark::DoNotOptimize(pass());
+    ns += trace_clock_ns() - start;
+    passes++;
+  }
+  return (double)ns / ((double)passes * n);
+}
+
+// The layouts of a table of 2-bit counters indexed by the PC XOR the
+// history, as gshare's: a byte per counter, or 32 to a 64-bit word
+static uint64_t cliff_bytes_pass(uint8_t *t, uint64_t mask, const predictor_branch_t *br, size_t n)
+{
+  uint64_t hist = 0, correct = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    uint8_t taken = br[i].flags & BP_F_TAKEN;
+    uint8_t *c = &t[(br[i].pc ^ hist) & mask];
+    correct += (*c >= WT) == taken;
+    if (taken ? *c != ST : *c != SN)
+    {
+      *c += taken ? 1 : -1;
+    }
+    hist = hist << 1 | taken;
+  }
+  return correct;
+}
+
+static uint64_t cliff_packed_pass(uint64_t *t, uint64_t mask, const predictor_branch_t *br, size_t n)
+{
+  uint64_t hist = 0, correct = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    uint8_t taken = br[i].flags & BP_F_TAKEN;
+    uint64_t index = (br[i].pc ^ hist) & mask;
+    uint64_t *w = &t[index / 32];
+    int shift = index % 32 * 2;
+    uint8_t c = (*w >> shift) & 3;
+    correct += (c >= WT) == taken;
+    if (taken ? c != ST : c != SN)
+    {
+      *w ^= (uint64_t)(c ^ (uint8_t)(c + (taken ? 1 : -1))) << shift;
+    }
+    hist = hist << 1 | taken;
+  }
+  return correct;
+}
+
+// The layouts of a tagged table, as one of TAGE's: a 4-byte entry of
+// tag, counter and usefulness (AoS), or the three in arrays of their
+// own (SoA), where a miss reads only the tag
+typedef struct
+{
+  uint16_t tag;
+  int8_t ctr;
+  uint8_t u;
+} cliff_entry_t;
+
+typedef struct
+{
+  uint16_t *tag;
+  int8_t *ctr;
+  uint8_t *u;
+} cliff_soa_t;
+
+// The step of a tagged entry: predict on a hit, else replace it when
+// it is not useful
+template <class T>
+static inline uint64_t cliff_tagged_step(T &tag, int8_t &ctr, uint8_t &u, uint16_t want, uint8_t taken)
+{
+  if (tag != want)
+  {
+    if (u)
+    {
+      u--;
+    }
+    else
+    {
+      tag = want;
+      ctr = taken ? 0 : -1;
+    }
+    return 0;
+  }
+  uint64_t correct = (ctr >= 0) == taken;
+  u += correct && u < 3;
+  ctr += taken ? ctr < 3 : -(ctr > -4);
+  return correct;
+}
+
+static inline uint64_t cliff_tagged_index(uint32_t pc, uint64_t hist, uint64_t mask, uint16_t *tag)
+{
+  uint64_t h = (pc ^ hist) * 0x9E3779B97F4A7C15ULL;
+  *tag = (uint16_t)(h >> 20);
+  return (h >> 40 ^ h) & mask;
+}
+
+static uint64_t cliff_aos_pass(cliff_entry_t *t, uint64_t mask, const predictor_branch_t *br, size_t n)
+{
+  uint64_t hist = 0, correct = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    uint8_t taken = br[i].flags & BP_F_TAKEN;
+    uint16_t tag;
+    cliff_entry_t *e = &t[cliff_tagged_index(br[i].pc, hist, mask, &tag)];
+    correct += cliff_tagged_step(e->tag, e->ctr, e->u, tag, taken);
+    hist = hist << 1 | taken;
+  }
+  return correct;
+}
+
+static uint64_t cliff_soa_pass(const cliff_soa_t *t, uint64_t mask, const predictor_branch_t *br, size_t n)
+{
+  uint64_t hist = 0, correct = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    uint8_t taken = br[i].flags & BP_F_TAKEN;
+    uint16_t tag;
+    uint64_t e = cliff_tagged_index(br[i].pc, hist, mask, &tag);
+    correct += cliff_tagged_step(t->tag[e], t->ctr[e], t->u[e], tag, taken);
+    hist = hist << 1 | taken;
+  }
+  return correct;
+}
+
+// Time every layout at 2^bits entries, each table within 'max' bytes
+static void cliff_layouts(const std::vector<predictor_branch_t> &recs, size_t max, std::vector<cliff_point_t> *out)
+{
+  const predictor_branch_t *br = recs.data();
+  size_t n = recs.size();
+  for (int bits = 10; (size_t)1 << bits <= max; bits++)
+  {
+    uint64_t entries = (uint64_t)1 << bits, mask = entries - 1;
+    uint8_t *bytes = (uint8_t *)malloc(entries);
+    memset(bytes, WN, entries);
+    cliff_point_t pt = {"layout/counters-bytes", "entries", bits, (size_t)entries, 0};
+    pt.ns = cliff_time([&] { return cliff_bytes_pass(bytes, mask, br, n); }, n);
+    out->push_back(pt);
+    free(bytes);
+
+    if (entries >= 32)
+    {
+      uint64_t *packed = (uint64_t *)malloc(entries / 4);
+      memset(packed, 0x55, entries / 4); // WN
+      pt.series = "layout/counters-packed";
+      pt.bytes = entries / 4;
+      pt.ns = cliff_time([&] { return cliff_packed_pass(packed, mask, br, n); }, n);
+      out->push_back(pt);
+      free(packed);
+    }
+
+    if (entries * sizeof(cliff_entry_t) <= max)
+    {
+      cliff_entry_t *aos = (cliff_entry_t *)calloc(entries, sizeof(cliff_entry_t));
+      pt.series = "layout/tagged-aos";
+      pt.bytes = entries * sizeof(cliff_entry_t);
+      pt.ns = cliff_time([&] { return cliff_aos_pass(aos, mask, br, n); }, n);
+      out->push_back(pt);
+      free(aos);
+
+      cliff_soa_t soa = {(uint16_t *)calloc(entries, 2), (int8_t *)calloc(entries, 1), (uint8_t *)calloc(entries, 1)};
+      pt.series = "layout/tagged-soa";
+      pt.ns = cliff_time([&] { return cliff_soa_pass(&soa, mask, br, n); }, n);
+      out->push_back(pt);
+      free(soa.tag);
+      free(soa.ctr);
+      free(soa.u);
+    }
+  }
+}
+
+// Time predictor 'type' through the fused and batch entry points at
+// every value of its size parameter 'key' that fits 'max' bytes
+static void cliff_predictor(int type, const char *key, const std::vector<predictor_branch_t> &recs, size_t max,
+                            std::vector<cliff_point_t> *out)
+{
+  const predictor_branch_t *br = recs.data();
+  size_t n = recs.size();
+  for (int bits = 1; bits <= 30; bits++)
+  {
+    predictor_config_t cfg = predictor_default_config(type);
+    size_t bytes;
+    if (!predictor_config_set(&cfg, key, bits) || !(bytes = predictor_config_memory(&cfg)))
+    {
+      continue;
+    }
+    if (bytes > max)
+    {
+      break;
+    }
+    for (int path = BENCH_FUSED; path <= BENCH_BATCH; path++)
+    {
+      predictor_t *p = predictor_create(&cfg);
+      if (!p)
+      {
+        continue;
+      }
+      cliff_point_t pt = {std::string(bpName[type]) + "/" + bench_path_names[path], key, bits, bytes, 0};
+      pt.ns = cliff_time([&] { return bench_pass(p, path, br, n); }, n);
+      out->push_back(pt);
+      predictor_destroy(p);
+    }
+  }
+}
+
+// The caches a working set of 'bytes' has outgrown, as "L1 L2", or
+// "-" for none
+static std::string cliff_outgrown(const cliff_cache_t *caches, size_t ncaches, size_t bytes)
+{
+  std::string s;
+  for (size_t c = 0; c < ncaches; c++)
+  {
+    if (caches[c].bytes < bytes)
+    {
+      s += (s.empty() ? "L" : " L") + std::to_string(caches[c].level);
+    }
+  }
+  return s.empty() ? "-" : s;
+}
+
+// Run the sweep up to 'max_mb' and print it
+static int cliff_run(int max_mb)
+{
+  cliff_cache_t caches[CLIFF_MAX_CACHES];
+  size_t ncaches = cliff_caches(caches);
+  std::vector<predictor_branch_t> recs;
+  cliff_stream(&recs);
+  size_t max = (size_t)max_mb << 20;
+  std::vector<cliff_point_t> points;
+  cliff_layouts(recs, max, &points);
+  cliff_predictor(GSHARE, "ghistoryBits", recs, max, &points);
+  cliff_predictor(CUSTOM, "tageTaggedBits", recs, max, &points);
+  cliff_predictor(PERCEPTRON, "perceptronBits", recs, max, &points);
+
+  for (size_t c = 0; c < ncaches; c++)
+  {
+    printf("# L%d %zu bytes\n", caches[c].level, caches[c].bytes);
+  }
+  printf("series,key,bits,bytes,ns_per_branch,outgrown\n");
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    const cliff_point_t &pt = points[i];
+    printf("%s,%s,%d,%zu,%.3f,%s\n", pt.series.c_str(), pt.key, pt.bits, pt.bytes, pt.ns,
+           cliff_outgrown(caches, ncaches, pt.bytes).c_str());
+  }
+  // each point against the one before it in its series
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    const cliff_point_t &b = points[i];
+    for (size_t j = i; j-- > 0;)
+    {
+      const cliff_point_t &a = points[j];
+      if (a.series != b.series)
+      {
+        continue;
+      }
+      if (b.ns >= a.ns * CLIFF_JUMP)
+      {
+        printf("# cliff %s %s=%d: %.2f -> %.2f ns at %zu bytes, past %s\n", b.series.c_str(), b.key, b.bits, a.ns,
+               b.ns, b.bytes, cliff_outgrown(caches, ncaches, b.bytes).c_str());
+      }
+      break;
+    }
+  }
+  // the fastest layout of each kind of table in each band of sizes
+  // between two caches
+  static const char *kinds[] = {"layout/counters-", "layout/tagged-"};
+  for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++)
+  {
+    for (size_t c = 0; c <= ncaches; c++)
+    {
+      size_t lo = c ? caches[c - 1].bytes : 0, hi = c < ncaches ? caches[c].bytes : (size_t)-1;
+      std::string best;
+      double best_ns = 0;
+      for (size_t i = 0; i < points.size(); i++)
+      {
+        const cliff_point_t &pt = points[i];
+        if (pt.series.compare(0, strlen(kinds[k]), kinds[k]) || pt.bytes <= lo || pt.bytes > hi)
+        {
+          continue;
+        }
+        double sum = 0;
+        int count = 0;
+        for (size_t j = 0; j < points.size(); j++)
+        {
+          if (points[j].series == pt.series && points[j].bytes > lo && points[j].bytes <= hi)
+          {
+            sum += points[j].ns;
+            count++;
+          }
+        }
+        if (best.empty() || sum / count < best_ns)
+        {
+          best = pt.series;
+          best_ns = sum / count;
+        }
+      }
+      if (!best.empty())
+      {
+        std::string band = c < ncaches ? "within L" + std::to_string(caches[c].level) : "past the caches";
+        printf("# fastest %s %s: %s, %.2f ns\n", kinds[k] + 7, band.c_str(), best.c_str(), best_ns);
+      }
+    }
+  }
+  return 0;
+}
+
+//------------------------------------//
+//        Baseline comparison         //
+//------------------------------------//
+
+typedef struct
+{
+  std::string name;
+  double ns;
+} bench_result_t;
+
+// The name and ns_per_branch of every benchmark in the JSON that
+// --benchmark_out wrote to 'path'
+//
+// Returns True if Successful
+//
+static int bench_load(const char *path, std::vector<bench_result_t> *out)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+  {
+    fprintf(stderr, "Unable to open %s\n", path);
+    return 0;
+  }
+  std::string json;
+  char buf[65536];
+  for (size_t n; (n = fread(buf, 1, sizeof(buf), f)) > 0;)
+  {
+    json.append(buf, n);
+  }
+  fclose(f);
+
+  static const char name_key[] = "\"name\": \"", ns_key[] = "\"ns_per_branch\": ";
+  for (size_t at = 0; (at = json.find(name_key, at)) != std::string::npos;)
+  {
+    at += sizeof(name_key) - 1;
+    size_t end = json.find('"', at);
+    size_t next = json.find(name_key, end);
+    size_t ns = json.find(ns_key, end);
+    if (end == std::string::npos)
+    {
+      break;
+    }
+    if (ns != std::string::npos && ns < next)
+    {
+      bench_result_t r = {json.substr(at, end - at), strtod(json.c_str() + ns + sizeof(ns_key) - 1, NULL)};
+      out->push_back(r);
+    }
+    at = end;
+  }
+  return 1;
+}
+
+// Print the change of every benchmark of 'current' that 'baseline'
+// also has
+//
+// Returns 1 if one is more than 'threshold' percent slower, else 0
+//
+static int bench_compare(const char *baseline, const char *current, double threshold)
+{
+  std::vector<bench_result_t> base, cur;
+  if (!bench_load(baseline, &base) || !bench_load(current, &cur))
+  {
+    return 2;
+  }
+  int slower = 0;
+  printf("%-36s %10s %10s %8s\n", "Benchmark", "Base ns", "ns", "Change");
+  for (size_t i = 0; i < cur.size(); i++)
+  {
+    for (size_t j = 0; j < base.size(); j++)
+    {
+      if (base[j].name != cur[i].name || base[j].ns <= 0)
+      {
+        continue;
+      }
+      double change = 100.0 * (cur[i].ns - base[j].ns) / base[j].ns;
+      int bad = change > threshold;
+      printf("%-36s %10.2f %10.2f %+7.1f%%%s\n", cur[i].name.c_str(), base[j].ns, cur[i].ns, change,
+             bad ? "  SLOWER" : "");
+      slower += bad;
+      break;
+    }
+  }
+  if (slower)
+  {
+    printf("%d benchmarks more than %.1f%% slower than %s\n", slower, threshold, baseline);
+  }
+  return slower ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc >= 4 && !strcmp(argv[1], "--compare"))
+  {
+    double threshold = 10;
+    if (argc > 4 && !strncmp(argv[4], "--threshold=", 12))
+    {
+      threshold = atof(argv[4] + 12);
+    }
+    return bench_compare(argv[2], argv[3], threshold);
+  }
+
+  // Our own options first, --traces=<glob> (default ../traces/*)
+  const char *traces = "../traces/*";
+  int kept = 1;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strncmp(argv[i], "--traces=", 9))
+    {
+      traces = argv[i] + 9;
+    }
+    else if (!strcmp(argv[i], "--cliff") || !strncmp(argv[i], "--cliff=", 8))
+    {
+      return cliff_run(argv[i][7] ? atoi(argv[i] + 8) : CLIFF_MAX_MB);
+    }
+    else
+    {
+      argv[kept++] = argv[i];
+    }
+  }
+  argc = kept;
+
+  bench_synthetic();
+  bench_traces(traces);
+  perfctr_group_t perf;
+  if (!perfctr_open(&perf) || perf.fd[PERFCTR_LLC_MISSES] < 0)
+  {
+    fprintf(stderr, "No cache miss counter (%s), reporting time only\n", strerror(errno));
+  }
+  perfctr_close(&perf);
+
+  for (int type = 0; type < NUM_BP_TYPES; type++)
+  {
+    if (type == PLUGIN || type == STATIC)
+    {
+      continue;
+    }
+    for (int path = 0; path < BENCH_PATHS; path++)
+    {
+      for (size_t s = 0; s < bench_streams.size(); s++)
+      {
+        std::string name = std::string(bpName[type]) + "/" + bench_path_names[path] + "/" + bench_streams[s].name;
+        benchmark::RegisterBenchmark(name.c_str(), bench_run, type, path, &bench_streams[s]);
+      }
+    }
+  }
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+  {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,171 @@
+//========================================================//
+//  preddiff.cpp                                          //
+//  Compares two prediction dumps                         //
+//                                                        //
+//  ./predictor --gshare --dump-predictions=a.pred trace  //
+//  ./preddiff a.pred b.pred                              //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "preddump.h"
+
+typedef struct
+{
+  const pred_dump_header_t *hdr;
+  const uint8_t *bits;
+} dump_t;
+
+// Map the dump at 'path' and check its header
+//
+// Returns True if Successful
+//
+int open_dump(const char *path, dump_t *d)
+{
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) || (size_t)st.st_size < sizeof(pred_dump_header_t))
+  {
+    fprintf(stderr, "Error: can not read %s\n", path);
+    return 0;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    fprintf(stderr, "Error: can not map %s\n", path);
+    return 0;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  d->hdr = (const pred_dump_header_t *)map;
+  d->bits = (const uint8_t *)map + sizeof(pred_dump_header_t);
+  uint32_t np = d->hdr->num_predictors;
+  uint64_t bytes = (d->hdr->num_branches * np + 7) / 8;
+  if (memcmp(d->hdr->magic, PRED_DUMP_MAGIC, sizeof(PRED_DUMP_MAGIC)) ||
+      d->hdr->version != PRED_DUMP_VERSION || np == 0 || np > NUM_BP_TYPES ||
+      bytes > st.st_size - sizeof(pred_dump_header_t))
+  {
+    fprintf(stderr, "Error: %s is not a prediction dump\n", path);
+    return 0;
+  }
+  return 1;
+}
+
+static inline int dump_bit(const dump_t *d, uint64_t branch, uint32_t column)
+{
+  uint64_t bit = branch * d->hdr->num_predictors + column;
+  return (d->bits[bit >> 3] >> (bit & 7)) & 1;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 3)
+  {
+    fprintf(stderr, "Usage: preddiff <dump> <dump>\n");
+    exit(2);
+  }
+  dump_t a, b;
+  if (!open_dump(argv[1], &a) || !open_dump(argv[2], &b))
+  {
+    exit(2);
+  }
+
+  uint64_t branches = a.hdr->num_branches < b.hdr->num_branches ? a.hdr->num_branches : b.hdr->num_branches;
+  uint64_t differ[NUM_BP_TYPES] = {0};
+  uint64_t first[NUM_BP_TYPES];
+  int column_b[NUM_BP_TYPES];
+  uint32_t np = a.hdr->num_predictors;
+  int same_layout = np == b.hdr->num_predictors;
+  for (uint32_t p = 0; p < np; p++)
+  {
+    first[p] = ~0ULL;
+    column_b[p] = -1;
+    for (uint32_t q = 0; q < b.hdr->num_predictors; q++)
+    {
+      if (b.hdr->types[q] == a.hdr->types[p])
+      {
+        column_b[p] = q;
+      }
+    }
+    same_layout = same_layout && column_b[p] == (int)p;
+  }
+
+  if (same_layout)
+  {
+    // Same columns: compare whole words and only look into the ones
+    // that differ
+    uint64_t nbits = branches * np;
+    uint64_t nwords = nbits / 64;
+    for (uint64_t w = 0; w <= nwords; w++)
+    {
+      uint64_t x, y;
+      size_t len = w < nwords ? 8 : ((nbits % 64) + 7) / 8;
+      x = y = 0;
+      memcpy(&x, a.bits + w * 8, len);
+      memcpy(&y, b.bits + w * 8, len);
+      uint64_t diff = x ^ y;
+      if (w == nwords && nbits % 64)
+      {
+        diff &= (1ULL << (nbits % 64)) - 1;
+      }
+      while (diff)
+      {
+        uint64_t bit = w * 64 + __builtin_ctzll(diff);
+        uint32_t p = bit % np;
+        if (!differ[p]++)
+        {
+          first[p] = bit / np;
+        }
+        diff &= diff - 1;
+      }
+    }
+  }
+  else
+  {
+    for (uint64_t i = 0; i < branches; i++)
+    {
+      for (uint32_t p = 0; p < np; p++)
+      {
+        if (column_b[p] >= 0 && dump_bit(&a, i, p) != dump_bit(&b, i, column_b[p]))
+        {
+          if (!differ[p]++)
+          {
+            first[p] = i;
+          }
+        }
+      }
+    }
+  }
+
+  int status = a.hdr->num_branches != b.hdr->num_branches;
+  printf("Branches:        %10llu", (unsigned long long)a.hdr->num_branches);
+  if (status)
+  {
+    printf(" vs %llu, compared %llu", (unsigned long long)b.hdr->num_branches, (unsigned long long)branches);
+  }
+  printf("\n");
+  for (uint32_t p = 0; p < np; p++)
+  {
+    printf("%-16s ", bpName[a.hdr->types[p]]);
+    if (column_b[p] < 0)
+    {
+      printf("    not in %s\n", argv[2]);
+      status = 1;
+    }
+    else if (differ[p])
+    {
+      printf("%10llu differ, first at branch %llu\n", (unsigned long long)differ[p], (unsigned long long)first[p]);
+      status = 1;
+    }
+    else
+    {
+      printf("%10s\n", "identical");
+    }
+  }
+  return status;
+}
@@ -0,0 +1,99 @@
+//========================================================//
+//  preddump.cpp                                          //
+//  Source file for the prediction dump format            //
+//========================================================//
+
+#include <stdlib.h>
+#include <string.h>
+#include "preddump.h"
+
+// Bytes of packed bits collected before each write
+#define PRED_DUMP_BUF_SIZE (1 << 20)
+
+pred_dump_t *pred_dump_open(const char *path, const int *types, int num_types)
+{
+  FILE *out = fopen(path, "wb");
+  if (!out)
+  {
+    return NULL;
+  }
+  pred_dump_t *d = (pred_dump_t *)calloc(1, sizeof(pred_dump_t));
+  memcpy(d->hdr.magic, PRED_DUMP_MAGIC, sizeof(PRED_DUMP_MAGIC));
+  d->hdr.version = PRED_DUMP_VERSION;
+  d->hdr.num_predictors = num_types;
+  for (int p = 0; p < num_types; p++)
+  {
+    d->hdr.types[p] = (uint8_t)types[p];
+  }
+  d->out = out;
+  d->cap = PRED_DUMP_BUF_SIZE;
+  d->buf = (uint8_t *)calloc(d->cap, 1);
+
+  // The branch count is filled in by pred_dump_close
+  if (fwrite(&d->hdr, sizeof(d->hdr), 1, out) != 1)
+  {
+    fclose(out);
+    free(d->buf);
+    free(d);
+    return NULL;
+  }
+  return d;
+}
+
+// Write the complete bytes of the buffer, keeping a partial last byte
+//
+// Returns True if Successful
+//
+static int pred_dump_flush(pred_dump_t *d, int all)
+{
+  size_t bytes = d->bits / 8;
+  size_t partial = d->bits % 8;
+  if (all && partial)
+  {
+    bytes++;
+    partial = 0;
+  }
+  if (bytes && fwrite(d->buf, 1, bytes, d->out) != bytes)
+  {
+    return 0;
+  }
+  uint8_t last = partial ? d->buf[bytes] : 0;
+  memset(d->buf, 0, bytes + (partial ? 1 : 0));
+  d->buf[0] = last;
+  d->bits = partial;
+  return 1;
+}
+
+int pred_dump_write(pred_dump_t *d, const branch_record_t *recs, size_t n, const uint64_t *const *predictions)
+{
+  uint32_t np = d->hdr.num_predictors;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (!TRACE_FLAG(&recs[i], TRACE_F_CONDITION))
+    {
+      continue;
+    }
+    if (d->bits + np > (uint64_t)d->cap * 8 && !pred_dump_flush(d, 0))
+    {
+      return 0;
+    }
+    for (uint32_t p = 0; p < np; p++)
+    {
+      uint8_t bit = (predictions[p][i >> 6] >> (i & 63)) & 1;
+      d->buf[d->bits >> 3] |= bit << (d->bits & 7);
+      d->bits++;
+    }
+    d->hdr.num_branches++;
+  }
+  return 1;
+}
+
+int pred_dump_close(pred_dump_t *d)
+{
+  int ok = pred_dump_flush(d, 1);
+  ok = ok && fseek(d->out, 0, SEEK_SET) == 0 && fwrite(&d->hdr, sizeof(d->hdr), 1, d->out) == 1;
+  ok = fclose(d->out) == 0 && ok;
+  free(d->buf);
+  free(d);
+  return ok;
+}
@@ -0,0 +1,63 @@
+//========================================================//
+//  preddump.h                                            //
+//  Header file for the prediction dump format            //
+//                                                        //
+//  Records the prediction of every conditional branch    //
+//  as one bit per predictor, for comparing runs          //
+//  across versions with preddiff                         //
+//========================================================//
+
+#ifndef PREDDUMP_H
+#define PREDDUMP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "predictor.h"
+#include "trace.h"
+
+// A dump is a header followed by the prediction bits. Branch b of
+// predictor p is bit (b * num_predictors + p), bit 0 being the least
+// significant bit of the first byte; 1 is a taken prediction.
+#define PRED_DUMP_MAGIC "BPPRED1"
+#define PRED_DUMP_VERSION 1
+
+typedef struct
+{
+  char magic[8];               // PRED_DUMP_MAGIC, NUL terminated
+  uint32_t version;            // PRED_DUMP_VERSION
+  uint32_t num_predictors;
+  uint64_t num_branches;       // conditional branches recorded
+  uint8_t types[NUM_BP_TYPES]; // predictor type of each bit column
+  uint8_t reserved[8 - NUM_BP_TYPES % 8];
+} pred_dump_header_t;
+
+typedef struct
+{
+  FILE *out;
+  pred_dump_header_t hdr;
+  uint8_t *buf;  // packed bits not written yet
+  size_t cap;    // size of buf in bytes
+  uint64_t bits; // bits in buf
+} pred_dump_t;
+
+// Create the dump 'path' for 'num_types' predictors of 'types'
+//
+// Returns NULL if the file can not be created
+//
+pred_dump_t *pred_dump_open(const char *path, const int *types, int num_types);
+
+// Append the conditional branches among 'n' records, taking the
+// prediction of record i for predictor p from bit i of
+// predictions[p] as filled by predictor_predict_batch
+//
+// Returns True if Successful
+//
+int pred_dump_write(pred_dump_t *d, const branch_record_t *recs, size_t n, const uint64_t *const *predictions);
+
+// Flush, record the branch count and close the dump
+//
+// Returns True if Successful
+//
+int pred_dump_close(pred_dump_t *d);
+
+#endif
@@ -7,35 +7,180 @@
 //========================================================//
 #include <stdio.h>
 #include <math.h>
+#include <stddef.h>
+#include <strings.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+// GCC 12's _mm512_undefined_* initialize a vector with itself, which
+// -Wmaybe-uninitialized flags wherever -O3 inlines them into the
+// AVX-512 kernels, as in branchExt's build (GCC bug 105593)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+
+// The AVX-512 gshare batch of gshare_predict_conflict, which neither
+// times nor counts the table accesses of the COST=1 and OCCUPANCY=1
+// builds. It is built on any x86 host and runs where kernels.h finds
+// AVX-512
+#if !defined(BP_COST) && !defined(BP_OCCUPANCY)
+#define BP_GSHARE_CONFLICT
+#endif
+
+// Pin's C library defines STATIC, the tool's -predict builds this
+#ifdef PIN_CRT
+#undef STATIC
+#endif
 #include "predictor.h"
+#include "bpplugin.h"
+#include "bpcost.h"
+#include "bpocc.h"
+#include "foldhist.h"
+#include "bpmap.h"
+#include "history.h"
+#include "kernels.h"
+
+// Scratch buffers of the batch loops, one per thread. Pin's C library,
+// branchExt -predict, has no thread-local storage; the tool runs the
+// predictors of all its threads under one lock, so one copy does there
+#ifdef PIN_CRT
+#define BP_SCRATCH static
+#else
+#define BP_SCRATCH static thread_local
+#endif
+
+// -------------------- gshare predictor configuration --------------------
+#define G_HISTORY_BITS 15             // default of ghistoryBits
 
 // -------------------- Tournament predictor configuration --------------------
+// Default sizes, per instance in predictor_config_t
 #define T_LHT_BITS   11               // local history bits 
-#define T_LHT_ENTRIES (1UL << T_LHT_BITS) 
-#define T_LPT_ENTRIES (1UL << T_LHT_BITS) // index by local history 
 #define T_LPT_COUNTER_MAX 7           // 3-bit saturating counter
 #define T_LPT_INIT 1
+#define T_LOCAL_HIST_BITS 0           // width of a local history, 0: lhtBits
+#define T_LOCAL_WAYS 1                // local histories per set, 1: indexed by pc alone
+#define T_LOCAL_PATTERN_BITS 0        // log2 local pattern tables picked by pc, 0: one shared
 
 #define T_GHR_BITS   13               // global history bits
-#define T_GPT_ENTRIES (1UL << T_GHR_BITS) 
 #define T_GPT_COUNTER_MAX 3           // 2-bit saturating counter
 #define T_GPT_INIT 1
 
-#define T_CHOOSER_ENTRIES (1UL << T_GHR_BITS) 
 #define T_CHOOSER_MAX 3           // 2-bit saturating counter 
 #define T_CHOOSER_INIT 1
+#define T_CHOOSER_SHIFT 2         // chooser bits in an entry, over the global counter
 
 // -------------------- TAGE predictor configuration --------------------
 #define TAGE_BIMODAL_BITS 15                // bimodal size = 16K
-#define TAGE_BIMODAL_SIZE (1 << TAGE_BIMODAL_BITS)
 #define TAGE_NUM_TAGGED 7                   // number of tagged components
 #define TAGE_TAGGED_BITS 12                 // each table has 4K entries (4096)
-#define TAGE_TAGGED_SIZE (1 << TAGE_TAGGED_BITS)
-#define TAGE_TAG_BITS TAGE_TAGGED_BITS - 5
+#define TAGE_TAG_SHORTER 5                  // tags are TAGGED_BITS - 5 bits
 #define TAGE_CTR_MAX 3                      // 3-bit signed-like counter: 0..7 used as saturating
 #define TAGE_CTR_INIT 4
 #define TAGE_U_MAX 3                        // useful counter 0..3
 #define TAGE_U_INIT 0
+#define TAGE_TAG_EMPTY 0xFFFF               // tag of a free entry; tags are stored XOR it
+#define TAGE_CTR_WIDTH 3                    // modeled bits of the counters above
+#define TAGE_U_WIDTH 2
+#define TAGE_SEED 1                         // usefulness decay generator seed
+#define TAGE_U_RESET 0                      // log2 branches between usefulness halvings, 0: random decay
+#define TAGE_U_RESET_MIN 10
+#define TAGE_HASH 0                         // index and tag hash, see tage_hash_xor
+#define TAGE_HASH_XOR 0
+#define TAGE_HASH_MUL 1
+#define TAGE_HASH_CRC 2
+#define TAGE_HASH_CLMUL 3
+#define TAGE_HASHES 4
+#define TAGE_WAYS 1                         // ways of each tagged table's sets, 1: direct mapped
+#define TAGE_MAX_WAYS 8                     // the 16-byte tags of a set, one SSE2 compare
+#define TAGE_U_AGE_CHUNK 64                 // useful counters halved at once, a cache line
+#define TAGE_HIST_BUF 2048                  // outcomes kept, above TAGE_MAX_HIST + BP_PREFETCH_DISTANCE
+
+// Optional stages, each off by default: a bias filter in front of the
+// whole lookup, then after the TAGE provider a loop predictor that
+// overrides it and a statistical corrector that may revert the result
+#define TAGE_FILTER 0                       // bias filter stage
+#define TAGE_FILTER_BITS 10                 // entries, direct mapped by pc
+#define TAGE_FILTER_RUN 32                  // outcomes one way in a row before a branch is filtered
+#define TAGE_FILTER_ENTRY_WIDTH 15          // modeled bits: 8 tag, 1 dir, 6 run
+#define TAGE_LOOP 0                         // loop predictor stage
+#define TAGE_LOOP_ENTRIES 16                // fully associative, two SSE2 vectors of tags
+#define TAGE_LOOP_CONF_MAX 3                // trip count seen this many times in a row to predict
+#define TAGE_LOOP_AGE_MAX 7                 // replacement misses an entry survives
+#define TAGE_LOOP_USE_MAX 63                // loop / TAGE chooser, -64..63
+#define TAGE_LOOP_ENTRY_WIDTH 53            // modeled bits: 15 tag, 16 past, 16 cur, 2 conf, 3 age, 1 dir
+#define TAGE_SC 0                           // statistical corrector stage
+#define TAGE_SC_TABLES 8                    // GEHL tables, see tage_sc_lengths
+#define TAGE_SC_BITS 10                     // entries per table
+#define TAGE_SC_CTR_MAX 31                  // 6-bit signed counters, -32..31
+#define TAGE_SC_WEIGHT 8                    // weight of each step of TAGE's confidence in the sum
+#define TAGE_SC_THRESH 32                   // initial training threshold
+#define TAGE_SC_WIDTH 6                     // modeled bits of a corrector counter
+#define TAGE_SC_THRESH_WIDTH 15             // of the threshold (8) and its adaptation counter (7)
+
+// -------------------- Perceptron predictor configuration --------------------
+// Hashed perceptron: the last PERCEPTRON_SEGMENTS * PERCEPTRON_SEGMENT
+// outcomes in segments, each with a table of rows of one int8 weight
+// per outcome of the segment, one SSE2 vector
+#define PERCEPTRON_BITS 10                  // rows per weight table and bias entries
+#define PERCEPTRON_SEGMENTS 4               // weight tables
+#define PERCEPTRON_SEGMENT 16               // outcomes per segment
+#define PERCEPTRON_THETA ((int)(1.93 * (PERCEPTRON_SEGMENTS * PERCEPTRON_SEGMENT + 1) + 14)) // training threshold
+#define PERCEPTRON_WEIGHT_MAX 127           // weights stay in -127..127, so they negate in int8
+#define PERCEPTRON_WEIGHT_WIDTH 8
+
+// Multiperspective features, the bits of perceptronFeatures. Every one
+// but the segments above adds a table of 1 << perceptronBits int8
+// weights, one picked per prediction by a hash of the pc and the
+// feature's value, its theta growing with the inputs
+#define PERCEPTRON_F_GLOBAL  (1 << 0)       // the global history segments above
+#define PERCEPTRON_F_LOCAL   (1 << 1)       // the last 16 outcomes of the branch's own row
+#define PERCEPTRON_F_PATH    (1 << 2)       // pc bits of the last 8 branches of any kind
+#define PERCEPTRON_F_DEPTH   (1 << 3)       // calls less returns, 0 to PERCEPTRON_DEPTH_MAX
+#define PERCEPTRON_F_TARGETS (1 << 4)       // target bits of the last 8 taken branches
+#define PERCEPTRON_F_LONG    (1 << 5)       // all 64 outcomes folded into one
+#define PERCEPTRON_FEATURES 6
+#define PERCEPTRON_F_DEFAULT PERCEPTRON_F_GLOBAL
+#define PERCEPTRON_F_BRANCHES (PERCEPTRON_F_PATH | PERCEPTRON_F_DEPTH | PERCEPTRON_F_TARGETS) // read every record
+#define PERCEPTRON_LOCAL_WIDTH 16
+#define PERCEPTRON_REG_WIDTH 16             // of the path and target features
+#define PERCEPTRON_DEPTH_MAX 63
+#define PERCEPTRON_DEPTH_WIDTH 6
+#define PERCEPTRON_CHUNK 256                // conditional branches a batch extracts features for at once
+
+// -------------------- YAGS predictor configuration --------------------
+// A bimodal choice table by pc and two caches of the branches that go
+// against it, taken ones where it says not taken and the reverse, each
+// entry a short pc tag and a 2-bit counter, indexed by a hash of the
+// pc and the global history. The defaults fit the budget
+#define YAGS_CHOICE_BITS 14                 // choice counters
+#define YAGS_CACHE_BITS 11                  // entries per exception cache
+#define YAGS_TAG_BITS 6                     // of the pc in a cache entry, up to YAGS_MAX_TAG_BITS
+#define YAGS_MAX_TAG_BITS 15                // tags are stored XOR all ones, never a tag
+#define YAGS_HIST_BITS 11                   // outcomes hashed into the cache index
+#define YAGS_HASH 0                         // index and tag hash, one of TAGE_HASH_*
+
+// -------------------- Table arena --------------------
+// Every table of an instance is carved from one allocation, each table
+// starting on a cache line; arenas from PREDICTOR_ARENA_HUGE bytes up
+// are mapped and marked for transparent huge pages, or with hugePages
+// put on reserved pages of that size while the pool has them
+#define PREDICTOR_ARENA_ALIGN 64
+#define PREDICTOR_ARENA_HUGE (2 << 20)
+
+// -------------------- Batch replay look-ahead --------------------
+// Records ahead of the current one whose table entries are prefetched;
+// only done for tables larger than a typical L2
+#define BP_PREFETCH_DISTANCE 16
+#define BP_PREFETCH_MIN_BYTES (1 << 20)
+
+// -------------------- Repeated branches --------------------
+// Copies of one conditional record in a row from which the gshare
+// batch loop replays them as a run, see gshare_run
+#define BP_RUN_MIN 8
 
 //
 // TODO:Student Information
@@ -49,561 +194,5411 @@ const char *email = "zuy001@ucsd.edu";
 //------------------------------------//
 
 // Handy Global for use in output routines
-const char *bpName[4] = {"Static", "Gshare",
-                         "Tournament", "Custom"};
+const char *bpName[NUM_BP_TYPES] = {"Static", "Gshare",
+                                    "Tournament", "Custom", "Plugin", "Perceptron", "YAGS"};
 
 // define number of bits required for indexing the BHT here.
-int ghistoryBits = 15; // Number of bits used for Global History
+int ghistoryBits = G_HISTORY_BITS; // Number of bits used for Global History
 int bpType;            // Branch Prediction Type
 int verbose;
+int hugePages;         // 2 or 1024 to map large arenas with MAP_HUGETLB
+int updateDelay;       // 0 to train each branch before predicting the next
+int unbounded;         // 1 for tables that never evict
 
 //------------------------------------//
 //      Predictor Data Structures     //
 //------------------------------------//
 
-//
-// Tournament
-static uint64_t *t_localHistory;   // T_LHT_ENTRIES entries, each holds T_LHT_BITS bits
-static uint8_t  *t_localPred;      // T_LPT_ENTRIES of 3-bit counters (stored in uint8_t)
-static uint8_t  *t_globalPred;     // T_GPT_ENTRIES of 2-bit counters
-static uint8_t  *t_chooser;        // T_CHOOSER_ENTRIES of 2-bit counters
-static uint64_t t_ghr = 0;         // global history register
-//
-// gshare
-uint8_t *bht_gshare;
-uint64_t ghistory;
-//
 // Custom
 // history lengths (geometric growth)
 //static const int tage_hist_lengths[TAGE_NUM_TAGGED] = {4, 10, 20, 60}; // example lengths
-static const int tage_hist_lengths[TAGE_NUM_TAGGED] = {4, 8, 16, 32, 64, 128, 256}; // lengths for 15-bit ghist
+static const int tage_hist_lengths[TAGE_NUM_TAGGED] = {4, 8, 16, 32, 64, 128, 256};
+// global history lengths of the statistical corrector tables, up to 64
+static const int tage_sc_lengths[TAGE_SC_TABLES] = {0, 3, 5, 8, 12, 19, 31, 48};
 
 // Data structures
+// The tagged tables are three arrays in one arena, each holding every
+// table in turn: entry i of table t is element (t << tageTaggedBits) + i
+// of tage_tag (the truncated tag, up to 16 bits), tage_ctr (the 3-bit
+// prediction counter, 0..7) and tage_u (the useful counter,
+// 0..TAGE_U_MAX). Tag matching then only reads tag lines
+#define TAGE_ENTRY_BYTES (sizeof(uint16_t) + 2 * sizeof(uint8_t))
+
+// The global history of each table folded down by XOR, for its index
+// and its tag, and kept up to date one outcome at a time
+typedef struct {
+  uint32_t idx[TAGE_MAX_TAGGED];   // to tageTaggedBits bits
+  uint32_t tag0[TAGE_MAX_TAGGED];  // to the tag width
+  uint32_t tag1[TAGE_MAX_TAGGED];  // to the tag width - 1
+  uint64_t pos;                    // outcomes pushed so far
+  uint64_t ghist;                  // last 64 outcomes, newest in bit 0, for the corrector
+} tage_hist_t;
+
+// History length of a table and the bit where its oldest outcome
+// leaves each folded history, length % width
+typedef struct {
+  uint16_t len;
+  uint8_t out_idx;
+  uint8_t out_tag0;
+  uint8_t out_tag1;
+} tage_fold_t;
+
+// Loop predictor entries, by field so the tags match in two compares.
+// An entry predicts 'dir' for 'past' outcomes since the last other one
+// and then the other direction, once that trip count repeated
+// TAGE_LOOP_CONF_MAX times
+typedef struct {
+  uint16_t tag[TAGE_LOOP_ENTRIES];  // 15-bit pc hash, 0xFFFF when free
+  uint16_t past[TAGE_LOOP_ENTRIES]; // trip count of the last complete run
+  uint16_t cur[TAGE_LOOP_ENTRIES];  // 'dir' outcomes of the current run
+  uint8_t conf[TAGE_LOOP_ENTRIES];
+  uint8_t age[TAGE_LOOP_ENTRIES];
+  uint8_t dir[TAGE_LOOP_ENTRIES];
+  int8_t use;                       // >= 0 while its overrides are right more often than not
+} tage_loop_t;
+
+// Word of a packed counter table, see ctr_packing
+typedef uint64_t ctr_word_t;
+
+// Two-level local history engine (Yeh and Patt): a table of branch
+// histories, sets of 'ways' entries picked by low pc bits, and the
+// caller's pattern counters indexed by a history and, with
+// pattern_bits, that many pc bits choosing one of several tables.
+// One shared table with a history per pc is PAg, one per pc PAp, and
+// a history table small enough that branches share a set's history
+// SAg. With ways each entry is a 16-bit tag over a history of up to
+// 16 bits and a set is in most-recently-used order; otherwise entries
+// are the narrowest of 8, 16 and 32 bits that holds a history. A set
+// is at most 32 bytes, so a prediction reads one line of histories
+// and one of counters
+#define LOCAL_MAX_WAYS 8
+#define LOCAL_TAG_WIDTH 16
 typedef struct {
-  uint16_t tag;    // truncated tag (TAG_BITS can be up to 16 here)
-  uint8_t ctr;     // prediction counter (3-bit using 0..7)
-  uint8_t u;       // useful counter (0..TAGE_U_MAX)
-} tage_entry_t;
+  void *table;
+  uint32_t set_mask;
+  uint32_t hist_mask;
+  uint32_t pattern_mask;      // of the pc bits choosing a pattern table
+  uint8_t set_bits;
+  uint8_t hist_bits;
+  uint8_t ways;
+  uint8_t entry;              // bytes of an entry
+} local_engine_t;
+
+struct predictor
+{
+  predictor_config_t cfg;
+  //
+  // Tournament
+  local_engine_t t_local;     // 1 << lhtBits local histories
+  ctr_word_t *t_localPred;      // 3-bit counters of each local pattern, packed 16 per word
+  ctr_word_t *t_global;         // 1 << ghrBits entries of a 2-bit global counter with the
+                              // 2-bit chooser above it, packed 16 per word, see T_CHOOSER_SHIFT
+  uint64_t t_ghr;             // global history register
+  //
+  // gshare
+  ctr_word_t *bht_gshare;      // 2-bit counters, packed 32 per word
+  uint64_t ghistory;
+  //
+  // Custom
+  uint8_t *tage_bimodal;      // bimodal base table (2-bit counters)
+  uint16_t *tage_tag;         // tags of every tagged table, followed by
+  uint8_t *tage_ctr;          // their prediction counters
+  uint8_t *tage_u;            // their useful counters
+  uint8_t *tage_hbuf;         // last TAGE_HIST_BUF outcomes, one per byte, by position
+  tage_hist_t tage_hist;      // folded histories for tage_hbuf
+  tage_fold_t tage_folds[TAGE_MAX_TAGGED];
+  uint64_t tage_rng;          // allocation decay, xorshift64* state, never 0
+  uint64_t (*tage_batch)(predictor_t *, const predictor_branch_t *, size_t, uint64_t *); // see tage_geometries
+  const bp_folds_t *tage_shared; // its folded histories, see predictor_fold_attach
+  uint8_t tage_slot[3][TAGE_MAX_TAGGED]; // of each table's idx, tag0 and tag1 there
+  uint64_t (*tage_folded)(predictor_t *, const bp_folds_t *, uint64_t *);
+  uint16_t *tage_filter;      // with tageFilter, 1 << TAGE_FILTER_BITS entries; tag, dir, run
+  uint64_t tage_filtered;     // branches the filter predicted, of
+  uint64_t tage_filter_checks; // those it trained on; statistics, not state
+  tage_loop_t tage_loop;      // with tageLoop
+  int8_t *tage_sc;            // with tageSC, TAGE_SC_TABLES tables of TAGE_SC_BITS counters
+  int32_t tage_sc_thresh;     // corrector training threshold
+  int32_t tage_sc_tc;         // and its adaptation counter
+  uint32_t tage_u_age_pos;    // with tageUReset, the next useful counters halved,
+  uint32_t tage_u_age_count;  // the branches until then
+  uint32_t tage_u_age_every;  // and between chunks
+  //
+  // Perceptron
+  int8_t *pc_weights;         // PERCEPTRON_SEGMENTS tables of 1 << perceptronBits rows
+  int8_t *pc_bias;            // 1 << perceptronBits bias weights
+  uint64_t pc_ghist;          // global history, newest outcome in bit 0
+  int8_t *pc_features;        // with perceptronFeatures, a table of 1 << perceptronBits
+                              // weights per feature but the global one, in bit order
+  uint16_t *pc_local;         // with PERCEPTRON_F_LOCAL, the local history of each row
+  bp_history_t pc_regs;       // path and target registers of the features reading them
+  int pc_depth;               // and the call depth
+  int pc_theta;               // training threshold for the inputs in use
+  //
+  // YAGS
+  ctr_word_t *y_choice;       // 1 << yagsChoiceBits 2-bit choice counters, packed 32 per word
+  void *y_tags;               // 2 << yagsCacheBits tags, the taken cache's and the not-taken
+                              // cache's of an index side by side, bytes up to 7 bits
+  ctr_word_t *y_ctrs;         // and their 2-bit counters, in the same order
+  uint64_t y_ghist;           // global history, yagsHistBits outcomes
+  //
+  // Plugin
+  void *plugin_state;         // returned by the plugin's init
+  //
+  // With unbounded, the tables that grow instead: gshare's counters;
+  // the tournament's local histories; TAGE's bimodal counters, then
+  // each tagged table. See gshare_unbounded_bp
+  bp_map_t ub[TAGE_MAX_TAGGED + 1];
+  //
+  // Every table above, see arena_open
+  void *arena;
+  size_t arena_bytes;
+  uint8_t arena_mapped;       // from mmap rather than posix_memalign
+  void (*arena_layout)(predictor_t *, struct arena *); // points the tables into the arena
+  //
+  // With updateDelay, the updates in flight, see delayed_step
+  void *delay_ring;           // updateDelay + 1 slots, at the end of the arena
+  uint32_t delay_head;        // oldest slot
+  uint32_t delay_count;       // slots in use
+#ifdef BP_COST
+  bp_cost_t cost;             // sampled cycles of the entry points, see bpcost.h
+#endif
+#ifdef BP_OCCUPANCY
+  bp_occ_t occ;               // sampled table occupancy, see bpocc.h
+#endif
+};
+
+// Time the calls between BP_COST_BEGIN and BP_COST_END as 'entry' of
+// p->cost; nothing without BP_COST
+#ifdef BP_COST
+#define BP_COST_BEGIN(p, entry) uint64_t bp_cost_start = bp_cost_begin(&(p)->cost, entry)
+#define BP_COST_END(p, entry) bp_cost_end(&(p)->cost, entry, bp_cost_start)
+#else
+#define BP_COST_BEGIN(p, entry)
+#define BP_COST_END(p, entry)
+#endif
+
+// Statements of the occupancy statistics of p->occ, by the table ids
+// below; nothing without BP_OCCUPANCY
+#ifdef BP_OCCUPANCY
+#define BP_OCC(...) __VA_ARGS__
+#else
+#define BP_OCC(...)
+#endif
+#define BP_OCC_GSHARE_BHT 0
+#define BP_OCC_T_LHT 0
+#define BP_OCC_T_LPT 1
+#define BP_OCC_T_GPT 2
+#define BP_OCC_TAGE_BIMODAL 0       // tagged table t is 1 + t
+#define BP_OCC_PERCEPTRON_BIAS 0
+#define BP_OCC_YAGS_CHOICE 0
+#define BP_OCC_YAGS_CACHE 1
+
+// TAGE index and tag hashes of (pc, folded history) pairs, the hash
+// of a geometry below. An index takes the low 'bits' of its result and
+// a tag the high ones where the hash mixes upwards, so the two differ.
+// The CRC32C and carry-less multiply use the SSE4.2 crc32 and PCLMUL
+// instructions in builds that have them, and compute the same values
+// in plain C otherwise
+struct tage_hash_xor {
+  static uint32_t index(const predictor_t *p, uint32_t pc, uint32_t h, int table, int bits) {
+    // simple mix: XOR pc, its bits above the index, and the table id
+    // with the folded history, spread by a multiply: without it the
+    // folded bits alias pc bits, and U1 mispredicts 25% more
+    return (pc ^ (pc >> bits) ^ (h * 0x9e3779b9u) ^ (table * 0xabcdefu)) & ((1u << bits) - 1);
+  }
+  static uint32_t tag(const predictor_t *p, uint32_t pc, uint32_t h, int bits) {
+    return (pc ^ h) & ((1u << bits) - 1);
+  }
+};
+
+struct tage_hash_mul {
+  static uint32_t index(const predictor_t *p, uint32_t pc, uint32_t h, int table, int bits) {
+    uint64_t key = (uint64_t)(pc ^ (table * 0xabcdefu)) << 32 | h;
+    return (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> (64 - bits));
+  }
+  static uint32_t tag(const predictor_t *p, uint32_t pc, uint32_t h, int bits) {
+    uint64_t key = (uint64_t)pc << 32 | h;
+    return (uint32_t)((key * 0xc2b2ae3d27d4eb4fULL) >> (64 - bits));
+  }
+};
 
-static uint8_t *tage_bimodal;                      // bimodal base table (2-bit counters)
-static tage_entry_t **tage_tables;                 // array of pointers to tagged tables
-static uint64_t tage_ghist = 0;                    // global history (kept wide)
-static int tage_hist_mask = 0;
+// Without the instructions the CRC goes a byte at a time through a
+// table, and the carry-less product by 4-bit digits of 'a' through one
+// of the digits times 'K', both built by the compiler
+struct tage_crc_table {
+  uint32_t t[256];
+  constexpr tage_crc_table() : t() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int b = 0; b < 8; b++) c = c >> 1 ^ (0x82f63b78u & -(c & 1));
+      t[i] = c;
+    }
+  }
+};
+
+template <uint64_t K>
+struct tage_clmul_digits {
+  uint64_t d[16];
+  constexpr tage_clmul_digits() : d() {
+    for (int n = 0; n < 16; n++)
+      for (int i = 0; i < 4; i++)
+        if (n >> i & 1) d[n] ^= K << i;
+  }
+};
+
+static inline uint32_t tage_crc32c(uint32_t crc, uint32_t v) {
+#ifdef __SSE4_2__
+  return _mm_crc32_u32(crc, v);
+#else
+  static constexpr tage_crc_table table;
+  crc ^= v;
+  for (int b = 0; b < 4; b++) crc = crc >> 8 ^ table.t[crc & 0xFF];
+  return crc;
+#endif
+}
+
+struct tage_hash_crc {
+  static uint32_t index(const predictor_t *p, uint32_t pc, uint32_t h, int table, int bits) {
+    return tage_crc32c(tage_crc32c(table, pc), h) & ((1u << bits) - 1);
+  }
+  static uint32_t tag(const predictor_t *p, uint32_t pc, uint32_t h, int bits) {
+    return tage_crc32c(tage_crc32c(~0u, pc), h) >> (32 - bits);
+  }
+};
+
+// Low 64 bits of the carry-less product of 'a' and 'K'
+template <uint64_t K>
+static inline uint64_t tage_clmul(uint64_t a) {
+#ifdef __PCLMUL__
+  return (uint64_t)_mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_cvtsi64_si128(a), _mm_cvtsi64_si128(K), 0));
+#else
+  static constexpr tage_clmul_digits<K> digits;
+  uint64_t r = 0;
+#pragma GCC unroll 16
+  for (int i = 0; i < 64; i += 4) r ^= digits.d[a >> i & 15] << i;
+  return r;
+#endif
+}
+
+struct tage_hash_clmul {
+  static uint32_t index(const predictor_t *p, uint32_t pc, uint32_t h, int table, int bits) {
+    uint64_t key = (uint64_t)h << 32 | (pc ^ (table * 0xabcdefu));
+    return (uint32_t)(tage_clmul<0x9e3779b97f4a7c15ULL>(key) >> (64 - bits));
+  }
+  static uint32_t tag(const predictor_t *p, uint32_t pc, uint32_t h, int bits) {
+    uint64_t key = (uint64_t)h << 32 | pc;
+    return (uint32_t)(tage_clmul<0xc2b2ae3d27d4eb4fULL>(key) >> (64 - bits));
+  }
+};
+
+// The CRC and carry-less hashes in the instructions of the sse4.2
+// kernels, for hosts that have them when the build does not assume
+// them; only the batch loops of tage_predict_hashed_sse42 inline them
+__attribute__((target("sse4.2"))) static inline uint32_t tage_crc32c_sse42(uint32_t crc, uint32_t v) {
+  return _mm_crc32_u32(crc, v);
+}
 
-// helper: get lower N bits of history (we store ghist as bits LSB = most recent)
-static inline uint32_t get_hist_bits(uint64_t hist, int len) {
-  if (len >= 64) return (uint32_t)(hist & (~0ULL));
-  return (uint32_t)(hist & ((1ULL << len) - 1));
+template <uint64_t K>
+__attribute__((target("pclmul"))) static inline uint64_t tage_clmul_sse42(uint64_t a) {
+  return (uint64_t)_mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_cvtsi64_si128(a), _mm_cvtsi64_si128(K), 0));
 }
 
-// index function: combine pc and history
-static inline uint32_t tage_index(uint32_t pc, uint64_t hist, int table) {
-  uint32_t h = get_hist_bits(hist, tage_hist_lengths[table]);
-  // simple mix: XOR pc shifted with history and table id
-  uint32_t idx = (pc ^ (h * 0x9e3779b9u) ^ (table * 0xabcdefu)) & (TAGE_TAGGED_SIZE - 1);
-  return idx;
+struct tage_hash_crc_sse42 {
+  __attribute__((target("sse4.2"))) static uint32_t index(const predictor_t *p, uint32_t pc, uint32_t h, int table,
+                                                          int bits) {
+    return tage_crc32c_sse42(tage_crc32c_sse42(table, pc), h) & ((1u << bits) - 1);
+  }
+  __attribute__((target("sse4.2"))) static uint32_t tag(const predictor_t *p, uint32_t pc, uint32_t h, int bits) {
+    return tage_crc32c_sse42(tage_crc32c_sse42(~0u, pc), h) >> (32 - bits);
+  }
+};
+
+struct tage_hash_clmul_sse42 {
+  __attribute__((target("pclmul"))) static uint32_t index(const predictor_t *p, uint32_t pc, uint32_t h, int table,
+                                                          int bits) {
+    uint64_t key = (uint64_t)h << 32 | (pc ^ (table * 0xabcdefu));
+    return (uint32_t)(tage_clmul_sse42<0x9e3779b97f4a7c15ULL>(key) >> (64 - bits));
+  }
+  __attribute__((target("pclmul"))) static uint32_t tag(const predictor_t *p, uint32_t pc, uint32_t h, int bits) {
+    uint64_t key = (uint64_t)h << 32 | pc;
+    return (uint32_t)(tage_clmul_sse42<0xc2b2ae3d27d4eb4fULL>(key) >> (64 - bits));
+  }
+};
+
+// The hash of p->cfg.tageHash, for the single branch entry points
+struct tage_hash_config {
+  static uint32_t index(const predictor_t *p, uint32_t pc, uint32_t h, int table, int bits) {
+    switch (p->cfg.tageHash) {
+    case TAGE_HASH_MUL: return tage_hash_mul::index(p, pc, h, table, bits);
+    case TAGE_HASH_CRC: return tage_hash_crc::index(p, pc, h, table, bits);
+    case TAGE_HASH_CLMUL: return tage_hash_clmul::index(p, pc, h, table, bits);
+    }
+    return tage_hash_xor::index(p, pc, h, table, bits);
+  }
+  static uint32_t tag(const predictor_t *p, uint32_t pc, uint32_t h, int bits) {
+    switch (p->cfg.tageHash) {
+    case TAGE_HASH_MUL: return tage_hash_mul::tag(p, pc, h, bits);
+    case TAGE_HASH_CRC: return tage_hash_crc::tag(p, pc, h, bits);
+    case TAGE_HASH_CLMUL: return tage_hash_clmul::tag(p, pc, h, bits);
+    }
+    return tage_hash_xor::tag(p, pc, h, bits);
+  }
+};
+
+// TAGE geometry, the G of the tage_ functions below. tage_runtime
+// reads it from p->cfg; tage_fixed compiles one in, so the loops over
+// the tables unroll and the masks and history lengths are immediates.
+// Each also names its hash: the runtime geometry's batch loops take
+// the hash as the parameter H, and tage_fixed is the XOR one
+template <class H>
+struct tage_runtime_hashed {
+  typedef H hash;
+  static int ways(const predictor_t *p) { return p->cfg.tageWays; }
+  static int num_tagged(const predictor_t *p) { return p->cfg.tageNumTagged; }
+  static int tagged_bits(const predictor_t *p) { return p->cfg.tageTaggedBits; }
+  static int bimodal_bits(const predictor_t *p) { return p->cfg.tageBimodalBits; }
+  static tage_fold_t fold(const predictor_t *p, int t) { return p->tage_folds[t]; }
+};
+typedef tage_runtime_hashed<tage_hash_config> tage_runtime;
+
+template <int NT, int TB, int BB, const int *H>
+struct tage_fixed {
+  typedef tage_hash_xor hash;
+  static const int tag_bits = TB - TAGE_TAG_SHORTER;
+  static const int tag1_bits = tag_bits > 1 ? tag_bits - 1 : 1;
+  static int ways(const predictor_t *p) { return 1; }
+  static int num_tagged(const predictor_t *p) { return NT; }
+  static int tagged_bits(const predictor_t *p) { return TB; }
+  static int bimodal_bits(const predictor_t *p) { return BB; }
+  static tage_fold_t fold(const predictor_t *p, int t) {
+    tage_fold_t f = {(uint16_t)H[t], (uint8_t)(H[t] % TB), (uint8_t)(H[t] % tag_bits), (uint8_t)(H[t] % tag1_bits)};
+    return f;
+  }
+};
+
+// Width of the tags and of their second folded history
+template <class G>
+static inline int tage_tag_bits(const predictor_t *p) { return G::tagged_bits(p) - TAGE_TAG_SHORTER; }
+template <class G>
+static inline int tage_tag1_bits(const predictor_t *p) { return tage_tag_bits<G>(p) > 1 ? tage_tag_bits<G>(p) - 1 : 1; }
+
+// index function: combine pc and the folded history
+// into the arrays of the tagged tables
+template <class G>
+static inline uint32_t tage_index(const predictor_t *p, uint32_t pc, const tage_hist_t *hist, int table) {
+  uint32_t idx = G::hash::index(p, pc, hist->idx[table], table, G::tagged_bits(p));
+  return ((uint32_t)table << G::tagged_bits(p)) | idx;
 }
 
 // tag function: truncated tag
-static inline uint16_t tage_tag(uint32_t pc, uint64_t hist, int table) {
-  uint32_t h = get_hist_bits(hist, tage_hist_lengths[table]);
-  uint32_t tag = (pc ^ (h >> (table + 1))) & ((1u << TAGE_TAG_BITS) - 1);
-  return (uint16_t)tag;
+template <class G>
+static inline uint16_t tage_tag(const predictor_t *p, uint32_t pc, const tage_hist_t *hist, int table) {
+  uint32_t tag = G::hash::tag(p, pc, hist->tag0[table] ^ (hist->tag1[table] << 1), tage_tag_bits<G>(p));
+  return (uint16_t)(tag ^ TAGE_TAG_EMPTY);
+}
+
+// Perceptron row of table 'seg' for 'pc', hashed with the outcomes of
+// the segment
+static inline uint32_t perceptron_row(const predictor_t *p, uint32_t pc, uint64_t hist, int seg) {
+  uint32_t outcomes = (uint32_t)(hist >> (seg * PERCEPTRON_SEGMENT)) & ((1u << PERCEPTRON_SEGMENT) - 1);
+  uint32_t h = pc ^ (outcomes * 0x9e3779b1u) ^ (seg * 0x85ebca6bu);
+  return (h ^ (h >> 16)) & ((1u << p->cfg.perceptronBits) - 1);
+}
+
+static inline int8_t *perceptron_weights(const predictor_t *p, int seg, uint32_t row) {
+  return p->pc_weights + ((((size_t)seg << p->cfg.perceptronBits) + row) * PERCEPTRON_SEGMENT);
+}
+
+// Row of the table of feature bit 'f' for 'pc' and the feature's value
+static inline uint32_t perceptron_feature_row(uint32_t mask, uint32_t pc, uint32_t value, int f) {
+  uint32_t h = (pc * 0x9e3779b1u) ^ (value * 0x85ebca6bu) ^ ((uint32_t)f * 0xc2b2ae35u);
+  return (h ^ (h >> 16)) & mask;
+}
+
+// Value of feature bit 'f' before a conditional branch, from the
+// outcomes 'hist', the registers, the call depth and the branch's
+// local history
+static inline uint32_t perceptron_feature_value(int f, uint64_t hist, const bp_history_t *regs, int depth,
+                                                uint32_t local) {
+  switch (f) {
+  case PERCEPTRON_F_LOCAL: return local;
+  case PERCEPTRON_F_PATH: return (uint32_t)regs->path & ((1u << PERCEPTRON_REG_WIDTH) - 1);
+  case PERCEPTRON_F_DEPTH: return depth;
+  case PERCEPTRON_F_TARGETS: return (uint32_t)regs->targets & ((1u << PERCEPTRON_REG_WIDTH) - 1);
+  default: return (uint32_t)(hist ^ (hist >> 32));
+  }
+}
+
+// Advance the path and target registers and the call depth past any
+// record
+static inline void perceptron_observe(bp_history_t *regs, int *depth, const predictor_branch_t *br) {
+  history_push(regs, br);
+  int d = *depth + !!(br->flags & BP_F_CALL) - !!(br->flags & BP_F_RET);
+  *depth = d < 0 ? 0 : d > PERCEPTRON_DEPTH_MAX ? PERCEPTRON_DEPTH_MAX : d;
 }
 
 //------------------------------------//
 //        Predictor Functions         //
 //------------------------------------//
 
-// Helpfer macros
-// Prediction
-#define PREDICT2b(counter, pred)   switch (counter) \
-  { \
-  case WN: \
-    pred = NOTTAKEN; \
-    break; \
-  case SN: \
-    pred = NOTTAKEN; \
-    break; \
-  case WT: \
-    pred = TAKEN; \
-  case ST: \
-    pred = TAKEN; \
-    break; \
-  default: \
-    printf("Warning: Undefined state of entry in 2 bit BHT!\n"); \
-    pred = NOTTAKEN; \
-    break; \
-  }
-
-#define PREDICT3b(counter, pred)   switch (counter) \
-  { \
-  case SSSN: \
-    pred = NOTTAKEN; \
-    break; \
-  case SSN: \
-    pred = NOTTAKEN; \
-    break; \
-  case NS: \
-    pred = NOTTAKEN; \
-    break; \
-  case NW: \
-    pred = NOTTAKEN; \
-    break; \
-  case TW: \
-    pred = TAKEN; \
-    break; \
-  case TS: \
-    pred = TAKEN; \
-    break; \
-  case SST: \
-    pred = TAKEN; \
-    break; \
-  case SSST: \
-    pred = TAKEN; \
-    break; \
-  default: \
-    printf("Warning: Undefined state of entry in 3 bit BHT!\n"); \
-    pred = NOTTAKEN; \
-    break; \
-  }
-
-#define COUNTERUPDATE2b(counter, outcome)  switch (counter) \
-  { \
-  case WN: \
-    counter = (outcome == TAKEN) ? WT : SN; \
-    break; \
-  case SN: \
-    counter = (outcome == TAKEN) ? WN : SN; \
-    break; \
-  case WT: \
-    counter = (outcome == TAKEN) ? ST : WN; \
-    break; \
-  case ST: \
-    counter = (outcome == TAKEN) ? ST : WT; \
-    break; \
-  default: \
-    printf("Warning: Undefined state of entry in 2 bit BHT!\n"); \
-    break; \
-  }
-
-#define COUNTERUPDATE3b(counter, outcome)  switch (counter) \
-  { \
-  case SSSN: \
-    counter = (outcome == TAKEN) ? SSN : SSSN; \
-    break; \
-  case SSN: \
-    counter = (outcome == TAKEN) ? NS : SSSN; \
-    break; \
-  case NS: \
-    counter = (outcome == TAKEN) ? NW : SSN; \
-    break; \
-  case NW: \
-    counter = (outcome == TAKEN) ? TW : NS; \
-    break; \
-  case TW: \
-    counter = (outcome == TAKEN) ? TS : NW; \
-    break; \
-  case TS: \
-    counter = (outcome == TAKEN) ? SST : TW; \
-    break; \
-  case SST: \
-    counter = (outcome == TAKEN) ? SSST : TS; \
-    break; \
-  case SSST: \
-    counter = (outcome == TAKEN) ? SSST : SST; \
-    break; \
-  default: \
-    printf("Warning: Undefined state of entry in 3 bit BHT!\n"); \
-    break; \
-  }
-
-void init_tage()
-{
-  // allocate bimodal (2-bit saturating counters), init to weakly taken (WT)
-  tage_bimodal = (uint8_t *)malloc(TAGE_BIMODAL_SIZE * sizeof(uint8_t));
-  if (!tage_bimodal) { fprintf(stderr, "TAGE: bimodal malloc failed\n"); exit(1); }
-  for (int i = 0; i < TAGE_BIMODAL_SIZE; ++i) tage_bimodal[i] = WT;
-
-  // allocate tagged tables
-  tage_tables = (tage_entry_t **)malloc(TAGE_NUM_TAGGED * sizeof(tage_entry_t *));
-  if (!tage_tables) { fprintf(stderr, "TAGE: tables malloc failed\n"); exit(1); }
-  for (int t = 0; t < TAGE_NUM_TAGGED; ++t) {
-    tage_tables[t] = (tage_entry_t *)malloc(TAGE_TAGGED_SIZE * sizeof(tage_entry_t));
-    if (!tage_tables[t]) { fprintf(stderr, "TAGE: table[%d] malloc failed\n", t); exit(1); }
-    // initialize entries
-    for (int i = 0; i < TAGE_TAGGED_SIZE; ++i) {
-      tage_tables[t][i].tag = 0xFFFFu;         // invalid tag
-      tage_tables[t][i].ctr = TAGE_CTR_INIT;   // weakly taken
-      tage_tables[t][i].u = TAGE_U_INIT;
-    }
-  }
-
-  tage_ghist = 0;
-  tage_hist_mask = (1 << ghistoryBits) - 1; // reuse ghistoryBits as global history register width
-}
-
-uint8_t tage_predict(uint32_t pc)
-{
-  // bimodal index
-  uint32_t bim_idx = pc & (TAGE_BIMODAL_SIZE - 1);
-  uint8_t bim_pred;
-  PREDICT2b(tage_bimodal[bim_idx], bim_pred);
-
-  int provider = -1;
-  int alt = -1;
-  uint8_t provider_pred = bim_pred;
-  uint8_t alt_pred = bim_pred;
-
-  // search from longest history (highest table index) to shortest
-  for (int t = TAGE_NUM_TAGGED - 1; t >= 0; --t) {
-    uint32_t idx = tage_index(pc, tage_ghist, t);
-    uint16_t tag = tage_tag(pc, tage_ghist, t);
-    tage_entry_t *e = &tage_tables[t][idx];
-    if (e->tag == tag) {
-      uint8_t pred;
-      PREDICT3b(e->ctr, pred);
-      if (provider == -1) {
-        provider = t;
-        provider_pred = pred;
-      } else if (alt == -1) {
-        alt = t;
-        alt_pred = pred;
-      }
-    }
+// Saturating counters of N bits, 0 to (1 << N) - 1, predicting taken
+// in the upper half. The prediction is a compare, with no jump table
+// or data dependent branch on the counter value.
+//
+// A table starting at counter value I stores each counter XOR I, so
+// a new table is all zero bytes: the arena needs no fill loop, and a
+// mapped one is only backed by pages as its entries are first touched.
+// A step XORs the bits that change into the stored value, which the
+// word-wide add of an unencoded step would carry out of
+template <int N>
+static inline uint8_t ctr_predict(uint8_t counter)
+{
+  return counter >= (1 << (N - 1));
+}
+
+// One step toward 'outcome' (TAKEN or NOTTAKEN) unless saturated
+// there. Most counters are, so skipping their store is cheaper than an
+// unconditional clamped add and the test is well predicted
+template <int N, int I = 0>
+static inline void ctr_update(uint8_t *counter, uint8_t outcome)
+{
+  uint8_t c = *counter ^ I;
+  uint8_t saturated = outcome ? (1 << N) - 1 : 0;
+  if (c != saturated)
+  {
+    *counter = (uint8_t)(c + (outcome ? 1 : -1)) ^ I;
   }
+}
 
-  // if we have a provider, choose it; else use bimodal
-  if (provider != -1) return provider_pred;
-  return bim_pred;
+// Tables of N-bit counters packed into 64-bit words, in fields of 2
+// or 4 bits so an index is a shift and a mask
+template <int N>
+struct ctr_packing {
+  static const int field = N <= 2 ? 2 : 4;
+  static const int per_word = 8 * sizeof(ctr_word_t) / field;
+};
+
+// Words holding 'entries' counters
+template <int N>
+static inline size_t ctr_words(size_t entries)
+{
+  return (entries + ctr_packing<N>::per_word - 1) / ctr_packing<N>::per_word;
 }
 
-void train_tage(uint32_t pc, uint8_t outcome)
+template <int N, int I = 0>
+static inline uint8_t ctr_get(const ctr_word_t *table, uint32_t i)
 {
-  // bimodal index
-  uint32_t bim_idx = pc & (TAGE_BIMODAL_SIZE - 1);
-  uint8_t bim_pred;
-  PREDICT2b(tage_bimodal[bim_idx], bim_pred);
-
-  int provider = -1;
-  int alt = -1;
-  uint8_t provider_pred = bim_pred;
-  uint8_t alt_pred = bim_pred;
-
-  for (int t = TAGE_NUM_TAGGED - 1; t >= 0; --t) {
-    uint32_t idx = tage_index(pc, tage_ghist, t);
-    uint16_t tag = tage_tag(pc, tage_ghist, t);
-    tage_entry_t *e = &tage_tables[t][idx];
-    if (e->tag == tag) {
-      uint8_t pred;
-      PREDICT3b(e->ctr, pred);
-      if (provider == -1) {
-        provider = t;
-        provider_pred = pred;
-      } else if (alt == -1) {
-        alt = t;
-        alt_pred = pred;
-      }
-    }
+  const int f = ctr_packing<N>::field;
+  return ((table[i / ctr_packing<N>::per_word] >> (i % ctr_packing<N>::per_word * f)) & ((1 << N) - 1)) ^ I;
+}
+
+// ctr_update on the 'N'-bit counter at bit 'shift' of 'word', stored
+// XOR I
+template <int N, int I = 0>
+static inline void ctr_step_field(ctr_word_t *word, int shift, uint8_t outcome)
+{
+  uint8_t c = ((*word >> shift) & ((1 << N) - 1)) ^ I;
+  uint8_t saturated = outcome ? (1 << N) - 1 : 0;
+  if (c != saturated)
+  {
+    uint8_t next = c + (outcome ? 1 : -1);
+    *word ^= (ctr_word_t)((c ^ next) & ((1 << N) - 1)) << shift;
   }
+}
 
-  // if provider exists, update its counter
-  if (provider != -1) {
-    uint32_t idx = tage_index(pc, tage_ghist, provider);
-    tage_entry_t *e = &tage_tables[provider][idx];
-    // update 3-bit saturating-like counter: keep in 0..7
-    COUNTERUPDATE3b(e->ctr, outcome);
-    // update useful bit: if provider predicted correctly and alternate predicted incorrectly, increase u
-    if (provider_pred == outcome && alt != -1 && alt_pred != outcome) {
-      COUNTERUPDATE2b(e->u, TAKEN);
-    }
-    // if provider wrong but alt correct, decrement u
-    if (provider_pred != outcome && alt != -1 && alt_pred == outcome) {
-      COUNTERUPDATE2b(e->u, NOTTAKEN);
-    }
-  } else {
-    // no provider: update bimodal only for now
-    COUNTERUPDATE2b(tage_bimodal[bim_idx], outcome);
-  }
-  // If provider did not exist and prediction was incorrect, allocate in a low-utility entry (simple allocation)
-  if (provider == -1) {
-    // try to allocate in one of the higher tables where an entry has u==0
-    for (int t = 0; t < TAGE_NUM_TAGGED; ++t) {
-      uint32_t idx = tage_index(pc, tage_ghist, t);
-      tage_entry_t *e = &tage_tables[t][idx];
-      if (e->u == 0) {
-        // allocate
-        e->tag = tage_tag(pc, tage_ghist, t);
-        e->ctr = TAGE_CTR_INIT + (outcome ? 1 : -1); // bias toward outcome
-        if (e->ctr > 7) e->ctr = 7;
-        if (e->ctr < 0) e->ctr = 0;
-        e->u = 0;
-        break;
-      } else {
-        // decay usefulness slowly
-        if (e->u > 0 && (rand() & 0x3F) == 0) e->u--;
-      }
+// ctr_update on a packed counter
+template <int N, int I = 0>
+static inline void ctr_update_packed(ctr_word_t *table, uint32_t i, uint8_t outcome)
+{
+  ctr_step_field<N, I>(&table[i / ctr_packing<N>::per_word], i % ctr_packing<N>::per_word * ctr_packing<N>::field,
+                       outcome);
+}
+
+// Set a packed counter to 'value'
+template <int N, int I = 0>
+static inline void ctr_set_packed(ctr_word_t *table, uint32_t i, uint8_t value)
+{
+  int shift = i % ctr_packing<N>::per_word * ctr_packing<N>::field;
+  ctr_word_t *word = &table[i / ctr_packing<N>::per_word];
+  *word = (*word & ~((ctr_word_t)((1 << N) - 1) << shift)) | (ctr_word_t)(value ^ I) << shift;
+}
+
+// Counter automata by table: the next state of each state and outcome,
+// generated at compile time from a rule, so an update is one byte load
+// from a table of 2 * states entries whatever the scheme. The
+// prediction stays the rule's own test, a compare for the counters
+// here, which measured faster than a second table on the TAGE lookup
+// path. A rule is a struct with
+//
+//   static const int states;    // a power of 2, up to 256
+//   static constexpr uint8_t step(uint8_t state, uint8_t outcome);
+//   static constexpr uint8_t predict(uint8_t state);
+//
+// Like the counters above, a table of counters starting at state I
+// stores each state XOR I, and the automaton's table is indexed and
+// filled by those stored values
+template <class R, int I = 0>
+struct ctr_automaton {
+  static_assert((R::states & (R::states - 1)) == 0 && R::states <= 256 && I < R::states,
+                "automaton states are a power of 2 holding the initial state");
+  uint8_t next[2 * R::states]; // by stored state << 1 | outcome
+  constexpr ctr_automaton() : next() {
+    for (int s = 0; s < R::states; s++) {
+      next[(s ^ I) << 1] = R::step(s, NOTTAKEN) ^ I;
+      next[(s ^ I) << 1 | 1] = R::step(s, TAKEN) ^ I;
     }
   }
+};
 
-  // If provider existed, also update alternate or bimodal sometimes (helpful fallback)
-  if (provider != -1 && alt == -1) {
-    // update bimodal as alternate
-    if (outcome == TAKEN) {
-      if (tage_bimodal[bim_idx] < ST) tage_bimodal[bim_idx]++;
-    } else {
-      if (tage_bimodal[bim_idx] > SN) tage_bimodal[bim_idx]--;
-    }
+template <class R, int I = 0>
+constexpr ctr_automaton<R, I> ctr_automaton_table{};
+
+// The N-bit saturating counter of ctr_update
+template <int N>
+struct ctr_saturating {
+  static const int states = 1 << N;
+  static constexpr uint8_t step(uint8_t s, uint8_t outcome) {
+    return outcome ? (s < states - 1 ? s + 1 : s) : (s > 0 ? s - 1 : s);
   }
+  static constexpr uint8_t predict(uint8_t s) { return s >= states / 2; }
+};
 
-  // update global history (keep width limited by ghistoryBits)
-  tage_ghist = ((tage_ghist << 1) | (outcome & 1)) & ((1ULL << ghistoryBits) - 1);
-}
+// A 2-bit counter with hysteresis on the weak states: a misprediction
+// there jumps to the strong state of the other direction, so a branch
+// that changes direction is followed after one miss instead of two
+struct ctr_hysteresis {
+  static const int states = 4;
+  static constexpr uint8_t step(uint8_t s, uint8_t outcome) {
+    return outcome ? (s == WN ? ST : s < ST ? s + 1 : ST) : (s == WT ? SN : s > SN ? s - 1 : SN);
+  }
+  static constexpr uint8_t predict(uint8_t s) { return s >= WT; }
+};
 
-// cleanup
-void cleanup_tage()
+static_assert(ctr_automaton_table<ctr_saturating<3>, TAGE_CTR_INIT>.next[(TAGE_CTR_INIT ^ TAGE_CTR_INIT) << 1 | 1] ==
+                  ((TAGE_CTR_INIT + 1) ^ TAGE_CTR_INIT) &&
+                  ctr_automaton_table<ctr_saturating<2>, WT>.next[(SN ^ WT) << 1] == (SN ^ WT) &&
+                  ctr_automaton_table<ctr_hysteresis>.next[WN << 1 | 1] == ST,
+              "automaton tables step like the rules");
+
+template <class R, int I = 0>
+static inline uint8_t ctr_automaton_predict(uint8_t counter)
 {
-  if (tage_bimodal) { free(tage_bimodal); tage_bimodal = NULL; }
-  if (tage_tables) {
-    for (int t = 0; t < TAGE_NUM_TAGGED; ++t) {
-      if (tage_tables[t]) { free(tage_tables[t]); tage_tables[t] = NULL; }
-    }
-    free(tage_tables); tage_tables = NULL;
-  }
+  return R::predict(counter ^ I);
 }
 
-// Tournament functions
-void init_tournament()
+// One step of rule R on a counter stored XOR I, with no branch on the
+// state or the outcome
+template <class R, int I = 0>
+static inline void ctr_automaton_update(uint8_t *counter, uint8_t outcome)
 {
-  // allocate
-  t_localHistory = (uint64_t *)malloc(sizeof(uint64_t) * T_LHT_ENTRIES);
-  t_localPred    = (uint8_t  *)malloc(sizeof(uint8_t)  * T_LPT_ENTRIES);
-  t_globalPred   = (uint8_t  *)malloc(sizeof(uint8_t)  * T_GPT_ENTRIES);
-  t_chooser      = (uint8_t  *)malloc(sizeof(uint8_t)  * T_CHOOSER_ENTRIES);
+  *counter = ctr_automaton_table<R, I>.next[*counter << 1 | outcome];
+}
 
-  if (!t_localHistory || !t_localPred || !t_globalPred || !t_chooser) {
-    fprintf(stderr, "Error: tournament predictor malloc failed\n");
-    exit(1);
-  }
+// ctr_automaton_update on the counter at bit 'shift' of 'word'
+template <class R, int I = 0>
+static inline void ctr_automaton_step_field(ctr_word_t *word, int shift, uint8_t outcome)
+{
+  uint8_t c = (*word >> shift) & (R::states - 1);
+  *word ^= (ctr_word_t)(c ^ ctr_automaton_table<R, I>.next[c << 1 | outcome]) << shift;
+}
 
-  // initialize
-  memset(t_localHistory, 0, sizeof(uint64_t) * T_LHT_ENTRIES);
-  for (int i = 0; i < T_LPT_ENTRIES; ++i) t_localPred[i]  = T_LPT_INIT;
-  for (int i = 0; i < T_GPT_ENTRIES; ++i) t_globalPred[i] = T_GPT_INIT;
-  for (int i = 0; i < T_CHOOSER_ENTRIES; ++i) t_chooser[i]  = T_CHOOSER_INIT;
+// Local history engine functions
+// The geometry of 1 << 'entries_bits' histories of 'hist_bits' bits in
+// sets of 'ways', with 1 << 'pattern_bits' pattern tables
+static inline void local_engine_setup(local_engine_t *e, int entries_bits, int hist_bits, int ways, int pattern_bits)
+{
+  e->table = NULL;
+  e->set_bits = entries_bits - __builtin_ctz(ways);
+  e->set_mask = (1u << e->set_bits) - 1;
+  e->hist_bits = hist_bits;
+  e->hist_mask = (1u << hist_bits) - 1;
+  e->pattern_mask = (1u << pattern_bits) - 1;
+  e->ways = ways;
+  e->entry = ways > 1 ? sizeof(uint32_t) : hist_bits <= 8 ? sizeof(uint8_t) :
+             hist_bits <= 16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
 
-  t_ghr = 0;
+static inline size_t local_bytes(const local_engine_t *e)
+{
+  return ((size_t)e->set_mask + 1) * e->ways * e->entry;
 }
 
-uint8_t tournament_predict(uint32_t pc)
+// Counters of the pattern tables
+static inline size_t local_patterns(const local_engine_t *e)
 {
-  // index into local history table using low bits of PC 
-  uint32_t lht_index = pc & (T_LHT_ENTRIES - 1);
-  uint32_t local_hist = t_localHistory[lht_index];
+  return ((size_t)e->pattern_mask + 1) << e->hist_bits;
+}
 
-  // local predictor indexed by local history
-  uint32_t local_index = local_hist & (T_LPT_ENTRIES - 1);
-  uint8_t local_counter = t_localPred[local_index];
-  uint8_t local_taken;
-  PREDICT3b(local_counter, local_taken);
+// The set of 'pc'
+static inline const void *local_set(const local_engine_t *e, uint32_t pc)
+{
+  return (const char *)e->table + (size_t)(pc & e->set_mask) * e->ways * e->entry;
+}
 
-  // global predictor indexed by GHR
-  uint32_t global_index = t_ghr & (T_GPT_ENTRIES - 1);
-  uint8_t global_counter = t_globalPred[global_index];
-  uint8_t global_taken;
-  PREDICT2b(global_counter, global_taken);
+// A history found for a branch: its entry, and with ways its tag and
+// the way it was in, 'ways' when it was not
+typedef struct {
+  uint32_t slot;
+  uint32_t hist;
+  uint32_t tag;
+  uint8_t way;
+} local_lookup_t;
 
-  // chooser selects: smaller values prefer local, larger prefer global
-  uint8_t chooser_val = t_chooser[global_index];
-  uint8_t prefer_global;
-  PREDICT2b(chooser_val, prefer_global);
-  return prefer_global ? global_taken : local_taken;
+// The entry size is the same for every access and well predicted
+static inline void local_find(const local_engine_t *e, uint32_t pc, local_lookup_t *lk)
+{
+  uint32_t set = pc & e->set_mask;
+  if (e->ways == 1)
+  {
+    lk->slot = set;
+    lk->hist = e->entry == 2 ? ((const uint16_t *)e->table)[set] :
+               e->entry == 1 ? ((const uint8_t *)e->table)[set] : ((const uint32_t *)e->table)[set];
+    return;
+  }
+  const uint32_t *ways = (const uint32_t *)e->table + (size_t)set * e->ways;
+  uint32_t h = pc >> e->set_bits;
+  lk->slot = set * e->ways;
+  lk->tag = (h ^ (h >> LOCAL_TAG_WIDTH)) & ((1u << LOCAL_TAG_WIDTH) - 1);
+  lk->hist = 0;
+  lk->way = e->ways;
+  for (int w = 0; w < e->ways; w++)
+  {
+    if (ways[w] >> LOCAL_TAG_WIDTH == lk->tag)
+    {
+      lk->way = w;
+      lk->hist = ways[w] & e->hist_mask;
+      break;
+    }
+  }
 }
 
-void train_tournament(uint32_t pc, uint8_t outcome)
+// The pattern counter of the history of 'lk' for 'pc'
+static inline uint32_t local_pattern(const local_engine_t *e, uint32_t pc, const local_lookup_t *lk)
 {
-  // local indexes
-  uint32_t lht_index = pc & (T_LHT_ENTRIES - 1);
-  uint32_t local_hist = t_localHistory[lht_index];
-  uint32_t local_index = local_hist & (T_LPT_ENTRIES - 1);
-
-  // global indexes
-  uint32_t global_index = t_ghr & (T_GPT_ENTRIES - 1);
+  return (pc & e->pattern_mask) << e->hist_bits | lk->hist;
+}
 
-  // current predictions
-  uint8_t local_taken;
-  PREDICT3b(t_localPred[local_index], local_taken);
-  uint8_t global_taken;
-  PREDICT2b(t_globalPred[global_index], global_taken);
-  // update local predictor (3-bit saturating)
-  COUNTERUPDATE3b(t_localPred[local_index], outcome);
-  // update global predictor (2-bit saturating)
-  COUNTERUPDATE2b(t_globalPred[global_index], outcome);
-  // update chooser only when local and global disagree
-  if (local_taken != global_taken) {
-    // if global was correct, move chooser towards global (increment)
-    if (global_taken == outcome) {
-      COUNTERUPDATE2b(t_chooser[global_index], TAKEN);
-    } else if (local_taken == outcome) {
-      // if local was correct, move chooser towards local (decrement)
-      COUNTERUPDATE2b(t_chooser[global_index], NOTTAKEN);
+// Shift 'outcome' into the history of 'lk'. With ways it moves to the
+// front of its set, replacing the least recently used on a miss
+static inline void local_push(local_engine_t *e, const local_lookup_t *lk, uint8_t outcome)
+{
+  uint32_t hist = ((lk->hist << 1) | outcome) & e->hist_mask;
+  if (e->ways == 1)
+  {
+    if (e->entry == 2)
+    {
+      ((uint16_t *)e->table)[lk->slot] = hist;
+    }
+    else if (e->entry == 1)
+    {
+      ((uint8_t *)e->table)[lk->slot] = hist;
+    }
+    else
+    {
+      ((uint32_t *)e->table)[lk->slot] = hist;
     }
+    return;
   }
-  // update local history (per-PC)
-  t_localHistory[lht_index] = ((t_localHistory[lht_index] << 1) | outcome) & (T_LHT_ENTRIES - 1);
+  uint32_t *ways = (uint32_t *)e->table + lk->slot;
+  int w = lk->way < e->ways ? lk->way : e->ways - 1;
+  memmove(ways + 1, ways, w * sizeof(uint32_t));
+  ways[0] = lk->tag << LOCAL_TAG_WIDTH | hist;
+}
 
-  // update global history
-  t_ghr = ((t_ghr << 1) | outcome) & (T_GPT_ENTRIES - 1);
+// Bits of the histories, with ways their tags and recency order
+static constexpr uint64_t local_bits(int entries_bits, int hist_bits, int ways)
+{
+  return (uint64_t)(hist_bits + (ways > 1 ? LOCAL_TAG_WIDTH + __builtin_ctz(ways) : 0)) << entries_bits;
 }
 
-void cleanup_tournament()
+// Tables handed out by a layout function, in order. With 'base' NULL
+// only the bytes are counted
+typedef struct arena
+{
+  char *base;
+  size_t used;
+} arena_t;
+
+static void *arena_take(arena_t *a, size_t bytes)
 {
-  if (t_localHistory) { free(t_localHistory); t_localHistory = NULL; }
-  if (t_localPred)    { free(t_localPred);    t_localPred    = NULL; }
-  if (t_globalPred)   { free(t_globalPred);   t_globalPred   = NULL; }
-  if (t_chooser)      { free(t_chooser);      t_chooser      = NULL; }
+  void *table = a->base ? a->base + a->used : NULL;
+  a->used += (bytes + PREDICTOR_ARENA_ALIGN - 1) & ~(size_t)(PREDICTOR_ARENA_ALIGN - 1);
+  return table;
 }
 
-// gshare functions
-void init_gshare()
+static size_t delay_ring_bytes(const predictor_config_t *cfg);
+
+// Run 'layout' for the scheme's tables, then take the ring of updates
+// in flight with updateDelay after them
+static void arena_place(predictor_t *p, void (*layout)(predictor_t *, arena_t *), arena_t *a)
+{
+  layout(p, a);
+  size_t ring = delay_ring_bytes(&p->cfg);
+  p->delay_ring = ring ? arena_take(a, ring) : NULL;
+}
+
+// Size the tables 'layout' takes for p->cfg, allocate them zeroed in
+// one arena and run 'layout' again to point p at them
+//
+// Returns True if Successful
+//
+static int arena_open(predictor_t *p, void (*layout)(predictor_t *, arena_t *))
 {
-  int bht_entries = 1 << ghistoryBits;
-  bht_gshare = (uint8_t *)malloc(bht_entries * sizeof(uint8_t));
-  int i = 0;
-  for (i = 0; i < bht_entries; i++)
+  arena_t a = {NULL, 0};
+  arena_place(p, layout, &a);
+  if (a.used >= PREDICTOR_ARENA_HUGE)
+  {
+    void *m = MAP_FAILED;
+    size_t bytes = 0;
+    if (hugePages)
+    {
+      size_t page = (size_t)hugePages << 20;
+      bytes = (a.used + page - 1) & ~(page - 1);
+      int size_flag = (hugePages == 1024 ? 30 : 21) << MAP_HUGE_SHIFT;
+      m = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | size_flag, -1, 0);
+      static std::atomic<int> warned(0);
+      if (m == MAP_FAILED && !warned.exchange(1))
+      {
+        fprintf(stderr, "--hugepages: no free %d MB pages, using transparent huge pages\n", hugePages);
+      }
+    }
+    if (m == MAP_FAILED)
+    {
+      bytes = (a.used + PREDICTOR_ARENA_HUGE - 1) & ~(size_t)(PREDICTOR_ARENA_HUGE - 1);
+      m = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (m == MAP_FAILED)
+      {
+        return 0;
+      }
+      madvise(m, bytes, MADV_HUGEPAGE);
+    }
+    p->arena = m;
+    p->arena_bytes = bytes;
+    p->arena_mapped = 1;
+  }
+  else if (a.used)
   {
-    bht_gshare[i] = WN;
+    if (posix_memalign(&p->arena, PREDICTOR_ARENA_ALIGN, a.used))
+    {
+      p->arena = NULL;
+      return 0;
+    }
+    memset(p->arena, 0, a.used);
+    p->arena_bytes = a.used;
   }
-  ghistory = 0;
+  p->arena_layout = layout;
+  a.base = (char *)p->arena;
+  a.used = 0;
+  arena_place(p, layout, &a);
+  p->delay_head = p->delay_count = 0;
+  return 1;
 }
 
-uint8_t gshare_predict(uint32_t pc)
+// Free every table of 'p' at once; the scheme's pointers are left
+// dangling for its cleanup to clear
+static void arena_close(predictor_t *p)
 {
-  // get lower ghistoryBits of pc
-  uint32_t bht_entries = 1 << ghistoryBits;
-  uint32_t pc_lower_bits = pc & (bht_entries - 1);
-  uint32_t ghistory_lower_bits = ghistory & (bht_entries - 1);
-  uint32_t index = pc_lower_bits ^ ghistory_lower_bits;
-  switch (bht_gshare[index])
+  if (p->arena_mapped)
   {
-  case WN:
-    return NOTTAKEN;
-  case SN:
-    return NOTTAKEN;
-  case WT:
-    return TAKEN;
-  case ST:
-    return TAKEN;
-  default:
-    printf("Warning: Undefined state of entry in GSHARE BHT!\n");
-    return NOTTAKEN;
+    munmap(p->arena, p->arena_bytes);
+  }
+  else
+  {
+    free(p->arena);
   }
+  p->arena = NULL;
+  p->arena_bytes = 0;
+  p->arena_mapped = 0;
 }
 
-void train_gshare(uint32_t pc, uint8_t outcome)
+static void tage_layout(predictor_t *p, arena_t *a)
 {
-  // get lower ghistoryBits of pc
-  uint32_t bht_entries = 1 << ghistoryBits;
-  uint32_t pc_lower_bits = pc & (bht_entries - 1);
-  uint32_t ghistory_lower_bits = ghistory & (bht_entries - 1);
-  uint32_t index = pc_lower_bits ^ ghistory_lower_bits;
-
-  // Update state of entry in bht based on outcome
-  switch (bht_gshare[index])
+  if (p->cfg.unbounded)
   {
-  case WN:
-    bht_gshare[index] = (outcome == TAKEN) ? WT : SN;
-    break;
-  case SN:
-    bht_gshare[index] = (outcome == TAKEN) ? WN : SN;
-    break;
-  case WT:
-    bht_gshare[index] = (outcome == TAKEN) ? ST : WN;
-    break;
-  case ST:
-    bht_gshare[index] = (outcome == TAKEN) ? ST : WT;
-    break;
-  default:
-    printf("Warning: Undefined state of entry in GSHARE BHT!\n");
-    break;
+    // the tables are in p->ub, only the history is here
+    p->tage_hbuf = (uint8_t *)arena_take(a, TAGE_HIST_BUF);
+    return;
+  }
+  size_t entries = (size_t)p->cfg.tageNumTagged << p->cfg.tageTaggedBits;
+  p->tage_bimodal = (uint8_t *)arena_take(a, (size_t)1 << p->cfg.tageBimodalBits);
+  p->tage_tag = (uint16_t *)arena_take(a, entries * TAGE_ENTRY_BYTES);
+  p->tage_ctr = a->base ? (uint8_t *)(p->tage_tag + entries) : NULL;
+  p->tage_u = a->base ? p->tage_ctr + entries : NULL;
+  p->tage_hbuf = (uint8_t *)arena_take(a, TAGE_HIST_BUF);
+  p->tage_sc = p->cfg.tageSC ? (int8_t *)arena_take(a, (size_t)TAGE_SC_TABLES << TAGE_SC_BITS) : NULL;
+  p->tage_filter = p->cfg.tageFilter ? (uint16_t *)arena_take(a, sizeof(uint16_t) << TAGE_FILTER_BITS) : NULL;
+}
+
+int init_tage(predictor_t *p)
+{
+  // every table in the arena, zeroed: the bimodal counters weakly
+  // taken (WT), the tags invalid, the tagged counters TAGE_CTR_INIT and
+  // the useful counters TAGE_U_INIT, each stored XOR that value
+  if (!arena_open(p, tage_layout)) return 0;
+
+  // history buffer and folded registers, all outcomes not taken
+  memset(&p->tage_hist, 0, sizeof(p->tage_hist));
+  for (int t = 0; t < p->cfg.tageNumTagged; ++t) {
+    int len = p->cfg.tageHistLengths[t];
+    p->tage_folds[t].len = len;
+    p->tage_folds[t].out_idx = len % p->cfg.tageTaggedBits;
+    p->tage_folds[t].out_tag0 = len % tage_tag_bits<tage_runtime>(p);
+    p->tage_folds[t].out_tag1 = len % tage_tag1_bits<tage_runtime>(p);
   }
+  // each instance has its own generator, started from the seed mixed
+  // by one splitmix64 step so nearby seeds give unrelated sequences
+  uint64_t z = (uint64_t)(uint32_t)p->cfg.tageSeed + 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z ^= z >> 31;
+  p->tage_rng = z ? z : 1;
+
+  // optional stages: every loop entry free, corrector counters at 0
+  memset(&p->tage_loop, 0, sizeof(p->tage_loop));
+  memset(p->tage_loop.tag, 0xFF, sizeof(p->tage_loop.tag));
+  p->tage_sc_thresh = TAGE_SC_THRESH;
+  p->tage_sc_tc = 0;
 
-  // Update history register
-  ghistory = ((ghistory << 1) | outcome);
+  // usefulness aging: every chunk once per period
+  size_t chunks = ((size_t)p->cfg.tageNumTagged << p->cfg.tageTaggedBits) / TAGE_U_AGE_CHUNK;
+  uint64_t every = p->cfg.tageUReset ? (1ULL << p->cfg.tageUReset) / chunks : 0;
+  p->tage_u_age_every = every > 1 ? (uint32_t)every : 1;
+  p->tage_u_age_count = p->tage_u_age_every;
+  p->tage_u_age_pos = 0;
+  return 1;
 }
 
-void cleanup_gshare()
+// xorshift64*, returning the high half of the product
+static inline uint32_t tage_random(predictor_t *p)
 {
-  free(bht_gshare);
+  uint64_t x = p->tage_rng;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  p->tage_rng = x;
+  return (uint32_t)((x * 0x2545f4914f6cdd1dULL) >> 32);
 }
 
-void init_predictor()
+// Automata of the bimodal and tagged counters, read and stepped through
+// their tables; a rule of the same number of states swaps either one
+typedef ctr_saturating<2> tage_bimodal_rule;
+typedef ctr_saturating<TAGE_CTR_WIDTH> tage_ctr_rule;
+
+// Table lookups shared by prediction and training
+typedef struct {
+  uint32_t filter_idx;        // filter stage: the entry, the pc's tag and
+  uint16_t filter_tag;        // whether the entry predicted alone
+  uint8_t filtered;
+  uint32_t bim_idx;
+  uint8_t bim_pred;
+  uint32_t idx[TAGE_MAX_TAGGED];
+  uint16_t tag[TAGE_MAX_TAGGED];
+  int provider;
+  int alt;
+  uint8_t provider_pred;
+  uint8_t alt_pred;
+  uint8_t tage_pred;          // provider, or bimodal without one
+  uint8_t pred;               // after the optional stages
+  uint16_t loop_tag;          // loop stage: the pc hash, the entry hit or -1,
+  int loop;                   // its prediction and whether it is confident
+  uint8_t loop_pred;
+  uint8_t loop_valid;
+  uint8_t sc_in;              // corrector stage: the prediction it corrects,
+  uint32_t sc_idx[TAGE_SC_TABLES]; // the counters read and their sum
+  int sc_sum;
+} tage_lookup_t;
+
+// Loop predictor entry of 'tag', or -1. The tags are unique, so the
+// first of the two compare masks' set bits is the entry
+static_assert(TAGE_LOOP_ENTRIES == 16, "tage_loop_find compares two vectors of 8 tags");
+static inline int tage_loop_find(const tage_loop_t *l, uint16_t tag)
 {
-  switch (bpType)
-  {
-  case STATIC:
-    break;
-  case GSHARE:
-    init_gshare();
-    break;
-  case TOURNAMENT:
-    init_tournament();
-    break;
-  case CUSTOM:
-  init_tage();
-    break;
-  default:
-    break;
-  }
+  __m128i t = _mm_set1_epi16((short)tag);
+  __m128i lo = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)l->tag), t);
+  __m128i hi = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(l->tag + 8)), t);
+  uint32_t m = (uint32_t)_mm_movemask_epi8(lo) | ((uint32_t)_mm_movemask_epi8(hi) << 16);
+  return m ? __builtin_ctz(m) >> 1 : -1;
 }
 
-// Make a prediction for conditional branch instruction at PC 'pc'
-// Returning TAKEN indicates a prediction of taken; returning NOTTAKEN
-// indicates a prediction of not taken
-//
-uint32_t make_prediction(uint32_t pc, uint32_t target, uint32_t direct)
+// Loop stage: a confident entry overrides the TAGE prediction while
+// the chooser favours it
+static inline void tage_loop_lookup(const predictor_t *p, uint32_t pc, tage_lookup_t *lk)
 {
+  const tage_loop_t *l = &p->tage_loop;
+  lk->loop_tag = (uint16_t)((pc ^ (pc >> 15)) & 0x7FFF);
+  lk->loop = tage_loop_find(l, lk->loop_tag);
+  lk->loop_valid = 0;
+  if (lk->loop < 0) return;
+  int e = lk->loop;
+  lk->loop_pred = l->cur[e] == l->past[e] ? !l->dir[e] : l->dir[e];
+  lk->loop_valid = l->conf[e] == TAGE_LOOP_CONF_MAX;
+  if (lk->loop_valid && l->use >= 0) lk->pred = lk->loop_pred;
+}
 
-  // Make a prediction based on the bpType
-  switch (bpType)
-  {
-  case STATIC:
-    return TAKEN;
-  case GSHARE:
-    return gshare_predict(pc);
-  case TOURNAMENT:
-    return tournament_predict(pc);
-  case CUSTOM:
-    return tage_predict(pc);
-  default:
-    break;
+// Corrector table 't' entry of 'pc' under the outcomes 'ghist', less
+// the bit of the prediction it corrects
+static inline uint32_t tage_sc_hash(uint32_t pc, uint64_t ghist, int t)
+{
+  uint64_t mask = tage_sc_lengths[t] ? ~0ULL >> (64 - tage_sc_lengths[t]) : 0;
+  uint32_t h = (uint32_t)(((ghist & mask) * 0x9e3779b97f4a7c15ULL) >> 40);
+  return ((uint32_t)t << TAGE_SC_BITS) | (((pc ^ (pc >> TAGE_SC_BITS) ^ h) << 1) & ((1u << TAGE_SC_BITS) - 1));
+}
+
+// Corrector stage: GEHL tables indexed by the pc, the prediction so far
+// and the global history of each length, summed with that prediction
+// weighted by its counter's confidence. The sum's sign is the result.
+// 'base' holds the entries of tage_sc_hash
+static inline void tage_sc_read(const predictor_t *p, const uint32_t *base, tage_lookup_t *lk)
+{
+  int conf;
+  if (lk->pred != lk->tage_pred) conf = 7;
+  else if (lk->provider != -1) conf = abs(2 * (p->tage_ctr[lk->idx[lk->provider]] ^ TAGE_CTR_INIT) - 7);
+  else conf = abs(2 * (p->tage_bimodal[lk->bim_idx] ^ WT) - 3);
+  lk->sc_in = lk->pred;
+  int sum = (conf + 1) * TAGE_SC_WEIGHT;
+  if (!lk->sc_in) sum = -sum;
+#pragma GCC unroll 8
+  for (int t = 0; t < TAGE_SC_TABLES; t++) {
+    lk->sc_idx[t] = base[t] | lk->sc_in;
+    sum += 2 * p->tage_sc[lk->sc_idx[t]] + 1;
   }
+  lk->sc_sum = sum;
+  lk->pred = sum >= 0;
+}
 
-  // If there is not a compatable bpType then return NOTTAKEN
-  return NOTTAKEN;
+static inline void tage_sc_lookup(const predictor_t *p, uint32_t pc, const tage_hist_t *hist, tage_lookup_t *lk)
+{
+  uint32_t base[TAGE_SC_TABLES];
+#pragma GCC unroll 8
+  for (int t = 0; t < TAGE_SC_TABLES; t++) base[t] = tage_sc_hash(pc, hist->ghist, t);
+  tage_sc_read(p, base, lk);
 }
 
-// Train the predictor the last executed branch at PC 'pc' and with
-// outcome 'outcome' (true indicates that the branch was taken, false
-// indicates that the branch was not taken)
+// Filter stage: an entry of the pc's tag that saw TAGE_FILTER_RUN
+// outcomes in a row one way predicts that way, with no other table read
+static inline uint8_t tage_filter_lookup(const predictor_t *p, uint32_t pc, tage_lookup_t *lk)
+{
+  lk->filter_idx = pc & ((1u << TAGE_FILTER_BITS) - 1);
+  lk->filter_tag = (uint16_t)(((pc >> TAGE_FILTER_BITS) ^ (pc >> 18)) & 0xFF);
+  uint16_t e = p->tage_filter[lk->filter_idx];
+  lk->filtered = (e >> 8) == lk->filter_tag && (e & 0x7F) == TAGE_FILTER_RUN;
+  lk->pred = (e >> 7) & 1;
+  return lk->filtered;
+}
+
+// With tageWays above 1 a table is sets of that many ways, the index
+// with its low bits cleared being the first, so the tags of a set are
+// at most 16 bytes of one cache line, and its counters 8 bytes of
+// theirs. The tag decides the way, and keeps the index bits the set
+// drops above its own.
 //
+// Returns the way of the set at 'base' holding 'tag', by one SSE2
+// compare of the whole set, or -1
+//
+template <class G>
+static inline int tage_match_way(const predictor_t *p, uint32_t base, uint16_t tag) {
+  // a set of fewer ways reads past its end, but never past the arena:
+  // the counters follow the tags
+  __m128i tags = _mm_loadu_si128((const __m128i *)(p->tage_tag + base));
+  int hits = _mm_movemask_epi8(_mm_cmpeq_epi16(tags, _mm_set1_epi16((short)tag))) & ((1 << (2 * G::ways(p))) - 1);
+  return hits ? __builtin_ctz(hits) >> 1 : -1;
+}
 
-void train_predictor(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+// Returns the way of the set at 'base' to allocate for 'tag': from the
+// way the tag picks on, the first whose useful counter is 0, found by
+// a zero byte test of all its counters in one word, or when none is
+// the way the tag picks. Starting there keeps the branches of a set
+// in different ways while they are all 0
+template <class G>
+static inline int tage_victim_way(const predictor_t *p, uint32_t base, uint16_t tag) {
+  const int ways = G::ways(p);
+  int start = tag & (ways - 1);
+  uint64_t u;
+  memcpy(&u, p->tage_u + base, sizeof(u));  // the history buffer follows the counters
+  u ^= TAGE_U_INIT * 0x0101010101010101ULL;
+  uint64_t zero = (u - 0x0101010101010101ULL) & ~u & 0x8080808080808080ULL;
+  // a bit per way, twice so the search wraps around
+  uint32_t free = (uint32_t)(((zero >> 7) * 0x0102040810204080ULL) >> 56) & ((1u << ways) - 1);
+  free = (free | free << ways) >> start;
+  return free ? (start + __builtin_ctz(free)) & (ways - 1) : start;
+}
+
+// Index and tag of 'pc' in tagged table 't' under 'hist'. With ways
+// the index bits the set drops go above the tag, so no two entries
+// alias that would not direct mapped, and the index is the set's first
+template <class G>
+static inline void tage_hash_table(const predictor_t *p, uint32_t pc, const tage_hist_t *hist, int t,
+                                   uint32_t *idx, uint16_t *tag)
 {
-  if (condition)
-  {
-    switch (bpType)
-    {
-    case STATIC:
+  *idx = tage_index<G>(p, pc, hist, t);
+  *tag = tage_tag<G>(p, pc, hist, t);
+  if (G::ways(p) > 1) {
+    uint32_t low = *idx & (G::ways(p) - 1);
+    *tag ^= (uint16_t)(low << tage_tag_bits<G>(p));
+    *idx -= low;
+  }
+}
+
+// Clear the fields only the filter and loop stages fill, which
+// tage_update reads under the same flags. Zeroing the whole lookup,
+// 184 bytes, took U3 --custom from 320 to 430 ms
+static inline void tage_lookup_start(tage_lookup_t *lk)
+{
+  lk->filtered = 0;
+  lk->filter_idx = 0;
+  lk->filter_tag = 0;
+  lk->loop = -1;
+  lk->loop_valid = 0;
+}
+
+// Start a lookup at the bimodal table, the prediction without a hit
+template <class G>
+static inline void tage_lookup_bimodal(const predictor_t *p, uint32_t pc, tage_lookup_t *lk)
+{
+  lk->bim_idx = pc & ((1u << G::bimodal_bits(p)) - 1);
+  lk->bim_pred = ctr_automaton_predict<tage_bimodal_rule, WT>(p->tage_bimodal[lk->bim_idx]);
+  lk->provider = -1;
+  lk->alt = -1;
+  lk->provider_pred = lk->bim_pred;
+  lk->alt_pred = lk->bim_pred;
+}
+
+// Read table 't' at lk->idx[t] for lk->tag[t], the first hit from the
+// longest history being the provider and the next the alternate. A
+// miss leaves idx at its set
+template <class G>
+static inline void tage_probe(const predictor_t *p, tage_lookup_t *lk, int t)
+{
+  int hit;
+  if (G::ways(p) > 1) {
+    int way = tage_match_way<G>(p, lk->idx[t], lk->tag[t]);
+    hit = way >= 0;
+    lk->idx[t] += hit ? way : 0;
+  } else {
+    hit = p->tage_tag[lk->idx[t]] == lk->tag[t];
+  }
+  if (hit) {
+    uint8_t pred = ctr_automaton_predict<tage_ctr_rule, TAGE_CTR_INIT>(p->tage_ctr[lk->idx[t]]);
+    if (lk->provider == -1) {
+      lk->provider = t;
+      lk->provider_pred = pred;
+    } else if (lk->alt == -1) {
+      lk->alt = t;
+      lk->alt_pred = pred;
+    }
+  }
+}
+
+template <class G>
+static inline void tage_lookup(const predictor_t *p, uint32_t pc, const tage_hist_t *hist, tage_lookup_t *lk)
+{
+  tage_lookup_start(lk);
+  if (p->cfg.tageFilter && tage_filter_lookup(p, pc, lk)) return;
+  tage_lookup_bimodal<G>(p, pc, lk);
+
+  // search from longest history (highest table index) to shortest.
+  // The compares stay scalar and branchy: hits are well predicted, so
+  // the tag loads of all tables overlap. An AVX2 gather of the tags with
+  // the provider picked from a match mask measured 45% slower with 7
+  // tables and 40% slower with 16 (custom on U4, 632 against 434 ms and
+  // 1269 against 891 ms). A branch-free scalar mask was 9% and 25%
+  // slower (472 and 1115 ms). Hashing every table first in one
+  // vectorizable loop gained nothing either, with AVX-512 or without
+#pragma GCC unroll 16
+  for (int t = G::num_tagged(p) - 1; t >= 0; --t) {
+    tage_hash_table<G>(p, pc, hist, t, &lk->idx[t], &lk->tag[t]);
+    tage_probe<G>(p, lk, t);
+  }
+  lk->tage_pred = lk->provider_pred;
+  lk->pred = lk->tage_pred;
+  if (p->cfg.tageLoop) tage_loop_lookup(p, pc, lk);
+  if (p->cfg.tageSC) tage_sc_lookup(p, pc, hist, lk);
+}
+
+// A conditional branch with every hash of its lookup done, by the
+// first stage of a predictor_pipeline_t
+typedef struct {
+  uint32_t pc;
+  uint32_t index;                  // of its record in the batch
+  uint8_t taken;
+  uint16_t tag[TAGE_MAX_TAGGED];   // as tage_hash_table left them
+  uint32_t idx[TAGE_MAX_TAGGED];
+  uint32_t sc_base[TAGE_SC_TABLES]; // with tageSC, of tage_sc_hash
+} tage_hashed_t;
+
+// tage_lookup of a branch hashed ahead, reading the tables only
+template <class G>
+static inline void tage_lookup_hashed(const predictor_t *p, const tage_hashed_t *h, tage_lookup_t *lk)
+{
+  tage_lookup_start(lk);
+  if (p->cfg.tageFilter && tage_filter_lookup(p, h->pc, lk)) return;
+  tage_lookup_bimodal<G>(p, h->pc, lk);
+#pragma GCC unroll 16
+  for (int t = G::num_tagged(p) - 1; t >= 0; --t) {
+    lk->idx[t] = h->idx[t];
+    lk->tag[t] = h->tag[t];
+    tage_probe<G>(p, lk, t);
+  }
+  lk->tage_pred = lk->provider_pred;
+  lk->pred = lk->tage_pred;
+  if (p->cfg.tageLoop) tage_loop_lookup(p, h->pc, lk);
+  if (p->cfg.tageSC) tage_sc_read(p, h->sc_base, lk);
+}
+
+// Free loop entry 'e'
+static inline void tage_loop_free(tage_loop_t *l, int e)
+{
+  l->tag[e] = 0xFFFF;
+  l->past[e] = l->cur[e] = 0;
+  l->conf[e] = l->age[e] = 0;
+}
+
+// Train the loop stage. A miss that TAGE mispredicted may be a loop
+// exit and takes a random entry once its age has run out; a hit counts
+// the run and checks its trip count against the last one's
+static inline void tage_loop_update(predictor_t *p, const tage_lookup_t *lk, uint8_t outcome)
+{
+  tage_loop_t *l = &p->tage_loop;
+  int e = lk->loop;
+  if (e < 0) {
+    if (lk->tage_pred != outcome) {
+      int v = tage_random(p) & (TAGE_LOOP_ENTRIES - 1);
+      if (l->age[v]) {
+        l->age[v]--;
+      } else {
+        tage_loop_free(l, v);
+        l->tag[v] = lk->loop_tag;
+        l->dir[v] = !outcome;
+        l->age[v] = TAGE_LOOP_AGE_MAX;
+      }
+    }
+    return;
+  }
+  if (lk->loop_valid) {
+    if (lk->loop_pred != lk->tage_pred) {
+      int right = lk->loop_pred == outcome;
+      if (right ? l->use < TAGE_LOOP_USE_MAX : l->use > -TAGE_LOOP_USE_MAX - 1) l->use += right ? 1 : -1;
+      if (right && l->age[e] < TAGE_LOOP_AGE_MAX) l->age[e]++;
+    }
+    if (lk->loop_pred != outcome) {
+      tage_loop_free(l, e);
+      return;
+    }
+  }
+  if (outcome == l->dir[e]) {
+    if (++l->cur[e] == 0xFFFF) tage_loop_free(l, e);
+  } else {
+    if (l->cur[e] == l->past[e]) {
+      if (l->conf[e] < TAGE_LOOP_CONF_MAX) l->conf[e]++;
+    } else {
+      l->past[e] = l->cur[e];
+      l->conf[e] = 0;
+    }
+    l->cur[e] = 0;
+  }
+}
+
+// Train the corrector when it was wrong or not confident, adapting the
+// threshold so both happen about as often
+static inline void tage_sc_update(predictor_t *p, const tage_lookup_t *lk, uint8_t outcome)
+{
+  int sum = lk->sc_sum;
+  uint8_t pred = sum >= 0;
+  if (pred != outcome) {
+    if (++p->tage_sc_tc >= 32) { p->tage_sc_thresh++; p->tage_sc_tc = 0; }
+  } else if (abs(sum) < p->tage_sc_thresh) {
+    if (--p->tage_sc_tc <= -32) { if (p->tage_sc_thresh > 1) p->tage_sc_thresh--; p->tage_sc_tc = 0; }
+  } else {
+    return;
+  }
+#pragma GCC unroll 8
+  for (int t = 0; t < TAGE_SC_TABLES; t++) {
+    int8_t *c = &p->tage_sc[lk->sc_idx[t]];
+    if (outcome ? *c < TAGE_SC_CTR_MAX : *c > -TAGE_SC_CTR_MAX - 1) *c += outcome ? 1 : -1;
+  }
+}
+
+// Graceful usefulness reset, spread over the period: every
+// tage_u_age_every branches halve the next TAGE_U_AGE_CHUNK useful
+// counters, so each is halved once per 1 << tageUReset branches with
+// no pass over whole tables at once. The counters start at 0 and are
+// stored unencoded, so a byte shift is the halving
+static_assert(TAGE_U_INIT == 0 && TAGE_U_AGE_CHUNK % 16 == 0, "aging shifts the stored counters, 16 at a time");
+static inline void tage_u_age(predictor_t *p)
+{
+  if (--p->tage_u_age_count) return;
+  p->tage_u_age_count = p->tage_u_age_every;
+  uint8_t *u = p->tage_u + p->tage_u_age_pos;
+  const __m128i low = _mm_set1_epi8(0x7F);
+#pragma GCC unroll 4
+  for (int b = 0; b < TAGE_U_AGE_CHUNK; b += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(u + b));
+    _mm_storeu_si128((__m128i *)(u + b), _mm_and_si128(_mm_srli_epi16(v, 1), low));
+  }
+  p->tage_u_age_pos += TAGE_U_AGE_CHUNK;
+  if (p->tage_u_age_pos == (uint32_t)p->cfg.tageNumTagged << p->cfg.tageTaggedBits) p->tage_u_age_pos = 0;
+}
+
+// Train the filter: a branch going its entry's way lengthens the run,
+// any other outcome or branch starts the entry over, so a filtered
+// branch that changes direction goes back to the full lookup
+static inline void tage_filter_update(predictor_t *p, const tage_lookup_t *lk, uint8_t outcome)
+{
+  uint16_t *e = &p->tage_filter[lk->filter_idx];
+  p->tage_filtered += lk->filtered;
+  p->tage_filter_checks++;
+  if ((*e >> 8) != lk->filter_tag || ((*e >> 7) & 1) != outcome) {
+    *e = (uint16_t)(lk->filter_tag << 8 | outcome << 7 | 1);
+  } else if ((*e & 0x7F) < TAGE_FILTER_RUN) {
+    (*e)++;
+  }
+}
+
+// Allocate for a branch no table provided: the candidate of every
+// table, the way tage_victim_way picks in a set, is gathered with its
+// useful counter, one SSE2 compare finds those at 0, and the first of
+// them from table 0 up takes the branch. Without tageUReset each one
+// passed over before it decays with probability 1/64, drawing the
+// random numbers in table order as the walk one entry at a time did
+static_assert(TAGE_MAX_TAGGED <= 16, "the candidates' useful counters fill one SSE2 register");
+template <class G>
+static inline void tage_allocate(predictor_t *p, const tage_lookup_t *lk, uint8_t outcome)
+{
+  const int n = G::num_tagged(p);
+  uint32_t ent[TAGE_MAX_TAGGED];
+  alignas(16) uint8_t u[16];
+  memset(u, 0xFF, sizeof(u));
+#pragma GCC unroll 16
+  for (int t = 0; t < n; ++t) {
+    uint32_t e = lk->idx[t];
+    if (G::ways(p) > 1) e += tage_victim_way<G>(p, e, lk->tag[t]);
+    ent[t] = e;
+    u[t] = p->tage_u[e];
+  }
+  uint32_t zero = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i *)u), _mm_setzero_si128()));
+  // the lanes from n on are 0xFF, but say so for -Wmaybe-uninitialized
+  int first = zero ? __builtin_ctz(zero) : n;
+  first = first < n ? first : n;
+  if (!p->cfg.tageUReset) {
+    // decay usefulness slowly, the passed counters are all above 0
+    for (int t = 0; t < first; ++t) p->tage_u[ent[t]] -= (tage_random(p) & 0x3F) == 0;
+  }
+  if (first < n) {
+    uint32_t e = ent[first];
+    // allocate (TAGE_CTR_INIT +- 1 stays within 0..7)
+    BP_OCC(bp_occ_allocate(&p->occ, 1 + first, e & ((1u << G::tagged_bits(p)) - 1), p->tage_tag[e] != 0));
+    p->tage_tag[e] = lk->tag[first];
+    p->tage_ctr[e] = (TAGE_CTR_INIT + (outcome ? 1 : -1)) ^ TAGE_CTR_INIT; // bias toward outcome
+  }
+}
+
+// Update the entries found by tage_lookup with the outcome
+template <class G>
+static inline void tage_update(predictor_t *p, const tage_lookup_t *lk, uint8_t outcome)
+{
+  if (p->cfg.tageUReset) tage_u_age(p);
+  if (p->cfg.tageFilter) tage_filter_update(p, lk, outcome);
+  // the lookup stopped at the filter, and read nothing else
+  if (lk->filtered) return;
+  int provider = lk->provider;
+  int alt = lk->alt;
+  uint32_t bim_idx = lk->bim_idx;
+
+  BP_OCC(p->occ.lookups++);
+  BP_OCC(bp_occ_touch(&p->occ, BP_OCC_TAGE_BIMODAL, bim_idx));
+  // if provider exists, update its counter
+  if (provider != -1) {
+    uint32_t e = lk->idx[provider];
+    BP_OCC(bp_occ_hit(&p->occ, 1 + provider));
+    // update 3-bit saturating-like counter: keep in 0..7
+    ctr_automaton_update<tage_ctr_rule, TAGE_CTR_INIT>(&p->tage_ctr[e], outcome);
+    // update useful bit: if provider predicted correctly and alternate predicted incorrectly, increase u
+    if (lk->provider_pred == outcome && alt != -1 && lk->alt_pred != outcome) {
+      ctr_update<2>(&p->tage_u[e], TAKEN);
+    }
+    // if provider wrong but alt correct, decrement u
+    if (lk->provider_pred != outcome && alt != -1 && lk->alt_pred == outcome) {
+      ctr_update<2>(&p->tage_u[e], NOTTAKEN);
+    }
+  } else {
+    // no provider: update bimodal only for now
+    ctr_automaton_update<tage_bimodal_rule, WT>(&p->tage_bimodal[bim_idx], outcome);
+  }
+  // If provider did not exist, allocate in a low-utility entry (simple allocation)
+  if (provider == -1) tage_allocate<G>(p, lk, outcome);
+
+  // If provider existed, also update alternate or bimodal sometimes (helpful fallback)
+  if (provider != -1 && alt == -1) {
+    // update bimodal as alternate
+    ctr_automaton_update<tage_bimodal_rule, WT>(&p->tage_bimodal[bim_idx], outcome);
+  }
+
+  if (p->cfg.tageLoop) tage_loop_update(p, lk, outcome);
+  if (p->cfg.tageSC) tage_sc_update(p, lk, outcome);
+}
+
+// update global history: record the outcome and fold it into every
+// table's registers, dropping the outcome that ages past its length
+template <class G>
+static inline void tage_push_history(const predictor_t *p, tage_hist_t *hist, uint8_t outcome)
+{
+  const uint8_t *buf = p->tage_hbuf;
+  int index_bits = G::tagged_bits(p), tag_bits = tage_tag_bits<G>(p), tag1_bits = tage_tag1_bits<G>(p);
+  int num_tagged = G::num_tagged(p);
+  uint64_t pos = ++hist->pos;
+  outcome &= 1;
+  p->tage_hbuf[pos & (TAGE_HIST_BUF - 1)] = outcome;
+  hist->ghist = (hist->ghist << 1) | outcome;
+#pragma GCC unroll 16
+  for (int t = 0; t < num_tagged; ++t) {
+    tage_fold_t f = G::fold(p, t);
+    uint8_t out = buf[(pos - f.len) & (TAGE_HIST_BUF - 1)];
+    uint32_t idx = fold_push(hist->idx[t], outcome, out, f.out_idx, index_bits);
+    uint32_t tag0 = fold_push(hist->tag0[t], outcome, out, f.out_tag0, tag_bits);
+    uint32_t tag1 = fold_push(hist->tag1[t], outcome, out, f.out_tag1, tag1_bits);
+    hist->idx[t] = idx;
+    hist->tag0[t] = tag0;
+    hist->tag1[t] = tag1;
+  }
+}
+
+// Prefetch the entries tage_lookup will read for 'pc' under 'hist'
+template <class G>
+static inline void tage_prefetch(const predictor_t *p, uint32_t pc, const tage_hist_t *hist)
+{
+  __builtin_prefetch(&p->tage_bimodal[pc & ((1u << G::bimodal_bits(p)) - 1)], 1);
+  for (int t = 0; t < G::num_tagged(p); ++t) {
+    uint32_t e = tage_index<G>(p, pc, hist, t);
+    __builtin_prefetch(&p->tage_tag[e], 1);
+    __builtin_prefetch(&p->tage_ctr[e], 1);
+  }
+}
+
+// Hash the conditional branch 'pc' under 'hist' into 'h', for
+// tage_lookup_hashed, and advance 'hist' past its outcome
+template <class G>
+static inline void tage_hash_branch(const predictor_t *p, tage_hist_t *hist, uint32_t pc, uint8_t taken,
+                                    tage_hashed_t *h)
+{
+  h->pc = pc;
+  h->taken = taken;
+  for (int t = 0; t < G::num_tagged(p); t++) {
+    tage_hash_table<G>(p, pc, hist, t, &h->idx[t], &h->tag[t]);
+  }
+  if (p->cfg.tageSC) {
+#pragma GCC unroll 8
+    for (int t = 0; t < TAGE_SC_TABLES; t++) h->sc_base[t] = tage_sc_hash(pc, hist->ghist, t);
+  }
+  tage_push_history<G>(p, hist, taken);
+}
+
+// tage_prefetch of a hashed branch, from its indices
+template <class G>
+static inline void tage_prefetch_hashed(const predictor_t *p, const tage_hashed_t *h)
+{
+  __builtin_prefetch(&p->tage_bimodal[h->pc & ((1u << G::bimodal_bits(p)) - 1)], 1);
+  for (int t = 0; t < G::num_tagged(p); t++) {
+    __builtin_prefetch(&p->tage_tag[h->idx[t]], 1);
+    __builtin_prefetch(&p->tage_ctr[h->idx[t]], 1);
+  }
+}
+
+// cleanup
+void cleanup_tage(predictor_t *p)
+{
+  arena_close(p);
+  p->tage_bimodal = p->tage_hbuf = p->tage_ctr = p->tage_u = NULL;
+  p->tage_tag = NULL;
+  p->tage_sc = NULL;
+}
+
+// Tournament functions
+// Width of the local histories
+static inline int tournament_local_hist_bits(const predictor_config_t *cfg)
+{
+  return cfg->localHistBits ? cfg->localHistBits : cfg->lhtBits;
+}
+
+// tables with the counters packed and the local histories in the
+// narrowest entries that hold them
+static void tournament_layout(predictor_t *p, arena_t *a)
+{
+  size_t gpt_entries = 1UL << p->cfg.ghrBits;
+  local_engine_setup(&p->t_local, p->cfg.lhtBits, tournament_local_hist_bits(&p->cfg), p->cfg.localWays,
+                     p->cfg.localPatternBits);
+  p->t_local.table  = p->cfg.unbounded ? NULL : arena_take(a, local_bytes(&p->t_local));
+  p->t_localPred    = (ctr_word_t *)arena_take(a, ctr_words<3>(local_patterns(&p->t_local)) * sizeof(ctr_word_t));
+  p->t_global       = (ctr_word_t *)arena_take(a, ctr_words<4>(gpt_entries) * sizeof(ctr_word_t));
+}
+
+int init_tournament(predictor_t *p)
+{
+  if (!arena_open(p, tournament_layout)) {
+    return 0;
+  }
+  // the counters are stored XOR their initial values, see ctr_get
+
+  p->t_ghr = 0;
+  return 1;
+}
+
+// Words and fields found by the prediction and trained in place, so a
+// branch touches the local history, local counter and global entry
+// lines once each
+typedef struct {
+  BP_OCC(uint32_t pc;)
+  local_lookup_t local;
+  uint32_t local_index;       // of the local counter
+  ctr_word_t *local_word;
+  ctr_word_t *global_word;
+  uint8_t local_shift;
+  uint8_t global_shift;       // of the global counter, the chooser is T_CHOOSER_SHIFT above
+  uint8_t local_taken;
+  uint8_t global_taken;
+  uint8_t prefer_global;
+} tournament_lookup_t;
+
+// Point 'lk' at local counter 'local_index' and global entry
+// 'global_index'
+static inline void tournament_locate(const predictor_t *p, uint32_t local_index, uint32_t global_index,
+                                     tournament_lookup_t *lk)
+{
+  lk->local_word = &p->t_localPred[local_index / ctr_packing<3>::per_word];
+  lk->local_shift = local_index % ctr_packing<3>::per_word * ctr_packing<3>::field;
+  lk->global_word = &p->t_global[global_index / ctr_packing<4>::per_word];
+  lk->global_shift = global_index % ctr_packing<4>::per_word * ctr_packing<4>::field;
+}
+
+// The counters of the local history found in 'lk'
+static inline void tournament_lookup_counters(const predictor_t *p, uint32_t pc, uint64_t ghr, tournament_lookup_t *lk)
+{
+  uint32_t gpt_mask = (1u << p->cfg.ghrBits) - 1;
+
+  // local predictor indexed by local history, global predictor and
+  // chooser indexed by GHR, in one entry
+  lk->local_index = local_pattern(&p->t_local, pc, &lk->local);
+  tournament_locate(p, lk->local_index, ghr & gpt_mask, lk);
+  lk->local_taken = ctr_predict<3>(((*lk->local_word >> lk->local_shift) & T_LPT_COUNTER_MAX) ^ T_LPT_INIT);
+  uint8_t entry = (*lk->global_word >> lk->global_shift) ^ (T_GPT_INIT | T_CHOOSER_INIT << T_CHOOSER_SHIFT);
+  lk->global_taken = ctr_predict<2>(entry & T_GPT_COUNTER_MAX);
+  lk->prefer_global = ctr_predict<2>((entry >> T_CHOOSER_SHIFT) & T_CHOOSER_MAX);
+}
+
+static inline void tournament_lookup(const predictor_t *p, uint32_t pc, uint64_t ghr, tournament_lookup_t *lk)
+{
+  // index into local history table using low bits of PC 
+  BP_OCC(lk->pc = pc);
+  local_find(&p->t_local, pc, &lk->local);
+  tournament_lookup_counters(p, pc, ghr, lk);
+}
+
+static inline uint8_t tournament_choose(const predictor_t *p, const tournament_lookup_t *lk)
+{
+  // chooser selects: smaller values prefer local, larger prefer global
+  return lk->prefer_global ? lk->global_taken : lk->local_taken;
+}
+
+// Train the counters of 'lk', all but the local history
+static inline void tournament_train(predictor_t *p, const tournament_lookup_t *lk, uint8_t outcome)
+{
+  BP_OCC(bp_occ_touch(&p->occ, BP_OCC_T_LPT,
+                      (uint64_t)(lk->local_word - p->t_localPred) * ctr_packing<3>::per_word +
+                      lk->local_shift / ctr_packing<3>::field));
+  BP_OCC(bp_occ_alias(&p->occ, BP_OCC_T_GPT,
+                      (uint64_t)(lk->global_word - p->t_global) * ctr_packing<4>::per_word +
+                      lk->global_shift / ctr_packing<4>::field, lk->pc, lk->global_taken, outcome, T_GPT_INIT));
+  // update local predictor (3-bit saturating)
+  ctr_step_field<3, T_LPT_INIT>(lk->local_word, lk->local_shift, outcome);
+  // update global predictor (2-bit saturating)
+  ctr_step_field<2, T_GPT_INIT>(lk->global_word, lk->global_shift, outcome);
+  // update chooser only when local and global disagree
+  if (lk->local_taken != lk->global_taken) {
+    // if global was correct, move chooser towards global (increment)
+    if (lk->global_taken == outcome) {
+      ctr_step_field<2, T_CHOOSER_INIT>(lk->global_word, lk->global_shift + T_CHOOSER_SHIFT, TAKEN);
+    } else if (lk->local_taken == outcome) {
+      // if local was correct, move chooser towards local (decrement)
+      ctr_step_field<2, T_CHOOSER_INIT>(lk->global_word, lk->global_shift + T_CHOOSER_SHIFT, NOTTAKEN);
+    }
+  }
+}
+
+// Shift the outcome into the local history of 'lk'
+static inline void tournament_push_local(predictor_t *p, const tournament_lookup_t *lk, uint8_t outcome)
+{
+  BP_OCC(bp_occ_touch(&p->occ, BP_OCC_T_LHT, lk->local.slot + (lk->local.way < p->t_local.ways ? lk->local.way : 0)));
+  local_push(&p->t_local, &lk->local, outcome);
+}
+
+static inline void tournament_update(predictor_t *p, const tournament_lookup_t *lk, uint8_t outcome)
+{
+  tournament_train(p, lk, outcome);
+  // update local history (per-PC)
+  tournament_push_local(p, lk, outcome);
+}
+
+// update global history
+static inline uint64_t tournament_push_history(const predictor_t *p, uint64_t ghr, uint8_t outcome)
+{
+  return ((ghr << 1) | outcome) & ((1u << p->cfg.ghrBits) - 1);
+}
+
+void cleanup_tournament(predictor_t *p)
+{
+  arena_close(p);
+  p->t_local.table = NULL;
+  p->t_localPred = p->t_global = NULL;
+}
+
+// gshare functions
+static void gshare_layout(predictor_t *p, arena_t *a)
+{
+  size_t words = p->cfg.unbounded ? 0 : ctr_words<2>((size_t)1 << p->cfg.ghistoryBits);
+  p->bht_gshare = words ? (ctr_word_t *)arena_take(a, words * sizeof(ctr_word_t)) : NULL;
+}
+
+int init_gshare(predictor_t *p)
+{
+  // every counter weakly not taken (WN), stored XOR WN as zero
+  if (!arena_open(p, gshare_layout))
+  {
+    return 0;
+  }
+  p->ghistory = 0;
+  return 1;
+}
+
+void cleanup_gshare(predictor_t *p)
+{
+  arena_close(p);
+  p->bht_gshare = NULL;
+}
+
+// Perceptron functions
+static void perceptron_layout(predictor_t *p, arena_t *a)
+{
+  size_t rows = (size_t)1 << p->cfg.perceptronBits;
+  int features = p->cfg.perceptronFeatures;
+  int count = __builtin_popcount(features & ~PERCEPTRON_F_GLOBAL);
+  p->pc_weights = features & PERCEPTRON_F_GLOBAL ?
+                  (int8_t *)arena_take(a, PERCEPTRON_SEGMENTS * rows * PERCEPTRON_SEGMENT) : NULL;
+  p->pc_bias = (int8_t *)arena_take(a, rows);
+  p->pc_features = count ? (int8_t *)arena_take(a, count * rows) : NULL;
+  p->pc_local = features & PERCEPTRON_F_LOCAL ? (uint16_t *)arena_take(a, rows * sizeof(uint16_t)) : NULL;
+}
+
+// Every weight starts at 0, as the arena does
+//
+// Returns True if Successful
+//
+int init_perceptron(predictor_t *p)
+{
+  if (!arena_open(p, perceptron_layout))
+  {
+    return 0;
+  }
+  int features = p->cfg.perceptronFeatures;
+  int inputs = (features & PERCEPTRON_F_GLOBAL ? PERCEPTRON_SEGMENTS * PERCEPTRON_SEGMENT : 0) +
+               __builtin_popcount(features & ~PERCEPTRON_F_GLOBAL) + 1;
+  p->pc_ghist = 0;
+  memset(&p->pc_regs, 0, sizeof(p->pc_regs));
+  p->pc_depth = 0;
+  p->pc_theta = (int)(1.93 * inputs + 14);
+  return 1;
+}
+
+// The weights and inputs of one prediction, kept for its training
+typedef struct {
+  int8_t *bias;
+  int8_t *rows[PERCEPTRON_SEGMENTS];
+  __m128i taken[PERCEPTRON_SEGMENTS];     // 0xFF for each taken outcome
+  __m128i w[PERCEPTRON_SEGMENTS];         // the rows as loaded
+  int sum;
+} perceptron_lookup_t;
+
+// 0xFF in byte i of taken[s] for each set bit i of segment s of 'hist',
+// spreading its bytes with unpacks from a single move
+static_assert(PERCEPTRON_SEGMENTS * PERCEPTRON_SEGMENT == 64 && PERCEPTRON_SEGMENT == 16,
+              "perceptron_expand spreads one 64-bit history over 16-byte segments");
+static inline void perceptron_expand(uint64_t hist, __m128i *taken)
+{
+  const __m128i select = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+  __m128i v = _mm_cvtsi64_si128((long long)hist);
+  v = _mm_unpacklo_epi8(v, v);
+  __m128i lo = _mm_unpacklo_epi16(v, v);
+  __m128i hi = _mm_unpackhi_epi16(v, v);
+  taken[0] = _mm_cmpeq_epi8(_mm_and_si128(_mm_unpacklo_epi32(lo, lo), select), select);
+  taken[1] = _mm_cmpeq_epi8(_mm_and_si128(_mm_unpackhi_epi32(lo, lo), select), select);
+  taken[2] = _mm_cmpeq_epi8(_mm_and_si128(_mm_unpacklo_epi32(hi, hi), select), select);
+  taken[3] = _mm_cmpeq_epi8(_mm_and_si128(_mm_unpackhi_epi32(hi, hi), select), select);
+}
+
+// The output is the bias plus, for every outcome, its weight if it was
+// taken and minus it if not. The rows are negated where taken, summed
+// with psadbw after an offset of 128 that makes them unsigned, and the
+// total is negated back
+static inline void perceptron_lookup(const predictor_t *p, uint32_t pc, uint64_t hist, perceptron_lookup_t *lk)
+{
+  const __m128i offset = _mm_set1_epi8(-128);
+  __m128i acc = _mm_setzero_si128();
+  lk->bias = &p->pc_bias[pc & ((1u << p->cfg.perceptronBits) - 1)];
+  perceptron_expand(hist, lk->taken);
+#pragma GCC unroll 4
+  for (int seg = 0; seg < PERCEPTRON_SEGMENTS; seg++)
+  {
+    lk->rows[seg] = perceptron_weights(p, seg, perceptron_row(p, pc, hist, seg));
+    __m128i w = lk->w[seg] = _mm_load_si128((const __m128i *)lk->rows[seg]);
+    __m128i negated = _mm_sub_epi8(_mm_xor_si128(w, lk->taken[seg]), lk->taken[seg]);
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_xor_si128(negated, offset), _mm_setzero_si128()));
+  }
+  acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+  lk->sum = *lk->bias - (_mm_cvtsi128_si32(acc) - PERCEPTRON_SEGMENTS * PERCEPTRON_SEGMENT * 128);
+}
+
+// Step the bias and, with 'segments', every weight of the rows toward
+// agreeing with 'outcome', saturating at +-PERCEPTRON_WEIGHT_MAX
+static inline void perceptron_step(const perceptron_lookup_t *lk, uint8_t outcome, int segments)
+{
+  int bias = *lk->bias + (outcome ? 1 : -1);
+  if (bias >= -PERCEPTRON_WEIGHT_MAX && bias <= PERCEPTRON_WEIGHT_MAX)
+  {
+    *lk->bias = bias;
+  }
+  if (!segments)
+  {
+    return;
+  }
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i lowest = _mm_set1_epi8(-128);
+  const __m128i flip = _mm_set1_epi8(outcome ? 0 : -1);
+#pragma GCC unroll 4
+  for (int seg = 0; seg < PERCEPTRON_SEGMENTS; seg++)
+  {
+    // +1 where the outcome agrees with the branch, -1 elsewhere
+    __m128i agree = _mm_xor_si128(lk->taken[seg], flip);
+    __m128i step = _mm_sub_epi8(_mm_and_si128(agree, _mm_set1_epi8(2)), one);
+    __m128i w = _mm_adds_epi8(lk->w[seg], step);
+    w = _mm_sub_epi8(w, _mm_cmpeq_epi8(w, lowest));
+    _mm_store_si128((__m128i *)lk->rows[seg], w);
+  }
+}
+
+// Train when mispredicted or not confident
+static inline void perceptron_update(predictor_t *p, const perceptron_lookup_t *lk, uint8_t outcome)
+{
+  BP_OCC(bp_occ_touch(&p->occ, BP_OCC_PERCEPTRON_BIAS, lk->bias - p->pc_bias));
+  uint8_t pred = lk->sum >= 0;
+  if (pred == outcome && (lk->sum > PERCEPTRON_THETA || lk->sum < -PERCEPTRON_THETA))
+  {
+    return;
+  }
+  perceptron_step(lk, outcome, 1);
+}
+
+// A prediction with perceptronFeatures: the segments, when selected,
+// and one weight of each other feature
+typedef struct {
+  perceptron_lookup_t g;
+  int8_t *w[PERCEPTRON_FEATURES - 1];
+  int count;
+  int sum;
+} perceptron_mp_lookup_t;
+
+// Rows of the feature tables but the global one for a conditional
+// branch at 'pc', from the registers of 'p', into 'rows'
+static inline void perceptron_feature_rows(const predictor_t *p, uint32_t pc, uint32_t *rows)
+{
+  uint32_t mask = (1u << p->cfg.perceptronBits) - 1;
+  uint32_t local = p->pc_local ? p->pc_local[pc & mask] : 0;
+  int s = 0;
+  for (int m = p->cfg.perceptronFeatures & ~PERCEPTRON_F_GLOBAL; m; m &= m - 1)
+  {
+    int f = m & -m;
+    rows[s++] = perceptron_feature_row(mask, pc, perceptron_feature_value(f, p->pc_ghist, &p->pc_regs, p->pc_depth,
+                                                                         local), f);
+  }
+}
+
+// The output is the bias, the segments' part when selected and the
+// weight of each other feature at its row of 'rows'
+static inline void perceptron_mp_lookup(const predictor_t *p, uint32_t pc, uint64_t hist, const uint32_t *rows,
+                                        perceptron_mp_lookup_t *lk)
+{
+  int features = p->cfg.perceptronFeatures;
+  if (features & PERCEPTRON_F_GLOBAL)
+  {
+    perceptron_lookup(p, pc, hist, &lk->g);
+  }
+  else
+  {
+    lk->g.bias = &p->pc_bias[pc & ((1u << p->cfg.perceptronBits) - 1)];
+    lk->g.sum = *lk->g.bias;
+  }
+  lk->count = __builtin_popcount(features & ~PERCEPTRON_F_GLOBAL);
+  lk->sum = lk->g.sum;
+  for (int s = 0; s < lk->count; s++)
+  {
+    lk->w[s] = p->pc_features + ((size_t)s << p->cfg.perceptronBits) + rows[s];
+    lk->sum += *lk->w[s];
+  }
+}
+
+// Train when mispredicted or not confident against the threshold of
+// the inputs in use
+static inline void perceptron_mp_update(predictor_t *p, const perceptron_mp_lookup_t *lk, uint8_t outcome)
+{
+  BP_OCC(bp_occ_touch(&p->occ, BP_OCC_PERCEPTRON_BIAS, lk->g.bias - p->pc_bias));
+  uint8_t pred = lk->sum >= 0;
+  if (pred == outcome && (lk->sum > p->pc_theta || lk->sum < -p->pc_theta))
+  {
+    return;
+  }
+  perceptron_step(&lk->g, outcome, p->cfg.perceptronFeatures & PERCEPTRON_F_GLOBAL);
+  for (int s = 0; s < lk->count; s++)
+  {
+    int w = *lk->w[s] + (outcome ? 1 : -1);
+    if (w >= -PERCEPTRON_WEIGHT_MAX && w <= PERCEPTRON_WEIGHT_MAX)
+    {
+      *lk->w[s] = w;
+    }
+  }
+}
+
+// Shift 'outcome' into the global and the branch's local history
+static inline void perceptron_mp_push(predictor_t *p, uint32_t pc, uint8_t outcome)
+{
+  if (p->pc_local)
+  {
+    uint16_t *l = &p->pc_local[pc & ((1u << p->cfg.perceptronBits) - 1)];
+    *l = (uint16_t)((*l << 1) | outcome);
+  }
+  p->pc_ghist = (p->pc_ghist << 1) | outcome;
+}
+
+void cleanup_perceptron(predictor_t *p)
+{
+  arena_close(p);
+  p->pc_weights = NULL;
+  p->pc_bias = NULL;
+  p->pc_features = NULL;
+  p->pc_local = NULL;
+}
+
+// YAGS functions
+static inline size_t yags_tag_bytes(const predictor_config_t *cfg)
+{
+  return cfg->yagsTagBits <= 7 ? sizeof(uint8_t) : sizeof(uint16_t);
+}
+
+static void yags_layout(predictor_t *p, arena_t *a)
+{
+  size_t slots = 2UL << p->cfg.yagsCacheBits;
+  p->y_choice = (ctr_word_t *)arena_take(a, ctr_words<2>(1UL << p->cfg.yagsChoiceBits) * sizeof(ctr_word_t));
+  p->y_tags = arena_take(a, slots * yags_tag_bytes(&p->cfg));
+  p->y_ctrs = (ctr_word_t *)arena_take(a, ctr_words<2>(slots) * sizeof(ctr_word_t));
+}
+
+// Every choice counter starts weakly not taken and every cache entry
+// free, as the zeroed arena stores them
+//
+// Returns True if Successful
+//
+int init_yags(predictor_t *p)
+{
+  if (!arena_open(p, yags_layout))
+  {
+    return 0;
+  }
+  p->y_ghist = 0;
+  return 1;
+}
+
+// The choice counter and the entry of the cache it points to, the
+// not-taken one when it says taken, found for one prediction
+typedef struct {
+  uint32_t choice;
+  uint32_t slot;              // tag and counter of the entry, 2 * index plus the choice
+  uint16_t tag;
+  uint8_t bias;               // the choice's prediction
+  uint8_t hit;
+  uint8_t taken;              // the entry's prediction on a hit, the choice's otherwise
+} yags_lookup_t;
+
+// The stored tag of 'slot', all ones when free
+static inline uint16_t yags_tag_get(const predictor_t *p, uint32_t slot)
+{
+  return p->cfg.yagsTagBits <= 7 ? (uint16_t)(((const uint8_t *)p->y_tags)[slot] ^ 0xFF)
+                                 : (uint16_t)(((const uint16_t *)p->y_tags)[slot] ^ 0xFFFF);
+}
+
+static inline void yags_tag_set(predictor_t *p, uint32_t slot, uint16_t tag)
+{
+  if (p->cfg.yagsTagBits <= 7)
+  {
+    ((uint8_t *)p->y_tags)[slot] = (uint8_t)(tag ^ 0xFF);
+  }
+  else
+  {
+    ((uint16_t *)p->y_tags)[slot] = (uint16_t)(tag ^ 0xFFFF);
+  }
+}
+
+template <class H>
+static inline void yags_lookup(const predictor_t *p, uint32_t pc, uint64_t hist, yags_lookup_t *lk)
+{
+  lk->choice = pc & ((1u << p->cfg.yagsChoiceBits) - 1);
+  lk->bias = ctr_predict<2>(ctr_get<2, WN>(p->y_choice, lk->choice));
+  lk->slot = H::index(p, pc, (uint32_t)hist, 0, p->cfg.yagsCacheBits) * 2 + lk->bias;
+  lk->tag = H::tag(p, pc, 0, p->cfg.yagsTagBits);
+  lk->hit = yags_tag_get(p, lk->slot) == lk->tag;
+  lk->taken = lk->hit ? ctr_predict<2>(ctr_get<2>(p->y_ctrs, lk->slot)) : lk->bias;
+}
+
+// A hit trains its entry and a miss against the choice takes the
+// entry, weak toward the outcome. The choice trains unless it was
+// wrong and its exception right
+static inline void yags_update(predictor_t *p, const yags_lookup_t *lk, uint8_t outcome)
+{
+  BP_OCC(bp_occ_touch(&p->occ, BP_OCC_YAGS_CHOICE, lk->choice));
+  if (lk->hit)
+  {
+    BP_OCC(bp_occ_touch(&p->occ, BP_OCC_YAGS_CACHE, lk->slot));
+    ctr_update_packed<2>(p->y_ctrs, lk->slot, outcome);
+  }
+  else if (outcome != lk->bias)
+  {
+    BP_OCC(bp_occ_touch(&p->occ, BP_OCC_YAGS_CACHE, lk->slot));
+    yags_tag_set(p, lk->slot, lk->tag);
+    ctr_set_packed<2>(p->y_ctrs, lk->slot, outcome ? WT : WN);
+  }
+  if (!(lk->hit && lk->taken == outcome && lk->bias != outcome))
+  {
+    ctr_update_packed<2, WN>(p->y_choice, lk->choice, outcome);
+  }
+}
+
+void cleanup_yags(predictor_t *p)
+{
+  arena_close(p);
+  p->y_choice = p->y_ctrs = NULL;
+  p->y_tags = NULL;
+}
+
+//------------------------------------//
+//        Predictor Registry          //
+//------------------------------------//
+
+// Position in a state snapshot; with 'buf' NULL only the size is
+// counted
+typedef struct {
+  char *buf;
+  size_t off;
+  int load;   // copy from buf into the predictor instead
+  size_t len; // of buf, when loading
+  int overrun; // set when a load ran past 'len'
+} state_cursor_t;
+
+static void state_field(state_cursor_t *c, void *ptr, size_t len)
+{
+  if (c->buf && c->load && (c->overrun || len > c->len - c->off))
+  {
+    c->overrun = 1;
+  }
+  else if (c->buf && c->load)
+  {
+    memcpy(ptr, c->buf + c->off, len);
+  }
+  else if (c->buf)
+  {
+    memcpy(c->buf + c->off, ptr, len);
+  }
+  c->off += len;
+}
+
+// An unbounded table: its entry count, then the entries in the order
+// they were added. A load rebuilds the slots from them
+static void state_map(state_cursor_t *c, bp_map_t *m)
+{
+  uint32_t count = m->count;
+  state_field(c, &count, sizeof(count));
+  if (c->buf && c->load)
+  {
+    if (c->overrun || count > (c->len - c->off) / sizeof(bp_map_entry_t))
+    {
+      c->overrun = 1;
+      return;
+    }
+    bp_map_reserve(m, count);
+    m->count = count;
+  }
+  state_field(c, m->entries, (size_t)count * sizeof(bp_map_entry_t));
+  if (c->buf && c->load)
+  {
+    bp_map_index(m, m->mask + 1);
+  }
+}
+
+// Each predictor is a type with static members, instantiated into
+// the loops below so its lookups inline into them:
+//
+//   ctx                      what a batch keeps in locals, with the
+//                            global history in 'hist'
+//   load(p), store(p, c)     fill a ctx from 'p' and write 'hist' back
+//   footprint(c)             table bytes, to decide on prefetching
+//   prefetch(c, pc, hist)    touch the entries of 'pc' under 'hist'
+//   push(c, hist, outcome)   advance 'hist' past a branch
+//   shared(c, outcomes)      'hist' from the shared outcome history, for
+//                            the schemes registered with shared_ops
+//   predict(c, pc)           the prediction under c.hist
+//   update(c, pc, outcome)   train and advance c.hist
+//   predict_and_update       both, with the lookups done once
+//   init, cleanup, state     allocate, free and walk the tables
+//   layout(p, a)             carve the tables of p->cfg from arena 'a'
+//   describe(cfg, buf, len)  the fields of cfg it uses
+//   budget(cfg)              the bits of storage the hardware would
+//                            need for cfg: tables and history registers
+//
+// and is registered in predictor_ops by its type number
+
+struct static_bp {
+  struct ctx { uint64_t hist; };
+  static ctx load(predictor_t *p) { ctx c = {0}; return c; }
+  static void store(predictor_t *p, const ctx &c) {}
+  static size_t footprint(const ctx &c) { return 0; }
+  static void prefetch(const ctx &c, uint32_t pc, uint64_t hist) {}
+  static void push(const ctx &c, uint64_t &hist, uint8_t outcome) {}
+  static uint8_t predict(const ctx &c, uint32_t pc) { return TAKEN; }
+  static void update(ctx &c, uint32_t pc, uint8_t outcome) {}
+  static uint8_t predict_and_update(ctx &c, uint32_t pc, uint8_t outcome) { return TAKEN; }
+  struct pending { uint8_t none; };
+  static uint8_t speculate(ctx &c, uint32_t pc, uint8_t outcome, pending *u) { return TAKEN; }
+  static void retire(ctx &c, const pending *u, uint8_t outcome) {}
+  static int init(predictor_t *p) { return 1; }
+  static void cleanup(predictor_t *p) {}
+  static void state(predictor_t *p, state_cursor_t *c) {}
+  static void layout(predictor_t *p, arena_t *a) {}
+  static void describe(const predictor_config_t *cfg, char *buf, size_t len) { buf[0] = '\0'; }
+  static uint64_t budget(const predictor_config_t *cfg) { return 0; }
+};
+
+struct gshare_bp {
+  struct ctx { uint64_t hist; ctr_word_t *bht; uint32_t mask; BP_OCC(bp_occ_t *occ;) };
+  static ctx load(predictor_t *p) {
+    ctx c = {p->ghistory, p->bht_gshare, (1u << p->cfg.ghistoryBits) - 1};
+    BP_OCC(c.occ = &p->occ);
+    return c;
+  }
+  static void store(predictor_t *p, const ctx &c) { p->ghistory = c.hist; }
+  static size_t footprint(const ctx &c) { return ctr_words<2>((size_t)c.mask + 1) * sizeof(ctr_word_t); }
+  static void prefetch(const ctx &c, uint32_t pc, uint64_t hist) {
+    __builtin_prefetch(&c.bht[((pc ^ hist) & c.mask) / ctr_packing<2>::per_word], 1);
+  }
+  static void push(const ctx &c, uint64_t &hist, uint8_t outcome) { hist = (hist << 1) | outcome; }
+  static uint64_t shared(const ctx &c, uint64_t outcomes) { return outcomes; }
+  static uint8_t predict(const ctx &c, uint32_t pc) { return ctr_predict<2>(ctr_get<2, WN>(c.bht, (pc ^ c.hist) & c.mask)); }
+  static void update(ctx &c, uint32_t pc, uint8_t outcome) {
+    BP_OCC(uint32_t index = (pc ^ c.hist) & c.mask;
+           bp_occ_alias(c.occ, BP_OCC_GSHARE_BHT, index, pc, ctr_predict<2>(ctr_get<2, WN>(c.bht, index)), outcome, WN));
+    ctr_update_packed<2, WN>(c.bht, (pc ^ c.hist) & c.mask, outcome);
+    push(c, c.hist, outcome);
+  }
+  static uint8_t predict_and_update(ctx &c, uint32_t pc, uint8_t outcome) {
+    uint32_t index = (pc ^ c.hist) & c.mask;
+    uint8_t pred = ctr_predict<2>(ctr_get<2, WN>(c.bht, index));
+    BP_OCC(bp_occ_alias(c.occ, BP_OCC_GSHARE_BHT, index, pc, pred, outcome, WN));
+    ctr_update_packed<2, WN>(c.bht, index, outcome);
+    push(c, c.hist, outcome);
+    return pred;
+  }
+  struct pending { uint32_t index; };
+  static uint8_t speculate(ctx &c, uint32_t pc, uint8_t outcome, pending *u) {
+    u->index = (pc ^ c.hist) & c.mask;
+    uint8_t pred = ctr_predict<2>(ctr_get<2, WN>(c.bht, u->index));
+    BP_OCC(bp_occ_alias(c.occ, BP_OCC_GSHARE_BHT, u->index, pc, pred, outcome, WN));
+    push(c, c.hist, outcome);
+    return pred;
+  }
+  static void retire(ctx &c, const pending *u, uint8_t outcome) { ctr_update_packed<2, WN>(c.bht, u->index, outcome); }
+  static int init(predictor_t *p) { return init_gshare(p); }
+  static void cleanup(predictor_t *p) { cleanup_gshare(p); }
+  static void state(predictor_t *p, state_cursor_t *c) {
+    state_field(c, &p->ghistory, sizeof(p->ghistory));
+    state_field(c, p->bht_gshare, ctr_words<2>((size_t)1 << p->cfg.ghistoryBits) * sizeof(ctr_word_t));
+  }
+  static void layout(predictor_t *p, arena_t *a) { gshare_layout(p, a); }
+  static void describe(const predictor_config_t *cfg, char *buf, size_t len) {
+    snprintf(buf, len, "ghistoryBits=%d", cfg->ghistoryBits);
+  }
+  static constexpr uint64_t bits(int ghistoryBits) { return (2ULL << ghistoryBits) + ghistoryBits; }
+  static uint64_t budget(const predictor_config_t *cfg) { return bits(cfg->ghistoryBits); }
+};
+static_assert(gshare_bp::bits(G_HISTORY_BITS) <= PREDICTOR_BUDGET_BITS, "the default gshare fits the budget");
+
+// The local history and global entries are prefetched; the local
+// counters depend on the local history just loaded and are not
+struct tournament_bp {
+  struct ctx { uint64_t hist; predictor_t *p; uint32_t gpt_mask; };
+  static ctx load(predictor_t *p) {
+    ctx c = {p->t_ghr, p, (1u << p->cfg.ghrBits) - 1};
+    return c;
+  }
+  static void store(predictor_t *p, const ctx &c) { p->t_ghr = c.hist; }
+  static size_t footprint(const ctx &c) {
+    const local_engine_t *e = &c.p->t_local;
+    size_t gpt = (size_t)c.gpt_mask + 1;
+    return local_bytes(e) + (ctr_words<3>(local_patterns(e)) + ctr_words<4>(gpt)) * sizeof(ctr_word_t);
+  }
+  static void prefetch(const ctx &c, uint32_t pc, uint64_t hist) {
+    __builtin_prefetch(local_set(&c.p->t_local, pc), 1);
+    __builtin_prefetch(&c.p->t_global[(hist & c.gpt_mask) / ctr_packing<4>::per_word], 1);
+  }
+  static void push(const ctx &c, uint64_t &hist, uint8_t outcome) { hist = tournament_push_history(c.p, hist, outcome); }
+  static uint64_t shared(const ctx &c, uint64_t outcomes) { return outcomes & c.gpt_mask; }
+  static uint8_t predict(const ctx &c, uint32_t pc) {
+    tournament_lookup_t lk;
+    tournament_lookup(c.p, pc, c.hist, &lk);
+    return tournament_choose(c.p, &lk);
+  }
+  static void update(ctx &c, uint32_t pc, uint8_t outcome) {
+    tournament_lookup_t lk;
+    tournament_lookup(c.p, pc, c.hist, &lk);
+    tournament_update(c.p, &lk, outcome);
+    push(c, c.hist, outcome);
+  }
+  static uint8_t predict_and_update(ctx &c, uint32_t pc, uint8_t outcome) {
+    tournament_lookup_t lk;
+    tournament_lookup(c.p, pc, c.hist, &lk);
+    uint8_t pred = tournament_choose(c.p, &lk);
+    tournament_update(c.p, &lk, outcome);
+    push(c, c.hist, outcome);
+    return pred;
+  }
+  // the counters and the choice between them, the local history
+  // being speculated with the global one
+  struct pending {
+    uint32_t local_index, global_index;
+    uint8_t local_taken, global_taken;
+    BP_OCC(uint32_t pc;)
+  };
+  static uint8_t speculate(ctx &c, uint32_t pc, uint8_t outcome, pending *u) {
+    tournament_lookup_t lk;
+    tournament_lookup(c.p, pc, c.hist, &lk);
+    u->local_index = lk.local_index;
+    u->global_index = c.hist & c.gpt_mask;
+    u->local_taken = lk.local_taken;
+    u->global_taken = lk.global_taken;
+    BP_OCC(u->pc = pc);
+    tournament_push_local(c.p, &lk, outcome);
+    push(c, c.hist, outcome);
+    return tournament_choose(c.p, &lk);
+  }
+  static void retire(ctx &c, const pending *u, uint8_t outcome) {
+    tournament_lookup_t lk;
+    tournament_locate(c.p, u->local_index, u->global_index, &lk);
+    lk.local_taken = u->local_taken;
+    lk.global_taken = u->global_taken;
+    BP_OCC(lk.pc = u->pc);
+    tournament_train(c.p, &lk, outcome);
+  }
+  static int init(predictor_t *p) { return init_tournament(p); }
+  static void cleanup(predictor_t *p) { cleanup_tournament(p); }
+  static void state(predictor_t *p, state_cursor_t *c) {
+    state_field(c, &p->t_ghr, sizeof(p->t_ghr));
+    size_t gpt = (size_t)1 << p->cfg.ghrBits;
+    state_field(c, p->t_local.table, local_bytes(&p->t_local));
+    state_field(c, p->t_localPred, ctr_words<3>(local_patterns(&p->t_local)) * sizeof(ctr_word_t));
+    state_field(c, p->t_global, ctr_words<4>(gpt) * sizeof(ctr_word_t));
+  }
+  static void layout(predictor_t *p, arena_t *a) { tournament_layout(p, a); }
+  static void describe(const predictor_config_t *cfg, char *buf, size_t len) {
+    snprintf(buf, len, "lhtBits=%d ghrBits=%d localHistBits=%d localWays=%d localPatternBits=%d", cfg->lhtBits,
+             cfg->ghrBits, cfg->localHistBits, cfg->localWays, cfg->localPatternBits);
+  }
+  // local histories and 3-bit counters, 2-bit global counters and
+  // choosers, and the global history
+  static constexpr uint64_t bits(int lhtBits, int ghrBits, int histBits, int ways, int patternBits) {
+    return local_bits(lhtBits, histBits, ways) + ((uint64_t)3 << (histBits + patternBits)) +
+           ((uint64_t)(2 + 2) << ghrBits) + ghrBits;
+  }
+  static uint64_t budget(const predictor_config_t *cfg) {
+    return bits(cfg->lhtBits, cfg->ghrBits, tournament_local_hist_bits(cfg), cfg->localWays, cfg->localPatternBits);
+  }
+};
+static_assert(tournament_bp::bits(T_LHT_BITS, T_GHR_BITS, T_LHT_BITS, T_LOCAL_WAYS, T_LOCAL_PATTERN_BITS) <=
+              PREDICTOR_BUDGET_BITS,
+              "the default tournament fits the budget");
+
+// init picks the batch loop of a compiled-in geometry when the
+// configuration has one, see tage_geometries
+typedef uint64_t (*tage_batch_fn)(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions);
+static tage_batch_fn tage_batch_for(const predictor_config_t *cfg);
+
+template <class G>
+struct tage_bp_t {
+  struct ctx { tage_hist_t hist; predictor_t *p; };
+  static ctx load(predictor_t *p) { ctx c = {p->tage_hist, p}; return c; }
+  static void store(predictor_t *p, const ctx &c) { p->tage_hist = c.hist; }
+  static size_t footprint(const ctx &c) {
+    const predictor_config_t *cfg = &c.p->cfg;
+    return (((size_t)cfg->tageNumTagged * TAGE_ENTRY_BYTES) << cfg->tageTaggedBits) +
+           ((size_t)1 << cfg->tageBimodalBits);
+  }
+  static void prefetch(const ctx &c, uint32_t pc, const tage_hist_t &hist) { tage_prefetch<G>(c.p, pc, &hist); }
+  static void push(const ctx &c, tage_hist_t &hist, uint8_t outcome) { tage_push_history<G>(c.p, &hist, outcome); }
+  static uint8_t predict(const ctx &c, uint32_t pc) {
+    tage_lookup_t lk;
+    tage_lookup<G>(c.p, pc, &c.hist, &lk);
+    return lk.pred;
+  }
+  static void update(ctx &c, uint32_t pc, uint8_t outcome) {
+    tage_lookup_t lk;
+    tage_lookup<G>(c.p, pc, &c.hist, &lk);
+    tage_update<G>(c.p, &lk, outcome);
+    push(c, c.hist, outcome);
+  }
+  static uint8_t predict_and_update(ctx &c, uint32_t pc, uint8_t outcome) {
+    tage_lookup_t lk;
+    tage_lookup<G>(c.p, pc, &c.hist, &lk);
+    uint8_t pred = lk.pred;
+    tage_update<G>(c.p, &lk, outcome);
+    push(c, c.hist, outcome);
+    return pred;
+  }
+  typedef tage_lookup_t pending;
+  static uint8_t speculate(ctx &c, uint32_t pc, uint8_t outcome, pending *u) {
+    tage_lookup<G>(c.p, pc, &c.hist, u);
+    push(c, c.hist, outcome);
+    return u->pred;
+  }
+  static void retire(ctx &c, const pending *u, uint8_t outcome) { tage_update<G>(c.p, u, outcome); }
+  static int init(predictor_t *p) {
+    if (!init_tage(p)) return 0;
+    p->tage_batch = tage_batch_for(&p->cfg);
+    return 1;
+  }
+  static void cleanup(predictor_t *p) { cleanup_tage(p); }
+  static void state(predictor_t *p, state_cursor_t *c) {
+    state_field(c, p->tage_hbuf, TAGE_HIST_BUF);
+    state_field(c, &p->tage_hist, sizeof(p->tage_hist));
+    state_field(c, &p->tage_rng, sizeof(p->tage_rng));
+    state_field(c, p->tage_bimodal, (size_t)1 << p->cfg.tageBimodalBits);
+    state_field(c, p->tage_tag, ((size_t)p->cfg.tageNumTagged * TAGE_ENTRY_BYTES) << p->cfg.tageTaggedBits);
+    if (p->cfg.tageFilter) state_field(c, p->tage_filter, sizeof(uint16_t) << TAGE_FILTER_BITS);
+    if (p->cfg.tageUReset) {
+      state_field(c, &p->tage_u_age_pos, sizeof(p->tage_u_age_pos));
+      state_field(c, &p->tage_u_age_count, sizeof(p->tage_u_age_count));
+    }
+    if (p->cfg.tageLoop) state_field(c, &p->tage_loop, sizeof(p->tage_loop));
+    if (p->cfg.tageSC) {
+      state_field(c, p->tage_sc, (size_t)TAGE_SC_TABLES << TAGE_SC_BITS);
+      state_field(c, &p->tage_sc_thresh, sizeof(p->tage_sc_thresh));
+      state_field(c, &p->tage_sc_tc, sizeof(p->tage_sc_tc));
+    }
+  }
+  static void describe(const predictor_config_t *cfg, char *buf, size_t len) {
+    size_t n = snprintf(buf, len, "tageBimodalBits=%d tageTaggedBits=%d tageNumTagged=%d tageSeed=%d tageSC=%d tageLoop=%d "
+                        "tageFilter=%d tageUReset=%d tageHash=%d tageWays=%d tageHistLengths=", cfg->tageBimodalBits,
+                        cfg->tageTaggedBits, cfg->tageNumTagged, cfg->tageSeed, cfg->tageSC, cfg->tageLoop,
+                        cfg->tageFilter, cfg->tageUReset, cfg->tageHash, cfg->tageWays);
+    for (int t = 0; t < cfg->tageNumTagged && t < TAGE_MAX_TAGGED && n < len; t++) {
+      n += snprintf(buf + n, len - n, t ? ",%d" : "%d", cfg->tageHistLengths[t]);
+    }
+  }
+  static void layout(predictor_t *p, arena_t *a) { tage_layout(p, a); }
+  // 2-bit bimodal counters, tagged entries, the longest history and
+  // the index and two tag folds of every table, and the stages
+  static uint64_t budget(const predictor_config_t *cfg) {
+    int tag = cfg->tageTaggedBits - TAGE_TAG_SHORTER;
+    int way_bits = __builtin_ctz(cfg->tageWays);
+    uint64_t bits = (2ULL << cfg->tageBimodalBits) +
+                    ((uint64_t)cfg->tageNumTagged << cfg->tageTaggedBits) *
+                        (tag + way_bits + TAGE_CTR_WIDTH + TAGE_U_WIDTH);
+    int longest = cfg->tageSC ? 64 : 0;
+    for (int t = 0; t < cfg->tageNumTagged; t++) {
+      longest = cfg->tageHistLengths[t] > longest ? cfg->tageHistLengths[t] : longest;
+      bits += cfg->tageTaggedBits + tag + (tag > 1 ? tag - 1 : 1);
+    }
+    bits += longest;
+    if (cfg->tageFilter) bits += (uint64_t)TAGE_FILTER_ENTRY_WIDTH << TAGE_FILTER_BITS;
+    if (cfg->tageUReset) bits += cfg->tageUReset; // the period counter, whose high bits are the chunk
+    if (cfg->tageLoop) bits += TAGE_LOOP_ENTRIES * TAGE_LOOP_ENTRY_WIDTH + 7;
+    if (cfg->tageSC) bits += ((uint64_t)TAGE_SC_TABLES * TAGE_SC_WIDTH << TAGE_SC_BITS) + TAGE_SC_THRESH_WIDTH;
+    return bits;
+  }
+};
+typedef tage_bp_t<tage_runtime> tage_bp;
+typedef tage_bp_t<tage_runtime_hashed<tage_hash_xor> > tage_xor_bp;
+
+// Unbounded tables: with cfg.unbounded gshare, the tournament and TAGE
+// keep the entries of their sized arrays in bp_map_t tables in p->ub,
+// one per distinct index and the pc bits or tag the entry is matched
+// by, so no branch ever evicts or trains the entry of another. An
+// entry holds its counter stored XOR the initial value, as the arrays
+// do, and is added where the bounded table would first have read or
+// allocated it. The history registers, and the tournament's pattern
+// and global counters that branches share by design, stay in the
+// arena. An add may move the entries, so those an update in flight
+// with updateDelay trains are looked up again by key at retire
+
+// Empty unbounded tables 0 to n - 1
+static void unbounded_open(predictor_t *p, int n)
+{
+  for (int t = 0; t < n; t++) bp_map_init(&p->ub[t]);
+}
+
+static void unbounded_close(predictor_t *p)
+{
+  for (int t = 0; t <= TAGE_MAX_TAGGED; t++) {
+    if (p->ub[t].ctrl) bp_map_free(&p->ub[t]);
+  }
+}
+
+// Unbounded tables in use
+static int unbounded_tables(const predictor_config_t *cfg)
+{
+  return cfg->type == CUSTOM ? 1 + cfg->tageNumTagged : 1;
+}
+
+// A counter per pc and history, keyed by both
+struct gshare_unbounded_bp {
+  struct ctx { uint64_t hist; bp_map_t *map; uint32_t mask; };
+  static ctx load(predictor_t *p) {
+    ctx c = {p->ghistory, &p->ub[0], (1u << p->cfg.ghistoryBits) - 1};
+    return c;
+  }
+  static void store(predictor_t *p, const ctx &c) { p->ghistory = c.hist; }
+  static size_t footprint(const ctx &c) { return 0; }
+  static void prefetch(const ctx &c, uint32_t pc, uint64_t hist) {}
+  static void push(const ctx &c, uint64_t &hist, uint8_t outcome) { hist = (hist << 1) | outcome; }
+  static uint64_t shared(const ctx &c, uint64_t outcomes) { return outcomes; }
+  static uint64_t key(const ctx &c, uint32_t pc) { return (uint64_t)pc << 32 | (c.hist & c.mask); }
+  static uint8_t train(bp_map_entry_t *e, uint8_t outcome) {
+    uint8_t v = e->value;
+    uint8_t pred = ctr_predict<2>(v ^ WN);
+    ctr_update<2, WN>(&v, outcome);
+    e->value = v;
+    return pred;
+  }
+  static uint8_t predict(const ctx &c, uint32_t pc) {
+    const bp_map_entry_t *e = bp_map_find(c.map, key(c, pc));
+    return ctr_predict<2>((e ? e->value : 0) ^ WN);
+  }
+  static void update(ctx &c, uint32_t pc, uint8_t outcome) { predict_and_update(c, pc, outcome); }
+  static uint8_t predict_and_update(ctx &c, uint32_t pc, uint8_t outcome) {
+    uint8_t pred = train(bp_map_get(c.map, key(c, pc), 0), outcome);
+    push(c, c.hist, outcome);
+    return pred;
+  }
+  struct pending { uint64_t key; };
+  static uint8_t speculate(ctx &c, uint32_t pc, uint8_t outcome, pending *u) {
+    u->key = key(c, pc);
+    uint8_t pred = ctr_predict<2>(bp_map_get(c.map, u->key, 0)->value ^ WN);
+    push(c, c.hist, outcome);
+    return pred;
+  }
+  static void retire(ctx &c, const pending *u, uint8_t outcome) { train(bp_map_find(c.map, u->key), outcome); }
+  static int init(predictor_t *p) {
+    if (!init_gshare(p)) return 0;
+    unbounded_open(p, 1);
+    return 1;
+  }
+  static void cleanup(predictor_t *p) {
+    cleanup_gshare(p);
+    unbounded_close(p);
+  }
+  static void state(predictor_t *p, state_cursor_t *c) {
+    state_field(c, &p->ghistory, sizeof(p->ghistory));
+    state_map(c, &p->ub[0]);
+  }
+  static void layout(predictor_t *p, arena_t *a) { gshare_layout(p, a); }
+  static void describe(const predictor_config_t *cfg, char *buf, size_t len) { gshare_bp::describe(cfg, buf, len); }
+  static uint64_t budget(const predictor_config_t *cfg) { return gshare_bp::budget(cfg); }
+};
+
+// A local history per pc; the counters are the tournament's own
+struct tournament_unbounded_bp : tournament_bp {
+  static size_t footprint(const ctx &c) { return 0; }
+  static void prefetch(const ctx &c, uint32_t pc, uint64_t hist) {}
+  // tournament_lookup with the history of the pc's entry, its slot
+  // being the entry's position
+  static void lookup(predictor_t *p, uint32_t pc, uint64_t ghr, tournament_lookup_t *lk) {
+    BP_OCC(lk->pc = pc);
+    bp_map_entry_t *e = bp_map_get(&p->ub[0], pc, 0);
+    lk->local.slot = e - p->ub[0].entries;
+    lk->local.hist = e->value;
+    tournament_lookup_counters(p, pc, ghr, lk);
+  }
+  static void push_local(predictor_t *p, const tournament_lookup_t *lk, uint8_t outcome) {
+    p->ub[0].entries[lk->local.slot].value = ((lk->local.hist << 1) | outcome) & p->t_local.hist_mask;
+  }
+  static uint8_t predict(const ctx &c, uint32_t pc) {
+    tournament_lookup_t lk;
+    lookup(c.p, pc, c.hist, &lk);
+    return tournament_choose(c.p, &lk);
+  }
+  static void update(ctx &c, uint32_t pc, uint8_t outcome) { predict_and_update(c, pc, outcome); }
+  static uint8_t predict_and_update(ctx &c, uint32_t pc, uint8_t outcome) {
+    tournament_lookup_t lk;
+    lookup(c.p, pc, c.hist, &lk);
+    uint8_t pred = tournament_choose(c.p, &lk);
+    tournament_train(c.p, &lk, outcome);
+    push_local(c.p, &lk, outcome);
+    push(c, c.hist, outcome);
+    return pred;
+  }
+  static uint8_t speculate(ctx &c, uint32_t pc, uint8_t outcome, pending *u) {
+    tournament_lookup_t lk;
+    lookup(c.p, pc, c.hist, &lk);
+    u->local_index = lk.local_index;
+    u->global_index = c.hist & c.gpt_mask;
+    u->local_taken = lk.local_taken;
+    u->global_taken = lk.global_taken;
+    BP_OCC(u->pc = pc);
+    push_local(c.p, &lk, outcome);
+    push(c, c.hist, outcome);
+    return tournament_choose(c.p, &lk);
+  }
+  static int init(predictor_t *p) {
+    if (!init_tournament(p)) return 0;
+    unbounded_open(p, 1);
+    return 1;
+  }
+  static void cleanup(predictor_t *p) {
+    cleanup_tournament(p);
+    unbounded_close(p);
+  }
+  static void state(predictor_t *p, state_cursor_t *c) {
+    state_field(c, &p->t_ghr, sizeof(p->t_ghr));
+    state_map(c, &p->ub[0]);
+    state_field(c, p->t_localPred, ctr_words<3>(local_patterns(&p->t_local)) * sizeof(ctr_word_t));
+    state_field(c, p->t_global, ctr_words<4>((size_t)1 << p->cfg.ghrBits) * sizeof(ctr_word_t));
+  }
+};
+
+// tage_lookup on the unbounded tables: the entry of each tagged table
+// is keyed by its index and tag, the bimodal counter by the pc
+typedef struct {
+  uint32_t pc;
+  int provider;
+  int alt;
+  uint8_t provider_pred;
+  uint8_t alt_pred;
+  uint64_t key[TAGE_MAX_TAGGED];  // index << 16 | tag, of the tables probed
+} tage_unbounded_lookup_t;
+
+static inline void tage_unbounded_lookup(predictor_t *p, uint32_t pc, const tage_hist_t *hist,
+                                         tage_unbounded_lookup_t *lk)
+{
+  lk->pc = pc;
+  lk->provider = -1;
+  lk->alt = -1;
+  lk->provider_pred = ctr_automaton_predict<tage_bimodal_rule, WT>(bp_map_get(&p->ub[0], pc, 0)->value);
+  lk->alt_pred = lk->provider_pred;
+  for (int t = p->cfg.tageNumTagged - 1; t >= 0; --t) {
+    // an empty table can not hit, and only the first's key is needed
+    // to allocate
+    if (!p->ub[1 + t].count && t) continue;
+    uint32_t idx;
+    uint16_t tag;
+    tage_hash_table<tage_runtime>(p, pc, hist, t, &idx, &tag);
+    lk->key[t] = (uint64_t)idx << 16 | tag;
+    const bp_map_entry_t *e = bp_map_find(&p->ub[1 + t], lk->key[t]);
+    if (!e) continue;
+    uint8_t pred = ctr_automaton_predict<tage_ctr_rule, TAGE_CTR_INIT>(e->value);
+    if (lk->provider == -1) {
+      lk->provider = t;
+      lk->provider_pred = pred;
+    } else if (lk->alt == -1) {
+      lk->alt = t;
+      lk->alt_pred = pred;
+    }
+  }
+}
+
+// tage_update on the unbounded tables. A missing entry is a free one,
+// so the allocation with no provider is always in the first table;
+// with nothing to pick a victim from, no useful counter is kept
+static inline void tage_unbounded_update(predictor_t *p, const tage_unbounded_lookup_t *lk, uint8_t outcome)
+{
+  if (lk->provider != -1) {
+    bp_map_entry_t *e = bp_map_find(&p->ub[1 + lk->provider], lk->key[lk->provider]);
+    uint8_t v = e->value;
+    ctr_automaton_update<tage_ctr_rule, TAGE_CTR_INIT>(&v, outcome);
+    e->value = v;
+  }
+  if (lk->provider == -1 || lk->alt == -1) {
+    bp_map_entry_t *e = bp_map_get(&p->ub[0], lk->pc, 0);
+    uint8_t v = e->value;
+    ctr_automaton_update<tage_bimodal_rule, WT>(&v, outcome);
+    e->value = v;
+  }
+  if (lk->provider == -1) {
+    bp_map_get(&p->ub[1], lk->key[0], 0)->value = (TAGE_CTR_INIT + (outcome ? 1 : -1)) ^ TAGE_CTR_INIT;
+  }
+}
+
+struct tage_unbounded_bp : tage_bp {
+  static size_t footprint(const ctx &c) { return 0; }
+  static void prefetch(const ctx &c, uint32_t pc, const tage_hist_t &hist) {}
+  static uint8_t predict(const ctx &c, uint32_t pc) {
+    tage_unbounded_lookup_t lk;
+    tage_unbounded_lookup(c.p, pc, &c.hist, &lk);
+    return lk.provider_pred;
+  }
+  static void update(ctx &c, uint32_t pc, uint8_t outcome) { predict_and_update(c, pc, outcome); }
+  static uint8_t predict_and_update(ctx &c, uint32_t pc, uint8_t outcome) {
+    tage_unbounded_lookup_t lk;
+    tage_unbounded_lookup(c.p, pc, &c.hist, &lk);
+    tage_unbounded_update(c.p, &lk, outcome);
+    push(c, c.hist, outcome);
+    return lk.provider_pred;
+  }
+  typedef tage_unbounded_lookup_t pending;
+  static uint8_t speculate(ctx &c, uint32_t pc, uint8_t outcome, pending *u) {
+    tage_unbounded_lookup(c.p, pc, &c.hist, u);
+    push(c, c.hist, outcome);
+    return u->provider_pred;
+  }
+  static void retire(ctx &c, const pending *u, uint8_t outcome) { tage_unbounded_update(c.p, u, outcome); }
+  static int init(predictor_t *p) {
+    if (!init_tage(p)) return 0;
+    unbounded_open(p, unbounded_tables(&p->cfg));
+    return 1;
+  }
+  static void cleanup(predictor_t *p) {
+    cleanup_tage(p);
+    unbounded_close(p);
+  }
+  static void state(predictor_t *p, state_cursor_t *c) {
+    state_field(c, p->tage_hbuf, TAGE_HIST_BUF);
+    state_field(c, &p->tage_hist, sizeof(p->tage_hist));
+    for (int t = 0; t < unbounded_tables(&p->cfg); t++) state_map(c, &p->ub[t]);
+  }
+};
+
+struct perceptron_bp {
+  struct ctx { uint64_t hist; predictor_t *p; };
+  static ctx load(predictor_t *p) { ctx c = {p->pc_ghist, p}; return c; }
+  static void store(predictor_t *p, const ctx &c) { p->pc_ghist = c.hist; }
+  static size_t footprint(const ctx &c) {
+    return (size_t)(PERCEPTRON_SEGMENTS * PERCEPTRON_SEGMENT + 1) << c.p->cfg.perceptronBits;
+  }
+  static void prefetch(const ctx &c, uint32_t pc, uint64_t hist) {
+    __builtin_prefetch(&c.p->pc_bias[pc & ((1u << c.p->cfg.perceptronBits) - 1)], 1);
+    for (int seg = 0; seg < PERCEPTRON_SEGMENTS; seg++) {
+      __builtin_prefetch(perceptron_weights(c.p, seg, perceptron_row(c.p, pc, hist, seg)), 1);
+    }
+  }
+  static void push(const ctx &c, uint64_t &hist, uint8_t outcome) { hist = (hist << 1) | outcome; }
+  static uint64_t shared(const ctx &c, uint64_t outcomes) { return outcomes; }
+  static uint8_t predict(const ctx &c, uint32_t pc) {
+    perceptron_lookup_t lk;
+    perceptron_lookup(c.p, pc, c.hist, &lk);
+    return lk.sum >= 0;
+  }
+  static void update(ctx &c, uint32_t pc, uint8_t outcome) {
+    perceptron_lookup_t lk;
+    perceptron_lookup(c.p, pc, c.hist, &lk);
+    perceptron_update(c.p, &lk, outcome);
+    push(c, c.hist, outcome);
+  }
+  static uint8_t predict_and_update(ctx &c, uint32_t pc, uint8_t outcome) {
+    perceptron_lookup_t lk;
+    perceptron_lookup(c.p, pc, c.hist, &lk);
+    perceptron_update(c.p, &lk, outcome);
+    push(c, c.hist, outcome);
+    return lk.sum >= 0;
+  }
+  // the rows by offset, as PERCEPTRON_SEGMENT byte units, reloaded to
+  // train so the updates retired since are kept
+  struct pending { uint32_t bias; uint32_t rows[PERCEPTRON_SEGMENTS]; uint64_t hist; int sum; };
+  static uint8_t speculate(ctx &c, uint32_t pc, uint8_t outcome, pending *u) {
+    perceptron_lookup_t lk;
+    perceptron_lookup(c.p, pc, c.hist, &lk);
+    u->bias = lk.bias - c.p->pc_bias;
+    for (int seg = 0; seg < PERCEPTRON_SEGMENTS; seg++) {
+      u->rows[seg] = (lk.rows[seg] - c.p->pc_weights) / PERCEPTRON_SEGMENT;
+    }
+    u->hist = c.hist;
+    u->sum = lk.sum;
+    push(c, c.hist, outcome);
+    return lk.sum >= 0;
+  }
+  static void retire(ctx &c, const pending *u, uint8_t outcome) {
+    perceptron_lookup_t lk;
+    lk.bias = c.p->pc_bias + u->bias;
+    perceptron_expand(u->hist, lk.taken);
+    for (int seg = 0; seg < PERCEPTRON_SEGMENTS; seg++) {
+      lk.rows[seg] = c.p->pc_weights + (size_t)u->rows[seg] * PERCEPTRON_SEGMENT;
+      lk.w[seg] = _mm_load_si128((const __m128i *)lk.rows[seg]);
+    }
+    lk.sum = u->sum;
+    perceptron_update(c.p, &lk, outcome);
+  }
+  static int init(predictor_t *p) { return init_perceptron(p); }
+  static void cleanup(predictor_t *p) { cleanup_perceptron(p); }
+  static void state(predictor_t *p, state_cursor_t *c) {
+    size_t rows = (size_t)1 << p->cfg.perceptronBits;
+    int features = p->cfg.perceptronFeatures;
+    state_field(c, &p->pc_ghist, sizeof(p->pc_ghist));
+    state_field(c, p->pc_bias, rows);
+    if (p->pc_weights) {
+      state_field(c, p->pc_weights, PERCEPTRON_SEGMENTS * rows * PERCEPTRON_SEGMENT);
+    }
+    if (features != PERCEPTRON_F_DEFAULT) {
+      state_field(c, p->pc_features, __builtin_popcount(features & ~PERCEPTRON_F_GLOBAL) * rows);
+      if (p->pc_local) {
+        state_field(c, p->pc_local, rows * sizeof(uint16_t));
+      }
+      state_field(c, &p->pc_regs, sizeof(p->pc_regs));
+      state_field(c, &p->pc_depth, sizeof(p->pc_depth));
+    }
+  }
+  static void layout(predictor_t *p, arena_t *a) { perceptron_layout(p, a); }
+  static void describe(const predictor_config_t *cfg, char *buf, size_t len) {
+    snprintf(buf, len, "perceptronBits=%d perceptronFeatures=%d", cfg->perceptronBits, cfg->perceptronFeatures);
+  }
+  // a weight per outcome of every selected segment, the bias and a
+  // weight per other feature, per row, the local histories, and the
+  // global history and the registers the features read
+  static uint64_t budget(const predictor_config_t *cfg) {
+    int features = cfg->perceptronFeatures;
+    uint64_t inputs = (features & PERCEPTRON_F_GLOBAL ? PERCEPTRON_SEGMENTS * PERCEPTRON_SEGMENT : 0) +
+                      __builtin_popcount(features & ~PERCEPTRON_F_GLOBAL) + 1;
+    return ((inputs * PERCEPTRON_WEIGHT_WIDTH +
+             (features & PERCEPTRON_F_LOCAL ? PERCEPTRON_LOCAL_WIDTH : 0)) << cfg->perceptronBits) +
+           PERCEPTRON_SEGMENTS * PERCEPTRON_SEGMENT +
+           (features & PERCEPTRON_F_PATH ? PERCEPTRON_REG_WIDTH : 0) +
+           (features & PERCEPTRON_F_TARGETS ? PERCEPTRON_REG_WIDTH : 0) +
+           (features & PERCEPTRON_F_DEPTH ? PERCEPTRON_DEPTH_WIDTH : 0);
+  }
+};
+
+// The hash policies are the TAGE ones, H, the index hashing the
+// history with the pc and the tag the pc alone
+template <class H>
+struct yags_bp_t {
+  struct ctx { uint64_t hist; predictor_t *p; uint64_t hist_mask; };
+  static ctx load(predictor_t *p) {
+    ctx c = {p->y_ghist, p, p->cfg.yagsHistBits >= 64 ? ~0ULL : (1ULL << p->cfg.yagsHistBits) - 1};
+    return c;
+  }
+  static void store(predictor_t *p, const ctx &c) { p->y_ghist = c.hist; }
+  static size_t footprint(const ctx &c) {
+    const predictor_config_t *cfg = &c.p->cfg;
+    size_t slots = 2UL << cfg->yagsCacheBits;
+    return (ctr_words<2>(1UL << cfg->yagsChoiceBits) + ctr_words<2>(slots)) * sizeof(ctr_word_t) +
+           slots * yags_tag_bytes(cfg);
+  }
+  // both caches' entries of the index, the one consulted is not known
+  // before the choice counter loads
+  static void prefetch(const ctx &c, uint32_t pc, uint64_t hist) {
+    const predictor_t *p = c.p;
+    uint32_t slot = H::index(p, pc, (uint32_t)hist, 0, p->cfg.yagsCacheBits) * 2;
+    __builtin_prefetch(&p->y_choice[(pc & ((1u << p->cfg.yagsChoiceBits) - 1)) / ctr_packing<2>::per_word], 1);
+    __builtin_prefetch((const char *)p->y_tags + slot * yags_tag_bytes(&p->cfg), 1);
+    __builtin_prefetch(&p->y_ctrs[slot / ctr_packing<2>::per_word], 1);
+  }
+  static void push(const ctx &c, uint64_t &hist, uint8_t outcome) { hist = ((hist << 1) | outcome) & c.hist_mask; }
+  static uint64_t shared(const ctx &c, uint64_t outcomes) { return outcomes & c.hist_mask; }
+  static uint8_t predict(const ctx &c, uint32_t pc) {
+    yags_lookup_t lk;
+    yags_lookup<H>(c.p, pc, c.hist, &lk);
+    return lk.taken;
+  }
+  static void update(ctx &c, uint32_t pc, uint8_t outcome) {
+    yags_lookup_t lk;
+    yags_lookup<H>(c.p, pc, c.hist, &lk);
+    yags_update(c.p, &lk, outcome);
+    push(c, c.hist, outcome);
+  }
+  static uint8_t predict_and_update(ctx &c, uint32_t pc, uint8_t outcome) {
+    yags_lookup_t lk;
+    yags_lookup<H>(c.p, pc, c.hist, &lk);
+    yags_update(c.p, &lk, outcome);
+    push(c, c.hist, outcome);
+    return lk.taken;
+  }
+  // the lookup, trained as it was seen; a tag taken since by another
+  // branch is overwritten
+  typedef yags_lookup_t pending;
+  static uint8_t speculate(ctx &c, uint32_t pc, uint8_t outcome, pending *u) {
+    yags_lookup<H>(c.p, pc, c.hist, u);
+    push(c, c.hist, outcome);
+    return u->taken;
+  }
+  static void retire(ctx &c, const pending *u, uint8_t outcome) { yags_update(c.p, u, outcome); }
+  static int init(predictor_t *p) { return init_yags(p); }
+  static void cleanup(predictor_t *p) { cleanup_yags(p); }
+  static void state(predictor_t *p, state_cursor_t *c) {
+    size_t slots = 2UL << p->cfg.yagsCacheBits;
+    state_field(c, &p->y_ghist, sizeof(p->y_ghist));
+    state_field(c, p->y_choice, ctr_words<2>(1UL << p->cfg.yagsChoiceBits) * sizeof(ctr_word_t));
+    state_field(c, p->y_tags, slots * yags_tag_bytes(&p->cfg));
+    state_field(c, p->y_ctrs, ctr_words<2>(slots) * sizeof(ctr_word_t));
+  }
+  static void layout(predictor_t *p, arena_t *a) { yags_layout(p, a); }
+  static void describe(const predictor_config_t *cfg, char *buf, size_t len) {
+    snprintf(buf, len, "yagsChoiceBits=%d yagsCacheBits=%d yagsTagBits=%d yagsHistBits=%d yagsHash=%d",
+             cfg->yagsChoiceBits, cfg->yagsCacheBits, cfg->yagsTagBits, cfg->yagsHistBits, cfg->yagsHash);
+  }
+  // 2-bit choice counters, a tag and a 2-bit counter per entry of both
+  // caches, and the history
+  static constexpr uint64_t bits(int choiceBits, int cacheBits, int tagBits, int histBits) {
+    return (2ULL << choiceBits) + ((uint64_t)2 * (tagBits + 2) << cacheBits) + histBits;
+  }
+  static uint64_t budget(const predictor_config_t *cfg) {
+    return bits(cfg->yagsChoiceBits, cfg->yagsCacheBits, cfg->yagsTagBits, cfg->yagsHistBits);
+  }
+};
+static_assert(yags_bp_t<tage_hash_xor>::bits(YAGS_CHOICE_BITS, YAGS_CACHE_BITS, YAGS_TAG_BITS, YAGS_HIST_BITS) <=
+              PREDICTOR_BUDGET_BITS, "the default YAGS fits the budget");
+
+// yagsHash read per branch for the single-branch entry points; the
+// batch loops take the policy as a parameter
+struct yags_hash_config {
+  static uint32_t index(const predictor_t *p, uint32_t pc, uint32_t h, int table, int bits) {
+    switch (p->cfg.yagsHash) {
+    case TAGE_HASH_MUL: return tage_hash_mul::index(p, pc, h, table, bits);
+    case TAGE_HASH_CRC: return tage_hash_crc::index(p, pc, h, table, bits);
+    case TAGE_HASH_CLMUL: return tage_hash_clmul::index(p, pc, h, table, bits);
+    }
+    return tage_hash_xor::index(p, pc, h, table, bits);
+  }
+  static uint32_t tag(const predictor_t *p, uint32_t pc, uint32_t h, int bits) {
+    switch (p->cfg.yagsHash) {
+    case TAGE_HASH_MUL: return tage_hash_mul::tag(p, pc, h, bits);
+    case TAGE_HASH_CRC: return tage_hash_crc::tag(p, pc, h, bits);
+    case TAGE_HASH_CLMUL: return tage_hash_clmul::tag(p, pc, h, bits);
+    }
+    return tage_hash_xor::tag(p, pc, h, bits);
+  }
+};
+typedef yags_bp_t<yags_hash_config> yags_bp;
+
+// An update in flight: what S::speculate looked up for the branch,
+// for S::retire to train
+template <class S>
+struct delay_slot {
+  typename S::pending u;
+  uint8_t outcome;
+};
+
+// One conditional branch with updateDelay: predicted from the tables
+// as the updates retired so far left them, its update queued in the
+// ring and the one updateDelay branches older retired. The history
+// moves on at once, speculatively; the trace follows the correct
+// path, so after the repair a mispredicted branch gets, it holds the
+// outcome either way and is shifted once, with that
+template <class S>
+static inline uint8_t delayed_step(predictor_t *p, typename S::ctx &c, uint32_t pc, uint8_t outcome)
+{
+  delay_slot<S> *ring = (delay_slot<S> *)p->delay_ring;
+  uint32_t slots = p->cfg.updateDelay + 1;
+  uint32_t tail = p->delay_head + p->delay_count;
+  tail -= tail >= slots ? slots : 0;
+  uint8_t pred = S::speculate(c, pc, outcome, &ring[tail].u);
+  ring[tail].outcome = outcome;
+  if (++p->delay_count == slots) {
+    delay_slot<S> *oldest = &ring[p->delay_head];
+    S::retire(c, &oldest->u, oldest->outcome);
+    p->delay_head = p->delay_head + 1 == slots ? 0 : p->delay_head + 1;
+    p->delay_count--;
+  }
+  return pred;
+}
+
+// scheme_predict_batch with updateDelay. The ring is in the arena, and
+// an update retires while the lines its prediction read are still
+// likely cached
+template <class S>
+static uint64_t scheme_predict_delayed(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions)
+{
+  typename S::ctx c = S::load(p);
+  uint64_t mispredictions = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!(br[i].flags & BP_F_CONDITION)) continue;
+    uint8_t outcome = br[i].flags & BP_F_TAKEN;
+    BP_COST_BEGIN(p, BP_COST_PREDICT_AND_TRAIN);
+    uint8_t pred = delayed_step<S>(p, c, br[i].pc, outcome);
+    BP_COST_END(p, BP_COST_PREDICT_AND_TRAIN);
+    mispredictions += pred != outcome;
+    if (predictions && pred) predictions[i >> 6] |= 1ULL << (i & 63);
+  }
+  S::store(p, c);
+  return mispredictions;
+}
+
+// Predict and train a batch with the ctx in locals. The outcomes are
+// known, so the history of upcoming branches is exact and, for tables
+// larger than a typical L2, their entries are prefetched
+// BP_PREFETCH_DISTANCE records ahead
+template <class S>
+static uint64_t scheme_predict_batch(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions)
+{
+  if (p->delay_ring) {
+    return scheme_predict_delayed<S>(p, br, n, predictions);
+  }
+  typename S::ctx c = S::load(p);
+  uint64_t mispredictions = 0;
+  int prefetch = S::footprint(c) >= BP_PREFETCH_MIN_BYTES;
+  size_t ahead = 0;
+  decltype(c.hist) ahead_hist = c.hist;
+  for (size_t i = 0; i < n; i++) {
+    if (prefetch) {
+      for (; ahead < n && ahead <= i + BP_PREFETCH_DISTANCE; ahead++) {
+        if (!(br[ahead].flags & BP_F_CONDITION)) continue;
+        S::prefetch(c, br[ahead].pc, ahead_hist);
+        S::push(c, ahead_hist, br[ahead].flags & BP_F_TAKEN);
+      }
+    }
+    if (!(br[i].flags & BP_F_CONDITION)) continue;
+    uint8_t outcome = br[i].flags & BP_F_TAKEN;
+    BP_COST_BEGIN(p, BP_COST_PREDICT_AND_TRAIN);
+    uint8_t pred = S::predict_and_update(c, br[i].pc, outcome);
+    BP_COST_END(p, BP_COST_PREDICT_AND_TRAIN);
+    mispredictions += pred != outcome;
+    if (predictions && pred) predictions[i >> 6] |= 1ULL << (i & 63);
+  }
+  S::store(p, c);
+  return mispredictions;
+}
+
+// scheme_predict_batch over the conditional branches gathered in
+// 'hist', with c.hist set from the shared history before each: nothing
+// branches on the record flags and no prediction waits on the one
+// before it to shift the register. The last update leaves the register
+// as the shared one
+template <class S>
+static uint64_t scheme_predict_shared(predictor_t *p, const predictor_branch_t *br, const bp_history_batch_t *hist,
+                                      uint64_t *predictions)
+{
+  typename S::ctx c = S::load(p);
+  if (p->delay_ring || (hist->count && S::shared(c, hist->outcomes[0]) != c.hist)) {
+    return scheme_predict_batch<S>(p, br, hist->n, predictions);
+  }
+  uint64_t mispredictions = 0;
+  int prefetch = S::footprint(c) >= BP_PREFETCH_MIN_BYTES;
+  for (size_t k = 0; k < hist->count; k++) {
+    size_t ahead = k + BP_PREFETCH_DISTANCE;
+    if (prefetch && ahead < hist->count) {
+      S::prefetch(c, hist->pc[ahead], S::shared(c, hist->outcomes[ahead]));
+    }
+    uint8_t outcome = hist->taken[k];
+    c.hist = S::shared(c, hist->outcomes[k]);
+    BP_COST_BEGIN(p, BP_COST_PREDICT_AND_TRAIN);
+    uint8_t pred = S::predict_and_update(c, hist->pc[k], outcome);
+    BP_COST_END(p, BP_COST_PREDICT_AND_TRAIN);
+    mispredictions += pred != outcome;
+    if (predictions) predictions[hist->index[k] >> 6] |= (uint64_t)pred << (hist->index[k] & 63);
+  }
+  S::store(p, c);
+  return mispredictions;
+}
+
+// Records of each lane scheme_predict_traces_k gathers at a time
+#define BP_TRACES_CHUNK 1024
+
+// scheme_predict_batch on K predictors, each over its own branches.
+// The conditional branches of every lane are gathered first, without
+// branching on the flags, then each lane in turn predicts and trains
+// one, prefetches the lines of its next one, from its updated history,
+// and yields to the next lane: a round robin of K simulations, each
+// suspended while its loads are in flight
+template <class S, int K>
+static void scheme_predict_traces_k(predictor_t *const *ps, const predictor_branch_t *const *br, const size_t *n,
+                                    uint64_t *mispredictions)
+{
+  uint32_t pcs[K][BP_TRACES_CHUNK];
+  uint8_t outcomes[K][BP_TRACES_CHUNK];
+  typename S::ctx c[K];
+  uint64_t miss[K] = {0};
+  size_t longest = 0;
+  for (int j = 0; j < K; j++) {
+    c[j] = S::load(ps[j]);
+    longest = n[j] > longest ? n[j] : longest;
+  }
+  for (size_t off = 0; off < longest; off += BP_TRACES_CHUNK) {
+    size_t count[K];
+    size_t common = BP_TRACES_CHUNK;
+    for (int j = 0; j < K; j++) {
+      size_t m = 0;
+      for (size_t i = off; i < n[j] && i < off + BP_TRACES_CHUNK; i++) {
+        pcs[j][m] = br[j][i].pc;
+        outcomes[j][m] = br[j][i].flags & BP_F_TAKEN;
+        m += (br[j][i].flags & BP_F_CONDITION) != 0;
+      }
+      count[j] = m;
+      common = m < common ? m : common;
+    }
+    for (size_t i = 0; i < common; i++) {
+#pragma GCC unroll 8
+      for (int j = 0; j < K; j++) {
+        miss[j] += S::predict_and_update(c[j], pcs[j][i], outcomes[j][i]) != outcomes[j][i];
+        if (i + 1 < count[j]) S::prefetch(c[j], pcs[j][i + 1], c[j].hist);
+      }
+    }
+    for (int j = 0; j < K; j++) {
+      for (size_t i = common; i < count[j]; i++) {
+        miss[j] += S::predict_and_update(c[j], pcs[j][i], outcomes[j][i]) != outcomes[j][i];
+      }
+    }
+  }
+  for (int j = 0; j < K; j++) {
+    S::store(ps[j], c[j]);
+    mispredictions[j] += miss[j];
+  }
+}
+
+// The lanes only beat the prefetching batch loop once the tables are
+// well out of the cache
+//
+// Returns True if Successful, False when a table is smaller than
+// BP_PREFETCH_MIN_BYTES, replaying nothing
+//
+template <class S>
+static int scheme_predict_traces(predictor_t *const *ps, int k, const predictor_branch_t *const *br, const size_t *n,
+                                 uint64_t *mispredictions)
+{
+  for (int j = 0; j < k; j++) {
+    if (S::footprint(S::load(ps[j])) < BP_PREFETCH_MIN_BYTES) return 0;
+  }
+  typedef void (*traces_fn)(predictor_t *const *, const predictor_branch_t *const *, const size_t *, uint64_t *);
+  static const traces_fn by_lanes[PREDICTOR_LOCKSTEP_MAX] = {
+    scheme_predict_traces_k<S, 1>, scheme_predict_traces_k<S, 2>, scheme_predict_traces_k<S, 3>,
+    scheme_predict_traces_k<S, 4>, scheme_predict_traces_k<S, 5>, scheme_predict_traces_k<S, 6>,
+    scheme_predict_traces_k<S, 7>, scheme_predict_traces_k<S, 8>,
+  };
+  by_lanes[k - 1](ps, br, n, mispredictions);
+  return 1;
+}
+
+// Conditional branches tage_predict_hashed hashes at a time; their
+// hashes stay in L1
+#define TAGE_HASHED_CHUNK 256
+
+// scheme_predict_batch for TAGE tables large enough to prefetch. That
+// loop walks the history a second time, BP_PREFETCH_DISTANCE branches
+// ahead, and hashes every table twice, once to prefetch and once to
+// look up. Here the branches of a chunk are hashed once, with their
+// histories, before any table is read: the lookups then wait on no
+// history register and the prefetches read the indices already there
+template <class G>
+static uint64_t tage_predict_hashed(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions)
+{
+  typedef tage_bp_t<G> S;
+  if (p->delay_ring || S::footprint(S::load(p)) < BP_PREFETCH_MIN_BYTES) {
+    return scheme_predict_batch<S>(p, br, n, predictions);
+  }
+  BP_SCRATCH tage_hashed_t hashed[TAGE_HASHED_CHUNK];
+  tage_hist_t hist = p->tage_hist;
+  uint64_t mispredictions = 0;
+  for (size_t i = 0; i < n;) {
+    size_t count = 0;
+    for (; i < n && count < TAGE_HASHED_CHUNK; i++) {
+      if (!(br[i].flags & BP_F_CONDITION)) continue;
+      tage_hashed_t *h = &hashed[count++];
+      h->index = (uint32_t)i;
+      tage_hash_branch<G>(p, &hist, br[i].pc, br[i].flags & BP_F_TAKEN, h);
+      // the first lookups have no branches ahead of them to hide theirs
+      if (count <= BP_PREFETCH_DISTANCE) tage_prefetch_hashed<G>(p, h);
+    }
+    for (size_t k = 0; k < count; k++) {
+      if (k + BP_PREFETCH_DISTANCE < count) tage_prefetch_hashed<G>(p, &hashed[k + BP_PREFETCH_DISTANCE]);
+      const tage_hashed_t *h = &hashed[k];
+      BP_COST_BEGIN(p, BP_COST_PREDICT_AND_TRAIN);
+      tage_lookup_t lk;
+      tage_lookup_hashed<G>(p, h, &lk);
+      tage_update<G>(p, &lk, h->taken);
+      BP_COST_END(p, BP_COST_PREDICT_AND_TRAIN);
+      mispredictions += lk.pred != h->taken;
+      if (predictions) predictions[h->index >> 6] |= (uint64_t)lk.pred << (h->index & 63);
+    }
+  }
+  p->tage_hist = hist;
+  return mispredictions;
+}
+
+// tage_predict_hashed in the sse4.2 kernels, with the CRC and carry-less
+// hashes of tage_hash_crc_sse42 and tage_hash_clmul_sse42 inlined into
+// its loops
+template <class G>
+__attribute__((target("sse4.2,pclmul"), flatten)) static uint64_t
+tage_predict_hashed_sse42(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions)
+{
+  return tage_predict_hashed<G>(p, br, n, predictions);
+}
+
+// The instruction set of the TAGE hash batch loops on this host
+static const int tage_hash_isa = kernel_usable(KERNEL_SSE42) ? KERNEL_SSE42 : KERNEL_SCALAR;
+
+// tage_predict_hashed on the conditional branches 'f' was last filled
+// from, with the folded histories before each read from its row of 'f'
+// at the slots of predictor_fold_attach rather than folded here. The
+// rows hold the indices of the branches ahead too, so those are
+// prefetched without a second pass over the history. Its own history
+// is then brought up to where 'f' left it
+template <class G>
+static uint64_t tage_predict_folded(predictor_t *p, const bp_folds_t *f, uint64_t *predictions)
+{
+  typedef tage_bp_t<G> S;
+  const int folds = f->n, num_tagged = G::num_tagged(p);
+  const uint8_t *idx = p->tage_slot[0], *tag0 = p->tage_slot[1], *tag1 = p->tage_slot[2];
+  const size_t ahead = S::footprint(S::load(p)) < BP_PREFETCH_MIN_BYTES ? f->count : BP_PREFETCH_DISTANCE;
+  uint64_t mispredictions = 0;
+  for (size_t k = 0; k < f->count; k++) {
+    if (k + ahead < f->count) {
+      const uint32_t *row = &f->rows[(k + ahead) * folds];
+      tage_hist_t next;
+      for (int t = 0; t < num_tagged; t++) next.idx[t] = row[idx[t]];
+      tage_prefetch<G>(p, f->pc[k + ahead], &next);
+    }
+    const uint32_t *row = &f->rows[k * folds];
+    tage_hist_t hist;
+    for (int t = 0; t < num_tagged; t++) {
+      hist.idx[t] = row[idx[t]];
+      hist.tag0[t] = row[tag0[t]];
+      hist.tag1[t] = row[tag1[t]];
+    }
+    hist.ghist = f->ghists[k];
+    uint8_t taken = f->taken[k];
+    BP_COST_BEGIN(p, BP_COST_PREDICT_AND_TRAIN);
+    tage_lookup_t lk;
+    tage_lookup<G>(p, f->pc[k], &hist, &lk);
+    tage_update<G>(p, &lk, taken);
+    BP_COST_END(p, BP_COST_PREDICT_AND_TRAIN);
+    mispredictions += lk.pred != taken;
+    if (predictions) predictions[f->index[k] >> 6] |= (uint64_t)lk.pred << (f->index[k] & 63);
+  }
+  uint64_t pos = p->tage_hist.pos;
+  for (size_t k = 0; k < f->count; k++) p->tage_hbuf[(pos + 1 + k) & (TAGE_HIST_BUF - 1)] = f->taken[k];
+  for (int t = 0; t < num_tagged; t++) {
+    p->tage_hist.idx[t] = f->value[idx[t]];
+    p->tage_hist.tag0[t] = f->value[tag0[t]];
+    p->tage_hist.tag1[t] = f->value[tag1[t]];
+  }
+  p->tage_hist.pos = f->pos;
+  p->tage_hist.ghist = f->ghist;
+  return mispredictions;
+}
+
+// tage_predict_folded in the sse4.2 kernels, as tage_predict_hashed_sse42
+template <class G>
+__attribute__((target("sse4.2,pclmul"), flatten)) static uint64_t
+tage_predict_folded_sse42(predictor_t *p, const bp_folds_t *f, uint64_t *predictions)
+{
+  return tage_predict_folded<G>(p, f, predictions);
+}
+
+typedef uint64_t (*tage_folded_fn)(predictor_t *p, const bp_folds_t *f, uint64_t *predictions);
+
+// The compiled-in TAGE geometries: the default and its
+// tageTaggedBits sweep, with the XOR hash. Any other configuration
+// runs tage_runtime, with the batch loop of its hash compiled in
+typedef struct {
+  int num_tagged, tagged_bits, bimodal_bits;
+  const int *hist_lengths;
+  tage_batch_fn batch;
+  tage_folded_fn folded;
+} tage_geometry_t;
+
+template <int NT, int TB, int BB, const int *H>
+static constexpr tage_geometry_t tage_geometry()
+{
+  return {NT, TB, BB, H, tage_predict_hashed<tage_fixed<NT, TB, BB, H> >,
+          tage_predict_folded<tage_fixed<NT, TB, BB, H> >};
+}
+
+static const tage_geometry_t tage_geometries[] = {
+  tage_geometry<TAGE_NUM_TAGGED, TAGE_TAGGED_BITS, TAGE_BIMODAL_BITS, tage_hist_lengths>(),
+  tage_geometry<TAGE_NUM_TAGGED, 10, TAGE_BIMODAL_BITS, tage_hist_lengths>(),
+  tage_geometry<TAGE_NUM_TAGGED, 11, TAGE_BIMODAL_BITS, tage_hist_lengths>(),
+  tage_geometry<TAGE_NUM_TAGGED, 13, TAGE_BIMODAL_BITS, tage_hist_lengths>(),
+  tage_geometry<TAGE_NUM_TAGGED, 14, TAGE_BIMODAL_BITS, tage_hist_lengths>(),
+};
+
+// The compiled-in geometry 'cfg' has, or NULL
+static const tage_geometry_t *tage_geometry_for(const predictor_config_t *cfg)
+{
+  for (size_t g = 0; g < sizeof(tage_geometries) / sizeof(tage_geometries[0]); g++) {
+    const tage_geometry_t *geo = &tage_geometries[g];
+    if (cfg->tageNumTagged == geo->num_tagged && cfg->tageTaggedBits == geo->tagged_bits &&
+        cfg->tageBimodalBits == geo->bimodal_bits &&
+        cfg->tageWays == 1 && !memcmp(cfg->tageHistLengths, geo->hist_lengths, geo->num_tagged * sizeof(int))) {
+      return geo;
+    }
+  }
+  return NULL;
+}
+
+static tage_batch_fn tage_batch_for(const predictor_config_t *cfg)
+{
+  switch (cfg->tageHash) {
+  case TAGE_HASH_MUL: return tage_predict_hashed<tage_runtime_hashed<tage_hash_mul> >;
+  case TAGE_HASH_CRC:
+    return tage_hash_isa == KERNEL_SSE42 ? tage_predict_hashed_sse42<tage_runtime_hashed<tage_hash_crc_sse42> >
+                                         : tage_predict_hashed<tage_runtime_hashed<tage_hash_crc> >;
+  case TAGE_HASH_CLMUL:
+    return tage_hash_isa == KERNEL_SSE42 ? tage_predict_hashed_sse42<tage_runtime_hashed<tage_hash_clmul_sse42> >
+                                         : tage_predict_hashed<tage_runtime_hashed<tage_hash_clmul> >;
+  }
+  const tage_geometry_t *geo = tage_geometry_for(cfg);
+  if (geo) return geo->batch;
+  return tage_predict_hashed<tage_runtime_hashed<tage_hash_xor> >;
+}
+
+// The loop of tage_predict_folded with the configured hash
+static tage_folded_fn tage_folded_for(const predictor_config_t *cfg)
+{
+  switch (cfg->tageHash) {
+  case TAGE_HASH_MUL: return tage_predict_folded<tage_runtime_hashed<tage_hash_mul> >;
+  case TAGE_HASH_CRC:
+    return tage_hash_isa == KERNEL_SSE42 ? tage_predict_folded_sse42<tage_runtime_hashed<tage_hash_crc_sse42> >
+                                         : tage_predict_folded<tage_runtime_hashed<tage_hash_crc> >;
+  case TAGE_HASH_CLMUL:
+    return tage_hash_isa == KERNEL_SSE42 ? tage_predict_folded_sse42<tage_runtime_hashed<tage_hash_clmul_sse42> >
+                                         : tage_predict_folded<tage_runtime_hashed<tage_hash_clmul> >;
+  }
+  const tage_geometry_t *geo = tage_geometry_for(cfg);
+  if (geo) return geo->folded;
+  return tage_predict_folded<tage_runtime_hashed<tage_hash_xor> >;
+}
+
+static uint64_t tage_predict_batch(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions)
+{
+  return p->tage_batch(p, br, n, predictions);
+}
+
+// Single branch entry points, for the original API
+template <class S>
+static uint8_t scheme_predict(predictor_t *p, uint32_t pc)
+{
+  typename S::ctx c = S::load(p);
+  return S::predict(c, pc);
+}
+
+template <class S>
+static void scheme_train(predictor_t *p, uint32_t pc, uint8_t outcome)
+{
+  typename S::ctx c = S::load(p);
+  if (p->delay_ring) {
+    delayed_step<S>(p, c, pc, outcome);
+  } else {
+    S::update(c, pc, outcome);
+  }
+  S::store(p, c);
+}
+
+template <class S>
+static uint8_t scheme_predict_and_train(predictor_t *p, uint32_t pc, uint8_t outcome)
+{
+  typename S::ctx c = S::load(p);
+  uint8_t pred = p->delay_ring ? delayed_step<S>(p, c, pc, outcome) : S::predict_and_update(c, pc, outcome);
+  S::store(p, c);
+  return pred;
+}
+
+typedef struct {
+  int (*init)(predictor_t *p);  // Returns True if Successful
+  void (*cleanup)(predictor_t *p);
+  uint8_t (*predict)(predictor_t *p, uint32_t pc);
+  void (*train)(predictor_t *p, uint32_t pc, uint8_t outcome);
+  uint8_t (*predict_and_train)(predictor_t *p, uint32_t pc, uint8_t outcome);
+  uint64_t (*predict_batch)(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions);
+  uint64_t (*predict_shared)(predictor_t *p, const predictor_branch_t *br, const bp_history_batch_t *hist,
+                             uint64_t *predictions); // NULL when the scheme keeps its own history
+  int (*predict_traces)(predictor_t *const *ps, int k, const predictor_branch_t *const *br, const size_t *n,
+                        uint64_t *mispredictions); // NULL when not interleaved, see predictor_predict_traces
+  void (*state)(predictor_t *p, state_cursor_t *c);
+  void (*describe)(const predictor_config_t *cfg, char *buf, size_t len);
+  void (*layout)(predictor_t *p, arena_t *a);  // NULL when the tables are not in the arena
+  uint64_t (*budget)(const predictor_config_t *cfg);
+  size_t delay_slot;          // bytes per update in flight, 0 when nothing trains
+  uint32_t (*fields)(const predictor_config_t *cfg); // BP_FIELD_* read beyond the pc and outcome
+} predictor_ops_t;
+
+// The direction schemes read nothing but the pc, the outcome and
+// whether the branch is conditional
+static uint32_t direction_fields(const predictor_config_t *cfg)
+{
+  return 0;
+}
+
+template <class S>
+static constexpr predictor_ops_t scheme_ops()
+{
+  return {S::init, S::cleanup, scheme_predict<S>, scheme_train<S>, scheme_predict_and_train<S>,
+          scheme_predict_batch<S>, NULL, NULL, S::state, S::describe, S::layout, S::budget, sizeof(delay_slot<S>),
+          direction_fields};
+}
+
+// Schemes whose history is a plain outcome register, S::shared of the
+// shared one
+template <class S>
+static constexpr predictor_ops_t shared_ops()
+{
+  predictor_ops_t ops = scheme_ops<S>();
+  ops.predict_shared = scheme_predict_shared<S>;
+  return ops;
+}
+
+// 'len' copies of the conditional branch at 'pc' going the way of
+// 'outcome', predicted and trained one by one only until the history
+// is all 'outcome' and the counter it then indexes is saturated that
+// way: every later copy is predicted right and changes nothing but the
+// history, which shifts in the rest of the run at once. The loop ends
+// within ghistoryBits + 3 copies whatever the length of the run
+//
+// Returns the mispredictions, with the predictions set in
+// 'predictions' from bit 'at' when it is not NULL
+//
+static uint64_t gshare_run(gshare_bp::ctx &c, uint32_t pc, uint8_t outcome, size_t len, uint64_t *predictions,
+                           size_t at)
+{
+  const uint32_t fixed = outcome ? c.mask : 0;
+  const uint8_t saturated = outcome ? ST : SN;
+  uint64_t mispredictions = 0;
+  size_t k = 0;
+  for (; k < len; k++) {
+    if ((c.hist & c.mask) == fixed && ctr_get<2, WN>(c.bht, (pc ^ fixed) & c.mask) == saturated) break;
+    uint8_t pred = gshare_bp::predict_and_update(c, pc, outcome);
+    mispredictions += pred != outcome;
+    if (predictions && pred) predictions[(at + k) >> 6] |= 1ULL << ((at + k) & 63);
+  }
+  size_t rest = len - k;
+  c.hist = rest >= 64 ? (outcome ? ~0ULL : 0) : (c.hist << rest) | (outcome ? (1ULL << rest) - 1 : 0);
+  for (; predictions && outcome && k < len; k++) {
+    predictions[(at + k) >> 6] |= 1ULL << ((at + k) & 63);
+  }
+  return mispredictions;
+}
+
+// scheme_predict_batch on gshare, with BP_RUN_MIN or more copies of a
+// conditional record in a row going through gshare_run. The records
+// come expanded, so finding a run still reads each copy, but only to
+// compare it with the first
+static uint64_t gshare_predict_runs(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions)
+{
+  if (p->delay_ring) {
+    return scheme_predict_delayed<gshare_bp>(p, br, n, predictions);
+  }
+  gshare_bp::ctx c = gshare_bp::load(p);
+  uint64_t mispredictions = 0;
+  int prefetch = gshare_bp::footprint(c) >= BP_PREFETCH_MIN_BYTES;
+  size_t ahead = 0, run_end = 0;
+  uint64_t ahead_hist = c.hist;
+  for (size_t i = 0; i < n; i++) {
+    if (!(br[i].flags & BP_F_CONDITION)) continue;
+    uint8_t outcome = br[i].flags & BP_F_TAKEN;
+    if (i >= run_end && i + 1 < n && br[i + 1].pc == br[i].pc && br[i + 1].flags == br[i].flags) {
+      for (run_end = i + 2; run_end < n && br[run_end].pc == br[i].pc && br[run_end].flags == br[i].flags; run_end++);
+      if (run_end - i >= BP_RUN_MIN) {
+        mispredictions += gshare_run(c, br[i].pc, outcome, run_end - i, predictions, i);
+        i = run_end - 1;
+        if (ahead <= i) {
+          ahead = run_end;
+          ahead_hist = c.hist;
+        }
+        continue;
+      }
+    }
+    if (prefetch) {
+      for (; ahead < n && ahead <= i + BP_PREFETCH_DISTANCE; ahead++) {
+        if (!(br[ahead].flags & BP_F_CONDITION)) continue;
+        gshare_bp::prefetch(c, br[ahead].pc, ahead_hist);
+        gshare_bp::push(c, ahead_hist, br[ahead].flags & BP_F_TAKEN);
+      }
+    }
+    uint8_t pred = gshare_bp::predict_and_update(c, br[i].pc, outcome);
+    mispredictions += pred != outcome;
+    if (predictions && pred) predictions[i >> 6] |= 1ULL << (i & 63);
+  }
+  gshare_bp::store(p, c);
+  return mispredictions;
+}
+
+#ifdef BP_GSHARE_CONFLICT
+// scheme_predict_batch on gshare 16 conditional branches at a time. The
+// outcomes are known, so the indices of a batch are worked out first.
+// The table is read as 32-bit words of 16 counters, and the lanes that
+// are first in the batch to touch their word are gathered, stepped and
+// scattered at once, as in gshare_lockstep; VPCONFLICTD finds the
+// others, which then train one by one in order on the words the vector
+// step left. Only branches sharing a word see each other's updates, so
+// the results are those of the scalar loop. Only tables larger than a
+// typical L2 gain from the gathers overlapping their misses; smaller
+// ones, and those with an updateDelay, take gshare_predict_runs
+__attribute__((target("avx512f,avx512cd"))) static uint64_t
+gshare_predict_conflict_avx512(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions)
+{
+  ctr_word_t *bht = p->bht_gshare;
+  const uint32_t mask = (1u << p->cfg.ghistoryBits) - 1;
+  const __m512i one = _mm512_set1_epi32(1), three = _mm512_set1_epi32(3);
+  uint64_t hist = p->ghistory, mispredictions = 0;
+  alignas(64) uint32_t idx[16];
+  size_t pos[16];
+  for (size_t i = 0; i < n;) {
+    int m = 0;
+    uint32_t taken = 0;
+    for (; i < n && m < 16; i++) {
+      if (!(br[i].flags & BP_F_CONDITION)) continue;
+      uint32_t outcome = br[i].flags & BP_F_TAKEN;
+      idx[m] = (br[i].pc ^ (uint32_t)hist) & mask;
+      pos[m] = i;
+      taken |= outcome << m++;
+      hist = (hist << 1) | outcome;
+    }
+    const __mmask16 live = (__mmask16)((1u << m) - 1), outcome = (__mmask16)taken;
+    __m512i index = _mm512_maskz_load_epi32(live, idx);
+    __m512i word_at = _mm512_srli_epi32(index, 4);
+    __m512i shift = _mm512_slli_epi32(_mm512_and_si512(index, _mm512_set1_epi32(15)), 1);
+    __m512i conflict = _mm512_conflict_epi32(word_at);
+    __mmask16 first = _mm512_mask_testn_epi32_mask(live, conflict, conflict);
+    __m512i word = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), first, word_at, bht, 4);
+    __m512i c = _mm512_xor_si512(_mm512_and_si512(_mm512_srlv_epi32(word, shift), three), one);
+    __mmask16 pred = _mm512_mask_cmpge_epu32_mask(first, c, _mm512_set1_epi32(2));
+    mispredictions += __builtin_popcount((pred ^ outcome) & first);
+    __m512i next = _mm512_mask_add_epi32(_mm512_sub_epi32(c, one), outcome, c, one);
+    __m512i step = _mm512_sllv_epi32(_mm512_and_si512(_mm512_xor_si512(c, next), three), shift);
+    __mmask16 move = _mm512_mask_cmpneq_epu32_mask(first, c, _mm512_maskz_mov_epi32(outcome, three));
+    _mm512_mask_i32scatter_epi32(bht, move, word_at, _mm512_xor_si512(word, step), 4);
+    for (uint32_t rest = live & ~first; rest; rest &= rest - 1) {
+      int j = __builtin_ctz(rest);
+      uint8_t o = (taken >> j) & 1;
+      uint8_t lane = ctr_predict<2>(ctr_get<2, WN>(bht, idx[j]));
+      mispredictions += lane != o;
+      pred |= (__mmask16)(lane << j);
+      ctr_update_packed<2, WN>(bht, idx[j], o);
+    }
+    if (predictions) {
+      for (uint32_t set = pred; set; set &= set - 1) {
+        size_t at = pos[__builtin_ctz(set)];
+        predictions[at >> 6] |= 1ULL << (at & 63);
+      }
+    }
+  }
+  p->ghistory = hist;
+  return mispredictions;
+}
+
+// The instruction set of the gshare batch loop on this host
+static const int gshare_conflict_isa = kernel_usable(KERNEL_AVX512) ? KERNEL_AVX512 : KERNEL_SCALAR;
+
+static uint64_t gshare_predict_conflict(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions)
+{
+  if (gshare_conflict_isa != KERNEL_AVX512 || p->delay_ring ||
+      gshare_bp::footprint(gshare_bp::load(p)) < BP_PREFETCH_MIN_BYTES) {
+    return gshare_predict_runs(p, br, n, predictions);
+  }
+  return gshare_predict_conflict_avx512(p, br, n, predictions);
+}
+#endif
+
+// gshare also interleaves; tournament and the perceptron measured
+// slower interleaved than in their own batch loops. A batch replays
+// runs of one branch in closed form, or on an AVX-512 host goes
+// through gshare_predict_conflict. The cost and occupancy builds
+// sample every update and keep the plain loop
+static constexpr predictor_ops_t gshare_ops()
+{
+  predictor_ops_t ops = shared_ops<gshare_bp>();
+  ops.predict_traces = scheme_predict_traces<gshare_bp>;
+#if !defined(BP_COST) && !defined(BP_OCCUPANCY)
+  ops.predict_batch = gshare_predict_runs;
+#endif
+#ifdef BP_GSHARE_CONFLICT
+  ops.predict_batch = gshare_predict_conflict;
+#endif
+  return ops;
+}
+
+// Static predictions train nothing, so there is nothing to delay
+static constexpr predictor_ops_t static_ops()
+{
+  predictor_ops_t ops = scheme_ops<static_bp>();
+  ops.delay_slot = 0;
+  return ops;
+}
+
+// TAGE batches go through the loop init picked for the geometry
+static constexpr predictor_ops_t tage_ops()
+{
+  predictor_ops_t ops = scheme_ops<tage_bp>();
+  ops.predict_batch = tage_predict_batch;
+  ops.predict_traces = scheme_predict_traces<tage_xor_bp>;
+  return ops;
+}
+
+// The PLUGIN type forwards to the entry points of the loaded plugin;
+// its batches cross into the plugin once, not once per branch. The
+// tables live in the plugin and are not part of a state snapshot
+static const bp_plugin_t *bp_plugin;
+
+static int plugin_init(predictor_t *p)
+{
+  return bp_plugin && (p->plugin_state = bp_plugin->init()) != NULL;
+}
+
+static void plugin_cleanup(predictor_t *p)
+{
+  if (p->plugin_state)
+  {
+    bp_plugin->free(p->plugin_state);
+    p->plugin_state = NULL;
+  }
+}
+
+static uint8_t plugin_predict(predictor_t *p, uint32_t pc)
+{
+  return bp_plugin->predict(p->plugin_state, pc);
+}
+
+static void plugin_train(predictor_t *p, uint32_t pc, uint8_t outcome)
+{
+  bp_plugin->train(p->plugin_state, pc, outcome);
+}
+
+static uint8_t plugin_predict_and_train(predictor_t *p, uint32_t pc, uint8_t outcome)
+{
+  return bp_plugin->predict_and_train(p->plugin_state, pc, outcome);
+}
+
+static uint64_t plugin_predict_batch(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions)
+{
+  return bp_plugin->predict_batch(p->plugin_state, br, n, predictions);
+}
+
+static void plugin_state(predictor_t *p, state_cursor_t *c)
+{
+}
+
+// The plugin's own count, from its describe
+static uint64_t plugin_budget(const predictor_config_t *cfg)
+{
+  char buf[256];
+  return bp_plugin ? bp_plugin->describe(buf, sizeof(buf)) : 0;
+}
+
+// A plugin may read any field of the records
+static uint32_t plugin_fields(const predictor_config_t *cfg)
+{
+  return BP_FIELD_ALL;
+}
+
+static void plugin_describe(const predictor_config_t *cfg, char *buf, size_t len)
+{
+  if (!bp_plugin)
+  {
+    return;
+  }
+  uint64_t bits = bp_plugin->describe(buf, len);
+  size_t n = strlen(buf);
+  if (n < len)
+  {
+    snprintf(buf + n, len - n, "%sbudgetBits=%llu", n ? " " : "", (unsigned long long)bits);
+  }
+}
+
+// The perceptron with perceptronFeatures other than the default, over
+// chunks of PERCEPTRON_CHUNK conditional branches. A sequential pass
+// reads each one's feature values, and the local histories it shifts,
+// from registers advanced past every record; a pass per feature hashes
+// its values of the chunk to rows, lane-wise so it vectorizes; then
+// each branch predicts and trains in order, prefetching the rows of
+// the one BP_PREFETCH_DISTANCE ahead
+static uint64_t perceptron_mp_batch(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions)
+{
+  const int features = p->cfg.perceptronFeatures;
+  const uint32_t mask = (1u << p->cfg.perceptronBits) - 1;
+  int list[PERCEPTRON_FEATURES - 1], count = 0;
+  for (int m = features & ~PERCEPTRON_F_GLOBAL; m; m &= m - 1) list[count++] = m & -m;
+  uint32_t rows[PERCEPTRON_FEATURES - 1][PERCEPTRON_CHUNK];
+  uint32_t at[PERCEPTRON_CHUNK], pcs[PERCEPTRON_CHUNK];
+  uint64_t hists[PERCEPTRON_CHUNK];
+  uint8_t taken[PERCEPTRON_CHUNK];
+  uint64_t hist = p->pc_ghist, mispredictions = 0;
+  bp_history_t regs = p->pc_regs;
+  int depth = p->pc_depth;
+  for (size_t i = 0; i < n;) {
+    size_t k = 0;
+    for (; i < n && k < PERCEPTRON_CHUNK; i++) {
+      const predictor_branch_t *b = &br[i];
+      if (b->flags & BP_F_CONDITION) {
+        uint8_t outcome = b->flags & BP_F_TAKEN;
+        uint16_t *l = p->pc_local ? &p->pc_local[b->pc & mask] : NULL;
+        for (int s = 0; s < count; s++) rows[s][k] = perceptron_feature_value(list[s], hist, &regs, depth, l ? *l : 0);
+        if (l) *l = (uint16_t)((*l << 1) | outcome);
+        at[k] = i;
+        pcs[k] = b->pc;
+        hists[k] = hist;
+        taken[k] = outcome;
+        k++;
+        hist = (hist << 1) | outcome;
+      }
+      if (features & PERCEPTRON_F_BRANCHES) perceptron_observe(&regs, &depth, b);
+    }
+    for (int s = 0; s < count; s++) {
+      int f = list[s];
+      for (size_t j = 0; j < k; j++) rows[s][j] = perceptron_feature_row(mask, pcs[j], rows[s][j], f);
+    }
+    for (size_t j = 0; j < k; j++) {
+      size_t a = j + BP_PREFETCH_DISTANCE;
+      if (a < k) {
+        if (features & PERCEPTRON_F_GLOBAL) {
+          perceptron_bp::ctx c = {hists[a], p};
+          perceptron_bp::prefetch(c, pcs[a], hists[a]);
+        }
+        for (int s = 0; s < count; s++) {
+          __builtin_prefetch(p->pc_features + ((size_t)s << p->cfg.perceptronBits) + rows[s][a], 1);
+        }
+      }
+      uint32_t r[PERCEPTRON_FEATURES - 1];
+      for (int s = 0; s < count; s++) r[s] = rows[s][j];
+      perceptron_mp_lookup_t lk;
+      BP_COST_BEGIN(p, BP_COST_PREDICT_AND_TRAIN);
+      perceptron_mp_lookup(p, pcs[j], hists[j], r, &lk);
+      perceptron_mp_update(p, &lk, taken[j]);
+      BP_COST_END(p, BP_COST_PREDICT_AND_TRAIN);
+      uint8_t pred = lk.sum >= 0;
+      mispredictions += pred != taken[j];
+      if (predictions) predictions[at[j] >> 6] |= (uint64_t)pred << (at[j] & 63);
+    }
+  }
+  p->pc_ghist = hist;
+  p->pc_regs = regs;
+  p->pc_depth = depth;
+  return mispredictions;
+}
+
+// The perceptron's entry points take the scheme loops for the default
+// features and the loops above for any others
+static uint8_t perceptron_predict(predictor_t *p, uint32_t pc)
+{
+  if (p->cfg.perceptronFeatures == PERCEPTRON_F_DEFAULT) {
+    return scheme_predict<perceptron_bp>(p, pc);
+  }
+  uint32_t rows[PERCEPTRON_FEATURES - 1];
+  perceptron_mp_lookup_t lk;
+  perceptron_feature_rows(p, pc, rows);
+  perceptron_mp_lookup(p, pc, p->pc_ghist, rows, &lk);
+  return lk.sum >= 0;
+}
+
+static uint8_t perceptron_predict_and_train(predictor_t *p, uint32_t pc, uint8_t outcome)
+{
+  if (p->cfg.perceptronFeatures == PERCEPTRON_F_DEFAULT) {
+    return scheme_predict_and_train<perceptron_bp>(p, pc, outcome);
+  }
+  uint32_t rows[PERCEPTRON_FEATURES - 1];
+  perceptron_mp_lookup_t lk;
+  perceptron_feature_rows(p, pc, rows);
+  perceptron_mp_lookup(p, pc, p->pc_ghist, rows, &lk);
+  perceptron_mp_update(p, &lk, outcome);
+  perceptron_mp_push(p, pc, outcome);
+  return lk.sum >= 0;
+}
+
+static void perceptron_train(predictor_t *p, uint32_t pc, uint8_t outcome)
+{
+  if (p->cfg.perceptronFeatures == PERCEPTRON_F_DEFAULT) {
+    scheme_train<perceptron_bp>(p, pc, outcome);
+  } else {
+    perceptron_predict_and_train(p, pc, outcome);
+  }
+}
+
+static uint64_t perceptron_predict_batch(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions)
+{
+  if (p->cfg.perceptronFeatures == PERCEPTRON_F_DEFAULT) {
+    return scheme_predict_batch<perceptron_bp>(p, br, n, predictions);
+  }
+  return perceptron_mp_batch(p, br, n, predictions);
+}
+
+static uint64_t perceptron_predict_shared(predictor_t *p, const predictor_branch_t *br, const bp_history_batch_t *hist,
+                                          uint64_t *predictions)
+{
+  if (p->cfg.perceptronFeatures == PERCEPTRON_F_DEFAULT) {
+    return scheme_predict_shared<perceptron_bp>(p, br, hist, predictions);
+  }
+  return perceptron_mp_batch(p, br, hist->n, predictions);
+}
+
+// The call depth reads the call and return flags, the target feature
+// the targets
+static uint32_t perceptron_fields(const predictor_config_t *cfg)
+{
+  return (cfg->perceptronFeatures & PERCEPTRON_F_DEPTH ? BP_FIELD_CALL | BP_FIELD_RET : 0) |
+         (cfg->perceptronFeatures & PERCEPTRON_F_TARGETS ? BP_FIELD_TARGET : 0);
+}
+
+static constexpr predictor_ops_t perceptron_ops()
+{
+  predictor_ops_t ops = scheme_ops<perceptron_bp>();
+  ops.fields = perceptron_fields;
+  ops.predict = perceptron_predict;
+  ops.train = perceptron_train;
+  ops.predict_and_train = perceptron_predict_and_train;
+  ops.predict_batch = perceptron_predict_batch;
+  ops.predict_shared = perceptron_predict_shared;
+  return ops;
+}
+
+// YAGS batches run the loops of the configured hash
+static uint64_t yags_predict_batch(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions)
+{
+  switch (p->cfg.yagsHash) {
+  case TAGE_HASH_MUL: return scheme_predict_batch<yags_bp_t<tage_hash_mul> >(p, br, n, predictions);
+  case TAGE_HASH_CRC: return scheme_predict_batch<yags_bp_t<tage_hash_crc> >(p, br, n, predictions);
+  case TAGE_HASH_CLMUL: return scheme_predict_batch<yags_bp_t<tage_hash_clmul> >(p, br, n, predictions);
+  }
+  return scheme_predict_batch<yags_bp_t<tage_hash_xor> >(p, br, n, predictions);
+}
+
+static uint64_t yags_predict_shared(predictor_t *p, const predictor_branch_t *br, const bp_history_batch_t *hist,
+                                    uint64_t *predictions)
+{
+  switch (p->cfg.yagsHash) {
+  case TAGE_HASH_MUL: return scheme_predict_shared<yags_bp_t<tage_hash_mul> >(p, br, hist, predictions);
+  case TAGE_HASH_CRC: return scheme_predict_shared<yags_bp_t<tage_hash_crc> >(p, br, hist, predictions);
+  case TAGE_HASH_CLMUL: return scheme_predict_shared<yags_bp_t<tage_hash_clmul> >(p, br, hist, predictions);
+  }
+  return scheme_predict_shared<yags_bp_t<tage_hash_xor> >(p, br, hist, predictions);
+}
+
+static constexpr predictor_ops_t yags_ops()
+{
+  predictor_ops_t ops = scheme_ops<yags_bp>();
+  ops.predict_batch = yags_predict_batch;
+  ops.predict_shared = yags_predict_shared;
+  return ops;
+}
+
+// Indexed by type, in the order of bpName; a new predictor adds its
+// struct here, a name to bpName and one to NUM_BP_TYPES
+static const predictor_ops_t predictor_ops[] = {
+  static_ops(),
+  gshare_ops(),
+  shared_ops<tournament_bp>(),
+  tage_ops(),
+  {plugin_init, plugin_cleanup, plugin_predict, plugin_train, plugin_predict_and_train,
+   plugin_predict_batch, NULL, NULL, plugin_state, plugin_describe, NULL, plugin_budget, 0, plugin_fields},
+  perceptron_ops(),
+  yags_ops(),
+};
+static_assert(sizeof(predictor_ops) / sizeof(predictor_ops[0]) == NUM_BP_TYPES, "one entry per predictor type");
+
+// With cfg->unbounded, by type as predictor_ops; predictor_config_valid
+// refuses the others. They keep no arrays to interleave or pipeline
+static const predictor_ops_t unbounded_ops[] = {
+  static_ops(),
+  shared_ops<gshare_unbounded_bp>(),
+  shared_ops<tournament_unbounded_bp>(),
+  scheme_ops<tage_unbounded_bp>(),
+};
+
+// The entry points of 'cfg'
+static inline const predictor_ops_t *ops_of(const predictor_config_t *cfg)
+{
+  return cfg->unbounded && cfg->type >= GSHARE && cfg->type <= CUSTOM ? &unbounded_ops[cfg->type]
+                                                                       : &predictor_ops[cfg->type];
+}
+
+static size_t delay_ring_bytes(const predictor_config_t *cfg)
+{
+  return cfg->updateDelay ? ops_of(cfg)->delay_slot * (cfg->updateDelay + 1) : 0;
+}
+
+//------------------------------------//
+//        Predictor Instances         //
+//------------------------------------//
+
+predictor_config_t predictor_default_config(int type)
+{
+  predictor_config_t cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.type = type;
+  cfg.ghistoryBits = ghistoryBits;
+  cfg.lhtBits = T_LHT_BITS;
+  cfg.ghrBits = T_GHR_BITS;
+  cfg.localHistBits = T_LOCAL_HIST_BITS;
+  cfg.localWays = T_LOCAL_WAYS;
+  cfg.localPatternBits = T_LOCAL_PATTERN_BITS;
+  cfg.tageBimodalBits = TAGE_BIMODAL_BITS;
+  cfg.tageTaggedBits = TAGE_TAGGED_BITS;
+  cfg.tageNumTagged = TAGE_NUM_TAGGED;
+  cfg.tageSeed = TAGE_SEED;
+  cfg.tageSC = TAGE_SC;
+  cfg.tageLoop = TAGE_LOOP;
+  cfg.tageFilter = TAGE_FILTER;
+  cfg.tageUReset = TAGE_U_RESET;
+  cfg.tageHash = TAGE_HASH;
+  cfg.tageWays = TAGE_WAYS;
+  cfg.perceptronBits = PERCEPTRON_BITS;
+  cfg.perceptronFeatures = PERCEPTRON_F_DEFAULT;
+  cfg.yagsChoiceBits = YAGS_CHOICE_BITS;
+  cfg.yagsCacheBits = YAGS_CACHE_BITS;
+  cfg.yagsTagBits = YAGS_TAG_BITS;
+  cfg.yagsHistBits = YAGS_HIST_BITS;
+  cfg.yagsHash = YAGS_HASH;
+  cfg.updateDelay = updateDelay;
+  cfg.unbounded = unbounded && (type == GSHARE || type == TOURNAMENT || type == CUSTOM);
+  for (int t = 0; t < TAGE_NUM_TAGGED; t++)
+  {
+    cfg.tageHistLengths[t] = tage_hist_lengths[t];
+  }
+  return cfg;
+}
+
+int predictor_type_by_name(const char *name)
+{
+  for (int t = 0; t < NUM_BP_TYPES; t++)
+  {
+    if (!strcasecmp(name, bpName[t]))
+    {
+      return t;
+    }
+  }
+  return -1;
+}
+
+int predictor_plugin_load(const char *path)
+{
+  if (bp_plugin)
+  {
+    fprintf(stderr, "Only one plugin can be loaded\n");
+    return 0;
+  }
+  // A bare name would be searched for on the library path
+  std::string file = strchr(path, '/') ? path : std::string("./") + path;
+  void *lib = dlopen(file.c_str(), RTLD_NOW | RTLD_LOCAL);
+  if (!lib)
+  {
+    fprintf(stderr, "Unable to load plugin %s: %s\n", path, dlerror());
+    return 0;
+  }
+  typedef const bp_plugin_t *(*info_fn)(void);
+  info_fn info = (info_fn)dlsym(lib, BP_PLUGIN_ENTRY);
+  const bp_plugin_t *plugin = info ? info() : NULL;
+  if (!plugin || plugin->abi != BP_PLUGIN_ABI || !plugin->init || !plugin->predict || !plugin->train ||
+      !plugin->predict_and_train || !plugin->predict_batch || !plugin->free || !plugin->describe)
+  {
+    fprintf(stderr, "%s is not a predictor plugin of ABI %d\n", path, BP_PLUGIN_ABI);
+    dlclose(lib);
+    return 0;
+  }
+  bp_plugin = plugin;
+  if (plugin->name && plugin->name[0])
+  {
+    bpName[PLUGIN] = plugin->name;
+  }
+  return 1;
+}
+
+int predictor_config_set(predictor_config_t *cfg, const char *key, int value)
+{
+  static const struct { const char *name; const char *macro; size_t offset; } fields[] = {
+    {"ghistoryBits", "ghistoryBits", offsetof(predictor_config_t, ghistoryBits)},
+    {"lhtBits", "T_LHT_BITS", offsetof(predictor_config_t, lhtBits)},
+    {"ghrBits", "T_GHR_BITS", offsetof(predictor_config_t, ghrBits)},
+    {"localHistBits", "T_LOCAL_HIST_BITS", offsetof(predictor_config_t, localHistBits)},
+    {"localWays", "T_LOCAL_WAYS", offsetof(predictor_config_t, localWays)},
+    {"localPatternBits", "T_LOCAL_PATTERN_BITS", offsetof(predictor_config_t, localPatternBits)},
+    {"tageBimodalBits", "TAGE_BIMODAL_BITS", offsetof(predictor_config_t, tageBimodalBits)},
+    {"tageTaggedBits", "TAGE_TAGGED_BITS", offsetof(predictor_config_t, tageTaggedBits)},
+    {"tageNumTagged", "TAGE_NUM_TAGGED", offsetof(predictor_config_t, tageNumTagged)},
+    {"tageSeed", "TAGE_SEED", offsetof(predictor_config_t, tageSeed)},
+    {"tageSC", "TAGE_SC", offsetof(predictor_config_t, tageSC)},
+    {"tageLoop", "TAGE_LOOP", offsetof(predictor_config_t, tageLoop)},
+    {"tageFilter", "TAGE_FILTER", offsetof(predictor_config_t, tageFilter)},
+    {"tageUReset", "TAGE_U_RESET", offsetof(predictor_config_t, tageUReset)},
+    {"tageHash", "TAGE_HASH", offsetof(predictor_config_t, tageHash)},
+    {"tageWays", "TAGE_WAYS", offsetof(predictor_config_t, tageWays)},
+    {"perceptronBits", "PERCEPTRON_BITS", offsetof(predictor_config_t, perceptronBits)},
+    {"perceptronFeatures", "PERCEPTRON_FEATURES", offsetof(predictor_config_t, perceptronFeatures)},
+    {"yagsChoiceBits", "YAGS_CHOICE_BITS", offsetof(predictor_config_t, yagsChoiceBits)},
+    {"yagsCacheBits", "YAGS_CACHE_BITS", offsetof(predictor_config_t, yagsCacheBits)},
+    {"yagsTagBits", "YAGS_TAG_BITS", offsetof(predictor_config_t, yagsTagBits)},
+    {"yagsHistBits", "YAGS_HIST_BITS", offsetof(predictor_config_t, yagsHistBits)},
+    {"yagsHash", "YAGS_HASH", offsetof(predictor_config_t, yagsHash)},
+    {"updateDelay", "UPDATE_DELAY", offsetof(predictor_config_t, updateDelay)},
+    {"unbounded", "UNBOUNDED", offsetof(predictor_config_t, unbounded)},
+  };
+  for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+  {
+    if (!strcmp(key, fields[i].name) || !strcmp(key, fields[i].macro))
+    {
+      *(int *)((char *)cfg + fields[i].offset) = value;
+      return 1;
+    }
+  }
+
+  // tageHistLengths.<table>, also as tage_hist_lengths.<table>
+  const char *dot = strchr(key, '.');
+  if (dot && (!strncmp(key, "tageHistLengths.", 16) || !strncmp(key, "tage_hist_lengths.", 18)))
+  {
+    char *end;
+    long t = strtol(dot + 1, &end, 10);
+    if (*end || end == dot + 1 || t < 0 || t >= TAGE_MAX_TAGGED)
+    {
+      return 0;
+    }
+    cfg->tageHistLengths[t] = value;
+    return 1;
+  }
+  return 0;
+}
+
+void predictor_config_format(const predictor_config_t *cfg, char *buf, size_t len)
+{
+  buf[0] = '\0';
+  if (cfg->type >= 0 && cfg->type < NUM_BP_TYPES)
+  {
+    ops_of(cfg)->describe(cfg, buf, len);
+  }
+  // of every type that trains, so only when set
+  size_t n = strlen(buf);
+  if (cfg->updateDelay && n < len)
+  {
+    snprintf(buf + n, len - n, n ? " updateDelay=%d" : "updateDelay=%d", cfg->updateDelay);
+  }
+  n = strlen(buf);
+  if (cfg->unbounded && n < len)
+  {
+    snprintf(buf + n, len - n, n ? " unbounded=%d" : "unbounded=%d", cfg->unbounded);
+  }
+}
+
+// Returns True if every field of 'cfg' is in range
+//
+static int predictor_config_valid(const predictor_config_t *cfg)
+{
+  if (cfg->type < 0 || cfg->type >= NUM_BP_TYPES ||
+      cfg->ghistoryBits < 1 || cfg->ghistoryBits > 30 ||
+      cfg->lhtBits < 1 || cfg->lhtBits > 30 || cfg->ghrBits < 1 || cfg->ghrBits > 30 ||
+      cfg->localHistBits < 0 || cfg->localHistBits > 30 || cfg->localPatternBits < 0 ||
+      cfg->localWays < 1 || cfg->localWays > LOCAL_MAX_WAYS || (cfg->localWays & (cfg->localWays - 1)) ||
+      __builtin_ctz(cfg->localWays) > cfg->lhtBits ||
+      (cfg->localWays > 1 && tournament_local_hist_bits(cfg) > 32 - LOCAL_TAG_WIDTH) ||
+      tournament_local_hist_bits(cfg) + cfg->localPatternBits > 30 ||
+      cfg->tageBimodalBits < 1 || cfg->tageBimodalBits > 30 ||
+      cfg->tageTaggedBits <= TAGE_TAG_SHORTER || cfg->tageTaggedBits > 16 + TAGE_TAG_SHORTER ||
+      cfg->tageNumTagged < 1 || cfg->tageNumTagged > TAGE_MAX_TAGGED ||
+      cfg->tageSC < 0 || cfg->tageSC > 1 || cfg->tageLoop < 0 || cfg->tageLoop > 1 ||
+      cfg->tageFilter < 0 || cfg->tageFilter > 1 ||
+      (cfg->tageUReset && (cfg->tageUReset < TAGE_U_RESET_MIN || cfg->tageUReset > 30)) ||
+      cfg->tageHash < 0 || cfg->tageHash >= TAGE_HASHES ||
+      cfg->tageWays < 1 || cfg->tageWays > TAGE_MAX_WAYS || (cfg->tageWays & (cfg->tageWays - 1)) ||
+      cfg->tageTaggedBits - TAGE_TAG_SHORTER + __builtin_ctz(cfg->tageWays) > 16 ||
+      cfg->perceptronBits < 1 || cfg->perceptronBits > 24 ||
+      cfg->perceptronFeatures < 1 || cfg->perceptronFeatures >= 1 << PERCEPTRON_FEATURES ||
+      (cfg->perceptronFeatures != PERCEPTRON_F_DEFAULT && cfg->type == PERCEPTRON && cfg->updateDelay) ||
+      cfg->yagsChoiceBits < 1 || cfg->yagsChoiceBits > 30 || cfg->yagsCacheBits < 1 || cfg->yagsCacheBits > 29 ||
+      cfg->yagsTagBits < 1 || cfg->yagsTagBits > YAGS_MAX_TAG_BITS || cfg->yagsHistBits < 0 ||
+      cfg->yagsHistBits > 32 || cfg->yagsHash < 0 || cfg->yagsHash >= TAGE_HASHES ||
+      cfg->updateDelay < 0 || cfg->updateDelay > PREDICTOR_DELAY_MAX || (cfg->updateDelay && cfg->type == PLUGIN) ||
+      cfg->unbounded < 0 || cfg->unbounded > 1 ||
+      (cfg->unbounded && cfg->type != GSHARE && cfg->type != TOURNAMENT && cfg->type != CUSTOM) ||
+      (cfg->unbounded && cfg->type == TOURNAMENT && cfg->localWays != 1) ||
+      (cfg->unbounded && cfg->type == CUSTOM &&
+       (cfg->tageSC || cfg->tageLoop || cfg->tageFilter || cfg->tageUReset || cfg->tageWays != 1)))
+  {
+    return 0;
+  }
+  for (int t = 0; t < cfg->tageNumTagged; t++)
+  {
+    if (cfg->tageHistLengths[t] < 0 || cfg->tageHistLengths[t] > TAGE_MAX_HIST)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+uint64_t predictor_budget_bits(const predictor_config_t *cfg)
+{
+  return predictor_config_valid(cfg) ? ops_of(cfg)->budget(cfg) : 0;
+}
+
+uint32_t predictor_fields(const predictor_config_t *cfg)
+{
+  return predictor_config_valid(cfg) ? ops_of(cfg)->fields(cfg) : BP_FIELD_ALL;
+}
+
+#ifndef BP_BUILD_ID
+#define BP_BUILD_ID "unknown"
+#endif
+
+const char *predictor_build_id()
+{
+  return BP_BUILD_ID;
+}
+
+size_t predictor_config_memory(const predictor_config_t *cfg)
+{
+  if (!predictor_config_valid(cfg))
+  {
+    return 0;
+  }
+  // the layout only reads the configuration with no arena to carve
+  predictor_t scratch;
+  memset(&scratch, 0, sizeof(scratch));
+  scratch.cfg = *cfg;
+  arena_t a = {NULL, 0};
+  if (ops_of(cfg)->layout)
+  {
+    arena_place(&scratch, ops_of(cfg)->layout, &a);
+  }
+  size_t bytes = a.used;
+  if (bytes >= PREDICTOR_ARENA_HUGE)
+  {
+    // mapped, in whole pages as arena_open rounds them
+    size_t page = hugePages ? (size_t)hugePages << 20 : PREDICTOR_ARENA_HUGE;
+    bytes = (bytes + page - 1) & ~(page - 1);
+  }
+  return sizeof(predictor_t) + bytes;
+}
+
+#ifdef BP_OCCUPANCY
+// The tables p->occ tracks, by the BP_OCC_ ids; a plugin's are its own
+//
+static void predictor_occ_open(predictor_t *p)
+{
+  const predictor_config_t *cfg = &p->cfg;
+  bp_occ_t *o = &p->occ;
+  int ok = 1;
+  bp_occ_init(o);
+  switch (cfg->type)
+  {
+  case GSHARE:
+    ok = bp_occ_table(o, "counters", 1ULL << cfg->ghistoryBits, 1);
+    break;
+  case TOURNAMENT:
+    ok = bp_occ_table(o, "local hist", 1ULL << cfg->lhtBits, 0) &&
+         bp_occ_table(o, "local ctrs", 1ULL << (tournament_local_hist_bits(cfg) + cfg->localPatternBits), 0) &&
+         bp_occ_table(o, "global", 1ULL << cfg->ghrBits, 1);
+    break;
+  case CUSTOM:
+    ok = bp_occ_table(o, "bimodal", 1ULL << cfg->tageBimodalBits, 0);
+    for (int t = 0; ok && t < cfg->tageNumTagged; t++)
+    {
+      char name[16];
+      snprintf(name, sizeof(name), "T%d", t + 1);
+      ok = bp_occ_table(o, name, 1ULL << cfg->tageTaggedBits, 0);
+    }
+    break;
+  case PERCEPTRON:
+    ok = bp_occ_table(o, "rows", 1ULL << cfg->perceptronBits, 0);
+    break;
+  case YAGS:
+    ok = bp_occ_table(o, "choice", 1ULL << cfg->yagsChoiceBits, 0) &&
+         bp_occ_table(o, "exceptions", 2ULL << cfg->yagsCacheBits, 0);
+    break;
+  }
+  if (!ok)
+  {
+    fprintf(stderr, "Error: occupancy tables malloc failed\n");
+    exit(1);
+  }
+}
+#endif
+
+predictor_t *predictor_create(const predictor_config_t *cfg)
+{
+  if (!predictor_config_valid(cfg))
+  {
+    return NULL;
+  }
+  predictor_t *p = (predictor_t *)calloc(1, sizeof(predictor_t));
+  if (!p)
+  {
+    return NULL;
+  }
+  p->cfg = *cfg;
+#ifdef BP_COST
+  bp_cost_init(&p->cost);
+#endif
+  if (!ops_of(cfg)->init(p))
+  {
+    free(p);
+    return NULL;
+  }
+#ifdef BP_OCCUPANCY
+  predictor_occ_open(p);
+#endif
+  return p;
+}
+
+uint32_t predictor_predict(predictor_t *p, uint32_t pc, uint32_t target, uint32_t direct)
+{
+  // Make a prediction based on the predictor type
+  BP_COST_BEGIN(p, BP_COST_PREDICT);
+  uint32_t pred = ops_of(&p->cfg)->predict(p, pc);
+  BP_COST_END(p, BP_COST_PREDICT);
+  return pred;
+}
+
+// The features of a perceptron that read every record see this one,
+// after a conditional one trained
+static inline void predictor_observe(predictor_t *p, uint32_t pc, uint32_t target, uint32_t outcome,
+                                     uint32_t condition, uint32_t call, uint32_t ret)
+{
+  if (p->cfg.type == PERCEPTRON && (p->cfg.perceptronFeatures & PERCEPTRON_F_BRANCHES))
+  {
+    predictor_branch_t br = {pc, target, (uint8_t)((outcome ? BP_F_TAKEN : 0) | (condition ? BP_F_CONDITION : 0) |
+                                                   (call ? BP_F_CALL : 0) | (ret ? BP_F_RET : 0))};
+    perceptron_observe(&p->pc_regs, &p->pc_depth, &br);
+  }
+}
+
+void predictor_train(predictor_t *p, uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+{
+  if (condition)
+  {
+    BP_COST_BEGIN(p, BP_COST_TRAIN);
+    ops_of(&p->cfg)->train(p, pc, outcome);
+    BP_COST_END(p, BP_COST_TRAIN);
+  }
+  predictor_observe(p, pc, target, outcome, condition, call, ret);
+}
+
+uint32_t predictor_predict_and_train(predictor_t *p, uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+{
+  if (!condition)
+  {
+    // only conditional branches are predicted and trained
+    predictor_observe(p, pc, target, outcome, condition, call, ret);
+    return NOTTAKEN;
+  }
+  BP_COST_BEGIN(p, BP_COST_PREDICT_AND_TRAIN);
+  uint32_t pred = ops_of(&p->cfg)->predict_and_train(p, pc, outcome);
+  BP_COST_END(p, BP_COST_PREDICT_AND_TRAIN);
+  predictor_observe(p, pc, target, outcome, condition, call, ret);
+  return pred;
+}
+
+uint64_t predictor_predict_batch(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions)
+{
+  if (predictions)
+  {
+    memset(predictions, 0, ((n + 63) / 64) * sizeof(uint64_t));
+  }
+
+  // One dispatch per batch, into the loop instantiated for the type
+  return ops_of(&p->cfg)->predict_batch(p, br, n, predictions);
+}
+
+int predictor_history_regs(const predictor_t *p)
+{
+  return ops_of(&p->cfg)->predict_shared ? HISTORY_OUTCOMES : 0;
+}
+
+uint64_t predictor_predict_shared(predictor_t *p, const predictor_branch_t *br, const bp_history_batch_t *hist,
+                                  uint64_t *predictions)
+{
+  const predictor_ops_t *ops = ops_of(&p->cfg);
+  if (!ops->predict_shared || !(hist->regs & HISTORY_OUTCOMES))
+  {
+    return predictor_predict_batch(p, br, hist->n, predictions);
+  }
+  if (predictions)
+  {
+    memset(predictions, 0, ((hist->n + 63) / 64) * sizeof(uint64_t));
+  }
+  return ops->predict_shared(p, br, hist, predictions);
+}
+
+int predictor_fold_attach(predictor_t *p, bp_folds_t *f)
+{
+  if (p->cfg.type != CUSTOM || p->delay_ring || p->cfg.unbounded || p->tage_hist.pos || f->pos)
+  {
+    return 0;
+  }
+  uint8_t slot[3][TAGE_MAX_TAGGED];
+  int widths[3] = {p->cfg.tageTaggedBits, tage_tag_bits<tage_runtime>(p), tage_tag1_bits<tage_runtime>(p)};
+  for (int t = 0; t < p->cfg.tageNumTagged; t++)
+  {
+    for (int r = 0; r < 3; r++)
+    {
+      int at = history_fold_add(f, p->cfg.tageHistLengths[t], widths[r]);
+      if (at < 0)
+      {
+        return 0;
+      }
+      slot[r][t] = (uint8_t)at;
+    }
+  }
+  memcpy(p->tage_slot, slot, sizeof(slot));
+  p->tage_folded = tage_folded_for(&p->cfg);
+  p->tage_shared = f;
+  return 1;
+}
+
+uint64_t predictor_predict_folded(predictor_t *p, const predictor_branch_t *br, const bp_folds_t *f,
+                                  uint64_t *predictions)
+{
+  // its own history must stand where the batch started, as it does
+  // unless it replayed other records since
+  if (p->tage_shared != f || p->tage_hist.pos + f->count != f->pos)
+  {
+    return predictor_predict_batch(p, br, f->records, predictions);
+  }
+  if (predictions)
+  {
+    memset(predictions, 0, ((f->records + 63) / 64) * sizeof(uint64_t));
+  }
+  return p->tage_folded(p, f, predictions);
+}
+
+int predictor_local_geometry(const predictor_config_t *cfg, int *lht_bits, int *hist_bits)
+{
+  if (cfg->type != TOURNAMENT || cfg->localWays != 1 || cfg->updateDelay || cfg->unbounded)
+  {
+    return 0;
+  }
+  *lht_bits = cfg->lhtBits;
+  *hist_bits = tournament_local_hist_bits(cfg);
+  return 1;
+}
+
+// tournament_bp::predict_and_update with the local history of each
+// branch read from 'local' rather than looked up and pushed
+template <class T>
+static uint64_t tournament_predict_local(predictor_t *p, const predictor_branch_t *br, size_t n, const T *local,
+                                         uint64_t *predictions)
+{
+  uint64_t ghr = p->t_ghr;
+  uint64_t mispredictions = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (!(br[i].flags & BP_F_CONDITION))
+    {
+      continue;
+    }
+    uint8_t outcome = br[i].flags & BP_F_TAKEN;
+    tournament_lookup_t lk;
+    BP_OCC(lk.pc = br[i].pc);
+    lk.local.hist = local[i];
+    tournament_lookup_counters(p, br[i].pc, ghr, &lk);
+    uint8_t pred = tournament_choose(p, &lk);
+    tournament_train(p, &lk, outcome);
+    ghr = tournament_push_history(p, ghr, outcome);
+    mispredictions += pred != outcome;
+    if (predictions && pred) predictions[i >> 6] |= 1ULL << (i & 63);
+  }
+  p->t_ghr = ghr;
+  return mispredictions;
+}
+
+uint64_t predictor_predict_local(predictor_t *p, const predictor_branch_t *br, size_t n, const void *local,
+                                 size_t entry, uint64_t *predictions)
+{
+  int lht_bits, hist_bits;
+  if (!predictor_local_geometry(&p->cfg, &lht_bits, &hist_bits))
+  {
+    return predictor_predict_batch(p, br, n, predictions);
+  }
+  if (predictions)
+  {
+    memset(predictions, 0, ((n + 63) / 64) * sizeof(uint64_t));
+  }
+  return entry == 1   ? tournament_predict_local(p, br, n, (const uint8_t *)local, predictions)
+         : entry == 2 ? tournament_predict_local(p, br, n, (const uint16_t *)local, predictions)
+                      : tournament_predict_local(p, br, n, (const uint32_t *)local, predictions);
+}
+
+// gshare lanes of predictor_predict_lockstep: each lane's table and
+// index mask, with one history for all of them
+typedef struct {
+  ctr_word_t *bht[PREDICTOR_LOCKSTEP_MAX];
+  uint64_t mask[PREDICTOR_LOCKSTEP_MAX];
+} gshare_lanes_t;
+
+// One 64-bit lane per configuration: the counter words are gathered,
+// stepped where not saturated and scattered back, stored XOR WN as
+// ctr_step_field does
+__attribute__((target("avx512f"))) static uint64_t gshare_lockstep_avx512(const gshare_lanes_t *l, int k,
+                                                                         uint64_t hist, const predictor_branch_t *br,
+                                                                         size_t n, uint64_t *mispredictions)
+{
+  const __mmask8 active = (__mmask8)((1u << k) - 1);
+  const __m512i one = _mm512_set1_epi64(1), three = _mm512_set1_epi64(3);
+  const __m512i base = _mm512_loadu_si512(l->bht), mask = _mm512_loadu_si512(l->mask);
+  __m512i miss = _mm512_setzero_si512();
+  for (size_t i = 0; i < n; i++) {
+    if (!(br[i].flags & BP_F_CONDITION)) continue;
+    uint8_t outcome = br[i].flags & BP_F_TAKEN;
+    __m512i idx = _mm512_and_si512(_mm512_set1_epi64((long long)(br[i].pc ^ hist)), mask);
+    __m512i addr = _mm512_add_epi64(base, _mm512_slli_epi64(_mm512_srli_epi64(idx, 5), 3));
+    __m512i shift = _mm512_slli_epi64(_mm512_and_si512(idx, _mm512_set1_epi64(31)), 1);
+    __m512i word = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), active, addr, NULL, 1);
+    __m512i c = _mm512_xor_si512(_mm512_and_si512(_mm512_srlv_epi64(word, shift), three), one);
+    __mmask8 taken = _mm512_cmpge_epu64_mask(c, _mm512_set1_epi64(2));
+    miss = _mm512_mask_add_epi64(miss, (outcome ? ~taken : taken) & active, miss, one);
+    __m512i next = outcome ? _mm512_add_epi64(c, one) : _mm512_sub_epi64(c, one);
+    __m512i step = _mm512_sllv_epi64(_mm512_and_si512(_mm512_xor_si512(c, next), three), shift);
+    __mmask8 move = _mm512_mask_cmpneq_epu64_mask(active, c, outcome ? three : _mm512_setzero_si512());
+    word = _mm512_xor_si512(word, step);
+    _mm512_mask_i64scatter_epi64(NULL, move, addr, word, 1);
+    hist = (hist << 1) | outcome;
+  }
+  uint64_t lanes[PREDICTOR_LOCKSTEP_MAX];
+  _mm512_storeu_si512(lanes, miss);
+  for (int j = 0; j < k; j++) mispredictions[j] += lanes[j];
+  return hist;
+}
+
+// The lanes unrolled as scalar code, one instance per lane count
+template <int K>
+static uint64_t gshare_lockstep_k(const gshare_lanes_t *l, uint64_t hist, const predictor_branch_t *br, size_t n,
+                                  uint64_t *mispredictions)
+{
+  uint64_t miss[K] = {0};
+  for (size_t i = 0; i < n; i++) {
+    if (!(br[i].flags & BP_F_CONDITION)) continue;
+    uint8_t outcome = br[i].flags & BP_F_TAKEN;
+#pragma GCC unroll 8
+    for (int j = 0; j < K; j++) {
+      uint32_t index = (br[i].pc ^ hist) & l->mask[j];
+      miss[j] += ctr_predict<2>(ctr_get<2, WN>(l->bht[j], index)) != outcome;
+      ctr_update_packed<2, WN>(l->bht[j], index, outcome);
+    }
+    hist = (hist << 1) | outcome;
+  }
+  for (int j = 0; j < K; j++) mispredictions[j] += miss[j];
+  return hist;
+}
+
+// The instruction set of the gshare lanes on this host
+static const int gshare_lanes_isa = kernel_usable(KERNEL_AVX512) ? KERNEL_AVX512 : KERNEL_SCALAR;
+
+static uint64_t gshare_lockstep(const gshare_lanes_t *l, int k, uint64_t hist, const predictor_branch_t *br,
+                                size_t n, uint64_t *mispredictions)
+{
+  if (gshare_lanes_isa == KERNEL_AVX512) {
+    return gshare_lockstep_avx512(l, k, hist, br, n, mispredictions);
+  }
+  typedef uint64_t (*lockstep_fn)(const gshare_lanes_t *, uint64_t, const predictor_branch_t *, size_t, uint64_t *);
+  static const lockstep_fn by_lanes[PREDICTOR_LOCKSTEP_MAX] = {
+    gshare_lockstep_k<1>, gshare_lockstep_k<2>, gshare_lockstep_k<3>, gshare_lockstep_k<4>,
+    gshare_lockstep_k<5>, gshare_lockstep_k<6>, gshare_lockstep_k<7>, gshare_lockstep_k<8>,
+  };
+  return by_lanes[k - 1](l, hist, br, n, mispredictions);
+}
+static_assert(PREDICTOR_LOCKSTEP_MAX == 8, "one AVX-512 vector, or one scalar instance per lane count");
+
+int predictor_predict_lockstep(predictor_t *const *ps, int k, const predictor_branch_t *br, size_t n,
+                               uint64_t *mispredictions)
+{
+  if (k < 1 || k > PREDICTOR_LOCKSTEP_MAX)
+  {
+    return 0;
+  }
+  gshare_lanes_t lanes;
+  memset(&lanes, 0, sizeof(lanes));
+  for (int j = 0; j < k; j++)
+  {
+    if (ps[j]->cfg.type != GSHARE || ps[j]->delay_ring || ps[j]->cfg.unbounded || ps[j]->ghistory != ps[0]->ghistory)
+    {
+      return 0;
+    }
+    lanes.bht[j] = ps[j]->bht_gshare;
+    lanes.mask[j] = (1u << ps[j]->cfg.ghistoryBits) - 1;
+  }
+  uint64_t hist = gshare_lockstep(&lanes, k, ps[0]->ghistory, br, n, mispredictions);
+  for (int j = 0; j < k; j++)
+  {
+    ps[j]->ghistory = hist;
+  }
+  return 1;
+}
+
+// Lanes of predictor_slice_t. The counters of an entry are N planes
+// of 'words' 64-bit words, plane p holding bit p of the counter of
+// every lane, stored XOR the initial value I as ctr_step_field does,
+// so a new table is all zero. The mispredictions are counted in planes
+// too: a branch adds into PREDICTOR_SLICE_LOW_BITS of them, which are
+// added into PREDICTOR_SLICE_COUNT_BITS before they can wrap, and
+// those into each lane's total once per batch. Every step is the same
+// few operations whatever the counters hold, as a branch on them
+// would be mispredicted as often as the counters are
+#define PREDICTOR_SLICE_LOW_BITS 4
+#define PREDICTOR_SLICE_COUNT_BITS 16
+#define PREDICTOR_SLICE_FOLD ((1 << PREDICTOR_SLICE_LOW_BITS) - 1)
+
+// The entry of each conditional branch of a chunk, shifted left by one
+// with the outcome in bit 0, worked out first so the entries a few
+// branches on can be prefetched: 512 lanes take 128 bytes an entry
+#define PREDICTOR_SLICE_CHUNK 256
+#define PREDICTOR_SLICE_AHEAD 16
+
+struct predictor_slice {
+  int lanes;
+  int words;            // 64-bit words of a plane
+  int isa;              // KERNEL_AVX512 when words is a multiple of 8
+  int hist_bits;        // outcomes in the index, ghistoryBits
+  uint32_t mask;
+  uint64_t hist;        // outcomes since the slice was created
+  int pending;          // branches added into the low count planes
+  uint64_t *planes;     // 2 planes of 'words' per entry
+  uint64_t *low;        // PREDICTOR_SLICE_LOW_BITS planes of 'words'
+  uint64_t *counts;     // PREDICTOR_SLICE_COUNT_BITS planes of 'words'
+  uint64_t *active;     // lanes started and not stopped
+  uint64_t *young;      // active lanes whose history is still shorter than the index
+  uint8_t *age;         // conditional branches each young lane has seen
+};
+
+// One step of the N-bit counters of the lanes in 'act', the planes
+// 'stride' words apart from 'e', toward 'outcome'
+//
+// Returns the lanes of 'act' that predicted the other way
+//
+// A saturating step adds or subtracts 1 on the lanes not saturated,
+// rippling a carry or borrow through the planes
+template <int N, int I>
+static inline uint64_t slice_step(uint64_t *e, size_t stride, uint64_t act, uint8_t outcome)
+{
+  const uint64_t toward = outcome ? ~0ULL : 0;
+  uint64_t b[N], all = ~0ULL;
+  for (int p = 0; p < N; p++) {
+    // the planes in the direction of the step: saturated where all set
+    b[p] = e[p * stride] ^ ((I >> p & 1) ? ~0ULL : 0) ^ ~toward;
+    all &= b[p];
+  }
+  uint64_t carry = act & ~all;
+  for (int p = 0; p < N; p++) {
+    e[p * stride] ^= carry;
+    carry &= b[p];
+  }
+  return ~b[N - 1] & act;
+}
+
+// Add 1 to the low count planes, 'stride' words apart, of the lanes in
+// 'miss'
+static inline void slice_count(uint64_t *low, size_t stride, uint64_t miss)
+{
+  for (int p = 0; p < PREDICTOR_SLICE_LOW_BITS; p++) {
+    uint64_t carry = low[p * stride] & miss;
+    low[p * stride] ^= miss;
+    miss = carry;
+  }
+}
+
+// Add the low count planes into the wide ones and clear them
+static void slice_fold(predictor_slice_t *s)
+{
+  for (int w = 0; w < s->words; w++) {
+    uint64_t carry = 0;
+    for (int p = 0; p < PREDICTOR_SLICE_COUNT_BITS; p++) {
+      uint64_t a = s->counts[p * s->words + w], b = p < PREDICTOR_SLICE_LOW_BITS ? s->low[p * s->words + w] : 0;
+      s->counts[p * s->words + w] = a ^ b ^ carry;
+      carry = (a & b) | (carry & (a ^ b));
+    }
+  }
+  memset(s->low, 0, PREDICTOR_SLICE_LOW_BITS * s->words * sizeof(uint64_t));
+  s->pending = 0;
+}
+
+static inline size_t slice_index(const predictor_slice_t *s, const predictor_branch_t *br, size_t n, uint32_t *pcs,
+                                 uint32_t *entries)
+{
+  uint64_t hist = s->hist;
+  size_t m = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!(br[i].flags & BP_F_CONDITION)) continue;
+    uint8_t outcome = br[i].flags & BP_F_TAKEN;
+    pcs[m] = br[i].pc;
+    entries[m++] = ((br[i].pc ^ (uint32_t)hist) & s->mask) << 1 | outcome;
+    hist = (hist << 1) | outcome;
+  }
+  return m;
+}
+
+static inline void slice_prefetch(const predictor_slice_t *s, const uint32_t *entries, size_t k, size_t m, int n)
+{
+  if (k + PREDICTOR_SLICE_AHEAD < m) {
+    const char *e = (const char *)(s->planes + (size_t)(entries[k + PREDICTOR_SLICE_AHEAD] >> 1) * n * s->words);
+    for (size_t b = 0; b < n * s->words * sizeof(uint64_t); b += 64) __builtin_prefetch(e + b, 1);
+  }
+}
+
+// The lanes still warming their history, each at its own index: the
+// history a cold predictor has is the last 'age' outcomes
+template <int N, int I>
+static inline void slice_young(predictor_slice_t *s, uint32_t pc, uint8_t outcome)
+{
+  for (int w = 0; w < s->words; w++) {
+    for (uint64_t y = s->young[w]; y; y &= y - 1) {
+      int lane = w * 64 + __builtin_ctzll(y);
+      uint64_t bit = y & -y;
+      uint32_t index = (pc ^ (s->hist & ((1ULL << s->age[lane]) - 1))) & s->mask;
+      uint64_t *e = s->planes + (size_t)index * N * s->words + w;
+      slice_count(s->low + w, s->words, slice_step<N, I>(e, s->words, bit, outcome));
+      if (++s->age[lane] >= s->hist_bits) s->young[w] &= ~bit;
+    }
+  }
+}
+
+template <int N, int I>
+static void slice_batch_scalar(predictor_slice_t *s, const predictor_branch_t *br, size_t n)
+{
+  BP_SCRATCH uint32_t pcs[PREDICTOR_SLICE_CHUNK], entries[PREDICTOR_SLICE_CHUNK];
+  const int words = s->words;
+  for (size_t off = 0; off < n; off += PREDICTOR_SLICE_CHUNK) {
+    size_t m = slice_index(s, br + off, n - off < PREDICTOR_SLICE_CHUNK ? n - off : PREDICTOR_SLICE_CHUNK, pcs, entries);
+    for (size_t k = 0; k < m; k++) {
+      slice_prefetch(s, entries, k, m, N);
+      uint8_t outcome = entries[k] & 1;
+      uint64_t *e = s->planes + (size_t)(entries[k] >> 1) * N * words;
+      for (int w = 0; w < words; w++) {
+        uint64_t act = s->active[w] & ~s->young[w];
+        slice_count(s->low + w, words, slice_step<N, I>(e + w, words, act, outcome));
+      }
+      slice_young<N, I>(s, pcs[k], outcome);
+      s->hist = (s->hist << 1) | outcome;
+      if (++s->pending == PREDICTOR_SLICE_FOLD) slice_fold(s);
+    }
+  }
+}
+
+// slice_batch_scalar on 512 lanes a vector, each plane one register
+// and each full adder of the counts one ternary logic instruction
+template <int N, int I>
+__attribute__((target("avx512f"))) static void slice_batch_avx512(predictor_slice_t *s, const predictor_branch_t *br,
+                                                                  size_t n)
+{
+  BP_SCRATCH uint32_t pcs[PREDICTOR_SLICE_CHUNK], entries[PREDICTOR_SLICE_CHUNK];
+  const int words = s->words;
+  const __m512i ones = _mm512_set1_epi64(-1);
+  for (size_t off = 0; off < n; off += PREDICTOR_SLICE_CHUNK) {
+    size_t m = slice_index(s, br + off, n - off < PREDICTOR_SLICE_CHUNK ? n - off : PREDICTOR_SLICE_CHUNK, pcs, entries);
+    for (size_t k = 0; k < m; k++) {
+      slice_prefetch(s, entries, k, m, N);
+      uint8_t outcome = entries[k] & 1;
+      uint64_t *e = s->planes + (size_t)(entries[k] >> 1) * N * words;
+      const __m512i away = outcome ? _mm512_setzero_si512() : ones;
+      for (int w = 0; w < words; w += 8) {
+        __m512i act = _mm512_andnot_si512(_mm512_loadu_si512(s->young + w), _mm512_loadu_si512(s->active + w));
+        __m512i b[N], all = ones;
+        for (int p = 0; p < N; p++) {
+          b[p] = _mm512_xor_si512(_mm512_load_si512(e + p * words + w), (I >> p & 1) ? _mm512_xor_si512(away, ones) : away);
+          all = _mm512_and_si512(all, b[p]);
+        }
+        __m512i carry = _mm512_andnot_si512(all, act);
+        for (int p = 0; p < N; p++) {
+          __m512i *plane = (__m512i *)(e + p * words + w);
+          _mm512_store_si512(plane, _mm512_xor_si512(_mm512_load_si512(plane), carry));
+          carry = _mm512_and_si512(carry, b[p]);
+        }
+        __m512i miss = _mm512_andnot_si512(b[N - 1], act);
+        for (int p = 0; p < PREDICTOR_SLICE_LOW_BITS; p++) {
+          __m512i *low = (__m512i *)(s->low + p * words + w);
+          __m512i c = _mm512_load_si512(low);
+          _mm512_store_si512(low, _mm512_xor_si512(c, miss));
+          miss = _mm512_and_si512(c, miss);
+        }
+      }
+      slice_young<N, I>(s, pcs[k], outcome);
+      s->hist = (s->hist << 1) | outcome;
+      if (++s->pending == PREDICTOR_SLICE_FOLD) {
+        for (int w = 0; w < words; w += 8) {
+          __m512i carry = _mm512_setzero_si512();
+          for (int p = 0; p < PREDICTOR_SLICE_COUNT_BITS; p++) {
+            __m512i *count = (__m512i *)(s->counts + p * words + w);
+            __m512i a = _mm512_load_si512(count);
+            __m512i b = p < PREDICTOR_SLICE_LOW_BITS ? _mm512_load_si512(s->low + p * words + w) : _mm512_setzero_si512();
+            _mm512_store_si512(count, _mm512_ternarylogic_epi64(a, b, carry, 0x96));
+            carry = _mm512_ternarylogic_epi64(a, b, carry, 0xe8);
+          }
+        }
+        memset(s->low, 0, PREDICTOR_SLICE_LOW_BITS * words * sizeof(uint64_t));
+        s->pending = 0;
+      }
+    }
+  }
+}
+
+// The instruction set of the bit-sliced lanes on this host
+static const int gshare_slice_isa = kernel_usable(KERNEL_AVX512) ? KERNEL_AVX512 : KERNEL_SCALAR;
+
+predictor_slice_t *predictor_slice_create(const predictor_config_t *cfg, int lanes)
+{
+  if (cfg->type != GSHARE || cfg->updateDelay || cfg->unbounded || lanes < 1 || lanes > PREDICTOR_SLICE_MAX ||
+      cfg->ghistoryBits < 1 || cfg->ghistoryBits > 31)
+  {
+    return NULL;
+  }
+  predictor_slice_t *s = (predictor_slice_t *)calloc(1, sizeof(predictor_slice_t));
+  s->lanes = lanes;
+  s->words = (lanes + 63) / 64;
+  // up to 256 lanes, as many words as they need beat a whole vector
+  if (s->words > 4 && gshare_slice_isa == KERNEL_AVX512)
+  {
+    s->words = (s->words + 7) & ~7;
+    s->isa = KERNEL_AVX512;
+  }
+  s->hist_bits = cfg->ghistoryBits;
+  s->mask = (1u << cfg->ghistoryBits) - 1;
+  size_t plane_bytes = s->words * sizeof(uint64_t);
+  size_t table = ((size_t)1 << cfg->ghistoryBits) * 2 * plane_bytes;
+  size_t count = (PREDICTOR_SLICE_LOW_BITS + PREDICTOR_SLICE_COUNT_BITS) * plane_bytes;
+  void *planes = NULL, *counts = NULL;
+  if (posix_memalign(&planes, 64, table) || posix_memalign(&counts, 64, count))
+  {
+    free(planes);
+    free(s);
+    return NULL;
+  }
+  s->planes = (uint64_t *)planes;
+  s->low = (uint64_t *)counts;
+  s->counts = s->low + PREDICTOR_SLICE_LOW_BITS * s->words;
+  memset(s->planes, 0, table);
+  memset(s->low, 0, count);
+  s->active = (uint64_t *)calloc(s->words, sizeof(uint64_t));
+  s->young = (uint64_t *)calloc(s->words, sizeof(uint64_t));
+  s->age = (uint8_t *)calloc(s->words * 64, 1);
+  return s;
+}
+
+void predictor_slice_start(predictor_slice_t *s, int lane)
+{
+  // the lane's bit of every plane back to WN, as a new table
+  int w = lane / 64;
+  uint64_t bit = 1ULL << (lane % 64);
+  size_t entries = (size_t)s->mask + 1;
+  for (size_t e = 0; e < entries * 2; e++) {
+    s->planes[e * s->words + w] &= ~bit;
+  }
+  s->active[w] |= bit;
+  s->young[w] |= bit;
+  s->age[lane] = 0;
+}
+
+void predictor_slice_stop(predictor_slice_t *s, int lane)
+{
+  s->active[lane / 64] &= ~(1ULL << (lane % 64));
+  s->young[lane / 64] &= ~(1ULL << (lane % 64));
+}
+
+void predictor_slice_batch(predictor_slice_t *s, const predictor_branch_t *br, size_t n, uint64_t *mispredictions)
+{
+  // the wide count planes wrap after 2^16 - 1 branches, so longer
+  // batches go in parts
+  const size_t part = ((size_t)1 << PREDICTOR_SLICE_COUNT_BITS) - 1;
+  for (size_t off = 0; off < n; off += part)
+  {
+    size_t m = n - off < part ? n - off : part;
+    if (s->isa == KERNEL_AVX512)
+    {
+      slice_batch_avx512<2, WN>(s, br + off, m);
+    }
+    else
+    {
+      slice_batch_scalar<2, WN>(s, br + off, m);
+    }
+    slice_fold(s);
+    for (int p = 0; p < PREDICTOR_SLICE_COUNT_BITS; p++)
+    {
+      for (int w = 0; w < s->words; w++)
+      {
+        for (uint64_t c = s->counts[p * s->words + w]; c; c &= c - 1)
+        {
+          mispredictions[w * 64 + __builtin_ctzll(c)] += 1ULL << p;
+        }
+        s->counts[p * s->words + w] = 0;
+      }
+    }
+  }
+}
+
+void predictor_slice_destroy(predictor_slice_t *s)
+{
+  if (!s)
+  {
+    return;
+  }
+  free(s->planes);
+  free(s->low);
+  free(s->active);
+  free(s->young);
+  free(s->age);
+  free(s);
+}
+
+// Entries of a 64-byte line of gshare counters, the grain of the
+// ranges predictor_index_split makes so no two threads share a line
+#define GSHARE_LINE_ENTRIES (ctr_packing<2>::per_word * (64 / sizeof(ctr_word_t)))
+
+int predictor_index_split(const predictor_t *p, int parts, uint32_t *bounds)
+{
+  if (p->cfg.type != GSHARE || p->delay_ring || p->cfg.unbounded || parts < 1)
+  {
+    return 0;
+  }
+  uint32_t lines = (uint32_t)((((size_t)1 << p->cfg.ghistoryBits) + GSHARE_LINE_ENTRIES - 1) / GSHARE_LINE_ENTRIES);
+  if ((uint32_t)parts > lines)
+  {
+    parts = (int)lines;
+  }
+  for (int i = 0; i <= parts; i++)
+  {
+    uint64_t line = (uint64_t)lines * i / parts;
+    bounds[i] = (uint32_t)(line * GSHARE_LINE_ENTRIES < (1u << p->cfg.ghistoryBits) ? line * GSHARE_LINE_ENTRIES
+                                                                                    : 1u << p->cfg.ghistoryBits);
+  }
+  return parts;
+}
+
+size_t predictor_index_batch(predictor_t *p, const predictor_branch_t *br, size_t n, uint32_t *entries)
+{
+  uint64_t hist = p->ghistory;
+  uint32_t mask = (1u << p->cfg.ghistoryBits) - 1;
+  size_t m = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!(br[i].flags & BP_F_CONDITION)) continue;
+    uint32_t outcome = br[i].flags & BP_F_TAKEN;
+    entries[m++] = ((br[i].pc ^ (uint32_t)hist) & mask) << 1 | outcome;
+    hist = (hist << 1) | outcome;
+  }
+  p->ghistory = hist;
+  return m;
+}
+
+uint64_t predictor_predict_indexed(predictor_t *p, const uint32_t *entries, size_t n, uint32_t lo, uint32_t hi)
+{
+  ctr_word_t *bht = p->bht_gshare;
+  uint32_t span = hi - lo;
+  uint64_t miss = 0;
+  for (size_t k = 0; k < n; k++) {
+    uint32_t index = entries[k] >> 1;
+    if (index - lo >= span) continue;
+    uint8_t outcome = entries[k] & 1;
+    miss += ctr_predict<2>(ctr_get<2, WN>(bht, index)) != outcome;
+    ctr_update_packed<2, WN>(bht, index, outcome);
+  }
+  return miss;
+}
+
+// predictor_predict_traces on gshare, one 64-bit lane per trace as in
+// gshare_lockstep but with each lane's own PC, outcome and history.
+// The conditional branches are gathered transposed, a row per step
+// holding one of each lane, and the lanes left over at the end of a
+// chunk finish in scalar code
+__attribute__((target("avx512f,avx512dq"))) static void
+gshare_predict_traces(predictor_t *const *ps, int k, const predictor_branch_t *const *br, const size_t *n,
+                      uint64_t *mispredictions)
+{
+  BP_SCRATCH uint32_t pcs[BP_TRACES_CHUNK][PREDICTOR_LOCKSTEP_MAX];
+  BP_SCRATCH uint8_t outcomes[BP_TRACES_CHUNK][PREDICTOR_LOCKSTEP_MAX];
+  const __mmask8 active = (__mmask8)((1u << k) - 1);
+  const __m512i one = _mm512_set1_epi64(1), three = _mm512_set1_epi64(3);
+  uint64_t bht[PREDICTOR_LOCKSTEP_MAX] = {0}, mask[PREDICTOR_LOCKSTEP_MAX] = {0}, hist[PREDICTOR_LOCKSTEP_MAX] = {0};
+  size_t longest = 0;
+  for (int j = 0; j < k; j++) {
+    bht[j] = (uint64_t)ps[j]->bht_gshare;
+    mask[j] = (1u << ps[j]->cfg.ghistoryBits) - 1;
+    hist[j] = ps[j]->ghistory;
+    longest = n[j] > longest ? n[j] : longest;
+  }
+  const __m512i base = _mm512_loadu_si512(bht), masks = _mm512_loadu_si512(mask);
+  __m512i miss = _mm512_setzero_si512();
+  uint64_t tail_miss[PREDICTOR_LOCKSTEP_MAX] = {0};
+  for (size_t off = 0; off < longest; off += BP_TRACES_CHUNK) {
+    size_t count[PREDICTOR_LOCKSTEP_MAX];
+    size_t common = BP_TRACES_CHUNK;
+    for (int j = 0; j < k; j++) {
+      size_t m = 0;
+      for (size_t i = off; i < n[j] && i < off + BP_TRACES_CHUNK; i++) {
+        pcs[m][j] = br[j][i].pc;
+        outcomes[m][j] = br[j][i].flags & BP_F_TAKEN;
+        m += (br[j][i].flags & BP_F_CONDITION) != 0;
+      }
+      count[j] = m;
+      common = m < common ? m : common;
+    }
+    __m512i h = _mm512_loadu_si512(hist);
+    for (size_t i = 0; i < common; i++) {
+      __m512i pc = _mm512_cvtepu32_epi64(_mm256_loadu_si256((const __m256i *)pcs[i]));
+      __m512i o = _mm512_cvtepu8_epi64(_mm_loadl_epi64((const __m128i *)outcomes[i]));
+      __m512i idx = _mm512_and_si512(_mm512_xor_si512(pc, h), masks);
+      __m512i addr = _mm512_add_epi64(base, _mm512_slli_epi64(_mm512_srli_epi64(idx, 5), 3));
+      __m512i shift = _mm512_slli_epi64(_mm512_and_si512(idx, _mm512_set1_epi64(31)), 1);
+      __m512i word = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), active, addr, NULL, 1);
+      __m512i c = _mm512_xor_si512(_mm512_and_si512(_mm512_srlv_epi64(word, shift), three), one);
+      __mmask8 taken = _mm512_cmpge_epu64_mask(c, _mm512_set1_epi64(2));
+      __mmask8 outcome = _mm512_test_epi64_mask(o, o);
+      miss = _mm512_mask_add_epi64(miss, (taken ^ outcome) & active, miss, one);
+      __m512i next = _mm512_add_epi64(c, _mm512_sub_epi64(_mm512_slli_epi64(o, 1), one));
+      __m512i step = _mm512_sllv_epi64(_mm512_and_si512(_mm512_xor_si512(c, next), three), shift);
+      __mmask8 move = _mm512_mask_cmpneq_epu64_mask(active, c, _mm512_mullo_epi64(o, three));
+      _mm512_mask_i64scatter_epi64(NULL, move, addr, _mm512_xor_si512(word, step), 1);
+      h = _mm512_or_si512(_mm512_slli_epi64(h, 1), o);
+    }
+    _mm512_storeu_si512(hist, h);
+    for (int j = 0; j < k; j++) {
+      for (size_t i = common; i < count[j]; i++) {
+        uint8_t o = outcomes[i][j];
+        uint32_t index = (pcs[i][j] ^ hist[j]) & mask[j];
+        tail_miss[j] += ctr_predict<2>(ctr_get<2, WN>(ps[j]->bht_gshare, index)) != o;
+        ctr_update_packed<2, WN>(ps[j]->bht_gshare, index, o);
+        hist[j] = (hist[j] << 1) | o;
+      }
+    }
+  }
+  uint64_t lanes[PREDICTOR_LOCKSTEP_MAX];
+  _mm512_storeu_si512(lanes, miss);
+  for (int j = 0; j < k; j++) {
+    ps[j]->ghistory = hist[j];
+    mispredictions[j] += lanes[j] + tail_miss[j];
+  }
+}
+
+int predictor_predict_traces(predictor_t *const *ps, int k, const predictor_branch_t *const *br, const size_t *n,
+                             uint64_t *mispredictions)
+{
+  if (k < 1 || k > PREDICTOR_LOCKSTEP_MAX)
+  {
+    return 0;
+  }
+  const predictor_ops_t *ops = ops_of(&ps[0]->cfg);
+  for (int j = 0; j < k; j++)
+  {
+    if (ps[j]->cfg.type != ps[0]->cfg.type || ps[j]->delay_ring || ps[j]->cfg.unbounded || !ops->predict_traces)
+    {
+      return 0;
+    }
+  }
+  if (ps[0]->cfg.type == GSHARE && gshare_lanes_isa == KERNEL_AVX512)
+  {
+    gshare_predict_traces(ps, k, br, n, mispredictions);
+    return 1;
+  }
+  // a compiled-in TAGE geometry beats the lanes at any size; the lanes
+  // only hash by XOR
+  for (int j = 0; j < k; j++)
+  {
+    if (ps[j]->cfg.type == CUSTOM && ps[j]->tage_batch != tage_predict_hashed<tage_runtime_hashed<tage_hash_xor> >)
+    {
+      return 0;
+    }
+  }
+  return ops->predict_traces(ps, k, br, n, mispredictions);
+}
+
+int predictor_kernels(kernel_choice_t *out)
+{
+  int n = 0;
+  out[n].kernel = "TAGE hash batch";
+  out[n++].variant = kernel_isa_names[tage_hash_isa];
+  // a set's tags and a perceptron segment are one 128-bit vector, in
+  // SSE2, which every x86-64 has
+  out[n].kernel = "TAGE tag match";
+  out[n++].variant = "sse2";
+  out[n].kernel = "gshare lockstep counters";
+  out[n++].variant = kernel_isa_names[gshare_lanes_isa];
+  out[n].kernel = "gshare bit-sliced lanes";
+  out[n++].variant = kernel_isa_names[gshare_slice_isa];
+#ifdef BP_GSHARE_CONFLICT
+  out[n].kernel = "gshare conflict batch";
+  out[n++].variant = kernel_isa_names[gshare_conflict_isa];
+#endif
+  out[n].kernel = "perceptron dot product";
+  out[n++].variant = "sse2";
+  return n;
+}
+
+int predictor_components(const predictor_t *p, predictor_components_t *info)
+{
+  if (p->cfg.type != TOURNAMENT || p->delay_ring || p->cfg.unbounded)
+  {
+    return 0;
+  }
+  info->count = 2;
+  info->chooser_init = T_CHOOSER_INIT;
+  info->chooser_bits = p->cfg.ghrBits;
+  return 1;
+}
+
+int predictor_predict_components(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t first,
+                                 uint64_t *const *bits, uint64_t *taken, uint64_t *mispredictions)
+{
+  predictor_components_t info;
+  if (!predictor_components(p, &info))
+  {
+    return 0;
+  }
+  // the chooser's choice between them is the only use of its counter,
+  // so the components never depend on it
+  tournament_bp::ctx c = tournament_bp::load(p);
+  uint64_t *local = bits[0], *global = bits[1];
+  uint64_t k = first, misses = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!(br[i].flags & BP_F_CONDITION)) continue;
+    uint8_t outcome = br[i].flags & BP_F_TAKEN;
+    tournament_lookup_t lk;
+    tournament_lookup(p, br[i].pc, c.hist, &lk);
+    uint64_t bit = 1ULL << (k & 63);
+    local[k >> 6] |= lk.local_taken ? bit : 0;
+    global[k >> 6] |= lk.global_taken ? bit : 0;
+    taken[k >> 6] |= outcome ? bit : 0;
+    misses += tournament_choose(p, &lk) != outcome;
+    tournament_update(p, &lk, outcome);
+    tournament_bp::push(c, c.hist, outcome);
+    k++;
+  }
+  tournament_bp::store(p, c);
+  *mispredictions += misses;
+  return 1;
+}
+
+// Visit every table and history register of 'p' in snapshot order
+//
+static void predictor_state_walk(predictor_t *p, state_cursor_t *c)
+{
+  ops_of(&p->cfg)->state(p, c);
+  if (p->delay_ring)
+  {
+    state_field(c, p->delay_ring, delay_ring_bytes(&p->cfg));
+    state_field(c, &p->delay_head, sizeof(p->delay_head));
+    state_field(c, &p->delay_count, sizeof(p->delay_count));
+  }
+}
+
+const predictor_config_t *predictor_config(const predictor_t *p)
+{
+  return &p->cfg;
+}
+
+#ifdef BP_COST
+const bp_cost_t *predictor_cost(const predictor_t *p)
+{
+  return &p->cost;
+}
+#endif
+
+#ifdef BP_OCCUPANCY
+const bp_occ_t *predictor_occupancy(const predictor_t *p)
+{
+  return &p->occ;
+}
+#endif
+
+size_t predictor_state_size(predictor_t *p)
+{
+  state_cursor_t c = {NULL, 0, 0};
+  predictor_state_walk(p, &c);
+  return c.off;
+}
+
+size_t predictor_memory(predictor_t *p)
+{
+  size_t bytes = sizeof(predictor_t) + p->arena_bytes;
+  for (int t = 0; t <= TAGE_MAX_TAGGED; t++)
+  {
+    bytes += p->ub[t].ctrl ? bp_map_bytes(&p->ub[t]) : 0;
+  }
+  return bytes;
+}
+
+int predictor_filter_stats(const predictor_t *p, uint64_t *filtered, uint64_t *checked)
+{
+  *filtered = *checked = 0;
+  if (p->cfg.type != CUSTOM || !p->cfg.tageFilter)
+  {
+    return 0;
+  }
+  *filtered = p->tage_filtered;
+  *checked = p->tage_filter_checks;
+  return 1;
+}
+
+int predictor_unbounded_entries(const predictor_t *p, const char **names, uint64_t *entries, int max)
+{
+  if (!p->cfg.unbounded)
+  {
+    return 0;
+  }
+  static const char *tagged[TAGE_MAX_TAGGED] = {"T1", "T2", "T3", "T4", "T5", "T6", "T7", "T8",
+                                                "T9", "T10", "T11", "T12", "T13", "T14", "T15", "T16"};
+  int n = unbounded_tables(&p->cfg);
+  for (int t = 0; t < n && t < max; t++)
+  {
+    names[t] = p->cfg.type == GSHARE ? "counters" : p->cfg.type == TOURNAMENT ? "local hist" :
+               t ? tagged[t - 1] : "bimodal";
+    entries[t] = p->ub[t].count;
+  }
+  return n < max ? n : max;
+}
+
+void predictor_save_state(predictor_t *p, void *buf)
+{
+  state_cursor_t c = {(char *)buf, 0, 0};
+  predictor_state_walk(p, &c);
+}
+
+predictor_t *predictor_load_state(const predictor_config_t *cfg, const void *buf, size_t len)
+{
+  // unbounded tables hold as many entries as the state does
+  predictor_t *p = predictor_create(cfg);
+  if (!p || (!cfg->unbounded && predictor_state_size(p) != len))
+  {
+    predictor_destroy(p);
+    return NULL;
+  }
+  state_cursor_t c = {(char *)buf, 0, 1, len, 0};
+  predictor_state_walk(p, &c);
+  if (c.overrun || c.off != len || (cfg->type == CUSTOM && !p->tage_rng))
+  {
+    predictor_destroy(p);
+    return NULL;
+  }
+  return p;
+}
+
+// A frozen copy of a predictor: the instance with its registers, and
+// its arena either in 'image' or, from PREDICTOR_ARENA_HUGE bytes, in
+// the memory file 'fd' that forks and restores map copy-on-write
+struct predictor_snapshot
+{
+  predictor_t inst;
+  void *image;
+  int fd;
+};
+
+predictor_snapshot_t *predictor_snapshot(predictor_t *p)
+{
+  if (p->cfg.type == PLUGIN || p->cfg.unbounded)
+  {
+    return NULL;
+  }
+  predictor_snapshot_t *s = (predictor_snapshot_t *)calloc(1, sizeof(predictor_snapshot_t));
+  if (!s)
+  {
+    return NULL;
+  }
+  s->inst = *p;
+  s->fd = -1;
+#ifndef PIN_CRT
+  // Pin's C library, branchExt -predict, has no memfd_create; the
+  // tables are copied there
+  if (p->arena_mapped)
+  {
+    s->fd = memfd_create("predictor-snapshot", MFD_CLOEXEC);
+    void *m = MAP_FAILED;
+    if (s->fd >= 0 && !ftruncate(s->fd, p->arena_bytes))
+    {
+      m = mmap(NULL, p->arena_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    }
+    if (m == MAP_FAILED)
+    {
+      predictor_snapshot_free(s);
+      return NULL;
+    }
+    memcpy(m, p->arena, p->arena_bytes);
+    munmap(m, p->arena_bytes);
+  }
+  else
+#endif
+  if (p->arena_bytes)
+  {
+    if (posix_memalign(&s->image, PREDICTOR_ARENA_ALIGN, p->arena_bytes))
+    {
+      s->image = NULL;
+      predictor_snapshot_free(s);
+      return NULL;
+    }
+    memcpy(s->image, p->arena, p->arena_bytes);
+  }
+  return s;
+}
+
+// Put the registers of 's' in 'p', which has an arena of the same
+// size mapped or allocated already, and copy or map its tables
+//
+// Returns True if Successful
+//
+static int predictor_snapshot_apply(predictor_t *p, const predictor_snapshot_t *s)
+{
+  void *arena = p->arena;
+  uint8_t mapped = p->arena_mapped;
+  if (s->fd >= 0)
+  {
+    // MAP_FIXED drops the pages 'p' wrote, in place
+    int flags = MAP_PRIVATE | (arena ? MAP_FIXED : 0);
+    arena = mmap(arena, s->inst.arena_bytes, PROT_READ | PROT_WRITE, flags, s->fd, 0);
+    if (arena == MAP_FAILED)
+    {
+      return 0;
+    }
+    mapped = 1;
+  }
+  else if (s->image)
+  {
+    if (!arena && posix_memalign(&arena, PREDICTOR_ARENA_ALIGN, s->inst.arena_bytes))
+    {
+      return 0;
+    }
+    memcpy(arena, s->image, s->inst.arena_bytes);
+  }
+#ifdef BP_COST
+  bp_cost_t cost = p->cost;
+#endif
+#ifdef BP_OCCUPANCY
+  bp_occ_t occ = p->occ;
+#endif
+  *p = s->inst;
+#ifdef BP_COST
+  p->cost = cost;
+#endif
+#ifdef BP_OCCUPANCY
+  p->occ = occ;
+#endif
+  p->arena = arena;
+  p->arena_mapped = mapped;
+  if (p->arena_layout)
+  {
+    arena_t a = {(char *)arena, 0};
+    arena_place(p, p->arena_layout, &a);
+  }
+  return 1;
+}
+
+predictor_t *predictor_fork(const predictor_snapshot_t *s)
+{
+  predictor_t *p = (predictor_t *)calloc(1, sizeof(predictor_t));
+  if (!p)
+  {
+    return NULL;
+  }
+#ifdef BP_COST
+  bp_cost_init(&p->cost);
+#endif
+  if (!predictor_snapshot_apply(p, s))
+  {
+    free(p);
+    return NULL;
+  }
+#ifdef BP_OCCUPANCY
+  predictor_occ_open(p);
+#endif
+  return p;
+}
+
+int predictor_restore(predictor_t *p, const predictor_snapshot_t *s)
+{
+  if (memcmp(&p->cfg, &s->inst.cfg, sizeof(p->cfg)) || p->arena_bytes != s->inst.arena_bytes)
+  {
+    return 0;
+  }
+  return predictor_snapshot_apply(p, s);
+}
+
+void predictor_snapshot_free(predictor_snapshot_t *s)
+{
+  if (!s)
+  {
+    return;
+  }
+  if (s->fd >= 0)
+  {
+    close(s->fd);
+  }
+  free(s->image);
+  free(s);
+}
+
+void predictor_destroy(predictor_t *p)
+{
+  if (!p)
+  {
+    return;
+  }
+  ops_of(&p->cfg)->cleanup(p);
+#ifdef BP_OCCUPANCY
+  bp_occ_free(&p->occ);
+#endif
+  free(p);
+}
+
+// A TAGE predictor replayed by three threads: the first hashes,
+// keeping the history, the second reads and trains the tables, and the
+// caller's adds up the results. Each ring is written by one stage and
+// read by the next, as the trace pipe's: the writer only moves 'head'
+// and the reader 'tail', and a side that finds its ring full or empty
+// spins briefly and then yields its core
+#define PIPELINE_CHUNK 128                  // branches in a slot
+#define PIPELINE_SLOTS 32                   // slots of each ring
+#define PIPELINE_SPIN 256
+
+typedef struct
+{
+  tage_hashed_t br[PIPELINE_CHUNK];
+  uint32_t n;
+  uint8_t last;                             // of its batch
+} pipeline_hashed_t;
+
+typedef struct
+{
+  uint32_t index[PIPELINE_CHUNK];           // of the records in the batch
+  uint8_t pred[PIPELINE_CHUNK];
+  uint8_t taken[PIPELINE_CHUNK];
+  uint32_t n;
+  uint8_t last;
+} pipeline_result_t;
+
+template <class T>
+struct pipeline_ring
+{
+  T *slots;
+  alignas(64) std::atomic<size_t> head;     // slots written
+  alignas(64) std::atomic<size_t> tail;     // slots read
+};
+
+struct predictor_pipeline
+{
+  predictor_t *p;
+  pipeline_ring<pipeline_hashed_t> hashed;
+  pipeline_ring<pipeline_result_t> results;
+  alignas(64) std::atomic<uint64_t> batches; // started by the caller
+  const predictor_branch_t *br;              // and the last one's records
+  size_t n;
+  std::atomic<int> stop;
+  std::thread hasher, reader;
+};
+
+void (*predictor_span)(const char *name) = NULL;
+
+static inline void pipeline_span(const char *name)
+{
+  if (predictor_span)
+  {
+    predictor_span(name);
+  }
+}
+
+static inline void pipeline_wait(int *spins)
+{
+  if (++*spins < PIPELINE_SPIN)
+  {
+    _mm_pause();
+  }
+  else
+  {
+    std::this_thread::yield();
+  }
+}
+
+// The next slot to write of 'r', once free
+//
+// Returns NULL when the pipeline stops
+//
+template <class T>
+static T *pipeline_put(predictor_pipeline_t *pp, pipeline_ring<T> *r)
+{
+  size_t head = r->head.load(std::memory_order_relaxed);
+  if (head - r->tail.load(std::memory_order_acquire) == PIPELINE_SLOTS)
+  {
+    pipeline_span("ring full");
+    int spins = 0;
+    while (head - r->tail.load(std::memory_order_acquire) == PIPELINE_SLOTS)
+    {
+      if (pp->stop.load(std::memory_order_relaxed))
+      {
+        pipeline_span(NULL);
+        return NULL;
+      }
+      pipeline_wait(&spins);
+    }
+    pipeline_span(NULL);
+  }
+  return &r->slots[head % PIPELINE_SLOTS];
+}
+
+// The next slot to read of 'r', once written
+//
+// Returns NULL when the pipeline stops
+//
+template <class T>
+static const T *pipeline_get(predictor_pipeline_t *pp, pipeline_ring<T> *r)
+{
+  size_t tail = r->tail.load(std::memory_order_relaxed);
+  if (r->head.load(std::memory_order_acquire) == tail)
+  {
+    pipeline_span("ring empty");
+    int spins = 0;
+    while (r->head.load(std::memory_order_acquire) == tail)
+    {
+      if (pp->stop.load(std::memory_order_relaxed))
+      {
+        pipeline_span(NULL);
+        return NULL;
+      }
+      pipeline_wait(&spins);
+    }
+    pipeline_span(NULL);
+  }
+  return &r->slots[tail % PIPELINE_SLOTS];
+}
+
+template <class T>
+static inline void pipeline_publish(pipeline_ring<T> *r)
+{
+  r->head.store(r->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+template <class T>
+static inline void pipeline_release(pipeline_ring<T> *r)
+{
+  r->tail.store(r->tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// First stage: the history and every index and tag of each batch's
+// conditional branches, which depend on the trace alone. It owns the
+// history, which it leaves in p once a batch is hashed
+template <class G>
+static void pipeline_hash_batches(predictor_pipeline_t *pp)
+{
+  predictor_t *p = pp->p;
+  uint64_t done = 0;
+  for (;;)
+  {
+    int spins = 0;
+    while (pp->batches.load(std::memory_order_acquire) == done)
+    {
+      if (pp->stop.load(std::memory_order_relaxed))
+      {
+        return;
+      }
+      pipeline_wait(&spins);
+    }
+    done++;
+    pipeline_span("hash batch");
+    const predictor_branch_t *br = pp->br;
+    size_t n = pp->n;
+    tage_hist_t hist = p->tage_hist;
+    size_t i = 0;
+    do
+    {
+      pipeline_hashed_t *slot = pipeline_put(pp, &pp->hashed);
+      if (!slot)
+      {
+        pipeline_span(NULL);
+        return;
+      }
+      uint32_t k = 0;
+      for (; i < n && k < PIPELINE_CHUNK; i++)
+      {
+        if (!(br[i].flags & BP_F_CONDITION)) continue;
+        tage_hashed_t *h = &slot->br[k++];
+        h->index = (uint32_t)i;
+        tage_hash_branch<G>(p, &hist, br[i].pc, br[i].flags & BP_F_TAKEN, h);
+      }
+      slot->n = k;
+      slot->last = i == n;
+      if (slot->last)
+      {
+        p->tage_hist = hist;
+      }
+      pipeline_publish(&pp->hashed);
+    } while (i < n);
+    pipeline_span(NULL);
+  }
+}
+
+template <class G>
+static void pipeline_hash(predictor_pipeline_t *pp)
+{
+  pipeline_span("pipeline hash");
+  pipeline_hash_batches<G>(pp);
+  pipeline_span(NULL);
+}
+
+// Second stage: the table reads and updates, in order, prefetching the
+// entries of the branch BP_PREFETCH_DISTANCE ahead in the slot from
+// the indices the first stage left
+template <class G>
+static void pipeline_read_slots(predictor_pipeline_t *pp)
+{
+  predictor_t *p = pp->p;
+  int prefetch = tage_bp_t<G>::footprint(tage_bp_t<G>::load(p)) >= BP_PREFETCH_MIN_BYTES;
+  for (;;)
+  {
+    const pipeline_hashed_t *in = pipeline_get(pp, &pp->hashed);
+    pipeline_result_t *out = in ? pipeline_put(pp, &pp->results) : NULL;
+    if (!out)
+    {
       return;
-    case GSHARE:
-      return train_gshare(pc, outcome);
-    case TOURNAMENT:
-      return train_tournament(pc, outcome);
-    case CUSTOM:
-      return train_tage(pc, outcome);
-    default:
-      break;
     }
+    pipeline_span("read slot");
+    for (uint32_t k = 0; k < in->n; k++)
+    {
+      const tage_hashed_t *h = &in->br[k];
+      if (prefetch && k + BP_PREFETCH_DISTANCE < in->n)
+      {
+        tage_prefetch_hashed<G>(p, &in->br[k + BP_PREFETCH_DISTANCE]);
+      }
+      tage_lookup_t lk;
+      tage_lookup_hashed<G>(p, h, &lk);
+      tage_update<G>(p, &lk, h->taken);
+      out->index[k] = h->index;
+      out->pred[k] = lk.pred;
+      out->taken[k] = h->taken;
+    }
+    out->n = in->n;
+    out->last = in->last;
+    pipeline_release(&pp->hashed);
+    pipeline_publish(&pp->results);
+    pipeline_span(NULL);
+  }
+}
+
+template <class G>
+static void pipeline_read(predictor_pipeline_t *pp)
+{
+  pipeline_span("pipeline read");
+  pipeline_read_slots<G>(pp);
+  pipeline_span(NULL);
+}
+
+template <class G>
+static void pipeline_start_stages(predictor_pipeline_t *pp)
+{
+  pp->hasher = std::thread(pipeline_hash<G>, pp);
+  pp->reader = std::thread(pipeline_read<G>, pp);
+}
+
+predictor_pipeline_t *predictor_pipeline_start(predictor_t *p)
+{
+#ifdef PIN_CRT
+  // Pin's C library, branchExt -predict, has no threads for the stages
+  (void)p;
+  return NULL;
+#else
+  if (p->cfg.type != CUSTOM || p->delay_ring || p->cfg.unbounded)
+  {
+    return NULL;
+  }
+  predictor_pipeline_t *pp = new predictor_pipeline_t();
+  pp->p = p;
+  pp->hashed.slots = (pipeline_hashed_t *)malloc(sizeof(pipeline_hashed_t) * PIPELINE_SLOTS);
+  pp->results.slots = (pipeline_result_t *)malloc(sizeof(pipeline_result_t) * PIPELINE_SLOTS);
+  if (!pp->hashed.slots || !pp->results.slots)
+  {
+    free(pp->hashed.slots);
+    free(pp->results.slots);
+    delete pp;
+    return NULL;
+  }
+  pp->hashed.head = pp->hashed.tail = 0;
+  pp->results.head = pp->results.tail = 0;
+  pp->batches = 0;
+  pp->stop = 0;
+  switch (p->cfg.tageHash)
+  {
+  case TAGE_HASH_MUL:
+    pipeline_start_stages<tage_runtime_hashed<tage_hash_mul> >(pp);
+    break;
+  case TAGE_HASH_CRC:
+    pipeline_start_stages<tage_runtime_hashed<tage_hash_crc> >(pp);
+    break;
+  case TAGE_HASH_CLMUL:
+    pipeline_start_stages<tage_runtime_hashed<tage_hash_clmul> >(pp);
+    break;
+  default:
+    pipeline_start_stages<tage_runtime_hashed<tage_hash_xor> >(pp);
+    break;
+  }
+  return pp;
+#endif
+}
+
+uint64_t predictor_pipeline_batch(predictor_pipeline_t *pp, const predictor_branch_t *br, size_t n,
+                                  uint64_t *predictions)
+{
+  if (predictions)
+  {
+    memset(predictions, 0, ((n + 63) / 64) * sizeof(uint64_t));
+  }
+  pp->br = br;
+  pp->n = n;
+  pp->batches.fetch_add(1, std::memory_order_release);
+
+  // Third stage: the mispredictions and prediction bits, until the
+  // batch's last slot
+  uint64_t mispredictions = 0;
+  for (;;)
+  {
+    const pipeline_result_t *r = pipeline_get(pp, &pp->results);
+    for (uint32_t k = 0; k < r->n; k++)
+    {
+      mispredictions += r->pred[k] != r->taken[k];
+      if (predictions)
+      {
+        predictions[r->index[k] >> 6] |= (uint64_t)r->pred[k] << (r->index[k] & 63);
+      }
+    }
+    int last = r->last;
+    pipeline_release(&pp->results);
+    if (last)
+    {
+      return mispredictions;
+    }
+  }
+}
+
+void predictor_pipeline_stop(predictor_pipeline_t *pp)
+{
+  if (!pp)
+  {
+    return;
+  }
+  pp->stop.store(1, std::memory_order_relaxed);
+  pp->hasher.join();
+  pp->reader.join();
+  free(pp->hashed.slots);
+  free(pp->results.slots);
+  delete pp;
+}
+
+//------------------------------------//
+//       Global Predictor API         //
+//------------------------------------//
+
+// Instance behind the original entry points
+static predictor_t *bp_global;
+
+void init_predictor()
+{
+  predictor_destroy(bp_global);
+  predictor_config_t cfg = predictor_default_config(bpType);
+  bp_global = predictor_create(&cfg);
+  if (!bp_global)
+  {
+    fprintf(stderr, "Error: invalid predictor configuration\n");
+    exit(1);
   }
 }
+
+// Make a prediction for conditional branch instruction at PC 'pc'
+// Returning TAKEN indicates a prediction of taken; returning NOTTAKEN
+// indicates a prediction of not taken
+//
+uint32_t make_prediction(uint32_t pc, uint32_t target, uint32_t direct)
+{
+  return predictor_predict(bp_global, pc, target, direct);
+}
+
+// Train the predictor the last executed branch at PC 'pc' and with
+// outcome 'outcome' (true indicates that the branch was taken, false
+// indicates that the branch was not taken)
+//
+
+void train_predictor(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+{
+  predictor_train(bp_global, pc, target, outcome, condition, call, ret, direct);
+}
+
+uint32_t predict_and_train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+{
+  return predictor_predict_and_train(bp_global, pc, target, outcome, condition, call, ret, direct);
+}
@@ -12,6 +12,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include "kernels.h"
 
 //
 // Student Information
@@ -56,6 +57,9 @@ extern int lhistoryBits; // Number of bits used for Local History
 extern int pcIndexBits;  // Number of bits used for PC index
 extern int bpType;       // Branch Prediction Type
 extern int verbose;
+extern int hugePages;    // --hugepages: MB per reserved huge page, 0 for transparent ones
+extern int updateDelay;  // --update-delay: branches each table update waits
+extern int unbounded;    // --unbounded: tables that never evict, see predictor_config_t
 
 //------------------------------------//
 //    Predictor Function Prototypes   //
@@ -80,6 +84,476 @@ void train_predictor(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t co
 // Please add your code below, and DO NOT MODIFY ANY OF THE CODE ABOVE
 // 
 
+// A predictor loaded from a shared object, see bpplugin.h
+#define PLUGIN 4
 
+// Hashed perceptron over segments of the global history
+#define PERCEPTRON 5
+
+// Bimodal choice with taken and not-taken exception caches
+#define YAGS 6
+
+// Number of predictor types
+#define NUM_BP_TYPES 7
+
+// The storage the assignment allows a predictor, 64 Kbit of tables
+// and 1024 bits for registers, see predictor_budget_bits
+#define PREDICTOR_BUDGET_BITS (64 * 1024 + 1024)
+
+// Upper bound on the number of TAGE tagged components
+#define TAGE_MAX_TAGGED 16
+
+// Upper bound on the history length of a TAGE tagged component
+#define TAGE_MAX_HIST 1024
+
+// Upper bound on updateDelay
+#define PREDICTOR_DELAY_MAX 1024
+
+// make_prediction and train_predictor in one call on the global
+// predictor
+//
+uint32_t predict_and_train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct);
+
+//------------------------------------//
+//        Predictor Instances         //
+//------------------------------------//
+
+// Everything that sizes a predictor; the entry points above run one
+// global instance built from predictor_default_config(bpType)
+typedef struct
+{
+  int type;             // STATIC, GSHARE, TOURNAMENT, CUSTOM, PLUGIN, PERCEPTRON or YAGS
+  int ghistoryBits;     // gshare history/index bits
+  int lhtBits;          // log2 tournament local histories, and their width
+  int ghrBits;          // tournament global history bits and table size
+  int localHistBits;    // tournament local history width, 0 for lhtBits
+  int localWays;        // tournament local histories per set, tagged when above 1
+  int localPatternBits; // log2 tournament local pattern tables, picked by pc bits
+  int tageBimodalBits;  // TAGE base predictor size
+  int tageTaggedBits;   // entries per TAGE tagged table
+  int tageNumTagged;    // TAGE tagged components, up to TAGE_MAX_TAGGED
+  int tageHistLengths[TAGE_MAX_TAGGED]; // outcomes each hashes, up to TAGE_MAX_HIST
+  int tageSeed;         // TAGE usefulness decay generator seed
+  int tageSC;           // TAGE statistical corrector stage, 0 or 1
+  int tageLoop;         // TAGE loop predictor stage, 0 or 1
+  int tageFilter;       // TAGE bias filter stage, 0 or 1
+  int tageUReset;       // TAGE usefulness halved every 1 << tageUReset branches,
+                        // 0 for the random decay at allocation
+  int tageHash;         // TAGE index and tag hash: 0 XOR fold, 1 multiply-shift,
+                        // 2 CRC32C, 3 carry-less multiply
+  int tageWays;         // TAGE ways per set of each tagged table, 1 (direct mapped),
+                        // 2, 4 or 8
+  int perceptronBits;   // perceptron rows per weight table
+  int perceptronFeatures; // perceptron inputs, a mask of 1 global history segments,
+                        // 2 local history, 4 path, 8 call depth, 16 targets and
+                        // 32 the whole history folded
+  int yagsChoiceBits;   // YAGS choice counters by pc
+  int yagsCacheBits;    // entries per YAGS exception cache
+  int yagsTagBits;      // YAGS pc tag width, up to 15
+  int yagsHistBits;     // outcomes in the YAGS cache index, up to 32
+  int yagsHash;         // YAGS index and tag hash, as tageHash
+  int updateDelay;      // branches predicted before a branch's update reaches the
+                        // tables, up to PREDICTOR_DELAY_MAX; the history is not delayed
+  int unbounded;        // 1 for gshare, tournament or TAGE tables that grow an entry per
+                        // distinct index and tag instead of sharing a fixed array
+} predictor_config_t;
+
+typedef struct predictor predictor_t;
+
+// Look up a predictor type by name ("gshare", "custom", ...)
+//
+// Returns the type, -1 if unknown
+//
+int predictor_type_by_name(const char *name);
+
+// Load the plugin at 'path' as the PLUGIN type, once per process
+//
+// Returns True if Successful
+//
+int predictor_plugin_load(const char *path);
+
+// Set the configuration field 'key' (e.g. "ghistoryBits", the
+// original macro name "T_LHT_BITS", or "tageHistLengths.3") to 'value'
+//
+// Returns True if Successful
+//
+int predictor_config_set(predictor_config_t *cfg, const char *key, int value);
+
+// Write the fields of 'cfg' used by its type into 'buf' of 'len'
+// bytes as "key=value ...", with the keys of predictor_config_set
+//
+void predictor_config_format(const predictor_config_t *cfg, char *buf, size_t len);
+
+// The configuration of the built-in predictor 'type'
+//
+predictor_config_t predictor_default_config(int type);
+
+// Allocate and initialize an independent predictor
+//
+// Returns NULL if the configuration is invalid
+//
+predictor_t *predictor_create(const predictor_config_t *cfg);
+
+// Same as make_prediction and train_predictor for one instance
+//
+uint32_t predictor_predict(predictor_t *p, uint32_t pc, uint32_t target, uint32_t direct);
+void predictor_train(predictor_t *p, uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct);
+
+// make_prediction followed by train_predictor for one branch, with
+// the table lookups done once; the prediction is only meaningful
+// for conditional branches
+//
+uint32_t predictor_predict_and_train(predictor_t *p, uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct);
+
+// One branch of a batch, laid out like the packed records of the
+// binary trace format
+typedef struct __attribute__((packed))
+{
+  uint32_t pc;
+  uint32_t target;
+  uint8_t flags;   // BP_F_* bits
+} predictor_branch_t;
+
+#define BP_F_TAKEN     (1 << 0)
+#define BP_F_CONDITION (1 << 1)
+#define BP_F_CALL      (1 << 2)
+#define BP_F_RET       (1 << 3)
+#define BP_F_DIRECT    (1 << 4)
+#define BP_F_SUMMARY   (1 << 5) // unconditional branches summarized, see TRACE_F_SUMMARY
+#define BP_F_BREAK     (1 << 6) // a discontinuity of the trace, see TRACE_F_BREAK
+#define BP_SUMMARY_SHIFT 24
+
+// Fields of a predictor_branch_t a predictor reads beyond the pc,
+// BP_F_TAKEN and BP_F_CONDITION, see predictor_fields. The flag ones
+// are the flag bits
+#define BP_FIELD_CALL   BP_F_CALL
+#define BP_FIELD_RET    BP_F_RET
+#define BP_FIELD_DIRECT BP_F_DIRECT
+#define BP_FIELD_TARGET (1 << 7)
+#define BP_FIELD_ALL    (BP_FIELD_CALL | BP_FIELD_RET | BP_FIELD_DIRECT | BP_FIELD_TARGET)
+
+// predictor_predict_and_train over 'n' branches in order. With
+// 'predictions' non NULL, bit i of it (word i / 64) is set when
+// conditional branch i was predicted taken
+//
+// Returns the number of mispredicted conditional branches
+//
+uint64_t predictor_predict_batch(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t *predictions);
+
+// Most predictors predictor_predict_lockstep replays at once
+#define PREDICTOR_LOCKSTEP_MAX 8
+
+// predictor_predict_batch on 'k' gshare predictors at once, adding
+// the mispredictions of ps[i] to mispredictions[i]. The records are
+// read once and the history, which the predictors must share, shifted
+// once; only the table lookups are per predictor
+//
+// Returns True if Successful, False when they are not all gshare
+// with the same history and no updateDelay, replaying nothing
+//
+int predictor_predict_lockstep(predictor_t *const *ps, int k, const predictor_branch_t *br, size_t n,
+                               uint64_t *mispredictions);
+
+// Most lanes of a predictor_slice_t, one AVX-512 vector of bits
+#define PREDICTOR_SLICE_MAX 512
+
+// Up to PREDICTOR_SLICE_MAX instances of one gshare configuration
+// replaying the same branches, each started cold and stopped at its
+// own branch, as cold starts of one trace. Their counters are stored
+// bit-sliced: a 64-bit word holds the same bit of the same entry in 64
+// lanes, so once a lane's history is as long as the index, a branch
+// reads and trains all of them with a few boolean operations on whole
+// words, 64 lanes to the instruction or 512 on an AVX-512 host. Each
+// lane predicts exactly as a predictor_create'd gshare would
+typedef struct predictor_slice predictor_slice_t;
+
+// Lanes 0 to 'lanes' - 1 of gshare 'cfg', all stopped
+//
+// Returns NULL when 'cfg' is not a gshare without updateDelay, or the
+// tables can not be allocated
+//
+predictor_slice_t *predictor_slice_create(const predictor_config_t *cfg, int lanes);
+
+// Start 'lane' as a new predictor from the next branch, or stop it;
+// between batches only
+void predictor_slice_start(predictor_slice_t *s, int lane);
+void predictor_slice_stop(predictor_slice_t *s, int lane);
+
+// predictor_predict_batch on every started lane, adding the
+// mispredictions of lane i to mispredictions[i]
+//
+void predictor_slice_batch(predictor_slice_t *s, const predictor_branch_t *br, size_t n, uint64_t *mispredictions);
+
+void predictor_slice_destroy(predictor_slice_t *s);
+
+// A predictor whose every table entry only the branches indexing it
+// train, at an index the outcomes alone decide, replays the same when
+// its table is split into ranges and each range replays just its own
+// branches: gshare with no updateDelay. predictor_index_batch walks
+// the history in order, and then one predictor_predict_indexed per
+// range may run on its own thread, all on the same predictor
+
+// Split the table of 'p' into at most 'parts' ranges of whole cache
+// lines, range i being entries [bounds[i], bounds[i + 1])
+//
+// Returns the number of ranges, 0 when 'p' does not split by index
+//
+int predictor_index_split(const predictor_t *p, int parts, uint32_t *bounds);
+
+// The table entry each conditional branch of br[0..n) reads, shifted
+// left by one with the outcome in bit 0, into entries[], in order,
+// advancing the history of 'p' over the branches
+//
+// Returns the number of conditional branches
+//
+size_t predictor_index_batch(predictor_t *p, const predictor_branch_t *br, size_t n, uint32_t *entries);
+
+// Predict and train the entries[0..n) of predictor_index_batch that
+// fall in [lo, hi), in order, skipping the others
+//
+// Returns the number of them mispredicted
+//
+uint64_t predictor_predict_indexed(predictor_t *p, const uint32_t *entries, size_t n, uint32_t lo, uint32_t hi);
+
+// predictor_predict_batch on 'k' gshare or TAGE predictors of one type
+// at once, each over its own branches br[i][0..n[i]), the same ones
+// for all to interleave sweep points, adding the mispredictions of
+// ps[i] to mispredictions[i]. Each keeps its own tables and history.
+// They advance a conditional branch of each in turn, each prefetching
+// its next lookup before the others take theirs, or on an AVX-512
+// host, gshare has one 64-bit lane of a vector per predictor
+//
+// Returns True if Successful, False when they differ in type, one has
+// an updateDelay, the type is not gshare or TAGE, or a table is under
+// BP_PREFETCH_MIN_BYTES or a TAGE has a compiled-in geometry and its
+// own loop is faster, replaying nothing
+//
+int predictor_predict_traces(predictor_t *const *ps, int k, const predictor_branch_t *const *br, const size_t *n,
+                             uint64_t *mispredictions);
+
+// The SIMD kernels of the predictors and the variants picked for this
+// host into 'out', see kernels.h
+//
+// Returns the number of kernels
+//
+int predictor_kernels(kernel_choice_t *out);
+
+// predictor_predict_batch on one TAGE predictor split over threads:
+// one folds the history and hashes every index and tag of a batch,
+// one reads and trains the tables, and the caller counts the results,
+// each passing slots of branches to the next through a ring. The
+// predictions are the same as predictor_predict_batch's. The threads
+// stay until predictor_pipeline_stop, idle between batches, when 'p'
+// may be read or saved as usual
+typedef struct predictor_pipeline predictor_pipeline_t;
+
+// Start the threads of 'p'
+//
+// Returns NULL when it is not a TAGE, --custom, predictor or has an
+// updateDelay, and always in branchExt, whose C library has no threads
+//
+predictor_pipeline_t *predictor_pipeline_start(predictor_t *p);
+
+uint64_t predictor_pipeline_batch(predictor_pipeline_t *pp, const predictor_branch_t *br, size_t n,
+                                  uint64_t *predictions);
+
+void predictor_pipeline_stop(predictor_pipeline_t *pp);
+
+// Called by the pipeline's threads, and the caller waiting on them, as
+// they begin a span 'name', a string literal, and with 'name' NULL as
+// they end the innermost one: each stage's life, batch or slot, and
+// wait on a full or empty ring. NULL, the default, for none; the
+// driver's --timeline sets timeline_event, see timeline.h
+extern void (*predictor_span)(const char *name);
+
+// The components of a predictor combined by a chooser, whose own
+// predictions never depend on it
+typedef struct
+{
+  int count;        // components, local then global for a tournament
+  int chooser_init; // initial value of its 2-bit chooser counters
+  int chooser_bits; // index bits of its chooser, from the global history
+} predictor_components_t;
+
+// Fill in 'info' for 'p'
+//
+// Returns True if Successful, False when it has no components to
+// record, not a tournament or with an updateDelay
+//
+int predictor_components(const predictor_t *p, predictor_components_t *info);
+
+// predictor_predict_batch on 'p' that also records what each of its
+// components predicted: counting its conditional branches from 'first',
+// bit i of bits[c] (word i / 64) is set when component c predicted
+// branch i taken, and bit i of 'taken' when it was taken. The bits
+// must start cleared. Its mispredictions are added to 'mispredictions'
+//
+// Returns True if Successful, False as predictor_components
+//
+int predictor_predict_components(predictor_t *p, const predictor_branch_t *br, size_t n, uint64_t first,
+                                 uint64_t *const *bits, uint64_t *taken, uint64_t *mispredictions);
+
+// The registers before each record of a batch, see history.h
+typedef struct bp_history_batch bp_history_batch_t;
+
+// The HISTORY_* registers predictor_predict_shared reads for 'p', 0
+// when it keeps its own history
+//
+int predictor_history_regs(const predictor_t *p);
+
+// predictor_predict_batch on the hist->n branches 'hist' was filled
+// from, taking the outcome history of each from 'hist' rather than
+// from the predictor's own register, which ends up the same. TAGE,
+// whose histories are folded to its geometry, and plugins keep their
+// own, as does a predictor whose register does not match the shared
+// one before the first branch, or with 'hist' lacking the registers
+// it reads
+//
+// Returns the number of mispredicted conditional branches
+//
+uint64_t predictor_predict_shared(predictor_t *p, const predictor_branch_t *br, const bp_history_batch_t *hist,
+                                  uint64_t *predictions);
+
+// The folded histories TAGE predictors replaying one stream share,
+// see history.h
+typedef struct bp_folds bp_folds_t;
+
+// Have 'p' read the folded histories of its tables from 'f' in
+// predictor_predict_folded, adding those 'f' lacks
+//
+// Returns True if Successful, False unless 'p' is TAGE with neither an
+// updateDelay nor unbounded tables, neither it nor 'f' has seen a
+// branch yet, and 'f' has room for its histories
+//
+int predictor_fold_attach(predictor_t *p, bp_folds_t *f);
+
+// predictor_predict_batch on the f->records branches 'br' that 'f' was
+// last filled from, taking the folded histories before each branch
+// from 'f' rather than folding its own, which end up the same. A
+// predictor not attached to 'f', or that replayed other records since
+// it last read 'f', replays them on its own
+//
+// Returns the number of mispredicted conditional branches
+//
+uint64_t predictor_predict_folded(predictor_t *p, const predictor_branch_t *br, const bp_folds_t *f,
+                                  uint64_t *predictions);
+
+// The local histories a predictor of 'cfg' keeps, as a direct-mapped
+// table of 1 << *lht_bits histories of *hist_bits bits indexed by the
+// low PC bits, which depend on the trace alone
+//
+// Returns False unless it is a tournament with one way and no
+// updateDelay
+//
+int predictor_local_geometry(const predictor_config_t *cfg, int *lht_bits, int *hist_bits);
+
+// predictor_predict_batch on the 'n' records 'br', taking the local
+// history of record i from entry i of 'local', of 'entry' bytes (1, 2
+// or 4), instead of from its own table, which is then left as it was.
+// The column holds the histories predictor_local_geometry describes,
+// as the records before 'br' left them; see featcache.h
+//
+// Returns the number of mispredicted conditional branches
+//
+uint64_t predictor_predict_local(predictor_t *p, const predictor_branch_t *br, size_t n, const void *local,
+                                 size_t entry, uint64_t *predictions);
+
+// The configuration 'p' was created with
+//
+const predictor_config_t *predictor_config(const predictor_t *p);
+
+// Bits of storage the hardware of 'cfg' would need, its tables and
+// history registers, as each scheme models them; the plugin's own
+// count for PLUGIN
+//
+// Returns 0 if the configuration is invalid
+//
+uint64_t predictor_budget_bits(const predictor_config_t *cfg);
+
+// The BP_FIELD_* bits of the records a predictor of 'cfg' reads, so
+// the trace reader can leave the others undecoded
+//
+// Returns BP_FIELD_ALL if the configuration is invalid
+//
+uint32_t predictor_fields(const predictor_config_t *cfg);
+
+// Fingerprint of the predictor sources this was built from, set by
+// the Makefile, so stored results of other sources are not reused
+//
+const char *predictor_build_id();
+
+// Bytes predictor_create would allocate for 'cfg', as predictor_memory
+// reports them, without creating it
+//
+// Returns 0 if the configuration is invalid
+//
+size_t predictor_config_memory(const predictor_config_t *cfg);
+
+// Number of bytes predictor_save_state writes for 'p'
+//
+size_t predictor_state_size(predictor_t *p);
+
+// Bytes allocated for 'p': the instance, the one arena holding its
+// tables and any unbounded tables as they stand; a plugin's own
+// tables are not counted
+//
+size_t predictor_memory(predictor_t *p);
+
+// Branches the TAGE bias filter of 'p' predicted with no other table
+// read, into 'filtered', of those it saw, into 'checked'
+//
+// Returns True if 'p' has a bias filter
+//
+int predictor_filter_stats(const predictor_t *p, uint64_t *filtered, uint64_t *checked);
+
+// Entries each unbounded table of 'p' grew to, up to 'max' tables,
+// into 'entries' with the table names into 'names'
+//
+// Returns the number of tables, 0 when 'p' is not unbounded
+//
+int predictor_unbounded_entries(const predictor_t *p, const char **names, uint64_t *entries, int max);
+
+// Copy every table and history register of 'p' into 'buf'
+//
+void predictor_save_state(predictor_t *p, void *buf);
+
+// Create a predictor for 'cfg' holding the state saved by
+// predictor_save_state from a predictor of the same configuration
+//
+// Returns NULL if 'buf' does not match the configuration
+//
+predictor_t *predictor_load_state(const predictor_config_t *cfg, const void *buf, size_t len);
+
+// A frozen copy of a predictor's tables and registers. Taken from a
+// new predictor it is an initial image to reset to; taken after a
+// warmup, measurements branch off it one fork at a time. Tables of 2 MB
+// or more are shared copy-on-write, so a fork or restore copies only
+// the pages it writes
+typedef struct predictor_snapshot predictor_snapshot_t;
+
+// Copy the state of 'p', which may go on training
+//
+// Returns NULL for plugins and unbounded tables or if the copy failed
+//
+predictor_snapshot_t *predictor_snapshot(predictor_t *p);
+
+// Create a predictor holding the state of 's'
+//
+// Returns NULL if the allocation failed
+//
+predictor_t *predictor_fork(const predictor_snapshot_t *s);
+
+// Put 'p' back to the state of 's', taken from a predictor of the
+// same configuration
+//
+// Returns True if Successful
+//
+int predictor_restore(predictor_t *p, const predictor_snapshot_t *s);
+
+void predictor_snapshot_free(predictor_snapshot_t *s);
+
+// Release the tables of 'p'
+//
+void predictor_destroy(predictor_t *p);
 
 #endif
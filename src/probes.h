@@ -0,0 +1,94 @@
+//========================================================//
+//  probes.h                                              //
+//  Header file for the static probes of the replay loops //
+//                                                        //
+//  Each batch of the single run loop and each task and   //
+//  piece of the sweep scheduler is marked by a start and //
+//  a done USDT probe of provider bp, for bpftrace, perf  //
+//  or SystemTap to time against a running process:       //
+//                                                        //
+//  bpftrace -e 'usdt:./predictor:bp:predict_start        //
+//    { @t[tid] = nsecs }                                 //
+//    usdt:./predictor:bp:predict_done                    //
+//    { @ns = hist(nsecs - @t[tid]) }' -p <pid>           //
+//                                                        //
+//  A probe is a single nop until a tracer attaches, and  //
+//  its arguments are values the loops have at hand.      //
+//  Without <sys/sdt.h> the probes compile to nothing.    //
+//  make ITT=<dir> also marks the same spans as Intel ITT //
+//  tasks of domain bp for VTune, with the ittnotify of   //
+//  <dir>, and --timeline records them, see timeline.h    //
+//========================================================//
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#include "timeline.h"
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define BP_HAVE_SDT 1
+#endif
+#endif
+
+// Probes of provider bp and their arguments:
+//  decode_start, decode_done(records)            a batch read from the trace
+//  predict_start(predictor), predict_done(predictor, records, mispredictions)
+//                                                a batch of one predictor
+//  sweep_task_start(worker, pack, lo, hi), sweep_task_done(worker, pack)
+//                                                a task taken by a sweep worker
+//  sweep_piece_start(worker, point), sweep_piece_done(worker, point, records, mispredictions)
+//                                                a piece of a point or a pack
+#ifdef BP_HAVE_SDT
+#define BP_PROBE0(name) DTRACE_PROBE(bp, name)
+#define BP_PROBE1(name, a) DTRACE_PROBE1(bp, name, a)
+#define BP_PROBE2(name, a, b) DTRACE_PROBE2(bp, name, a, b)
+#define BP_PROBE3(name, a, b, c) DTRACE_PROBE3(bp, name, a, b, c)
+#define BP_PROBE4(name, a, b, c, d) DTRACE_PROBE4(bp, name, a, b, c, d)
+#else
+#define BP_PROBE0(name) ((void)0)
+#define BP_PROBE1(name, a) ((void)0)
+#define BP_PROBE2(name, a, b) ((void)0)
+#define BP_PROBE3(name, a, b, c) ((void)0)
+#define BP_PROBE4(name, a, b, c, d) ((void)0)
+#endif
+
+// A span named 'name', a string literal, from BP_TASK_BEGIN to the
+// next BP_TASK_END of the thread: an ITT task with make ITT=<dir>,
+// and a span of the --timeline, see timeline.h
+#ifdef BP_ITT
+#include <ittnotify.h>
+
+static inline __itt_domain *bp_itt_domain()
+{
+  static __itt_domain *domain = __itt_domain_create("bp");
+  return domain;
+}
+
+#define BP_ITT_BEGIN(name)                                                       \
+  do                                                                             \
+  {                                                                              \
+    static __itt_string_handle *bp_itt_name = __itt_string_handle_create(name); \
+    __itt_task_begin(bp_itt_domain(), __itt_null, __itt_null, bp_itt_name);      \
+  } while (0)
+#define BP_ITT_END() __itt_task_end(bp_itt_domain())
+#else
+#define BP_ITT_BEGIN(name) ((void)0)
+#define BP_ITT_END() ((void)0)
+#endif
+
+#define BP_TASK_BEGIN(name) \
+  do                        \
+  {                         \
+    BP_ITT_BEGIN(name);     \
+    timeline_begin(name);   \
+  } while (0)
+#define BP_TASK_END() \
+  do                  \
+  {                   \
+    timeline_end();   \
+    BP_ITT_END();     \
+  } while (0)
+
+#endif
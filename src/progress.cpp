@@ -0,0 +1,146 @@
+//========================================================//
+//  progress.cpp                                          //
+//  Source file for the live progress report              //
+//========================================================//
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "progress.h"
+#include "trace.h"
+
+int progress_enabled = 0;
+progress_slot_t progress_slots[PROGRESS_SLOTS];
+
+static std::thread progress_thread;
+static std::mutex progress_lock;
+static std::condition_variable progress_wake;
+static int progress_done;
+
+// The offset of descriptor 'fd' from /proc, which the kernel keeps for
+// the reader whatever thread it is in
+//
+// Returns True if Successful
+//
+static int progress_offset(int fd, uint64_t *offset)
+{
+  char path[64], line[128];
+  snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", fd);
+  FILE *in = fopen(path, "r");
+  int ok = 0;
+  while (in && !ok && fgets(line, sizeof(line), in))
+  {
+    unsigned long long pos;
+    ok = sscanf(line, "pos: %llu", &pos) == 1;
+    *offset = pos;
+  }
+  if (in)
+  {
+    fclose(in);
+  }
+  return ok;
+}
+
+// Print 'v' with an M or G suffix into 'out'
+static void progress_count(double v, char *out, size_t len)
+{
+  const char *unit = "";
+  if (v >= 1e9)
+  {
+    v /= 1e9;
+    unit = " G";
+  }
+  else if (v >= 1e6)
+  {
+    v /= 1e6;
+    unit = " M";
+  }
+  snprintf(out, len, *unit ? "%.2f%s" : "%.0f%s", v, unit);
+}
+
+static void progress_run(uint64_t total, int fd, uint64_t size)
+{
+  int tty = isatty(STDERR_FILENO);
+  uint64_t start_ns = trace_clock_ns(), last_ns = start_ns, last_records = 0, first_offset = 0;
+  if (!total && fd >= 0 && size && !progress_offset(fd, &first_offset))
+  {
+    fd = -1;
+  }
+  std::unique_lock<std::mutex> lock(progress_lock);
+  while (!progress_wake.wait_for(lock, std::chrono::milliseconds(PROGRESS_PERIOD_MS),
+                                 [] { return progress_done; }))
+  {
+    uint64_t records = 0, branches = 0, mispredictions = 0;
+    for (int s = 0; s < PROGRESS_SLOTS; s++)
+    {
+      records += progress_slots[s].records.load(std::memory_order_relaxed);
+      branches += progress_slots[s].branches.load(std::memory_order_relaxed);
+      mispredictions += progress_slots[s].mispredictions.load(std::memory_order_relaxed);
+    }
+    uint64_t now = trace_clock_ns();
+
+    // Part done, from the records or the file offset past where the
+    // run started
+    double done = -1.0;
+    uint64_t offset;
+    if (total)
+    {
+      done = (double)records / total;
+    }
+    else if (fd >= 0 && size > first_offset && progress_offset(fd, &offset) && offset > first_offset)
+    {
+      done = (double)(offset - first_offset) / (size - first_offset);
+    }
+    done = done > 1.0 ? 1.0 : done;
+
+    char count[32], rate[32], eta[48] = "";
+    progress_count((double)records, count, sizeof(count));
+    progress_count(now > last_ns ? (records - last_records) * 1e9 / (now - last_ns) : 0.0, rate, sizeof(rate));
+    if (done > 0.0)
+    {
+      uint64_t left = (uint64_t)((now - start_ns) / 1e9 * (1.0 - done) / done);
+      snprintf(eta, sizeof(eta), ", %.1f%% done, ETA %llu:%02llu:%02llu", 100.0 * done,
+               (unsigned long long)(left / 3600), (unsigned long long)(left / 60 % 60),
+               (unsigned long long)(left % 60));
+    }
+    fprintf(stderr, "%sProgress: %s records, %s/s, rate %.3f%s%s", tty ? "\r" : "", count, rate,
+            branches ? 1000.0 * mispredictions / branches : 0.0, eta, tty ? "\033[K" : "\n");
+    fflush(stderr);
+    last_ns = now;
+    last_records = records;
+  }
+  if (tty)
+  {
+    fprintf(stderr, "\r\033[K");
+  }
+}
+
+void progress_start(uint64_t total, int fd, uint64_t size)
+{
+  for (int s = 0; s < PROGRESS_SLOTS; s++)
+  {
+    progress_slots[s].records.store(0, std::memory_order_relaxed);
+    progress_slots[s].branches.store(0, std::memory_order_relaxed);
+    progress_slots[s].mispredictions.store(0, std::memory_order_relaxed);
+  }
+  progress_done = 0;
+  progress_thread = std::thread(progress_run, total, fd, size);
+}
+
+void progress_stop()
+{
+  if (!progress_thread.joinable())
+  {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(progress_lock);
+    progress_done = 1;
+  }
+  progress_wake.notify_all();
+  progress_thread.join();
+}
@@ -0,0 +1,71 @@
+//========================================================//
+//  progress.h                                            //
+//  Header file for the live progress report              //
+//                                                        //
+//  With --progress a thread wakes every second, sums     //
+//  the counters the replay loops store once per batch,   //
+//  and prints the records replayed, the current rate,    //
+//  the running misprediction rate and an estimate of     //
+//  the time left to stderr. The loops only store, with   //
+//  relaxed atomics, each worker into its own slot        //
+//========================================================//
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#define PROGRESS_PERIOD_MS 1000
+#define PROGRESS_SLOTS 256           // workers with their own counters, more share them
+#define PROGRESS_CHUNK (1 << 20)     // records a sweep point replays between stores
+
+// Whether --progress was given
+extern int progress_enabled;
+
+// Counters of one worker, on their own cache line. 'branches' and
+// 'mispredictions' add up over every predictor it replayed
+typedef struct alignas(64)
+{
+  std::atomic<uint64_t> records;
+  std::atomic<uint64_t> branches;
+  std::atomic<uint64_t> mispredictions;
+} progress_slot_t;
+
+extern progress_slot_t progress_slots[PROGRESS_SLOTS];
+
+// Add to the counters of worker 'w'. Each slot has one writer, or a
+// few taking turns under a lock, so a load and a store will do
+//
+static inline void progress_add(int w, uint64_t records, uint64_t branches, uint64_t mispredictions)
+{
+  progress_slot_t *s = &progress_slots[w % PROGRESS_SLOTS];
+  s->records.store(s->records.load(std::memory_order_relaxed) + records, std::memory_order_relaxed);
+  s->branches.store(s->branches.load(std::memory_order_relaxed) + branches, std::memory_order_relaxed);
+  s->mispredictions.store(s->mispredictions.load(std::memory_order_relaxed) + mispredictions,
+                          std::memory_order_relaxed);
+}
+
+// Set the counters of worker 'w' to totals it keeps itself
+//
+static inline void progress_set(int w, uint64_t records, uint64_t branches, uint64_t mispredictions)
+{
+  progress_slot_t *s = &progress_slots[w % PROGRESS_SLOTS];
+  s->records.store(records, std::memory_order_relaxed);
+  s->branches.store(branches, std::memory_order_relaxed);
+  s->mispredictions.store(mispredictions, std::memory_order_relaxed);
+}
+
+// Clear the slots and start the report of a run of 'total' records
+// over all workers, or with 'total' 0 of an unknown number read from
+// a file of 'size' bytes through descriptor 'fd', whose offset then
+// gives the part done; with neither there is no estimate
+//
+void progress_start(uint64_t total, int fd, uint64_t size);
+
+// Stop the report, clearing its line on a terminal
+//
+void progress_stop();
+
+#endif
@@ -0,0 +1,406 @@
+//========================================================//
+//  remote.cpp                                            //
+//  Source file for traces read from object storage       //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "remote.h"
+#include "xxh3.h"
+
+size_t remote_cache_bytes = (size_t)REMOTE_CACHE_MB << 20;
+
+// The libcurl options used, as in curl.h, so that building needs no
+// curl headers
+#define CURLOPT_WRITEDATA 10001
+#define CURLOPT_URL 10002
+#define CURLOPT_USERPWD 10005
+#define CURLOPT_RANGE 10007
+#define CURLOPT_WRITEFUNCTION 20011
+#define CURLOPT_HTTPHEADER 10023
+#define CURLOPT_NOBODY 44
+#define CURLOPT_FOLLOWLOCATION 52
+#define CURLOPT_NOSIGNAL 99
+#define CURLOPT_AWS_SIGV4 10305
+#define CURLINFO_RESPONSE_CODE 0x200002
+#define CURLINFO_CONTENT_LENGTH_DOWNLOAD_T 0x60000f
+#define CURL_GLOBAL_DEFAULT 3
+
+typedef size_t (*curl_write_fn)(char *, size_t, size_t, void *);
+
+static struct
+{
+  int loaded;
+  int (*global_init)(long);
+  void *(*easy_init)();
+  int (*easy_setopt)(void *, int, ...);
+  int (*easy_perform)(void *);
+  int (*easy_getinfo)(void *, int, ...);
+  void (*easy_cleanup)(void *);
+  const char *(*easy_strerror)(int);
+  void *(*slist_append)(void *, const char *);
+  void (*slist_free_all)(void *);
+} curl;
+
+static std::once_flag curl_once;
+
+static void remote_load_curl()
+{
+  void *lib = dlopen("libcurl.so.4", RTLD_NOW | RTLD_LOCAL);
+  if (!lib)
+  {
+    lib = dlopen("libcurl.so", RTLD_NOW | RTLD_LOCAL);
+  }
+  if (!lib)
+  {
+    return;
+  }
+  curl.global_init = (int (*)(long))dlsym(lib, "curl_global_init");
+  curl.easy_init = (void *(*)())dlsym(lib, "curl_easy_init");
+  curl.easy_setopt = (int (*)(void *, int, ...))dlsym(lib, "curl_easy_setopt");
+  curl.easy_perform = (int (*)(void *))dlsym(lib, "curl_easy_perform");
+  curl.easy_getinfo = (int (*)(void *, int, ...))dlsym(lib, "curl_easy_getinfo");
+  curl.easy_cleanup = (void (*)(void *))dlsym(lib, "curl_easy_cleanup");
+  curl.easy_strerror = (const char *(*)(int))dlsym(lib, "curl_easy_strerror");
+  curl.slist_append = (void *(*)(void *, const char *))dlsym(lib, "curl_slist_append");
+  curl.slist_free_all = (void (*)(void *))dlsym(lib, "curl_slist_free_all");
+  curl.loaded = curl.global_init && curl.easy_init && curl.easy_setopt && curl.easy_perform &&
+                curl.easy_getinfo && curl.easy_cleanup && curl.easy_strerror && curl.slist_append &&
+                curl.slist_free_all && !curl.global_init(CURL_GLOBAL_DEFAULT);
+}
+
+// States of a cached frame
+#define REMOTE_QUEUED 0   // waiting for a worker
+#define REMOTE_FETCHING 1
+#define REMOTE_READY 2
+#define REMOTE_FAILED 3
+
+typedef struct
+{
+  std::vector<char> data;
+  int state;
+  uint64_t last_use; // of the LRU order
+} remote_entry_t;
+
+struct remote
+{
+  std::string url;
+  std::string userpwd; // key:secret of the signature, empty for none
+  std::string sigv4;   // provider:region:service of CURLOPT_AWS_SIGV4
+  void *headers;       // curl_slist of the session token
+  uint64_t size;
+
+  const trace_frame_t *frames;
+  const uint64_t *sums; // of the frames, NULL if the trace has none
+  uint64_t num_frames;
+
+  std::mutex lock;
+  std::condition_variable work;  // a frame was queued or the reader stops
+  std::condition_variable fetched;
+  std::map<uint64_t, remote_entry_t> cache;
+  std::deque<uint64_t> queue;
+  size_t cached;    // bytes of the ready frames
+  uint64_t clock;
+  uint64_t current; // the frame handed out last, kept with those ahead
+  int stop;
+  std::vector<std::thread> workers;
+};
+
+static size_t remote_append(char *ptr, size_t size, size_t nmemb, void *v)
+{
+  ((std::vector<char> *)v)->insert(((std::vector<char> *)v)->end(), ptr, ptr + size * nmemb);
+  return size * nmemb;
+}
+
+// Set up 'h' for a request to the object
+static void remote_prepare(const remote_t *r, void *h)
+{
+  curl.easy_setopt(h, CURLOPT_URL, r->url.c_str());
+  curl.easy_setopt(h, CURLOPT_FOLLOWLOCATION, 1L);
+  curl.easy_setopt(h, CURLOPT_NOSIGNAL, 1L);
+  if (!r->userpwd.empty())
+  {
+    curl.easy_setopt(h, CURLOPT_USERPWD, r->userpwd.c_str());
+    curl.easy_setopt(h, CURLOPT_AWS_SIGV4, r->sigv4.c_str());
+  }
+  if (r->headers)
+  {
+    curl.easy_setopt(h, CURLOPT_HTTPHEADER, r->headers);
+  }
+}
+
+// Fetch the 'len' bytes at 'offset' with 'h' into 'out'
+//
+// Returns True if Successful
+//
+static int remote_get(const remote_t *r, void *h, uint64_t offset, size_t len, std::vector<char> *out)
+{
+  char range[64];
+  snprintf(range, sizeof(range), "%llu-%llu", (unsigned long long)offset, (unsigned long long)(offset + len - 1));
+  for (int attempt = 0; attempt < REMOTE_RETRIES; attempt++)
+  {
+    out->clear();
+    out->reserve(len);
+    remote_prepare(r, h);
+    curl.easy_setopt(h, CURLOPT_NOBODY, 0L);
+    curl.easy_setopt(h, CURLOPT_RANGE, range);
+    curl.easy_setopt(h, CURLOPT_WRITEFUNCTION, (curl_write_fn)remote_append);
+    curl.easy_setopt(h, CURLOPT_WRITEDATA, (void *)out);
+    long code = 0;
+    int err = curl.easy_perform(h);
+    curl.easy_getinfo(h, CURLINFO_RESPONSE_CODE, &code);
+    // a server ignoring the range sends the whole object with 200
+    if (!err && (code == 206 || (code == 200 && !offset && len == r->size)) && out->size() == len)
+    {
+      return 1;
+    }
+    if (attempt + 1 == REMOTE_RETRIES)
+    {
+      fprintf(stderr, "Error: range %s of %s failed: %s\n", range, r->url.c_str(),
+              err ? curl.easy_strerror(err) : code == 200 ? "the server ignores ranges" : "HTTP error");
+    }
+  }
+  return 0;
+}
+
+// Drop least recently used ready frames, other than the current one
+// and those ahead of it, until the cache fits
+static void remote_evict(remote_t *r)
+{
+  while (r->cached > remote_cache_bytes)
+  {
+    std::map<uint64_t, remote_entry_t>::iterator lru = r->cache.end();
+    for (std::map<uint64_t, remote_entry_t>::iterator it = r->cache.begin(); it != r->cache.end(); ++it)
+    {
+      if (it->second.state == REMOTE_READY && (it->first < r->current || it->first > r->current + REMOTE_AHEAD) &&
+          (lru == r->cache.end() || it->second.last_use < lru->second.last_use))
+      {
+        lru = it;
+      }
+    }
+    if (lru == r->cache.end())
+    {
+      return;
+    }
+    r->cached -= lru->second.data.size();
+    r->cache.erase(lru);
+  }
+}
+
+static void remote_worker(remote_t *r)
+{
+  void *h = curl.easy_init();
+  std::unique_lock<std::mutex> lock(r->lock);
+  for (;;)
+  {
+    r->work.wait(lock, [r] { return r->stop || !r->queue.empty(); });
+    if (r->stop)
+    {
+      break;
+    }
+    uint64_t f = r->queue.front();
+    r->queue.pop_front();
+    r->cache[f].state = REMOTE_FETCHING;
+    lock.unlock();
+    std::vector<char> data;
+    int ok = 0;
+    // A frame enters the cache only once its checksum matches, else
+    // it is fetched again
+    for (int attempt = 0; h && !ok && attempt < REMOTE_RETRIES; attempt++)
+    {
+      ok = remote_get(r, h, r->frames[f].offset, r->frames[f].comp_size, &data) &&
+           (!r->sums || xxh3_64(data.data(), data.size()) == r->sums[f]);
+      if (!ok && data.size() == r->frames[f].comp_size && attempt + 1 == REMOTE_RETRIES)
+      {
+        fprintf(stderr, "Error: frame %llu of %s is corrupt\n", (unsigned long long)f, r->url.c_str());
+      }
+    }
+    lock.lock();
+    remote_entry_t *e = &r->cache[f];
+    e->data.swap(data);
+    e->state = ok ? REMOTE_READY : REMOTE_FAILED;
+    e->last_use = r->clock++;
+    r->cached += e->data.size();
+    remote_evict(r);
+    r->fetched.notify_all();
+  }
+  if (h)
+  {
+    curl.easy_cleanup(h);
+  }
+}
+
+int remote_is_url(const char *path)
+{
+  return path && (!strncmp(path, "http://", 7) || !strncmp(path, "https://", 8) || !strncmp(path, "s3://", 5));
+}
+
+remote_t *remote_open(const char *url)
+{
+  std::call_once(curl_once, remote_load_curl);
+  if (!curl.loaded)
+  {
+    fprintf(stderr, "Unable to load libcurl for %s\n", url);
+    return NULL;
+  }
+  remote_t *r = new remote_t();
+  r->url = url;
+  r->headers = NULL;
+  r->size = 0;
+  r->frames = NULL;
+  r->sums = NULL;
+  r->num_frames = 0;
+  r->cached = 0;
+  r->clock = 0;
+  r->current = ~0ULL;
+  r->stop = 0;
+
+  const char *region = getenv("AWS_REGION") ? getenv("AWS_REGION") : getenv("AWS_DEFAULT_REGION");
+  region = region ? region : "us-east-1";
+  if (!strncmp(url, "s3://", 5))
+  {
+    const char *bucket = url + 5, *key = strchr(bucket, '/');
+    const char *endpoint = getenv("AWS_ENDPOINT_URL");
+    if (!key)
+    {
+      fprintf(stderr, "No key in %s\n", url);
+      delete r;
+      return NULL;
+    }
+    r->url = endpoint ? std::string(endpoint) + (endpoint[strlen(endpoint) - 1] == '/' ? "" : "/") +
+                            std::string(bucket, key - bucket) + key
+                      : "https://" + std::string(bucket, key - bucket) + ".s3." + region + ".amazonaws.com" + key;
+  }
+  const char *id = getenv("AWS_ACCESS_KEY_ID"), *secret = getenv("AWS_SECRET_ACCESS_KEY");
+  if (id && secret)
+  {
+    r->userpwd = std::string(id) + ":" + secret;
+    r->sigv4 = std::string("aws:amz:") + region + ":s3";
+    const char *token = getenv("AWS_SESSION_TOKEN");
+    if (token)
+    {
+      r->headers = curl.slist_append(NULL, (std::string("x-amz-security-token: ") + token).c_str());
+    }
+  }
+
+  // The size, from the headers of a HEAD request
+  void *h = curl.easy_init();
+  long code = 0;
+  int64_t size = -1;
+  int err = 1;
+  if (h)
+  {
+    remote_prepare(r, h);
+    curl.easy_setopt(h, CURLOPT_NOBODY, 1L);
+    err = curl.easy_perform(h);
+    curl.easy_getinfo(h, CURLINFO_RESPONSE_CODE, &code);
+    curl.easy_getinfo(h, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &size);
+    curl.easy_cleanup(h);
+  }
+  if (err || code / 100 != 2 || size <= 0)
+  {
+    fprintf(stderr, "Unable to reach %s: %s\n", r->url.c_str(),
+            !h ? "no curl handle" : err ? curl.easy_strerror(err) : code / 100 != 2 ? "HTTP error" : "no length");
+    remote_close(r);
+    return NULL;
+  }
+  r->size = size;
+  return r;
+}
+
+uint64_t remote_size(const remote_t *r)
+{
+  return r->size;
+}
+
+int remote_read(remote_t *r, uint64_t offset, size_t len, char *dst)
+{
+  void *h = curl.easy_init();
+  std::vector<char> data;
+  int ok = h && remote_get(r, h, offset, len, &data);
+  if (h)
+  {
+    curl.easy_cleanup(h);
+  }
+  if (ok)
+  {
+    memcpy(dst, data.data(), len);
+  }
+  return ok;
+}
+
+void remote_set_frames(remote_t *r, const trace_frame_t *frames, const uint64_t *sums, uint64_t n)
+{
+  r->frames = frames;
+  r->sums = sums;
+  r->num_frames = n;
+  for (int t = 0; t < REMOTE_THREADS; t++)
+  {
+    r->workers.push_back(std::thread(remote_worker, r));
+  }
+}
+
+const char *remote_frame(remote_t *r, uint64_t f)
+{
+  std::unique_lock<std::mutex> lock(r->lock);
+
+  // Requeue from 'f' on, so that a seek drops the frames queued ahead
+  // of the old position
+  for (size_t q = 0; q < r->queue.size(); q++)
+  {
+    r->cache.erase(r->queue[q]);
+  }
+  r->queue.clear();
+  for (uint64_t g = f; g < r->num_frames && g <= f + REMOTE_AHEAD; g++)
+  {
+    if (!r->cache.count(g))
+    {
+      r->cache[g].state = REMOTE_QUEUED;
+      r->queue.push_back(g);
+    }
+  }
+  r->work.notify_all();
+
+  r->current = f;
+  r->fetched.wait(lock, [r, f] { return r->cache[f].state >= REMOTE_READY; });
+  remote_entry_t *e = &r->cache[f];
+  if (e->state == REMOTE_FAILED)
+  {
+    fprintf(stderr, "Error: failed to fetch trace frame %llu\n", (unsigned long long)f);
+    exit(1);
+  }
+  e->last_use = r->clock++;
+  remote_evict(r);
+  return e->data.data();
+}
+
+void remote_close(remote_t *r)
+{
+  if (!r)
+  {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(r->lock);
+    r->stop = 1;
+    r->work.notify_all();
+  }
+  for (size_t t = 0; t < r->workers.size(); t++)
+  {
+    r->workers[t].join();
+  }
+  if (r->headers)
+  {
+    curl.slist_free_all(r->headers);
+  }
+  delete r;
+}
@@ -0,0 +1,72 @@
+//========================================================//
+//  remote.h                                              //
+//  Header file for traces read from object storage       //
+//                                                        //
+//  A framed trace at an http://, https:// or s3:// URL   //
+//  is read in place: its header and frame index come     //
+//  first, then each frame the reader reaches is fetched  //
+//  with an HTTP range request, REMOTE_AHEAD frames ahead //
+//  on REMOTE_THREADS connections, and kept in an LRU     //
+//  cache. A seek, as of --start or --shard, only fetches //
+//  the frames from there on. libcurl is loaded at run    //
+//  time                                                  //
+//========================================================//
+
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "trace.h"
+
+#define REMOTE_THREADS 8     // range requests in flight
+#define REMOTE_AHEAD 16      // frames fetched ahead of the reader
+#define REMOTE_RETRIES 3     // attempts of each request
+#define REMOTE_CACHE_MB 256  // default size of the frame cache
+
+// Bytes of compressed frames kept, --remote-cache
+extern size_t remote_cache_bytes;
+
+typedef struct remote remote_t;
+
+// Whether 'path' is a URL remote_open takes
+//
+int remote_is_url(const char *path);
+
+// Find the size of the object at 'url'. s3://<bucket>/<key> goes to
+// $AWS_ENDPOINT_URL/<bucket>/<key> when set, else to AWS in
+// $AWS_REGION, and the requests are signed with $AWS_ACCESS_KEY_ID
+// and $AWS_SECRET_ACCESS_KEY when they are given
+//
+// Returns NULL, with the reason printed, if it can not be reached
+//
+remote_t *remote_open(const char *url);
+
+// Size of the object in bytes
+//
+uint64_t remote_size(const remote_t *r);
+
+// Fetch the 'len' bytes at 'offset' into 'dst'
+//
+// Returns True if Successful
+//
+int remote_read(remote_t *r, uint64_t offset, size_t len, char *dst);
+
+// Start serving the 'n' frames of 'frames', which must stay valid
+// until remote_close, as must their checksums 'sums' unless NULL: a
+// fetched frame that does not match its checksum is fetched again, up
+// to REMOTE_RETRIES times, before it fails
+//
+void remote_set_frames(remote_t *r, const trace_frame_t *frames, const uint64_t *sums, uint64_t n);
+
+// The compressed bytes of frame 'f', fetched or from the cache, and
+// start fetching the frames after it. They stay valid until the next
+// call
+//
+const char *remote_frame(remote_t *r, uint64_t f);
+
+// Stop the fetches and release the cache
+//
+void remote_close(remote_t *r);
+
+#endif
@@ -0,0 +1,206 @@
+//========================================================//
+//  replay.cpp                                            //
+//  Source file for replaying decoded records             //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include "replay.h"
+#include "probes.h"
+
+// The trace records are handed to the predictors as they are
+static_assert(sizeof(branch_record_t) == sizeof(predictor_branch_t), "record layout");
+static_assert(TRACE_F_TAKEN == BP_F_TAKEN && TRACE_F_CONDITION == BP_F_CONDITION &&
+              TRACE_F_CALL == BP_F_CALL && TRACE_F_RET == BP_F_RET && TRACE_F_DIRECT == BP_F_DIRECT &&
+              TRACE_F_SUMMARY == BP_F_SUMMARY && TRACE_F_BREAK == BP_F_BREAK,
+              "record flags");
+static_assert(TRACE_FIELD_ALL == BP_FIELD_ALL && TRACE_FIELD_TARGET == BP_FIELD_TARGET, "record fields");
+
+uint64_t replay_count_conditional(const branch_record_t *recs, size_t n)
+{
+  uint64_t branches = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    branches += TRACE_FLAG(&recs[i], TRACE_F_CONDITION);
+  }
+  return branches;
+}
+
+void replay_records(predictor_t *p, const branch_record_t *recs, size_t n, replay_stats_t *st)
+{
+  st->branches += replay_count_conditional(recs, n);
+  st->mispredictions += predictor_predict_batch(p, replay_branches(recs), n, NULL);
+}
+
+replay_history_t *replay_history_new(predictor_t *const *predictors, int n)
+{
+  int regs = 0, readers = 0;
+  for (int p = 0; p < n; p++)
+  {
+    int r = predictor_history_regs(predictors[p]);
+    regs |= r;
+    readers += r != 0;
+  }
+  if (readers < 2)
+  {
+    return NULL;
+  }
+  replay_history_t *h = (replay_history_t *)calloc(1, sizeof(replay_history_t));
+  if (h)
+  {
+    h->regs = regs;
+  }
+  return h;
+}
+
+void replay_batch(predictor_t *const *predictors, int n, const branch_record_t *recs, size_t m,
+                  replay_history_t *h, replay_stats_t *st)
+{
+  uint64_t branches = st ? replay_count_conditional(recs, m) : 0;
+  if (h)
+  {
+    replay_history_fill(h, recs, m);
+  }
+  for (int p = 0; p < n; p++)
+  {
+    uint64_t mispredictions = h ? predictor_predict_shared(predictors[p], replay_branches(recs), &h->batch, NULL)
+                                : predictor_predict_batch(predictors[p], replay_branches(recs), m, NULL);
+    if (st)
+    {
+      st[p].branches += branches;
+      st[p].mispredictions += mispredictions;
+    }
+  }
+}
+
+// One thread of replay_parallel
+//
+static void replay_consume(trace_pipe_t *tp, int c, predictor_t *p, uint64_t warmup, uint64_t count,
+                           int fingerprint, replay_consumer_t *out)
+{
+  timeline_thread("predictor", c);
+  uint64_t predictions[TRACE_BATCH / 64];
+  const branch_record_t *recs;
+  size_t n;
+  uint64_t t = trace_clock_ns();
+  while (out->records < count && (n = trace_pipe_next_for(tp, c, &recs)) > 0)
+  {
+    uint64_t now = trace_clock_ns();
+    out->wait_ns += now - t;
+    t = now;
+    size_t m = 0;
+    if (out->warmed < warmup)
+    {
+      m = n < warmup - out->warmed ? n : warmup - out->warmed;
+      replay_warmup(p, recs, m);
+      out->warmed += m;
+    }
+    size_t k = n - m < count - out->records ? n - m : count - out->records;
+    if (k)
+    {
+      BP_TASK_BEGIN("predict");
+      out->st.branches += replay_count_conditional(recs + m, k);
+      out->st.mispredictions +=
+          predictor_predict_batch(p, replay_branches(recs + m), k, fingerprint ? predictions : NULL);
+      BP_TASK_END();
+      if (fingerprint)
+      {
+        fingerprint_add(&out->fingerprint, replay_branches(recs + m), predictions, k);
+      }
+      out->records += k;
+    }
+    now = trace_clock_ns();
+    out->predict_ns += now - t;
+    t = now;
+  }
+  trace_pipe_leave(tp, c);
+}
+
+void replay_parallel(trace_pipe_t *tp, predictor_t *const *predictors, int n, uint64_t warmup, uint64_t count,
+                     int fingerprint, replay_consumer_t *out)
+{
+  std::thread threads[TRACE_PIPE_CONSUMERS];
+  for (int p = 0; p < n; p++)
+  {
+    memset(&out[p], 0, sizeof(out[p]));
+    fingerprint_init(&out[p].fingerprint);
+    threads[p] = std::thread(replay_consume, tp, p, predictors[p], warmup, count, fingerprint, &out[p]);
+  }
+  for (int p = 0; p < n; p++)
+  {
+    threads[p].join();
+  }
+}
+
+void replay_records_profiled(predictor_t *p, const branch_record_t *recs, size_t n, const uint32_t *ids,
+                             uint32_t num_pcs, const uint64_t *cond, const uint64_t *taken,
+                             replay_stats_t *st, pc_counts_t *misses)
+{
+  uint64_t predictions[TRACE_BATCH / 64];
+  for (size_t i = 0; i < n; i += TRACE_BATCH)
+  {
+    size_t m = n - i < TRACE_BATCH ? n - i : TRACE_BATCH;
+    st->branches += replay_count_conditional(recs + i, m);
+    st->mispredictions += predictor_predict_batch(p, replay_branches(recs + i), m, predictions);
+    pc_profile_misses(cond + i / 64, taken + i / 64, predictions, m, predictions);
+    pc_counts_add(misses, ids + i, m, num_pcs, predictions);
+  }
+}
+
+size_t replay_load(trace_reader_t *tr, uint64_t count, const branch_record_t **recs, branch_record_t **owned)
+{
+  *owned = NULL;
+
+  // Plain binary in the page cache, nothing to decode
+  if (tr->format == TRACE_FMT_BIN && trace_mapped(tr) && !tr->frames && !tr->has_ids)
+  {
+    uint64_t n = (tr->len - tr->pos) / sizeof(branch_record_t);
+    if (n > tr->records_left)
+    {
+      n = tr->records_left;
+    }
+    if (n > count)
+    {
+      n = count;
+    }
+    *recs = (const branch_record_t *)(tr->data + tr->pos);
+    return n;
+  }
+
+  size_t cap = 1 << 20;
+  size_t n = 0;
+  branch_record_t *buf = (branch_record_t *)malloc(cap * sizeof(branch_record_t));
+  while (buf && n < count)
+  {
+    if (n == cap)
+    {
+      cap *= 2;
+      buf = (branch_record_t *)realloc(buf, cap * sizeof(branch_record_t));
+      if (!buf)
+      {
+        break;
+      }
+    }
+    size_t want = cap - n;
+    if (want > count - n)
+    {
+      want = count - n;
+    }
+    size_t got = trace_read_batch(tr, buf + n, want);
+    if (got == 0)
+    {
+      break;
+    }
+    n += got;
+  }
+  if (!buf)
+  {
+    fprintf(stderr, "Error: trace buffer malloc failed\n");
+    exit(1);
+  }
+  *recs = buf;
+  *owned = buf;
+  return n;
+}
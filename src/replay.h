@@ -0,0 +1,155 @@
+//========================================================//
+//  replay.h                                              //
+//  Header file for replaying decoded records             //
+//                                                        //
+//  Shared by the drivers that run predictors over        //
+//  in-memory traces                                      //
+//========================================================//
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <math.h>
+#include "predictor.h"
+#include "history.h"
+#include "trace.h"
+#include "pcprof.h"
+#include "tracepipe.h"
+#include "fingerprint.h"
+
+typedef struct
+{
+  uint64_t branches;       // conditional branches seen
+  uint64_t mispredictions;
+} replay_stats_t;
+
+// The records as predictor_predict_batch input, no copy
+//
+static inline const predictor_branch_t *replay_branches(const branch_record_t *recs)
+{
+  return (const predictor_branch_t *)recs;
+}
+
+// Train 'p' on 'n' records without counting them
+//
+static inline void replay_warmup(predictor_t *p, const branch_record_t *recs, size_t n)
+{
+  predictor_predict_batch(p, replay_branches(recs), n, NULL);
+}
+
+// Number of conditional branches among 'n' records
+//
+uint64_t replay_count_conditional(const branch_record_t *recs, size_t n);
+
+// Predict and train 'p' on 'n' records, adding to 'st'
+//
+void replay_records(predictor_t *p, const branch_record_t *recs, size_t n, replay_stats_t *st);
+
+// The history of one stream of records, advanced once per batch for
+// all the predictors replaying it
+typedef struct
+{
+  int regs;              // HISTORY_* the predictors read
+  bp_history_t hist;
+  bp_history_batch_t batch;
+} replay_history_t;
+
+// A history for the 'n' predictors to share, advanced in
+// replay_history_fill
+//
+// Returns NULL when fewer than two of them read one
+//
+replay_history_t *replay_history_new(predictor_t *const *predictors, int n);
+
+static inline void replay_history_fill(replay_history_t *h, const branch_record_t *recs, size_t n)
+{
+  history_fill(&h->hist, replay_branches(recs), n, h->regs, &h->batch);
+}
+
+static_assert(TRACE_BATCH <= HISTORY_BATCH, "a trace batch fills one history batch");
+
+// Predict and train 'n' predictors on 'm' records, at most
+// TRACE_BATCH, adding to st[p] or, with 'st' NULL, only training. With
+// 'h' non NULL the history is advanced once in 'h' and read by every
+// predictor that can share it
+//
+void replay_batch(predictor_t *const *predictors, int n, const branch_record_t *recs, size_t m,
+                  replay_history_t *h, replay_stats_t *st);
+
+// What one predictor of replay_parallel counted
+typedef struct
+{
+  replay_stats_t st;
+  uint64_t warmed;      // records it only trained on
+  uint64_t records;     // records counted after them
+  uint64_t predict_ns;
+  uint64_t wait_ns;     // waiting for the reader
+  fingerprint_t fingerprint;
+} replay_consumer_t;
+
+// Replay each of the 'n' predictors on a thread of its own, predictor
+// p reading every batch of 'tp' as its consumer p: the first 'warmup'
+// records only train it and up to 'count' more are counted into
+// out[p], with 'fingerprint' also hashing its predictions there
+//
+void replay_parallel(trace_pipe_t *tp, predictor_t *const *predictors, int n, uint64_t warmup, uint64_t count,
+                     int fingerprint, replay_consumer_t *out);
+
+// replay_records that also counts the mispredictions of each PC in
+// 'misses', given the PC id of every record (all below 'num_pcs')
+// and the pc_profile_outcomes bitmaps of all 'n' records
+//
+void replay_records_profiled(predictor_t *p, const branch_record_t *recs, size_t n, const uint32_t *ids,
+                             uint32_t num_pcs, const uint64_t *cond, const uint64_t *taken,
+                             replay_stats_t *st, pc_counts_t *misses);
+
+// The records of 'tr' from its current position, at most 'count'.
+// Plain mapped binary traces are used in place, anything else is
+// decoded into *owned, which the caller frees
+//
+// Returns the number of records in *recs
+//
+size_t replay_load(trace_reader_t *tr, uint64_t count, const branch_record_t **recs, branch_record_t **owned);
+
+// Misprediction rate per 1000 conditional branches
+//
+static inline double replay_rate(const replay_stats_t *st)
+{
+  return 1000.0 * (double)st->mispredictions / (double)st->branches;
+}
+
+// Running mean and variance of the rates of successive windows
+// (Welford), for confidence intervals on a rate
+typedef struct
+{
+  uint64_t windows;
+  double mean;
+  double m2;      // sum of squared deviations from the mean
+} replay_monitor_t;
+
+static inline void replay_monitor_add(replay_monitor_t *m, double rate)
+{
+  m->windows++;
+  double delta = rate - m->mean;
+  m->mean += delta / m->windows;
+  m->m2 += delta * (rate - m->mean);
+}
+
+// Half width of the 95% confidence interval of the mean rate, from
+// the Student t quantile up to 30 windows and the normal one above
+//
+static inline double replay_monitor_interval(const replay_monitor_t *m)
+{
+  static const double t95[30] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+  if (m->windows < 2)
+  {
+    return INFINITY;
+  }
+  uint64_t df = m->windows - 1;
+  return (df <= 30 ? t95[df - 1] : 1.960) * sqrt(m->m2 / df / m->windows);
+}
+
+#endif
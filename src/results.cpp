@@ -0,0 +1,447 @@
+//========================================================//
+//  results.cpp                                           //
+//  Source file for run results                           //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <algorithm>
+#include "predictor.h"
+#include "results.h"
+
+int result_shard = 0;
+int result_shards = 1;
+const char *result_path = NULL;
+int result_format = RESULT_FORMAT_TEXT;
+
+static const char *result_status_names[RESULT_STATUSES] = {"ok", "invalid", "failed", "over-budget", "oversized"};
+
+int results_parse_shard(const char *spec)
+{
+  char *end;
+  long i = strtol(spec, &end, 10);
+  if (end == spec || *end != '/')
+  {
+    return 0;
+  }
+  const char *p = end + 1;
+  long n = strtol(p, &end, 10);
+  if (end == p || *end || n < 1 || i < 0 || i >= n)
+  {
+    return 0;
+  }
+  result_shard = i;
+  result_shards = n;
+  return 1;
+}
+
+int results_parse_format(const char *name)
+{
+  static const char *names[] = {"text", "json", "csv"};
+  for (int f = 0; f < 3; f++)
+  {
+    if (!strcmp(name, names[f]))
+    {
+      result_format = f;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// One line per sweep point, as printed by sweep_run
+//
+static void results_print_sweep(const std::vector<const result_row_t *> &rows)
+{
+  printf("%-11s %10s %10s %8s %10s  %s\n", "Predictor", "Branches", "Incorrect", "Rate", "Bits", "Parameters");
+  for (size_t i = 0; i < rows.size(); i++)
+  {
+    const result_row_t *r = rows[i];
+    if (r->status == RESULT_OVER_BUDGET)
+    {
+      printf("%-11s %10s %10s %8s %10llu  %s\n", bpName[r->type], "-", "-", "budget",
+             (unsigned long long)r->budget_bits, r->params.c_str());
+      continue;
+    }
+    if (r->status == RESULT_OVERSIZED)
+    {
+      printf("%-11s %10s %10s %8s %10llu  %s\n", bpName[r->type], "-", "-", "oversize",
+             (unsigned long long)r->budget_bits, r->params.c_str());
+      continue;
+    }
+    if (r->status != RESULT_OK)
+    {
+      printf("%-11s %10s %10s %8s %10s  %s\n", bpName[r->type], "-", "-", "invalid", "-", r->params.c_str());
+      continue;
+    }
+    printf("%-11s %10llu %10llu %8.3f %10llu  %s", bpName[r->type], (unsigned long long)r->stats.branches,
+           (unsigned long long)r->stats.mispredictions, r->stats.branches ? replay_rate(&r->stats) : 0.0,
+           (unsigned long long)r->budget_bits, r->params.c_str());
+    if (r->replayed < r->records)
+    {
+      printf(" (stopped at %.0f%%)", 100.0 * r->replayed / r->records);
+    }
+    printf("\n");
+  }
+}
+
+// Per trace lines, then the mean and geometric mean of each
+// predictor over the traces it replayed
+//
+static void results_print_traces(const std::vector<const result_row_t *> &rows)
+{
+  printf("%-32s %-11s %10s %10s %8s\n", "Trace", "Predictor", "Branches", "Incorrect", "Rate");
+  std::vector<int> types;
+  for (size_t i = 0; i < rows.size(); i++)
+  {
+    const result_row_t *r = rows[i];
+    if (std::find(types.begin(), types.end(), r->type) == types.end())
+    {
+      types.push_back(r->type);
+    }
+    if (r->status != RESULT_OK)
+    {
+      if (i == 0 || rows[i - 1]->index != r->index)
+      {
+        printf("%-32s unable to open\n", r->name.c_str());
+      }
+      continue;
+    }
+    printf("%-32s %-11s %10llu %10llu %8.3f\n", r->name.c_str(), bpName[r->type],
+           (unsigned long long)r->stats.branches, (unsigned long long)r->stats.mispredictions,
+           replay_rate(&r->stats));
+  }
+  for (size_t t = 0; t < types.size(); t++)
+  {
+    double sum = 0, log_sum = 0;
+    int n = 0;
+    for (size_t i = 0; i < rows.size(); i++)
+    {
+      const result_row_t *r = rows[i];
+      if (r->type != types[t] || r->status != RESULT_OK || r->stats.branches == 0)
+      {
+        continue;
+      }
+      double rate = replay_rate(&r->stats);
+      sum += rate;
+      log_sum += log(rate > 0 ? rate : 1e-9);
+      n++;
+    }
+    if (n > 0)
+    {
+      char label[64];
+      snprintf(label, sizeof(label), "Mean of %d", n);
+      printf("%-32s %-11s %10s %10s %8.3f\n", label, bpName[types[t]], "", "", sum / n);
+      snprintf(label, sizeof(label), "Geomean of %d", n);
+      printf("%-32s %-11s %10s %10s %8.3f\n", label, bpName[types[t]], "", "", exp(log_sum / n));
+    }
+  }
+}
+
+// Print the sweep table and the trace table of 'rows', each when
+// it has any rows
+//
+static void results_print(const std::vector<result_row_t> &rows)
+{
+  std::vector<const result_row_t *> sweep, traces;
+  for (size_t i = 0; i < rows.size(); i++)
+  {
+    (rows[i].kind == RESULT_SWEEP ? sweep : traces).push_back(&rows[i]);
+  }
+  if (!sweep.empty())
+  {
+    results_print_sweep(sweep);
+  }
+  if (!traces.empty())
+  {
+    results_print_traces(traces);
+  }
+}
+
+// Print 's' as a JSON string
+//
+static void results_json_string(const std::string &s)
+{
+  putchar('"');
+  for (size_t i = 0; i < s.size(); i++)
+  {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\')
+    {
+      printf("\\%c", c);
+    }
+    else if (c < 0x20)
+    {
+      printf("\\u%04x", c);
+    }
+    else
+    {
+      putchar(c);
+    }
+  }
+  putchar('"');
+}
+
+// Print 's' as a CSV field, quoted when it has a separator or quote
+//
+static void results_csv_string(const std::string &s)
+{
+  if (s.find_first_of(",\"\n") == std::string::npos)
+  {
+    fputs(s.c_str(), stdout);
+    return;
+  }
+  putchar('"');
+  for (size_t i = 0; i < s.size(); i++)
+  {
+    if (s[i] == '"')
+    {
+      putchar('"');
+    }
+    putchar(s[i]);
+  }
+  putchar('"');
+}
+
+// Print 'rows' as JSON or CSV, one record per row with the rate as
+// "mpki" (mispredictions per 1000 conditional branches)
+//
+static void results_print_records(const std::vector<result_row_t> &rows)
+{
+  if (result_format == RESULT_FORMAT_CSV)
+  {
+    printf("trace,predictor,configuration,branches,mispredictions,mpki,runtime_s,branches_per_sec,memory_bytes,"
+           "budget_bits,records,status,fingerprint\n");
+  }
+  else
+  {
+    printf("[");
+  }
+  for (size_t i = 0; i < rows.size(); i++)
+  {
+    const result_row_t *r = &rows[i];
+    double mpki = r->stats.branches ? replay_rate(&r->stats) : 0.0;
+    double runtime = r->runtime_ns / 1e9;
+    double per_sec = r->runtime_ns ? r->replayed * 1e9 / r->runtime_ns : 0.0;
+    if (result_format == RESULT_FORMAT_CSV)
+    {
+      results_csv_string(r->name);
+      printf(",%s,", bpName[r->type]);
+      results_csv_string(r->config);
+      printf(",%llu,%llu,%.3f,%.6f,%.0f,%llu,%llu,%llu,%s,%s\n", (unsigned long long)r->stats.branches,
+             (unsigned long long)r->stats.mispredictions, mpki, runtime, per_sec, (unsigned long long)r->memory,
+             (unsigned long long)r->budget_bits, (unsigned long long)r->replayed, result_status_names[r->status],
+             r->fingerprint.c_str());
+      continue;
+    }
+    printf(i ? ",\n  {\"trace\": " : "\n  {\"trace\": ");
+    results_json_string(r->name);
+    printf(", \"predictor\": \"%s\", \"configuration\": ", bpName[r->type]);
+    results_json_string(r->config);
+    printf(", \"branches\": %llu, \"mispredictions\": %llu, \"mpki\": %.3f, \"runtime_s\": %.6f, "
+           "\"branches_per_sec\": %.0f, \"memory_bytes\": %llu, \"budget_bits\": %llu, \"records\": %llu, "
+           "\"status\": \"%s\", \"fingerprint\": ",
+           (unsigned long long)r->stats.branches, (unsigned long long)r->stats.mispredictions, mpki, runtime, per_sec,
+           (unsigned long long)r->memory, (unsigned long long)r->budget_bits, (unsigned long long)r->replayed,
+           result_status_names[r->status]);
+    printf(r->fingerprint.empty() ? "null}" : "\"%s\"}", r->fingerprint.c_str());
+  }
+  if (result_format == RESULT_FORMAT_JSON)
+  {
+    printf(rows.empty() ? "]\n" : "\n]\n");
+  }
+}
+
+// Write 'rows' to 'path' through a temporary file
+//
+// Returns True if Successful
+//
+static int results_write(const char *path, const std::vector<result_row_t> &rows)
+{
+  std::string tmp = std::string(path) + ".tmp";
+  FILE *out = fopen(tmp.c_str(), "w");
+  if (!out)
+  {
+    return 0;
+  }
+  fprintf(out, "%s %d %d %d\n", RESULTS_MAGIC, RESULTS_VERSION, result_shard, result_shards);
+  for (size_t i = 0; i < rows.size(); i++)
+  {
+    const result_row_t *r = &rows[i];
+    fprintf(out, "%s\t%llu\t%s\t%s\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t%s\t%s\t%s\n",
+            r->kind == RESULT_SWEEP ? "sweep" : "trace", (unsigned long long)r->index, bpName[r->type],
+            result_status_names[r->status], (unsigned long long)r->stats.branches,
+            (unsigned long long)r->stats.mispredictions, (unsigned long long)r->replayed,
+            (unsigned long long)r->records, (unsigned long long)r->runtime_ns, (unsigned long long)r->memory,
+            (unsigned long long)r->budget_bits, r->name.c_str(), r->params.c_str(), r->config.c_str());
+  }
+  int ok = !ferror(out);
+  ok = fclose(out) == 0 && ok;
+  if (ok && rename(tmp.c_str(), path))
+  {
+    ok = 0;
+  }
+  if (!ok)
+  {
+    unlink(tmp.c_str());
+  }
+  return ok;
+}
+
+int results_report(const std::vector<result_row_t> &rows)
+{
+  if (result_format == RESULT_FORMAT_TEXT)
+  {
+    results_print(rows);
+  }
+  else
+  {
+    results_print_records(rows);
+  }
+  if (result_path && !results_write(result_path, rows))
+  {
+    fprintf(stderr, "Error: failed to write %s\n", result_path);
+    return 0;
+  }
+  return 1;
+}
+
+// Parse one tab separated row of a result file
+//
+// Returns True if Successful
+//
+static int results_parse_row(char *line, result_row_t *r)
+{
+  line[strcspn(line, "\n")] = '\0';
+  char *fields[14];
+  int n = 0;
+  for (char *p = line; n < 14 && p; n++)
+  {
+    fields[n] = p;
+    p = n < 13 ? strchr(p, '\t') : NULL;
+    if (p)
+    {
+      *p++ = '\0';
+    }
+  }
+  if (n < 14)
+  {
+    return 0;
+  }
+  if (!strcmp(fields[0], "sweep"))
+  {
+    r->kind = RESULT_SWEEP;
+  }
+  else if (!strcmp(fields[0], "trace"))
+  {
+    r->kind = RESULT_TRACE;
+  }
+  else
+  {
+    return 0;
+  }
+  r->type = predictor_type_by_name(fields[2]);
+  r->status = -1;
+  for (int s = 0; s < RESULT_STATUSES; s++)
+  {
+    if (!strcmp(fields[3], result_status_names[s]))
+    {
+      r->status = s;
+    }
+  }
+  if (r->type < 0 || r->status < 0)
+  {
+    return 0;
+  }
+  r->index = strtoull(fields[1], NULL, 10);
+  r->stats.branches = strtoull(fields[4], NULL, 10);
+  r->stats.mispredictions = strtoull(fields[5], NULL, 10);
+  r->replayed = strtoull(fields[6], NULL, 10);
+  r->records = strtoull(fields[7], NULL, 10);
+  r->runtime_ns = strtoull(fields[8], NULL, 10);
+  r->memory = strtoull(fields[9], NULL, 10);
+  r->budget_bits = strtoull(fields[10], NULL, 10);
+  r->name = fields[11];
+  r->params = fields[12];
+  r->config = fields[13];
+  return 1;
+}
+
+int results_merge(int n, char *const *paths)
+{
+  std::vector<result_row_t> rows;
+  std::vector<int> seen;
+  int shards = 0;
+  for (int f = 0; f < n; f++)
+  {
+    FILE *in = fopen(paths[f], "r");
+    if (!in)
+    {
+      fprintf(stderr, "Unable to open %s\n", paths[f]);
+      return 0;
+    }
+    char magic[16];
+    int version, shard, count;
+    if (fscanf(in, "%15s %d %d %d\n", magic, &version, &shard, &count) != 4 || strcmp(magic, RESULTS_MAGIC) ||
+        version != RESULTS_VERSION || shard < 0 || shard >= count || (shards && count != shards))
+    {
+      fprintf(stderr, "%s is not a result file of the same run\n", paths[f]);
+      fclose(in);
+      return 0;
+    }
+    shards = count;
+    seen.resize(shards);
+    if (seen[shard]++)
+    {
+      fprintf(stderr, "Warning: shard %d/%d given more than once, %s ignored\n", shard, shards, paths[f]);
+      fclose(in);
+      continue;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    while (getline(&line, &cap, in) > 0)
+    {
+      result_row_t r;
+      if (!results_parse_row(line, &r))
+      {
+        fprintf(stderr, "Malformed row in %s\n", paths[f]);
+        free(line);
+        fclose(in);
+        return 0;
+      }
+      rows.push_back(r);
+    }
+    free(line);
+    fclose(in);
+  }
+
+  int ok = 1, found = 0;
+  for (int s = 0; s < shards; s++)
+  {
+    if (!seen[s])
+    {
+      fprintf(stderr, "Warning: shard %d/%d is missing\n", s, shards);
+      ok = 0;
+    }
+    found += seen[s] > 0;
+  }
+
+  // Back into the order of the whole run, each trace keeping its
+  // predictors in order
+  std::stable_sort(rows.begin(), rows.end(), [](const result_row_t &a, const result_row_t &b) {
+    return a.kind != b.kind ? a.kind < b.kind : a.index < b.index;
+  });
+  if (result_format == RESULT_FORMAT_TEXT)
+  {
+    printf("Merged:          %10zu results from %d of %d shards\n", rows.size(), found, shards);
+    results_print(rows);
+  }
+  else
+  {
+    results_print_records(rows);
+  }
+  return ok;
+}
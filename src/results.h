@@ -0,0 +1,105 @@
+//========================================================//
+//  results.h                                             //
+//  Header file for run results                           //
+//                                                        //
+//  Prints the results of single runs (in JSON or CSV),   //
+//  the sweep and the runner, and saves and merges the    //
+//  partial results of runs split across machines with    //
+//  --shard=i/N                                           //
+//========================================================//
+
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "predictor.h"
+#include "replay.h"
+
+// A result file is the line "BPRESULTS <version> <shard> <shards>"
+// followed by one tab separated line per result_row_t:
+// kind index predictor status branches mispredictions replayed
+// records runtime_ns memory budget_bits name params config, where
+// status is ok, invalid, failed, over-budget or oversized
+#define RESULTS_MAGIC "BPRESULTS"
+#define RESULTS_VERSION 3
+
+#define RESULT_SWEEP 0 // one configuration point of a sweep
+#define RESULT_TRACE 1 // one predictor on one trace of the runner
+
+#define RESULT_OK 0
+#define RESULT_INVALID 1 // predictor_create rejected the point
+#define RESULT_FAILED 2  // the trace could not be opened
+#define RESULT_OVER_BUDGET 3 // the point needs more bits than the sweep allows, not replayed
+#define RESULT_OVERSIZED 4 // the point's tables are far larger than the trace fills, not replayed
+#define RESULT_STATUSES 5
+
+// Output formats of --format
+#define RESULT_FORMAT_TEXT 0 // aligned tables
+#define RESULT_FORMAT_JSON 1 // an array with one object per row
+#define RESULT_FORMAT_CSV 2  // a header line and one line per row
+
+typedef struct
+{
+  int kind;             // RESULT_SWEEP or RESULT_TRACE
+  uint64_t index;       // point or trace number in the whole run
+  int type;             // predictor type
+  int status;           // RESULT_*
+  replay_stats_t stats;
+  uint64_t replayed;    // records replayed, fewer than 'records' if stopped early
+  uint64_t records;
+  uint64_t runtime_ns;  // time spent predicting and training
+  uint64_t memory;      // bytes allocated for the predictor, see predictor_memory
+  uint64_t budget_bits; // modeled storage, see predictor_budget_bits
+  std::string name;     // trace path
+  std::string params;   // swept "key=value ..." fields
+  std::string config;   // every field of the configuration, see predictor_config_format
+  std::string fingerprint; // of the predictions in hex, see fingerprint.h, "" (null in JSON) if unknown
+} result_row_t;
+
+// Part of the work done by this process, set by --shard=i/N: sweep
+// points and traces whose index is result_shard modulo result_shards
+extern int result_shard;
+extern int result_shards;
+
+// File the rows are also written to, NULL for none
+extern const char *result_path;
+
+// RESULT_FORMAT_* of the printed rows
+extern int result_format;
+
+// Parse "<i>/<N>" into result_shard and result_shards
+//
+// Returns True if Successful
+//
+int results_parse_shard(const char *spec);
+
+// Parse "text", "json" or "csv" into result_format
+//
+// Returns True if Successful
+//
+int results_parse_format(const char *name);
+
+// Returns True if 'index' belongs to this shard
+//
+static inline int results_mine(uint64_t index)
+{
+  return index % result_shards == (uint64_t)result_shard;
+}
+
+// Print 'rows' in result_format, as tables for text, and write them
+// to result_path if set
+//
+// Returns True if Successful
+//
+int results_report(const std::vector<result_row_t> &rows);
+
+// Read the result files 'paths' and print their rows combined, in
+// result_format
+//
+// Returns True if Successful
+//
+int results_merge(int n, char *const *paths);
+
+#endif
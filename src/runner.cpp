@@ -0,0 +1,533 @@
+//========================================================//
+//  runner.cpp                                            //
+//  Source file for the multi-trace runner                //
+//                                                        //
+//  Traces are sorted by file size and claimed from a     //
+//  shared counter so the biggest ones start first and    //
+//  the run does not wait on one slow trace at the end.   //
+//  Each worker owns its reader and predictor instances.  //
+//  With lanes, a worker keeps that many traces open and  //
+//  replays their batches interleaved, claiming the next  //
+//  trace whenever one ends                               //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "archive.h"
+#include "memo.h"
+#include "numa.h"
+#include "predictor.h"
+#include "replay.h"
+#include "results.h"
+#include "runner.h"
+#include "trace.h"
+#include "traceidx.h"
+#include "tracecache.h"
+
+typedef struct
+{
+  std::string path;
+  uint64_t size;
+  int failed;
+  replay_stats_t stats[NUM_BP_TYPES];
+  uint64_t records;                  // counted records replayed
+  uint64_t runtime_ns[NUM_BP_TYPES]; // predicting and training them
+  uint64_t memory[NUM_BP_TYPES];     // predictor_memory bytes
+  int node;                          // NUMA node of its worker with --numa
+  std::string scope;                 // see memo_scope, empty when not stored
+} runner_trace_t;
+
+static std::vector<runner_trace_t> runner_traces;
+
+static void runner_push(const std::string &path, uint64_t size)
+{
+  runner_trace_t t;
+  t.path = path;
+  t.size = size;
+  t.failed = 0;
+  memset(t.stats, 0, sizeof(t.stats));
+  t.records = 0;
+  memset(t.runtime_ns, 0, sizeof(t.runtime_ns));
+  memset(t.memory, 0, sizeof(t.memory));
+  t.node = 0;
+  runner_traces.push_back(t);
+}
+
+// Returns True for the sidecar files written next to traces
+//
+static int runner_skip_name(const char *name)
+{
+  size_t n = strlen(name);
+  return name[0] == '.' || (n > 4 && !strcmp(name + n - 4, ".idx")) || (n > 5 && !strcmp(name + n - 5, ".warm"));
+}
+
+int runner_add(const char *arg)
+{
+  // An archive stands for its traces
+  std::vector<std::string> members;
+  std::vector<uint64_t> sizes;
+  if (archive_expand(arg, &members, &sizes) > 0)
+  {
+    for (size_t i = 0; i < members.size(); i++)
+    {
+      runner_push(members[i], sizes[i]);
+    }
+    return members.size();
+  }
+
+  struct stat st;
+  if (!stat(arg, &st) && S_ISDIR(st.st_mode))
+  {
+    DIR *dir = opendir(arg);
+    if (!dir)
+    {
+      return 0;
+    }
+    std::vector<std::string> names;
+    for (struct dirent *e; (e = readdir(dir));)
+    {
+      if (!runner_skip_name(e->d_name))
+      {
+        names.push_back(e->d_name);
+      }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    std::string prefix = arg;
+    if (prefix[prefix.size() - 1] != '/')
+    {
+      prefix += "/";
+    }
+    int added = 0;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+      std::string path = prefix + names[i];
+      if (!stat(path.c_str(), &st) && S_ISREG(st.st_mode))
+      {
+        runner_push(path, st.st_size);
+        added++;
+      }
+    }
+    return added;
+  }
+  if (!stat(arg, &st))
+  {
+    runner_push(arg, S_ISREG(st.st_mode) ? st.st_size : 0);
+    return 1;
+  }
+
+  // Not a file, try it as a pattern
+  glob_t g;
+  int added = 0;
+  if (glob(arg, 0, NULL, &g) == 0)
+  {
+    for (size_t i = 0; i < g.gl_pathc; i++)
+    {
+      if (!stat(g.gl_pathv[i], &st) && S_ISREG(st.st_mode) && !runner_skip_name(g.gl_pathv[i]))
+      {
+        runner_push(g.gl_pathv[i], st.st_size);
+        added++;
+      }
+    }
+  }
+  globfree(&g);
+  return added;
+}
+
+int runner_count()
+{
+  return runner_traces.size();
+}
+
+const char *runner_path(int i)
+{
+  return runner_traces[i].path.c_str();
+}
+
+// Initial image of each selected predictor, forked for every trace
+// instead of filling its tables again; NULL for plugins
+static predictor_snapshot_t *runner_images[NUM_BP_TYPES];
+
+// With --memo, fill in the results of 't' from the store
+//
+// Returns True if it holds those of every predictor, to not replay it
+//
+static int runner_memo_load(const runner_config_t *cfg, runner_trace_t *t)
+{
+  char scope[MEMO_SCOPE_LEN];
+  if (!cfg->memo || !memo_scope(t->path.c_str(), cfg->start_branch, cfg->warmup, cfg->branch_count, scope))
+  {
+    return 0;
+  }
+  t->scope = scope;
+  memo_result_t r[NUM_BP_TYPES];
+  for (int p = 0; p < cfg->num_types; p++)
+  {
+    predictor_config_t pc = predictor_default_config(cfg->types[p]);
+    if (!memo_lookup(scope, &pc, &r[p]) || r[p].records != r[0].records)
+    {
+      return 0;
+    }
+  }
+  t->records = r[0].records;
+  for (int p = 0; p < cfg->num_types; p++)
+  {
+    t->stats[p] = r[p].stats;
+    t->runtime_ns[p] = r[p].runtime_ns;
+    t->memory[p] = r[p].memory;
+  }
+  return 1;
+}
+
+// Add the results of 't', replayed, to the store
+//
+static void runner_memo_store(const runner_config_t *cfg, const runner_trace_t *t)
+{
+  for (int p = 0; p < cfg->num_types && !t->scope.empty() && !t->failed; p++)
+  {
+    predictor_config_t pc = predictor_default_config(cfg->types[p]);
+    memo_result_t r = {t->stats[p], t->records, t->runtime_ns[p], t->memory[p]};
+    if (!memo_store(t->scope.c_str(), &pc, &r))
+    {
+      fprintf(stderr, "Error: failed to write %s\n", memo_path);
+    }
+  }
+}
+
+// Replay one trace on fresh instances of every selected predictor
+//
+static void runner_replay(const runner_config_t *cfg, runner_trace_t *t)
+{
+  if (runner_memo_load(cfg, t))
+  {
+    return;
+  }
+  trace_reader_t *tr = trace_cache_open(cfg->cache_dir, t->path.c_str());
+  if (!tr)
+  {
+    t->failed = 1;
+    return;
+  }
+  trace_seek_branch(tr, t->path.c_str(), cfg->start_branch);
+
+  predictor_t *predictors[NUM_BP_TYPES];
+  for (int p = 0; p < cfg->num_types; p++)
+  {
+    predictor_config_t pc = predictor_default_config(cfg->types[p]);
+    predictors[p] = runner_images[p] ? predictor_fork(runner_images[p]) : predictor_create(&pc);
+  }
+  branch_record_t *batch = (branch_record_t *)malloc(TRACE_BATCH * sizeof(branch_record_t));
+  replay_history_t *hist = replay_history_new(predictors, cfg->num_types);
+  uint64_t left = cfg->warmup;
+  size_t n;
+  const branch_record_t *recs;
+  while (left > 0 && (n = trace_read_span(tr, batch, left < TRACE_BATCH ? left : TRACE_BATCH, &recs)) > 0)
+  {
+    left -= n;
+    replay_batch(predictors, cfg->num_types, recs, n, hist, NULL);
+  }
+  left = cfg->branch_count;
+  while (left > 0 && (n = trace_read_span(tr, batch, left < TRACE_BATCH ? left : TRACE_BATCH, &recs)) > 0)
+  {
+    left -= n;
+    t->records += n;
+    uint64_t branches = replay_count_conditional(recs, n);
+    if (hist)
+    {
+      replay_history_fill(hist, recs, n);
+    }
+    uint64_t now = trace_clock_ns();
+    for (int p = 0; p < cfg->num_types; p++)
+    {
+      const predictor_branch_t *br = replay_branches(recs);
+      t->stats[p].branches += branches;
+      t->stats[p].mispredictions += hist ? predictor_predict_shared(predictors[p], br, &hist->batch, NULL)
+                                         : predictor_predict_batch(predictors[p], br, n, NULL);
+      uint64_t then = now;
+      now = trace_clock_ns();
+      t->runtime_ns[p] += now - then;
+    }
+  }
+  free(batch);
+  free(hist);
+  for (int p = 0; p < cfg->num_types; p++)
+  {
+    t->memory[p] = predictor_memory(predictors[p]);
+    predictor_destroy(predictors[p]);
+  }
+  trace_close(tr);
+  runner_memo_store(cfg, t);
+}
+
+// A trace being replayed in one of a worker's lanes
+typedef struct
+{
+  runner_trace_t *t;
+  trace_reader_t *tr;
+  predictor_t *predictors[NUM_BP_TYPES];
+  branch_record_t *batch;
+  uint64_t left; // counted records still to replay
+} runner_lane_t;
+
+// Open trace 't' in 'lane' on fresh predictors and replay its warmup
+//
+// Returns True if Successful, False also when the --memo store holds
+// its results
+//
+static int runner_lane_open(const runner_config_t *cfg, runner_lane_t *lane, runner_trace_t *t)
+{
+  if (runner_memo_load(cfg, t))
+  {
+    return 0;
+  }
+  lane->t = t;
+  lane->tr = trace_cache_open(cfg->cache_dir, t->path.c_str());
+  if (!lane->tr)
+  {
+    t->failed = 1;
+    return 0;
+  }
+  trace_seek_branch(lane->tr, t->path.c_str(), cfg->start_branch);
+  for (int p = 0; p < cfg->num_types; p++)
+  {
+    predictor_config_t pc = predictor_default_config(cfg->types[p]);
+    lane->predictors[p] = runner_images[p] ? predictor_fork(runner_images[p]) : predictor_create(&pc);
+  }
+  lane->batch = (branch_record_t *)malloc(TRACE_BATCH * sizeof(branch_record_t));
+  uint64_t left = cfg->warmup;
+  size_t n;
+  const branch_record_t *recs;
+  while (left > 0 && (n = trace_read_span(lane->tr, lane->batch, left < TRACE_BATCH ? left : TRACE_BATCH, &recs)) > 0)
+  {
+    left -= n;
+    replay_batch(lane->predictors, cfg->num_types, recs, n, NULL, NULL);
+  }
+  lane->left = cfg->branch_count;
+  return 1;
+}
+
+static void runner_lane_close(const runner_config_t *cfg, runner_lane_t *lane)
+{
+  for (int p = 0; p < cfg->num_types; p++)
+  {
+    lane->t->memory[p] = predictor_memory(lane->predictors[p]);
+    predictor_destroy(lane->predictors[p]);
+  }
+  free(lane->batch);
+  trace_close(lane->tr);
+  runner_memo_store(cfg, lane->t);
+}
+
+// Replay the traces claimed from 'next' on this thread, cfg->lanes of
+// them at a time, a batch of each in turn through
+// predictor_predict_traces; the time of a round is split evenly
+// between the traces in it
+//
+static void runner_replay_lanes(const runner_config_t *cfg, const std::vector<runner_trace_t *> &order,
+                                std::atomic<size_t> &next, int node)
+{
+  runner_lane_t lanes[PREDICTOR_LOCKSTEP_MAX];
+  int k = 0;
+  for (;;)
+  {
+    for (size_t i; k < cfg->lanes && (i = next.fetch_add(1)) < order.size();)
+    {
+      order[i]->node = node;
+      k += runner_lane_open(cfg, &lanes[k], order[i]);
+    }
+    if (!k)
+    {
+      break;
+    }
+
+    // a trace that ends gives its lane to the last one
+    size_t n[PREDICTOR_LOCKSTEP_MAX];
+    const predictor_branch_t *br[PREDICTOR_LOCKSTEP_MAX];
+    for (int j = 0; j < k; j++)
+    {
+      runner_lane_t *lane = &lanes[j];
+      const branch_record_t *recs = NULL;
+      n[j] = lane->left ? trace_read_span(lane->tr, lane->batch, lane->left < TRACE_BATCH ? lane->left : TRACE_BATCH,
+                                          &recs)
+                        : 0;
+      if (!n[j])
+      {
+        runner_lane_close(cfg, lane);
+        lanes[j--] = lanes[--k];
+        continue;
+      }
+      lane->left -= n[j];
+      lane->t->records += n[j];
+      br[j] = replay_branches(recs);
+      uint64_t branches = replay_count_conditional(recs, n[j]);
+      for (int p = 0; p < cfg->num_types; p++)
+      {
+        lane->t->stats[p].branches += branches;
+      }
+    }
+    uint64_t now = trace_clock_ns();
+    for (int p = 0; p < cfg->num_types && k; p++)
+    {
+      predictor_t *ps[PREDICTOR_LOCKSTEP_MAX];
+      uint64_t misses[PREDICTOR_LOCKSTEP_MAX] = {0};
+      for (int j = 0; j < k; j++)
+      {
+        ps[j] = lanes[j].predictors[p];
+      }
+      if (!predictor_predict_traces(ps, k, br, n, misses))
+      {
+        for (int j = 0; j < k; j++)
+        {
+          misses[j] = predictor_predict_batch(ps[j], br[j], n[j], NULL);
+        }
+      }
+      uint64_t then = now;
+      now = trace_clock_ns();
+      for (int j = 0; j < k; j++)
+      {
+        lanes[j].t->stats[p].mispredictions += misses[j];
+        lanes[j].t->runtime_ns[p] += (now - then) / k;
+      }
+    }
+  }
+}
+
+int runner_run(const runner_config_t *cfg)
+{
+  // The traces of this shard, largest first, the heaviest traces
+  // bound the run time
+  std::vector<runner_trace_t *> order;
+  for (size_t i = 0; i < runner_traces.size(); i++)
+  {
+    if (results_mine(i))
+    {
+      order.push_back(&runner_traces[i]);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [](const runner_trace_t *a, const runner_trace_t *b) { return a->size > b->size; });
+
+  int jobs = cfg->jobs > 0 ? cfg->jobs : (int)std::thread::hardware_concurrency();
+  int lanes = cfg->lanes > 1 ? cfg->lanes : 1;
+  if (jobs > ((int)order.size() + lanes - 1) / lanes)
+  {
+    jobs = (order.size() + lanes - 1) / lanes;
+  }
+  if (jobs < 1)
+  {
+    jobs = 1;
+  }
+
+  for (int p = 0; p < cfg->num_types; p++)
+  {
+    predictor_config_t pc = predictor_default_config(cfg->types[p]);
+    predictor_t *fresh = predictor_create(&pc);
+    runner_images[p] = fresh ? predictor_snapshot(fresh) : NULL;
+    predictor_destroy(fresh);
+  }
+
+  // With --numa each worker is pinned before it creates any predictor
+  // or reads a trace, so their memory is on its node
+  int nodes = numa_enabled ? numa_init() : 1;
+  std::vector<uint64_t> node_done(nodes, 0);
+  std::mutex node_lock;
+  uint64_t start_ns = trace_clock_ns();
+
+  std::atomic<size_t> next(0);
+  auto worker = [&](int w) {
+    int node = 0, cpu;
+    if (numa_enabled)
+    {
+      node = numa_place(w, &cpu);
+      numa_pin(cpu, node);
+    }
+    if (cfg->lanes > 1)
+    {
+      runner_replay_lanes(cfg, order, next, node);
+    }
+    else
+    {
+      for (size_t i; (i = next.fetch_add(1)) < order.size();)
+      {
+        order[i]->node = node;
+        runner_replay(cfg, order[i]);
+      }
+    }
+    std::lock_guard<std::mutex> lock(node_lock);
+    node_done[node] = trace_clock_ns() - start_ns;
+  };
+  std::vector<std::thread> threads;
+  for (int t = 1; t < jobs; t++)
+  {
+    threads.push_back(std::thread(worker, t));
+  }
+  worker(0);
+  for (size_t t = 0; t < threads.size(); t++)
+  {
+    threads[t].join();
+  }
+  for (int p = 0; p < cfg->num_types; p++)
+  {
+    predictor_snapshot_free(runner_images[p]);
+    runner_images[p] = NULL;
+  }
+
+  if (numa_enabled && result_format == RESULT_FORMAT_TEXT)
+  {
+    std::vector<int> node_workers(nodes, 0);
+    std::vector<uint64_t> node_records(nodes, 0);
+    for (int w = 0; w < jobs; w++)
+    {
+      int cpu;
+      node_workers[numa_place(w, &cpu)]++;
+    }
+    for (size_t i = 0; i < order.size(); i++)
+    {
+      node_records[order[i]->node] += order[i]->records * cfg->num_types;
+    }
+    numa_report(stdout, node_workers.data(), node_records.data(), node_done.data());
+  }
+
+  // One row per trace and predictor in the order given
+  int ok = 1;
+  std::vector<result_row_t> rows;
+  for (size_t i = 0; i < runner_traces.size(); i++)
+  {
+    const runner_trace_t *t = &runner_traces[i];
+    if (!results_mine(i))
+    {
+      continue;
+    }
+    ok = ok && !t->failed;
+    for (int p = 0; p < cfg->num_types; p++)
+    {
+      result_row_t r;
+      r.kind = RESULT_TRACE;
+      r.index = i;
+      r.type = cfg->types[p];
+      r.status = t->failed ? RESULT_FAILED : RESULT_OK;
+      r.stats = t->stats[p];
+      r.replayed = r.records = t->records;
+      r.runtime_ns = t->runtime_ns[p];
+      r.memory = t->memory[p];
+      r.name = t->path;
+      predictor_config_t pc = predictor_default_config(cfg->types[p]);
+      r.budget_bits = predictor_budget_bits(&pc);
+      char config[256];
+      predictor_config_format(&pc, config, sizeof(config));
+      r.config = config;
+      rows.push_back(r);
+    }
+  }
+  return results_report(rows) && ok;
+}
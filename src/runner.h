@@ -0,0 +1,53 @@
+//========================================================//
+//  runner.h                                              //
+//  Header file for the multi-trace runner                //
+//                                                        //
+//  Replays the selected predictors over many traces on   //
+//  worker threads and prints per-trace and aggregate     //
+//  results                                               //
+//========================================================//
+
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include <stdint.h>
+
+// Most worker threads --jobs takes, for traces or sweep points
+#define RUNNER_JOBS_MAX 1024
+
+typedef struct
+{
+  const int *types;       // predictor types to replay
+  int num_types;
+  uint64_t start_branch;  // replay window of every trace
+  uint64_t branch_count;
+  int jobs;               // worker threads, 0 for one per core
+  const char *cache_dir;  // see tracecache.h, NULL or "" for none
+  uint64_t warmup;        // records replayed before branch_count, not counted
+  int lanes;              // traces a worker replays interleaved, see predictor_predict_traces
+  int memo;               // take and add results in the memo_path store, see memo.h
+} runner_config_t;
+
+// Add the trace files named by 'arg' to the run: a file, every file
+// of a directory, or a glob pattern
+//
+// Returns the number of traces added
+//
+int runner_add(const char *arg);
+
+// Number of traces added so far
+//
+int runner_count();
+
+// Path of trace 'i'
+//
+const char *runner_path(int i);
+
+// Replay every trace, or those of this --shard (see results.h),
+// largest first, and print the results
+//
+// Returns True if every trace could be opened
+//
+int runner_run(const runner_config_t *cfg);
+
+#endif
@@ -0,0 +1,282 @@
+//========================================================//
+//  sample.cpp                                            //
+//  Source file for sampled simulation                    //
+//                                                        //
+//  Window k measures branches [first + k * period,       //
+//  first + k * period + measure). The gaps are either    //
+//  replayed without counting (functional warming) or     //
+//  skipped with trace_seek / the index, replaying only   //
+//  gap_warmup branches before each window.               //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sample.h"
+#include "replay.h"
+#include "traceidx.h"
+#include "icount.h"
+
+int sample_parse(const char *spec, sample_config_t *cfg)
+{
+  char *end;
+  if (!strncmp(spec, "breaks", 6))
+  {
+    cfg->breaks = 1;
+    cfg->break_warmup = SAMPLE_BREAK_WARMUP;
+    if (spec[6] == ':')
+    {
+      cfg->break_warmup = strtoull(spec + 7, &end, 0);
+      return end != spec + 7 && !*end;
+    }
+    return !spec[6];
+  }
+  uint64_t measure = strtoull(spec, &end, 0);
+  if (end == spec || *end != '/')
+  {
+    return 0;
+  }
+  const char *p = end + 1;
+  uint64_t period = strtoull(p, &end, 0);
+  if (end == p || *end || measure == 0 || period < measure)
+  {
+    return 0;
+  }
+  cfg->measure = measure;
+  cfg->period = period;
+  return 1;
+}
+
+// Replay up to 'count' branches of 'tr' on the predictors, counting
+// them in st[] unless 'st' is NULL, sharing the history 'h' if not NULL
+//
+// Returns the number of branches replayed
+//
+static uint64_t sample_replay(trace_reader_t *tr, predictor_t *const *predictors, int n, uint64_t count,
+                              replay_stats_t *st, branch_record_t *batch, replay_history_t *h)
+{
+  uint64_t done = 0;
+  size_t got;
+  const branch_record_t *recs;
+  while (done < count &&
+         (got = trace_read_span(tr, batch, count - done < TRACE_BATCH ? count - done : TRACE_BATCH, &recs)) > 0)
+  {
+    replay_batch(predictors, n, recs, got, h, st);
+    done += got;
+  }
+  return done;
+}
+
+// Move 'tr' forward from branch 'pos' to branch 'target'
+//
+static void sample_skip(trace_reader_t *tr, const trace_index_t *idx, uint64_t pos, uint64_t target)
+{
+  if (trace_seek(tr, target))
+  {
+    return;
+  }
+  if (idx && target - pos >= idx->hdr.interval && trace_index_seek(tr, idx, target))
+  {
+    return;
+  }
+  trace_skip(tr, target - pos);
+}
+
+// Per predictor totals and the running mean and variance of the
+// window rates
+typedef struct
+{
+  replay_stats_t total[NUM_BP_TYPES];
+  replay_monitor_t monitor[NUM_BP_TYPES];
+  uint64_t windows;
+} sample_totals_t;
+
+static void sample_add_window(sample_totals_t *t, const replay_stats_t *st, int n)
+{
+  if (st[0].branches == 0)
+  {
+    return;
+  }
+  t->windows++;
+  for (int p = 0; p < n; p++)
+  {
+    replay_monitor_add(&t->monitor[p], replay_rate(&st[p]));
+    t->total[p].branches += st[p].branches;
+    t->total[p].mispredictions += st[p].mispredictions;
+  }
+}
+
+// Replay the records of 'tr' from 'pos' to 'end', each stretch between
+// two TRACE_F_BREAK records a window whose first cfg->break_warmup
+// branches only train. The break records themselves are not replayed
+//
+static void sample_breaks(trace_reader_t *tr, uint64_t pos, uint64_t end, predictor_t *const *predictors, int n,
+                          const sample_config_t *cfg, sample_totals_t *t, branch_record_t *batch,
+                          replay_history_t *hist)
+{
+  replay_stats_t st[NUM_BP_TYPES];
+  memset(st, 0, sizeof(st));
+  uint64_t in_window = 0;
+  size_t got;
+  const branch_record_t *recs;
+  while (pos < end && (got = trace_read_span(tr, batch, end - pos < TRACE_BATCH ? end - pos : TRACE_BATCH, &recs)) > 0)
+  {
+    pos += got;
+    for (size_t i = 0; i < got;)
+    {
+      if (recs[i].flags & TRACE_F_BREAK)
+      {
+        sample_add_window(t, st, n);
+        memset(st, 0, sizeof(st));
+        in_window = 0;
+        i++;
+        continue;
+      }
+      size_t j = i;
+      while (j < got && !(recs[j].flags & TRACE_F_BREAK))
+      {
+        j++;
+      }
+      if (in_window < cfg->break_warmup)
+      {
+        size_t w = j - i < cfg->break_warmup - in_window ? j - i : cfg->break_warmup - in_window;
+        replay_batch(predictors, n, recs + i, w, hist, NULL);
+        in_window += w;
+        i += w;
+      }
+      if (i < j)
+      {
+        replay_batch(predictors, n, recs + i, j - i, hist, st);
+        in_window += j - i;
+        i = j;
+      }
+    }
+  }
+  sample_add_window(t, st, n);
+}
+
+void sample_run(trace_reader_t *tr, const char *path, uint64_t start, uint64_t count,
+                predictor_t *const *predictors, const int *types, int n, const sample_config_t *cfg)
+{
+  branch_record_t *batch = (branch_record_t *)malloc(TRACE_BATCH * sizeof(branch_record_t));
+  replay_history_t *hist = replay_history_new(predictors, n);
+  trace_index_t *idx = NULL;
+  if (cfg->skip && tr->format == TRACE_FMT_TEXT && path && strcmp(path, "-"))
+  {
+    idx = trace_index_load(path);
+    if (!idx)
+    {
+      idx = trace_index_build(path, TRACE_INDEX_INTERVAL);
+    }
+  }
+
+  uint64_t end = count < ~0ULL - start ? start + count : ~0ULL;
+  uint64_t pos = start;
+  pos += sample_replay(tr, predictors, n, cfg->warmup < end - pos ? cfg->warmup : end - pos, NULL, batch, hist);
+
+  // With the trace's instruction counts each window's misses per
+  // instruction stand for its whole period, weighted by the period's
+  // instructions, which the sidecar has for the records not replayed too
+  icount_t *icount = icount_open(path);
+  double weighted[NUM_BP_TYPES] = {0};
+  uint64_t period_instructions = 0;
+  if (icount)
+  {
+    icount_read(icount, NULL, pos);
+  }
+
+  sample_totals_t totals;
+  memset(&totals, 0, sizeof(totals));
+  if (cfg->breaks)
+  {
+    icount_close(icount);
+    icount = NULL;
+    sample_breaks(tr, pos, end, predictors, n, cfg, &totals, batch, hist);
+  }
+
+  for (uint64_t w = pos; w < end && !cfg->breaks; w += cfg->period)
+  {
+    if (pos < w)
+    {
+      uint64_t from = pos;
+      if (cfg->skip)
+      {
+        from = w - pos > cfg->gap_warmup ? w - cfg->gap_warmup : pos;
+        if (from > pos)
+        {
+          sample_skip(tr, idx, pos, from);
+        }
+      }
+      pos = from + sample_replay(tr, predictors, n, w - from, NULL, batch, hist);
+      if (pos < w)
+      {
+        break;
+      }
+    }
+
+    replay_stats_t st[NUM_BP_TYPES];
+    memset(st, 0, sizeof(st));
+    uint64_t want = cfg->measure < end - w ? cfg->measure : end - w;
+    uint64_t got = sample_replay(tr, predictors, n, want, st, batch, hist);
+    pos += got;
+    uint64_t window_instructions = icount ? icount_read(icount, NULL, got) : 0;
+    if (icount && icount_short(icount))
+    {
+      fprintf(stderr, "Warning: the instruction counts of %s end before its records, they are not reported\n", path);
+      icount_close(icount);
+      icount = NULL;
+    }
+    if (icount)
+    {
+      uint64_t rest = end - w > cfg->period ? cfg->period - got : end - w - got;
+      uint64_t instructions = window_instructions + (got < want ? 0 : icount_read(icount, NULL, rest));
+      for (int p = 0; p < n && window_instructions; p++)
+      {
+        weighted[p] += (double)st[p].mispredictions * instructions / window_instructions;
+      }
+      period_instructions += window_instructions ? instructions : 0;
+    }
+    sample_add_window(&totals, st, n);
+    if (got < want || w > ~0ULL - cfg->period)
+    {
+      break;
+    }
+  }
+
+  // Print the estimates, one block per predictor as in main
+  const replay_stats_t *total = totals.total;
+  if (cfg->breaks)
+  {
+    printf("Sampled:         %10llu windows between breaks, after %llu branches each\n",
+           (unsigned long long)totals.windows, (unsigned long long)cfg->break_warmup);
+  }
+  else
+  {
+    printf("Sampled:         %10llu windows of %llu every %llu branches\n", (unsigned long long)totals.windows,
+           (unsigned long long)cfg->measure, (unsigned long long)cfg->period);
+  }
+  for (int p = 0; p < n; p++)
+  {
+    if (n > 1)
+    {
+      printf("%s:\n", bpName[types[p]]);
+    }
+    printf("Branches:        %10llu\n", (unsigned long long)total[p].branches);
+    printf("Incorrect:       %10llu\n", (unsigned long long)total[p].mispredictions);
+    printf("Misprediction Rate: %7.3f\n", total[p].branches ? replay_rate(&total[p]) : 0.0);
+    if (totals.windows > 1)
+    {
+      printf("95%% Interval:    +- %7.3f\n", replay_monitor_interval(&totals.monitor[p]));
+    }
+    if (icount)
+    {
+      printf("Instructions:    %10llu\n", (unsigned long long)period_instructions);
+      printf("Misses per KInst:   %7.3f\n", period_instructions ? 1000.0 * weighted[p] / period_instructions : 0.0);
+    }
+  }
+
+  icount_close(icount);
+  trace_index_free(idx);
+  free(batch);
+  free(hist);
+}
@@ -0,0 +1,44 @@
+//========================================================//
+//  sample.h                                              //
+//  Header file for sampled simulation                    //
+//                                                        //
+//  Measures periodic windows of a trace, or the samples  //
+//  between its break records, and estimates the          //
+//  misprediction rate with a confidence interval,        //
+//  training on or skipping the branches in between       //
+//========================================================//
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+#include "predictor.h"
+#include "trace.h"
+
+typedef struct
+{
+  uint64_t measure;     // branches measured per window
+  uint64_t period;      // branches from one window start to the next
+  int skip;             // skip the gaps instead of training on them
+  uint64_t gap_warmup;  // with skip, branches trained before each window
+  uint64_t warmup;      // branches trained before the first window
+  int breaks;           // the windows are the stretches between TRACE_F_BREAK records
+  uint64_t break_warmup; // with breaks, branches trained at the start of each
+} sample_config_t;
+
+#define SAMPLE_BREAK_WARMUP 16
+
+// Parse "<measure>/<period>" or "breaks[:<warmup>]" into 'cfg'
+//
+// Returns True if Successful
+//
+int sample_parse(const char *spec, sample_config_t *cfg);
+
+// Replay windows of 'tr', opened from 'path' and positioned at branch
+// 'start', on the 'n' predictors, covering at most 'count' branches,
+// and print the estimated rate of each with its 95% interval
+//
+void sample_run(trace_reader_t *tr, const char *path, uint64_t start, uint64_t count,
+                predictor_t *const *predictors, const int *types, int n, const sample_config_t *cfg);
+
+#endif
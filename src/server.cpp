@@ -0,0 +1,404 @@
+//========================================================//
+//  server.cpp                                            //
+//  Source file for the simulation server                 //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "server.h"
+#include "predictor.h"
+#include "replay.h"
+#include "tracecache.h"
+#include "memo.h"
+
+// A trace decoded on first use and kept until the server exits
+typedef struct
+{
+  std::once_flag once;
+  trace_reader_t *tr;
+  const branch_record_t *recs;
+  branch_record_t *owned; // decoded records, NULL when mapped
+  size_t n;
+} server_trace_t;
+
+// A client, closed once its reader and all its jobs are done
+struct server_conn_t
+{
+  int fd;
+  std::mutex write_lock;
+  ~server_conn_t()
+  {
+    close(fd);
+  }
+};
+
+typedef struct
+{
+  std::shared_ptr<server_conn_t> conn;
+  std::string line;
+} server_job_t;
+
+static const server_config_t *server_cfg;
+static std::mutex server_traces_lock;
+static std::map<std::string, std::unique_ptr<server_trace_t> > server_traces;
+static std::mutex server_queue_lock;
+static std::condition_variable server_queue_ready;
+static std::deque<server_job_t> server_queue;
+
+// The resident records of 'path', opening it the first time
+//
+// Returns NULL if the trace can not be opened
+//
+static const server_trace_t *server_trace(const std::string &path)
+{
+  server_trace_t *t;
+  {
+    std::lock_guard<std::mutex> lock(server_traces_lock);
+    std::unique_ptr<server_trace_t> &slot = server_traces[path];
+    if (!slot)
+    {
+      slot.reset(new server_trace_t());
+    }
+    t = slot.get();
+  }
+  std::call_once(t->once, [&]() {
+    t->tr = trace_cache_open(server_cfg->cache_dir, path.c_str());
+    if (t->tr)
+    {
+      t->n = replay_load(t->tr, ~0ULL, &t->recs, &t->owned);
+    }
+  });
+  return t->tr ? t : NULL;
+}
+
+// Append 's' to 'out' as a JSON string
+static void server_json_string(std::string *out, const std::string &s)
+{
+  *out += '"';
+  for (size_t i = 0; i < s.size(); i++)
+  {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\')
+    {
+      *out += '\\';
+      *out += c;
+    }
+    else if (c < 0x20)
+    {
+      char esc[8];
+      snprintf(esc, sizeof(esc), "\\u%04x", c);
+      *out += esc;
+    }
+    else
+    {
+      *out += c;
+    }
+  }
+  *out += '"';
+}
+
+// Append the job id 'id' to 'out', null when there is none
+static void server_json_id(std::string *out, const std::string &id)
+{
+  if (id.empty())
+  {
+    *out += "null";
+  }
+  else
+  {
+    server_json_string(out, id);
+  }
+}
+
+// The result line of a job that failed with 'error'
+static std::string server_error(const std::string &id, const char *error)
+{
+  std::string out = "{\"id\": ";
+  server_json_id(&out, id);
+  out += ", \"status\": \"error\", \"error\": ";
+  server_json_string(&out, error);
+  return out + "}\n";
+}
+
+// Parse the count 's' into 'v'
+//
+// Returns True if Successful
+//
+static int server_count(const std::string &s, uint64_t *v)
+{
+  char *end;
+  *v = strtoull(s.c_str(), &end, 0);
+  return !s.empty() && !*end && s[0] != '-';
+}
+
+// The space separated tokens of 'line'
+static std::vector<std::string> server_tokens(const std::string &line)
+{
+  std::vector<std::string> tokens;
+  size_t pos = 0;
+  while (pos < line.size())
+  {
+    size_t end = line.find(' ', pos);
+    end = end == std::string::npos ? line.size() : end;
+    if (end > pos)
+    {
+      tokens.push_back(line.substr(pos, end - pos));
+    }
+    pos = end + 1;
+  }
+  return tokens;
+}
+
+// The value of the first id= of 'tokens', empty when there is none
+static std::string server_id(const std::vector<std::string> &tokens)
+{
+  for (size_t i = 0; i < tokens.size(); i++)
+  {
+    if (!tokens[i].compare(0, 3, "id="))
+    {
+      return tokens[i].substr(3);
+    }
+  }
+  return "";
+}
+
+// Run the job of 'line'
+//
+// Returns its result line
+//
+static std::string server_job(const std::string &line)
+{
+  // the id first, so a job that fails on a field before it still
+  // gets its answer matched up
+  std::vector<std::string> tokens = server_tokens(line);
+  std::string id = server_id(tokens), path;
+  int type = -1;
+  uint64_t start = 0, warmup = 0, count = ~0ULL;
+  std::vector<std::pair<std::string, std::string> > fields;
+  for (size_t i = 0; i < tokens.size(); i++)
+  {
+    const std::string &tok = tokens[i];
+    size_t eq = tok.find('=');
+    if (eq == std::string::npos)
+    {
+      return server_error(id, ("not key=value: " + tok).c_str());
+    }
+    std::string key = tok.substr(0, eq), value = tok.substr(eq + 1);
+    int ok = 1;
+    if (key == "id")
+    {
+      continue;
+    }
+    else if (key == "trace")
+    {
+      path = value;
+    }
+    else if (key == "predictor")
+    {
+      ok = (type = predictor_type_by_name(value.c_str())) >= 0;
+    }
+    else if (key == "start" || key == "warmup" || key == "count")
+    {
+      ok = server_count(value, key == "start" ? &start : key == "warmup" ? &warmup : &count);
+    }
+    else
+    {
+      fields.push_back(std::make_pair(key, value));
+    }
+    if (!ok)
+    {
+      return server_error(id, ("bad " + key + ": " + value).c_str());
+    }
+  }
+  if (path.empty() || type < 0)
+  {
+    return server_error(id, "a job needs trace= and predictor=");
+  }
+  predictor_config_t cfg = predictor_default_config(type);
+  for (size_t f = 0; f < fields.size(); f++)
+  {
+    char *end;
+    long v = strtol(fields[f].second.c_str(), &end, 0);
+    if (fields[f].second.empty() || *end || !predictor_config_set(&cfg, fields[f].first.c_str(), (int)v))
+    {
+      return server_error(id, ("bad field " + fields[f].first + "=" + fields[f].second).c_str());
+    }
+  }
+
+  const server_trace_t *t = server_trace(path);
+  memo_result_t r;
+  memset(&r, 0, sizeof(r));
+  int memoized = 0;
+  if (!t)
+  {
+    return server_error(id, ("unable to open trace " + path).c_str());
+  }
+  size_t lo = start < t->n ? start : t->n;
+  size_t warm = warmup < t->n - lo ? warmup : t->n - lo;
+  size_t n = count < t->n - lo - warm ? count : t->n - lo - warm;
+  char scope[MEMO_SCOPE_LEN];
+  int memo = memo_path && memo_scope(path.c_str(), start, warmup, count, scope);
+  if (memo && memo_lookup(scope, &cfg, &r) && r.records == n)
+  {
+    memoized = 1;
+  }
+  else
+  {
+    predictor_t *p = predictor_create(&cfg);
+    if (!p)
+    {
+      return server_error(id, "invalid configuration");
+    }
+    uint64_t t0 = trace_clock_ns();
+    replay_warmup(p, t->recs + lo, warm);
+    replay_stats_t st = {0, 0};
+    replay_records(p, t->recs + lo + warm, n, &st);
+    r.stats = st;
+    r.records = n;
+    r.runtime_ns = trace_clock_ns() - t0;
+    r.memory = predictor_memory(p);
+    predictor_destroy(p);
+    if (memo && !memo_store(scope, &cfg, &r))
+    {
+      fprintf(stderr, "Error: failed to write %s\n", memo_path);
+    }
+  }
+
+  char config[1024], nums[512];
+  predictor_config_format(&cfg, config, sizeof(config));
+  std::string out = "{\"id\": ";
+  server_json_id(&out, id);
+  out += ", \"trace\": ";
+  server_json_string(&out, path);
+  out += ", \"predictor\": \"";
+  out += bpName[type];
+  out += "\", \"configuration\": ";
+  server_json_string(&out, config);
+  snprintf(nums, sizeof(nums),
+           ", \"branches\": %llu, \"mispredictions\": %llu, \"mpki\": %.3f, \"runtime_s\": %.6f, "
+           "\"branches_per_sec\": %.0f, \"memory_bytes\": %llu, \"budget_bits\": %llu, \"records\": %llu, "
+           "\"memoized\": %d, \"status\": \"ok\"}\n",
+           (unsigned long long)r.stats.branches, (unsigned long long)r.stats.mispredictions,
+           r.stats.branches ? replay_rate(&r.stats) : 0.0, r.runtime_ns / 1e9,
+           r.runtime_ns ? r.records * 1e9 / r.runtime_ns : 0.0, (unsigned long long)r.memory,
+           (unsigned long long)predictor_budget_bits(&cfg), (unsigned long long)r.records, memoized);
+  return out + nums;
+}
+
+// Send all of 'out' to 'conn', dropping it if the client went away
+static void server_send(server_conn_t *conn, const std::string &out)
+{
+  std::lock_guard<std::mutex> lock(conn->write_lock);
+  for (size_t sent = 0; sent < out.size();)
+  {
+    ssize_t k = send(conn->fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+    if (k <= 0)
+    {
+      return;
+    }
+    sent += k;
+  }
+}
+
+static void server_worker()
+{
+  for (;;)
+  {
+    server_job_t job;
+    {
+      std::unique_lock<std::mutex> lock(server_queue_lock);
+      server_queue_ready.wait(lock, [] { return !server_queue.empty(); });
+      job = server_queue.front();
+      server_queue.pop_front();
+    }
+    server_send(job.conn.get(), server_job(job.line));
+  }
+}
+
+// Queue every line the client sends until it closes its side
+static void server_read(std::shared_ptr<server_conn_t> conn)
+{
+  std::string pending;
+  char buf[SERVER_LINE_MAX];
+  ssize_t k;
+  while ((k = read(conn->fd, buf, sizeof(buf))) > 0)
+  {
+    pending.append(buf, k);
+    size_t nl;
+    while ((nl = pending.find('\n')) != std::string::npos)
+    {
+      std::string line = pending.substr(0, nl);
+      pending.erase(0, nl + 1);
+      if (!line.empty() && line[line.size() - 1] == '\r')
+      {
+        line.erase(line.size() - 1);
+      }
+      if (line.empty())
+      {
+        continue;
+      }
+      std::lock_guard<std::mutex> lock(server_queue_lock);
+      server_queue.push_back({conn, line});
+      server_queue_ready.notify_one();
+    }
+    if (pending.size() > SERVER_LINE_MAX)
+    {
+      // the id of the tokens received whole, if it came early
+      size_t whole = pending.rfind(' ');
+      std::string id = whole == std::string::npos ? "" : server_id(server_tokens(pending.substr(0, whole)));
+      server_send(conn.get(), server_error(id, "line too long"));
+      return;
+    }
+  }
+}
+
+int server_run(const server_config_t *cfg)
+{
+  server_cfg = cfg;
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(cfg->socket_path) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "Socket path %s is too long\n", cfg->socket_path);
+    return 0;
+  }
+  strcpy(addr.sun_path, cfg->socket_path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(cfg->socket_path);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, SERVER_BACKLOG))
+  {
+    fprintf(stderr, "Unable to listen on %s\n", cfg->socket_path);
+    return 0;
+  }
+
+  int jobs = cfg->jobs > 0 ? cfg->jobs : std::thread::hardware_concurrency();
+  for (int w = 0; w < (jobs > 0 ? jobs : 1); w++)
+  {
+    std::thread(server_worker).detach();
+  }
+  fprintf(stderr, "Serving on %s with %d workers\n", cfg->socket_path, jobs > 0 ? jobs : 1);
+  for (;;)
+  {
+    int client = accept(fd, NULL, NULL);
+    if (client < 0)
+    {
+      continue;
+    }
+    std::shared_ptr<server_conn_t> conn(new server_conn_t());
+    conn->fd = client;
+    std::thread(server_read, conn).detach();
+  }
+}
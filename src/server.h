@@ -0,0 +1,44 @@
+//========================================================//
+//  server.h                                              //
+//  Header file for the simulation server                 //
+//                                                        //
+//  --serve=<socket> keeps running and takes jobs over a  //
+//  Unix socket, one line each: a trace, a predictor, its //
+//  configuration and a window. Traces are opened and     //
+//  decoded once and kept resident, mapped or in memory,  //
+//  the jobs of every connection share one worker pool,   //
+//  and each result is sent back as a line of JSON        //
+//========================================================//
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+// A job is a line of space separated key=value pairs
+//  trace=<path>        the trace, without spaces, required
+//  predictor=<type>    a name of predictor_type_by_name, required
+//  start=<n> warmup=<n> count=<n>  the window, as the options
+//  id=<token>          echoed in the result to match it up, even
+//                      when the job fails
+// and any field of predictor_config_set. The result is a JSON object
+// with the keys of --format=json and "id", or "id", "status" of
+// "error" and "error"
+#define SERVER_LINE_MAX 4096
+#define SERVER_BACKLOG 64
+
+typedef struct
+{
+  const char *socket_path;
+  int jobs;              // worker threads, 0 for one per core
+  const char *cache_dir; // see tracecache.h, NULL or "" for none
+} server_config_t;
+
+// Listen on cfg->socket_path, replacing a stale socket there, and
+// answer jobs until the process is stopped
+//
+// Returns False if the socket can not be set up
+//
+int server_run(const server_config_t *cfg);
+
+#endif
@@ -0,0 +1,342 @@
+//========================================================//
+//  shard.cpp                                             //
+//  Source file for sharded single-trace replay           //
+//                                                        //
+//  Shard k counts branches [from_k, from_(k+1)) after    //
+//  training on the 'overlap' branches before from_k. The //
+//  last L of those are also counted on the side, as is   //
+//  the end of the previous shard, which saw the same     //
+//  branches with a longer history: their difference      //
+//  estimates what the cold start costs.                  //
+//                                                        //
+//  With cfg->exact each shard also saves its state where //
+//  it starts counting and where it ends. A shard whose   //
+//  warmup brought it to the state the previous one ends  //
+//  in predicts exactly as a single replay would; any     //
+//  other is replayed again from that state, in order.    //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "shard.h"
+#include "predictor.h"
+#include "replay.h"
+#include "traceidx.h"
+#include "tracecache.h"
+
+typedef struct
+{
+  uint64_t warm_from;                 // first branch trained on
+  uint64_t from;                      // first branch counted
+  uint64_t to;                        // branch after the last counted
+  replay_stats_t st[NUM_BP_TYPES];    // branches [from, to)
+  replay_stats_t lead[NUM_BP_TYPES];  // the last L warmup branches
+  replay_stats_t tail[NUM_BP_TYPES];  // the last L counted branches
+  uint8_t *start[NUM_BP_TYPES];       // state at 'from', with cfg->exact
+  uint8_t *end[NUM_BP_TYPES];         // state at 'to'
+  uint64_t start_hash[NUM_BP_TYPES];
+  uint64_t end_hash[NUM_BP_TYPES];
+  size_t state_len[NUM_BP_TYPES];     // of 'start'
+  size_t end_len[NUM_BP_TYPES];       // of 'end', unbounded tables having grown
+  int ok;
+} shard_t;
+
+// FNV-1a over the words of a saved state, so most boundaries that
+// differ are told apart without a second pass over both states
+//
+static uint64_t shard_state_hash(const uint8_t *state, size_t len)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8)
+  {
+    uint64_t w;
+    memcpy(&w, state + i, 8);
+    h = (h ^ w) * 0x100000001b3ULL;
+  }
+  for (; i < len; i++)
+  {
+    h = (h ^ state[i]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// Save the state of 'p' into a new buffer and hash it
+//
+// Returns NULL if out of memory
+//
+static uint8_t *shard_save(predictor_t *p, uint64_t *hash, size_t *len_out)
+{
+  size_t len = *len_out = predictor_state_size(p);
+  uint8_t *state = (uint8_t *)malloc(len ? len : 1);
+  if (state)
+  {
+    predictor_save_state(p, state);
+    *hash = shard_state_hash(state, len);
+  }
+  return state;
+}
+
+// Number of branches in the trace 'tr' opened from 'path', building
+// the index of text traces so the shards can seek
+//
+// Returns ~0 if it can not be known without reading the trace
+//
+static uint64_t shard_trace_length(trace_reader_t *tr, const char *path)
+{
+  if (tr->frames)
+  {
+    return tr->frame_hdr.num_records;
+  }
+  if (tr->num_records != ~0ULL)
+  {
+    return tr->num_records;
+  }
+  if (tr->format == TRACE_FMT_BIN && trace_mapped(tr))
+  {
+    return (tr->len - tr->data_offset) / tr->record_size;
+  }
+  if (tr->format == TRACE_FMT_TEXT)
+  {
+    trace_index_t *idx = trace_index_load(path);
+    if (!idx)
+    {
+      idx = trace_index_build(path, TRACE_INDEX_INTERVAL);
+    }
+    uint64_t n = idx ? idx->hdr.num_records : ~0ULL;
+    trace_index_free(idx);
+    return n;
+  }
+  return ~0ULL;
+}
+
+// Replay the next 'count' branches of 'tr', counting them in st[]
+// unless 'st' is NULL, sharing the history 'h' if not NULL
+//
+// Returns the number of branches replayed
+//
+static uint64_t shard_replay(trace_reader_t *tr, predictor_t *const *predictors, int n, uint64_t count,
+                             replay_stats_t *st, branch_record_t *batch, replay_history_t *h)
+{
+  uint64_t done = 0;
+  size_t got;
+  const branch_record_t *recs;
+  while (done < count &&
+         (got = trace_read_span(tr, batch, count - done < TRACE_BATCH ? count - done : TRACE_BATCH, &recs)) > 0)
+  {
+    replay_batch(predictors, n, recs, got, h, st);
+    done += got;
+  }
+  return done;
+}
+
+// Replay one shard on its own reader and predictors, with 'side'
+// branches counted separately at both ends
+//
+static void shard_replay_one(const shard_config_t *cfg, shard_t *sh, uint64_t side)
+{
+  trace_reader_t *tr = trace_cache_open(cfg->cache_dir, cfg->path);
+  if (!tr)
+  {
+    return;
+  }
+  predictor_t *predictors[NUM_BP_TYPES];
+  int created = 0;
+  for (; created < cfg->num_types; created++)
+  {
+    predictor_config_t pc = predictor_default_config(cfg->types[created]);
+    if (!(predictors[created] = predictor_create(&pc)))
+    {
+      break;
+    }
+  }
+  branch_record_t *batch = (branch_record_t *)malloc(TRACE_BATCH * sizeof(branch_record_t));
+  replay_history_t *hist = replay_history_new(predictors, created);
+
+  if (created == cfg->num_types && batch)
+  {
+    trace_seek_branch(tr, cfg->path, sh->warm_from);
+    uint64_t lead = sh->warm_from + side <= sh->from ? side : 0;
+    uint64_t tail = sh->to - sh->from >= side ? side : 0;
+    uint64_t cold = sh->from - sh->warm_from - lead;
+    uint64_t body = sh->to - sh->from - tail;
+    sh->ok = shard_replay(tr, predictors, created, cold, NULL, batch, hist) == cold &&
+             shard_replay(tr, predictors, created, lead, sh->lead, batch, hist) == lead;
+    for (int p = 0; p < created && sh->ok && cfg->exact; p++)
+    {
+      sh->ok = (sh->start[p] = shard_save(predictors[p], &sh->start_hash[p], &sh->state_len[p])) != NULL;
+    }
+    sh->ok = sh->ok && shard_replay(tr, predictors, created, body, sh->st, batch, hist) == body &&
+             shard_replay(tr, predictors, created, tail, sh->tail, batch, hist) == tail;
+    for (int p = 0; p < created && sh->ok && cfg->exact; p++)
+    {
+      sh->ok = (sh->end[p] = shard_save(predictors[p], &sh->end_hash[p], &sh->end_len[p])) != NULL;
+    }
+    for (int p = 0; p < created; p++)
+    {
+      sh->st[p].branches += sh->tail[p].branches;
+      sh->st[p].mispredictions += sh->tail[p].mispredictions;
+    }
+  }
+
+  free(batch);
+  free(hist);
+  for (int p = 0; p < created; p++)
+  {
+    predictor_destroy(predictors[p]);
+  }
+  trace_close(tr);
+}
+
+// Replay shard 'sh' again for predictor p alone, from the 'state' of
+// 'len' bytes the previous shard ends in, replacing its statistics and
+// end state
+//
+// Returns True if Successful
+//
+static int shard_rerun(const shard_config_t *cfg, shard_t *sh, int p, const uint8_t *state, size_t len)
+{
+  predictor_config_t pc = predictor_default_config(cfg->types[p]);
+  predictor_t *bp = predictor_load_state(&pc, state, len);
+  trace_reader_t *tr = trace_cache_open(cfg->cache_dir, cfg->path);
+  branch_record_t *batch = (branch_record_t *)malloc(TRACE_BATCH * sizeof(branch_record_t));
+  int ok = tr && batch && bp;
+  if (ok)
+  {
+    trace_seek_branch(tr, cfg->path, sh->from);
+    memset(&sh->st[p], 0, sizeof(sh->st[p]));
+    free(sh->end[p]);
+    ok = shard_replay(tr, &bp, 1, sh->to - sh->from, &sh->st[p], batch, NULL) == sh->to - sh->from &&
+         (sh->end[p] = shard_save(bp, &sh->end_hash[p], &sh->end_len[p])) != NULL;
+  }
+  predictor_destroy(bp);
+  free(batch);
+  if (tr)
+  {
+    trace_close(tr);
+  }
+  return ok;
+}
+
+int shard_run(trace_reader_t *tr, const shard_config_t *cfg)
+{
+  uint64_t length = cfg->path && strcmp(cfg->path, "-") ? shard_trace_length(tr, cfg->path) : ~0ULL;
+  if (length == ~0ULL)
+  {
+    fprintf(stderr, "--shards needs a seekable trace file: binary, framed or indexed text\n");
+    return 0;
+  }
+
+  // The counted range, split evenly
+  uint64_t from = cfg->start + cfg->warmup < length ? cfg->start + cfg->warmup : length;
+  uint64_t to = cfg->count < length - from ? from + cfg->count : length;
+  int k = cfg->shards;
+  if ((uint64_t)k > to - from)
+  {
+    k = to - from > 0 ? (int)(to - from) : 1;
+  }
+  std::vector<shard_t> shards(k);
+  uint64_t len = (to - from) / k;
+  uint64_t side = cfg->exact ? 0 : cfg->overlap / 2 < len ? cfg->overlap / 2 : len;
+  for (int s = 0; s < k; s++)
+  {
+    shard_t *sh = &shards[s];
+    memset(sh, 0, sizeof(*sh));
+    sh->from = from + s * len;
+    sh->to = s + 1 < k ? sh->from + len : to;
+    sh->warm_from = s == 0 ? cfg->start : sh->from - (sh->from - cfg->start < cfg->overlap ? sh->from - cfg->start
+                                                                                           : cfg->overlap);
+  }
+
+  std::vector<std::thread> threads;
+  for (int s = 1; s < k; s++)
+  {
+    threads.push_back(std::thread(shard_replay_one, cfg, &shards[s], side));
+  }
+  shard_replay_one(cfg, &shards[0], side);
+  for (size_t t = 0; t < threads.size(); t++)
+  {
+    threads[t].join();
+  }
+  int ok = 1;
+  for (int s = 0; s < k && ok; s++)
+  {
+    if (!(ok = shards[s].ok))
+    {
+      fprintf(stderr, "Error: shard %d of %s failed\n", s, cfg->path);
+    }
+  }
+
+  // Each boundary against the true state before it, in order
+  int rerun[NUM_BP_TYPES] = {0};
+  for (int s = 1; s < k && ok && cfg->exact; s++)
+  {
+    for (int p = 0; p < cfg->num_types && ok; p++)
+    {
+      shard_t *prev = &shards[s - 1], *sh = &shards[s];
+      if (sh->start_hash[p] == prev->end_hash[p] && sh->state_len[p] == prev->end_len[p] &&
+          !memcmp(sh->start[p], prev->end[p], sh->state_len[p]))
+      {
+        continue;
+      }
+      rerun[p]++;
+      if (!(ok = shard_rerun(cfg, sh, p, prev->end[p], prev->end_len[p])))
+      {
+        fprintf(stderr, "Error: re-running shard %d of %s failed\n", s, cfg->path);
+      }
+    }
+  }
+  for (int s = 0; s < k; s++)
+  {
+    for (int p = 0; p < cfg->num_types; p++)
+    {
+      free(shards[s].start[p]);
+      free(shards[s].end[p]);
+    }
+  }
+  if (!ok)
+  {
+    return 0;
+  }
+
+  // Merge, and sum the extra mispredictions of the cold starts
+  printf("Shards:          %10d of %llu branches, %llu warmup\n", k, (unsigned long long)len,
+         (unsigned long long)cfg->overlap);
+  for (int p = 0; p < cfg->num_types; p++)
+  {
+    replay_stats_t total = {0, 0};
+    int64_t extra = 0;
+    uint64_t compared = 0;
+    for (int s = 0; s < k; s++)
+    {
+      total.branches += shards[s].st[p].branches;
+      total.mispredictions += shards[s].st[p].mispredictions;
+      if (s > 0 && shards[s].lead[p].branches == shards[s - 1].tail[p].branches)
+      {
+        extra += (int64_t)shards[s].lead[p].mispredictions - (int64_t)shards[s - 1].tail[p].mispredictions;
+        compared++;
+      }
+    }
+    if (cfg->num_types > 1)
+    {
+      printf("%s:\n", bpName[cfg->types[p]]);
+    }
+    printf("Branches:        %10llu\n", (unsigned long long)total.branches);
+    printf("Incorrect:       %10llu\n", (unsigned long long)total.mispredictions);
+    printf("Misprediction Rate: %7.3f\n", total.branches ? replay_rate(&total) : 0.0);
+    if (cfg->exact)
+    {
+      printf("Re-run:          %10d of %d shards\n", rerun[p], k - 1);
+    }
+    else if (compared)
+    {
+      // Measured after a shorter warmup, so this errs on the high side
+      printf("Warmup error:    %10lld incorrect, %+.3f rate (estimate)\n", (long long)extra,
+             total.branches ? 1000.0 * extra / total.branches : 0.0);
+    }
+  }
+  return 1;
+}
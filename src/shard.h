@@ -0,0 +1,46 @@
+//========================================================//
+//  shard.h                                               //
+//  Header file for sharded single-trace replay           //
+//                                                        //
+//  Splits one trace into consecutive shards replayed at  //
+//  the same time, each on its own reader and predictors  //
+//  warmed on the branches just before the shard          //
+//========================================================//
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdint.h>
+#include "trace.h"
+
+// Default branches each shard trains on before its range
+#define SHARD_WARMUP 1000000
+
+// Most shards of one trace, each a thread and a warmup of its own
+#define SHARD_MAX 256
+
+typedef struct
+{
+  const int *types;       // predictor types to replay
+  int num_types;
+  const char *path;       // trace, reopened by every shard
+  const char *cache_dir;  // see trace_cache_open, NULL for none
+  uint64_t start;         // first branch of the trace to replay
+  uint64_t count;         // branches counted after the warmup
+  uint64_t warmup;        // branches trained on from 'start' first
+  int shards;             // shards, one thread each
+  uint64_t overlap;       // branches each later shard trains on first
+  int exact;              // re-run the shards not starting from the
+                          // state the previous one ends in
+} shard_config_t;
+
+// Replay the trace 'tr', opened from cfg->path, in cfg->shards shards
+// and print the merged statistics, with an estimate of the error the
+// cold shard starts introduce, or with cfg->exact the statistics of a
+// single replay
+//
+// Returns True if Successful
+//
+int shard_run(trace_reader_t *tr, const shard_config_t *cfg);
+
+#endif
@@ -0,0 +1,215 @@
+//========================================================//
+//  shmring.cpp                                           //
+//  Source file for the shared memory branch ring         //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shmring.h"
+
+// Records of slot number 'n' of the stream
+static inline char *shm_ring_at(const shm_ring_t *r, uint64_t n)
+{
+  return r->data + (n % r->hdr->slots) * r->hdr->slot_records * SHM_RING_RECORD_SIZE;
+}
+
+// Back off while waiting on the other side: yield for a while, then
+// sleep, so an idle ring costs no core
+static void shm_ring_wait(unsigned *spins)
+{
+  if (++*spins < 64)
+  {
+    sched_yield();
+    return;
+  }
+  struct timespec ts = {0, 50000};
+  nanosleep(&ts, NULL);
+}
+
+shm_ring_t *shm_ring_create(const char *name, uint32_t readers)
+{
+  if (readers < 1 || readers > SHM_RING_MAX_READERS)
+  {
+    return NULL;
+  }
+  shm_ring_t *r = (shm_ring_t *)calloc(1, sizeof(shm_ring_t));
+  if (!r)
+  {
+    return NULL;
+  }
+  snprintf(r->path, sizeof(r->path), "/dev/shm/%s", name);
+  r->reader = -1;
+  r->bytes = sizeof(shm_ring_header_t) + (size_t)SHM_RING_SLOTS * SHM_RING_SLOT_RECORDS * SHM_RING_RECORD_SIZE;
+
+  // Set up under another name, so a reader never maps a ring that is
+  // not initialized yet
+  char tmp[sizeof(r->path) + 8];
+  snprintf(tmp, sizeof(tmp), "%s.new", r->path);
+  int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  void *m = MAP_FAILED;
+  if (fd >= 0 && !ftruncate(fd, r->bytes))
+  {
+    m = mmap(NULL, r->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (fd >= 0)
+  {
+    close(fd);
+  }
+  if (m == MAP_FAILED)
+  {
+    unlink(tmp);
+    free(r);
+    return NULL;
+  }
+  r->hdr = (shm_ring_header_t *)m;
+  r->data = (char *)m + sizeof(shm_ring_header_t);
+  r->hdr->slots = SHM_RING_SLOTS;
+  r->hdr->slot_records = SHM_RING_SLOT_RECORDS;
+  r->hdr->readers = readers;
+  memcpy(r->hdr->magic, SHM_RING_MAGIC, SHM_RING_MAGIC_LEN);
+  if (rename(tmp, r->path))
+  {
+    munmap(m, r->bytes);
+    unlink(tmp);
+    free(r);
+    return NULL;
+  }
+  return r;
+}
+
+char *shm_ring_slot(shm_ring_t *r)
+{
+  shm_ring_header_t *h = r->hdr;
+  unsigned spins = 0;
+  while (__atomic_load_n(&h->attached, __ATOMIC_ACQUIRE) < h->readers)
+  {
+    shm_ring_wait(&spins);
+  }
+  for (;;)
+  {
+    uint64_t oldest = r->next;
+    for (uint32_t i = 0; i < h->readers; i++)
+    {
+      uint64_t tail = __atomic_load_n(&h->tail[i], __ATOMIC_ACQUIRE);
+      oldest = tail < oldest ? tail : oldest;
+    }
+    if (r->next - oldest < h->slots)
+    {
+      break;
+    }
+    shm_ring_wait(&spins);
+  }
+  return shm_ring_at(r, r->next);
+}
+
+void shm_ring_publish(shm_ring_t *r, uint32_t n)
+{
+  r->hdr->len[r->next % r->hdr->slots] = n;
+  r->next++;
+  __atomic_store_n(&r->hdr->head, r->next, __ATOMIC_RELEASE);
+}
+
+void shm_ring_finish(shm_ring_t *r)
+{
+  if (!r)
+  {
+    return;
+  }
+  __atomic_store_n(&r->hdr->done, 1, __ATOMIC_RELEASE);
+  unlink(r->path);
+  munmap(r->hdr, r->bytes);
+  free(r);
+}
+
+shm_ring_t *shm_ring_attach(const char *name)
+{
+  shm_ring_t *r = (shm_ring_t *)calloc(1, sizeof(shm_ring_t));
+  if (!r)
+  {
+    return NULL;
+  }
+  snprintf(r->path, sizeof(r->path), "/dev/shm/%s", name);
+  int fd = open(r->path, O_RDWR);
+  for (int i = 0; fd < 0 && i < SHM_RING_ATTACH_WAIT * 10; i++)
+  {
+    struct timespec ts = {0, 100000000};
+    nanosleep(&ts, NULL);
+    fd = open(r->path, O_RDWR);
+  }
+  struct stat st;
+  void *m = MAP_FAILED;
+  if (fd >= 0 && !fstat(fd, &st) && (size_t)st.st_size >= sizeof(shm_ring_header_t))
+  {
+    r->bytes = st.st_size;
+    m = mmap(NULL, r->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (fd >= 0)
+  {
+    close(fd);
+  }
+  if (m == MAP_FAILED)
+  {
+    free(r);
+    return NULL;
+  }
+  r->hdr = (shm_ring_header_t *)m;
+  r->data = (char *)m + sizeof(shm_ring_header_t);
+  shm_ring_header_t *h = r->hdr;
+  if (memcmp(h->magic, SHM_RING_MAGIC, SHM_RING_MAGIC_LEN) || h->slots > SHM_RING_SLOTS ||
+      r->bytes < sizeof(shm_ring_header_t) + (size_t)h->slots * h->slot_records * SHM_RING_RECORD_SIZE)
+  {
+    munmap(m, r->bytes);
+    free(r);
+    return NULL;
+  }
+  r->reader = __atomic_fetch_add(&h->attached, 1, __ATOMIC_ACQ_REL);
+  if (r->reader >= (int)h->readers)
+  {
+    fprintf(stderr, "Error: the ring %s already has its %u readers\n", name, h->readers);
+    munmap(m, r->bytes);
+    free(r);
+    return NULL;
+  }
+  return r;
+}
+
+size_t shm_ring_next(shm_ring_t *r, const char **recs)
+{
+  shm_ring_header_t *h = r->hdr;
+  if (r->holding)
+  {
+    __atomic_store_n(&h->tail[r->reader], r->next, __ATOMIC_RELEASE);
+    r->holding = 0;
+  }
+  unsigned spins = 0;
+  while (r->next >= __atomic_load_n(&h->head, __ATOMIC_ACQUIRE))
+  {
+    // the head stored before done is the last one
+    if (__atomic_load_n(&h->done, __ATOMIC_ACQUIRE) && r->next >= __atomic_load_n(&h->head, __ATOMIC_ACQUIRE))
+    {
+      return 0;
+    }
+    shm_ring_wait(&spins);
+  }
+  *recs = shm_ring_at(r, r->next);
+  r->holding = 1;
+  return h->len[r->next++ % h->slots];
+}
+
+void shm_ring_detach(shm_ring_t *r)
+{
+  if (!r)
+  {
+    return;
+  }
+  __atomic_store_n(&r->hdr->tail[r->reader], SHM_RING_GONE, __ATOMIC_RELEASE);
+  munmap(r->hdr, r->bytes);
+  free(r);
+}
@@ -0,0 +1,105 @@
+//========================================================//
+//  shmring.h                                             //
+//  Header file for the shared memory branch ring         //
+//                                                        //
+//  branchExt -shm <name> publishes its records into a    //
+//  ring of slots in /dev/shm/<name> as it traces, and    //
+//  predictor --shm=<name> replays them as they come, so  //
+//  one traced run drives several simulators at once.     //
+//  The producer fills a slot in place and waits while    //
+//  the slowest reader still holds the oldest one; the    //
+//  readers replay each slot where it lies                //
+//========================================================//
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHM_RING_MAGIC "BPSHRING"
+#define SHM_RING_MAGIC_LEN 8
+
+// Slots of the ring and records of each, packed branch_record_t of
+// the binary trace format (9 bytes)
+#define SHM_RING_SLOTS 16
+#define SHM_RING_SLOT_RECORDS 65536
+#define SHM_RING_RECORD_SIZE 9
+#define SHM_RING_MAX_READERS 16
+
+// Tail of a reader that has detached, never waited for
+#define SHM_RING_GONE (~0ULL)
+
+// Seconds a reader waits for the ring to be created
+#define SHM_RING_ATTACH_WAIT 60
+
+// At the start of the mapping, followed by the slots. The counters
+// are only touched through atomics: head and done are stored by the
+// producer once a slot is written, a tail by its reader once it has
+// replayed a slot
+typedef struct
+{
+  char magic[SHM_RING_MAGIC_LEN]; // SHM_RING_MAGIC, not NUL terminated
+  uint32_t slots;
+  uint32_t slot_records;
+  uint32_t readers;        // the producer waits for this many before the first slot
+  uint32_t attached;       // readers that took an index
+  uint32_t done;           // nothing more is published after head
+  uint32_t reserved;
+  uint64_t head;           // slots published
+  uint64_t tail[SHM_RING_MAX_READERS]; // slots each reader has released
+  uint32_t len[SHM_RING_SLOTS];        // records of each slot
+} shm_ring_header_t;
+
+typedef struct
+{
+  shm_ring_header_t *hdr;
+  char *data;              // slot 0
+  size_t bytes;            // of the mapping
+  int reader;              // index of a reader, -1 for the producer
+  uint64_t next;           // slot the reader replays next, or the producer fills
+  int holding;             // the reader holds slot next - 1
+  char path[256];
+} shm_ring_t;
+
+// Create the ring /dev/shm/<name>, replacing any left over, for
+// 'readers' readers
+//
+// Returns NULL if it can not be created
+//
+shm_ring_t *shm_ring_create(const char *name, uint32_t readers);
+
+// Wait until every reader has attached and the next slot is released
+// by all of them
+//
+// Returns the slot to write up to slot_records records into
+//
+char *shm_ring_slot(shm_ring_t *r);
+
+// Publish the 'n' records written into the slot of shm_ring_slot
+//
+void shm_ring_publish(shm_ring_t *r, uint32_t n);
+
+// Mark the end of the stream, remove the name and unmap the ring;
+// the readers keep their mappings
+//
+void shm_ring_finish(shm_ring_t *r);
+
+// Attach to the ring /dev/shm/<name> as one of its readers, waiting
+// up to SHM_RING_ATTACH_WAIT seconds for it to be created
+//
+// Returns NULL if there is no ring or no free reader index
+//
+shm_ring_t *shm_ring_attach(const char *name);
+
+// Release the slot of the previous call and wait for the next one
+//
+// Returns the number of records at *recs, 0 at the end of the stream
+//
+size_t shm_ring_next(shm_ring_t *r, const char **recs);
+
+// Release the ring, so the producer no longer waits for this reader
+//
+void shm_ring_detach(shm_ring_t *r);
+
+#endif
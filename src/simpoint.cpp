@@ -0,0 +1,340 @@
+//========================================================//
+//  simpoint.cpp                                          //
+//  Picks simulation points from basic block vectors      //
+//                                                        //
+//  pin -t branchExt.so -bbv 10000000 -- <program>        //
+//  ./simpoint --k=8 --interval=10000000 branches.bb      //
+//                                                        //
+//  As SimPoint does: every interval's vector is          //
+//  normalized, randomly projected to a few dimensions    //
+//  and clustered with k-means, and the interval closest  //
+//  to each centroid stands for its cluster, weighted by  //
+//  the share of the intervals in it                      //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#define SP_DIMS 15         // of the random projection
+#define SP_RUNS 5          // k-means runs from different seeds, the best is kept
+#define SP_ITERATIONS 100  // at most per run
+#define SP_LINE_MAX (1 << 20)
+
+void usage()
+{
+  fprintf(stderr, "Usage: simpoint [options] <bbv file>\n");
+  fprintf(stderr, " Options:\n");
+  fprintf(stderr, " --k=<n>                  Simulation points to pick (default 10)\n");
+  fprintf(stderr, " --interval=<n>           Instructions per interval, as given to\n");
+  fprintf(stderr, "                          branchExt -bbv, to print the windows\n");
+  fprintf(stderr, " --seed=<n>               Seed of the projection and the clustering (default 1)\n");
+}
+
+static uint64_t sp_state;
+
+static inline uint64_t sp_random()
+{
+  sp_state ^= sp_state << 13;
+  sp_state ^= sp_state >> 7;
+  sp_state ^= sp_state << 17;
+  return sp_state;
+}
+
+// The projection matrix entry of block 'id' and dimension 'd', in
+// [-1, 1), a hash of both so the matrix is never stored
+static inline double sp_projection(uint64_t seed, uint64_t id, int d)
+{
+  uint64_t h = (id * SP_DIMS + d + 1) * 0x9e3779b97f4a7c15ULL ^ seed;
+  h ^= h >> 31;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 29;
+  return (double)(h >> 11) / (double)(1ULL << 52) - 1.0;
+}
+
+// Read the "T:<id>:<count> ..." lines of 'path' as projected vectors
+// of their instruction shares into 'vecs'
+//
+// Returns the number of intervals, 0 on error
+//
+static size_t read_bbv(const char *path, uint64_t seed, double **vecs)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+  {
+    fprintf(stderr, "Error: can not read %s\n", path);
+    return 0;
+  }
+  char *line = (char *)malloc(SP_LINE_MAX);
+  size_t n = 0, cap = 0;
+  double *v = NULL;
+  while (fgets(line, SP_LINE_MAX, f))
+  {
+    if (line[0] != 'T')
+    {
+      continue;
+    }
+    if (n == cap)
+    {
+      cap = cap ? cap * 2 : 1024;
+      v = (double *)realloc(v, cap * SP_DIMS * sizeof(double));
+    }
+    double *p = v + n * SP_DIMS;
+    memset(p, 0, SP_DIMS * sizeof(double));
+    double total = 0;
+    for (char *s = strchr(line, ':'); s; s = strchr(s, ':'))
+    {
+      char *end;
+      uint64_t id = strtoull(s + 1, &end, 10);
+      if (*end != ':')
+      {
+        break;
+      }
+      double count = (double)strtoull(end + 1, &s, 10);
+      total += count;
+      for (int d = 0; d < SP_DIMS; d++)
+      {
+        p[d] += count * sp_projection(seed, id, d);
+      }
+    }
+    for (int d = 0; d < SP_DIMS && total; d++)
+    {
+      p[d] /= total;
+    }
+    n++;
+  }
+  free(line);
+  fclose(f);
+  if (!n)
+  {
+    fprintf(stderr, "Error: no intervals in %s\n", path);
+  }
+  *vecs = v;
+  return n;
+}
+
+static inline double sp_distance(const double *a, const double *b)
+{
+  double sum = 0;
+  for (int d = 0; d < SP_DIMS; d++)
+  {
+    sum += (a[d] - b[d]) * (a[d] - b[d]);
+  }
+  return sum;
+}
+
+// Cluster the 'n' vectors around 'k' centroids, seeded k-means++ like,
+// leaving the cluster of each in 'member'
+//
+// Returns the sum of the squared distances to the centroids
+//
+static double kmeans(const double *vecs, size_t n, int k, double *centroids, int *member)
+{
+  double *nearest = (double *)malloc(n * sizeof(double));
+  memcpy(centroids, vecs + (sp_random() % n) * SP_DIMS, SP_DIMS * sizeof(double));
+  for (size_t i = 0; i < n; i++)
+  {
+    nearest[i] = sp_distance(vecs + i * SP_DIMS, centroids);
+  }
+  for (int c = 1; c < k; c++)
+  {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+      sum += nearest[i];
+    }
+    double pick = sum * (double)(sp_random() >> 11) / (double)(1ULL << 53);
+    size_t chosen = 0;
+    while (chosen < n - 1 && pick >= nearest[chosen])
+    {
+      pick -= nearest[chosen++];
+    }
+    memcpy(centroids + c * SP_DIMS, vecs + chosen * SP_DIMS, SP_DIMS * sizeof(double));
+    for (size_t i = 0; i < n; i++)
+    {
+      double dist = sp_distance(vecs + i * SP_DIMS, centroids + c * SP_DIMS);
+      nearest[i] = dist < nearest[i] ? dist : nearest[i];
+    }
+  }
+
+  size_t *sizes = (size_t *)malloc(k * sizeof(size_t));
+  double sse = 0;
+  for (int it = 0; it < SP_ITERATIONS; it++)
+  {
+    int moved = 0;
+    sse = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+      int best = 0;
+      double best_dist = sp_distance(vecs + i * SP_DIMS, centroids);
+      for (int c = 1; c < k; c++)
+      {
+        double dist = sp_distance(vecs + i * SP_DIMS, centroids + c * SP_DIMS);
+        if (dist < best_dist)
+        {
+          best = c;
+          best_dist = dist;
+        }
+      }
+      moved += !it || member[i] != best;
+      member[i] = best;
+      sse += best_dist;
+    }
+    if (!moved)
+    {
+      break;
+    }
+    // an emptied cluster keeps its centroid
+    memset(sizes, 0, k * sizeof(size_t));
+    for (size_t i = 0; i < n; i++)
+    {
+      sizes[member[i]]++;
+    }
+    for (int c = 0; c < k; c++)
+    {
+      if (sizes[c])
+      {
+        memset(centroids + c * SP_DIMS, 0, SP_DIMS * sizeof(double));
+      }
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+      for (int d = 0; d < SP_DIMS; d++)
+      {
+        centroids[member[i] * SP_DIMS + d] += vecs[i * SP_DIMS + d] / sizes[member[i]];
+      }
+    }
+  }
+  free(sizes);
+  free(nearest);
+  return sse;
+}
+
+int main(int argc, char *argv[])
+{
+  int k = 10;
+  uint64_t interval = 0;
+  uint64_t seed = 1;
+  const char *path = NULL;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strncmp(argv[i], "--k=", 4))
+    {
+      k = atoi(argv[i] + 4);
+    }
+    else if (!strncmp(argv[i], "--interval=", 11))
+    {
+      interval = strtoull(argv[i] + 11, NULL, 0);
+    }
+    else if (!strncmp(argv[i], "--seed=", 7))
+    {
+      seed = strtoull(argv[i] + 7, NULL, 0);
+    }
+    else if (!path && strncmp(argv[i], "--", 2))
+    {
+      path = argv[i];
+    }
+    else
+    {
+      usage();
+      exit(1);
+    }
+  }
+  if (!path || k < 1)
+  {
+    usage();
+    exit(1);
+  }
+
+  double *vecs;
+  size_t n = read_bbv(path, seed, &vecs);
+  if (!n)
+  {
+    exit(1);
+  }
+  if ((size_t)k > n)
+  {
+    k = n;
+  }
+
+  // the best of a few runs
+  double *centroids = (double *)malloc(k * SP_DIMS * sizeof(double));
+  double *best_centroids = (double *)malloc(k * SP_DIMS * sizeof(double));
+  int *member = (int *)malloc(n * sizeof(int));
+  int *best_member = (int *)malloc(n * sizeof(int));
+  double best_sse = -1;
+  for (int run = 0; run < SP_RUNS; run++)
+  {
+    sp_state = (seed + run) * 0x2545f4914f6cdd1dULL | 1;
+    double sse = kmeans(vecs, n, k, centroids, member);
+    if (best_sse < 0 || sse < best_sse)
+    {
+      best_sse = sse;
+      memcpy(best_centroids, centroids, k * SP_DIMS * sizeof(double));
+      memcpy(best_member, member, n * sizeof(int));
+    }
+  }
+
+  // each cluster's point is its interval nearest the centroid; the
+  // spread, the root mean squared distance of the others to it, tells
+  // how well it stands for them
+  size_t *point = (size_t *)malloc(k * sizeof(size_t));
+  size_t *size = (size_t *)calloc(k, sizeof(size_t));
+  double *spread = (double *)calloc(k, sizeof(double));
+  for (size_t i = 0; i < n; i++)
+  {
+    int c = best_member[i];
+    double dist = sp_distance(vecs + i * SP_DIMS, best_centroids + c * SP_DIMS);
+    if (!size[c] || dist < sp_distance(vecs + point[c] * SP_DIMS, best_centroids + c * SP_DIMS))
+    {
+      point[c] = i;
+    }
+    size[c]++;
+  }
+  for (size_t i = 0; i < n; i++)
+  {
+    int c = best_member[i];
+    spread[c] += sp_distance(vecs + i * SP_DIMS, vecs + point[c] * SP_DIMS);
+  }
+
+  int points = 0;
+  for (int c = 0; c < k; c++)
+  {
+    points += size[c] != 0;
+  }
+  printf("Simulation points: %d of %zu intervals\n", points, n);
+  printf("Interval    Weight  Spread");
+  if (interval)
+  {
+    printf("  branchExt window");
+  }
+  printf("\n");
+  // in interval order
+  for (size_t i = 0; i < n; i++)
+  {
+    int c = best_member[i];
+    if (point[c] != i)
+    {
+      continue;
+    }
+    printf("%8zu  %8.5f  %6.4f", i, (double)size[c] / n, sqrt(spread[c] / size[c]));
+    if (interval)
+    {
+      printf("  -f %llu -m %llu", (unsigned long long)(i * interval), (unsigned long long)interval);
+    }
+    printf("\n");
+  }
+
+  free(point);
+  free(size);
+  free(spread);
+  free(centroids);
+  free(best_centroids);
+  free(member);
+  free(best_member);
+  free(vecs);
+  return 0;
+}
@@ -0,0 +1,1364 @@
+//========================================================//
+//  sweep.cpp                                             //
+//  Source file for the predictor parameter sweep         //
+//                                                        //
+//  The trace is decoded once into memory (or used in     //
+//  place when it is a mapped binary trace); workers then //
+//  claim points from a shared counter and replay the     //
+//  whole trace on a private predictor instance.          //
+//                                                        //
+//  With early stop the trace is replayed in windows, and //
+//  each point is compared window by window with the best //
+//  point that got as far, so trace phases cancel out.    //
+//  The window totals are shared under a lock taken once  //
+//  per window.                                           //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "predictor.h"
+#include "replay.h"
+#include "sweep.h"
+#include "pcmap.h"
+#include "results.h"
+#include "gpusweep.h"
+#include "numa.h"
+#include "memo.h"
+#include "checkpoint.h"
+#include "featcache.h"
+#include "progress.h"
+#include "probes.h"
+
+typedef struct
+{
+  int type;
+  std::string key;
+  std::vector<int> values;
+} sweep_range_t;
+
+typedef struct
+{
+  predictor_config_t cfg;
+  std::string params; // "key=value ..." of the swept fields
+  replay_stats_t stats;
+  pc_counts_t misses; // per PC with --profile-pcs
+  uint64_t runtime_ns; // replaying the counted records
+  uint64_t memory;    // predictor state bytes
+  uint64_t budget;    // modeled storage bits
+  int invalid;        // predictor_create rejected cfg
+  int over_budget;    // needs more bits than allowed, not replayed
+  int oversized;      // tables far larger than the trace fills, not replayed
+  int memoized;       // result found in the --memo store, not replayed
+  int split;          // replayed in parts, see --sweep-split
+  int stored;         // added to the --memo store
+  int resumed;        // continued from a --sweep-checkpoint snapshot
+  size_t replayed;    // records replayed, less than all when stopped
+  std::vector<replay_stats_t> totals; // stats up to the end of each window
+} sweep_point_t;
+
+typedef struct
+{
+  size_t pack;    // index in the packs
+  size_t lo, hi;  // counted records to replay
+} sweep_task_t;
+
+static std::vector<sweep_range_t> sweep_ranges;
+
+// Parse "lo..hi", "lo..hi:step" or "a,b,c"
+//
+// Returns True if Successful
+//
+static int sweep_parse_values(const char *s, std::vector<int> *values)
+{
+  char *end;
+  const char *dots = strstr(s, "..");
+  if (dots)
+  {
+    long lo = strtol(s, &end, 0);
+    if (end != dots)
+    {
+      return 0;
+    }
+    long hi = strtol(dots + 2, &end, 0);
+    long step = 1;
+    if (*end == ':')
+    {
+      step = strtol(end + 1, &end, 0);
+    }
+    if (*end || step <= 0 || hi < lo || (hi - lo) / step > 100000)
+    {
+      return 0;
+    }
+    for (long v = lo; v <= hi; v += step)
+    {
+      values->push_back((int)v);
+    }
+    return 1;
+  }
+  for (;;)
+  {
+    long v = strtol(s, &end, 0);
+    if (end == s || (*end && *end != ','))
+    {
+      return 0;
+    }
+    values->push_back((int)v);
+    if (!*end)
+    {
+      return 1;
+    }
+    s = end + 1;
+  }
+}
+
+int sweep_add(const char *spec)
+{
+  const char *dot = strchr(spec, '.');
+  const char *eq = dot ? strchr(dot, '=') : NULL;
+  if (!dot || !eq)
+  {
+    return 0;
+  }
+  sweep_range_t range;
+  range.type = predictor_type_by_name(std::string(spec, dot - spec).c_str());
+  range.key = std::string(dot + 1, eq - dot - 1);
+
+  // Check the key against a scratch configuration
+  predictor_config_t cfg = predictor_default_config(range.type);
+  if (range.type < 0 || !predictor_config_set(&cfg, range.key.c_str(), 0) ||
+      !sweep_parse_values(eq + 1, &range.values))
+  {
+    return 0;
+  }
+  sweep_ranges.push_back(range);
+  return 1;
+}
+
+int sweep_active()
+{
+  return !sweep_ranges.empty();
+}
+
+// Expand the ranges into the cross product of each type
+//
+static std::vector<sweep_point_t> sweep_points()
+{
+  std::vector<sweep_point_t> points;
+  for (int type = 0; type < NUM_BP_TYPES; type++)
+  {
+    std::vector<sweep_point_t> pts(1);
+    pts[0].cfg = predictor_default_config(type);
+    int used = 0;
+    for (size_t r = 0; r < sweep_ranges.size(); r++)
+    {
+      const sweep_range_t *range = &sweep_ranges[r];
+      if (range->type != type)
+      {
+        continue;
+      }
+      used = 1;
+      std::vector<sweep_point_t> next;
+      for (size_t i = 0; i < pts.size(); i++)
+      {
+        for (size_t v = 0; v < range->values.size(); v++)
+        {
+          sweep_point_t pt = pts[i];
+          predictor_config_set(&pt.cfg, range->key.c_str(), range->values[v]);
+          if (!pt.params.empty())
+          {
+            pt.params += " ";
+          }
+          pt.params += range->key + "=" + std::to_string(range->values[v]);
+          next.push_back(pt);
+        }
+      }
+      pts.swap(next);
+    }
+    if (used)
+    {
+      points.insert(points.end(), pts.begin(), pts.end());
+    }
+  }
+  return points;
+}
+
+// Whether the table of 'cfg' indexed by PC and history has more than
+// 'factor' times the entries the trace of 'st' fills: gshare indexes by
+// the pairs at its history length, the perceptron its rows by the PC
+// and a segment of 16 outcomes
+//
+static int sweep_oversized(const predictor_config_t *cfg, const trace_stat_t *st, uint64_t factor)
+{
+  switch (cfg->type)
+  {
+  case GSHARE:
+    return (1ULL << cfg->ghistoryBits) > factor * trace_stat_pairs(st, cfg->ghistoryBits);
+  case PERCEPTRON:
+    return (1ULL << cfg->perceptronBits) > factor * trace_stat_pairs(st, 16);
+  }
+  return 0;
+}
+
+size_t sweep_configs(uint64_t budget_bits, const trace_stat_t *stat, uint64_t prune_factor,
+                     predictor_config_t **cfgs)
+{
+  std::vector<sweep_point_t> all = sweep_points();
+  *cfgs = (predictor_config_t *)malloc((all.size() ? all.size() : 1) * sizeof(predictor_config_t));
+  size_t n = 0;
+  for (size_t i = 0; i < all.size() && *cfgs; i++)
+  {
+    const predictor_config_t *cfg = &all[i].cfg;
+    if (results_mine(i) && !(budget_bits && predictor_budget_bits(cfg) > budget_bits) &&
+        !(stat && sweep_oversized(cfg, stat, prune_factor)))
+    {
+      (*cfgs)[n++] = *cfg;
+    }
+  }
+  return n;
+}
+
+int sweep_run(trace_reader_t *tr, const char *path, uint64_t warmup, uint64_t count, int jobs, int profile_top,
+              const char *pprof_path, const char *pprof_symbols, uint64_t stop_window, int gpu, uint64_t budget_bits,
+              uint64_t memory_bytes, const trace_stat_t *stat, uint64_t prune_factor, int interleave, int shared_folds, uint64_t block, uint64_t split_warmup,
+              const char *memo_scope_id, int halving, const char *checkpoint_dir, uint64_t checkpoint_ns,
+              const char *feature_dir)
+{
+  // Only the points of this shard, keeping their index in the run
+  std::vector<sweep_point_t> all = sweep_points();
+  std::vector<sweep_point_t> points;
+  std::vector<size_t> point_index;
+  for (size_t i = 0; i < all.size(); i++)
+  {
+    if (results_mine(i))
+    {
+      points.push_back(all[i]);
+      point_index.push_back(i);
+    }
+  }
+  // The records are loaded with only the fields some point reads
+  uint32_t fields = 0;
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    points[i].stats.branches = points[i].stats.mispredictions = 0;
+    pc_counts_init(&points[i].misses);
+    points[i].invalid = 0;
+    points[i].replayed = 0;
+    points[i].runtime_ns = 0;
+    points[i].memory = 0;
+    points[i].budget = predictor_budget_bits(&points[i].cfg);
+    points[i].over_budget = budget_bits && points[i].budget > budget_bits;
+    points[i].oversized = !points[i].over_budget && stat && sweep_oversized(&points[i].cfg, stat, prune_factor);
+    points[i].memoized = points[i].split = 0;
+    points[i].stored = points[i].resumed = 0;
+    fields |= predictor_fields(&points[i].cfg);
+  }
+  trace_set_fields(tr, fields);
+
+  // Points resume from their snapshots alone, so only the lockstep
+  // gshare packs, which finish soon, start over after a restart
+  if (checkpoint_dir)
+  {
+    interleave = 0;
+    shared_folds = 0;
+    block = 0;
+  }
+
+  const branch_record_t *recs;
+  branch_record_t *owned;
+  size_t n = replay_load(tr, warmup + count < warmup ? ~0ULL : warmup + count, &recs, &owned);
+
+  // The warmup records come first and are not counted
+  const branch_record_t *warm_recs = recs;
+  size_t nwarm = n < warmup ? n : warmup;
+  recs += nwarm;
+  n -= nwarm;
+
+  // Points the store holds over exactly these records are not replayed,
+  // but profiles are not stored
+  for (size_t i = 0; i < points.size() && memo_scope_id && !profile_top; i++)
+  {
+    memo_result_t r;
+    if (!points[i].over_budget && !points[i].oversized && memo_lookup(memo_scope_id, &points[i].cfg, &r) &&
+        r.records == n)
+    {
+      points[i].memoized = 1;
+      points[i].stats = r.stats;
+      points[i].replayed = n;
+      points[i].runtime_ns = r.runtime_ns;
+      points[i].memory = r.memory;
+    }
+  }
+
+  // PC ids, outcomes and executions are the same for every point
+  pc_map_t pc_map;
+  pc_counts_t execs;
+  std::vector<uint32_t> ids;
+  std::vector<uint64_t> cond, taken;
+  if (profile_top)
+  {
+    pc_map_init(&pc_map);
+    ids.resize(n);
+    for (size_t i = 0; i < n; i++)
+    {
+      ids[i] = pc_map_id(&pc_map, recs[i].pc);
+    }
+    cond.resize((n + 63) / 64);
+    taken.resize((n + 63) / 64);
+    pc_profile_outcomes(recs, n, cond.data(), taken.data());
+    pc_counts_init(&execs);
+    pc_counts_add(&execs, ids.data(), n, pc_map.count, cond.data());
+  }
+
+  if (jobs <= 0)
+  {
+    jobs = std::thread::hardware_concurrency();
+  }
+  // points that split can keep every worker busy
+  int splittable = split_warmup && !stop_window && !profile_top;
+  if (jobs > (int)points.size() && !splittable)
+  {
+    jobs = points.size();
+  }
+  if (jobs < 1)
+  {
+    jobs = 1;
+  }
+
+  // Window size for early stop, a multiple of 64 records so the
+  // profile bitmaps can be sliced
+  size_t window = n;
+  if (stop_window)
+  {
+    window = stop_window == SWEEP_STOP_AUTO ? n / SWEEP_STOP_WINDOWS : stop_window;
+    window = (window + 63) & ~(size_t)63;
+    if (window == 0)
+    {
+      window = 64;
+    }
+  }
+  // Windows of the trace's warm-up, which early stop doesn't compare
+  size_t warm_windows = stop_window ? (n / 100 * SWEEP_STOP_WARMUP + window - 1) / window : 0;
+  std::mutex totals_lock;
+
+  // Returns True if point 'i' is worse than another point over its
+  // last windows up to window 'k', after the warm-up: the best one
+  // over them that got as far, by the 95% interval of the differences
+  // of their window rates, by more than a margin. A point that started
+  // behind is only judged on where it is now
+  auto worse = [&](size_t i, size_t k) -> int {
+    if (k < warm_windows + SWEEP_STOP_MIN_WINDOWS)
+    {
+      return 0;
+    }
+    size_t first = std::max(warm_windows, k - std::min(k, (size_t)SWEEP_STOP_RECENT));
+    auto missed = [&](const sweep_point_t *pt) {
+      return pt->totals[k - 1].mispredictions - (first ? pt->totals[first - 1].mispredictions : 0);
+    };
+    const replay_stats_t *own = points[i].totals.data();
+    const sweep_point_t *best = NULL;
+    for (size_t j = 0; j < points.size(); j++)
+    {
+      const sweep_point_t *pt = &points[j];
+      if (j != i && pt->totals.size() >= k && (!best || missed(pt) < missed(best)))
+      {
+        best = pt;
+      }
+    }
+    if (!best || missed(best) >= missed(&points[i]))
+    {
+      return 0;
+    }
+    replay_monitor_t diff;
+    memset(&diff, 0, sizeof(diff));
+    replay_stats_t prev = first ? own[first - 1] : replay_stats_t{0, 0};
+    replay_stats_t best_prev = first ? best->totals[first - 1] : replay_stats_t{0, 0};
+    for (size_t w = first; w < k; w++)
+    {
+      replay_stats_t a = {own[w].branches - prev.branches, own[w].mispredictions - prev.mispredictions};
+      replay_stats_t b = {best->totals[w].branches - best_prev.branches,
+                          best->totals[w].mispredictions - best_prev.mispredictions};
+      prev = own[w];
+      best_prev = best->totals[w];
+      if (a.branches)
+      {
+        replay_monitor_add(&diff, replay_rate(&a) - replay_rate(&b));
+      }
+    }
+    // over those windows the best point's rate, of which the point must
+    // be worse by SWEEP_STOP_MARGIN percent
+    replay_stats_t over = {best->totals[k - 1].branches - (first ? best->totals[first - 1].branches : 0), missed(best)};
+    double margin = replay_rate(&over) * SWEEP_STOP_MARGIN / 100;
+    return diff.windows >= SWEEP_STOP_MIN_WINDOWS && diff.mean - replay_monitor_interval(&diff) > margin;
+  };
+
+  // --progress counts the records every point replays, warmup
+  // included, and successive halving its own rounds
+  if (progress_enabled && !halving)
+  {
+    uint64_t replaying = 0;
+    for (size_t i = 0; i < points.size(); i++)
+    {
+      replaying += !points[i].over_budget && !points[i].oversized && !points[i].memoized;
+    }
+    progress_start(replaying * (nwarm + n), -1, 0);
+  }
+
+  // With --gpu the points the device supports replay there, whole and
+  // all at once, and a few of them again on the CPU to check
+  std::vector<char> on_gpu(points.size(), 0);
+  if (gpu && !profile_top && gpu_sweep_init())
+  {
+    std::vector<size_t> idx;
+    std::vector<predictor_config_t> cfgs;
+    for (size_t i = 0; i < points.size(); i++)
+    {
+      if (points[i].over_budget || points[i].oversized || points[i].memoized ||
+          !gpu_sweep_supported(&points[i].cfg))
+      {
+        continue;
+      }
+      predictor_t *p = predictor_create(&points[i].cfg);
+      if (!p)
+      {
+        continue;
+      }
+      points[i].memory = predictor_memory(p);
+      predictor_destroy(p);
+      idx.push_back(i);
+      cfgs.push_back(points[i].cfg);
+    }
+    std::vector<uint64_t> misses(idx.size(), 0);
+    uint64_t t = trace_clock_ns();
+    if (!idx.empty() && !gpu_sweep_replay(warm_recs, nwarm, n, cfgs.data(), cfgs.size(), misses.data()))
+    {
+      fprintf(stderr, "Error: sweep points cannot replay on the GPU\n");
+      progress_stop();
+      free(owned);
+      return 0;
+    }
+    uint64_t elapsed = trace_clock_ns() - t;
+    uint64_t branches = replay_count_conditional(recs, n);
+    for (size_t j = 0; j < idx.size(); j++)
+    {
+      if (progress_enabled)
+      {
+        progress_add(0, nwarm + n, branches, misses[j]);
+      }
+      sweep_point_t *pt = &points[idx[j]];
+      pt->stats.branches = branches;
+      pt->stats.mispredictions = misses[j];
+      pt->replayed = n;
+      pt->runtime_ns = elapsed / idx.size();
+      on_gpu[idx[j]] = 1;
+    }
+    for (size_t v = 0; v < GPU_SWEEP_VERIFY && v < idx.size(); v++)
+    {
+      size_t i = idx[v ? idx.size() - 1 : 0];
+      predictor_t *p = predictor_create(&points[i].cfg);
+      replay_warmup(p, warm_recs, nwarm);
+      replay_stats_t st = {0, 0};
+      replay_records(p, recs, n, &st);
+      predictor_destroy(p);
+      if (st.mispredictions != points[i].stats.mispredictions)
+      {
+        fprintf(stderr, "Error: GPU replay of %s %s gave %llu mispredictions, the CPU %llu\n",
+                bpName[points[i].cfg.type], points[i].params.c_str(),
+                (unsigned long long)points[i].stats.mispredictions, (unsigned long long)st.mispredictions);
+        progress_stop();
+        free(owned);
+        return 0;
+      }
+    }
+  }
+  else if (gpu)
+  {
+    fprintf(stderr, profile_top ? "--gpu: not with --profile-pcs, replaying every point on the CPU\n"
+                                : "--gpu: replaying every point on the CPU\n");
+  }
+
+  // gshare points replay in lockstep packs, each reading the records
+  // once for up to PREDICTOR_LOCKSTEP_MAX points, and with 'interleave'
+  // TAGE points in packs of that many taking a branch each in turn, or
+  // with 'shared_folds' in packs of up to PREDICTOR_LOCKSTEP_MAX folding
+  // their histories once; with 'block' the others in packs replaying a block each in turn,
+  // else alone, as do those with an updateDelay or unbounded tables and
+  // all points with --profile-pcs
+  std::vector<std::vector<size_t> > packs;
+  size_t open[NUM_BP_TYPES]; // the pack points of each type join
+  for (int t = 0; t < NUM_BP_TYPES; t++)
+  {
+    open[t] = ~(size_t)0;
+  }
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    if (on_gpu[i] || points[i].over_budget || points[i].oversized || points[i].memoized)
+    {
+      continue;
+    }
+    int type = points[i].cfg.type;
+    size_t most = type == GSHARE                     ? PREDICTOR_LOCKSTEP_MAX
+                  : type == CUSTOM && interleave > 1 ? interleave
+                  : type == CUSTOM && shared_folds   ? PREDICTOR_LOCKSTEP_MAX
+                  : block                            ? PREDICTOR_LOCKSTEP_MAX
+                                                     : 1;
+    if (profile_top || most == 1 || points[i].cfg.updateDelay || points[i].cfg.unbounded)
+    {
+      packs.push_back(std::vector<size_t>(1, i));
+      continue;
+    }
+    if (open[type] == ~(size_t)0 || packs[open[type]].size() == most)
+    {
+      open[type] = packs.size();
+      packs.push_back(std::vector<size_t>());
+    }
+    packs[open[type]].push_back(i);
+  }
+  if (jobs > (int)packs.size() && !packs.empty() && !splittable)
+  {
+    jobs = packs.size();
+  }
+
+  // With 'feature_dir' a tournament point alone reads its local
+  // histories from a column of the feature cache, one per geometry,
+  // rather than keeping them in its own table
+  std::vector<featcache_column_t> columns;
+  std::vector<std::pair<int, int> > column_geometry;
+  std::vector<int> point_column(points.size(), -1);
+  uint64_t feature_key = 0;
+  for (size_t g = 0; g < packs.size() && feature_dir && *feature_dir && !profile_top && !checkpoint_dir && !halving;
+       g++)
+  {
+    size_t i = packs[g][0];
+    int lht_bits, hist_bits;
+    if (packs[g].size() > 1 || !predictor_config_memory(&points[i].cfg) ||
+        !predictor_local_geometry(&points[i].cfg, &lht_bits, &hist_bits))
+    {
+      continue;
+    }
+    std::pair<int, int> geometry(lht_bits, hist_bits);
+    size_t c = std::find(column_geometry.begin(), column_geometry.end(), geometry) - column_geometry.begin();
+    if (c == columns.size())
+    {
+      featcache_column_t col;
+      feature_key = columns.empty() ? featcache_key(warm_recs, nwarm + n) : feature_key;
+      if (!featcache_local(feature_dir, feature_key, warm_recs, nwarm + n, lht_bits, hist_bits, &col))
+      {
+        continue;
+      }
+      columns.push_back(col);
+      column_geometry.push_back(geometry);
+    }
+    point_column[i] = c;
+  }
+
+  // With a memory limit each pack reserves the bytes of its predictors
+  // before creating them and waits while the others hold too much; a
+  // pack alone is let through whatever it needs. The largest go first
+  // so the small ones fill in around them, and without a limit too, as
+  // the footprint is the best hint of a point's cost there is
+  std::vector<size_t> pack_bytes(packs.size(), 0);
+  for (size_t g = 0; g < packs.size(); g++)
+  {
+    for (size_t j = 0; j < packs[g].size(); j++)
+    {
+      pack_bytes[g] += predictor_config_memory(&points[packs[g][j]].cfg);
+    }
+  }
+  std::vector<size_t> order(packs.size());
+  for (size_t g = 0; g < order.size(); g++)
+  {
+    order[g] = g;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return pack_bytes[a] > pack_bytes[b]; });
+  std::mutex memory_lock;
+  std::condition_variable memory_freed;
+  uint64_t memory_used = 0;
+  auto reserve = [&](size_t bytes) {
+    std::unique_lock<std::mutex> lock(memory_lock);
+    memory_freed.wait(lock, [&]() { return !memory_used || memory_used + bytes <= memory_bytes; });
+    memory_used += bytes;
+  };
+  auto release = [&](size_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock(memory_lock);
+      memory_used -= bytes;
+    }
+    memory_freed.notify_all();
+  };
+
+  // Work stealing: each worker owns a deque of tasks, dealt the packs
+  // costliest first. It takes the front of its own, and once that is
+  // empty the back of another's. With 'split_warmup' a point alone
+  // hands the second half of what it has left to a worker that found
+  // nothing to take, as a task that first trains on the records before
+  // it, so a long point does not finish alone at the end
+  std::vector<std::deque<sweep_task_t> > queues(jobs);
+  std::vector<std::mutex> queue_locks(jobs);
+  for (size_t k = 0; k < order.size(); k++)
+  {
+    queues[k % jobs].push_back({order[k], 0, n});
+  }
+  std::atomic<size_t> unfinished(order.size());
+  std::atomic<int> idle(0);
+  std::atomic<size_t> splits(0);
+  auto take = [&](int w, sweep_task_t *task) -> int {
+    for (int v = 0; v < jobs; v++)
+    {
+      int q = (w + v) % jobs;
+      std::lock_guard<std::mutex> lock(queue_locks[q]);
+      if (!queues[q].empty())
+      {
+        *task = v ? queues[q].back() : queues[q].front();
+        if (v)
+        {
+          queues[q].pop_back();
+        }
+        else
+        {
+          queues[q].pop_front();
+        }
+        return 1;
+      }
+    }
+    return 0;
+  };
+
+  // Add point 'i' to the store as soon as it is replayed whole, in one
+  // part, so a sweep stopped later keeps it
+  std::atomic<int> store_failed(0);
+  auto store = [&](size_t i) {
+    sweep_point_t *pt = &points[i];
+    if (!memo_scope_id || pt->memoized || pt->stored || pt->invalid || pt->over_budget || pt->oversized ||
+        pt->split || pt->replayed < n || profile_top)
+    {
+      return;
+    }
+    memo_result_t r = {pt->stats, n, pt->runtime_ns, pt->memory};
+    pt->stored = 1;
+    if (!memo_store(memo_scope_id, &pt->cfg, &r))
+    {
+      store_failed = 1;
+    }
+  };
+
+  // The --sweep-checkpoint snapshot of point 'i', named by its key in
+  // the store
+  auto state_path = [&](size_t i) {
+    char key[MEMO_HASH_LEN + 1];
+    memo_key(memo_scope_id, &points[i].cfg, key);
+    return std::string(checkpoint_dir) + "/" + key + ".state";
+  };
+  std::atomic<size_t> resumed(0);
+
+  // Replay the point of pack 'g' alone over counted records 'lo' to
+  // 'hi' of 'base', worker 'w''s copy of the trace
+  //
+  // Returns the records replayed, warmup included
+  //
+  auto replay_point = [&](size_t g, const branch_record_t *base, size_t lo, size_t hi, int w) -> uint64_t {
+    size_t i = packs[g][0];
+    const branch_record_t *at = base + nwarm;
+    predictor_t *p = NULL;
+    std::string state;
+    uint64_t records = 0;
+    // the column holds the histories from the first record on, so the
+    // second part of a split warms its own table as before
+    const featcache_column_t *local = point_column[i] >= 0 && !lo ? &columns[point_column[i]] : NULL;
+    if (checkpoint_dir)
+    {
+      // Where a snapshot of an earlier run left off, warmed up
+      state = state_path(i);
+      uint64_t pos, branches, misses, runtime;
+      if (checkpoint_load_point(state.c_str(), &p, points[i].cfg.type, &pos, &branches, &misses, &runtime) &&
+          pos <= hi)
+      {
+        std::lock_guard<std::mutex> lock(totals_lock);
+        points[i].stats.branches = branches;
+        points[i].stats.mispredictions = misses;
+        points[i].replayed = pos;
+        points[i].runtime_ns = runtime;
+        points[i].resumed = 1;
+        resumed++;
+        lo = pos;
+        if (progress_enabled)
+        {
+          progress_add(w, nwarm + pos, branches, misses);
+        }
+      }
+      else if (p)
+      {
+        predictor_destroy(p);
+        p = NULL;
+      }
+    }
+    if (!p)
+    {
+      p = predictor_create(&points[i].cfg);
+      if (!p)
+      {
+        points[i].invalid = 1;
+        return 0;
+      }
+      size_t warm = !lo ? nwarm : lo + nwarm < split_warmup ? lo + nwarm : split_warmup;
+      if (local)
+      {
+        predictor_predict_local(p, replay_branches(base), nwarm, local->column, local->entry, NULL);
+      }
+      else
+      {
+        replay_warmup(p, at + lo - warm, warm);
+      }
+      if (progress_enabled)
+      {
+        progress_add(w, warm, 0, 0);
+      }
+      records = warm;
+    }
+    uint64_t t = trace_clock_ns(), saved = t;
+    size_t step = splittable ? SWEEP_SPLIT_STEP : checkpoint_dir && window > SWEEP_SPLIT_STEP ? SWEEP_SPLIT_STEP : window;
+    for (size_t off = lo; off < hi; off += step)
+    {
+      size_t m = hi - off < step ? hi - off : step;
+      replay_stats_t st = {0, 0};
+      // in pieces between the --progress stores
+      size_t piece = progress_enabled ? PROGRESS_CHUNK : m;
+      for (size_t o = off; o < off + m; o += piece)
+      {
+        size_t q = off + m - o < piece ? off + m - o : piece;
+        replay_stats_t part = {0, 0};
+        BP_PROBE2(sweep_piece_start, w, i);
+        BP_TASK_BEGIN("sweep piece");
+        if (profile_top)
+        {
+          replay_records_profiled(p, at + o, q, ids.data() + o, pc_map.count, cond.data() + o / 64,
+                                  taken.data() + o / 64, &part, &points[i].misses);
+        }
+        else if (local)
+        {
+          part.branches += replay_count_conditional(at + o, q);
+          part.mispredictions += predictor_predict_local(p, replay_branches(at + o), q,
+                                                         (const char *)local->column + (nwarm + o) * local->entry,
+                                                         local->entry, NULL);
+        }
+        else
+        {
+          replay_records(p, at + o, q, &part);
+        }
+        BP_TASK_END();
+        BP_PROBE4(sweep_piece_done, w, i, q, part.mispredictions);
+        st.branches += part.branches;
+        st.mispredictions += part.mispredictions;
+        if (progress_enabled)
+        {
+          progress_add(w, q, part.branches, part.mispredictions);
+        }
+      }
+      records += m;
+      std::lock_guard<std::mutex> lock(totals_lock);
+      points[i].stats.branches += st.branches;
+      points[i].stats.mispredictions += st.mispredictions;
+      points[i].replayed += m;
+      if (stop_window)
+      {
+        points[i].totals.push_back(points[i].stats);
+        if (off + m < hi && worse(i, points[i].totals.size()))
+        {
+          break;
+        }
+      }
+      uint64_t now = trace_clock_ns();
+      if (checkpoint_dir && off + m < hi && now - saved >= checkpoint_ns)
+      {
+        // the time up to here, as the run may stop before the end
+        if (!checkpoint_save_point(state.c_str(), p, off + m, points[i].stats.branches,
+                                   points[i].stats.mispredictions, points[i].runtime_ns + now - t))
+        {
+          fprintf(stderr, "Warning: failed to write %s\n", state.c_str());
+        }
+        saved = now;
+      }
+      size_t left = hi - off - m;
+      if (splittable && idle && left >= 2 * SWEEP_SPLIT_MIN)
+      {
+        size_t mid = hi - left / 2;
+        unfinished++;
+        splits++;
+        points[i].split = 1;
+        std::lock_guard<std::mutex> queue_lock(queue_locks[w]);
+        queues[w].push_front({g, mid, hi});
+        hi = mid;
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(totals_lock);
+      points[i].runtime_ns += trace_clock_ns() - t;
+      points[i].memory = predictor_memory(p);
+    }
+    predictor_destroy(p);
+    store(i);
+    if (checkpoint_dir && points[i].replayed == n)
+    {
+      unlink(state.c_str());
+    }
+    return records;
+  };
+
+  // Replay the 'm' records at 'at' on the 'k' predictors of a pack,
+  // adding their mispredictions to misses[]: gshare in lockstep, TAGE
+  // interleaved or reading the histories 'folds' folds for the pack, or
+  // one after the other when blocked or when predictor_predict_traces
+  // declines them
+  auto replay_together = [&](int type, predictor_t *const *live, int k, const branch_record_t *at, size_t m,
+                             bp_folds_t *folds, uint64_t *misses) {
+    if (type == GSHARE)
+    {
+      return predictor_predict_lockstep(live, k, replay_branches(at), m, misses);
+    }
+    if (folds)
+    {
+      for (size_t o = 0; o < m; o += HISTORY_FOLD_BATCH)
+      {
+        size_t q = m - o < HISTORY_FOLD_BATCH ? m - o : HISTORY_FOLD_BATCH;
+        history_fold_fill(folds, replay_branches(at + o), q);
+        for (int j = 0; j < k; j++)
+        {
+          misses[j] += predictor_predict_folded(live[j], replay_branches(at + o), folds, NULL);
+        }
+      }
+      return 1;
+    }
+    const predictor_branch_t *br[PREDICTOR_LOCKSTEP_MAX];
+    size_t len[PREDICTOR_LOCKSTEP_MAX];
+    for (int j = 0; j < k; j++)
+    {
+      br[j] = replay_branches(at);
+      len[j] = m;
+    }
+    if (!(type == CUSTOM && interleave > 1) || !predictor_predict_traces(live, k, br, len, misses))
+    {
+      // a block at a time, so the records are read from memory once
+      size_t step = block ? block : m;
+      for (size_t o = 0; o < m; o += step)
+      {
+        size_t q = m - o < step ? m - o : step;
+        for (int j = 0; j < k; j++)
+        {
+          misses[j] += predictor_predict_batch(live[j], br[j] + o, q, NULL);
+        }
+      }
+    }
+    return 1;
+  };
+
+  // Replay a pack together. Each window's time is split between the
+  // points still in it, and a point stopped early leaves the pack
+  auto replay_pack = [&](const std::vector<size_t> &pack, const branch_record_t *base, int w) {
+    const branch_record_t *warm_at = base, *at = base + nwarm;
+    predictor_t *live[PREDICTOR_LOCKSTEP_MAX];
+    size_t live_point[PREDICTOR_LOCKSTEP_MAX];
+    int k = 0;
+    for (size_t j = 0; j < pack.size(); j++)
+    {
+      predictor_t *p = predictor_create(&points[pack[j]].cfg);
+      if (!p)
+      {
+        points[pack[j]].invalid = 1;
+        continue;
+      }
+      live[k] = p;
+      live_point[k++] = pack[j];
+    }
+    uint64_t warm_misses[PREDICTOR_LOCKSTEP_MAX] = {0};
+    int type = points[pack[0]].cfg.type;
+    // the points that cannot share the folds replay them on their own
+    bp_folds_t *folds = NULL;
+    if (type == CUSTOM && shared_folds && !(interleave > 1) && k > 1)
+    {
+      folds = (bp_folds_t *)calloc(1, sizeof(bp_folds_t));
+      if (!folds)
+      {
+        fprintf(stderr, "Error: malloc failed\n");
+        exit(1);
+      }
+      for (int j = 0; j < k; j++)
+      {
+        predictor_fold_attach(live[j], folds);
+      }
+    }
+    if (k && !replay_together(type, live, k, warm_at, nwarm, folds, warm_misses))
+    {
+      fprintf(stderr, "Error: sweep points cannot replay in lockstep\n");
+      exit(1);
+    }
+    if (progress_enabled)
+    {
+      progress_add(w, nwarm * k, 0, 0);
+    }
+    uint64_t t = trace_clock_ns();
+    for (size_t off = 0; off < n && k; off += window)
+    {
+      size_t m = n - off < window ? n - off : window;
+      uint64_t branches = 0;
+      uint64_t misses[PREDICTOR_LOCKSTEP_MAX] = {0};
+      // in pieces between the --progress stores
+      size_t piece = progress_enabled ? PROGRESS_CHUNK : m;
+      for (size_t o = off; o < off + m; o += piece)
+      {
+        size_t q = off + m - o < piece ? off + m - o : piece;
+        uint64_t part[PREDICTOR_LOCKSTEP_MAX] = {0}, missed = 0;
+        BP_PROBE2(sweep_piece_start, w, live_point[0]);
+        BP_TASK_BEGIN("sweep piece");
+        uint64_t b = replay_count_conditional(at + o, q);
+        replay_together(type, live, k, at + o, q, folds, part);
+        for (int j = 0; j < k; j++)
+        {
+          misses[j] += part[j];
+          missed += part[j];
+        }
+        BP_TASK_END();
+        BP_PROBE4(sweep_piece_done, w, live_point[0], q * k, missed);
+        branches += b;
+        if (progress_enabled)
+        {
+          progress_add(w, q * k, b * k, missed);
+        }
+      }
+      uint64_t now = trace_clock_ns();
+      int kept = 0;
+      int stop[PREDICTOR_LOCKSTEP_MAX] = {0};
+      for (int j = 0; j < k; j++)
+      {
+        sweep_point_t *pt = &points[live_point[j]];
+        pt->stats.branches += branches;
+        pt->stats.mispredictions += misses[j];
+        pt->replayed += m;
+        pt->runtime_ns += (now - t) / k;
+      }
+      if (stop_window)
+      {
+        // every point of the pack got as far before any is compared,
+        // so the first ones see the others
+        std::lock_guard<std::mutex> lock(totals_lock);
+        for (int j = 0; j < k; j++)
+        {
+          points[live_point[j]].totals.push_back(points[live_point[j]].stats);
+        }
+        for (int j = 0; j < k && off + m < n; j++)
+        {
+          stop[j] = worse(live_point[j], points[live_point[j]].totals.size());
+        }
+      }
+      for (int j = 0; j < k; j++)
+      {
+        sweep_point_t *pt = &points[live_point[j]];
+        if (stop[j] || off + m == n)
+        {
+          pt->memory = predictor_memory(live[j]);
+          predictor_destroy(live[j]);
+          store(live_point[j]);
+          continue;
+        }
+        live[kept] = live[j];
+        live_point[kept++] = live_point[j];
+      }
+      k = kept;
+      t = now;
+    }
+    for (int j = 0; j < k; j++)
+    {
+      points[live_point[j]].memory = predictor_memory(live[j]);
+      predictor_destroy(live[j]);
+    }
+    free(folds);
+  };
+
+  // With --numa every node replays its own copy of the records, and
+  // each worker is pinned before it creates any predictor
+  int nodes = numa_enabled ? numa_init() : 1;
+  std::vector<const branch_record_t *> replica(nodes, warm_recs);
+  std::vector<branch_record_t *> replica_owned(nodes, (branch_record_t *)NULL);
+  for (int d = 0; d < nodes && nodes > 1; d++)
+  {
+    replica_owned[d] = numa_replicate(warm_recs, nwarm + n, d);
+    if (!replica_owned[d])
+    {
+      fprintf(stderr, "Error: malloc failed\n");
+      exit(1);
+    }
+    replica[d] = replica_owned[d];
+  }
+  std::vector<uint64_t> node_records(nodes, 0), node_done(nodes, 0);
+  std::mutex node_lock;
+  uint64_t start_ns = trace_clock_ns();
+
+  // Successive halving: every point replays the records of the first
+  // round, the best 1/'halving' of them by their mispredictions so far
+  // go on to a round 'halving' times as long, and so on until the last
+  // ones reach the end. A point keeps its predictor from one round to
+  // the next, so it continues where it stopped instead of replaying
+  // the records before again
+  std::vector<size_t> rounds; // records replayed by the end of each round
+  if (halving)
+  {
+    std::vector<size_t> alive;
+    for (size_t i = 0; i < points.size(); i++)
+    {
+      if (!points[i].over_budget && !points[i].oversized && !points[i].memoized)
+      {
+        alive.push_back(i);
+      }
+    }
+    size_t first = n;
+    for (size_t k = alive.size(); k > 1 && first / halving >= SWEEP_HALVING_MIN; k = (k + halving - 1) / halving)
+    {
+      first /= halving;
+    }
+    for (size_t len = n; len >= first; len /= halving)
+    {
+      rounds.insert(rounds.begin(), len);
+    }
+    if (progress_enabled)
+    {
+      uint64_t total = alive.size() * (uint64_t)nwarm;
+      for (size_t r = 0, k = alive.size(); r < rounds.size(); r++, k = (k + halving - 1) / halving)
+      {
+        total += k * (rounds[r] - (r ? rounds[r - 1] : 0));
+      }
+      progress_start(total, -1, 0);
+    }
+
+    std::vector<predictor_t *> live(points.size(), (predictor_t *)NULL);
+    std::vector<uint64_t> round_misses(points.size(), 0);
+    for (size_t r = 0; r < rounds.size() && !alive.empty(); r++)
+    {
+      size_t lo = r ? rounds[r - 1] : 0, hi = rounds[r];
+      std::atomic<size_t> next(0);
+      auto round_worker = [&](int w) {
+        int node = 0, cpu;
+        if (numa_enabled)
+        {
+          node = numa_place(w, &cpu);
+          numa_pin(cpu, node);
+        }
+        if (w)
+        {
+          timeline_thread("worker", w);
+        }
+        const branch_record_t *at = replica[node] + nwarm;
+        uint64_t records = 0;
+        for (size_t a; (a = next++) < alive.size();)
+        {
+          size_t i = alive[a];
+          BP_TASK_BEGIN("sweep round point");
+          if (!live[i])
+          {
+            live[i] = predictor_create(&points[i].cfg);
+            if (!live[i])
+            {
+              BP_TASK_END();
+              points[i].invalid = 1;
+              continue;
+            }
+            replay_warmup(live[i], replica[node], nwarm);
+            records += nwarm;
+            if (progress_enabled)
+            {
+              progress_add(w, nwarm, 0, 0);
+            }
+          }
+          replay_stats_t st = {0, 0};
+          uint64_t t = trace_clock_ns();
+          replay_records(live[i], at + lo, hi - lo, &st);
+          records += hi - lo;
+          if (progress_enabled)
+          {
+            progress_add(w, hi - lo, st.branches, st.mispredictions);
+          }
+          BP_TASK_END();
+          std::lock_guard<std::mutex> lock(totals_lock);
+          points[i].stats.branches += st.branches;
+          points[i].stats.mispredictions += st.mispredictions;
+          points[i].replayed = hi;
+          points[i].runtime_ns += trace_clock_ns() - t;
+          round_misses[i] = st.mispredictions;
+        }
+        std::lock_guard<std::mutex> lock(node_lock);
+        node_records[node] += records;
+        node_done[node] = trace_clock_ns() - start_ns;
+      };
+      std::vector<std::thread> threads;
+      for (int t = 1; t < jobs && t < (int)alive.size(); t++)
+      {
+        threads.push_back(std::thread(round_worker, t));
+      }
+      round_worker(0);
+      for (size_t t = 0; t < threads.size(); t++)
+      {
+        threads[t].join();
+      }
+
+      // every point replayed the same branches, so the fewest
+      // mispredictions is the lowest rate. Only those of this round
+      // count, as the larger tables are still warming up in the first
+      std::vector<size_t> ranked;
+      for (size_t a = 0; a < alive.size(); a++)
+      {
+        if (!points[alive[a]].invalid)
+        {
+          ranked.push_back(alive[a]);
+        }
+      }
+      std::stable_sort(ranked.begin(), ranked.end(), [&](size_t a, size_t b) {
+        return round_misses[a] < round_misses[b];
+      });
+      size_t keep = r + 1 < rounds.size() ? (ranked.size() + halving - 1) / halving : 0;
+      for (size_t a = keep; a < ranked.size(); a++)
+      {
+        points[ranked[a]].memory = predictor_memory(live[ranked[a]]);
+        predictor_destroy(live[ranked[a]]);
+      }
+      ranked.resize(keep);
+      alive.swap(ranked);
+    }
+  }
+
+  auto worker = [&](int w) {
+    int node = 0, cpu;
+    if (numa_enabled)
+    {
+      node = numa_place(w, &cpu);
+      numa_pin(cpu, node);
+    }
+    if (w)
+    {
+      timeline_thread("worker", w);
+    }
+    uint64_t records = 0;
+    int waiting = 0; // in an idle span
+    while (unfinished)
+    {
+      sweep_task_t task;
+      if (!take(w, &task))
+      {
+        // a long point may still split
+        if (!waiting)
+        {
+          BP_TASK_BEGIN("idle");
+          waiting = 1;
+        }
+        idle++;
+        std::this_thread::sleep_for(std::chrono::microseconds(SWEEP_IDLE_US));
+        idle--;
+        continue;
+      }
+      if (waiting)
+      {
+        BP_TASK_END();
+        waiting = 0;
+      }
+      size_t g = task.pack;
+      BP_PROBE4(sweep_task_start, w, g, task.lo, task.hi);
+      BP_TASK_BEGIN("sweep task");
+      if (memory_bytes)
+      {
+        BP_TASK_BEGIN("memory wait");
+        reserve(pack_bytes[g]);
+        BP_TASK_END();
+      }
+      if (packs[g].size() == 1)
+      {
+        records += replay_point(g, replica[node], task.lo, task.hi, w);
+      }
+      else
+      {
+        replay_pack(packs[g], replica[node], w);
+        for (size_t j = 0; j < packs[g].size(); j++)
+        {
+          records += points[packs[g][j]].invalid ? 0 : nwarm + points[packs[g][j]].replayed;
+        }
+      }
+      if (memory_bytes)
+      {
+        release(pack_bytes[g]);
+      }
+      BP_TASK_END();
+      BP_PROBE2(sweep_task_done, w, g);
+      unfinished--;
+    }
+    if (waiting)
+    {
+      BP_TASK_END();
+    }
+    std::lock_guard<std::mutex> lock(node_lock);
+    node_records[node] += records;
+    node_done[node] = trace_clock_ns() - start_ns;
+  };
+  std::vector<std::thread> threads;
+  for (int t = 1; t < jobs && !halving; t++)
+  {
+    threads.push_back(std::thread(worker, t));
+  }
+  if (!halving)
+  {
+    worker(0);
+  }
+  for (size_t t = 0; t < threads.size(); t++)
+  {
+    threads[t].join();
+  }
+  progress_stop();
+  for (int d = 0; d < nodes; d++)
+  {
+    free(replica_owned[d]);
+  }
+  for (size_t c = 0; c < columns.size(); c++)
+  {
+    featcache_release(&columns[c]);
+  }
+  free(owned);
+
+  // Every point replayed whole, in one part, goes into the store, the
+  // points of the GPU and of successive halving only now
+  size_t memoized = 0;
+  for (size_t i = 0; i < points.size() && memo_scope_id; i++)
+  {
+    memoized += points[i].memoized;
+    store(i);
+  }
+  if (store_failed)
+  {
+    fprintf(stderr, "Error: failed to write %s\n", memo_path);
+    return 0;
+  }
+
+  // Print out the table, one line per point
+  size_t stopped = 0, over = 0, oversized = 0;
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    stopped += !points[i].invalid && !points[i].over_budget && !points[i].oversized && points[i].replayed < n;
+    over += points[i].over_budget;
+    oversized += points[i].oversized;
+  }
+  if (result_format == RESULT_FORMAT_TEXT)
+  {
+    printf("Sweep:           %10zu points, %zu records, %d threads\n", points.size(), n, jobs);
+  }
+  if (numa_enabled && result_format == RESULT_FORMAT_TEXT)
+  {
+    // the records each node's points replayed, warmup included
+    std::vector<int> node_workers(nodes, 0);
+    for (int w = 0; w < jobs; w++)
+    {
+      int cpu;
+      node_workers[numa_place(w, &cpu)]++;
+    }
+    numa_report(stdout, node_workers.data(), node_records.data(), node_done.data());
+  }
+  if (memo_scope_id && result_format == RESULT_FORMAT_TEXT)
+  {
+    printf("Memoized:        %10zu points, from %s\n", memoized, memo_path);
+  }
+  if (checkpoint_dir && result_format == RESULT_FORMAT_TEXT)
+  {
+    printf("Resumed:         %10zu points, from %s\n", (size_t)resumed, checkpoint_dir);
+  }
+  if (splittable && result_format == RESULT_FORMAT_TEXT)
+  {
+    printf("Split:           %10zu times, warming %llu records\n", (size_t)splits,
+           (unsigned long long)split_warmup);
+  }
+  if (halving && result_format == RESULT_FORMAT_TEXT)
+  {
+    printf("Halving:         %10zu rounds, of", rounds.size());
+    for (size_t r = 0; r < rounds.size(); r++)
+    {
+      printf(" %zu", rounds[r]);
+    }
+    printf(" records\n");
+  }
+  if (stop_window && result_format == RESULT_FORMAT_TEXT)
+  {
+    printf("Stopped early:   %10zu points, windows of %zu records\n", stopped, window);
+  }
+  if (budget_bits && result_format == RESULT_FORMAT_TEXT)
+  {
+    printf("Over budget:     %10zu points, above %llu bits\n", over, (unsigned long long)budget_bits);
+  }
+  if (stat && result_format == RESULT_FORMAT_TEXT)
+  {
+    printf("Oversized:       %10zu points, tables over %llux the trace's working set\n", oversized,
+           (unsigned long long)prune_factor);
+  }
+  std::vector<result_row_t> rows(points.size());
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    result_row_t *r = &rows[i];
+    r->kind = RESULT_SWEEP;
+    r->index = point_index[i];
+    r->type = points[i].cfg.type;
+    r->status = points[i].over_budget ? RESULT_OVER_BUDGET
+                : points[i].oversized ? RESULT_OVERSIZED
+                : points[i].invalid   ? RESULT_INVALID
+                                      : RESULT_OK;
+    r->stats = points[i].stats;
+    r->replayed = points[i].invalid || points[i].over_budget || points[i].oversized ? n : points[i].replayed;
+    r->records = n;
+    r->runtime_ns = points[i].runtime_ns;
+    r->memory = points[i].memory;
+    r->budget_bits = points[i].budget;
+    r->name = path ? path : "-";
+    r->params = points[i].params;
+    char config[256];
+    predictor_config_format(&points[i].cfg, config, sizeof(config));
+    r->config = config;
+  }
+  int ok = results_report(rows);
+
+  if (profile_top)
+  {
+    std::vector<const pc_counts_t *> profiles;
+    std::vector<std::string> names;
+    for (size_t i = 0; i < points.size(); i++)
+    {
+      if (!points[i].invalid && !points[i].over_budget && !points[i].oversized)
+      {
+        profiles.push_back(&points[i].misses);
+        names.push_back(std::string(bpName[points[i].cfg.type]) + " " + points[i].params);
+      }
+    }
+    std::vector<const char *> name_ptrs;
+    for (const std::string &name : names)
+    {
+      name_ptrs.push_back(name.c_str());
+    }
+    if (pprof_path && !pc_profile_write_pprof(pprof_path, &execs, profiles.data(), name_ptrs.data(),
+                                              (int)profiles.size(), pc_map.pcs, pprof_symbols))
+    {
+      fprintf(stderr, "Error: failed to write %s\n", pprof_path);
+      ok = 0;
+    }
+    for (size_t i = 0; i < points.size(); i++)
+    {
+      if (!points[i].invalid && !points[i].over_budget && !points[i].oversized)
+      {
+        printf("\n%s %s:\n", bpName[points[i].cfg.type], points[i].params.c_str());
+        pc_profile_print(&execs, &points[i].misses, pc_map.pcs, profile_top);
+      }
+      pc_counts_free(&points[i].misses);
+    }
+    pc_counts_free(&execs);
+    pc_map_free(&pc_map);
+  }
+  return ok;
+}
@@ -0,0 +1,152 @@
+//========================================================//
+//  sweep.h                                               //
+//  Header file for the predictor parameter sweep         //
+//                                                        //
+//  Replays one decoded trace on a predictor instance     //
+//  per configuration point, spread over worker threads   //
+//========================================================//
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdint.h>
+#include "predictor.h"
+#include "trace.h"
+#include "tracestat.h"
+
+// Add the range of one --sweep=<type>.<param>=<values> option, where
+// values is lo..hi, lo..hi:step or a comma separated list. Ranges
+// of the same type multiply, the points of different types add up.
+//
+// Returns True if Successful
+//
+int sweep_add(const char *spec);
+
+// Returns True if any sweep range was given
+//
+int sweep_active();
+
+// Early stop: points replay in windows of 'stop_window' records, or
+// 1/SWEEP_STOP_WINDOWS of the trace with SWEEP_STOP_AUTO. The windows
+// of the first SWEEP_STOP_WARMUP percent of the trace, while larger
+// tables still fill, are not compared. After SWEEP_STOP_MIN_WINDOWS
+// more a point stops once the 95% interval of its rate minus that of
+// the best point over the same windows, the last SWEEP_STOP_RECENT,
+// lies above SWEEP_STOP_MARGIN percent of the best point's rate
+#define SWEEP_STOP_AUTO ~0ULL
+#define SWEEP_STOP_WINDOWS 100
+#define SWEEP_STOP_MIN_WINDOWS 10
+#define SWEEP_STOP_WARMUP 20
+#define SWEEP_STOP_RECENT 20
+#define SWEEP_STOP_MARGIN 5
+
+// With the statistics of the trace a point is oversized, and skipped,
+// when its PC and history indexed table has more than this many times
+// the entries the trace can fill, see sweep_run
+#define SWEEP_PRUNE_FACTOR 256
+
+// With --sweep-split, records a point split off trains on first by
+// default, records between checks for an idle worker, and fewest
+// counted records of each half of a split
+#define SWEEP_SPLIT_WARMUP 1000000
+#define SWEEP_SPLIT_STEP (1 << 20)
+#define SWEEP_SPLIT_MIN (1 << 22)
+
+// Microseconds a worker with nothing to take waits before looking again
+#define SWEEP_IDLE_US 200
+
+// Default fraction --sweep-halving keeps after each round, 1/2, and
+// fewest records of its first round
+#define SWEEP_HALVING 2
+#define SWEEP_HALVING_MIN (1 << 16)
+
+// Points --sweep-interleave packs by default: more TAGE predictors
+// than that take turns slower than they replay one by one
+#define SWEEP_INTERLEAVE 2
+
+// Records --sweep-block replays on each point of a pack in turn by
+// default: 64K of them, 576 KB, stay in a core's L2 cache
+#define SWEEP_BLOCK (1 << 16)
+
+// Seconds between the snapshots --sweep-checkpoint takes of a point
+// by default
+#define SWEEP_CHECKPOINT_SECONDS 600
+
+// The configurations of this shard's sweep points that sweep_run
+// replays with 'budget_bits', 'stat' and 'prune_factor', leaving out
+// those over budget or oversized, into '*cfgs', allocated with malloc
+//
+// Returns their count
+//
+size_t sweep_configs(uint64_t budget_bits, const trace_stat_t *stat, uint64_t prune_factor,
+                     predictor_config_t **cfgs);
+
+// Replay up to 'count' records of 'tr', opened from 'path', after
+// 'warmup' records that only train, once per sweep point on 'jobs'
+// threads (0 for one per core) and print the results, followed by
+// the 'profile_top' most mispredicted branches of each point when it
+// is not 0, also written to 'pprof_path' unless NULL with the symbols
+// of 'pprof_symbols', see pc_profile_write_pprof. Points are stopped
+// early as above unless 'stop_window' is 0. With --shard only the points of this shard are replayed, see
+// results.h. With 'gpu' the points gpusweep.h supports replay on an
+// OpenCL device when there is one, and are never stopped early.
+// Points needing more than 'budget_bits' of storage (see
+// predictor_budget_bits) are reported over budget without replaying
+// them, and with 'memory_bytes' a worker only creates its predictors
+// while those of all workers fit in that many bytes; 0 for no limit.
+// With 'stat', the statistics of the trace from its sidecar, gshare
+// and perceptron points whose table has more than 'prune_factor' times
+// the entries of the distinct (PC, history) pairs or PCs it is indexed
+// by are reported oversized without replaying them: nearly all of such
+// a table is never used, though a gshare point may still gain from its
+// longer history. Tournament and TAGE tables are never pruned. With
+// 'interleave' above 1, TAGE points replay in packs of up to that many
+// on a worker, taking a branch each in turn so each one's table misses
+// overlap the others' lookups, see predictor_predict_traces. Else with
+// 'shared_folds', TAGE points replay in packs of up to
+// PREDICTOR_LOCKSTEP_MAX on a worker whose folded histories, one per
+// distinct history length and width, are folded once per batch of
+// records and read by every point of the pack, see
+// predictor_predict_folded. With
+// 'block', the other points but gshare's and those 'interleave' packs
+// replay in packs of up to PREDICTOR_LOCKSTEP_MAX, each point of a
+// pack replaying 'block' records in turn, so the pack reads the trace
+// from memory once while it is cached. Workers
+// take the points costliest first, by their memory footprint, from
+// their own queue or another's. With 'split_warmup' and neither early
+// stop nor 'profile_top', a point alone splits the rest of its records
+// while a worker is idle, the new part training on the 'split_warmup'
+// records before it, so its rate is close to but not exactly that of
+// one replay. With 'memo_scope_id', see memo_scope, points the --memo
+// store holds are printed from it without replaying them, and those
+// replayed whole without a profile are added to it. With 'halving',
+// and neither early stop, 'split_warmup', 'profile_top' nor 'gpu',
+// the points instead replay alone in rounds by successive halving:
+// each round is 'halving' times as long as the one before and only
+// the best 1/'halving' of its points go on to the next, the first
+// as short as leaves one point for the last round, which ends with
+// the trace, but no shorter than SWEEP_HALVING_MIN records. With
+// 'checkpoint_dir', and 'memo_scope_id' but neither early stop,
+// 'split_warmup', 'profile_top' nor 'halving', a point replaying alone
+// saves its predictor, counts and position to a snapshot in that
+// directory every 'checkpoint_ns' (see checkpoint_save_point) and
+// resumes from it when the sweep is run again; every point goes into
+// the store the moment it completes. Its snapshot is named by its
+// store key, so only the same trace window, configuration and build
+// resume from it. TAGE and blocked points then replay alone. With
+// 'feature_dir', and neither 'profile_top', 'checkpoint_dir' nor
+// 'halving', a
+// tournament point replaying alone with one local way takes its local
+// histories from a column of the feature cache in that directory (see
+// featcache.h), computed once per geometry for these records and
+// mapped by later sweeps, with the same results.
+//
+// Returns True if Successful
+//
+int sweep_run(trace_reader_t *tr, const char *path, uint64_t warmup, uint64_t count, int jobs, int profile_top,
+              const char *pprof_path, const char *pprof_symbols, uint64_t stop_window, int gpu, uint64_t budget_bits,
+              uint64_t memory_bytes, const trace_stat_t *stat, uint64_t prune_factor, int interleave, int shared_folds, uint64_t block, uint64_t split_warmup,
+              const char *memo_scope_id, int halving, const char *checkpoint_dir, uint64_t checkpoint_ns,
+              const char *feature_dir);
+
+#endif
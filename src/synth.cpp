@@ -0,0 +1,340 @@
+//========================================================//
+//  synth.cpp                                             //
+//  Source file for the synthetic trace generator         //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+#include "synth.h"
+
+// Static branches are laid out from SYNTH_PC, 16 bytes apart, and the
+// calls into the loop nests from SYNTH_CALLER_PC
+#define SYNTH_PC 0x400000u
+#define SYNTH_CALLER_PC 0x300000u
+#define SYNTH_STRIDE 16u
+
+// Salts keeping the random streams of the patterns apart
+#define SYNTH_SALT_BIAS   0x62696173ULL
+#define SYNTH_SALT_PERIOD 0x70657264ULL
+#define SYNTH_SALT_LOOP   0x6c6f6f70ULL
+#define SYNTH_SALT_PICK   0x7069636bULL
+#define SYNTH_SALT_PAIR   0x70616972ULL
+#define SYNTH_SALT_FILL   0x66696c6cULL
+#define SYNTH_SALT_MIX    0x6d697865ULL
+
+const char *synth_pattern_names[SYNTH_PATTERNS] = {"loops", "biased", "correlated", "periodic", "mix"};
+
+// Random 64 bits number 'k' of the stream 'seed'
+static inline uint64_t synth_hash(uint64_t seed, uint64_t k)
+{
+  uint64_t x = seed + 0x9e3779b97f4a7c15ULL * (k + 1);
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// 'r' scaled to [0, n)
+static inline uint32_t synth_pick(uint32_t r, uint32_t n)
+{
+  return (uint32_t)(((uint64_t)r * n) >> 32);
+}
+
+static inline uint32_t synth_branch_pc(uint32_t id)
+{
+  return SYNTH_PC + id * SYNTH_STRIDE;
+}
+
+static inline char *synth_put(char *p, uint32_t pc, uint32_t target, uint8_t flags)
+{
+  memcpy(p, &pc, 4);
+  memcpy(p + 4, &target, 4);
+  p[8] = flags;
+  return p + SYNTH_RECORD_SIZE;
+}
+
+// A conditional branch jumping forward when taken
+static inline char *synth_put_cond(char *p, uint32_t id, int taken)
+{
+  uint32_t pc = synth_branch_pc(id);
+  return synth_put(p, pc, pc + 0x40, TRACE_F_CONDITION | TRACE_F_DIRECT | (taken ? TRACE_F_TAKEN : 0));
+}
+
+// A loop back edge
+static inline char *synth_put_back(char *p, uint32_t id, int taken)
+{
+  uint32_t pc = synth_branch_pc(id);
+  return synth_put(p, pc, pc - 0x100, TRACE_F_CONDITION | TRACE_F_DIRECT | (taken ? TRACE_F_TAKEN : 0));
+}
+
+int synth_parse_count(const char *s, uint64_t *val)
+{
+  char *end;
+  uint64_t v = strtoull(s, &end, 0);
+  if (end == s)
+  {
+    return 0;
+  }
+  if (*end == 'k' || *end == 'K')
+  {
+    v *= 1000ULL;
+    end++;
+  }
+  else if (*end == 'M')
+  {
+    v *= 1000000ULL;
+    end++;
+  }
+  else if (*end == 'G')
+  {
+    v *= 1000000000ULL;
+    end++;
+  }
+  *val = v;
+  return *end == '\0' || *end == ',';
+}
+
+int synth_parse(const char *spec, synth_config_t *cfg)
+{
+  cfg->pattern = -1;
+  cfg->seed = 1;
+  cfg->records = SYNTH_RECORDS;
+  cfg->branches = SYNTH_BRANCHES;
+  cfg->period = SYNTH_PERIOD;
+  size_t len = strcspn(spec, ",");
+  for (int p = 0; p < SYNTH_PATTERNS; p++)
+  {
+    if (strlen(synth_pattern_names[p]) == len && !strncmp(spec, synth_pattern_names[p], len))
+    {
+      cfg->pattern = p;
+    }
+  }
+  if (cfg->pattern < 0)
+  {
+    return 0;
+  }
+  for (const char *p = spec + len; *p == ','; p += strcspn(p + 1, ",") + 1)
+  {
+    const char *key = p + 1;
+    const char *eq = strchr(key, '=');
+    uint64_t v;
+    if (!eq || !synth_parse_count(eq + 1, &v))
+    {
+      return 0;
+    }
+    size_t klen = eq - key;
+    if (klen == 7 && !strncmp(key, "records", 7))
+    {
+      cfg->records = v;
+    }
+    else if (klen == 4 && !strncmp(key, "seed", 4))
+    {
+      cfg->seed = v;
+    }
+    else if (klen == 8 && !strncmp(key, "branches", 8) && v <= (1u << 24))
+    {
+      cfg->branches = (uint32_t)v;
+    }
+    else if (klen == 6 && !strncmp(key, "period", 6) && v <= (1u << 30))
+    {
+      cfg->period = (uint32_t)v;
+    }
+    else
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Lay out one pass over the loop nests: a call, then 'outer' times
+// the inner loop of 'inner' iterations with its body branch and the
+// outer back edge, then the return
+//
+static void synth_build_loops(synth_t *s)
+{
+  uint32_t nests = s->cfg.branches / 3;
+  nests = nests < SYNTH_LOOP_NESTS ? nests : SYNTH_LOOP_NESTS;
+  uint32_t outer[SYNTH_LOOP_NESTS], inner[SYNTH_LOOP_NESTS], every[SYNTH_LOOP_NESTS];
+  s->loop_len = 0;
+  for (uint32_t n = 0; n < nests; n++)
+  {
+    uint64_t h = synth_hash(s->cfg.seed ^ SYNTH_SALT_LOOP, n);
+    outer[n] = 2 + (h & 0xffff) % 15;
+    inner[n] = 1 + ((h >> 16) & 0xffff) % 64;
+    every[n] = 1 + ((h >> 32) & 0xffff) % 4;
+    s->loop_len += 2 + outer[n] * (2 * inner[n] + 1);
+  }
+  s->loop = (char *)malloc(s->loop_len * SYNTH_RECORD_SIZE);
+  char *p = s->loop;
+  for (uint32_t n = 0; n < nests; n++)
+  {
+    uint32_t body = 3 * n, back = 3 * n + 1, exit = 3 * n + 2;
+    uint32_t call = SYNTH_CALLER_PC + n * SYNTH_STRIDE;
+    p = synth_put(p, call, synth_branch_pc(body) - 0x20, TRACE_F_CALL | TRACE_F_DIRECT | TRACE_F_TAKEN);
+    for (uint32_t o = 0; o < outer[n]; o++)
+    {
+      for (uint32_t i = 0; i < inner[n]; i++)
+      {
+        p = synth_put_cond(p, body, i % every[n] == 0);
+        p = synth_put_back(p, back, i + 1 < inner[n]);
+      }
+      p = synth_put_back(p, exit, o + 1 < outer[n]);
+    }
+    p = synth_put(p, synth_branch_pc(exit) + 8, call + 5, TRACE_F_RET | TRACE_F_TAKEN);
+  }
+}
+
+synth_t *synth_open(const synth_config_t *cfg)
+{
+  if (cfg->pattern < 0 || cfg->pattern >= SYNTH_PATTERNS || cfg->branches < 4 || cfg->period < 2)
+  {
+    return NULL;
+  }
+  synth_t *s = (synth_t *)calloc(1, sizeof(synth_t));
+  s->cfg = *cfg;
+  s->bias = (uint32_t *)malloc(cfg->branches * sizeof(uint32_t));
+  if (!s->bias)
+  {
+    synth_close(s);
+    return NULL;
+  }
+
+  // A quarter each nearly always, mostly, often one way, and at random
+  static const double taken[4] = {0.999, 0.95, 0.75, 0.5};
+  for (uint32_t i = 0; i < cfg->branches; i++)
+  {
+    uint64_t h = synth_hash(cfg->seed ^ SYNTH_SALT_BIAS, i);
+    double p = taken[h & 3];
+    p = h & 4 ? p : 1 - p;
+    s->bias[i] = (uint32_t)(p * 4294967295.0);
+  }
+  synth_build_loops(s);
+  if (!s->loop)
+  {
+    synth_close(s);
+    return NULL;
+  }
+  return s;
+}
+
+static void synth_gen_loops(const synth_t *s, uint64_t k, char *out, size_t n)
+{
+  uint64_t at = k % s->loop_len;
+  while (n)
+  {
+    size_t run = s->loop_len - at < n ? s->loop_len - at : n;
+    memcpy(out, s->loop + at * SYNTH_RECORD_SIZE, run * SYNTH_RECORD_SIZE);
+    out += run * SYNTH_RECORD_SIZE;
+    n -= run;
+    at = 0;
+  }
+}
+
+static void synth_gen_biased(const synth_t *s, uint64_t k, char *out, size_t n)
+{
+  uint64_t seed = s->cfg.seed ^ SYNTH_SALT_PICK;
+  for (size_t i = 0; i < n; i++)
+  {
+    uint64_t h = synth_hash(seed, k + i);
+    uint32_t id = synth_pick((uint32_t)(h >> 32), s->cfg.branches);
+    out = synth_put_cond(out, id, (uint32_t)h < s->bias[id]);
+  }
+}
+
+// Pairs are the branches 2j and 2j + 1 below 2 * pairs, the branches
+// above them fill the group between and after the pair
+static void synth_gen_correlated(const synth_t *s, uint64_t k, char *out, size_t n)
+{
+  uint32_t pairs = s->cfg.branches / 4;
+  uint32_t fillers = s->cfg.branches - 2 * pairs;
+  for (size_t i = 0; i < n; i++)
+  {
+    uint64_t g = (k + i) / SYNTH_CORR_GROUP;
+    uint32_t slot = (uint32_t)((k + i) % SYNTH_CORR_GROUP);
+    uint64_t hg = synth_hash(s->cfg.seed ^ SYNTH_SALT_PICK, g);
+    uint32_t j = synth_pick((uint32_t)(hg >> 32), pairs);
+    uint64_t hj = synth_hash(s->cfg.seed ^ SYNTH_SALT_PAIR, j);
+    uint32_t distance = 1 + (uint32_t)(hj % (SYNTH_CORR_GROUP - 2));
+    if (slot == 0)
+    {
+      out = synth_put_cond(out, 2 * j, hg & 1);
+    }
+    else if (slot == distance + 1)
+    {
+      out = synth_put_cond(out, 2 * j + 1, (hg ^ (hj >> 32)) & 1);
+    }
+    else
+    {
+      uint64_t h = synth_hash(s->cfg.seed ^ SYNTH_SALT_FILL, k + i);
+      uint32_t id = 2 * pairs + synth_pick((uint32_t)(h >> 32), fillers);
+      out = synth_put_cond(out, id, (uint32_t)h < s->bias[id]);
+    }
+  }
+}
+
+static void synth_gen_periodic(const synth_t *s, uint64_t k, char *out, size_t n)
+{
+  uint64_t seed = s->cfg.seed ^ SYNTH_SALT_PERIOD;
+  uint32_t at = (uint32_t)(k % s->cfg.period);
+  for (size_t i = 0; i < n; i++)
+  {
+    uint64_t h = synth_hash(seed, at);
+    out = synth_put_cond(out, synth_pick((uint32_t)(h >> 32), s->cfg.branches), h & 1);
+    at = at + 1 < s->cfg.period ? at + 1 : 0;
+  }
+}
+
+static void synth_gen(const synth_t *s, int pattern, uint64_t k, char *out, size_t n)
+{
+  switch (pattern)
+  {
+  case SYNTH_LOOPS:
+    synth_gen_loops(s, k, out, n);
+    break;
+  case SYNTH_BIASED:
+    synth_gen_biased(s, k, out, n);
+    break;
+  case SYNTH_CORRELATED:
+    synth_gen_correlated(s, k, out, n);
+    break;
+  case SYNTH_PERIODIC:
+    synth_gen_periodic(s, k, out, n);
+    break;
+  }
+}
+
+void synth_generate(const synth_t *s, uint64_t first, char *out, size_t n)
+{
+  if (s->cfg.pattern != SYNTH_MIX)
+  {
+    synth_gen(s, s->cfg.pattern, first, out, n);
+    return;
+  }
+  // the pattern of each segment is drawn from the others
+  while (n)
+  {
+    uint64_t seg = first / SYNTH_MIX_SEGMENT;
+    size_t run = (seg + 1) * SYNTH_MIX_SEGMENT - first;
+    run = run < n ? run : n;
+    synth_gen(s, (int)(synth_hash(s->cfg.seed ^ SYNTH_SALT_MIX, seg) % SYNTH_MIX), first, out, run);
+    first += run;
+    out += run * SYNTH_RECORD_SIZE;
+    n -= run;
+  }
+}
+
+void synth_close(synth_t *s)
+{
+  if (!s)
+  {
+    return;
+  }
+  free(s->bias);
+  free(s->loop);
+  free(s);
+}
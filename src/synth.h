@@ -0,0 +1,98 @@
+//========================================================//
+//  synth.h                                               //
+//  Header file for the synthetic trace generator         //
+//                                                        //
+//  Every record is a function of the seed and its branch //
+//  number alone, so threads generate any part of a trace //
+//  independently and the result never depends on how    //
+//  many there are. bpgen writes them as a binary trace,  //
+//  and trace_open reads synth:<pattern>[,key=value...]   //
+//  in-process without a file                             //
+//========================================================//
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Path prefix of an in-process synthetic trace
+#define SYNTH_PREFIX "synth:"
+#define SYNTH_PREFIX_LEN 6
+
+// Patterns
+//  - loops: nests of an outer loop around an inner one, each with a
+//    body branch and entered by a call, trip counts fixed per nest
+//  - biased: branches picked at random, each taken with its own
+//    probability, mostly strongly biased
+//  - correlated: a random branch, then others, then one that repeats
+//    or inverts its outcome 1 to 16 branches later
+//  - periodic: a random sequence of 'period' records, branches and
+//    outcomes, repeated: each position needs its own long history
+//  - mix: the others by turns in segments of SYNTH_MIX_SEGMENT
+#define SYNTH_LOOPS      0
+#define SYNTH_BIASED     1
+#define SYNTH_CORRELATED 2
+#define SYNTH_PERIODIC   3
+#define SYNTH_MIX        4
+#define SYNTH_PATTERNS   5
+
+#define SYNTH_RECORDS 100000000ULL // default length
+#define SYNTH_BRANCHES 1024        // default static branches
+#define SYNTH_PERIOD 1024          // default period of periodic
+#define SYNTH_MIX_SEGMENT (1 << 16)
+#define SYNTH_LOOP_NESTS 64        // most nests of the loop pattern
+#define SYNTH_CORR_GROUP 18        // records from one correlated pair to the next
+
+// Records are packed branch_record_t of the binary trace format
+#define SYNTH_RECORD_SIZE 9
+
+extern const char *synth_pattern_names[SYNTH_PATTERNS];
+
+typedef struct
+{
+  int pattern;       // SYNTH_*
+  uint64_t seed;
+  uint64_t records;  // length of the trace
+  uint32_t branches; // static conditional branches
+  uint32_t period;   // records of the periodic pattern's sequence
+} synth_config_t;
+
+typedef struct
+{
+  synth_config_t cfg;
+  uint32_t *bias;    // taken threshold of each branch, out of 2^32
+  char *loop;        // records of one pass over the loop nests
+  uint64_t loop_len;
+} synth_t;
+
+// Parse the count 's', up to a comma or the end, with an optional k,
+// M or G suffix
+//
+// Returns True if Successful
+//
+int synth_parse_count(const char *s, uint64_t *val);
+
+// Parse "<pattern>[,records=<n>][,seed=<n>][,branches=<n>][,period=<n>]"
+// into 'cfg', with the defaults for the keys left out
+//
+// Returns True if Successful
+//
+int synth_parse(const char *spec, synth_config_t *cfg);
+
+// Build the branch tables of 'cfg'
+//
+// Returns NULL if the configuration is invalid
+//
+synth_t *synth_open(const synth_config_t *cfg);
+
+// Generate records 'first' to 'first' + 'n' - 1 into 'out', packed,
+// the caller keeping them within the length of the trace
+//
+void synth_generate(const synth_t *s, uint64_t first, char *out, size_t n);
+
+// Release 's'
+//
+void synth_close(synth_t *s);
+
+#endif
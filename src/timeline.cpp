@@ -0,0 +1,209 @@
+//========================================================//
+//  timeline.cpp                                          //
+//  Source file for the --timeline span recorder          //
+//                                                        //
+//  Each thread appends to a list of chunks only it       //
+//  writes, publishing every event with a release store   //
+//  of the chunk's count, so the writer at exit reads a   //
+//  consistent prefix even of threads still running. A    //
+//  thread takes the registry lock once, for its first    //
+//  event                                                 //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "timeline.h"
+
+// Events per chunk, 64 KB
+#define TIMELINE_CHUNK 4096
+
+typedef struct
+{
+  uint64_t ns;      // since timeline_open
+  const char *name; // NULL for an end
+} timeline_event_t;
+
+struct timeline_chunk
+{
+  timeline_event_t events[TIMELINE_CHUNK];
+  std::atomic<uint32_t> used;
+  std::atomic<timeline_chunk *> next;
+};
+
+typedef struct
+{
+  timeline_chunk *head, *tail;
+  char name[64];
+  int tid; // track number, from 1 in order of the first events
+} timeline_track_t;
+
+int timeline_on = 0;
+
+static FILE *timeline_file;
+static uint64_t timeline_start_ns;
+static std::mutex timeline_lock;
+static std::vector<timeline_track_t *> timeline_tracks;
+static thread_local timeline_track_t *timeline_self;
+
+static inline uint64_t timeline_clock_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static timeline_chunk *timeline_chunk_new()
+{
+  timeline_chunk *c = new timeline_chunk();
+  c->used.store(0, std::memory_order_relaxed);
+  c->next.store(NULL, std::memory_order_relaxed);
+  return c;
+}
+
+// The track of the calling thread, registered on its first call
+//
+static timeline_track_t *timeline_track()
+{
+  if (!timeline_self)
+  {
+    timeline_track_t *t = new timeline_track_t();
+    t->head = t->tail = timeline_chunk_new();
+    t->name[0] = '\0';
+    std::lock_guard<std::mutex> guard(timeline_lock);
+    timeline_tracks.push_back(t);
+    t->tid = (int)timeline_tracks.size();
+    timeline_self = t;
+  }
+  return timeline_self;
+}
+
+static void timeline_exit()
+{
+  timeline_write();
+}
+
+int timeline_open(const char *path)
+{
+  timeline_file = fopen(path, "w");
+  if (!timeline_file)
+  {
+    fprintf(stderr, "Error: can not create %s\n", path);
+    return 0;
+  }
+  timeline_start_ns = timeline_clock_ns();
+  timeline_on = 1;
+  timeline_thread("main", -1);
+  atexit(timeline_exit);
+  return 1;
+}
+
+void timeline_thread(const char *name, int index)
+{
+  if (!timeline_on)
+  {
+    return;
+  }
+  timeline_track_t *t = timeline_track();
+  if (index < 0)
+  {
+    snprintf(t->name, sizeof(t->name), "%s", name);
+  }
+  else
+  {
+    snprintf(t->name, sizeof(t->name), "%s %d", name, index);
+  }
+}
+
+void timeline_event(const char *name)
+{
+  timeline_track_t *t = timeline_track();
+  timeline_chunk *c = t->tail;
+  uint32_t used = c->used.load(std::memory_order_relaxed);
+  if (used == TIMELINE_CHUNK)
+  {
+    timeline_chunk *next = timeline_chunk_new();
+    c->next.store(next, std::memory_order_release);
+    t->tail = c = next;
+    used = 0;
+  }
+  if (name && !t->name[0])
+  {
+    snprintf(t->name, sizeof(t->name), "%s", name);
+  }
+  c->events[used].ns = timeline_clock_ns() - timeline_start_ns;
+  c->events[used].name = name;
+  c->used.store(used + 1, std::memory_order_release);
+}
+
+// Write 's' as a JSON string
+//
+static void timeline_string(FILE *out, const char *s)
+{
+  fputc('"', out);
+  for (; *s; s++)
+  {
+    if (*s == '"' || *s == '\\')
+    {
+      fputc('\\', out);
+    }
+    fputc((unsigned char)*s < 0x20 ? ' ' : *s, out);
+  }
+  fputc('"', out);
+}
+
+int timeline_write()
+{
+  if (!timeline_file)
+  {
+    return 1;
+  }
+  FILE *out = timeline_file;
+  timeline_file = NULL;
+  int pid = (int)getpid();
+  std::vector<timeline_track_t *> tracks;
+  {
+    std::lock_guard<std::mutex> guard(timeline_lock);
+    tracks = timeline_tracks;
+  }
+
+  // A metadata event naming each track, then its spans in order
+  fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  fprintf(out, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"predictor\"}}", pid);
+  for (size_t k = 0; k < tracks.size(); k++)
+  {
+    timeline_track_t *t = tracks[k];
+    fprintf(out, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": ", pid,
+            t->tid);
+    timeline_string(out, t->name[0] ? t->name : "thread");
+    fprintf(out, "}}");
+    for (timeline_chunk *c = t->head; c; c = c->next.load(std::memory_order_acquire))
+    {
+      uint32_t used = c->used.load(std::memory_order_acquire);
+      for (uint32_t i = 0; i < used; i++)
+      {
+        const timeline_event_t *e = &c->events[i];
+        fprintf(out, ",\n{\"ph\": \"%c\", \"ts\": %llu.%03u, \"pid\": %d, \"tid\": %d", e->name ? 'B' : 'E',
+                (unsigned long long)(e->ns / 1000), (unsigned)(e->ns % 1000), pid, t->tid);
+        if (e->name)
+        {
+          fprintf(out, ", \"name\": ");
+          timeline_string(out, e->name);
+        }
+        fprintf(out, "}");
+      }
+    }
+  }
+  fprintf(out, "\n]}\n");
+  if (fclose(out))
+  {
+    fprintf(stderr, "Error: writing the timeline failed\n");
+    return 0;
+  }
+  return 1;
+}
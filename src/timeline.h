@@ -0,0 +1,62 @@
+//========================================================//
+//  timeline.h                                            //
+//  Header file for the --timeline span recorder          //
+//                                                        //
+//  The spans the replay probes mark (see probes.h), the  //
+//  waits on the trace and pipeline rings and the idle    //
+//  time of sweep workers are recorded as begin and end   //
+//  events, each thread into buffers of its own without   //
+//  a lock, and written at exit as a Chrome trace event   //
+//  JSON file, which Perfetto and chrome://tracing load   //
+//  with one track per thread                             //
+//========================================================//
+
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdint.h>
+
+// Set once the timeline is recording
+extern int timeline_on;
+
+// Record from now on and write the timeline to 'path' at exit
+//
+// Returns True if Successful
+//
+int timeline_open(const char *path);
+
+// Name the track of the calling thread 'name' and 'index', e.g.
+// "worker" and 3; an unnamed track takes the name of its first span
+//
+void timeline_thread(const char *name, int index);
+
+// Append a begin event of span 'name', a string literal, or with
+// 'name' NULL the end of the innermost open span, to the buffers of
+// the calling thread
+//
+void timeline_event(const char *name);
+
+static inline void timeline_begin(const char *name)
+{
+  if (timeline_on)
+  {
+    timeline_event(name);
+  }
+}
+
+static inline void timeline_end()
+{
+  if (timeline_on)
+  {
+    timeline_event(0);
+  }
+}
+
+// Write the events recorded so far to the file of timeline_open,
+// which exit does too
+//
+// Returns True if Successful
+//
+int timeline_write();
+
+#endif
@@ -0,0 +1,429 @@
+//========================================================//
+//  tobin.cpp                                             //
+//  Converts branch traces to the binary formats          //
+//                                                        //
+//  ./tobin trace.bz2 trace.bin                           //
+//  ./tobin --codec=zstd trace.bz2 trace.bpz              //
+//  ./tobin --columnar --codec=zstd trace.bz2 trace.bpz   //
+//  ./tobin --pc-ids trace.bz2 trace.bin                  //
+//  ./tobin --static trace.bz2 trace.bin                  //
+//  ./tobin --conditional-only trace.bz2 cond.bin         //
+//  ./tobin --out-dir=bin ../traces/*.bz2                 //
+//                                                        //
+//  Text is read in chunks of whole lines that threads    //
+//  parse at once, written in order; --out-dir converts   //
+//  several traces at a time, skipping up to date ones    //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "trace.h"
+#include "codec.h"
+#include "history.h"
+
+void usage()
+{
+  fprintf(stderr, "Usage: tobin [options] <input trace|-> <output>\n");
+  fprintf(stderr, "       tobin [options] --out-dir=<dir> <input trace>...\n");
+  fprintf(stderr, "       bunzip2 -kc trace.bz2 | tobin - trace.bin\n");
+  fprintf(stderr, " Options:\n");
+  fprintf(stderr, " --codec=<none|zstd|lz4>  Write a seekable framed trace\n");
+  fprintf(stderr, " --columnar               Delta encode framed traces in columns\n");
+  fprintf(stderr, " --pc-ids                 Store a dense id per branch PC (plain format)\n");
+  fprintf(stderr, " --static                 Store a static table by PC id and runs of\n");
+  fprintf(stderr, "                          repeated records (plain format, version 3)\n");
+  fprintf(stderr, " --conditional-only       Keep only the conditional branches\n");
+  fprintf(stderr, " --gap-summary            and a summary of the path and target bits of\n");
+  fprintf(stderr, "                          the others between them\n");
+  fprintf(stderr, " --level=<n>              Compression level (default 3)\n");
+  fprintf(stderr, " --frame=<n>              Records per frame (default %d)\n", TRACE_FRAME_RECORDS);
+  fprintf(stderr, " --threads=<n>            Threads in all (default one per core)\n");
+  fprintf(stderr, " --out-dir=<dir>          Write <dir>/<name>.bin (.bpz with a codec) for\n");
+  fprintf(stderr, "                          each input, unless newer than the input\n");
+  fprintf(stderr, " --jobs=<n>               Inputs converted at once (default one per\n");
+  fprintf(stderr, "                          thread), sharing the threads\n");
+  fprintf(stderr, " --force                  Convert inputs that are up to date too\n");
+}
+
+// Text bytes parsed at a time by a thread
+#define TOBIN_CHUNK (8 << 20)
+
+// Output format, from the options
+int codec = -1;
+int layout = TRACE_LAYOUT_ROWS;
+int pc_ids = 0;
+int statics = 0;
+int conditional = 0; // 1 for --conditional-only, 2 with --gap-summary
+int level = 3;
+size_t frame_records = TRACE_FRAME_RECORDS;
+
+// Unconditional branches since the last conditional one, of which only
+// the last 32 still reach the 64-bit path and target histories
+typedef struct
+{
+  uint64_t count;
+  uint8_t path[32];   // low PC bits, by count modulo 32
+  uint8_t target[32]; // target bits
+  uint8_t taken[32];
+} gap_t;
+
+// Copy the conditional branches of the 'n' records of 'in' to 'out',
+// with 'summary' preceded by the TRACE_F_SUMMARY records of the gap
+// before each; 'out' holds n + 3 records, as a gap takes no more
+// records than it has branches but the last one of a batch three
+//
+// Returns the number of records in 'out'
+//
+static size_t project_conditional(const branch_record_t *in, size_t n, branch_record_t *out, gap_t *gap, int summary)
+{
+  size_t m = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    const branch_record_t *r = &in[i];
+    if (!TRACE_FLAG(r, TRACE_F_CONDITION))
+    {
+      unsigned slot = gap->count++ % 32;
+      gap->path[slot] = r->pc & ((1u << HISTORY_PATH_BITS) - 1);
+      gap->target[slot] = (r->target >> 2) & ((1u << HISTORY_TARGET_BITS) - 1);
+      gap->taken[slot] = TRACE_FLAG(r, TRACE_F_TAKEN);
+      continue;
+    }
+    // oldest first, the first record taking what is left over
+    uint64_t left = summary && gap->count < 32 ? gap->count : summary ? 32 : 0;
+    while (left)
+    {
+      unsigned k = left % TRACE_SUMMARY_MAX ? left % TRACE_SUMMARY_MAX : TRACE_SUMMARY_MAX;
+      uint32_t path = 0, targets = 0, takens = 0;
+      for (uint64_t b = gap->count - left; b < gap->count - left + k; b++)
+      {
+        path = path << HISTORY_PATH_BITS | gap->path[b % 32];
+        if (gap->taken[b % 32])
+        {
+          targets = targets << HISTORY_TARGET_BITS | gap->target[b % 32];
+          takens++;
+        }
+      }
+      out[m].pc = (uint32_t)k << TRACE_SUMMARY_SHIFT | path;
+      out[m].target = takens << TRACE_SUMMARY_SHIFT | targets;
+      out[m].flags = TRACE_F_SUMMARY;
+      m++;
+      left -= k;
+    }
+    gap->count = 0;
+    out[m++] = *r;
+  }
+  return m;
+}
+
+// Write the 'n' records of 'recs' to 'tw', projected onto the
+// conditional branches with 'gap' if asked for
+//
+// Returns True if Successful
+//
+static int tobin_write(trace_writer_t *tw, const branch_record_t *recs, size_t n, branch_record_t *projected,
+                       gap_t *gap)
+{
+  if (!conditional)
+  {
+    return trace_writer_write(tw, recs, n);
+  }
+  int ok = 1;
+  for (size_t i = 0; ok && i < n; i += TRACE_BATCH)
+  {
+    size_t m = n - i < TRACE_BATCH ? n - i : TRACE_BATCH;
+    ok = trace_writer_write(tw, projected, project_conditional(recs + i, m, projected, gap, conditional == 2));
+  }
+  return ok;
+}
+
+// Read 'threads' chunks of the text trace 'tr' at a time, parse them
+// on as many threads and write their records in order to 'tw'
+//
+// Returns True if Successful
+//
+static int tobin_text(trace_reader_t *tr, trace_writer_t *tw, int threads, branch_record_t *projected, gap_t *gap)
+{
+  size_t max = TOBIN_CHUNK / TRACE_TEXT_LINE_MIN + 1;
+  std::vector<char *> text(threads);
+  std::vector<branch_record_t *> recs(threads);
+  std::vector<size_t> lens(threads), counts(threads);
+  int ok = 1;
+  for (int t = 0; t < threads; t++)
+  {
+    text[t] = (char *)malloc(TOBIN_CHUNK);
+    recs[t] = (branch_record_t *)malloc(max * sizeof(branch_record_t));
+    ok = ok && text[t] && recs[t];
+  }
+  for (int more = ok; more;)
+  {
+    // the chunks end at line breaks, so each parses on its own
+    int used = 0;
+    while (used < threads && (lens[used] = trace_read_text_chunk(tr, text[used], TOBIN_CHUNK)) > 0)
+    {
+      used++;
+    }
+    more = used == threads;
+    auto parse = [&](int t) { counts[t] = trace_parse_text_chunk(text[t], lens[t], recs[t], max); };
+    std::vector<std::thread> pool;
+    for (int t = 0; t < used; t++)
+    {
+      pool.push_back(std::thread(parse, t));
+    }
+    for (int t = 0; t < used; t++)
+    {
+      pool[t].join();
+      ok = ok && tobin_write(tw, recs[t], counts[t], projected, gap);
+    }
+    more = more && ok;
+  }
+  for (int t = 0; t < threads; t++)
+  {
+    free(text[t]);
+    free(recs[t]);
+  }
+  return ok;
+}
+
+// Convert the trace 'in' to 'out' with 'threads' parsing threads,
+// through 'out'.tmp renamed at the end when 'atomic'
+//
+// Returns True if Successful
+//
+static int tobin_convert(const char *in, const char *out, int threads, int atomic)
+{
+  trace_reader_t *tr = trace_open(in);
+  if (!tr)
+  {
+    fprintf(stderr, "Error: can not open %s\n", in);
+    return 0;
+  }
+  std::string tmp = atomic ? std::string(out) + ".tmp" : std::string(out);
+  trace_writer_t *tw = trace_writer_open(tmp.c_str(), codec, layout, level, frame_records);
+  if (!tw)
+  {
+    fprintf(stderr, "Error: can not create %s\n", tmp.c_str());
+    trace_close(tr);
+    return 0;
+  }
+  int ok = (!pc_ids || trace_writer_use_ids(tw)) && (!statics || trace_writer_use_static(tw));
+
+  branch_record_t *projected = (branch_record_t *)malloc((TRACE_BATCH + 3) * sizeof(branch_record_t));
+  gap_t gap = {0};
+  if (ok && tr->format == TRACE_FMT_TEXT && threads > 1)
+  {
+    ok = tobin_text(tr, tw, threads, projected, &gap);
+  }
+  else if (ok)
+  {
+    branch_record_t *batch = (branch_record_t *)malloc(TRACE_BATCH * sizeof(branch_record_t));
+    size_t n;
+    const branch_record_t *recs;
+    while (ok && (n = trace_read_span(tr, batch, TRACE_BATCH, &recs)) > 0)
+    {
+      ok = tobin_write(tw, recs, n, projected, &gap);
+    }
+    free(batch);
+  }
+  free(projected);
+  trace_close(tr);
+
+  uint64_t num_records = tw->num_records + tw->npending;
+  uint32_t num_pcs = tw->pc_map ? tw->pc_map->count : 0;
+  if (!trace_writer_close(tw) || !ok || (atomic && rename(tmp.c_str(), out)))
+  {
+    fprintf(stderr, "Error: failed to write %s\n", out);
+    if (atomic)
+    {
+      remove(tmp.c_str());
+    }
+    return 0;
+  }
+  if (atomic)
+  {
+    printf("%s: %llu records\n", out, (unsigned long long)num_records);
+    return 1;
+  }
+  printf("Records:         %10llu\n", (unsigned long long)num_records);
+  if (pc_ids || statics)
+  {
+    printf("PCs:             %10u\n", num_pcs);
+  }
+  return 1;
+}
+
+// Path in 'dir' of the conversion of 'in': its name without .bz2 or
+// .txt, then .bin, or .bpz for a framed trace
+//
+static std::string tobin_output(const char *dir, const char *in)
+{
+  std::string name = in;
+  size_t slash = name.rfind('/');
+  name = slash == std::string::npos ? name : name.substr(slash + 1);
+  static const char *suffixes[] = {".bz2", ".txt"};
+  for (const char *suffix : suffixes)
+  {
+    size_t n = strlen(suffix);
+    if (name.size() > n && !name.compare(name.size() - n, n, suffix))
+    {
+      name.resize(name.size() - n);
+    }
+  }
+  return std::string(dir) + "/" + name + (codec >= 0 ? ".bpz" : ".bin");
+}
+
+// Returns True if 'out' was modified after 'in'
+//
+static int tobin_up_to_date(const char *in, const char *out)
+{
+  struct stat si, so;
+  return !stat(in, &si) && !stat(out, &so) &&
+         (so.st_mtim.tv_sec > si.st_mtim.tv_sec ||
+          (so.st_mtim.tv_sec == si.st_mtim.tv_sec && so.st_mtim.tv_nsec >= si.st_mtim.tv_nsec));
+}
+
+int main(int argc, char *argv[])
+{
+  int threads = 0;
+  int jobs = 0;
+  int force = 0;
+  const char *out_dir = NULL;
+  std::vector<const char *> paths;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strncmp(argv[i], "--codec=", 8))
+    {
+      codec = codec_by_name(argv[i] + 8);
+      if (codec < 0)
+      {
+        fprintf(stderr, "Unknown codec %s\n", argv[i] + 8);
+        exit(1);
+      }
+    }
+    else if (!strcmp(argv[i], "--columnar"))
+    {
+      layout = TRACE_LAYOUT_COLUMNAR;
+    }
+    else if (!strcmp(argv[i], "--pc-ids"))
+    {
+      pc_ids = 1;
+    }
+    else if (!strcmp(argv[i], "--static"))
+    {
+      statics = 1;
+    }
+    else if (!strcmp(argv[i], "--conditional-only"))
+    {
+      conditional = conditional ? conditional : 1;
+    }
+    else if (!strcmp(argv[i], "--gap-summary"))
+    {
+      conditional = 2;
+    }
+    else if (!strncmp(argv[i], "--level=", 8))
+    {
+      level = atoi(argv[i] + 8);
+    }
+    else if (!strncmp(argv[i], "--frame=", 8))
+    {
+      frame_records = strtoull(argv[i] + 8, NULL, 0);
+    }
+    else if (!strncmp(argv[i], "--threads=", 10))
+    {
+      threads = atoi(argv[i] + 10);
+    }
+    else if (!strncmp(argv[i], "--jobs=", 7))
+    {
+      jobs = atoi(argv[i] + 7);
+    }
+    else if (!strncmp(argv[i], "--out-dir=", 10))
+    {
+      out_dir = argv[i] + 10;
+    }
+    else if (!strcmp(argv[i], "--force"))
+    {
+      force = 1;
+    }
+    else if (strncmp(argv[i], "--", 2) || !strcmp(argv[i], "-"))
+    {
+      paths.push_back(argv[i]);
+    }
+    else
+    {
+      usage();
+      exit(1);
+    }
+  }
+  if (layout == TRACE_LAYOUT_COLUMNAR && codec < 0)
+  {
+    codec = CODEC_NONE;
+  }
+  if ((out_dir ? paths.empty() : paths.size() != 2) || frame_records == 0 || ((pc_ids || statics) && codec >= 0) ||
+      (pc_ids && statics) || (conditional == 2 && (pc_ids || statics)))
+  {
+    usage();
+    exit(1);
+  }
+  if (threads <= 0)
+  {
+    threads = std::thread::hardware_concurrency();
+    threads = threads > 0 ? threads : 1;
+  }
+
+  if (!out_dir)
+  {
+    return tobin_convert(paths[0], paths[1], threads, 0) ? 0 : 1;
+  }
+
+  // inputs whose output is newer are left alone, so a rerun only
+  // converts new or changed traces
+  std::vector<const char *> inputs;
+  mkdir(out_dir, 0777);
+  for (const char *in : paths)
+  {
+    std::string out = tobin_output(out_dir, in);
+    if (!strcmp(in, "-") || (!force && tobin_up_to_date(in, out.c_str())))
+    {
+      printf("%s: %s\n", out.c_str(), strcmp(in, "-") ? "up to date" : "skipped, not a file");
+      continue;
+    }
+    inputs.push_back(in);
+  }
+  jobs = jobs <= 0 || jobs > threads ? threads : jobs;
+  jobs = jobs > (int)inputs.size() ? (int)inputs.size() : jobs;
+  if (!jobs)
+  {
+    return 0;
+  }
+  int share = threads / jobs > 0 ? threads / jobs : 1;
+  trace_decode_threads = share;
+  std::atomic<size_t> next(0);
+  std::atomic<int> ok(1);
+  auto worker = [&]()
+  {
+    for (size_t i; (i = next++) < inputs.size();)
+    {
+      std::string out = tobin_output(out_dir, inputs[i]);
+      if (!tobin_convert(inputs[i], out.c_str(), share, 1))
+      {
+        ok = 0;
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  for (int j = 0; j < jobs; j++)
+  {
+    pool.push_back(std::thread(worker));
+  }
+  for (auto &t : pool)
+  {
+    t.join();
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,2305 @@
+//========================================================//
+//  trace.cpp                                             //
+//  Source file for the branch trace readers              //
+//                                                        //
+//  Reads the text and binary traces of branchExt, the    //
+//  packed binary formats written by tobin and, through   //
+//  foreign.h, ChampSim and BT9 traces                    //
+//========================================================//
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#include "trace.h"
+#include "kernels.h"
+#include "remote.h"
+#include "codec.h"
+#include "columnar.h"
+#include "xxh3.h"
+#include "foreign.h"
+
+#define TRACE_BUF_SIZE (1 << 20)
+
+// Pipes are grown to hold this much where the kernel allows it
+#define TRACE_PIPE_SIZE (256 << 10)
+
+static_assert(SHM_RING_RECORD_SIZE == sizeof(branch_record_t), "a ring slot holds packed records");
+static_assert(SYNTH_RECORD_SIZE == sizeof(branch_record_t), "the generator writes packed records");
+
+int trace_decode_threads = 0;
+int trace_use_mmap = 1;
+int trace_use_uring = URING_OFF;
+
+// Bytes per frame at the index of a framed trace: its trace_frame_t,
+// and from version 3 its checksum
+//
+static size_t trace_index_entry(const trace_framed_header_t *hdr)
+{
+  return sizeof(trace_frame_t) + (hdr->version >= 3 ? sizeof(uint64_t) : 0);
+}
+
+// Decode frame 'f' of a framed trace into the read buffer
+//
+static void trace_decode_frame(trace_reader_t *tr, uint64_t f)
+{
+  const trace_frame_t *frame = &tr->frames[f];
+  const trace_framed_header_t *hdr = &tr->frame_hdr;
+  const char *comp = tr->remote ? remote_frame(tr->remote, f) : tr->image + frame->offset;
+  size_t len = (size_t)frame->num_records * sizeof(branch_record_t);
+  int ok = frame->num_records <= hdr->frame_records;
+  uint64_t start = trace_clock_ns();
+  if (ok && hdr->layout == TRACE_LAYOUT_COLUMNAR)
+  {
+    size_t n = codec_decompress(hdr->codec, tr->scratch, tr->scratch_cap, comp, frame->comp_size);
+    tr->decompress_ns += trace_clock_ns() - start;
+    ok = n && columnar_decode(tr->scratch, n, (branch_record_t *)tr->buf, frame->num_records,
+                                 TRACE_FIELD_ALL & ~tr->skip_fields) == frame->num_records;
+  }
+  else if (ok)
+  {
+    ok = codec_decompress(hdr->codec, tr->buf, len, comp, frame->comp_size) == len;
+    tr->decompress_ns += trace_clock_ns() - start;
+  }
+  if (!ok)
+  {
+    fprintf(stderr, "Error: failed to decode trace frame %llu\n", (unsigned long long)f);
+    exit(1);
+  }
+  tr->data = tr->buf;
+  tr->pos = 0;
+  tr->len = len;
+  tr->next_frame = f + 1;
+}
+
+// Decode the next frame once the current one is consumed
+//
+static size_t trace_fill_frame(trace_reader_t *tr)
+{
+  if (tr->pos == tr->len)
+  {
+    if (tr->next_frame >= tr->frame_hdr.num_frames)
+    {
+      tr->eof = 1;
+      return 0;
+    }
+    trace_decode_frame(tr, tr->next_frame);
+  }
+  return tr->len - tr->pos;
+}
+
+// Take the next slot of the ring once the current one is consumed,
+// releasing it to the producer
+//
+static size_t trace_fill_shm(trace_reader_t *tr)
+{
+  if (tr->pos < tr->len)
+  {
+    return tr->len - tr->pos;
+  }
+  uint64_t start = trace_clock_ns();
+  const char *recs;
+  size_t n = shm_ring_next(tr->shm, &recs);
+  tr->decompress_ns += trace_clock_ns() - start;
+  tr->base += tr->len;
+  tr->data = recs;
+  tr->pos = 0;
+  tr->len = n * sizeof(branch_record_t);
+  tr->eof = n == 0;
+  return tr->len;
+}
+
+// Generate the next buffer of records once the current one is consumed
+//
+static size_t trace_fill_synth(trace_reader_t *tr)
+{
+  if (tr->pos < tr->len)
+  {
+    return tr->len - tr->pos;
+  }
+  uint64_t n = tr->synth->cfg.records - tr->synth_next;
+  if (n > tr->cap / sizeof(branch_record_t))
+  {
+    n = tr->cap / sizeof(branch_record_t);
+  }
+  synth_generate(tr->synth, tr->synth_next, tr->buf, n);
+  tr->synth_next += n;
+  tr->base += tr->len;
+  tr->pos = 0;
+  tr->len = n * sizeof(branch_record_t);
+  tr->eof = n == 0;
+  return tr->len;
+}
+
+// Take the next piece of the current part of a composed trace once the
+// one before is consumed, moving on to the next part at the end of a
+// slice and dropping the parts that end
+//
+static size_t trace_fill_compose(trace_reader_t *tr)
+{
+  if (tr->pos < tr->len)
+  {
+    return tr->len - tr->pos;
+  }
+  tr->base += tr->len;
+  tr->pos = 0;
+  tr->len = 0;
+  while (tr->num_parts)
+  {
+    trace_reader_t *p = tr->parts[tr->part];
+    size_t max = TRACE_BATCH * 16;
+    if (tr->slice && tr->slice_left < max)
+    {
+      max = tr->slice_left;
+    }
+    const branch_record_t *recs = tr->part_batch;
+    size_t n = trace_can_view(p) ? trace_read_view(p, &recs, max)
+                                 : trace_read_batch(p, tr->part_batch, max < TRACE_BATCH ? max : TRACE_BATCH);
+    if (n)
+    {
+      tr->switches += tr->switch_pending;
+      tr->switch_pending = 0;
+      tr->data = (const char *)recs;
+      tr->len = n * sizeof(branch_record_t);
+      if (tr->slice && !(tr->slice_left -= n))
+      {
+        tr->part = (tr->part + 1) % tr->num_parts;
+        tr->slice_left = tr->slice;
+        tr->switch_pending = tr->num_parts > 1;
+      }
+      return tr->len;
+    }
+    trace_close(p);
+    memmove(&tr->parts[tr->part], &tr->parts[tr->part + 1], (tr->num_parts - tr->part - 1) * sizeof(*tr->parts));
+    tr->num_parts--;
+    tr->part = tr->part < tr->num_parts ? tr->part : 0;
+    tr->slice_left = tr->slice;
+    tr->switch_pending = 1;
+  }
+  tr->eof = 1;
+  return 0;
+}
+
+// Read up to 'cap' next bytes of the stream into 'dst', through
+// io_uring when it is set up
+//
+// Returns the number of bytes read, 0 at the end of the stream
+//
+static size_t trace_read_stream(trace_reader_t *tr, char *dst, size_t cap)
+{
+  if (tr->piped)
+  {
+    for (;;)
+    {
+      ssize_t n = read(fileno(tr->stream), dst, cap);
+      if (n >= 0 || errno != EINTR)
+      {
+        return n > 0 ? n : 0;
+      }
+    }
+  }
+  return tr->uring ? uring_read(tr->uring, dst, cap) : fread(dst, 1, cap, tr->stream);
+}
+
+// Set up a pipe or socket on stdin or a FIFO to be read with read(2),
+// with nothing left in stdio, so binary records can be read from it
+// into the caller's arrays. A pipe is grown towards TRACE_PIPE_SIZE,
+// capped by /proc/sys/fs/pipe-max-size, so the writer runs further
+// ahead between wakeups
+//
+// Returns True if the stream is piped
+//
+static int trace_pipe_open(trace_reader_t *tr)
+{
+  struct stat st;
+  int fd = fileno(tr->stream);
+  if (fstat(fd, &st) || S_ISREG(st.st_mode) || S_ISBLK(st.st_mode) || S_ISCHR(st.st_mode))
+  {
+    return 0;
+  }
+#ifdef F_SETPIPE_SZ
+  if (S_ISFIFO(st.st_mode))
+  {
+    int size = TRACE_PIPE_SIZE;
+    FILE *f = fopen("/proc/sys/fs/pipe-max-size", "r");
+    int max;
+    if (f && fscanf(f, "%d", &max) == 1 && max < size)
+    {
+      size = max;
+    }
+    if (f)
+    {
+      fclose(f);
+    }
+    if (fcntl(fd, F_GETPIPE_SZ) < size)
+    {
+      fcntl(fd, F_SETPIPE_SZ, size);
+    }
+  }
+#endif
+  return 1;
+}
+
+// Read the next bytes of the input through its decompressor, if any
+//
+// Returns the number of bytes read, 0 at the end of the input
+//
+static size_t trace_read_raw(trace_reader_t *tr, char *dst, size_t cap)
+{
+  if (tr->bz2)
+  {
+    return bz2_read(tr->bz2, dst, cap);
+  }
+  if (tr->gzxz)
+  {
+    return gzxz_read(tr->gzxz, dst, cap);
+  }
+  if (tr->archive)
+  {
+    return archive_read(tr->archive, dst, cap);
+  }
+  // a mapped file is in the window whole
+  return tr->map ? 0 : trace_read_stream(tr, dst, cap);
+}
+
+// foreign_read_fn of the trace input
+//
+static size_t trace_read_foreign(void *ctx, char *dst, size_t cap)
+{
+  trace_reader_t *tr = (trace_reader_t *)ctx;
+  uint64_t start = trace_clock_ns();
+  size_t n = trace_read_raw(tr, dst, cap);
+  tr->decompress_ns += trace_clock_ns() - start;
+  return n;
+}
+
+// Decode the next buffer of records of a ChampSim or BT9 trace once
+// the current one is consumed
+//
+static size_t trace_fill_foreign(trace_reader_t *tr)
+{
+  if (tr->pos < tr->len)
+  {
+    return tr->len - tr->pos;
+  }
+  size_t n = foreign_read(tr->foreign, (branch_record_t *)tr->buf, tr->cap / sizeof(branch_record_t));
+  tr->base += tr->len;
+  tr->pos = 0;
+  tr->len = n * sizeof(branch_record_t);
+  tr->eof = n == 0;
+  return tr->len;
+}
+
+// Read the rest of the streamed input behind the bytes in the buffer
+// into tr->owned_image
+//
+static void trace_read_image(trace_reader_t *tr)
+{
+  size_t cap = tr->len * 2 + TRACE_BUF_SIZE;
+  char *image = (char *)malloc(cap);
+  memcpy(image, tr->data, tr->len);
+  size_t len = tr->len;
+  size_t n;
+  while (image && (n = trace_read_stream(tr, image + len, cap - len)) > 0)
+  {
+    len += n;
+    if (len == cap)
+    {
+      cap *= 2;
+      image = (char *)realloc(image, cap);
+    }
+  }
+  if (!image)
+  {
+    fprintf(stderr, "Error: trace image malloc failed\n");
+    exit(1);
+  }
+  tr->owned_image = image;
+  tr->len = len;
+}
+
+// Set up reading a framed trace from its image
+//
+static void trace_open_framed(trace_reader_t *tr)
+{
+  if (tr->remote)
+  {
+    // Only the header is here, the frames are fetched as they are read
+    tr->image = NULL;
+  }
+  else if (!tr->map)
+  {
+    // Streamed input, read all of it so frames can be addressed
+    trace_read_image(tr);
+    tr->image = tr->owned_image;
+  }
+  else
+  {
+    tr->image = tr->data;
+  }
+
+  trace_framed_header_t *hdr = &tr->frame_hdr;
+  const char *head = tr->remote ? tr->data : tr->image;
+  uint64_t size = tr->remote ? remote_size(tr->remote) : tr->len;
+  memset(hdr, 0, sizeof(*hdr));
+  memcpy(hdr, head, TRACE_FRAMED_V1_SIZE);
+  if (hdr->version >= 2)
+  {
+    memcpy(hdr, head, sizeof(*hdr));
+  }
+  if (hdr->version < 1 || hdr->version > TRACE_FRAMED_VERSION || hdr->layout > TRACE_LAYOUT_COLUMNAR ||
+      hdr->record_size != sizeof(branch_record_t) ||
+      hdr->index_offset + hdr->num_frames * trace_index_entry(hdr) > size)
+  {
+    fprintf(stderr, "Error: unsupported or truncated framed trace\n");
+    exit(1);
+  }
+  if (!codec_available(hdr->codec))
+  {
+    fprintf(stderr, "Error: trace needs the %s codec library\n", codec_name(hdr->codec));
+    exit(1);
+  }
+  if (tr->remote)
+  {
+    size_t bytes = hdr->num_frames * trace_index_entry(hdr);
+    tr->owned_image = (char *)malloc(bytes ? bytes : 1);
+    if (!tr->owned_image || (bytes && !remote_read(tr->remote, hdr->index_offset, bytes, tr->owned_image)))
+    {
+      fprintf(stderr, "Error: unable to read the frame index\n");
+      exit(1);
+    }
+    tr->frames = (const trace_frame_t *)tr->owned_image;
+  }
+  else
+  {
+    tr->frames = (const trace_frame_t *)(tr->image + hdr->index_offset);
+  }
+  tr->frame_sums = hdr->version >= 3 ? (const uint64_t *)(tr->frames + hdr->num_frames) : NULL;
+  if (tr->remote)
+  {
+    remote_set_frames(tr->remote, tr->frames, tr->frame_sums, hdr->num_frames);
+  }
+  if (hdr->layout == TRACE_LAYOUT_COLUMNAR)
+  {
+    tr->scratch_cap = columnar_bound(hdr->frame_records);
+    tr->scratch = (char *)malloc(tr->scratch_cap);
+  }
+
+  free(tr->buf);
+  tr->cap = (size_t)hdr->frame_records * sizeof(branch_record_t);
+  tr->buf = (char *)malloc(tr->cap ? tr->cap : 1);
+  tr->data = tr->buf;
+  tr->pos = 0;
+  tr->len = 0;
+  tr->eof = 0;
+  tr->next_frame = 0;
+  tr->format = TRACE_FMT_BIN;
+}
+
+// Move the unconsumed bytes to the front of the buffer and read
+// more from the stream
+//
+// Returns the number of bytes available
+//
+static size_t trace_fill(trace_reader_t *tr)
+{
+  if (tr->frames)
+  {
+    return trace_fill_frame(tr);
+  }
+  if (tr->shm)
+  {
+    return trace_fill_shm(tr);
+  }
+  if (tr->synth)
+  {
+    return trace_fill_synth(tr);
+  }
+  if (tr->parts)
+  {
+    return trace_fill_compose(tr);
+  }
+  if (tr->foreign)
+  {
+    return trace_fill_foreign(tr);
+  }
+  if (trace_mapped(tr))
+  {
+    return tr->len - tr->pos;
+  }
+  if (tr->pos > 0)
+  {
+    tr->base += tr->pos;
+    memmove(tr->buf, tr->buf + tr->pos, tr->len - tr->pos);
+    tr->len -= tr->pos;
+    tr->pos = 0;
+  }
+  uint64_t start = trace_clock_ns();
+  while (!tr->eof && tr->len < tr->cap)
+  {
+    size_t n;
+    n = trace_read_raw(tr, tr->buf + tr->len, tr->cap - tr->len);
+    if (n == 0)
+    {
+      tr->eof = 1;
+    }
+    tr->len += n;
+  }
+  tr->decompress_ns += trace_clock_ns() - start;
+  return tr->len;
+}
+
+// Map a regular file read-only so the readers walk the page cache
+// in place, shared by every process replaying the same trace
+//
+// Returns True if Successful
+//
+static int trace_map(trace_reader_t *tr)
+{
+  struct stat st;
+  int fd = fileno(tr->stream);
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0)
+  {
+    return 0;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    return 0;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+  madvise(map, st.st_size, MADV_HUGEPAGE);
+#endif
+  tr->map = map;
+  tr->map_len = st.st_size;
+  tr->data = (const char *)map;
+  tr->len = st.st_size;
+  tr->eof = 1;
+  return 1;
+}
+
+// Read the id header and the PC dictionary of a version 2 trace
+//
+static void trace_open_ids(trace_reader_t *tr, const trace_header_t *hdr)
+{
+  trace_ids_header_t ids;
+  memcpy(&ids, tr->data + sizeof(trace_header_t), sizeof(ids));
+  tr->has_ids = 1;
+  tr->record_size = sizeof(branch_id_record_t);
+  tr->num_records = tr->records_left = hdr->num_records;
+  tr->num_pcs = ids.num_pcs;
+
+  // The dictionary trails the records, out of reach of pipes and
+  // compressed input
+  size_t bytes = (size_t)ids.num_pcs * sizeof(uint32_t);
+  if (trace_mapped(tr) && ids.dict_offset + bytes <= tr->map_len)
+  {
+    tr->pc_dict = (uint32_t *)malloc(bytes + 1);
+    memcpy(tr->pc_dict, (const char *)tr->map + ids.dict_offset, bytes);
+  }
+  else if (!tr->bz2 && !tr->gzxz && !tr->archive)
+  {
+    tr->pc_dict = (uint32_t *)malloc(bytes + 1);
+    if (pread(fileno(tr->stream), tr->pc_dict, bytes, ids.dict_offset) != (ssize_t)bytes)
+    {
+      free(tr->pc_dict);
+  free(tr->statics);
+      tr->pc_dict = NULL;
+    }
+  }
+}
+
+// Define static id 'id' of a version 3 trace from the entry at 'src'
+//
+static void trace_define_static(trace_reader_t *tr, uint32_t id, const char *src)
+{
+  if (id >= tr->statics_cap)
+  {
+    uint32_t cap = tr->statics_cap ? tr->statics_cap : 4096;
+    while (cap <= id)
+    {
+      cap *= 2;
+    }
+    tr->statics = (trace_static_entry_t *)realloc(tr->statics, cap * sizeof(trace_static_entry_t));
+    tr->pc_dict = (uint32_t *)realloc(tr->pc_dict, cap * sizeof(uint32_t));
+    if (!tr->statics || !tr->pc_dict)
+    {
+      fprintf(stderr, "Error: trace static table malloc failed\n");
+      exit(1);
+    }
+    memset(tr->statics + tr->statics_cap, 0, (cap - tr->statics_cap) * sizeof(trace_static_entry_t));
+    memset(tr->pc_dict + tr->statics_cap, 0, (cap - tr->statics_cap) * sizeof(uint32_t));
+    tr->statics_cap = cap;
+  }
+  memcpy(&tr->statics[id], src, sizeof(trace_static_entry_t));
+  tr->pc_dict[id] = (uint32_t)tr->statics[id].pc;
+  if (id >= tr->num_pcs)
+  {
+    tr->num_pcs = id + 1;
+  }
+}
+
+// Set up generating the synthetic trace of 'spec'
+//
+// Returns NULL if 'spec' is not valid
+//
+static trace_reader_t *trace_open_synth(const char *spec)
+{
+  synth_config_t cfg;
+  synth_t *synth = synth_parse(spec, &cfg) ? synth_open(&cfg) : NULL;
+  if (!synth)
+  {
+    return NULL;
+  }
+  trace_reader_t *tr = (trace_reader_t *)calloc(1, sizeof(trace_reader_t));
+  tr->synth = synth;
+  tr->format = TRACE_FMT_BIN;
+  tr->record_size = sizeof(branch_record_t);
+  tr->num_records = tr->records_left = cfg.records;
+  tr->cap = TRACE_BUF_SIZE;
+  tr->buf = (char *)malloc(tr->cap);
+  if (!tr->buf)
+  {
+    fprintf(stderr, "Error: trace buffer malloc failed\n");
+    exit(1);
+  }
+  tr->data = tr->buf;
+  return tr;
+}
+
+// Open the part 'name' of a composition as given, or else with the
+// suffix of a trace format
+//
+static trace_reader_t *trace_open_part(const char *name)
+{
+  static const char *suffixes[] = {"", ".bin", ".bpz", ".bz2"};
+  size_t n = strlen(name) + 5;
+  char *path = (char *)malloc(n);
+  trace_reader_t *tr = NULL;
+  for (int i = 0; i < 4 && !tr; i++)
+  {
+    snprintf(path, n, "%s%s", name, suffixes[i]);
+    tr = !i || !access(path, R_OK) ? trace_open(path) : NULL;
+  }
+  free(path);
+  return tr;
+}
+
+// Whether the argument at 'p' is a key of the synth: spec before it
+// rather than a composition argument of its own
+//
+static int trace_compose_synth_key(const char *start, const char *p)
+{
+  size_t key = strspn(p, "abcdefghijklmnopqrstuvwxyz");
+  return !strncmp(start, SYNTH_PREFIX, SYNTH_PREFIX_LEN) && key && p[key] == '=' && strncmp(p, "slice=", 6);
+}
+
+// Set up reading the composition 'spec', concat(...) or interleave(...)
+//
+// Returns NULL if 'spec' is not valid or a part can not be opened
+//
+static trace_reader_t *trace_open_compose(const char *spec)
+{
+  int interleave = !strncmp(spec, "interleave(", 11);
+  const char *args = strchr(spec, '(') + 1;
+  size_t len = strlen(args);
+  if (!len || args[len - 1] != ')')
+  {
+    return NULL;
+  }
+  char *buf = strndup(args, len - 1);
+  trace_reader_t *parts[TRACE_COMPOSE_PARTS];
+  int num_parts = 0;
+  uint64_t slice = interleave ? TRACE_COMPOSE_SLICE : 0;
+  int ok = 1;
+
+  // split at the commas outside parentheses, keeping synth: keys
+  int depth = 0;
+  char *start = buf;
+  for (char *p = buf; ok; p++)
+  {
+    depth += (*p == '(') - (*p == ')');
+    if (*p && (*p != ',' || depth || trace_compose_synth_key(start, p + 1)))
+    {
+      continue;
+    }
+    int last = !*p;
+    *p = '\0';
+    if (!strncmp(start, "slice=", 6))
+    {
+      ok = interleave && synth_parse_count(start + 6, &slice) && slice;
+    }
+    else if (*start && num_parts < TRACE_COMPOSE_PARTS)
+    {
+      parts[num_parts] = trace_open_part(start);
+      ok = parts[num_parts++] != NULL;
+      if (!ok)
+      {
+        fprintf(stderr, "Error: can not open %s of %s\n", start, spec);
+      }
+    }
+    else
+    {
+      ok = 0;
+    }
+    if (last)
+    {
+      break;
+    }
+    start = p + 1;
+  }
+  free(buf);
+  if (!ok || !num_parts)
+  {
+    for (int i = 0; i < num_parts; i++)
+    {
+      trace_close(parts[i]);
+    }
+    return NULL;
+  }
+
+  trace_reader_t *tr = (trace_reader_t *)calloc(1, sizeof(trace_reader_t));
+  tr->parts = (trace_reader_t **)malloc(num_parts * sizeof(trace_reader_t *));
+  tr->part_batch = (branch_record_t *)malloc(TRACE_BATCH * sizeof(branch_record_t));
+  if (!tr->parts || !tr->part_batch)
+  {
+    fprintf(stderr, "Error: composed trace malloc failed\n");
+    exit(1);
+  }
+  memcpy(tr->parts, parts, num_parts * sizeof(trace_reader_t *));
+  tr->num_parts = num_parts;
+  tr->slice = tr->slice_left = slice;
+  tr->format = TRACE_FMT_BIN;
+  tr->record_size = sizeof(branch_record_t);
+  tr->num_records = 0;
+  for (int i = 0; i < num_parts; i++)
+  {
+    tr->num_records = tr->num_records == ~0ULL || parts[i]->records_left == ~0ULL ? ~0ULL
+                                                                                  : tr->num_records + parts[i]->records_left;
+  }
+  tr->records_left = tr->num_records;
+  return tr;
+}
+
+// Open the framed trace at the URL 'path', reading its header
+//
+// Returns NULL if it can not be reached or is not framed
+//
+static trace_reader_t *trace_open_remote(const char *path)
+{
+  remote_t *r = remote_open(path);
+  if (!r)
+  {
+    return NULL;
+  }
+  trace_reader_t *tr = (trace_reader_t *)calloc(1, sizeof(trace_reader_t));
+  tr->remote = r;
+  tr->record_size = sizeof(branch_record_t);
+  tr->num_records = tr->records_left = ~0ULL;
+  size_t head = remote_size(r) < sizeof(trace_framed_header_t) ? remote_size(r) : sizeof(trace_framed_header_t);
+  tr->buf = (char *)malloc(sizeof(trace_framed_header_t));
+  if (!tr->buf || !remote_read(r, 0, head, tr->buf) || head < TRACE_FRAMED_V1_SIZE ||
+      memcmp(tr->buf, TRACE_FRAMED_MAGIC, TRACE_MAGIC_LEN))
+  {
+    fprintf(stderr, "%s is not a framed trace, see tobin --codec\n", path);
+    trace_close(tr);
+    return NULL;
+  }
+  tr->data = tr->buf;
+  tr->len = head;
+  trace_open_framed(tr);
+  return tr;
+}
+
+trace_reader_t *trace_open(const char *path)
+{
+  if (path && !strncmp(path, SYNTH_PREFIX, SYNTH_PREFIX_LEN))
+  {
+    return trace_open_synth(path + SYNTH_PREFIX_LEN);
+  }
+  if (path && (!strncmp(path, "concat(", 7) || !strncmp(path, "interleave(", 11)))
+  {
+    return trace_open_compose(path);
+  }
+  if (remote_is_url(path))
+  {
+    return trace_open_remote(path);
+  }
+  FILE *stream = stdin;
+  archive_reader_t *archive = NULL;
+  if (archive_is_path(path))
+  {
+    archive = archive_open(path);
+    if (!archive)
+    {
+      return NULL;
+    }
+    stream = NULL;
+  }
+  else if (path && strcmp(path, "-"))
+  {
+    stream = fopen(path, "rb");
+    if (!stream)
+    {
+      return NULL;
+    }
+  }
+
+  trace_reader_t *tr = (trace_reader_t *)calloc(1, sizeof(trace_reader_t));
+  tr->stream = stream;
+  tr->archive = archive;
+  tr->record_size = sizeof(branch_record_t);
+  tr->num_records = tr->records_left = ~0ULL;
+  if (trace_use_uring && stream && stream != stdin)
+  {
+    tr->uring = uring_open(fileno(stream), trace_use_uring == URING_DIRECT);
+  }
+  if (archive || tr->uring || !trace_use_mmap || !trace_map(tr))
+  {
+    tr->cap = TRACE_BUF_SIZE;
+    if (stream && !tr->uring && trace_pipe_open(tr))
+    {
+      tr->piped = 1;
+    }
+    tr->buf = NULL;
+    if (posix_memalign((void **)&tr->buf, 4096, tr->cap))
+    {
+      tr->buf = NULL;
+    }
+    if (!tr->buf)
+    {
+      fprintf(stderr, "Error: trace buffer malloc failed\n");
+      exit(1);
+    }
+    tr->data = tr->buf;
+    trace_fill(tr);
+  }
+
+  // Hand compressed input over to the decoder and read through it
+  if (bz2_is_bzip2(tr->data, tr->len))
+  {
+    if (tr->map)
+    {
+      tr->bz2 = bz2_open_mem(tr->data, tr->len, trace_decode_threads);
+      tr->cap = TRACE_BUF_SIZE;
+      tr->buf = (char *)malloc(tr->cap);
+      tr->data = tr->buf;
+    }
+    else if (tr->uring)
+    {
+      // the whole compressed image, read ahead through the ring
+      trace_read_image(tr);
+      tr->bz2 = bz2_open_mem(tr->owned_image, tr->len, trace_decode_threads);
+    }
+    else
+    {
+      tr->bz2 = bz2_open(tr->stream, tr->buf, tr->len, trace_decode_threads);
+    }
+    tr->pos = 0;
+    tr->len = 0;
+    tr->eof = 0;
+    trace_fill(tr);
+  }
+  else if (int kind = gzxz_detect(tr->data, tr->len))
+  {
+    if (tr->map)
+    {
+      tr->gzxz = gzxz_open(kind, NULL, tr->data, tr->len);
+      tr->cap = TRACE_BUF_SIZE;
+      tr->buf = (char *)malloc(tr->cap);
+      tr->data = tr->buf;
+    }
+    else
+    {
+      // the whole compressed image with io_uring, else the bytes
+      // read so far ahead of the stream
+      if (tr->uring)
+      {
+        trace_read_image(tr);
+      }
+      else
+      {
+        tr->owned_image = (char *)malloc(tr->len);
+        memcpy(tr->owned_image, tr->buf, tr->len);
+      }
+      tr->gzxz = gzxz_open(kind, tr->uring ? NULL : tr->stream, tr->owned_image, tr->len);
+    }
+    if (!tr->gzxz || !tr->buf)
+    {
+      trace_close(tr);
+      return NULL;
+    }
+    tr->pos = 0;
+    tr->len = 0;
+    tr->eof = 0;
+    trace_fill(tr);
+  }
+
+  // ChampSim and BT9 traces are decoded into records in the buffer
+  if (int kind = foreign_detect(path, tr->data, tr->len))
+  {
+    tr->foreign = foreign_open(kind, tr->data, tr->len, trace_read_foreign, tr);
+    if (!tr->buf)
+    {
+      tr->cap = TRACE_BUF_SIZE;
+      tr->buf = (char *)malloc(tr->cap);
+      if (!tr->buf)
+      {
+        fprintf(stderr, "Error: trace buffer malloc failed\n");
+        exit(1);
+      }
+    }
+    tr->format = TRACE_FMT_BIN;
+    tr->data = tr->buf;
+    tr->pos = 0;
+    tr->len = 0;
+    tr->eof = 0;
+    trace_fill(tr);
+    return tr;
+  }
+
+  // Detect the format by its magic header
+  tr->format = TRACE_FMT_TEXT;
+  if (!tr->bz2 && !tr->gzxz && tr->len >= sizeof(trace_framed_header_t) && !memcmp(tr->data, TRACE_FRAMED_MAGIC, TRACE_MAGIC_LEN))
+  {
+    trace_open_framed(tr);
+  }
+  else if (tr->len >= sizeof(trace_header_t) && !memcmp(tr->data, TRACE_MAGIC, TRACE_MAGIC_LEN))
+  {
+    trace_header_t hdr;
+    memcpy(&hdr, tr->data, sizeof(hdr));
+    if (hdr.version == TRACE_VERSION_IDS && hdr.record_size == sizeof(branch_id_record_t) &&
+        tr->len >= sizeof(trace_header_t) + sizeof(trace_ids_header_t))
+    {
+      trace_open_ids(tr, &hdr);
+    }
+    else if (hdr.version == TRACE_VERSION_STATIC && hdr.record_size == 0)
+    {
+      tr->has_ids = 1;
+      tr->record_size = 0;
+      // The tool can't go back to the count of a trace written into a
+      // pipe, gen_trace.sh's, so 0 there reads to the end as version 1 does
+      tr->num_records = tr->records_left = hdr.num_records ? hdr.num_records : ~0ULL;
+    }
+    else if (hdr.version != TRACE_VERSION || hdr.record_size != sizeof(branch_record_t))
+    {
+      fprintf(stderr, "Error: unsupported binary trace version %u\n", hdr.version);
+      exit(1);
+    }
+    tr->format = TRACE_FMT_BIN;
+    tr->data_offset = sizeof(trace_header_t) + (hdr.version == TRACE_VERSION_IDS ? sizeof(trace_ids_header_t) : 0);
+    tr->pos = tr->data_offset;
+  }
+
+  return tr;
+}
+
+trace_reader_t *trace_open_shm(const char *name)
+{
+  shm_ring_t *shm = shm_ring_attach(name);
+  if (!shm)
+  {
+    return NULL;
+  }
+  trace_reader_t *tr = (trace_reader_t *)calloc(1, sizeof(trace_reader_t));
+  tr->shm = shm;
+  tr->format = TRACE_FMT_BIN;
+  tr->record_size = sizeof(branch_record_t);
+  tr->num_records = tr->records_left = ~0ULL;
+  return tr;
+}
+
+// Parse a hex field with an optional 0x prefix
+//
+static inline const char *trace_parse_hex(const char *p, const char *end, uint32_t *val)
+{
+  if (p + 1 < end && p[0] == '0' && p[1] == 'x')
+  {
+    p += 2;
+  }
+  const char *start = p;
+  uint32_t v = 0;
+  for (; p < end; p++)
+  {
+    unsigned c = (unsigned char)*p;
+    unsigned d = c - '0';
+    unsigned h = (c | 0x20) - 'a';
+    if (d < 10)
+    {
+      v = (v << 4) | d;
+    }
+    else if (h < 6)
+    {
+      v = (v << 4) | (h + 10);
+    }
+    else
+    {
+      break;
+    }
+  }
+  *val = v;
+  return p == start ? NULL : p;
+}
+
+int trace_parse_text(const char *line, const char *end, branch_record_t *rec)
+{
+  uint32_t pc, target;
+  const char *p = trace_parse_hex(line, end, &pc);
+  if (!p || p == end || *p != '\t')
+  {
+    return 0;
+  }
+  p = trace_parse_hex(p + 1, end, &target);
+  if (!p)
+  {
+    return 0;
+  }
+
+  // five single digit flags, each preceded by a tab
+  uint8_t flags = 0;
+  for (int f = 0; f < 5; f++, p += 2)
+  {
+    if (p + 1 >= end || p[0] != '\t' || (p[1] != '0' && p[1] != '1'))
+    {
+      return 0;
+    }
+    flags |= (p[1] - '0') << f;
+  }
+  rec->pc = pc;
+  rec->target = target;
+  rec->flags = flags;
+  return 1;
+}
+
+// Find the next newline-terminated line, refilling the buffer
+// as needed
+//
+// Returns a pointer to the line end, NULL at the end of the trace
+//
+static const char *trace_next_line(trace_reader_t *tr)
+{
+  for (;;)
+  {
+    const char *line = tr->data + tr->pos;
+    const char *nl = (const char *)memchr(line, '\n', tr->len - tr->pos);
+    if (nl)
+    {
+      return nl;
+    }
+    if (tr->eof)
+    {
+      // last line without a newline
+      return tr->pos == tr->len ? NULL : tr->data + tr->len;
+    }
+    if (tr->pos == 0 && tr->len == tr->cap)
+    {
+      fprintf(stderr, "Error: trace line too long\n");
+      exit(1);
+    }
+    trace_fill(tr);
+  }
+}
+
+// Bitmask of the tab and newline bytes in p[0..63], in a variant per
+// instruction set, each as a whole stage 1 loop below
+//
+static inline __attribute__((always_inline)) uint64_t trace_delim_mask_scalar(const char *p)
+{
+  uint64_t mask = 0;
+  for (int i = 0; i < 8; i++)
+  {
+    uint64_t x;
+    memcpy(&x, p + 8 * i, 8);
+    // 0x80 in each byte that is zero after the XOR, then one bit a byte
+    uint64_t t = x ^ 0x0909090909090909ULL, n = x ^ 0x0a0a0a0a0a0a0a0aULL;
+    const uint64_t low = 0x7f7f7f7f7f7f7f7fULL;
+    t = ~(((t & low) + low) | t | low);
+    n = ~(((n & low) + low) | n | low);
+    mask |= (((t | n) >> 7) * 0x0102040810204080ULL >> 56) << (8 * i);
+  }
+  return mask;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline __attribute__((always_inline)) uint64_t trace_delim_mask_sse42(const char *p)
+{
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i nl = _mm_set1_epi8('\n');
+  uint64_t mask = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+    uint32_t m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, nl)));
+    mask |= (uint64_t)m << (16 * i);
+  }
+  return mask;
+}
+
+__attribute__((target("avx2"))) static inline uint64_t trace_delim_mask_avx2(const char *p)
+{
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i nl = _mm256_set1_epi8('\n');
+  __m256i a = _mm256_loadu_si256((const __m256i *)p);
+  __m256i b = _mm256_loadu_si256((const __m256i *)(p + 32));
+  uint32_t ma = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(a, tab), _mm256_cmpeq_epi8(a, nl)));
+  uint32_t mb = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(b, tab), _mm256_cmpeq_epi8(b, nl)));
+  return ma | ((uint64_t)mb << 32);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static inline uint64_t trace_delim_mask_avx512(const char *p)
+{
+  __m512i v = _mm512_loadu_si512(p);
+  return _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\t')) | _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\n'));
+}
+#endif
+
+#ifdef __aarch64__
+static inline uint64_t trace_delim_mask_neon(const char *p)
+{
+  // each byte's own bit of its half, summed across the half
+  static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+  const uint8x16_t w = vld1q_u8(weights);
+  uint64_t mask = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    uint8x16_t v = vld1q_u8((const uint8_t *)p + 16 * i);
+    uint8x16_t hit = vandq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('\t')), vceqq_u8(v, vdupq_n_u8('\n'))), w);
+    uint64_t m = vaddv_u8(vget_low_u8(hit)) | (uint64_t)vaddv_u8(vget_high_u8(hit)) << 8;
+    mask |= m << (16 * i);
+  }
+  return mask;
+}
+#endif
+
+// Stage 1 of trace_tokenize: the offsets of the delimiters in [p, p+n)
+// into 'd', 64 bytes at a time, by the mask kernel M
+//
+// Returns the number of offsets
+//
+template <uint64_t (*M)(const char *)>
+static inline __attribute__((always_inline)) size_t trace_delims_with(const char *p, size_t n, uint32_t *d)
+{
+  size_t nd = 0;
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64)
+  {
+    uint64_t mask = M(p + i);
+    while (mask)
+    {
+      d[nd++] = i + __builtin_ctzll(mask);
+      mask &= mask - 1;
+    }
+  }
+  if (i < n)
+  {
+    char tail[64];
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, p + i, n - i);
+    uint64_t mask = M(tail);
+    while (mask)
+    {
+      d[nd++] = i + __builtin_ctzll(mask);
+      mask &= mask - 1;
+    }
+  }
+  return nd;
+}
+
+typedef size_t (*trace_delims_fn)(const char *p, size_t n, uint32_t *d);
+
+static size_t trace_delims_scalar(const char *p, size_t n, uint32_t *d)
+{
+  return trace_delims_with<trace_delim_mask_scalar>(p, n, d);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static size_t trace_delims_sse42(const char *p, size_t n, uint32_t *d)
+{
+  return trace_delims_with<trace_delim_mask_sse42>(p, n, d);
+}
+
+__attribute__((target("avx2"))) static size_t trace_delims_avx2(const char *p, size_t n, uint32_t *d)
+{
+  return trace_delims_with<trace_delim_mask_avx2>(p, n, d);
+}
+
+__attribute__((target("avx512f,avx512bw"))) static size_t trace_delims_avx512(const char *p, size_t n, uint32_t *d)
+{
+  return trace_delims_with<trace_delim_mask_avx512>(p, n, d);
+}
+#endif
+
+#ifdef __aarch64__
+static size_t trace_delims_neon(const char *p, size_t n, uint32_t *d)
+{
+  return trace_delims_with<trace_delim_mask_neon>(p, n, d);
+}
+#endif
+
+// The stage 1 variant of the host, and its instruction set
+static int trace_delims_isa = KERNEL_SCALAR;
+
+static trace_delims_fn trace_delims_select()
+{
+  int best = kernel_best();
+#if defined(__x86_64__) || defined(__i386__)
+  trace_delims_isa = best;
+  switch (best)
+  {
+  case KERNEL_AVX512:
+    return trace_delims_avx512;
+  case KERNEL_AVX2:
+    return trace_delims_avx2;
+  case KERNEL_SSE42:
+    return trace_delims_sse42;
+  }
+#elif defined(__aarch64__)
+  if (best >= KERNEL_NEON)
+  {
+    trace_delims_isa = KERNEL_NEON;
+    return trace_delims_neon;
+  }
+#endif
+  (void)best;
+  trace_delims_isa = KERNEL_SCALAR;
+  return trace_delims_scalar;
+}
+
+static const trace_delims_fn trace_delims = trace_delims_select();
+
+int trace_kernels(kernel_choice_t *out)
+{
+  out[0].kernel = "text tokenizer";
+  out[0].variant = kernel_isa_names[trace_delims_isa];
+  return 1;
+}
+
+// Decode 1..8 hex digits at p; the 8 bytes at p must be readable
+//
+static inline uint32_t trace_hex8(const char *p, int n)
+{
+  uint64_t x;
+  memcpy(&x, p, 8);
+  // '0'-'9' have bit 6 clear, 'a'-'f'/'A'-'F' set: add 9 to the latter
+  uint64_t nib = (x & 0x0f0f0f0f0f0f0f0fULL) + 9 * ((x >> 6) & 0x0101010101010101ULL);
+  // first digit to the top, then drop the bytes past the field
+  nib = __builtin_bswap64(nib) >> (8 * (8 - n));
+  nib = (nib | (nib >> 4)) & 0x00ff00ff00ff00ffULL;
+  nib = (nib | (nib >> 8)) & 0x0000ffff0000ffffULL;
+  nib = (nib | (nib >> 16)) & 0xffffffffULL;
+  return (uint32_t)nib;
+}
+
+// Tokenize the complete lines in [p, p+n) into 'recs', with room in
+// 'd' for the offsets of the delimiters
+//
+// Records the offset just past the last consumed line in 'used'
+//
+// Returns the number of records decoded
+//
+static size_t trace_tokenize(uint32_t *d, const char *p, size_t n, branch_record_t *recs, size_t max, size_t *used)
+{
+  // Stage 1: delimiter offsets, 64 bytes at a time, into 'd'
+  size_t nd = trace_delims(p, n, d);
+
+  // Stage 2: seven delimiters per line in the rigid branchExt form
+  // 0xPC \t 0xTARGET \t d \t d \t d \t d \t d \n
+  size_t out = 0;
+  size_t k = 0;
+  size_t line = 0;
+  while (k < nd && out < max)
+  {
+    if (k + 7 <= nd)
+    {
+      uint32_t t1 = d[k], t2 = d[k + 1], end = d[k + 6];
+      int npc = (int)(t1 - line) - 2;
+      int ntgt = (int)(t2 - t1) - 3;
+      if (end == t2 + 10 && p[end] == '\n' && p[t1] == '\t' && p[t2] == '\t' &&
+          d[k + 2] == t2 + 2 && d[k + 3] == t2 + 4 && d[k + 4] == t2 + 6 && d[k + 5] == t2 + 8 &&
+          p[d[k + 5]] == '\t' && p[d[k + 4]] == '\t' && p[d[k + 3]] == '\t' && p[d[k + 2]] == '\t' &&
+          npc >= 1 && npc <= 8 && ntgt >= 1 && ntgt <= 8 &&
+          p[line] == '0' && p[line + 1] == 'x' && p[t1 + 1] == '0' && p[t1 + 2] == 'x')
+      {
+        const char *f = p + t2 + 1;
+        unsigned bad = 0;
+        uint8_t flags = 0;
+        for (int b = 0; b < 5; b++)
+        {
+          unsigned v = (unsigned char)f[2 * b] - '0';
+          bad |= v;
+          flags |= v << b;
+        }
+        if (bad <= 1)
+        {
+          recs[out].pc = trace_hex8(p + line + 2, npc);
+          recs[out].target = trace_hex8(p + t1 + 3, ntgt);
+          recs[out].flags = flags;
+          out++;
+          k += 7;
+          line = end + 1;
+          continue;
+        }
+      }
+    }
+
+    // Irregular line: resync at its newline and parse it the slow way
+    while (k < nd && p[d[k]] != '\n')
+    {
+      k++;
+    }
+    if (k == nd)
+    {
+      break;
+    }
+    if (trace_parse_text(p + line, p + d[k], &recs[out]))
+    {
+      out++;
+    }
+    line = d[k] + 1;
+    k++;
+  }
+  *used = line;
+  return out;
+}
+
+// Decode the next batch of text records
+//
+static size_t trace_read_text_batch(trace_reader_t *tr, branch_record_t *recs, size_t max)
+{
+  if (!tr->delims)
+  {
+    tr->delims = (uint32_t *)malloc(sizeof(uint32_t) * (TRACE_BATCH * 64 + 64));
+  }
+  size_t out = 0;
+  while (out < max)
+  {
+    // Tokenize whole lines only, enough for the remaining records
+    const char *nl = trace_next_line(tr);
+    if (!nl)
+    {
+      break;
+    }
+    const char *start = tr->data + tr->pos;
+    size_t avail = tr->len - tr->pos;
+    size_t n = (max - out) * 64;
+    if (n > TRACE_BATCH * 64)
+    {
+      n = TRACE_BATCH * 64;
+    }
+    if (n > avail)
+    {
+      n = avail;
+    }
+    const char *last = start + n;
+    while (last > nl && last[-1] != '\n')
+    {
+      last--;
+    }
+    if (last <= nl)
+    {
+      // a single long or unterminated line, parse it the slow way
+      if (trace_parse_text(start, nl, &recs[out]))
+      {
+        out++;
+      }
+      tr->pos = nl - tr->data + (nl < tr->data + tr->len);
+      continue;
+    }
+    size_t used = 0;
+    out += trace_tokenize(tr->delims, start, last - start, recs + out, max - out, &used);
+    tr->pos += used;
+  }
+  return out;
+}
+
+size_t trace_read_text_chunk(trace_reader_t *tr, char *buf, size_t cap)
+{
+  size_t out = 0;
+  const char *nl;
+  while (out < cap && (nl = trace_next_line(tr)))
+  {
+    const char *start = tr->data + tr->pos;
+    const char *end = tr->data + tr->len;
+    const char *line_end = nl + (nl < end);
+    if ((size_t)(line_end - start) > cap - out)
+    {
+      break;
+    }
+    // as many whole lines of the buffer as fit
+    const char *last = (size_t)(end - start) > cap - out ? start + (cap - out) : end;
+    while (last > line_end && last[-1] != '\n' && !(tr->eof && last == end))
+    {
+      last--;
+    }
+    memcpy(buf + out, start, last - start);
+    out += last - start;
+    tr->pos += last - start;
+  }
+  if (out == 0 && tr->pos < tr->len && cap > 0)
+  {
+    fprintf(stderr, "Error: trace line too long\n");
+    exit(1);
+  }
+  return out;
+}
+
+size_t trace_parse_text_chunk(const char *p, size_t n, branch_record_t *recs, size_t max)
+{
+  uint32_t *d = (uint32_t *)malloc(sizeof(uint32_t) * (TRACE_BATCH * 64 + 64));
+  if (!d)
+  {
+    fprintf(stderr, "Error: malloc failed\n");
+    exit(1);
+  }
+  size_t out = 0;
+  size_t pos = 0;
+  while (pos < n && out < max)
+  {
+    const char *start = p + pos;
+    const char *end = p + n;
+    const char *nl = (const char *)memchr(start, '\n', n - pos);
+    nl = nl ? nl : end;
+    const char *last = n - pos > TRACE_BATCH * 64 ? start + TRACE_BATCH * 64 : end;
+    while (last > nl && last[-1] != '\n')
+    {
+      last--;
+    }
+    if (last <= nl)
+    {
+      // a single long or unterminated line, parse it the slow way
+      if (trace_parse_text(start, nl, &recs[out]))
+      {
+        out++;
+      }
+      pos = nl - p + (nl < end);
+      continue;
+    }
+    size_t used = 0;
+    out += trace_tokenize(d, start, last - start, recs + out, max - out, &used);
+    pos += used;
+  }
+  free(d);
+  return out;
+}
+
+// Decode up to 'max' records of a version 3 trace, and their ids when
+// 'ids' is not NULL, taking in the definitions before them and
+// expanding the runs
+//
+static size_t trace_read_static(trace_reader_t *tr, branch_record_t *recs, uint32_t *ids, size_t max)
+{
+  // the longest run of bytes for one record: a definition, then the
+  // record of a far indirect branch
+  const size_t longest = 4 + sizeof(trace_static_entry_t) + 16;
+  if (max > tr->records_left)
+  {
+    max = tr->records_left;
+  }
+  size_t out = 0;
+  while (out < max)
+  {
+    if (tr->repeat_left)
+    {
+      size_t k = max - out < tr->repeat_left ? max - out : (size_t)tr->repeat_left;
+      for (size_t i = 0; i < k; i++)
+      {
+        recs[out + i] = tr->last_rec;
+      }
+      if (ids)
+      {
+        for (size_t i = 0; i < k; i++)
+        {
+          ids[out + i] = tr->last_id;
+        }
+      }
+      tr->repeat_left -= k;
+      out += k;
+      continue;
+    }
+    if (tr->len - tr->pos < longest && !tr->eof)
+    {
+      trace_fill(tr);
+    }
+    size_t avail = tr->len - tr->pos;
+    const char *src = tr->data + tr->pos;
+    uint32_t word;
+    if (avail < 4)
+    {
+      break;
+    }
+    memcpy(&word, src, 4);
+    uint32_t id = word >> TRACE_S_ID_SHIFT;
+    uint32_t tag = word & TRACE_S_TAG_MASK;
+    if (tag == TRACE_S_DEFINE)
+    {
+      if (avail < 4 + sizeof(trace_static_entry_t))
+      {
+        break;
+      }
+      trace_define_static(tr, id, src + 4);
+      tr->pos += 4 + sizeof(trace_static_entry_t);
+      continue;
+    }
+    if (tag == TRACE_S_REPEAT)
+    {
+      if (!tr->num_pcs)
+      {
+        fprintf(stderr, "Error: trace run before any record\n");
+        exit(1);
+      }
+      tr->repeat_left = id;
+      tr->pos += 4;
+      continue;
+    }
+    if (id >= tr->num_pcs)
+    {
+      fprintf(stderr, "Error: trace branch id %u used before its definition\n", id);
+      exit(1);
+    }
+    const trace_static_entry_t *e = &tr->statics[id];
+    branch_record_t *r = &recs[out];
+    r->pc = (uint32_t)e->pc;
+    r->target = (uint32_t)e->target;
+    r->flags = e->flags | (tag == TRACE_S_TAKEN ? TRACE_F_TAKEN : 0);
+    size_t used = 4;
+    if (!(e->flags & TRACE_F_DIRECT))
+    {
+      int32_t delta;
+      if (avail < 8)
+      {
+        break;
+      }
+      memcpy(&delta, src + 4, 4);
+      uint64_t target = e->pc + (int64_t)delta;
+      used = 8;
+      if (delta == TRACE_S_FAR)
+      {
+        if (avail < 16)
+        {
+          break;
+        }
+        memcpy(&target, src + 8, 8);
+        used = 16;
+      }
+      r->target = (uint32_t)target;
+    }
+    if (ids)
+    {
+      ids[out] = id;
+    }
+    tr->last_rec = *r;
+    tr->last_id = id;
+    tr->pos += used;
+    out++;
+  }
+  if (tr->records_left != ~0ULL)
+  {
+    tr->records_left -= out;
+  }
+  return out;
+}
+
+// True when records of the trace can be read from its pipe straight
+// into the caller's array: plain records, not decoded on the way
+//
+static int trace_read_direct(trace_reader_t *tr)
+{
+  return tr->piped && !tr->eof && !tr->frames && !tr->has_ids && !tr->bz2 && !tr->gzxz && !tr->foreign &&
+         tr->record_size == sizeof(branch_record_t);
+}
+
+// Copy up to 'max' stored records of a binary trace, and their ids
+// when 'ids' is not NULL and the trace has them
+//
+static size_t trace_read_bin(trace_reader_t *tr, branch_record_t *recs, uint32_t *ids, size_t max)
+{
+  if (!tr->record_size)
+  {
+    return trace_read_static(tr, recs, ids, max);
+  }
+  size_t rs = tr->record_size;
+  if (max > tr->records_left)
+  {
+    max = tr->records_left;
+  }
+  size_t out = 0;
+  while (out < max)
+  {
+    size_t avail = (tr->len - tr->pos) / rs;
+    if (avail == 0 && trace_read_direct(tr))
+    {
+      // straight from the pipe into the caller's records, after the
+      // part of a record left in buf, up to a record boundary
+      char *dst = (char *)(recs + out);
+      size_t want = (max - out) * rs, got = tr->len - tr->pos;
+      memcpy(dst, tr->data + tr->pos, got);
+      tr->base += tr->len;
+      tr->pos = tr->len = 0;
+      uint64_t start = trace_clock_ns();
+      while (got < rs || got % rs)
+      {
+        size_t n = trace_read_stream(tr, dst + got, want - got);
+        if (n == 0)
+        {
+          tr->eof = 1;
+          break;
+        }
+        tr->base += n;
+        got += n;
+      }
+      tr->decompress_ns += trace_clock_ns() - start;
+      if (got < rs)
+      {
+        break;
+      }
+      out += got / rs;
+      continue;
+    }
+    if (avail == 0)
+    {
+      trace_fill(tr);
+      avail = (tr->len - tr->pos) / rs;
+      if (avail == 0)
+      {
+        break;
+      }
+    }
+    if (avail > max - out)
+    {
+      avail = max - out;
+    }
+    const char *src = tr->data + tr->pos;
+    if (!tr->has_ids)
+    {
+      memcpy(recs + out, src, avail * sizeof(branch_record_t));
+    }
+    else
+    {
+      for (size_t i = 0; i < avail; i++, src += rs)
+      {
+        memcpy(&recs[out + i], src, sizeof(branch_record_t));
+        if (ids)
+        {
+          memcpy(&ids[out + i], src + sizeof(branch_record_t), sizeof(uint32_t));
+        }
+      }
+    }
+    tr->pos += avail * rs;
+    out += avail;
+  }
+  if (tr->records_left != ~0ULL)
+  {
+    tr->records_left -= out;
+  }
+  return out;
+}
+
+size_t trace_read_batch(trace_reader_t *tr, branch_record_t *recs, size_t max)
+{
+  uint64_t start = trace_clock_ns();
+  size_t n;
+  if (tr->format == TRACE_FMT_TEXT)
+  {
+    n = trace_read_text_batch(tr, recs, max);
+  }
+  else
+  {
+    n = trace_read_bin(tr, recs, NULL, max);
+  }
+  tr->read_ns += trace_clock_ns() - start;
+  return n;
+}
+
+size_t trace_read_view(trace_reader_t *tr, const branch_record_t **recs, size_t max)
+{
+  uint64_t start = trace_clock_ns();
+  if (max > tr->records_left)
+  {
+    max = tr->records_left;
+  }
+  size_t avail = (tr->len - tr->pos) / sizeof(branch_record_t);
+  if (avail == 0 && max)
+  {
+    trace_fill(tr);
+    avail = (tr->len - tr->pos) / sizeof(branch_record_t);
+  }
+  if (avail > max)
+  {
+    avail = max;
+  }
+  *recs = (const branch_record_t *)(tr->data + tr->pos);
+  tr->pos += avail * sizeof(branch_record_t);
+  if (tr->records_left != ~0ULL)
+  {
+    tr->records_left -= avail;
+  }
+  tr->read_ns += trace_clock_ns() - start;
+  return avail;
+}
+
+size_t trace_read_batch_ids(trace_reader_t *tr, branch_record_t *recs, uint32_t *ids, size_t max)
+{
+  if (tr->has_ids)
+  {
+    uint64_t start = trace_clock_ns();
+    size_t n = trace_read_bin(tr, recs, ids, max);
+    tr->read_ns += trace_clock_ns() - start;
+    return n;
+  }
+  size_t n = trace_read_batch(tr, recs, max);
+  if (!tr->pc_map)
+  {
+    tr->pc_map = (pc_map_t *)malloc(sizeof(pc_map_t));
+    pc_map_init(tr->pc_map);
+  }
+  for (size_t i = 0; i < n; i++)
+  {
+    ids[i] = pc_map_id(tr->pc_map, recs[i].pc);
+  }
+  return n;
+}
+
+uint32_t trace_num_pcs(trace_reader_t *tr)
+{
+  if (tr->has_ids)
+  {
+    return tr->num_pcs;
+  }
+  return tr->pc_map ? tr->pc_map->count : 0;
+}
+
+const uint32_t *trace_pc_dict(trace_reader_t *tr)
+{
+  if (tr->has_ids)
+  {
+    return tr->pc_dict;
+  }
+  return tr->pc_map ? tr->pc_map->pcs : NULL;
+}
+
+uint64_t trace_pc64(trace_reader_t *tr, uint32_t id)
+{
+  if (tr->statics)
+  {
+    return id < tr->num_pcs ? tr->statics[id].pc : 0;
+  }
+  const uint32_t *dict = trace_pc_dict(tr);
+  return dict && id < trace_num_pcs(tr) ? dict[id] : 0;
+}
+
+int trace_read(trace_reader_t *tr, branch_record_t *rec)
+{
+  if (tr->format == TRACE_FMT_TEXT)
+  {
+    if (tr->batch_pos == tr->batch_len)
+    {
+      if (!tr->batch)
+      {
+        tr->batch = (branch_record_t *)malloc(sizeof(branch_record_t) * TRACE_BATCH);
+      }
+      tr->batch_pos = 0;
+      tr->batch_len = trace_read_text_batch(tr, tr->batch, TRACE_BATCH);
+      if (tr->batch_len == 0)
+      {
+        return 0;
+      }
+    }
+    *rec = tr->batch[tr->batch_pos++];
+    return 1;
+  }
+  return trace_read_bin(tr, rec, NULL, 1) == 1;
+}
+
+void trace_set_fields(trace_reader_t *tr, uint32_t fields)
+{
+  tr->skip_fields = TRACE_FIELD_ALL & ~fields;
+  for (int i = 0; i < tr->num_parts; i++)
+  {
+    trace_set_fields(tr->parts[i], fields);
+  }
+}
+
+int trace_seek(trace_reader_t *tr, uint64_t record)
+{
+  // version 3 records have no fixed size
+  if (tr->format != TRACE_FMT_BIN || tr->bz2 || tr->gzxz || tr->foreign || !tr->record_size)
+  {
+    return 0;
+  }
+
+  if (tr->archive)
+  {
+    // Decode from the chunk holding the record on
+    record = record < tr->num_records ? record : tr->num_records;
+    uint64_t off = tr->data_offset + record * tr->record_size;
+    if (!archive_seek(tr->archive, off))
+    {
+      return 0;
+    }
+    tr->base = off;
+    tr->pos = tr->len = 0;
+    tr->eof = 0;
+    tr->batch_pos = tr->batch_len = 0;
+    if (tr->num_records != ~0ULL)
+    {
+      tr->records_left = tr->num_records - record;
+    }
+    trace_fill(tr);
+    return 1;
+  }
+
+  if (tr->synth)
+  {
+    record = record < tr->num_records ? record : tr->num_records;
+    tr->synth_next = record;
+    tr->pos = tr->len = 0;
+    tr->eof = 0;
+    tr->records_left = tr->num_records - record;
+    return 1;
+  }
+
+  if (tr->frames)
+  {
+    // Last frame starting at or before 'record'
+    uint64_t lo = 0, hi = tr->frame_hdr.num_frames;
+    while (hi - lo > 1)
+    {
+      uint64_t mid = (lo + hi) / 2;
+      if (tr->frames[mid].first_record <= record)
+      {
+        lo = mid;
+      }
+      else
+      {
+        hi = mid;
+      }
+    }
+    if (record >= tr->frame_hdr.num_records)
+    {
+      tr->pos = tr->len;
+      tr->next_frame = tr->frame_hdr.num_frames;
+      return 1;
+    }
+    trace_decode_frame(tr, lo);
+    tr->pos = (record - tr->frames[lo].first_record) * sizeof(branch_record_t);
+    return 1;
+  }
+
+  if (!tr->map)
+  {
+    return 0;
+  }
+  if (record > tr->num_records)
+  {
+    record = tr->num_records;
+  }
+  size_t off = tr->data_offset + record * tr->record_size;
+  tr->pos = off < tr->len ? off : tr->len;
+  if (tr->num_records != ~0ULL)
+  {
+    tr->records_left = tr->num_records - record;
+  }
+  return 1;
+}
+
+uint64_t trace_skip(trace_reader_t *tr, uint64_t n)
+{
+  branch_record_t recs[TRACE_BATCH];
+  uint64_t skipped = 0;
+
+  // Records already decoded by trace_read
+  uint64_t cached = tr->batch_len - tr->batch_pos;
+  if (cached > n)
+  {
+    cached = n;
+  }
+  tr->batch_pos += cached;
+  skipped += cached;
+
+  while (skipped < n)
+  {
+    size_t want = n - skipped < TRACE_BATCH ? n - skipped : TRACE_BATCH;
+    size_t got = trace_read_batch(tr, recs, want);
+    if (got == 0)
+    {
+      break;
+    }
+    skipped += got;
+  }
+  return skipped;
+}
+
+int trace_next_text_line(trace_reader_t *tr, const char **line, const char **end, uint64_t *offset)
+{
+  const char *nl = trace_next_line(tr);
+  if (!nl)
+  {
+    return 0;
+  }
+  *line = tr->data + tr->pos;
+  *end = nl;
+  *offset = tr->base + tr->pos;
+  tr->pos = nl - tr->data + (nl < tr->data + tr->len);
+  return 1;
+}
+
+int trace_seek_stream(trace_reader_t *tr, uint64_t offset, const uint64_t *block_starts, size_t nblocks)
+{
+  if (tr->format != TRACE_FMT_TEXT || tr->gzxz || tr->archive)
+  {
+    return 0;
+  }
+  if (trace_mapped(tr))
+  {
+    if (offset > tr->len)
+    {
+      return 0;
+    }
+    tr->pos = offset;
+    tr->batch_pos = tr->batch_len = 0;
+    return 1;
+  }
+
+  uint64_t start = offset;
+  if (tr->bz2)
+  {
+    // Last block starting at or before 'offset'
+    size_t b = 0;
+    while (b + 1 < nblocks && block_starts[b + 1] <= offset)
+    {
+      b++;
+    }
+    if (nblocks == 0 || nblocks != bz2_block_starts(tr->bz2, NULL) || !bz2_seek_block(tr->bz2, b))
+    {
+      return 0;
+    }
+    start = block_starts[b];
+  }
+  else if (tr->uring)
+  {
+    uring_seek(tr->uring, offset);
+  }
+  else if (fseeko(tr->stream, offset, SEEK_SET))
+  {
+    return 0;
+  }
+  tr->base = start;
+  tr->pos = tr->len = 0;
+  tr->eof = 0;
+  tr->batch_pos = tr->batch_len = 0;
+
+  // Drop the decompressed bytes in front of 'offset'
+  for (;;)
+  {
+    trace_fill(tr);
+    if (offset <= tr->base + tr->len)
+    {
+      tr->pos = offset - tr->base;
+      return 1;
+    }
+    if (tr->eof)
+    {
+      tr->pos = tr->len;
+      return 0;
+    }
+    tr->pos = tr->len;
+  }
+}
+
+void trace_close(trace_reader_t *tr)
+{
+  if (!tr)
+  {
+    return;
+  }
+  foreign_close(tr->foreign);
+  bz2_close(tr->bz2);
+  gzxz_close(tr->gzxz);
+  archive_close(tr->archive);
+  uring_close(tr->uring);
+  remote_close(tr->remote);
+  shm_ring_detach(tr->shm);
+  synth_close(tr->synth);
+  for (int i = 0; i < tr->num_parts; i++)
+  {
+    trace_close(tr->parts[i]);
+  }
+  free(tr->parts);
+  free(tr->part_batch);
+  if (tr->map)
+  {
+    munmap(tr->map, tr->map_len);
+  }
+  if (tr->stream && tr->stream != stdin)
+  {
+    fclose(tr->stream);
+  }
+  free(tr->buf);
+  free(tr->batch);
+  free(tr->delims);
+  free(tr->owned_image);
+  free(tr->scratch);
+  free(tr->pc_dict);
+  if (tr->pc_map)
+  {
+    pc_map_free(tr->pc_map);
+    free(tr->pc_map);
+  }
+  free(tr);
+}
+
+int trace_write_header(FILE *out, uint64_t num_records)
+{
+  trace_header_t hdr;
+  memcpy(hdr.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+  hdr.version = TRACE_VERSION;
+  hdr.record_size = sizeof(branch_record_t);
+  hdr.num_records = num_records;
+  return fwrite(&hdr, sizeof(hdr), 1, out) == 1;
+}
+
+// Write the headers of a version 2 trace with dense PC ids
+//
+static int trace_write_ids_header(trace_writer_t *tw)
+{
+  trace_header_t hdr;
+  memcpy(hdr.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+  hdr.version = TRACE_VERSION_IDS;
+  hdr.record_size = sizeof(branch_id_record_t);
+  hdr.num_records = tw->num_records;
+  trace_ids_header_t ids;
+  ids.num_pcs = tw->pc_map->count;
+  ids.reserved = 0;
+  ids.dict_offset = sizeof(hdr) + sizeof(ids) + tw->num_records * sizeof(branch_id_record_t);
+  return fwrite(&hdr, sizeof(hdr), 1, tw->out) == 1 && fwrite(&ids, sizeof(ids), 1, tw->out) == 1;
+}
+
+// Write the header of a version 3 trace
+//
+static int trace_write_static_header(trace_writer_t *tw)
+{
+  trace_header_t hdr;
+  memcpy(hdr.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+  hdr.version = TRACE_VERSION_STATIC;
+  hdr.record_size = 0;
+  hdr.num_records = tw->num_records;
+  return fwrite(&hdr, sizeof(hdr), 1, tw->out) == 1;
+}
+
+// Append the pending run of the last record to 'p'
+//
+static inline char *trace_put_run(trace_writer_t *tw, char *p)
+{
+  if (tw->run)
+  {
+    uint32_t word = (uint32_t)tw->run << TRACE_S_ID_SHIFT | TRACE_S_REPEAT;
+    memcpy(p, &word, 4);
+    p += 4;
+    tw->run = 0;
+  }
+  return p;
+}
+
+// Append 'n' records to a version 3 trace. A PC met again with other
+// static bits or another direct target is defined again
+//
+// Returns True if Successful
+//
+static int trace_write_static(trace_writer_t *tw, const branch_record_t *recs, size_t n)
+{
+  // a run, a definition and the record of a far indirect branch
+  char out[TRACE_BATCH * (8 + sizeof(trace_static_entry_t) + 16)];
+  while (n > 0)
+  {
+    size_t k = n < TRACE_BATCH ? n : TRACE_BATCH;
+    char *p = out;
+    for (size_t i = 0; i < k; i++)
+    {
+      const branch_record_t *r = &recs[i];
+      if (tw->num_records && !memcmp(r, &tw->last, sizeof(*r)))
+      {
+        tw->num_records++;
+        if (++tw->run == TRACE_S_RUN_MAX)
+        {
+          p = trace_put_run(tw, p);
+        }
+        continue;
+      }
+      p = trace_put_run(tw, p);
+      uint32_t id = pc_map_id(tw->pc_map, r->pc);
+      if (id >= tw->statics_cap)
+      {
+        uint32_t cap = tw->statics_cap ? tw->statics_cap * 2 : 4096;
+        tw->statics = (trace_static_entry_t *)realloc(tw->statics, cap * sizeof(trace_static_entry_t));
+        if (!tw->statics)
+        {
+          fprintf(stderr, "Error: trace writer malloc failed\n");
+          exit(1);
+        }
+        tw->statics_cap = cap;
+      }
+      trace_static_entry_t e;
+      e.pc = r->pc;
+      e.target = (r->flags & TRACE_F_DIRECT) ? r->target : 0;
+      e.flags = r->flags & ~TRACE_F_TAKEN;
+      int fresh = id == tw->num_defined;
+      if (fresh || memcmp(&tw->statics[id], &e, sizeof(e)))
+      {
+        tw->num_defined += fresh;
+        tw->statics[id] = e;
+        uint32_t word = id << TRACE_S_ID_SHIFT | TRACE_S_DEFINE;
+        memcpy(p, &word, 4);
+        memcpy(p + 4, &e, sizeof(e));
+        p += 4 + sizeof(e);
+      }
+      uint32_t word = id << TRACE_S_ID_SHIFT | ((r->flags & TRACE_F_TAKEN) ? TRACE_S_TAKEN : 0);
+      memcpy(p, &word, 4);
+      p += 4;
+      if (!(r->flags & TRACE_F_DIRECT))
+      {
+        int64_t delta = (int64_t)r->target - r->pc;
+        int32_t near = delta == (int32_t)delta ? (int32_t)delta : TRACE_S_FAR;
+        memcpy(p, &near, 4);
+        p += 4;
+        if (near == TRACE_S_FAR)
+        {
+          uint64_t target = r->target;
+          memcpy(p, &target, 8);
+          p += 8;
+        }
+      }
+      tw->last = *r;
+      tw->num_records++;
+    }
+    if (fwrite(out, 1, p - out, tw->out) != (size_t)(p - out))
+    {
+      return 0;
+    }
+    recs += k;
+    n -= k;
+  }
+  return 1;
+}
+
+// Compress and append the pending records as one frame
+//
+// Returns True if Successful
+//
+static int trace_writer_flush(trace_writer_t *tw)
+{
+  if (tw->npending == 0)
+  {
+    return 1;
+  }
+  const char *payload = (const char *)tw->pending;
+  size_t len = tw->npending * sizeof(branch_record_t);
+  if (tw->layout == TRACE_LAYOUT_COLUMNAR)
+  {
+    len = columnar_encode(tw->pending, tw->npending, tw->encoded);
+    payload = tw->encoded;
+  }
+  size_t n = codec_compress(tw->codec, tw->comp, tw->comp_cap, payload, len, tw->level);
+  if (n == 0 || fwrite(tw->comp, 1, n, tw->out) != n)
+  {
+    return 0;
+  }
+  if (tw->nframes == tw->index_cap)
+  {
+    tw->index_cap = tw->index_cap ? tw->index_cap * 2 : 64;
+    tw->index = (trace_frame_t *)realloc(tw->index, tw->index_cap * sizeof(trace_frame_t));
+    tw->sums = (uint64_t *)realloc(tw->sums, tw->index_cap * sizeof(uint64_t));
+  }
+  tw->sums[tw->nframes] = xxh3_64(tw->comp, n);
+  trace_frame_t *frame = &tw->index[tw->nframes++];
+  frame->first_record = tw->num_records;
+  frame->offset = tw->offset;
+  frame->comp_size = (uint32_t)n;
+  frame->num_records = (uint32_t)tw->npending;
+  tw->num_records += tw->npending;
+  tw->offset += n;
+  tw->npending = 0;
+  return 1;
+}
+
+// Write the header of the framed format
+//
+static int trace_write_framed_header(trace_writer_t *tw)
+{
+  trace_framed_header_t hdr;
+  memcpy(hdr.magic, TRACE_FRAMED_MAGIC, TRACE_MAGIC_LEN);
+  hdr.version = TRACE_FRAMED_VERSION;
+  hdr.codec = tw->codec;
+  hdr.record_size = sizeof(branch_record_t);
+  hdr.frame_records = tw->frame_records;
+  hdr.num_records = tw->num_records;
+  hdr.num_frames = tw->nframes;
+  hdr.index_offset = tw->offset;
+  hdr.layout = tw->layout;
+  hdr.reserved = 0;
+  return fwrite(&hdr, sizeof(hdr), 1, tw->out) == 1;
+}
+
+trace_writer_t *trace_writer_open(const char *path, int codec, int layout, int level, size_t frame_records)
+{
+  if (codec >= 0 && !codec_available(codec))
+  {
+    fprintf(stderr, "Error: the %s codec library is not available\n", codec_name(codec));
+    return NULL;
+  }
+  FILE *out = fopen(path, "wb");
+  if (!out)
+  {
+    return NULL;
+  }
+  trace_writer_t *tw = (trace_writer_t *)calloc(1, sizeof(trace_writer_t));
+  tw->out = out;
+  tw->codec = codec;
+  tw->layout = layout;
+  tw->level = level;
+  tw->frame_records = frame_records ? frame_records : TRACE_FRAME_RECORDS;
+  if (codec < 0)
+  {
+    trace_write_header(out, 0);
+    return tw;
+  }
+
+  size_t raw = tw->frame_records * sizeof(branch_record_t);
+  if (layout == TRACE_LAYOUT_COLUMNAR)
+  {
+    raw = columnar_bound(tw->frame_records);
+    tw->encoded = (char *)malloc(raw);
+  }
+  tw->pending = (branch_record_t *)malloc(tw->frame_records * sizeof(branch_record_t));
+  tw->comp_cap = codec_bound(codec, raw);
+  tw->comp = (char *)malloc(tw->comp_cap);
+  if (!tw->pending || !tw->comp || (layout == TRACE_LAYOUT_COLUMNAR && !tw->encoded))
+  {
+    fprintf(stderr, "Error: trace writer malloc failed\n");
+    exit(1);
+  }
+  trace_write_framed_header(tw);
+  tw->offset = sizeof(trace_framed_header_t);
+  return tw;
+}
+
+int trace_writer_use_ids(trace_writer_t *tw)
+{
+  if (tw->codec >= 0 || tw->num_records > 0 || tw->pc_map)
+  {
+    return 0;
+  }
+  tw->pc_map = (pc_map_t *)malloc(sizeof(pc_map_t));
+  pc_map_init(tw->pc_map);
+  return !fseek(tw->out, 0, SEEK_SET) && trace_write_ids_header(tw);
+}
+
+int trace_writer_use_static(trace_writer_t *tw)
+{
+  if (tw->codec >= 0 || tw->num_records > 0 || tw->pc_map)
+  {
+    return 0;
+  }
+  tw->pc_map = (pc_map_t *)malloc(sizeof(pc_map_t));
+  pc_map_init(tw->pc_map);
+  tw->static_out = 1;
+  return !fseek(tw->out, 0, SEEK_SET) && trace_write_static_header(tw);
+}
+
+int trace_writer_write(trace_writer_t *tw, const branch_record_t *recs, size_t n)
+{
+  if (tw->static_out)
+  {
+    return trace_write_static(tw, recs, n);
+  }
+  if (tw->pc_map)
+  {
+    branch_id_record_t out[TRACE_BATCH];
+    while (n > 0)
+    {
+      size_t k = n < TRACE_BATCH ? n : TRACE_BATCH;
+      for (size_t i = 0; i < k; i++)
+      {
+        out[i].rec = recs[i];
+        out[i].id = pc_map_id(tw->pc_map, recs[i].pc);
+      }
+      if (fwrite(out, sizeof(branch_id_record_t), k, tw->out) != k)
+      {
+        return 0;
+      }
+      tw->num_records += k;
+      recs += k;
+      n -= k;
+    }
+    return 1;
+  }
+  if (tw->codec < 0)
+  {
+    tw->num_records += n;
+    return fwrite(recs, sizeof(branch_record_t), n, tw->out) == n;
+  }
+  while (n > 0)
+  {
+    size_t k = tw->frame_records - tw->npending;
+    if (k > n)
+    {
+      k = n;
+    }
+    memcpy(tw->pending + tw->npending, recs, k * sizeof(branch_record_t));
+    tw->npending += k;
+    recs += k;
+    n -= k;
+    if (tw->npending == tw->frame_records && !trace_writer_flush(tw))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int trace_writer_close(trace_writer_t *tw)
+{
+  int ok = 1;
+  if (tw->static_out)
+  {
+    char run[4];
+    size_t len = trace_put_run(tw, run) - run;
+    ok = fwrite(run, 1, len, tw->out) == len && !fseek(tw->out, 0, SEEK_SET) && trace_write_static_header(tw);
+    pc_map_free(tw->pc_map);
+    free(tw->pc_map);
+    free(tw->statics);
+  }
+  else if (tw->pc_map)
+  {
+    ok = fwrite(tw->pc_map->pcs, sizeof(uint32_t), tw->pc_map->count, tw->out) == tw->pc_map->count &&
+         !fseek(tw->out, 0, SEEK_SET) && trace_write_ids_header(tw);
+    pc_map_free(tw->pc_map);
+    free(tw->pc_map);
+  }
+  else if (tw->codec < 0)
+  {
+    ok = !fseek(tw->out, 0, SEEK_SET) && trace_write_header(tw->out, tw->num_records);
+  }
+  else
+  {
+    ok = trace_writer_flush(tw) &&
+         fwrite(tw->index, sizeof(trace_frame_t), tw->nframes, tw->out) == tw->nframes &&
+         fwrite(tw->sums, sizeof(uint64_t), tw->nframes, tw->out) == tw->nframes && !fseek(tw->out, 0, SEEK_SET) && trace_write_framed_header(tw);
+  }
+  ok = !fclose(tw->out) && ok;
+  free(tw->pending);
+  free(tw->comp);
+  free(tw->encoded);
+  free(tw->index);
+  free(tw->sums);
+  free(tw);
+  return ok;
+}
@@ -0,0 +1,551 @@
+//========================================================//
+//  trace.h                                               //
+//  Header file for the branch trace readers              //
+//                                                        //
+//  Defines the packed binary record format and the       //
+//  reader used by the driver and the trace tools         //
+//========================================================//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "bz2reader.h"
+#include "gzxz.h"
+#include "archive.h"
+#include "pcmap.h"
+#include "shmring.h"
+#include "synth.h"
+#include "uring.h"
+#include "kernels.h"
+
+//------------------------------------//
+//        Binary Trace Format         //
+//------------------------------------//
+
+// A binary trace is a trace_header_t followed by num_records packed
+// branch_record_t entries, all little endian.
+//
+#define TRACE_MAGIC "BPTRACE1"
+#define TRACE_MAGIC_LEN 8
+#define TRACE_VERSION 1
+
+// Version 2 adds dense PC ids: the header is followed by a
+// trace_ids_header_t, the records are branch_id_record_t and the
+// num_pcs PCs of the dictionary, indexed by id, follow the records
+#define TRACE_VERSION_IDS 2
+
+// Version 3, written by branchExt -format ids and tobin --static,
+// keeps the static part of each branch in a table instead of in
+// every record. Its entries have no fixed size (record_size is 0):
+// each starts with a uint32 word whose low bits are a TRACE_S_* tag
+//  - a record, (id << TRACE_S_ID_SHIFT) | TRACE_S_TAKEN if taken,
+//    followed by the target when the id is of an indirect branch:
+//    an int32 distance from the PC, or TRACE_S_FAR and the uint64
+//    target when it is further away
+//  - a definition of the id, (id << TRACE_S_ID_SHIFT) |
+//    TRACE_S_DEFINE followed by a trace_static_entry_t, before the
+//    first record of the id
+//  - a run, (n << TRACE_S_ID_SHIFT) | TRACE_S_REPEAT: n more copies
+//    of the record before, as hot loops repeat one branch
+// Addresses are the full 64 bits the extractor saw, so branches
+// whose low halves alias keep their own ids. num_records counts the
+// records with the runs expanded
+#define TRACE_VERSION_STATIC 3
+#define TRACE_S_TAKEN  1
+#define TRACE_S_DEFINE 2
+#define TRACE_S_REPEAT 3
+#define TRACE_S_TAG_MASK 3
+#define TRACE_S_ID_SHIFT 2
+#define TRACE_S_RUN_MAX ((1u << (32 - TRACE_S_ID_SHIFT)) - 1)
+#define TRACE_S_FAR ((int32_t)0x80000000)
+
+// Flag bits of branch_record_t.flags, in the column order of the
+// text format produced by branchExt
+#define TRACE_F_TAKEN     (1 << 0)
+#define TRACE_F_CONDITION (1 << 1)
+#define TRACE_F_CALL      (1 << 2)
+#define TRACE_F_RET       (1 << 3)
+#define TRACE_F_DIRECT    (1 << 4)
+
+// Alone in the flags of a record standing for up to TRACE_SUMMARY_MAX
+// unconditional branches dropped by tobin --gap-summary, oldest first:
+// the pc field holds their count above TRACE_SUMMARY_SHIFT and below
+// it the low PC bits of each, the target field the taken ones' count
+// and target bits, as the path and target histories take them (see
+// history.h)
+#define TRACE_F_SUMMARY   (1 << 5)
+#define TRACE_SUMMARY_MAX 12
+#define TRACE_SUMMARY_SHIFT 24
+
+// Alone in the flags of a record, with pc and target 0, where the
+// records stop following each other: between the sampled branch
+// stacks bplbr writes. --sample=breaks takes each stretch between two
+// as a window
+#define TRACE_F_BREAK     (1 << 6)
+
+// Fields of a record a reader may leave undecoded, see
+// trace_set_fields; the pc, TRACE_F_TAKEN and TRACE_F_CONDITION always
+// are. The flag ones are the flag bits, as BP_FIELD_* of predictor.h
+#define TRACE_FIELD_CALL   TRACE_F_CALL
+#define TRACE_FIELD_RET    TRACE_F_RET
+#define TRACE_FIELD_DIRECT TRACE_F_DIRECT
+#define TRACE_FIELD_TARGET (1 << 7)
+#define TRACE_FIELD_ALL    (TRACE_FIELD_CALL | TRACE_FIELD_RET | TRACE_FIELD_DIRECT | TRACE_FIELD_TARGET)
+
+typedef struct __attribute__((packed))
+{
+  char magic[TRACE_MAGIC_LEN]; // TRACE_MAGIC, not NUL terminated
+  uint32_t version;            // TRACE_VERSION
+  uint32_t record_size;        // sizeof(branch_record_t)
+  uint64_t num_records;        // number of records following the header
+} trace_header_t;
+
+typedef struct __attribute__((packed))
+{
+  uint32_t pc;     // branch address
+  uint32_t target; // branch target
+  uint8_t flags;   // TRACE_F_* bits
+} branch_record_t;
+
+typedef struct __attribute__((packed))
+{
+  uint32_t num_pcs;     // distinct branch PCs, ids are 0..num_pcs-1
+  uint32_t reserved;
+  uint64_t dict_offset; // byte offset of the PC dictionary
+} trace_ids_header_t;
+
+typedef struct __attribute__((packed))
+{
+  branch_record_t rec;
+  uint32_t id; // dense id of rec.pc
+} branch_id_record_t;
+
+typedef struct __attribute__((packed))
+{
+  uint64_t pc;     // branch address
+  uint64_t target; // target of a direct branch, 0 for an indirect one
+  uint8_t flags;   // TRACE_F_* bits but TRACE_F_TAKEN
+} trace_static_entry_t;
+
+// Helpers to pack and unpack the flag byte
+//
+static inline uint8_t trace_pack_flags(uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+{
+  return (uint8_t)((outcome ? TRACE_F_TAKEN : 0) | (condition ? TRACE_F_CONDITION : 0) |
+                   (call ? TRACE_F_CALL : 0) | (ret ? TRACE_F_RET : 0) | (direct ? TRACE_F_DIRECT : 0));
+}
+
+#define TRACE_FLAG(rec, f) (((rec)->flags & (f)) ? 1 : 0)
+
+//------------------------------------//
+//        Framed Trace Format         //
+//------------------------------------//
+
+// A framed trace is a trace_framed_header_t, then num_frames
+// independently compressed runs of frame_records packed records,
+// then the frame index at index_offset. Any record can be reached by
+// decoding a single frame. From version 3 the index is followed by
+// num_frames uint64 XXH3-64 checksums of the compressed frames, see
+// xxh3.h and trace_check_frames.
+//
+#define TRACE_FRAMED_MAGIC "BPFRAME1"
+#define TRACE_FRAMED_VERSION 3
+#define TRACE_FRAME_RECORDS (1 << 20)
+
+// Frame payload layouts, before compression
+#define TRACE_LAYOUT_ROWS 0     // packed branch_record_t
+#define TRACE_LAYOUT_COLUMNAR 1 // delta encoded columns, see columnar.h
+
+typedef struct __attribute__((packed))
+{
+  char magic[TRACE_MAGIC_LEN]; // TRACE_FRAMED_MAGIC
+  uint32_t version;            // TRACE_FRAMED_VERSION
+  uint32_t codec;              // CODEC_* of every frame
+  uint32_t record_size;        // sizeof(branch_record_t)
+  uint32_t frame_records;      // records per frame, the last may be short
+  uint64_t num_records;
+  uint64_t num_frames;
+  uint64_t index_offset;       // byte offset of num_frames trace_frame_t
+  uint32_t layout;             // TRACE_LAYOUT_*, absent in version 1
+  uint32_t reserved;
+} trace_framed_header_t;
+
+// Size of the version 1 header, which had no layout field
+#define TRACE_FRAMED_V1_SIZE 48
+
+typedef struct __attribute__((packed))
+{
+  uint64_t first_record; // branch number of the first record in the frame
+  uint64_t offset;       // byte offset of the compressed frame
+  uint32_t comp_size;    // compressed bytes
+  uint32_t num_records;  // records in the frame
+} trace_frame_t;
+
+//------------------------------------//
+//            Trace Reader            //
+//------------------------------------//
+
+// Input formats detected by trace_open
+#define TRACE_FMT_TEXT 0
+#define TRACE_FMT_BIN 1
+
+// Compositions of traces read by trace_open, each part up to the
+// slice before the next one
+#define TRACE_COMPOSE_PARTS 64
+#define TRACE_COMPOSE_SLICE 1000000
+
+typedef struct trace_reader
+{
+  FILE *stream;      // underlying input
+  bz2_reader_t *bz2; // in-process decoder when the input is bzip2
+  gzxz_reader_t *gzxz; // in-process decoder when the input is gzip or xz
+  archive_reader_t *archive; // stream of a trace in an archive, see archive.h
+  struct foreign *foreign; // decoder of a ChampSim or BT9 trace, see foreign.h
+  uring_reader_t *uring; // reads of stream through io_uring, see uring.h
+  int piped;         // stream is a pipe or socket, read with read(2)
+  struct remote *remote; // frames fetched from object storage, see remote.h
+  int format;        // TRACE_FMT_*
+  const char *data;  // current window: the mapped file or buf
+  size_t pos;        // first unconsumed byte in data
+  size_t len;        // number of valid bytes in data
+  uint64_t base;     // offset of data[0] in the (decompressed) stream
+  char *buf;         // read buffer for streamed input
+  size_t cap;        // size of buf
+  void *map;         // mapping of the trace file, if mapped
+  size_t map_len;
+  int eof;           // set once the input is exhausted
+  uint32_t skip_fields; // TRACE_FIELD_* left undecoded, see trace_set_fields
+
+  // Decoded records of the text tokenizer, handed out by trace_read
+  branch_record_t *batch;
+  size_t batch_pos;
+  size_t batch_len;
+  uint32_t *delims; // delimiter offsets found by the tokenizer
+
+  // Framed traces
+  const char *image;           // whole framed file, mapped or read in
+  char *owned_image;           // image when it had to be read into memory
+  trace_framed_header_t frame_hdr;
+  const trace_frame_t *frames; // index inside image, NULL if not framed
+  const uint64_t *frame_sums;  // checksum of each frame, NULL before version 3
+  uint64_t next_frame;         // next frame to decode
+  char *scratch;               // decompressed columnar payload
+  size_t scratch_cap;
+
+  // Plain binary traces
+  size_t record_size;          // bytes per stored record
+  size_t data_offset;          // offset of the first record
+  uint64_t num_records;        // records in the trace, ~0 if unknown
+  uint64_t records_left;       // records after the read position
+
+  // Dense PC ids, stored in version 2 and 3 traces or assigned on the fly
+  int has_ids;                 // records carry their id
+  uint32_t num_pcs;            // size of the stored dictionary, for version 3 the ids defined so far
+  uint32_t *pc_dict;           // stored dictionary, NULL if unreadable
+
+  // Version 3 static branch table by id, grown as definitions are read
+  trace_static_entry_t *statics;
+  uint32_t statics_cap;
+  branch_record_t last_rec;    // record before, repeated by a run
+  uint32_t last_id;
+  uint64_t repeat_left;        // copies of it still to hand out
+  pc_map_t *pc_map;            // ids assigned by trace_read_batch_ids
+
+  // Live records of branchExt -shm, a ring slot at a time as data
+  shm_ring_t *shm;
+
+  // Generated records of a synth: path, a buffer at a time
+  synth_t *synth;
+  uint64_t synth_next;         // branch number of the next record to generate
+
+  // Parts of a composed trace, a piece of one at a time as data: the
+  // records where the part holds them
+  struct trace_reader **parts; // those not at their end yet
+  int num_parts;
+  int part;                    // the one being read
+  uint64_t slice;              // records of a part before the next, 0 for all of them
+  uint64_t slice_left;
+  int switch_pending;          // the next piece is of another part
+  uint64_t switches;           // pieces so far that were of another part than the one before
+  branch_record_t *part_batch; // records of a part that can not be viewed
+
+  // Time spent in the readers, in trace_clock_ns units
+  uint64_t read_ns;            // inside trace_read_batch(_ids)
+  uint64_t decompress_ns;      // part of read_ns waiting on bzip2, a codec or the stream
+} trace_reader_t;
+
+// Monotonic clock in nanoseconds, cheap enough to call per batch
+//
+static inline uint64_t trace_clock_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Number of records decoded per text tokenizer batch
+#define TRACE_BATCH 4096
+
+// Number of threads decoding compressed traces (0 for one per core)
+extern int trace_decode_threads;
+
+// Most threads --decode-threads takes
+#define TRACE_DECODE_THREADS_MAX 256
+
+// Map regular trace files instead of reading them through stdio
+extern int trace_use_mmap;
+
+// URING_BUFFERED or URING_DIRECT reads regular trace files through
+// io_uring instead, where it is available, see uring.h
+extern int trace_use_uring;
+
+// Open the trace at 'path' ("-" or NULL reads stdin) and detect its
+// format from the magic header; bzip2, gzip and xz compressed traces
+// are decompressed in-process. ChampSim and BT9 traces are decoded
+// into records as they are read, see foreign.h. A path of
+// synth:<spec>, see synth_parse, generates a binary trace in memory
+// instead. A framed trace at an
+// http://, https:// or s3:// URL is fetched a frame at a time, see
+// remote.h. concat(<a>,<b>,...)
+// reads every part to its end in turn, interleave(<a>,<b>,...[,slice=
+// <n>]) takes n records (default TRACE_COMPOSE_SLICE) of each in turn
+// until all have ended; a part is any of these paths, tried with the
+// suffixes .bin, .bpz and .bz2 when not found. Composed traces hand
+// out the records of the parts without copying and can not seek
+//
+// Returns NULL if the file can not be opened
+//
+trace_reader_t *trace_open(const char *path);
+
+// Attach to the ring /dev/shm/<name> of branchExt -shm as one of its
+// readers and read its records as a binary trace as they are
+// published; it can not seek
+//
+// Returns NULL if there is no such ring or it has all its readers
+//
+trace_reader_t *trace_open_shm(const char *name);
+
+// Decode only the TRACE_FIELD_* 'fields' of the records from here on,
+// where the format allows skipping the others: a columnar framed
+// trace then leaves the target column and the flag planes of the
+// other fields unread, the records holding 0 in their place. The other
+// formats decode everything still
+//
+void trace_set_fields(trace_reader_t *tr, uint32_t fields);
+
+// Read the next record of the trace into 'rec'
+//
+// Returns True if Successful
+//
+int trace_read(trace_reader_t *tr, branch_record_t *rec);
+
+// Read up to 'max' records of the trace into 'recs'
+//
+// Returns the number of records read, 0 at the end of the trace
+//
+size_t trace_read_batch(trace_reader_t *tr, branch_record_t *recs, size_t max);
+
+// Whether the window of the reader is the mapped trace file itself,
+// not bytes decoded from it
+//
+static inline int trace_mapped(const trace_reader_t *tr)
+{
+  return tr->map && !tr->bz2 && !tr->gzxz && !tr->foreign;
+}
+
+// Whether trace_read_view can hand out the records of the trace: a
+// binary trace of plain records
+//
+static inline int trace_can_view(const trace_reader_t *tr)
+{
+  return tr->format == TRACE_FMT_BIN && tr->record_size == sizeof(branch_record_t) && !tr->has_ids;
+}
+
+// Point *recs at up to 'max' next records where they lie, in the
+// mapped file, the decoded frame, the read buffer or the ring slot,
+// without copying them; they stay valid until the next read
+//
+// Returns the number of records, 0 at the end of the trace
+//
+size_t trace_read_view(trace_reader_t *tr, const branch_record_t **recs, size_t max);
+
+// The batched read every consumer of records shares: point *recs at
+// up to 'max' next records where they lie when the trace can be
+// viewed, else decode them into 'buf', which holds 'max' records. The
+// records are the ones trace_set_fields asks for, valid until the next
+// read, and never copied on the view path
+//
+// Returns the number of records, 0 at the end of the trace
+//
+static inline size_t trace_read_span(trace_reader_t *tr, branch_record_t *buf, size_t max,
+                                     const branch_record_t **recs)
+{
+  if (trace_can_view(tr))
+  {
+    return trace_read_view(tr, recs, max);
+  }
+  *recs = buf;
+  return trace_read_batch(tr, buf, max);
+}
+
+// Read up to 'max' records into 'recs' and the dense id of each
+// record's PC into 'ids'; traces without stored ids get them
+// assigned in order of first appearance
+//
+// Returns the number of records read, 0 at the end of the trace
+//
+size_t trace_read_batch_ids(trace_reader_t *tr, branch_record_t *recs, uint32_t *ids, size_t max);
+
+// Number of PC ids known so far, the whole trace for version 2, the
+// defined ones for version 3
+//
+uint32_t trace_num_pcs(trace_reader_t *tr);
+
+// PC of each id, NULL if not available
+//
+const uint32_t *trace_pc_dict(trace_reader_t *tr);
+
+// Full 64-bit PC of 'id' for version 3 traces, the stored 32-bit one
+// otherwise, 0 if not known
+//
+uint64_t trace_pc64(trace_reader_t *tr, uint32_t id);
+
+// Position the reader at branch number 'record' of a binary or
+// framed trace
+//
+// Returns True if Successful, False if the trace can not seek
+//
+int trace_seek(trace_reader_t *tr, uint64_t record);
+
+// Skip the next 'n' records by decoding and dropping them
+//
+// Returns the number of records skipped
+//
+uint64_t trace_skip(trace_reader_t *tr, uint64_t n);
+
+// Return the next raw line of a text trace in [*line, *end), without
+// its newline, and its offset in the decompressed stream
+//
+// Returns True if Successful, False at the end of the trace
+//
+int trace_next_text_line(trace_reader_t *tr, const char **line, const char **end, uint64_t *offset);
+
+// Position a text trace at byte 'offset' of its decompressed stream;
+// bzip2 input needs the decompressed start of each of its 'nblocks'
+// blocks in 'block_starts', as reported by bz2_block_starts
+//
+// Returns True if Successful, False if the trace can not seek
+//
+int trace_seek_stream(trace_reader_t *tr, uint64_t offset, const uint64_t *block_starts, size_t nblocks);
+
+// Close the trace and release the reader
+//
+void trace_close(trace_reader_t *tr);
+
+// Parse the text line [line, end) into 'rec'
+//
+// Returns True if Successful
+//
+int trace_parse_text(const char *line, const char *end, branch_record_t *rec);
+
+// The SIMD kernels of the readers and the variants picked for this
+// host into 'out', see kernels.h
+//
+// Returns the number of kernels
+//
+int trace_kernels(kernel_choice_t *out);
+
+// Bytes of the shortest line of a text trace that holds a record
+#define TRACE_TEXT_LINE_MIN 14
+
+// Copy the next whole lines of a text trace into 'buf', as many as fit
+// in 'cap' bytes; only the last line of the trace may lack its newline
+//
+// Returns the number of bytes copied, 0 at the end of the trace
+//
+size_t trace_read_text_chunk(trace_reader_t *tr, char *buf, size_t cap);
+
+// Decode the text lines in [p, p+n), as trace_read_text_chunk copies
+// them, into up to 'max' records; n / TRACE_TEXT_LINE_MIN + 1 holds
+// them all. It needs no reader, so threads can parse chunks at once
+//
+// Returns the number of records decoded
+//
+size_t trace_parse_text_chunk(const char *p, size_t n, branch_record_t *recs, size_t max);
+
+// Write a binary trace header for 'num_records' records
+//
+// Returns True if Successful
+//
+int trace_write_header(FILE *out, uint64_t num_records);
+
+//------------------------------------//
+//            Trace Writer            //
+//------------------------------------//
+
+typedef struct
+{
+  FILE *out;
+  int codec;               // CODEC_*, or -1 for the plain binary format
+  int layout;              // TRACE_LAYOUT_* of framed traces
+  int level;               // compression level
+  size_t frame_records;
+  branch_record_t *pending; // records of the frame being filled
+  size_t npending;
+  char *comp;              // compression scratch buffer
+  size_t comp_cap;
+  char *encoded;           // columnar encoding of the pending frame
+  pc_map_t *pc_map;        // dense PC ids of version 2 and 3 output
+  int static_out;          // write version 3
+  trace_static_entry_t *statics; // entry defined for each id
+  uint32_t statics_cap;
+  uint32_t num_defined;
+  branch_record_t last;    // record the pending run repeats
+  uint64_t run;            // its repeats not written yet
+  trace_frame_t *index;
+  uint64_t *sums;          // checksum of each frame in the index
+  size_t nframes;
+  size_t index_cap;
+  uint64_t num_records;
+  uint64_t offset;         // file offset of the next frame
+} trace_writer_t;
+
+// Create a binary trace at 'path'; 'codec' -1 writes the plain
+// format, otherwise a framed trace of 'frame_records' record frames
+// in the given TRACE_LAYOUT_*
+//
+// Returns NULL if the file can not be created
+//
+trace_writer_t *trace_writer_open(const char *path, int codec, int layout, int level, size_t frame_records);
+
+// Store a dense PC id with every record and a PC dictionary, plain
+// binary format only; call before the first record
+//
+// Returns True if Successful
+//
+int trace_writer_use_ids(trace_writer_t *tw);
+
+// Write version 3 with the static table, dense PC ids and runs of
+// repeated records, plain binary format only; call before the first
+// record
+//
+// Returns True if Successful
+//
+int trace_writer_use_static(trace_writer_t *tw);
+
+// Append 'n' records
+//
+// Returns True if Successful
+//
+int trace_writer_write(trace_writer_t *tw, const branch_record_t *recs, size_t n);
+
+// Flush the last frame, write the index and header and close the file
+//
+// Returns True if Successful
+//
+int trace_writer_close(trace_writer_t *tw);
+
+#endif
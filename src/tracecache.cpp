@@ -0,0 +1,180 @@
+//========================================================//
+//  tracecache.cpp                                        //
+//  Source file for the decoded trace cache               //
+//                                                        //
+//  Entries are plain binary traces named after a 64-bit  //
+//  hash and the size of the source file. They are        //
+//  written to a temporary file and renamed into place,   //
+//  so concurrent runs never see a partial entry.         //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tracecache.h"
+#include "framecheck.h"
+
+// FNV-1a over 8-byte words, enough to tell trace files apart
+//
+static uint64_t trace_cache_hash(const char *data, size_t len)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8)
+  {
+    uint64_t w;
+    memcpy(&w, data + i, 8);
+    h = (h ^ w) * 0x100000001b3ULL;
+  }
+  for (; i < len; i++)
+  {
+    h = (h ^ (uint8_t)data[i]) * 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// Hash the contents of the regular file 'path'
+//
+// Returns True if Successful
+//
+static int trace_cache_key(const char *path, uint64_t *hash, uint64_t *size)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  struct stat st;
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0)
+  {
+    close(fd);
+    return 0;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    return 0;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  *hash = trace_cache_hash((const char *)map, st.st_size);
+  *size = st.st_size;
+  munmap(map, st.st_size);
+  return 1;
+}
+
+// Decode 'tr' into a new cache entry at 'entry'
+//
+// Returns True if Successful
+//
+static int trace_cache_fill(trace_reader_t *tr, const char *entry)
+{
+  size_t n = strlen(entry);
+  char *tmp = (char *)malloc(n + 32);
+  snprintf(tmp, n + 32, "%s.tmp.%d", entry, (int)getpid());
+  trace_writer_t *tw = trace_writer_open(tmp, -1, TRACE_LAYOUT_ROWS, 0, TRACE_FRAME_RECORDS);
+  if (!tw)
+  {
+    free(tmp);
+    return 0;
+  }
+
+  branch_record_t *batch = (branch_record_t *)malloc(TRACE_BATCH * sizeof(branch_record_t));
+  int ok = batch != NULL;
+  size_t got;
+  const branch_record_t *recs;
+  while (ok && (got = trace_read_span(tr, batch, TRACE_BATCH, &recs)) > 0)
+  {
+    ok = trace_writer_write(tw, recs, got);
+  }
+  ok = trace_writer_close(tw) && ok;
+  ok = ok && rename(tmp, entry) == 0;
+  if (!ok)
+  {
+    remove(tmp);
+  }
+  free(batch);
+  free(tmp);
+  return ok;
+}
+
+// Check the frames of the framed trace 'tr', opened from 'path', the
+// first time it comes through the cache, leaving '<entry>.checked'
+// once they all match so later runs start at once
+//
+// Returns False if a frame is corrupt
+//
+static int trace_cache_check(trace_reader_t *tr, const char *path, const char *dir, const char *entry)
+{
+  size_t n = strlen(entry) + 16;
+  char *stamp = (char *)malloc(n);
+  snprintf(stamp, n, "%s.checked", entry);
+  frame_check_t res;
+  int ok = 1;
+  if (access(stamp, F_OK) != 0 && frame_check(tr, path, 0, &res))
+  {
+    ok = res.corrupt == 0;
+    if (!ok)
+    {
+      fprintf(stderr, "Error: %llu of the %llu frames of %s are corrupt\n", (unsigned long long)res.corrupt,
+              (unsigned long long)res.frames, path);
+    }
+    else
+    {
+      mkdir(dir, 0777);
+      FILE *f = fopen(stamp, "w");
+      if (f)
+      {
+        fclose(f);
+      }
+    }
+  }
+  free(stamp);
+  return ok;
+}
+
+trace_reader_t *trace_cache_open(const char *dir, const char *path)
+{
+  uint64_t hash, size;
+  if (!dir || !*dir || !path || !strcmp(path, "-") || !trace_cache_key(path, &hash, &size))
+  {
+    return trace_open(path);
+  }
+
+  size_t n = strlen(dir) + 64;
+  char *entry = (char *)malloc(n);
+  snprintf(entry, n, "%s/%016llx-%llu.bin", dir, (unsigned long long)hash, (unsigned long long)size);
+  trace_reader_t *tr = NULL;
+  if (access(entry, R_OK) == 0)
+  {
+    tr = trace_open(entry);
+  }
+  if (!tr)
+  {
+    // Miss: decode the source once, binary sources are used as is
+    tr = trace_open(path);
+    if (tr && (tr->format == TRACE_FMT_TEXT || tr->bz2 || tr->gzxz || tr->foreign))
+    {
+      mkdir(dir, 0777);
+      int ok = trace_cache_fill(tr, entry);
+      trace_close(tr);
+      if (!ok)
+      {
+        fprintf(stderr, "Warning: can not write trace cache entry %s (%s)\n", entry, strerror(errno));
+      }
+      tr = trace_open(ok ? entry : path);
+    }
+    else if (tr && !trace_cache_check(tr, path, dir, entry))
+    {
+      trace_close(tr);
+      tr = NULL;
+    }
+  }
+  free(entry);
+  return tr;
+}
@@ -0,0 +1,27 @@
+//========================================================//
+//  tracecache.h                                          //
+//  Header file for the decoded trace cache               //
+//                                                        //
+//  Keeps binary copies of text and .bz2 traces in a      //
+//  cache directory, keyed by the source contents, so     //
+//  repeated replays map the decoded records directly     //
+//========================================================//
+
+#ifndef TRACECACHE_H
+#define TRACECACHE_H
+
+#include "trace.h"
+
+// Environment variable naming the default cache directory
+#define TRACE_CACHE_ENV "BP_TRACE_CACHE"
+
+// Open the trace at 'path' through the cache directory 'dir',
+// decoding it into the cache first if it is not there yet. Binary
+// traces and non-regular files are opened as is, but the frames of a
+// framed trace are checked the first time, see frame_check.
+//
+// Returns NULL if the trace can not be opened or has a corrupt frame
+//
+trace_reader_t *trace_cache_open(const char *dir, const char *path);
+
+#endif
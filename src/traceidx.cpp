@@ -0,0 +1,198 @@
+//========================================================//
+//  traceidx.cpp                                          //
+//  Source file for the branch number index of traces     //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <vector>
+#include "traceidx.h"
+
+// Path of the sidecar index of 'trace_path', to be freed
+//
+static char *trace_index_path(const char *trace_path)
+{
+  size_t n = strlen(trace_path);
+  char *path = (char *)malloc(n + 5);
+  memcpy(path, trace_path, n);
+  memcpy(path + n, ".idx", 5);
+  return path;
+}
+
+// Size and modification time identifying the trace contents
+//
+// Returns True if Successful
+//
+static int trace_index_stat(const char *trace_path, uint64_t *size, uint64_t *mtime)
+{
+  struct stat st;
+  if (stat(trace_path, &st) || !S_ISREG(st.st_mode))
+  {
+    return 0;
+  }
+  *size = st.st_size;
+  *mtime = st.st_mtime;
+  return 1;
+}
+
+trace_index_t *trace_index_load(const char *trace_path)
+{
+  uint64_t size, mtime;
+  if (!trace_index_stat(trace_path, &size, &mtime))
+  {
+    return NULL;
+  }
+  char *path = trace_index_path(trace_path);
+  FILE *in = fopen(path, "rb");
+  free(path);
+  if (!in)
+  {
+    return NULL;
+  }
+
+  trace_index_t *idx = (trace_index_t *)calloc(1, sizeof(trace_index_t));
+  trace_index_header_t *hdr = &idx->hdr;
+  int ok = fread(hdr, sizeof(*hdr), 1, in) == 1 && !memcmp(hdr->magic, TRACE_INDEX_MAGIC, TRACE_MAGIC_LEN) &&
+           hdr->version == TRACE_INDEX_VERSION && hdr->interval > 0 && hdr->source_size == size &&
+           hdr->source_mtime == mtime && hdr->num_entries == (hdr->num_records + hdr->interval - 1) / hdr->interval &&
+           hdr->num_blocks < (1ULL << 32);
+  if (ok)
+  {
+    idx->entries = (uint64_t *)malloc(hdr->num_entries * sizeof(uint64_t) + 1);
+    idx->blocks = (uint64_t *)malloc(hdr->num_blocks * sizeof(uint64_t) + 1);
+    ok = idx->entries && idx->blocks &&
+         fread(idx->entries, sizeof(uint64_t), hdr->num_entries, in) == hdr->num_entries &&
+         fread(idx->blocks, sizeof(uint64_t), hdr->num_blocks, in) == hdr->num_blocks;
+  }
+  fclose(in);
+  if (!ok)
+  {
+    trace_index_free(idx);
+    return NULL;
+  }
+  return idx;
+}
+
+trace_index_t *trace_index_build(const char *trace_path, uint32_t interval)
+{
+  trace_reader_t *tr = trace_open(trace_path);
+  if (!tr)
+  {
+    return NULL;
+  }
+  if (tr->format != TRACE_FMT_TEXT || interval == 0)
+  {
+    trace_close(tr);
+    return NULL;
+  }
+
+  // Count the lines the parser accepts, as the replay does
+  std::vector<uint64_t> entries;
+  uint64_t num_records = 0;
+  const char *line, *end;
+  uint64_t offset;
+  branch_record_t rec;
+  while (trace_next_text_line(tr, &line, &end, &offset))
+  {
+    if (!trace_parse_text(line, end, &rec))
+    {
+      continue;
+    }
+    if (num_records % interval == 0)
+    {
+      entries.push_back(offset);
+    }
+    num_records++;
+  }
+
+  trace_index_t *idx = (trace_index_t *)calloc(1, sizeof(trace_index_t));
+  trace_index_header_t *hdr = &idx->hdr;
+  memcpy(hdr->magic, TRACE_INDEX_MAGIC, TRACE_MAGIC_LEN);
+  hdr->version = TRACE_INDEX_VERSION;
+  hdr->interval = interval;
+  hdr->num_records = num_records;
+  hdr->num_entries = entries.size();
+  hdr->num_blocks = tr->bz2 ? bz2_block_starts(tr->bz2, NULL) : 0;
+  uint64_t size = 0, mtime = 0;
+  trace_index_stat(trace_path, &size, &mtime);
+  hdr->source_size = size;
+  hdr->source_mtime = mtime;
+  idx->entries = (uint64_t *)malloc(entries.size() * sizeof(uint64_t) + 1);
+  memcpy(idx->entries, entries.data(), entries.size() * sizeof(uint64_t));
+  idx->blocks = (uint64_t *)malloc(hdr->num_blocks * sizeof(uint64_t) + 1);
+  if (hdr->num_blocks)
+  {
+    bz2_block_starts(tr->bz2, idx->blocks);
+  }
+  trace_close(tr);
+
+  char *path = trace_index_path(trace_path);
+  FILE *out = fopen(path, "wb");
+  if (out)
+  {
+    int ok = fwrite(hdr, sizeof(*hdr), 1, out) == 1 &&
+             fwrite(idx->entries, sizeof(uint64_t), hdr->num_entries, out) == hdr->num_entries &&
+             fwrite(idx->blocks, sizeof(uint64_t), hdr->num_blocks, out) == hdr->num_blocks;
+    if (fclose(out) || !ok)
+    {
+      remove(path);
+    }
+  }
+  free(path);
+  return idx;
+}
+
+int trace_index_seek(trace_reader_t *tr, const trace_index_t *idx, uint64_t record)
+{
+  if (idx->hdr.num_entries == 0)
+  {
+    // empty trace
+    return 1;
+  }
+  uint64_t entry = record / idx->hdr.interval;
+  if (entry >= idx->hdr.num_entries)
+  {
+    entry = idx->hdr.num_entries - 1;
+  }
+  if (!trace_seek_stream(tr, idx->entries[entry], idx->blocks, idx->hdr.num_blocks))
+  {
+    return 0;
+  }
+  trace_skip(tr, record - entry * idx->hdr.interval);
+  return 1;
+}
+
+void trace_index_free(trace_index_t *idx)
+{
+  if (!idx)
+  {
+    return;
+  }
+  free(idx->entries);
+  free(idx->blocks);
+  free(idx);
+}
+
+void trace_seek_branch(trace_reader_t *tr, const char *trace_path, uint64_t record)
+{
+  if (record == 0 || trace_seek(tr, record))
+  {
+    return;
+  }
+  trace_index_t *idx = NULL;
+  if (tr->format == TRACE_FMT_TEXT && trace_path && strcmp(trace_path, "-"))
+  {
+    idx = trace_index_load(trace_path);
+    if (!idx)
+    {
+      idx = trace_index_build(trace_path, TRACE_INDEX_INTERVAL);
+    }
+  }
+  if (!idx || !trace_index_seek(tr, idx, record))
+  {
+    trace_skip(tr, record);
+  }
+  trace_index_free(idx);
+}
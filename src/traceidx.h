@@ -0,0 +1,72 @@
+//========================================================//
+//  traceidx.h                                            //
+//  Header file for the branch number index of traces     //
+//                                                        //
+//  A sidecar <trace>.idx maps every Nth branch of a      //
+//  text trace to its offset in the decompressed stream   //
+//  so a replay can start in the middle of the trace      //
+//========================================================//
+
+#ifndef TRACEIDX_H
+#define TRACEIDX_H
+
+#include <stdint.h>
+#include "trace.h"
+
+// An index file is a trace_index_header_t, num_entries uint64_t
+// stream offsets of branches 0, interval, 2*interval, ... and the
+// decompressed start of each of the num_blocks bzip2 blocks
+//
+#define TRACE_INDEX_MAGIC "BPINDEX1"
+#define TRACE_INDEX_VERSION 1
+#define TRACE_INDEX_INTERVAL (1 << 16)
+
+typedef struct __attribute__((packed))
+{
+  char magic[TRACE_MAGIC_LEN]; // TRACE_INDEX_MAGIC
+  uint32_t version;            // TRACE_INDEX_VERSION
+  uint32_t interval;           // branches between entries
+  uint64_t num_records;        // branches in the trace
+  uint64_t num_entries;
+  uint64_t num_blocks;         // 0 unless the trace is bzip2
+  uint64_t source_size;        // size and mtime of the indexed trace
+  uint64_t source_mtime;
+} trace_index_header_t;
+
+typedef struct
+{
+  trace_index_header_t hdr;
+  uint64_t *entries;
+  uint64_t *blocks;
+} trace_index_t;
+
+// Load '<trace_path>.idx'
+//
+// Returns NULL if it is missing or older than the trace
+//
+trace_index_t *trace_index_load(const char *trace_path);
+
+// Index the text trace at 'trace_path' every 'interval' branches and
+// write '<trace_path>.idx'; failing to write the file is not an error
+//
+// Returns NULL if the trace is not a text trace
+//
+trace_index_t *trace_index_build(const char *trace_path, uint32_t interval);
+
+// Position the text trace 'tr' at branch number 'record', or at its
+// end if the trace is shorter
+//
+// Returns True if Successful
+//
+int trace_index_seek(trace_reader_t *tr, const trace_index_t *idx, uint64_t record);
+
+void trace_index_free(trace_index_t *idx);
+
+// Position 'tr', opened from 'trace_path', at branch number 'record'
+// by the fastest means available: a direct seek for binary traces,
+// the sidecar index (built on first use) for text traces, decoding
+// and dropping the leading branches otherwise
+//
+void trace_seek_branch(trace_reader_t *tr, const char *trace_path, uint64_t record);
+
+#endif
@@ -0,0 +1,196 @@
+//========================================================//
+//  tracepipe.cpp                                         //
+//  Source file for the asynchronous trace reader         //
+//                                                        //
+//  The ring holds fixed batches. The producer only       //
+//  writes 'head' and each consumer only its own 'tail',  //
+//  so no locks are taken; the producer waits for the     //
+//  lowest tail, and a side that finds the ring full or   //
+//  empty spins briefly and then yields its core.         //
+//========================================================//
+
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include <emmintrin.h>
+#include "tracepipe.h"
+#include "probes.h"
+
+#define TRACE_PIPE_SPIN 256
+
+typedef struct
+{
+  branch_record_t recs[TRACE_BATCH];
+  size_t n;
+} trace_slot_t;
+
+// One consumer's place in the ring, on its own cache line
+typedef struct
+{
+  alignas(64) std::atomic<size_t> tail; // batches it released, ~0 once it left
+  size_t taken;                         // batches handed to it
+} trace_cursor_t;
+
+struct trace_pipe
+{
+  trace_reader_t *tr;
+  trace_slot_t *slots;
+  size_t num_slots;
+  int consumers;
+  alignas(64) std::atomic<size_t> head; // batches produced
+  alignas(64) std::atomic<int> done;    // producer reached the end
+  std::atomic<int> stop;                // consumer asked the producer to quit
+  trace_cursor_t cursors[TRACE_PIPE_CONSUMERS];
+  std::thread reader;
+};
+
+static inline void trace_pipe_wait(int *spins)
+{
+  if (++*spins < TRACE_PIPE_SPIN)
+  {
+    _mm_pause();
+  }
+  else
+  {
+    std::this_thread::yield();
+  }
+}
+
+// Batches released by every consumer still reading, ~0 when none is
+//
+static size_t trace_pipe_released(trace_pipe_t *tp)
+{
+  size_t tail = ~(size_t)0;
+  for (int c = 0; c < tp->consumers; c++)
+  {
+    size_t t = tp->cursors[c].tail.load(std::memory_order_acquire);
+    if (t < tail)
+    {
+      tail = t;
+    }
+  }
+  return tail;
+}
+
+static void trace_pipe_produce(trace_pipe_t *tp)
+{
+  timeline_thread("reader", -1);
+  size_t head = 0;
+  for (;;)
+  {
+    size_t tail = trace_pipe_released(tp);
+    if (tail != ~(size_t)0 && head - tail == tp->num_slots)
+    {
+      BP_TASK_BEGIN("ring full");
+      int spins = 0;
+      while (tail != ~(size_t)0 && head - tail == tp->num_slots)
+      {
+        if (tp->stop.load(std::memory_order_relaxed))
+        {
+          BP_TASK_END();
+          return;
+        }
+        trace_pipe_wait(&spins);
+        tail = trace_pipe_released(tp);
+      }
+      BP_TASK_END();
+    }
+    if (tail == ~(size_t)0)
+    {
+      // every consumer left
+      return;
+    }
+    trace_slot_t *slot = &tp->slots[head % tp->num_slots];
+    BP_TASK_BEGIN("decode");
+    slot->n = trace_read_batch(tp->tr, slot->recs, TRACE_BATCH);
+    BP_TASK_END();
+    if (slot->n == 0)
+    {
+      tp->done.store(1, std::memory_order_release);
+      return;
+    }
+    tp->head.store(++head, std::memory_order_release);
+  }
+}
+
+trace_pipe_t *trace_pipe_start(trace_reader_t *tr)
+{
+  return trace_pipe_start_shared(tr, 1);
+}
+
+trace_pipe_t *trace_pipe_start_shared(trace_reader_t *tr, int consumers)
+{
+  if (consumers < 1 || consumers > TRACE_PIPE_CONSUMERS)
+  {
+    fprintf(stderr, "Error: a trace pipe takes 1 to %d consumers\n", TRACE_PIPE_CONSUMERS);
+    exit(1);
+  }
+  trace_pipe_t *tp = new trace_pipe_t();
+  tp->tr = tr;
+  tp->num_slots = consumers > 1 ? TRACE_PIPE_SHARED_SLOTS : TRACE_PIPE_SLOTS;
+  tp->slots = (trace_slot_t *)malloc(sizeof(trace_slot_t) * tp->num_slots);
+  if (!tp->slots)
+  {
+    fprintf(stderr, "Error: trace pipe malloc failed\n");
+    exit(1);
+  }
+  tp->consumers = consumers;
+  tp->head = 0;
+  tp->done = 0;
+  tp->stop = 0;
+  for (int c = 0; c < consumers; c++)
+  {
+    tp->cursors[c].tail = 0;
+    tp->cursors[c].taken = 0;
+  }
+  tp->reader = std::thread(trace_pipe_produce, tp);
+  return tp;
+}
+
+size_t trace_pipe_next(trace_pipe_t *tp, const branch_record_t **recs)
+{
+  return trace_pipe_next_for(tp, 0, recs);
+}
+
+size_t trace_pipe_next_for(trace_pipe_t *tp, int consumer, const branch_record_t **recs)
+{
+  trace_cursor_t *cur = &tp->cursors[consumer];
+  // Release the batch handed out by the previous call
+  if (cur->taken > cur->tail.load(std::memory_order_relaxed))
+  {
+    cur->tail.store(cur->taken, std::memory_order_release);
+  }
+
+  if (tp->head.load(std::memory_order_acquire) == cur->taken)
+  {
+    BP_TASK_BEGIN("ring empty");
+    int spins = 0;
+    while (tp->head.load(std::memory_order_acquire) == cur->taken)
+    {
+      if (tp->done.load(std::memory_order_acquire) && tp->head.load(std::memory_order_acquire) == cur->taken)
+      {
+        BP_TASK_END();
+        return 0;
+      }
+      trace_pipe_wait(&spins);
+    }
+    BP_TASK_END();
+  }
+  trace_slot_t *slot = &tp->slots[cur->taken % tp->num_slots];
+  cur->taken++;
+  *recs = slot->recs;
+  return slot->n;
+}
+
+void trace_pipe_leave(trace_pipe_t *tp, int consumer)
+{
+  tp->cursors[consumer].tail.store(~(size_t)0, std::memory_order_release);
+}
+
+void trace_pipe_stop(trace_pipe_t *tp)
+{
+  tp->stop.store(1, std::memory_order_relaxed);
+  tp->reader.join();
+  free(tp->slots);
+  delete tp;
+}
@@ -0,0 +1,55 @@
+//========================================================//
+//  tracepipe.h                                           //
+//  Header file for the asynchronous trace reader         //
+//                                                        //
+//  A producer thread decodes record batches into a       //
+//  ring so decoding overlaps with the simulation; with   //
+//  several consumers every one of them reads every       //
+//  batch at its own pace                                 //
+//========================================================//
+
+#ifndef TRACEPIPE_H
+#define TRACEPIPE_H
+
+#include "trace.h"
+
+typedef struct trace_pipe trace_pipe_t;
+
+// Number of batches buffered between the reader and the simulation,
+// and between it and several consumers, which drift further apart
+#define TRACE_PIPE_SLOTS 8
+#define TRACE_PIPE_SHARED_SLOTS 32
+
+// Most consumers of one pipe
+#define TRACE_PIPE_CONSUMERS 16
+
+// Start a reader thread decoding 'tr' in batches of TRACE_BATCH
+// records; 'tr' belongs to the pipe until trace_pipe_stop
+//
+trace_pipe_t *trace_pipe_start(trace_reader_t *tr);
+
+// trace_pipe_start for 'consumers' consumers, numbered from 0, each
+// handed every batch; a slot is reused once the slowest released it
+//
+trace_pipe_t *trace_pipe_start_shared(trace_reader_t *tr, int consumers);
+
+// Wait for the next decoded batch, releasing the previous one
+//
+// Returns the number of records in *recs, 0 at the end of the trace
+//
+size_t trace_pipe_next(trace_pipe_t *tp, const branch_record_t **recs);
+
+// trace_pipe_next for consumer 'consumer' of a shared pipe
+//
+size_t trace_pipe_next_for(trace_pipe_t *tp, int consumer, const branch_record_t **recs);
+
+// Release every batch for consumer 'consumer', which reads no more, so
+// the reader no longer waits for it
+//
+void trace_pipe_leave(trace_pipe_t *tp, int consumer);
+
+// Stop the reader thread and release the ring
+//
+void trace_pipe_stop(trace_pipe_t *tp);
+
+#endif
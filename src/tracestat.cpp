@@ -0,0 +1,254 @@
+//========================================================//
+//  tracestat.cpp                                         //
+//  Source file for the trace statistics sidecar          //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#include "tracestat.h"
+
+#define TRACE_STAT_HLL_SIZE (1 << TRACE_STAT_HLL_BITS)
+#define TRACE_STAT_CM_MASK ((1u << TRACE_STAT_CM_BITS) - 1)
+
+static inline uint64_t trace_stat_hash(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// Add hash 'h' to the registers of a HyperLogLog: the top bits pick
+// the register, which keeps the longest run of leading zeros after them
+static inline void hll_add(uint8_t *regs, uint64_t h)
+{
+  uint32_t r = h >> (64 - TRACE_STAT_HLL_BITS);
+  uint8_t rank = __builtin_clzll(h << TRACE_STAT_HLL_BITS | 1ULL << (TRACE_STAT_HLL_BITS - 1)) + 1;
+  regs[r] = rank > regs[r] ? rank : regs[r];
+}
+
+// Returns the distinct hashes added to 'regs', estimated, with linear
+// counting while registers are still empty
+//
+static uint64_t hll_count(const uint8_t *regs)
+{
+  double m = TRACE_STAT_HLL_SIZE;
+  double sum = 0;
+  int zeros = 0;
+  for (int i = 0; i < TRACE_STAT_HLL_SIZE; i++)
+  {
+    sum += ldexp(1.0, -regs[i]);
+    zeros += !regs[i];
+  }
+  double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  if (e <= 2.5 * m && zeros)
+  {
+    e = m * log(m / zeros);
+  }
+  return (uint64_t)(e + 0.5);
+}
+
+void trace_stat_init(trace_stat_sketch_t *s)
+{
+  memset(s, 0, sizeof(*s));
+  memcpy(s->st.magic, TRACE_STAT_MAGIC, TRACE_MAGIC_LEN);
+  s->st.version = TRACE_STAT_VERSION;
+}
+
+void trace_stat_add(trace_stat_sketch_t *s, const branch_record_t *recs, size_t n)
+{
+  trace_stat_t *st = &s->st;
+  uint32_t masks[TRACE_STAT_HISTORIES];
+  for (int h = 0; h < TRACE_STAT_HISTORIES; h++)
+  {
+    int len = h * TRACE_STAT_HIST_STEP;
+    masks[h] = len ? ~0u >> (32 - len) : 0;
+  }
+  st->records += n;
+  for (size_t i = 0; i < n; i++)
+  {
+    const branch_record_t *r = &recs[i];
+    uint64_t hp = trace_stat_hash(r->pc);
+    hll_add(s->pc_hll, hp);
+    st->returns += TRACE_FLAG(r, TRACE_F_RET);
+    st->calls += TRACE_FLAG(r, TRACE_F_CALL);
+    st->indirect += !(r->flags & (TRACE_F_RET | TRACE_F_DIRECT));
+    if (!TRACE_FLAG(r, TRACE_F_CONDITION))
+    {
+      continue;
+    }
+    uint8_t outcome = TRACE_FLAG(r, TRACE_F_TAKEN);
+    st->conditional++;
+    st->taken += outcome;
+    for (int h = 0; h < TRACE_STAT_HISTORIES; h++)
+    {
+      hll_add(s->pair_hll[h], trace_stat_hash((uint64_t)r->pc << 32 | (s->ghist & masks[h])));
+    }
+
+    // the newest of the PC's cells is its last execution, or a later
+    // one of a PC sharing all of them
+    uint64_t last = ~0ULL;
+    for (int row = 0; row < TRACE_STAT_CM_ROWS; row++)
+    {
+      uint64_t *cell = &s->last[row][(hp >> (row * 16)) & TRACE_STAT_CM_MASK];
+      last = *cell < last ? *cell : last;
+      *cell = s->now + 1;
+    }
+    if (!last)
+    {
+      st->first++;
+    }
+    else
+    {
+      int b = 63 - __builtin_clzll(s->now + 1 - last);
+      st->reuse[b < TRACE_STAT_REUSE_BUCKETS ? b : TRACE_STAT_REUSE_BUCKETS - 1]++;
+    }
+    s->now++;
+    s->ghist = s->ghist << 1 | outcome;
+  }
+}
+
+void trace_stat_finish(trace_stat_sketch_t *s, trace_stat_t *st)
+{
+  *st = s->st;
+  st->pcs = hll_count(s->pc_hll);
+  for (int h = 0; h < TRACE_STAT_HISTORIES; h++)
+  {
+    st->pairs[h] = hll_count(s->pair_hll[h]);
+  }
+  // the estimates of longer histories are never below the shorter ones
+  for (int h = 1; h < TRACE_STAT_HISTORIES; h++)
+  {
+    st->pairs[h] = st->pairs[h] < st->pairs[h - 1] ? st->pairs[h - 1] : st->pairs[h];
+  }
+}
+
+uint64_t trace_stat_pairs(const trace_stat_t *st, int history)
+{
+  int h = (history + TRACE_STAT_HIST_STEP - 1) / TRACE_STAT_HIST_STEP;
+  h = h < 0 ? 0 : h;
+  return st->pairs[h < TRACE_STAT_HISTORIES ? h : TRACE_STAT_HISTORIES - 1];
+}
+
+// Path of the sidecar of 'trace_path', to be freed
+//
+static char *trace_stat_path(const char *trace_path)
+{
+  size_t n = strlen(trace_path);
+  char *path = (char *)malloc(n + 6);
+  memcpy(path, trace_path, n);
+  memcpy(path + n, ".stat", 6);
+  return path;
+}
+
+// Size and modification time identifying the trace contents
+//
+// Returns True if Successful
+//
+static int trace_stat_source(const char *trace_path, uint64_t *size, uint64_t *mtime)
+{
+  struct stat sb;
+  if (stat(trace_path, &sb) || !S_ISREG(sb.st_mode))
+  {
+    return 0;
+  }
+  *size = sb.st_size;
+  *mtime = sb.st_mtime;
+  return 1;
+}
+
+int trace_stat_write(const char *trace_path, trace_stat_t *st)
+{
+  uint64_t size, mtime;
+  if (!trace_stat_source(trace_path, &size, &mtime))
+  {
+    return 0;
+  }
+  st->source_size = size;
+  st->source_mtime = mtime;
+  char *path = trace_stat_path(trace_path);
+  FILE *out = fopen(path, "wb");
+  int ok = out && fwrite(st, sizeof(*st), 1, out) == 1;
+  if (out && (fclose(out) || !ok))
+  {
+    remove(path);
+    ok = 0;
+  }
+  free(path);
+  return ok;
+}
+
+int trace_stat_load(const char *trace_path, trace_stat_t *st)
+{
+  uint64_t size, mtime;
+  if (!trace_stat_source(trace_path, &size, &mtime))
+  {
+    return 0;
+  }
+  char *path = trace_stat_path(trace_path);
+  FILE *in = fopen(path, "rb");
+  free(path);
+  if (!in)
+  {
+    return 0;
+  }
+  int ok = fread(st, sizeof(*st), 1, in) == 1 && !memcmp(st->magic, TRACE_STAT_MAGIC, TRACE_MAGIC_LEN) &&
+           st->version == TRACE_STAT_VERSION && st->source_size == size && st->source_mtime == mtime;
+  fclose(in);
+  return ok;
+}
+
+void trace_stat_print(const trace_stat_t *st, FILE *out)
+{
+  double records = st->records ? (double)st->records : 1.0;
+  fprintf(out, "Records:         %12llu\n", (unsigned long long)st->records);
+  fprintf(out, "Conditional:     %12llu  %6.2f%%, %.2f%% of them taken\n", (unsigned long long)st->conditional,
+          100.0 * st->conditional / records, st->conditional ? 100.0 * st->taken / st->conditional : 0.0);
+  fprintf(out, "Indirect:        %12llu  %6.2f%%, not counting returns\n", (unsigned long long)st->indirect,
+          100.0 * st->indirect / records);
+  fprintf(out, "Calls:           %12llu  %6.2f%%\n", (unsigned long long)st->calls, 100.0 * st->calls / records);
+  fprintf(out, "Returns:         %12llu  %6.2f%%\n", (unsigned long long)st->returns, 100.0 * st->returns / records);
+  fprintf(out, "Branch PCs:      %12llu  estimated\n", (unsigned long long)st->pcs);
+  fprintf(out, "\nWorking set of the conditional branches, estimated\n");
+  fprintf(out, "History     (PC, history) pairs\n");
+  for (int h = 0; h < TRACE_STAT_HISTORIES; h++)
+  {
+    fprintf(out, "%7d %20llu\n", h * TRACE_STAT_HIST_STEP, (unsigned long long)st->pairs[h]);
+  }
+
+  // after the last bucket in use, nothing
+  int used = TRACE_STAT_REUSE_BUCKETS;
+  while (used > 0 && !st->reuse[used - 1])
+  {
+    used--;
+  }
+  uint64_t reused = st->conditional - st->first;
+  fprintf(out, "\nReuse distance, conditional branches since the same PC last ran\n");
+  fprintf(out, "Distance                  Branches    Share  Cumulative\n");
+  uint64_t sum = 0;
+  for (int b = 0; b < used; b++)
+  {
+    char range[32];
+    if (!b)
+    {
+      snprintf(range, sizeof(range), "1");
+    }
+    else if (b == TRACE_STAT_REUSE_BUCKETS - 1)
+    {
+      snprintf(range, sizeof(range), "%llu-", 1ULL << b);
+    }
+    else
+    {
+      snprintf(range, sizeof(range), "%llu-%llu", 1ULL << b, (2ULL << b) - 1);
+    }
+    sum += st->reuse[b];
+    fprintf(out, "%-22s %11llu  %6.2f%%    %6.2f%%\n", range, (unsigned long long)st->reuse[b],
+            reused ? 100.0 * st->reuse[b] / reused : 0.0, reused ? 100.0 * sum / reused : 0.0);
+  }
+  fprintf(out, "First runs             %11llu\n", (unsigned long long)st->first);
+}
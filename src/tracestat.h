@@ -0,0 +1,109 @@
+//========================================================//
+//  tracestat.h                                           //
+//  Header file for the trace statistics sidecar          //
+//                                                        //
+//  bpstat characterizes a trace in one pass with         //
+//  sketches of a fixed size: HyperLogLog counts of the   //
+//  distinct branch PCs and (PC, global history) pairs,   //
+//  and a Count-Min sketch of the last execution of each  //
+//  PC for the reuse distances. A sidecar <trace>.stat    //
+//  keeps the results, and the sweep reads it to skip     //
+//  points whose tables are far larger than the trace     //
+//  needs                                                 //
+//========================================================//
+
+#ifndef TRACESTAT_H
+#define TRACESTAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "trace.h"
+
+#define TRACE_STAT_MAGIC "BPSTATS1"
+#define TRACE_STAT_VERSION 1
+
+// Global history lengths of the (PC, history) working sets: 0, 4, ...
+// 32 outcomes. A length of 0 counts the conditional branch PCs
+#define TRACE_STAT_HIST_STEP 4
+#define TRACE_STAT_HISTORIES 9
+
+// Reuse distances, the conditional branches run since the last run of
+// the same PC, by bucket: bucket b holds distances 2^b to 2^(b+1) - 1,
+// the last one everything longer
+#define TRACE_STAT_REUSE_BUCKETS 40
+
+// HyperLogLog registers, 2^14 of them, for a standard error of 0.8%
+#define TRACE_STAT_HLL_BITS 14
+
+// Count-Min rows and columns. A cell keeps the last execution of the
+// PCs hashed to it, so the newest of a PC's cells is never older than
+// its own last execution and the least of them is the estimate
+#define TRACE_STAT_CM_ROWS 4
+#define TRACE_STAT_CM_BITS 15
+
+// The sidecar, written as is
+typedef struct __attribute__((packed))
+{
+  char magic[TRACE_MAGIC_LEN]; // TRACE_STAT_MAGIC
+  uint32_t version;            // TRACE_STAT_VERSION
+  uint32_t reserved;
+  uint64_t source_size;        // size and mtime of the trace
+  uint64_t source_mtime;
+  uint64_t records;
+  uint64_t conditional;
+  uint64_t taken;              // of the conditional ones
+  uint64_t indirect;           // neither direct nor returns
+  uint64_t returns;
+  uint64_t calls;
+  uint64_t pcs;                // distinct branch PCs, estimated
+  uint64_t pairs[TRACE_STAT_HISTORIES]; // distinct (PC, history) pairs of the conditional branches, estimated
+  uint64_t first;              // conditional branches whose PC had not run before
+  uint64_t reuse[TRACE_STAT_REUSE_BUCKETS]; // the others by reuse distance bucket
+} trace_stat_t;
+
+typedef struct
+{
+  trace_stat_t st;
+  uint32_t ghist;              // newest outcome in bit 0
+  uint64_t now;                // conditional branches so far
+  uint8_t pc_hll[1 << TRACE_STAT_HLL_BITS];
+  uint8_t pair_hll[TRACE_STAT_HISTORIES][1 << TRACE_STAT_HLL_BITS];
+  uint64_t last[TRACE_STAT_CM_ROWS][1 << TRACE_STAT_CM_BITS]; // 1 + branch number of the last execution
+} trace_stat_sketch_t;
+
+// Set up 's' for a trace
+//
+void trace_stat_init(trace_stat_sketch_t *s);
+
+// Add the 'n' records of 'recs', that follow those added before
+//
+void trace_stat_add(trace_stat_sketch_t *s, const branch_record_t *recs, size_t n);
+
+// The statistics of everything added, with the counts estimated from
+// the sketches
+//
+void trace_stat_finish(trace_stat_sketch_t *s, trace_stat_t *st);
+
+// Distinct (PC, history) pairs at the shortest length of the sidecar
+// of at least 'history' outcomes, so no fewer than at 'history'
+//
+uint64_t trace_stat_pairs(const trace_stat_t *st, int history);
+
+// Write 'st' to '<trace_path>.stat', identifying the trace by its size
+// and mtime
+//
+// Returns True if Successful
+//
+int trace_stat_write(const char *trace_path, trace_stat_t *st);
+
+// Load '<trace_path>.stat' into 'st'
+//
+// Returns False if it is missing or older than the trace
+//
+int trace_stat_load(const char *trace_path, trace_stat_t *st);
+
+// Print 'st' as a report to 'out'
+//
+void trace_stat_print(const trace_stat_t *st, FILE *out);
+
+#endif
@@ -0,0 +1,317 @@
+//========================================================//
+//  uring.cpp                                             //
+//  Source file for the io_uring file reader              //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+
+struct uring_reader
+{
+  int fd;        // the caller's
+  int read_fd;   // the one the reads go to, 'fd' reopened with O_DIRECT or 'fd'
+  int ring;
+  uint64_t size; // of the file
+
+  // Rings shared with the kernel
+  void *sq_map, *cq_map, *sqe_map;
+  size_t sq_len, cq_len, sqe_len;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+
+  char *bufs; // URING_DEPTH chunks, one per slot
+  int fixed;  // registered with the kernel
+
+  // Slot s reads the chunk at off[s]; the slots in flight or waiting
+  // to be read are the 'count' from 'head' on, in file order
+  uint64_t off[URING_DEPTH];
+  int64_t res[URING_DEPTH];
+  int pending[URING_DEPTH]; // submitted, completion not seen yet
+  unsigned head;
+  unsigned count;
+  uint64_t next_off; // of the next read to submit
+  size_t used;       // bytes of the head slot handed out or skipped
+};
+
+static int uring_enter(int ring, unsigned submit, unsigned wait)
+{
+  return syscall(__NR_io_uring_enter, ring, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+// Submit reads into every free slot, up to the end of the file
+static void uring_submit(uring_reader_t *ur)
+{
+  unsigned submit = 0;
+  unsigned tail = *ur->sq_tail;
+  while (ur->count < URING_DEPTH && ur->next_off < ur->size)
+  {
+    unsigned s = (ur->head + ur->count) % URING_DEPTH;
+    unsigned i = tail & *ur->sq_mask;
+    struct io_uring_sqe *sqe = &ur->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = ur->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = ur->read_fd;
+    sqe->off = ur->next_off;
+    sqe->addr = (uint64_t)(uintptr_t)(ur->bufs + (size_t)s * URING_CHUNK);
+    sqe->len = URING_CHUNK;
+    sqe->buf_index = s;
+    sqe->user_data = s;
+    ur->sq_array[i] = i;
+    ur->off[s] = ur->next_off;
+    ur->pending[s] = 1;
+    ur->next_off += URING_CHUNK;
+    ur->count++;
+    tail++;
+    submit++;
+  }
+  if (!submit)
+  {
+    return;
+  }
+  __atomic_store_n(ur->sq_tail, tail, __ATOMIC_RELEASE);
+  while (submit)
+  {
+    int k = uring_enter(ur->ring, submit, 0);
+    if (k < 0 && errno != EINTR && errno != EAGAIN)
+    {
+      fprintf(stderr, "Error: io_uring submission failed (%s)\n", strerror(errno));
+      exit(1);
+    }
+    submit -= k > 0 ? k : 0;
+  }
+}
+
+// Take the completions the kernel posted, waiting for one while slot
+// 's' is still pending
+static void uring_reap(uring_reader_t *ur, unsigned s)
+{
+  for (;;)
+  {
+    unsigned head = *ur->cq_head;
+    unsigned tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++)
+    {
+      const struct io_uring_cqe *cqe = &ur->cqes[head & *ur->cq_mask];
+      ur->res[cqe->user_data] = cqe->res;
+      ur->pending[cqe->user_data] = 0;
+    }
+    __atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+    if (!ur->pending[s])
+    {
+      return;
+    }
+    if (uring_enter(ur->ring, 0, 1) < 0 && errno != EINTR)
+    {
+      fprintf(stderr, "Error: io_uring wait failed (%s)\n", strerror(errno));
+      exit(1);
+    }
+  }
+}
+
+// Wait for slot 's' and finish a short read of it with plain reads
+//
+// Returns the bytes of the file in the slot
+//
+static size_t uring_complete(uring_reader_t *ur, unsigned s)
+{
+  uring_reap(ur, s);
+  if (ur->res[s] < 0)
+  {
+    fprintf(stderr, "Error: trace read failed (%s)\n", strerror(-ur->res[s]));
+    exit(1);
+  }
+  uint64_t want = ur->size - ur->off[s] < URING_CHUNK ? ur->size - ur->off[s] : URING_CHUNK;
+  char *buf = ur->bufs + (size_t)s * URING_CHUNK;
+  while ((uint64_t)ur->res[s] < want)
+  {
+    ssize_t k = pread(ur->fd, buf + ur->res[s], want - ur->res[s], ur->off[s] + ur->res[s]);
+    if (k <= 0)
+    {
+      break;
+    }
+    ur->res[s] += k;
+  }
+  ur->res[s] = (uint64_t)ur->res[s] < want ? ur->res[s] : want;
+  return ur->res[s];
+}
+
+// Wait for every read in flight
+static void uring_drain(uring_reader_t *ur)
+{
+  for (unsigned s = 0; s < URING_DEPTH; s++)
+  {
+    if (ur->pending[s])
+    {
+      uring_reap(ur, s);
+    }
+  }
+}
+
+// Reopen 'fd' with O_DIRECT, checking that a read of it works, as
+// some file systems only refuse the reads
+//
+// Returns the new descriptor, -1 if the file can't be read directly
+//
+static int uring_open_direct(int fd, char *probe)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+  int direct = open(path, O_RDONLY | O_DIRECT);
+  if (direct >= 0 && pread(direct, probe, URING_ALIGN, 0) < 0)
+  {
+    close(direct);
+    direct = -1;
+  }
+  return direct;
+}
+
+uring_reader_t *uring_open(int fd, int direct)
+{
+  struct stat st;
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+  {
+    return NULL;
+  }
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int ring = syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+  if (ring < 0)
+  {
+    return NULL;
+  }
+
+  uring_reader_t *ur = (uring_reader_t *)calloc(1, sizeof(uring_reader_t));
+  ur->fd = ur->read_fd = fd;
+  ur->ring = ring;
+  ur->size = st.st_size;
+  ur->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ur->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    ur->sq_len = ur->cq_len = ur->sq_len > ur->cq_len ? ur->sq_len : ur->cq_len;
+  }
+  ur->sqe_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  ur->sq_map = mmap(NULL, ur->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+  ur->cq_map = p.features & IORING_FEAT_SINGLE_MMAP
+                   ? ur->sq_map
+                   : mmap(NULL, ur->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+  ur->sqe_map = mmap(NULL, ur->sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+  if (posix_memalign((void **)&ur->bufs, URING_ALIGN, (size_t)URING_DEPTH * URING_CHUNK))
+  {
+    ur->bufs = NULL;
+  }
+  if (ur->sq_map == MAP_FAILED || ur->cq_map == MAP_FAILED || ur->sqe_map == MAP_FAILED || !ur->bufs)
+  {
+    ur->sq_map = ur->sq_map == MAP_FAILED ? NULL : ur->sq_map;
+    ur->cq_map = ur->cq_map == MAP_FAILED ? NULL : ur->cq_map;
+    ur->sqe_map = ur->sqe_map == MAP_FAILED ? NULL : ur->sqe_map;
+    uring_close(ur);
+    return NULL;
+  }
+  char *sq = (char *)ur->sq_map, *cq = (char *)ur->cq_map;
+  ur->sq_head = (unsigned *)(sq + p.sq_off.head);
+  ur->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ur->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  ur->sq_array = (unsigned *)(sq + p.sq_off.array);
+  ur->cq_head = (unsigned *)(cq + p.cq_off.head);
+  ur->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  ur->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  ur->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  ur->sqes = (struct io_uring_sqe *)ur->sqe_map;
+
+  // Registered buffers need locked memory, plain reads do without
+  struct iovec iov[URING_DEPTH];
+  for (int s = 0; s < URING_DEPTH; s++)
+  {
+    iov[s].iov_base = ur->bufs + (size_t)s * URING_CHUNK;
+    iov[s].iov_len = URING_CHUNK;
+  }
+  ur->fixed = !syscall(__NR_io_uring_register, ring, IORING_REGISTER_BUFFERS, iov, URING_DEPTH);
+
+  if (direct)
+  {
+    int d = uring_open_direct(fd, ur->bufs);
+    if (d < 0)
+    {
+      fprintf(stderr, "Warning: the trace can't be read with O_DIRECT, reading it through the page cache\n");
+    }
+    ur->read_fd = d < 0 ? fd : d;
+  }
+  uring_submit(ur);
+  return ur;
+}
+
+size_t uring_read(uring_reader_t *ur, char *dst, size_t cap)
+{
+  size_t got = 0;
+  while (got < cap && ur->count)
+  {
+    unsigned s = ur->head;
+    size_t len = uring_complete(ur, s);
+    size_t n = len > ur->used ? len - ur->used : 0;
+    n = n < cap - got ? n : cap - got;
+    memcpy(dst + got, ur->bufs + (size_t)s * URING_CHUNK + ur->used, n);
+    got += n;
+    ur->used += n;
+    if (ur->used >= len)
+    {
+      ur->head = (ur->head + 1) % URING_DEPTH;
+      ur->count--;
+      ur->used = 0;
+      uring_submit(ur);
+    }
+  }
+  return got;
+}
+
+void uring_seek(uring_reader_t *ur, uint64_t offset)
+{
+  uring_drain(ur);
+  ur->count = 0;
+  ur->next_off = offset & ~(uint64_t)(URING_ALIGN - 1);
+  ur->used = offset - ur->next_off;
+  uring_submit(ur);
+}
+
+void uring_close(uring_reader_t *ur)
+{
+  if (!ur)
+  {
+    return;
+  }
+  if (ur->sqes)
+  {
+    uring_drain(ur);
+  }
+  if (ur->sqe_map)
+  {
+    munmap(ur->sqe_map, ur->sqe_len);
+  }
+  if (ur->cq_map && ur->cq_map != ur->sq_map)
+  {
+    munmap(ur->cq_map, ur->cq_len);
+  }
+  if (ur->sq_map)
+  {
+    munmap(ur->sq_map, ur->sq_len);
+  }
+  close(ur->ring);
+  if (ur->read_fd != ur->fd)
+  {
+    close(ur->read_fd);
+  }
+  free(ur->bufs);
+  free(ur);
+}
@@ -0,0 +1,53 @@
+//========================================================//
+//  uring.h                                               //
+//  Header file for the io_uring file reader              //
+//                                                        //
+//  Reads a file front to back with URING_DEPTH reads of  //
+//  URING_CHUNK bytes kept in flight ahead of the reader, //
+//  into aligned buffers registered with the kernel, and  //
+//  optionally with O_DIRECT, so that a decoder fed from  //
+//  NVMe or NFS does not wait on one read at a time. The  //
+//  ring is set up with system calls, without liburing    //
+//========================================================//
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define URING_DEPTH 8           // reads in flight
+#define URING_CHUNK (1 << 20)   // bytes per read
+#define URING_ALIGN 4096        // of the buffers and O_DIRECT offsets
+
+// Values of trace_use_uring, see trace.h
+#define URING_OFF 0
+#define URING_BUFFERED 1
+#define URING_DIRECT 2
+
+typedef struct uring_reader uring_reader_t;
+
+// Start reading the regular file open as 'fd' from its beginning,
+// bypassing the page cache with 'direct' where the file system allows
+// it. 'fd' stays owned by the caller and must stay open
+//
+// Returns NULL if 'fd' is not a regular file or io_uring is
+// unavailable, and the caller reads it some other way
+//
+uring_reader_t *uring_open(int fd, int direct);
+
+// Copy up to 'cap' next bytes of the file into 'dst', in order
+//
+// Returns the number of bytes copied, 0 at the end of the file
+//
+size_t uring_read(uring_reader_t *ur, char *dst, size_t cap);
+
+// Continue reading at byte 'offset', dropping the reads in flight
+//
+void uring_seek(uring_reader_t *ur, uint64_t offset);
+
+// Wait for the reads in flight and release the ring
+//
+void uring_close(uring_reader_t *ur);
+
+#endif
@@ -0,0 +1,195 @@
+//========================================================//
+//  verify.cpp                                            //
+//  Source file for the reference check of the replay     //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "verify.h"
+
+int verify_init(verify_t *v, predictor_t *const *predictors, const char *const *names, int n,
+                uint64_t state_every)
+{
+  memset(v, 0, sizeof(*v));
+  v->n = n;
+  v->predictors = predictors;
+  v->state_every = state_every;
+  v->next_state = state_every;
+  for (int p = 0; p < n; p++)
+  {
+    size_t len = predictor_state_size(predictors[p]);
+    v->state_len = len > v->state_len ? len : v->state_len;
+  }
+  v->state[0] = (uint8_t *)malloc(v->state_len ? v->state_len : 1);
+  v->state[1] = (uint8_t *)malloc(v->state_len ? v->state_len : 1);
+  if (!v->state[0] || !v->state[1])
+  {
+    return 0;
+  }
+
+  // The twins start from the predictors' state, as of --load-state
+  for (int p = 0; p < n; p++)
+  {
+    v->names[p] = names[p];
+    predictor_save_state(predictors[p], v->state[0]);
+    v->ref[p] = predictor_load_state(predictor_config(predictors[p]), v->state[0],
+                                     predictor_state_size(predictors[p]));
+    if (!v->ref[p])
+    {
+      return 0;
+    }
+    v->images[p] = predictor_snapshot(v->ref[p]);
+  }
+  return 1;
+}
+
+// One record through a twin the way the simulator's own driver takes
+// it, predicting a conditional branch before training on it
+//
+static inline uint32_t verify_step(predictor_t *p, const branch_record_t *r)
+{
+  uint32_t flags = r->flags;
+  uint32_t condition = (flags & TRACE_F_CONDITION) != 0;
+  uint32_t pred = condition ? predictor_predict(p, r->pc, r->target, (flags & TRACE_F_DIRECT) != 0) : NOTTAKEN;
+  predictor_train(p, r->pc, r->target, (flags & TRACE_F_TAKEN) != 0, condition, (flags & TRACE_F_CALL) != 0,
+                  (flags & TRACE_F_RET) != 0, (flags & TRACE_F_DIRECT) != 0);
+  return pred;
+}
+
+void verify_warmup(verify_t *v, const branch_record_t *recs, size_t n)
+{
+  for (int p = 0; p < v->n; p++)
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      verify_step(v->ref[p], &recs[i]);
+    }
+  }
+}
+
+static void verify_print_record(const branch_record_t *r, uint64_t index, const char *mark)
+{
+  fprintf(stderr, "  %s%12llu  pc %08x  target %08x  %-4s %s%s%s\n", mark, (unsigned long long)index, r->pc,
+          r->target, r->flags & TRACE_F_CONDITION ? "cond" : "unc", r->flags & TRACE_F_TAKEN ? "taken" : "not taken",
+          r->flags & TRACE_F_CALL ? " call" : "", r->flags & TRACE_F_RET ? " ret" : "");
+}
+
+// Print the records around record i of the batch, counting from
+// 'first', with the ones of the previous batch kept in v->tail
+//
+static void verify_print_context(const verify_t *v, const branch_record_t *recs, size_t n, size_t i,
+                                 uint64_t first)
+{
+  size_t back = i < VERIFY_CONTEXT ? VERIFY_CONTEXT - i : 0;
+  back = back < v->tail_len ? back : v->tail_len;
+  for (size_t k = v->tail_len - back; k < v->tail_len; k++)
+  {
+    verify_print_record(&v->tail[k], first - (v->tail_len - k), "  ");
+  }
+  size_t lo = i < VERIFY_CONTEXT ? 0 : i - VERIFY_CONTEXT;
+  size_t hi = i + VERIFY_CONTEXT < n ? i + VERIFY_CONTEXT + 1 : n;
+  for (size_t k = lo; k < hi; k++)
+  {
+    verify_print_record(&recs[k], first + k, k == i ? "> " : "  ");
+  }
+}
+
+// Compare the saved tables of predictor p and its twin
+//
+// Returns True if they are the same
+//
+static int verify_state(verify_t *v, int p, uint64_t branch)
+{
+  size_t len = predictor_state_size(v->predictors[p]);
+  predictor_save_state(v->predictors[p], v->state[0]);
+  predictor_save_state(v->ref[p], v->state[1]);
+  if (!memcmp(v->state[0], v->state[1], len))
+  {
+    return 1;
+  }
+  size_t at = 0;
+  while (v->state[0][at] == v->state[1][at])
+  {
+    at++;
+  }
+  fprintf(stderr, "Verify: the %s state differs from the reference after %llu conditional branches,\n",
+          v->names[p], (unsigned long long)branch);
+  fprintf(stderr, "  first at byte %zu of %zu (%02x, reference %02x); they matched after %llu\n", at, len,
+          v->state[0][at], v->state[1][at], (unsigned long long)v->last_state);
+  return 0;
+}
+
+int verify_batch(verify_t *v, const branch_record_t *recs, size_t n, uint64_t first,
+                 const uint64_t *const *predictions)
+{
+  uint64_t cond = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    cond += (recs[i].flags & TRACE_F_CONDITION) != 0;
+  }
+  for (int p = 0; p < v->n; p++)
+  {
+    uint64_t branch = v->branches;
+    for (size_t i = 0; i < n; i++)
+    {
+      uint32_t pred = verify_step(v->ref[p], &recs[i]);
+      if (!(recs[i].flags & TRACE_F_CONDITION))
+      {
+        continue;
+      }
+      uint32_t got = (predictions[p][i / 64] >> (i % 64)) & 1;
+      if (got != pred)
+      {
+        fprintf(stderr, "Verify: the %s predictor diverges from the reference at record %llu,"
+                        " conditional branch %llu:\n",
+                v->names[p], (unsigned long long)(first + i), (unsigned long long)branch);
+        fprintf(stderr, "  predicted %s, the reference %s\n", got ? "taken" : "not taken",
+                pred ? "taken" : "not taken");
+        verify_print_context(v, recs, n, i, first);
+        return 0;
+      }
+      branch++;
+    }
+  }
+  v->branches += cond;
+
+  // Compare the tables once per batch that reaches the next point
+  if (v->state_every && v->branches >= v->next_state)
+  {
+    for (int p = 0; p < v->n; p++)
+    {
+      if (!verify_state(v, p, v->branches))
+      {
+        return 0;
+      }
+    }
+    v->states++;
+    v->last_state = v->branches;
+    v->next_state = v->branches + v->state_every;
+  }
+
+  v->tail_len = n < VERIFY_CONTEXT ? n : VERIFY_CONTEXT;
+  memcpy(v->tail, recs + n - v->tail_len, v->tail_len * sizeof(branch_record_t));
+  return 1;
+}
+
+void verify_restart(verify_t *v)
+{
+  for (int p = 0; p < v->n; p++)
+  {
+    predictor_restore(v->ref[p], v->images[p]);
+  }
+  v->tail_len = 0;
+}
+
+void verify_free(verify_t *v)
+{
+  for (int p = 0; p < v->n; p++)
+  {
+    predictor_snapshot_free(v->images[p]);
+    predictor_destroy(v->ref[p]);
+  }
+  free(v->state[0]);
+  free(v->state[1]);
+}
@@ -0,0 +1,71 @@
+//========================================================//
+//  verify.h                                              //
+//  Header file for the reference check of the replay     //
+//                                                        //
+//  With --verify-against=reference every predictor has   //
+//  a twin stepped one branch at a time through           //
+//  predictor_predict and predictor_train, the scalar     //
+//  path, on the records the batched or shared-history    //
+//  kernels replay. Each conditional prediction of the    //
+//  two is compared and, every so many branches, their    //
+//  saved tables, and the first divergence is reported    //
+//  with the records around it                            //
+//========================================================//
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+#include "predictor.h"
+#include "trace.h"
+
+#define VERIFY_CONTEXT 8  // records printed on each side of a divergence
+
+typedef struct
+{
+  int n;
+  predictor_t *const *predictors;    // the replayed ones
+  predictor_t *ref[NUM_BP_TYPES];    // and their twins
+  predictor_snapshot_t *images[NUM_BP_TYPES]; // of the twins, for verify_restart
+  const char *names[NUM_BP_TYPES];
+  uint64_t state_every;              // branches between state compares, 0 for none
+  uint64_t next_state;               // branch count of the next one
+  uint8_t *state[2];                 // saved tables, replayed and twin
+  size_t state_len;                  // bytes of each
+  uint64_t branches;                 // conditional branches compared
+  uint64_t states;                   // state compares passed
+  uint64_t last_state;               // branch count of the last one
+  branch_record_t tail[VERIFY_CONTEXT]; // last records of the previous batch
+  size_t tail_len;
+} verify_t;
+
+// Create the twins of the 'n' predictors, named 'names', in their
+// current state, comparing their tables every 'state_every'
+// conditional branches, 0 for never
+//
+// Returns True if Successful
+//
+int verify_init(verify_t *v, predictor_t *const *predictors, const char *const *names, int n,
+                uint64_t state_every);
+
+// Train the twins on 'n' warmup records
+//
+void verify_warmup(verify_t *v, const branch_record_t *recs, size_t n);
+
+// Step the twins over the 'n' records the predictors just replayed,
+// the first being record 'first' of the trace, and compare with
+// predictions[p], the bitmaps predictor_predict_batch filled in
+//
+// Returns True if they all agree, else prints the first divergence
+//
+int verify_batch(verify_t *v, const branch_record_t *recs, size_t n, uint64_t first,
+                 const uint64_t *const *predictions);
+
+// Put the twins back to their state at verify_init, with the
+// predictors at --compose-flush
+//
+void verify_restart(verify_t *v);
+
+void verify_free(verify_t *v);
+
+#endif
@@ -0,0 +1,219 @@
+//========================================================//
+//  xxh3.h                                                //
+//  Header file for the XXH3 64-bit hash                  //
+//                                                        //
+//  XXH3_64bits of xxHash 0.8 with its default secret and //
+//  seed 0, bit for bit, so a frame checksum can be       //
+//  checked with xxhsum -H3 as well. Long inputs hash in  //
+//  8 independent lanes the compiler vectorizes, several  //
+//  GB/s a core                                           //
+//========================================================//
+
+#ifndef XXH3_H
+#define XXH3_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define XXH3_PRIME32_1 0x9E3779B1U
+#define XXH3_PRIME32_2 0x85EBCA77U
+#define XXH3_PRIME32_3 0xC2B2AE3DU
+#define XXH3_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH3_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH3_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH3_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH3_PRIME64_5 0x27D4EB2F165667C5ULL
+#define XXH3_PRIME_MX1 0x165667919E3779F9ULL
+#define XXH3_PRIME_MX2 0x9FB21C651E98DF25ULL
+
+#define XXH3_SECRET_SIZE 192
+#define XXH3_STRIPE 64     // bytes of input per accumulation
+#define XXH3_SECRET_STEP 8 // bytes of secret each stripe moves on
+
+static const uint8_t xxh3_secret[XXH3_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+// Little endian loads, as the hosts all are
+static inline uint64_t xxh3_read64(const uint8_t *p)
+{
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static inline uint32_t xxh3_read32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static inline uint64_t xxh3_rotl64(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+// The high and low halves of the 128-bit product, xored
+static inline uint64_t xxh3_mul_fold(uint64_t a, uint64_t b)
+{
+  __uint128_t p = (__uint128_t)a * b;
+  return (uint64_t)p ^ (uint64_t)(p >> 64);
+}
+
+static inline uint64_t xxh3_avalanche(uint64_t h)
+{
+  h ^= h >> 37;
+  h *= XXH3_PRIME_MX1;
+  return h ^ (h >> 32);
+}
+
+// The final mix of XXH64
+static inline uint64_t xxh3_avalanche64(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= XXH3_PRIME64_2;
+  h ^= h >> 29;
+  h *= XXH3_PRIME64_3;
+  return h ^ (h >> 32);
+}
+
+static inline uint64_t xxh3_rrmxmx(uint64_t h, uint64_t len)
+{
+  h ^= xxh3_rotl64(h, 49) ^ xxh3_rotl64(h, 24);
+  h *= XXH3_PRIME_MX2;
+  h ^= (h >> 35) + len;
+  h *= XXH3_PRIME_MX2;
+  return h ^ (h >> 28);
+}
+
+static inline uint64_t xxh3_mix16(const uint8_t *p, const uint8_t *secret)
+{
+  return xxh3_mul_fold(xxh3_read64(p) ^ xxh3_read64(secret), xxh3_read64(p + 8) ^ xxh3_read64(secret + 8));
+}
+
+// Up to 16 bytes
+static inline uint64_t xxh3_short(const uint8_t *p, size_t len)
+{
+  const uint8_t *s = xxh3_secret;
+  if (len > 8)
+  {
+    uint64_t lo = xxh3_read64(p) ^ (xxh3_read64(s + 24) ^ xxh3_read64(s + 32));
+    uint64_t hi = xxh3_read64(p + len - 8) ^ (xxh3_read64(s + 40) ^ xxh3_read64(s + 48));
+    return xxh3_avalanche(len + __builtin_bswap64(lo) + hi + xxh3_mul_fold(lo, hi));
+  }
+  if (len >= 4)
+  {
+    uint64_t in = xxh3_read32(p + len - 4) + ((uint64_t)xxh3_read32(p) << 32);
+    return xxh3_rrmxmx(in ^ (xxh3_read64(s + 8) ^ xxh3_read64(s + 16)), len);
+  }
+  if (len)
+  {
+    uint32_t combined = ((uint32_t)p[0] << 16) | ((uint32_t)p[len >> 1] << 24) | p[len - 1] | ((uint32_t)len << 8);
+    return xxh3_avalanche64(combined ^ (uint64_t)(xxh3_read32(s) ^ xxh3_read32(s + 4)));
+  }
+  return xxh3_avalanche64(xxh3_read64(s + 56) ^ xxh3_read64(s + 64));
+}
+
+// 17 to 240 bytes
+static inline uint64_t xxh3_mid(const uint8_t *p, size_t len)
+{
+  const uint8_t *s = xxh3_secret;
+  uint64_t acc = len * XXH3_PRIME64_1;
+  if (len <= 128)
+  {
+    for (size_t i = 0; i <= (len - 1) / 32; i++)
+    {
+      acc += xxh3_mix16(p + 16 * i, s + 32 * i);
+      acc += xxh3_mix16(p + len - 16 * (i + 1), s + 32 * i + 16);
+    }
+    return xxh3_avalanche(acc);
+  }
+  for (size_t i = 0; i < 8; i++)
+  {
+    acc += xxh3_mix16(p + 16 * i, s + 16 * i);
+  }
+  acc = xxh3_avalanche(acc);
+  uint64_t end = xxh3_mix16(p + len - 16, s + 136 - 17);
+  for (size_t i = 8; i < len / 16; i++)
+  {
+    end += xxh3_mix16(p + 16 * i, s + 16 * (i - 8) + 3);
+  }
+  return xxh3_avalanche(acc + end);
+}
+
+static inline void xxh3_accumulate(uint64_t *acc, const uint8_t *p, const uint8_t *secret)
+{
+  for (int i = 0; i < 8; i++)
+  {
+    uint64_t v = xxh3_read64(p + 8 * i);
+    uint64_t k = v ^ xxh3_read64(secret + 8 * i);
+    acc[i ^ 1] += v;
+    acc[i] += (uint64_t)(uint32_t)k * (k >> 32);
+  }
+}
+
+static inline void xxh3_scramble(uint64_t *acc, const uint8_t *secret)
+{
+  for (int i = 0; i < 8; i++)
+  {
+    uint64_t a = acc[i];
+    a ^= a >> 47;
+    a ^= xxh3_read64(secret + 8 * i);
+    acc[i] = a * XXH3_PRIME32_1;
+  }
+}
+
+// Over 240 bytes: blocks of 16 stripes, each moving along the secret,
+// with a scramble between blocks
+static inline uint64_t xxh3_long(const uint8_t *p, size_t len)
+{
+  const uint8_t *s = xxh3_secret;
+  uint64_t acc[8] = {XXH3_PRIME32_3, XXH3_PRIME64_1, XXH3_PRIME64_2, XXH3_PRIME64_3,
+                     XXH3_PRIME64_4, XXH3_PRIME32_2, XXH3_PRIME64_5, XXH3_PRIME32_1};
+  const size_t stripes = (XXH3_SECRET_SIZE - XXH3_STRIPE) / XXH3_SECRET_STEP;
+  const size_t block = XXH3_STRIPE * stripes;
+  size_t blocks = (len - 1) / block;
+  for (size_t b = 0; b < blocks; b++)
+  {
+    for (size_t n = 0; n < stripes; n++)
+    {
+      xxh3_accumulate(acc, p + b * block + n * XXH3_STRIPE, s + n * XXH3_SECRET_STEP);
+    }
+    xxh3_scramble(acc, s + XXH3_SECRET_SIZE - XXH3_STRIPE);
+  }
+  size_t last = ((len - 1) - block * blocks) / XXH3_STRIPE;
+  for (size_t n = 0; n < last; n++)
+  {
+    xxh3_accumulate(acc, p + blocks * block + n * XXH3_STRIPE, s + n * XXH3_SECRET_STEP);
+  }
+  xxh3_accumulate(acc, p + len - XXH3_STRIPE, s + XXH3_SECRET_SIZE - XXH3_STRIPE - 7);
+
+  uint64_t h = len * XXH3_PRIME64_1;
+  for (int i = 0; i < 4; i++)
+  {
+    h += xxh3_mul_fold(acc[2 * i] ^ xxh3_read64(s + 11 + 16 * i), acc[2 * i + 1] ^ xxh3_read64(s + 11 + 16 * i + 8));
+  }
+  return xxh3_avalanche(h);
+}
+
+// XXH3_64bits(data, len)
+static inline uint64_t xxh3_64(const void *data, size_t len)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  return len <= 16 ? xxh3_short(p, len) : len <= 240 ? xxh3_mid(p, len) : xxh3_long(p, len);
+}
+
+#endif